@@ -6,7 +6,7 @@ import numpy as np
 from gymnasium.spaces import Discrete
 
 # noinspection PyUnresolvedReferences
-from megaverse.extension.megaverse import MegaverseGym, set_megaverse_log_level
+from megaverse.extension.megaverse import MegaverseGym, set_megaverse_log_level, bake_episode_dataset as _bake_episode_dataset
 
 
 MEGAVERSE8 = [
@@ -25,24 +25,222 @@ OBSTACLES_MULTITASK = [
 ]
 
 
-def make_env_multitask(multitask_name, task_idx, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan=False, params=None):
+def bake_episode_dataset(scenario_name, num_agents_per_env, num_episodes, filename, seed=0, params=None):
+    """
+    Generate the layouts of num_episodes episodes offline into a file for MegaverseEnv(episode_dataset=filename).
+    The dataset only fits envs with the same scenario, number of agents and params.
+    """
+    float_params = {k: float(v) for k, v in (params or {}).items()}
+    return _bake_episode_dataset(scenario_name.casefold(), num_agents_per_env, float_params, seed, num_episodes, filename)
+
+
+def multitask_scenarios(multitask_name):
     assert 'multitask' in multitask_name
     if multitask_name.endswith('megaverse8'):
-        tasks = MEGAVERSE8
+        return MEGAVERSE8
     elif multitask_name.endswith('obstacles'):
-        tasks = OBSTACLES_MULTITASK
+        return OBSTACLES_MULTITASK
     else:
         raise NotImplementedError()
 
+
+def make_env_multitask(multitask_name, task_idx, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan=False, params=None, render_gpus=None,
+                       shared_runtime=False):
+    """
+    With shared_runtime the gyms of all tasks created with the same arguments are slices of one multi-task batch
+    (one thread pool and one renderer in the process), see MegaverseRuntime.
+    """
+    tasks = multitask_scenarios(multitask_name)
+
     scenario_idx = task_idx % len(tasks)
     scenario = tasks[scenario_idx]
     print('Multi-task, scenario', scenario_idx, scenario)
-    return MegaverseEnv(scenario, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan, params)
+    if shared_runtime:
+        runtime = shared_multitask_runtime(multitask_name, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan, params, render_gpus)
+        return runtime.slice(scenario_idx)
+
+    return MegaverseEnv(scenario, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan, params, render_gpus)
+
+
+def make_env_multitask_batch(multitask_name, num_envs_per_task, num_agents_per_env, num_simulation_threads, use_vulkan=False, params=None, render_gpus=None):
+    """All tasks in one MegaverseEnv, rendered in a single batch. env_scenarios() tells which task each env runs."""
+    tasks = multitask_scenarios(multitask_name)
+    num_envs = num_envs_per_task * len(tasks)
+    return MegaverseEnv(tasks, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan, params, render_gpus)
+
+
+# runtimes of make_env_multitask(shared_runtime=True) in this process, by their arguments
+_shared_runtimes = {}
+
+
+def shared_multitask_runtime(multitask_name, num_envs_per_task, num_agents_per_env, num_simulation_threads, use_vulkan=False, params=None, render_gpus=None):
+    params_key = tuple(sorted((params or {}).items()))
+    key = (multitask_name, num_envs_per_task, num_agents_per_env, num_simulation_threads, use_vulkan, params_key, tuple(render_gpus or ()))
+    if key not in _shared_runtimes:
+        tasks = multitask_scenarios(multitask_name)
+        _shared_runtimes[key] = MegaverseRuntime(key, tasks, num_envs_per_task, num_agents_per_env, num_simulation_threads, use_vulkan, params, render_gpus)
+
+    return _shared_runtimes[key]
+
+
+class MegaverseRuntime:
+    """
+    Multi-task batch (see make_env_multitask_batch()) shared by the gyms of its tasks, each task is a MegaverseEnvSlice
+    over its contiguous block of envs. step_async() of several slices followed by their step_wait() steps all of them
+    at once: one step of the whole batch with a single render if every task has a slice and all of them submitted,
+    otherwise the envs of the submitted slices go through the asynchronous pool (send()/recv()) together.
+    Closed with its last slice.
+    """
+
+    def __init__(self, key, tasks, num_envs_per_task, num_agents_per_env, num_simulation_threads, use_vulkan=False, params=None, render_gpus=None):
+        self.key = key
+        self.tasks = tasks
+        self.num_envs_per_task = num_envs_per_task
+        self.env = MegaverseEnv(tasks, num_envs_per_task * len(tasks), num_agents_per_env, num_simulation_threads, use_vulkan, params, render_gpus)
+        self.num_agents_per_task = num_envs_per_task * num_agents_per_env
+
+        self.slices = {}
+        self.started = False
+
+        # per task: actions submitted by step_async(), results of the last fused step until step_wait() takes them
+        self._pending = {}
+        self._results = {}
+
+    def slice(self, task_idx):
+        if task_idx in self.slices:
+            raise ValueError(f'Task {task_idx} ({self.tasks[task_idx]}) already has a gym in the shared runtime')
+
+        self.slices[task_idx] = MegaverseEnvSlice(self, task_idx)
+        return self.slices[task_idx]
+
+    def agents(self, task_idx):
+        return task_idx * self.num_agents_per_task, (task_idx + 1) * self.num_agents_per_task
+
+    def reset(self, task_idx):
+        # envs auto-reset, the batch is reset once for all slices
+        if not self.started:
+            self.env.reset()
+            self.started = True
+
+        first, last = self.agents(task_idx)
+        return self.env.observations()[first:last]
+
+    def submit(self, task_idx, actions):
+        if task_idx in self._pending or task_idx in self._results:
+            raise RuntimeError(f'Task {task_idx} stepped again before its step_wait()')
+        self._pending[task_idx] = actions
+
+    def result(self, task_idx):
+        if task_idx in self._pending:
+            self._step_pending()
+        return self._results.pop(task_idx)
+
+    def _step_pending(self):
+        tasks = sorted(self._pending)
+        actions = np.concatenate([self._pending[t] for t in tasks])
+        self._pending.clear()
+
+        if len(tasks) == len(self.tasks):
+            obs, rewards, dones, infos = self.env.step(actions)
+            for t in tasks:
+                first, last = self.agents(t)
+                self._results[t] = obs[first:last], rewards[first:last], dones[first:last], infos[first:last]
+            return
+
+        n = self.num_envs_per_task
+        env_ids = np.concatenate([np.arange(t * n, (t + 1) * n) for t in tasks])
+        self.env.send(env_ids, actions)
+
+        # envs come back in any order, sorted they are the blocks of the tasks again
+        received, obs, rewards, dones = self.env.recv(len(env_ids))
+        agents_per_env = self.env.num_agents_per_env
+        order = (np.argsort(received)[:, None] * agents_per_env + np.arange(agents_per_env)).reshape(-1)
+        obs, rewards, dones = obs[order], rewards[order], dones[order]
+
+        for i, t in enumerate(tasks):
+            first, last = self.agents(t)
+            block = slice(i * self.num_agents_per_task, (i + 1) * self.num_agents_per_task)
+            infos = [dict(true_reward=float(self.env._true_objectives[first + a])) if done else {} for a, done in enumerate(dones[block])]
+            self._results[t] = list(obs[block]), rewards[block].tolist(), dones[block].tolist(), infos
+
+    def release(self, task_idx):
+        self.slices.pop(task_idx, None)
+        self._pending.pop(task_idx, None)
+        self._results.pop(task_idx, None)
+
+        if not self.slices:
+            self.env.close()
+            _shared_runtimes.pop(self.key, None)
+
+
+class MegaverseEnvSlice(gymnasium.Env):
+    """Gym of one task of a MegaverseRuntime, sees the agents of the envs of the task only."""
+
+    def __init__(self, runtime, task_idx):
+        self.runtime = runtime
+        self.task_idx = task_idx
+        self.scenario_name = runtime.tasks[task_idx].casefold()
+
+        self.is_multiagent = True
+        self.num_envs = runtime.num_envs_per_task
+        self.num_agents_per_env = runtime.env.num_agents_per_env
+        self.num_agents = runtime.num_agents_per_task
+
+        self.action_space = runtime.env.action_space
+        self.observation_space = runtime.env.observation_space
+
+    def reset(self):
+        return self.runtime.reset(self.task_idx)
+
+    def step(self, actions):
+        self.step_async(actions)
+        return self.step_wait()
+
+    def step_async(self, actions):
+        """Only queues the actions, the slices that are waited for together are stepped as one batch."""
+        self.runtime.submit(self.task_idx, np.asarray(actions, dtype=np.int32).reshape(self.num_agents, -1))
+
+    def step_wait(self):
+        return self.runtime.result(self.task_idx)
+
+    def close(self):
+        self.runtime.release(self.task_idx)
+
+
+class CudaObservations:
+    """
+    Wraps observations that live in the GPU memory, can be converted to a tensor without copies, e.g.
+    torch.as_tensor(CudaObservations(env), device='cuda'). Only supported with the Vulkan renderer.
+    """
+
+    def __init__(self, megaverse_gym):
+        self.__cuda_array_interface__ = megaverse_gym.get_observations_cuda()
+
+
+class CudaFrameStack:
+    """
+    Last k observations of every agent in GPU memory, (num_agents, k, H, W, C) oldest frame first, e.g.
+    torch.as_tensor(CudaFrameStack(env), device='cuda'). Only supported with the single-GPU Vulkan renderer.
+    """
+
+    def __init__(self, megaverse_gym):
+        self.__cuda_array_interface__ = megaverse_gym.get_frame_stack_cuda()
 
 
 class MegaverseEnv(gymnasium.Env):
-    def __init__(self, scenario_name, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan=False, params=None):
-        scenario_name = scenario_name.casefold()
+    def __init__(self, scenario_name, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan=False, params=None, render_gpus=None,
+                 grayscale=False, obs_downsample=1, depth=False, segmentation=False, metrics=False,
+                 cpu_affinity=None, frame_skip=1, encode_observations=False, background_resets=False,
+                 pregenerate_episodes=0, symbolic=None, cpu_rendering=False, ray_sensors=0, cuda_frame_stack=0,
+                 render_command_streams=1, render_threads=1, shading='phong', auto_tune_threads=0, retune_interval=0,
+                 host_memory='pageable', batched_components=False, physics_group_size=1, freeze_done_agents=False,
+                 terminal_observations=False, episode_dataset=None, physics_workers=0, incremental_reset_ms=0.0,
+                 low_latency=False):
+        # a list of scenarios makes a multi-task batch, envs are split between the scenarios in contiguous blocks
+        if isinstance(scenario_name, str):
+            scenario_name = scenario_name.casefold()
+        else:
+            scenario_name = [s.casefold() for s in scenario_name]
         self.scenario_name = scenario_name
 
         self.is_multiagent = True
@@ -51,7 +249,7 @@ class MegaverseEnv(gymnasium.Env):
 
         self.img_w = 128
         self.img_h = 72
-        self.channels = 3
+        self.channels = 1 if grayscale else 3
 
         self.use_vulkan = use_vulkan
 
@@ -75,11 +273,129 @@ class MegaverseEnv(gymnasium.Env):
             self.img_w, self.img_h, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan, float_params,
         )
 
+        if cpu_affinity is not None:
+            # one CPU per simulation thread, envs are re-created on their threads for NUMA-local memory
+            self.env.set_cpu_affinity(list(cpu_affinity))
+
+        if physics_group_size > 1:
+            # blocks of envs share the collision pools and solver memory of their Bullet worlds
+            self.env.set_physics_group_size(physics_group_size)
+
+        if render_gpus is not None:
+            # Vulkan only, envs are distributed between GPUs round-robin
+            self.env.set_render_gpus(list(render_gpus))
+
+        if render_command_streams > 1:
+            # Vulkan only, shards of envs are submitted to the GPU by the simulation threads as soon as they are stepped
+            self.env.set_render_command_streams(render_command_streams)
+
+        if render_threads > 1:
+            # OpenGL only, shards of envs are drawn concurrently with an EGL context per render thread
+            self.env.set_render_threads(render_threads)
+
+        if grayscale or obs_downsample != 1:
+            # converted by the renderer before the readback, RGB8 also avoids transferring the alpha channel
+            self.env.set_observation_format('gray8' if grayscale else 'rgb8', obs_downsample)
+
+        if host_memory != 'pageable':
+            # 'huge_pages' for fewer TLB misses on the observation batch, 'pinned' also page-locks it for CUDA so
+            # torch.as_tensor(obs).cuda(non_blocking=True) is an asynchronous copy
+            self.env.set_host_memory_policy(host_memory)
+
+        if shading != 'phong':
+            # 'lambert' or 'flat', drops the specular term that adds little at 128x72
+            self.env.set_shading(shading)
+
+        if cpu_rendering:
+            # frames are ray traced on the simulation threads, for machines without GPUs
+            self.env.set_cpu_rendering(True)
+
+        self.symbolic = symbolic
+        self.render_envs = []
+        if symbolic is not None:
+            # 'crop' or 'top_down': nothing is rendered, observations come from the voxel grids, see SymbolicEnvRenderer
+            self.env.set_symbolic_observations(symbolic)
+
+        if depth or segmentation:
+            # rendered in the same pass as the color observations, see auxiliary_observations()
+            self.env.set_auxiliary_outputs(depth, segmentation)
+
+        if cuda_frame_stack > 0:
+            # Vulkan only, the renderer keeps the last frames on the GPU, see frame_stack_cuda()
+            self.env.set_frame_stack_cuda(cuda_frame_stack)
+
+        if frame_skip != 1:
+            # action repeat in C++, only the last frame is rendered and the rewards are summed
+            self.env.set_frame_skip(frame_skip)
+
+        if background_resets:
+            # done envs are reset on a spare thread while masked out for one step, observations lag one frame behind
+            # at episode boundaries
+            self.env.set_background_resets(True)
+
+        if incremental_reset_ms > 0:
+            # done envs spread their reset over several steps, spending at most about this much of each step on it,
+            # and stay masked out (zero reward, no observation updates) until it completes
+            self.env.set_incremental_resets(int(incremental_reset_ms * 1e6))
+
+        if freeze_done_agents:
+            # agents that finish before their env (i.e. reach the exit) stand still and are not rendered anymore,
+            # see agent_dones()
+            self.env.set_freeze_done_agents(True)
+
+        self.keep_terminal_observations = terminal_observations
+        if terminal_observations:
+            # done envs are drawn once more before the reset, the frame ends up in infos['terminal_observation']
+            self.env.set_terminal_observations(True)
+
+        if physics_workers > 0:
+            # agents of each env are moved in parallel on these extra threads, for few large envs with many agents
+            self.env.set_physics_workers(physics_workers)
+
+        if low_latency:
+            # a few envs for interactive use: steps and draws run on the calling thread, the worker pool stays idle
+            self.env.set_low_latency(True)
+
+        if batched_components:
+            # fall detection of the envs of a simulation thread runs as one pass after their physics step
+            self.env.set_batched_components(True)
+
+        if auto_tune_threads > 0:
+            # step() tries 1, 2, 4, ... of the simulation threads for auto_tune_threads steps each and keeps the fastest,
+            # the choice is in get_metrics() (active_threads, envs_per_thread)
+            self.env.set_thread_auto_tuning(auto_tune_threads, retune_interval)
+
+        if episode_dataset is not None:
+            # envs only play the episodes baked into the file (see bake_episode_dataset()), instantiated from the mapping
+            if not self.env.set_episode_dataset(episode_dataset):
+                raise Exception(f'Could not use the episode dataset {episode_dataset}')
+
+        if pregenerate_episodes > 0:
+            # layouts of the next episodes of every env are generated on an idle-priority thread (Obstacles scenarios)
+            self.env.pregenerate_episodes(pregenerate_episodes)
+
+        if ray_sensors > 0:
+            # fan of ray_sensors rays around the heading of every agent, see ray_sensors()
+            self.env.enable_ray_sensors(ray_sensors)
+
+        if encode_observations:
+            # compressed in C++ after every step for remote actors, see encoded_observations()
+            self.env.encode_observations()
+
+        if metrics:
+            # per-zone timings for metrics(), a few clock reads per env step
+            self.env.enable_metrics(True)
+
+        obs_w, obs_h = self.img_w // obs_downsample, self.img_h // obs_downsample
+
         # obtaining default reward shaping scheme
         self.default_shaping_scheme = self.env.get_reward_shaping(0, 0)
 
         self.action_space = self.generate_action_space(self.env.action_space_sizes())
-        self.observation_space = gymnasium.spaces.Box(0, 255, (self.channels, self.img_h, self.img_w), dtype=np.uint8)
+        if symbolic is None:
+            self.observation_space = gymnasium.spaces.Box(0, 255, (self.channels, obs_h, obs_w), dtype=np.uint8)
+        else:
+            self.observation_space = gymnasium.spaces.Box(0, 255, tuple(self.env.symbolic_shape()), dtype=np.uint8)
 
     @staticmethod
     def generate_action_space(action_space_sizes):
@@ -120,62 +436,211 @@ class MegaverseEnv(gymnasium.Env):
         self.env.seed(seed)
 
     def observations(self):
-        obs = []
-        for env_i in range(self.num_envs):
-            for agent_i in range(self.num_agents_per_env):
-                o = self.env.get_observation(env_i, agent_i)
-                o = o[:, :, :3]
-                o = np.transpose(o, (2, 0, 1))  # convert to CHW for PyTorch
-                obs.append(o)
+        # (num_agents, C, H, W), converted in C++, symbolic observations are channel-last as they are
+        obs = self.env.get_observations_batched(self.symbolic is None)
+        return list(obs)
 
-        return obs
+    def terminal_observations(self):
+        """
+        Last frames of the envs that finished in the last step with terminal_observations=True: (env_ids, obs) with obs
+        of shape (len(env_ids), num_agents_per_env, *observation shape), laid out like observations(). Copies.
+        """
+        env_ids, obs = self.env.get_terminal_observations()
+        if self.symbolic is None:
+            obs = obs[..., :3].transpose(0, 1, 4, 2, 3)
+        return env_ids, obs
+
+    def auxiliary_observations(self, channel):
+        """(num_agents, H, W) uint16 'depth' or 'segmentation' at the full render resolution, valid until the next step."""
+        return self.env.get_auxiliary_observations_batched(channel)
+
+    def encoded_observations(self):
+        """
+        Compressed observations of the last step, one per agent: (slots, sizes) where slots[i, :sizes[i]] is the
+        encoded frame of agent i. Views, valid until the next step.
+        Decode on the receiving side with one ObservationDecoder(h, w, channels) per agent (from
+        megaverse.extension.megaverse), channels is 1 for grayscale, 4 for RGBA at full resolution and 3 otherwise.
+        """
+        return self.env.get_encoded_observations()
+
+    def ray_sensors(self):
+        """
+        (num_agents, num_rays, 2) view of the ray sensors of the last step, leftmost ray first: distance to the first hit
+        divided by the max distance (1 if nothing was hit) and the type of the hit (0 nothing, 1 layout, 2 object,
+        3 agent). Valid until the next step.
+        """
+        return self.env.get_ray_sensors_view()
+
+    def env_scenarios(self):
+        """Scenario of every env, the agents of env i are num_agents_per_env * i onwards."""
+        return self.env.env_scenarios()
+
+    def metrics(self, reset=False):
+        """Latency percentiles (simulate, pre_draw, draw, readback, reset, submit), GPU time per frame (gpu_draw,
+        gpu_readback, gpu_frame), reset counts, per-thread utilization and the simulation thread configuration
+        (active_threads, envs_per_thread, tuned_steps_per_sec, see auto_tune_threads)."""
+        return self.env.get_metrics(reset)
+
+    def memory_report(self, per_env=False):
+        """
+        Bytes by subsystem: 'env.*' (scene graph, physics, voxel grid, ...) summed over the envs or per env,
+        'render.*' host and 'gpu.*' video memory of the renderer, 'process.*' process-wide counters (Bullet, RSS).
+        """
+        return self.env.memory_report(per_env)
+
+    def observations_cuda(self):
+        """(num_agents, H, W, 4) observations in GPU memory, valid until the next step."""
+        return CudaObservations(self.env)
+
+    def frame_stack_cuda(self):
+        """(num_agents, k, H, W, C) last observations in GPU memory with cuda_frame_stack=k, valid until the next step."""
+        return CudaFrameStack(self.env)
 
     def reset(self):
         self.env.reset()
+
+        # persistent views, updated in place by the C++ code on every step
+        self._rewards = self.env.get_rewards_view()
+        self._dones = self.env.get_dones_view()
+        self._agent_dones = self.env.get_agent_dones_view()
+        self._true_objectives = self.env.get_true_objectives_view()
+
         return self.observations()
 
+    def set_num_envs(self, num_envs):
+        """
+        Resize the batch to num_envs (at most the number of envs it was created with) without rebuilding the renderer.
+        Envs that are brought back start a new episode, observations include them after the next step.
+        """
+        self.env.set_num_active_envs(num_envs)
+        self.num_envs = num_envs
+        self.num_agents = num_envs * self.num_agents_per_env
+
+        if hasattr(self, '_rewards'):
+            self._rewards = self.env.get_rewards_view()
+            self._dones = self.env.get_dones_view()
+            self._agent_dones = self.env.get_agent_dones_view()
+            self._true_objectives = self.env.get_true_objectives_view()
+
+    def agent_dones(self):
+        """
+        (num_agents,) bool after the last step: agents that finished their part of the episode (i.e. reached the
+        exit) and all agents of envs that are done. dones from step() are per env, these can be set earlier.
+        """
+        return self._agent_dones.astype(bool)
+
+    def episode_stats(self):
+        """
+        Per-agent episodes finished since the last call, aggregated in C++: a dict of equal-length numpy arrays
+        env, agent, return, length (steps), true_objective, wall_time (seconds) and done_step (step counted from 1),
+        plus num_dropped, the episodes lost because more than 4096 finished between calls.
+        """
+        return self.env.pop_episode_stats()
+
+    def set_render_mask(self, mask):
+        """
+        Only agents with a non-zero entry of mask (num_agents,) are rendered after the following steps, observations of
+        the others are stale. Agents of envs that start a new episode are always rendered. None renders everyone.
+        """
+        self.env.set_render_mask(np.zeros(0, dtype=np.uint8) if mask is None else np.asarray(mask, dtype=np.uint8))
+
     def step(self, actions):
-        action_idx = 0
-        for env_i in range(self.num_envs):
-            for agent_i in range(self.num_agents_per_env):
-                self.env.set_actions(env_i, agent_i, actions[action_idx])
-                action_idx += 1
+        self.step_async(actions)
+        return self.step_wait()
+
+    def step_async(self, actions):
+        """
+        Launches the simulation in the background. Observations returned by the previous step() stay valid
+        until step_wait() is called, so they can be processed (i.e. by the policy) while the envs are being simulated.
+        """
+        self.env.set_actions_batched(np.asarray(actions, dtype=np.int32).reshape(self.num_agents, -1))
+        self.env.step_async()
 
-        self.env.step()
+    def step_wait(self):
+        self.env.step_wait()
 
-        dones, infos = [], []
+        # episodes end per env, agents that finish earlier are in agent_dones()
+        dones = np.repeat(self._dones.astype(bool), self.num_agents_per_env).tolist()
 
-        agent_i = 0
-        for env_i in range(self.num_envs):
-            done = self.env.is_done(env_i)  # currently no individual done per agent
-            dones.extend([done for _ in range(self.num_agents_per_env)])
-            if done:
-                infos.extend([dict(true_reward=float(self.env.true_objective(env_i, j))) for j in range(self.num_agents_per_env)])
-            else:
-                infos.extend([{} for _ in range(self.num_agents_per_env)])
+        infos = [{} for _ in range(self.num_agents)]
+        for agent_i in np.flatnonzero(dones):
+            infos[agent_i] = dict(true_reward=float(self._true_objectives[agent_i]))
 
-            agent_i += self.num_agents_per_env
+        if self.keep_terminal_observations:
+            env_ids, terminal_obs = self.terminal_observations()
+            for i, env_i in enumerate(env_ids):
+                for agent in range(self.num_agents_per_env):
+                    infos[env_i * self.num_agents_per_env + agent]['terminal_observation'] = terminal_obs[i, agent]
 
-        rewards = self.env.get_last_rewards()
+        rewards = self._rewards.tolist()
 
         obs = self.observations()
 
         return obs, rewards, dones, infos
 
-    def convert_obs(self, obs):
-        if not self.use_vulkan:
-            obs = cv2.flip(obs, 0)
-        obs = cv2.cvtColor(obs, cv2.COLOR_RGB2BGR)
-        return obs
+    def send(self, env_ids, actions):
+        """
+        EnvPool-style asynchronous stepping: start stepping the envs env_ids with actions of shape
+        (len(env_ids) * num_agents_per_env, num_action_spaces). Envs are stepped independently, recv() returns them
+        as they finish. Don't send an env again before it was received. step() and reset() stop the pool.
+        """
+        env_ids = np.asarray(env_ids, dtype=np.int32)
+        actions = np.asarray(actions, dtype=np.int32).reshape(len(env_ids) * self.num_agents_per_env, -1)
+        if not self.env.send(env_ids, actions):
+            raise RuntimeError('Could not send the envs, see the log')
+
+    def recv(self, batch_size):
+        """
+        Wait for the first batch_size envs to finish, slow envs (i.e. mid-reset) keep running in the background.
+        :return: env_ids and the observations, rewards and dones of their agents (copies)
+        """
+        env_ids = self.env.recv(batch_size)
+        agents = (env_ids[:, None] * self.num_agents_per_env + np.arange(self.num_agents_per_env)).reshape(-1)
+
+        obs = self.env.get_observations_batched(self.symbolic is None)[agents]
+        rewards = self._rewards[agents]
+        dones = np.repeat(self._dones[env_ids].astype(bool), self.num_agents_per_env)
+        return env_ids, obs, rewards, dones
+
+    def fork(self, env_idx, target_ids):
+        """
+        Copy the current state of env env_idx into the envs target_ids, i.e. to expand the children of a search node
+        and step them all in one batch. Only the dynamic state is copied once a target replicates the layout of the
+        source episode. Observations of the targets are valid after the next step. Needs a scenario with snapshots.
+        """
+        if not self.env.fork(env_idx, np.asarray(target_ids, dtype=np.int32)):
+            raise RuntimeError('Could not fork the env, see the log')
+
+    def record_video(self, filename_prefix, fps=15):
+        """
+        Encode the hires frames of every render() call into <filename_prefix><env_idx>.mp4 in the background.
+        With mode='video' render() only submits the frames and skips the copies and the window.
+        None or empty prefix stops the recording.
+        """
+        self.env.record_video(filename_prefix or '', fps)
+
+    def set_render_envs(self, env_indices):
+        """
+        Only these envs are drawn at the hires resolution by render() and record_video(), i.e. a few envs of a large
+        evaluation batch. The main renderer draws them from its own scene state, the policy observations are not
+        affected. None or empty selects all envs.
+        """
+        self.render_envs = list(env_indices or [])
+        self.env.set_hires_envs(self.render_envs)
 
     def render(self, mode='human'):
+        if mode == 'video':
+            self.env.draw_hires()
+            return None
+
         self.env.draw_overview()
 
         self.env.draw_hires()
 
         rows = []
-        for env_i in range(self.num_envs):
-            obs = [self.convert_obs(self.env.get_hires_observation(env_i, i)) for i in range(self.num_agents_per_env)]
+        for env_i in self.render_envs or range(self.num_envs):
+            # hires frames are rendered top-down in BGR, they go to OpenCV as they are
+            obs = [self.env.get_hires_observation(env_i, i) for i in range(self.num_agents_per_env)]
             obs_concat = np.concatenate(obs, axis=1)
             rows.append(obs_concat)
 
@@ -197,6 +662,17 @@ class MegaverseEnv(gymnasium.Env):
         agent_idx = actor_idx % self.num_agents_per_env
         return self.env.set_reward_shaping(env_idx, agent_idx, reward_shaping)
 
+    def set_reward_shaping_batched(self, reward_shaping: dict):
+        """
+        Update rewards of all agents in one call, i.e. for PBT: reward_shaping maps reward names to one value per agent
+        (num_envs * num_agents_per_env, NaN keeps the current value). Does not block the sampler, the new values are
+        picked up by the next step or reset.
+        """
+        names = list(reward_shaping.keys())
+        values = np.stack([np.asarray(reward_shaping[name], dtype=np.float32) for name in names], axis=1)
+        if not self.env.set_reward_shaping_batched(names, values):
+            raise ValueError('Invalid reward shaping, see the log')
+
     def close(self):
         if self.env:
             self.env.close()
@@ -0,0 +1,116 @@
+"""
+Stepping Megaverse from inside jitted JAX functions, through the XLA custom call targets of libmegaverse_c.
+No Python callbacks are involved: XLA calls into C++ directly, on GPU the observations are copied device-to-device
+from the Vulkan renderer.
+
+    env = MegaverseXla('ObstaclesEasy', num_envs=64, num_agents_per_env=2, num_simulation_threads=8)
+    obs, rewards, dones = jax.jit(env.step)(actions)
+
+Steps are side effects of the compiled program. XLA orders them through the data dependencies: the actions of a step
+have to be computed from the observations of the previous one, as in any rollout loop.
+"""
+
+import ctypes
+import os
+
+import jax
+import numpy as np
+
+
+_TARGET = 'megaverse_step'
+
+_lib = None
+
+
+def _load_library():
+    global _lib
+    if _lib is not None:
+        return _lib
+
+    lib = ctypes.CDLL(os.path.join(os.path.dirname(__file__), 'extension', 'libmegaverse_c.so'))
+
+    lib.megaverse_create.restype = ctypes.c_void_p
+    lib.megaverse_create.argtypes = [
+        ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int,
+        ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(ctypes.c_float), ctypes.c_int,
+    ]
+    for fn in ('megaverse_destroy', 'megaverse_reset'):
+        getattr(lib, fn).argtypes = [ctypes.c_void_p]
+    lib.megaverse_seed.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.megaverse_set_cpu_rendering.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.megaverse_num_agents_per_env.argtypes = [ctypes.c_void_p]
+    lib.megaverse_observation_shape.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int), ctypes.c_int]
+    lib.megaverse_action_space_sizes.argtypes = [ctypes.POINTER(ctypes.c_int), ctypes.c_int]
+
+    jax.ffi.register_ffi_target(_TARGET, jax.ffi.pycapsule(lib.megaverse_xla_step_cpu), platform='cpu', api_version=0)
+    jax.ffi.register_ffi_target(_TARGET, jax.ffi.pycapsule(lib.megaverse_xla_step_gpu), platform='CUDA', api_version=0)
+
+    _lib = lib
+    return lib
+
+
+class MegaverseXla:
+    """
+    Batch of envs created through the C API, see megaverse_c.h. Observations are (num_agents, H, W, 4) uint8, rewards
+    (num_agents,) float32, dones (num_envs,) uint8, agents are ordered env-major like in MegaverseEnv.
+    XLA steps the envs on its own threads, so they render with Vulkan or on the CPU: an OpenGL context is bound to the
+    thread that created it.
+    """
+
+    def __init__(self, scenario_name, num_envs, num_agents_per_env, num_simulation_threads, use_vulkan=True,
+                 params=None, img_w=128, img_h=72, seed=0, cpu_rendering=False):
+        self._handle = None
+        if not use_vulkan and not cpu_rendering:
+            raise ValueError('MegaverseXla needs use_vulkan=True or cpu_rendering=True, OpenGL envs cannot be stepped from XLA threads')
+
+        self._lib = _load_library()
+
+        params = params or {}
+        names = (ctypes.c_char_p * len(params))(*[k.encode() for k in params])
+        values = (ctypes.c_float * len(params))(*[float(v) for v in params.values()])
+
+        self._handle = self._lib.megaverse_create(
+            scenario_name.encode(), img_w, img_h, num_envs, num_agents_per_env, num_simulation_threads,
+            int(use_vulkan), names, values, len(params),
+        )
+        if not self._handle:
+            raise RuntimeError(f'Could not create {scenario_name}')
+
+        self._lib.megaverse_set_cpu_rendering(self._handle, int(cpu_rendering))
+        self._lib.megaverse_seed(self._handle, seed)
+        if self._lib.megaverse_reset(self._handle) != 0:
+            self.close()
+            raise RuntimeError(f'Could not reset {scenario_name}')
+
+        self.num_envs = num_envs
+        self.num_agents = num_envs * self._lib.megaverse_num_agents_per_env(self._handle)
+
+        shape = (ctypes.c_int * 8)()
+        ndim = self._lib.megaverse_observation_shape(self._handle, shape, len(shape))
+        self.obs_shape = tuple(shape[:ndim])
+        self.num_action_spaces = self._lib.megaverse_action_space_sizes(None, 0)
+
+        self._results = (
+            jax.ShapeDtypeStruct((self.num_agents,) + self.obs_shape, np.uint8),
+            jax.ShapeDtypeStruct((self.num_agents,), np.float32),
+            jax.ShapeDtypeStruct((self.num_envs,), np.uint8),
+        )
+
+    def step(self, actions):
+        """
+        :param actions: int32 array of shape (num_agents, num_action_spaces)
+        :return: observations, rewards and dones after the step
+        """
+        call = jax.ffi.ffi_call(
+            _TARGET, self._results, has_side_effect=True,
+            custom_call_api_version=0, legacy_backend_config=str(self._handle),
+        )
+        return call(actions.astype(np.int32), np.uint64(self._handle))
+
+    def close(self):
+        if self._handle:
+            self._lib.megaverse_destroy(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
@@ -1,12 +1,13 @@
 import copy
 import os
+import tempfile
 import time
 
 import numpy as np
 
 from unittest import TestCase
 
-from megaverse.megaverse_env import MegaverseEnv, make_env_multitask
+from megaverse.megaverse_env import MegaverseEnv, make_env_multitask, make_env_multitask_batch, MEGAVERSE8, bake_episode_dataset, shared_multitask_runtime
 
 
 def sample_actions(e):
@@ -120,6 +121,116 @@ class TestEnv(TestCase):
 
         # print(fps1, fps2, fps4)
 
+    def test_metrics(self):
+        params = {'episodeLengthSec': 0.1}
+        e = MegaverseEnv('ObstaclesEasy', 2, 1, 2, False, params, metrics=True)
+        e.reset()
+        for i in range(20):
+            e.step(sample_actions(e))
+
+        m = e.metrics(reset=True)
+        self.assertEqual(m['simulate']['count'], 20)
+        self.assertGreater(m['draw']['p99_ms'], 0)
+        self.assertGreater(m['num_episode_resets'], 0)
+        self.assertEqual(len(m['thread_utilization']), 2)
+
+        self.assertEqual(e.metrics()['simulate']['count'], 0)
+        e.close()
+
+    def test_memory_report(self):
+        e = MegaverseEnv('ObstaclesEasy', 2, 2, 2, False, {})
+        e.reset()
+        e.step(sample_actions(e))
+
+        report = e.memory_report()
+        self.assertGreater(report['env.voxel_grid'], 0)
+        self.assertGreater(report['env.physics.objects'], 0)
+        self.assertGreater(report['render.observations'], 0)
+        self.assertGreater(report['process.bullet'], 0)
+
+        per_env = e.memory_report(per_env=True)
+        self.assertEqual(per_env['env.0.voxel_grid'] + per_env['env.1.voxel_grid'], report['env.voxel_grid'])
+        e.close()
+
+    def test_cpu_rendering(self):
+        e = MegaverseEnv('ObstaclesEasy', 2, 2, 2, False, {}, cpu_rendering=True, segmentation=True)
+        obs = e.reset()
+        self.assertEqual(obs[0].shape, e.observation_space.shape)
+
+        # the layout is in front of every agent
+        self.assertTrue((e.auxiliary_observations('segmentation') > 0).any())
+        e.step(sample_actions(e))
+        e.close()
+
+    def test_invalid_actions(self):
+        e = MegaverseEnv('ObstaclesEasy', 2, 2, 2, False, {}, symbolic='crop')
+        e.reset()
+
+        actions = np.zeros((e.num_agents, len(e.env.action_space_sizes())), dtype=np.int32)
+        with self.assertRaises(ValueError):
+            e.env.set_actions_batched(actions[1:])
+        with self.assertRaises(ValueError):
+            e.env.set_actions_batched(actions.ravel())
+
+        actions[0, 0] = 100
+        with self.assertRaises(ValueError):
+            e.step(actions)
+        e.close()
+
+    def test_cuda_observations_unsupported(self):
+        e = MegaverseEnv('ObstaclesEasy', 2, 2, 2, False, {}, symbolic='crop')
+        e.reset()
+
+        # observations of the symbolic renderer are on the host
+        with self.assertRaises(RuntimeError):
+            e.env.get_observations_cuda()
+        with self.assertRaises(RuntimeError):
+            e.env.get_frame_stack_cuda()
+        e.close()
+
+    def test_render_envs(self):
+        e = make_test_env(4, 2, 2)
+        e.reset()
+        e.set_render_envs([1, 3])
+
+        # only the selected envs are drawn, at the hires resolution of the main renderer
+        for _ in range(3):
+            e.step(sample_actions(e))
+            frame = e.render()
+        self.assertEqual(frame.shape[0], 2 * e.env.get_hires_observation(1, 0).shape[0])
+        e.close()
+
+    def test_symbolic_observations(self):
+        e = MegaverseEnv('ObstaclesEasy', 2, 2, 2, False, {}, symbolic='crop')
+        obs = e.reset()
+        self.assertEqual(obs[0].shape, e.observation_space.shape)
+
+        # every agent sees itself in the middle of the crop, at its own voxel level
+        center = obs[0].shape[1] // 2
+        self.assertEqual(obs[0][2, center, center, 3], 1)
+        self.assertTrue((obs[0][..., 0] != 0).any())
+        e.close()
+
+        e = MegaverseEnv('ObstaclesEasy', 2, 2, 2, False, {}, symbolic='top_down')
+        obs = e.reset()
+        self.assertEqual(obs[0].shape, (15, 15, 4))
+        e.step(sample_actions(e))
+        e.close()
+
+    def test_ray_sensors(self):
+        e = MegaverseEnv('ObstaclesEasy', 2, 2, 2, False, {}, ray_sensors=8)
+        e.reset()
+        rays = e.ray_sensors()
+        self.assertEqual(rays.shape, (4, 8, 2))
+
+        # every agent is enclosed by the walls of the layout
+        self.assertTrue((rays[..., 1] != 0).any())
+        self.assertTrue(((rays[..., 0] >= 0) & (rays[..., 0] <= 1)).all())
+
+        e.step(sample_actions(e))
+        self.assertEqual(e.ray_sensors().shape, (4, 8, 2))
+        e.close()
+
     def test_reward_shaping(self):
         e = MegaverseEnv('TowerBuilding', num_envs=3, num_agents_per_env=2, num_simulation_threads=2, use_vulkan=True)
         default_reward_shaping = e.get_default_reward_shaping()
@@ -184,6 +295,186 @@ class TestEnv(TestCase):
         for p in processes:
             p.join()
 
+    def test_multitask_batch(self):
+        e = make_env_multitask_batch('multitask_megaverse8', 2, 2, 2, use_vulkan=True, params={})
+        self.assertEqual(e.env_scenarios(), [s.casefold() for s in MEGAVERSE8 for _ in range(2)])
+
+        e.reset()
+        for _ in range(200):
+            obs, rewards, dones, infos = e.step(sample_actions(e))
+            self.assertEqual(len(obs), len(MEGAVERSE8) * 2 * 2)
+
+        e.close()
+
+    def test_multitask_shared_runtime(self):
+        envs = [make_env_multitask('multitask_megaverse8', i, 2, 2, 2, use_vulkan=False, params={}, shared_runtime=True) for i in range(len(MEGAVERSE8))]
+        runtime = shared_multitask_runtime('multitask_megaverse8', 2, 2, 2, use_vulkan=False, params={})
+        self.assertTrue(all(e.runtime is runtime for e in envs))
+
+        for e in envs:
+            self.assertEqual(len(e.reset()), 2 * 2)
+
+        for _ in range(50):
+            # all tasks submitted: one step of the whole batch
+            for e in envs:
+                e.step_async(sample_actions(e))
+            for e in envs:
+                obs, rewards, dones, infos = e.step_wait()
+                self.assertEqual(len(obs), 2 * 2)
+                self.assertEqual(len(rewards), 2 * 2)
+
+            # a single task steps its envs through the pool
+            obs, rewards, dones, infos = envs[3].step(sample_actions(envs[3]))
+            self.assertEqual(len(obs), 2 * 2)
+
+        for e in envs:
+            e.close()
+
+    def test_resize_batch(self):
+        e = MegaverseEnv('ObstaclesHard', 8, 2, 2, use_vulkan=False, params={})
+        e.reset()
+
+        for num_envs in [8, 3, 5, 1, 8]:
+            e.set_num_envs(num_envs)
+            for _ in range(20):
+                obs, rewards, dones, infos = e.step(sample_actions(e))
+                self.assertEqual(len(obs), num_envs * 2)
+                self.assertEqual(len(rewards), num_envs * 2)
+
+        e.close()
+
+    def test_background_resets(self):
+        e = MegaverseEnv('ObstaclesHard', 4, 2, 2, use_vulkan=False, params={'episodeLengthSec': 0.5}, background_resets=True)
+        e.reset()
+
+        prev_dones = [False] * e.num_agents
+        for _ in range(200):
+            obs, rewards, dones, infos = e.step(sample_actions(e))
+            for agent_i in np.flatnonzero(prev_dones):
+                # masked out while the new episode is prepared
+                self.assertFalse(dones[agent_i])
+                self.assertEqual(rewards[agent_i], 0.0)
+
+            prev_dones = dones
+
+        e.close()
+
+    def test_agent_dones(self):
+        e = MegaverseEnv('ObstaclesEasy', 4, 2, 2, False, {'episodeLengthSec': 1.0}, freeze_done_agents=True)
+        e.reset()
+
+        for _ in range(100):
+            _, _, dones, _ = e.step(sample_actions(e))
+            agent_dones = e.agent_dones()
+            self.assertEqual(len(agent_dones), e.num_agents)
+
+            # agents of done envs are done too
+            self.assertTrue(np.all(agent_dones[np.asarray(dones)]))
+
+        e.close()
+
+    def test_episode_stats(self):
+        e = MegaverseEnv('ObstaclesEasy', 4, 2, 2, False, {'episodeLengthSec': 1.0})
+        e.reset()
+
+        num_done = 0
+        for _ in range(100):
+            _, _, dones, _ = e.step(sample_actions(e))
+            num_done += 2 * int(np.sum(dones))
+
+        stats = e.episode_stats()
+        self.assertEqual(len(stats['return']), num_done)
+        self.assertEqual(stats['num_dropped'], 0)
+        self.assertTrue(np.all(stats['length'] > 0))
+        self.assertTrue(np.all(np.diff(stats['done_step']) >= 0))
+
+        # drained by the previous call
+        self.assertEqual(len(e.episode_stats()['env']), 0)
+
+        e.close()
+
+    def test_terminal_observations(self):
+        e = MegaverseEnv('ObstaclesEasy', 4, 2, 2, False, {'episodeLengthSec': 1.0}, terminal_observations=True)
+        e.reset()
+
+        num_done = 0
+        for _ in range(100):
+            obs, _, dones, infos = e.step(sample_actions(e))
+            for agent_i in np.flatnonzero(dones):
+                terminal_obs = infos[agent_i]['terminal_observation']
+                self.assertEqual(terminal_obs.shape, obs[agent_i].shape)
+                self.assertGreater(terminal_obs.max(), 0)
+                num_done += 1
+
+        self.assertGreater(num_done, 0)
+        e.close()
+
+    def test_episode_dataset(self):
+        params = {'episodeLengthSec': 1.0}
+        filename = os.path.join(tempfile.mkdtemp(), 'obstacles.bin')
+        self.assertTrue(bake_episode_dataset('ObstaclesEasy', 2, 8, filename, seed=0, params=params))
+
+        # the seed does not matter anymore, every env plays its share of the dataset
+        e1 = MegaverseEnv('ObstaclesEasy', 4, 2, 2, False, params, episode_dataset=filename)
+        e2 = MegaverseEnv('ObstaclesEasy', 4, 2, 2, False, params, episode_dataset=filename)
+        e1.seed(1)
+        e2.seed(2)
+
+        self.assertTrue(np.array_equal(e1.reset(), e2.reset()))
+        for _ in range(50):
+            e1.step(sample_actions(e1))
+
+        e2.close()
+        e1.close()
+
+        # baked for two agents per env
+        with self.assertRaises(Exception):
+            MegaverseEnv('ObstaclesEasy', 4, 1, 2, False, params, episode_dataset=filename)
+
+    def test_fork(self):
+        e = MegaverseEnv('Empty', 4, 2, 2, False, {})
+        e.reset()
+        for _ in range(10):
+            e.step(sample_actions(e))
+
+        e.fork(0, [1, 2, 3])
+
+        actions = sample_actions(e)
+        for env_i in range(1, 4):
+            actions[env_i * 2:(env_i + 1) * 2] = actions[0:2]
+
+        # same state and actions, so the children see what the parent sees (up to contact ordering in Bullet)
+        obs, _, _, _ = e.step(actions)
+        for env_i in range(1, 4):
+            self.assertLess(np.abs(obs[env_i * 2].astype(np.int32) - obs[0]).mean(), 1.0)
+
+        e.close()
+
+    def test_host_memory_policy(self):
+        for policy in ['huge_pages', 'pinned']:
+            e = MegaverseEnv('ObstaclesEasy', 4, 2, 2, False, {}, host_memory=policy)
+            obs = e.reset()
+            self.assertGreater(np.asarray(obs).max(), 0)
+
+            obs, _, _, _ = e.step(sample_actions(e))
+            self.assertEqual(len(obs), 8)
+            e.close()
+
+    def test_auto_tune_threads(self):
+        e = MegaverseEnv('ObstaclesEasy', 8, 1, 4, False, {}, metrics=True, auto_tune_threads=3)
+        e.reset()
+
+        # three candidates (1, 2, 4 threads), each with a warm-up step
+        for _ in range(3 * 4 + 1):
+            e.step(sample_actions(e))
+
+        m = e.metrics()
+        self.assertEqual(m['num_thread_calibrations'], 1)
+        self.assertIn(m['active_threads'], [1, 2, 4])
+        self.assertEqual(sum(m['envs_per_thread']), 8)
+        self.assertGreater(m['tuned_steps_per_sec'], 0)
+        e.close()
+
     def test_viewer(self):
         params = {'episodeLengthSec': 1.0}
         e1 = MegaverseEnv('ObstaclesHard', 2, 2, 2, True, params)
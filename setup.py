@@ -102,7 +102,7 @@ class CMakeBuild(build_ext):
 
         subprocess.check_call(cmake_cmd, cwd=self.build_temp, env=env)
         subprocess.check_call(
-            ['cmake', '--build', '.', '--target', 'megaverse'] + build_args, cwd=self.build_temp,
+            ['cmake', '--build', '.', '--target', 'megaverse', 'megaverse_c'] + build_args, cwd=self.build_temp,
         )
 
         print('Completed the build!')
@@ -1,6 +1,7 @@
 #include <mazes/breadthfirstsearch.h>
 #include <mazes/circularhexagonmaze.h>
 #include <mazes/circularmaze.h>
+#include <mazes/compactmaze.h>
 #include <mazes/depthfirstsearch.h>
 #include <mazes/hexagonalmaze.h>
 #include <mazes/honeycombmaze.h>
@@ -9,10 +10,15 @@
 #include <mazes/prim.h>
 #include <mazes/rectangularmaze.h>
 #include <mazes/usermaze.h>
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 void usage(std::ostream &out) {
   out << "Usage: mazegen [--help] [-m <maze type>] [-a <algorithm type>]"
@@ -20,6 +26,8 @@ void usage(std::ostream &out) {
   out << "               [-s <size> | -w <width> -h <height>]" << std::endl;
   out << "               [-t <output type>] [-o <output prefix>]" << std::endl;
   out << "               [-f <graph description file (for m=5)>]" << std::endl;
+  out << "               [-n <mazes per size> [-r <min size>] [-j <threads>]]"
+      << std::endl;
 
   out << std::endl;
   out << "Optional arguments" << std::endl;
@@ -62,14 +70,127 @@ void usage(std::ostream &out) {
   out << "          "
       << "1: png output using gnuplot (.plt) intermediate " << std::endl;
   out << "  -o      "
-      << "Prefix for .svg, .plt and .png outputs (default: maze)" << std::endl;
+      << "Prefix for .svg, .plt, .png and .mzpack outputs (default: maze)"
+      << std::endl;
+  out << "  -n      "
+      << "Bulk mode: generate this many mazes of every size and write them"
+      << std::endl;
+  out << "          "
+      << "to a single .mzpack file (straight-walled maze types only)"
+      << std::endl;
+  out << "  -r      "
+      << "Smallest size in bulk mode, sizes are [-r, -s] (default: -s)"
+      << std::endl;
+  out << "  -j      "
+      << "Worker threads in bulk mode (default: all cores)" << std::endl;
+}
+
+Maze *CreateMaze(int type, int size, int width, int height,
+                 const std::string &infile) {
+  switch (type) {
+    case 0:
+      return new RectangularMaze(width, height);
+    case 1:
+      return new HexagonalMaze(size);
+    case 2:
+      return new HoneyCombMaze(size);
+    case 3:
+      return new CircularMaze(size);
+    case 4:
+      return new CircularHexagonMaze(size);
+    case 5:
+      return new UserMaze(infile);
+    default:
+      return nullptr;
+  }
+}
+
+SpanningtreeAlgorithm *CreateAlgorithm(int type) {
+  switch (type) {
+    case 0:
+      return new Kruskal;
+    case 1:
+      return new DepthFirstSearch;
+    case 2:
+      return new BreadthFirstSearch;
+    case 3:
+      return new LoopErasedRandomWalk;
+    case 4:
+      return new Prim;
+    default:
+      return nullptr;
+  }
+}
+
+// Maze #i of a size is seeded with size * count + i, so a pack is
+// reproducible regardless of the number of threads
+int GenerateMazePack(const std::map<std::string, int> &options,
+                     const std::string &infile,
+                     const std::string &outputprefix) {
+  const int type = options.at("-m"), count = options.at("-n");
+  int minSize = options.at("-r") > 0 ? options.at("-r") : options.at("-s");
+  int maxSize = options.at("-s");
+  if (type == 0) minSize = maxSize = options.at("-w");
+  if (type == 5) minSize = maxSize = 0;
+
+  if (minSize > maxSize) {
+    std::cerr << "Invalid size range " << minSize << "-" << maxSize << "\n";
+    return 1;
+  }
+
+  int numThreads = options.at("-j");
+  if (numThreads <= 0)
+    numThreads = std::max(1, int(std::thread::hardware_concurrency()));
+
+  const int numSizes = maxSize - minSize + 1;
+  std::vector<CompactMaze> mazes(size_t(numSizes) * count);
+  std::atomic<int> nextJob{0};
+  std::atomic<bool> failed{false};
+
+  std::cout << "Generating " << mazes.size() << " mazes on " << numThreads
+            << " threads..." << std::endl;
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < numThreads; ++t) {
+    workers.emplace_back([&] {
+      for (int job = nextJob++; job < int(mazes.size()) && !failed;
+           job = nextJob++) {
+        const int size = minSize + job / count, i = job % count;
+        std::unique_ptr<Maze> maze(CreateMaze(type, size, options.at("-w"),
+                                              options.at("-h"), infile));
+        std::unique_ptr<SpanningtreeAlgorithm> algorithm(
+            CreateAlgorithm(options.at("-a")));
+        algorithm->Seed(unsigned(size * count + i));
+
+        maze->InitialiseGraph();
+        maze->GenerateMaze(algorithm.get());
+        if (!MakeCompactMaze(*maze, size, &mazes[job])) failed = true;
+      }
+    });
+  }
+  for (auto &worker : workers) worker.join();
+
+  if (failed) {
+    std::cerr << "Maze type " << type
+              << " has curved walls and can't be packed\n";
+    return 1;
+  }
+
+  const auto filename = outputprefix + ".mzpack";
+  std::cout << "Writing mazes to '" << filename << "'..." << std::endl;
+  if (!WriteMazePack(filename, MazeType(type), mazes)) {
+    std::cerr << "Could not write " << filename << "\n";
+    return 1;
+  }
+  return 0;
 }
 
 int main(int argc, char *argv[]) {
   std::string outputprefix = "maze", infile = "";
   std::map<std::string, int> optionmap{{"-m", 0},  {"-a", 0},     {"-s", 20},
                                        {"-w", 20}, {"-h", 20},    {"-o", 0},
-                                       {"-f", 0},  {"--help", 0}, {"-t", 0}};
+                                       {"-f", 0},  {"--help", 0}, {"-t", 0},
+                                       {"-n", 0},  {"-r", 0},     {"-j", 0}};
 
   for (int i = 1; i < argc; i++) {
     if (optionmap.find(argv[i]) == optionmap.end()) {
@@ -116,9 +237,6 @@ int main(int argc, char *argv[]) {
     optionmap[argv[i++]] = x;
   }
 
-  Maze *maze;
-  SpanningtreeAlgorithm *algorithm;
-
   switch (optionmap["-m"]) {
     case 0:
       if (optionmap["-w"] < 1 or optionmap["-h"] < 1) {
@@ -129,7 +247,6 @@ int main(int argc, char *argv[]) {
       }
       std::cout << "Rectangular maze of size " << optionmap["-w"] << "x"
                 << optionmap["-h"] << "\n";
-      maze = new RectangularMaze(optionmap["-w"], optionmap["-h"]);
       break;
 
     case 1:
@@ -141,7 +258,6 @@ int main(int argc, char *argv[]) {
       }
       std::cout << "Hexagonal maze with triangular lattice of size "
                 << optionmap["-s"] << "\n";
-      maze = new HexagonalMaze(optionmap["-s"]);
       break;
 
     case 2:
@@ -152,7 +268,6 @@ int main(int argc, char *argv[]) {
         return 1;
       }
       std::cout << "Honeycomb maze of size " << optionmap["-s"] << "\n";
-      maze = new HoneyCombMaze(optionmap["-s"]);
       break;
 
     case 3:
@@ -163,7 +278,6 @@ int main(int argc, char *argv[]) {
         return 1;
       }
       std::cout << "Circular maze of size " << optionmap["-s"] << "\n";
-      maze = new CircularMaze(optionmap["-s"]);
       break;
 
     case 4:
@@ -175,7 +289,6 @@ int main(int argc, char *argv[]) {
       }
       std::cout << "Circular maze with triangular lattice of size "
                 << optionmap["-s"] << "\n";
-      maze = new CircularHexagonMaze(optionmap["-s"]);
       break;
 
     case 5:
@@ -186,7 +299,6 @@ int main(int argc, char *argv[]) {
         return 1;
       }
       std::cout << "User-defined graph\n";
-      maze = new UserMaze(infile);
       break;
 
     default:
@@ -198,27 +310,22 @@ int main(int argc, char *argv[]) {
   switch (optionmap["-a"]) {
     case 0:
       std::cout << "Maze generation using Kruskal's algorithm\n";
-      algorithm = new Kruskal;
       break;
 
     case 1:
       std::cout << "Maze generation using Depth-first search\n";
-      algorithm = new DepthFirstSearch;
       break;
 
     case 2:
       std::cout << "Maze generation using Breadth-first search\n";
-      algorithm = new BreadthFirstSearch;
       break;
 
     case 3:
       std::cout << "Maze generation using Loop-erased random walk\n";
-      algorithm = new LoopErasedRandomWalk;
       break;
 
     case 4:
       std::cout << "Maze generation using Prim's algorithm\n";
-      algorithm = new Prim;
       break;
 
     default:
@@ -233,6 +340,13 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if (optionmap["-n"] > 0)
+    return GenerateMazePack(optionmap, infile, outputprefix);
+
+  Maze *maze = CreateMaze(optionmap["-m"], optionmap["-s"], optionmap["-w"],
+                          optionmap["-h"], infile);
+  SpanningtreeAlgorithm *algorithm = CreateAlgorithm(optionmap["-a"]);
+
   int status = 0;
 
   std::cout << "Initialising graph..." << std::endl;
@@ -1,17 +1,19 @@
 #include <cstdlib>
 
 #include <opencv2/core/mat.hpp>
-#include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 
 #include <util/util.hpp>
 #include <util/argparse.hpp>
 #include <util/os_utils.hpp>
+#include <util/string_utils.hpp>
 #include <util/tiny_logger.hpp>
 #include <util/tiny_profiler.hpp>
+#include <util/scoped_profiler.hpp>
 
 #include <env/env.hpp>
 #include <env/vector_env.hpp>
+#include <env/vector_env_benchmark.hpp>
 
 #include <scenarios/init.hpp>
 
@@ -20,6 +22,7 @@
 #endif
 
 #include <magnum_rendering/magnum_env_renderer.hpp>
+#include <magnum_rendering/multi_context_env_renderer.hpp>
 
 #include "viewer_args.hpp"
 
@@ -38,7 +41,7 @@ std::string windowName(int envIdx, int agentIdx)
 
 
 int mainLoop(VectorEnv &venv, EnvRenderer &renderer, bool viz, bool performanceTest, bool randomActions,
-             int W, int H, bool useVulkan, int delayMs, int maxNumFrames)
+             int W, int H, int delayMs, int maxNumFrames)
 {
     if (performanceTest)
         randomActions = true;
@@ -78,12 +81,8 @@ int mainLoop(VectorEnv &venv, EnvRenderer &renderer, bool viz, bool performanceT
                 const uint8_t *obsData = renderer.getObservation(envIdx, i);
 
                 if (viz) {
-                    cv::Mat mat(H, W, CV_8UC4, (char *) obsData);
-                    cv::cvtColor(mat, mat, cv::COLOR_RGB2BGR);
-
-                    if (!useVulkan)
-                        cv::flip(mat, mat, 0);
-
+                    // the renderer produces BGRA when visualizing, see main()
+                    const cv::Mat mat(H, W, CV_8UC4, const_cast<uint8_t *>(obsData));
                     cv::imshow(windowName(envIdx, i), mat);
                 }
             }
@@ -167,7 +166,11 @@ int mainLoop(VectorEnv &venv, EnvRenderer &renderer, bool viz, bool performanceT
             vvi.emplace_back(1024 * 1024, 3);
             TLOG(INFO) << std::accumulate(vvi.back().begin(), vvi.back().end(), 0);
 #endif
+            const auto waitStats = venv.getWaitStats();
+            venv.resetWaitStats();
+
             TLOG(INFO) << "Progress " << numFrames << "/" << maxNumFrames << ". Approx FPS: " << approxFps << ". VM usage: " << (long long)vmUsage << ". RSS: " << (long long)residentSet;
+            TLOG(INFO) << "Barrier wait: " << waitStats.totalWaitUsec / 1e3f << " ms total, " << waitStats.numParked << " parked";
         }
     } while (!shouldExit);
 
@@ -201,8 +204,67 @@ int main(int argc, char** argv)
         .help("number of parallel CPU threads to use for Bullet")
         .default_value(1)
         .scan<'i', int>();
-    parser.add_argument("--visualize")
-        .help("Whether to render multiple environments on screen")
+    parser.add_argument("--work_stealing")
+        .help("Use work-stealing scheduler to distribute envs between simulation threads (default is static slicing)")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--auto_tune_threads")
+        .help("Calibrate for this many steps per candidate thread count (1, 2, 4, ...) and simulate with the fastest one")
+        .default_value(0)
+        .scan<'i', int>();
+    parser.add_argument("--pipelined_rendering")
+        .help("Render frame N on the GPU while simulating frame N+1 (observations lag by one frame)")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--low_latency")
+        .help("Step and render inline on the main thread without the worker pool, for 1-4 envs (see --benchmark_steps for the latency)")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--command_streams")
+        .help("With the Vulkan renderer, submit shards of envs from the simulation threads with this many command streams")
+        .default_value(1)
+        .scan<'i', int>();
+    parser.add_argument("--render_threads")
+        .help("With the OpenGL renderer, draw shards of envs concurrently on this many threads with an EGL context each")
+        .default_value(1)
+        .scan<'i', int>();
+    parser.add_argument("--shading")
+        .help("Lighting of the observations: phong, lambert (per-face diffuse) or flat (unlit)")
+        .default_value(std::string{"phong"});
+    parser.add_argument("--spin_budget")
+        .help("Number of spin iterations on VectorEnv barriers before worker threads go to sleep")
+        .default_value(Barrier::defaultSpinBudget)
+        .scan<'i', int>();
+    parser.add_argument("--compound_layout")
+        .help("Use a single compound collision shape for the static layout of each env")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--voxel_collision")
+        .help("Use the voxel grid to speed up agent collision checks against the static layout")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--batched_rendering")
+        .help("With --use_opengl, render all agents as tiles of one framebuffer with a single readback per step")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--bake_layout")
+        .help("With --use_opengl, merge the static layout of each env into one mesh at reset")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--occlusion_culling")
+        .help("With --use_opengl, skip instances hidden behind the static layout from each agent camera")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--front_to_back")
+        .help("With --use_opengl, draw the visible instances of each agent camera roughly front to back")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--depth_prepass")
+        .help("With --use_opengl, draw a depth-only pass before the color pass")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--skip_unchanged_views")
+        .help("With --use_opengl, reuse the previous frame of agents whose view did not change")
         .default_value(false)
         .implicit_value(true);
     parser.add_argument("--visualize")
@@ -217,6 +279,17 @@ int main(int argc, char** argv)
         .help("Run for a limited number of env frames (currently 200000) to test performance. Uses random actions.")
         .default_value(false)
         .implicit_value(true);
+    parser.add_argument("--benchmark_steps")
+        .help("Measure steady-state throughput over this many steps with the built-in random policy (no visualization) and print a JSON report")
+        .default_value(0)
+        .scan<'i', int>();
+    parser.add_argument("--benchmark_output")
+        .help("Also write the JSON report of --benchmark_steps to this file")
+        .default_value(std::string{});
+    parser.add_argument("--perf_counters")
+        .help("With --benchmark_steps, also count cycles, instructions, LLC and branch misses per stage (Linux perf_event)")
+        .default_value(false)
+        .implicit_value(true);
     parser.add_argument("--hires")
         .help("Render at high resolution. Only use this parameter with --visualize and if the total number of agents is small")
         .default_value(false)
@@ -226,6 +299,17 @@ int main(int argc, char** argv)
         .default_value(false)
         .implicit_value(true);
 
+    parser.add_argument("--cpu_affinity")
+        .help("Comma-separated CPU per simulation thread (thread 0 is the main thread). Envs are created on their threads for NUMA-local memory")
+        .default_value(std::string{});
+    parser.add_argument("--profile")
+        .help("Collect per-zone timings (Env::step, stepSimulation, draw, ...) and print the histograms at exit")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--trace")
+        .help("Also save the profiled zones to this file in Chrome trace format (chrome://tracing). Implies --profile")
+        .default_value(std::string{});
+
     parseArgs(parser, argc, argv);
 
     const auto scenarioName = parser.get<std::string>("--scenario");
@@ -233,11 +317,39 @@ int main(int argc, char** argv)
     const bool useVulkanRenderer = !parser.get<bool>("--use_opengl");
     const int numEnvs = parser.get<int>("--num_envs");  // to test vectorized env interface
     const int numSimulationThreads = parser.get<int>("--num_simulation_threads");
+    const auto workStealing = parser.get<bool>("--work_stealing");
+    const auto spinBudget = parser.get<int>("--spin_budget");
+    const auto autoTuneThreads = parser.get<int>("--auto_tune_threads");
+    const auto commandStreams = parser.get<int>("--command_streams");
+    const auto renderThreads = parser.get<int>("--render_threads");
+    const auto shading = parser.get<std::string>("--shading");
+    const auto pipelinedRendering = parser.get<bool>("--pipelined_rendering");
+    const auto lowLatency = parser.get<bool>("--low_latency");
+    const auto compoundLayout = parser.get<bool>("--compound_layout");
+    const auto voxelCollision = parser.get<bool>("--voxel_collision");
+    const auto batchedRendering = parser.get<bool>("--batched_rendering");
+    const auto bakeLayout = parser.get<bool>("--bake_layout");
+    const auto occlusionCulling = parser.get<bool>("--occlusion_culling");
+    const auto frontToBack = parser.get<bool>("--front_to_back");
+    const auto depthPrepass = parser.get<bool>("--depth_prepass");
+    const auto skipUnchangedViews = parser.get<bool>("--skip_unchanged_views");
     const auto viz = parser.get<bool>("--visualize");
     const auto delayMs = parser.get<int>("--delay_ms");
     const auto performanceTest = parser.get<bool>("--performance_test");
     const auto hires = parser.get<bool>("--hires");
+    const auto benchmarkSteps = parser.get<int>("--benchmark_steps");
+    const auto benchmarkOutput = parser.get<std::string>("--benchmark_output");
+    const auto perfCounters = parser.get<bool>("--perf_counters");
     const bool randomActions = !parser.get<bool>("--user_actions");
+    std::vector<int> cpuAffinity;
+    for (const auto &cpu : splitString(parser.get<std::string>("--cpu_affinity"), ","))
+        cpuAffinity.emplace_back(std::stoi(cpu));
+
+    const auto tracePath = parser.get<std::string>("--trace");
+    const auto profile = parser.get<bool>("--profile") || !tracePath.empty();
+
+    sprof().setEnabled(profile);
+    sprof().setTraceEnabled(!tracePath.empty());
 
     const int W = hires ? 800 : 128, H = hires ? 450 : 72;
     TLOG(INFO) << "Rendering resolution is [" << W << "x" << H << "] per agent";
@@ -247,29 +359,72 @@ int main(int argc, char** argv)
     // FloatParams params{{Str::episodeLengthSec, 0.1f}};
     FloatParams params{{}};
 
-    std::vector<std::unique_ptr<Env>> envs;
-    for (int i = 0; i < numEnvs; ++i) {
-        envs.emplace_back(std::make_unique<Env>(scenarioName, numAgents, params));
-        envs[i]->seed(42 + i);
-    }
+    auto envs = VectorEnv::createEnvs(numEnvs, numSimulationThreads, [&](int envIdx) {
+        auto env = std::make_unique<Env>(scenarioName, numAgents, params);
+        env->seed(42 + envIdx);
+        env->setCompoundStaticLayout(compoundLayout);
+        env->setVoxelCollisionFastPath(voxelCollision);
+        return env;
+    }, cpuAffinity);
+
+    // imshow() takes the frames as they are, benchmarks keep the default RGBA8 that needs no conversion pass
+    ObservationOptions obsOptions;
+    if (viz)
+        obsOptions.format = ObservationFormat::BGRA8;
+    if (shading == "lambert")
+        obsOptions.shading = ShadingModel::Lambert;
+    else if (shading == "flat")
+        obsOptions.shading = ShadingModel::Flat;
 
     std::unique_ptr<EnvRenderer> renderer;
     if (useVulkanRenderer)
 #if defined (CORRADE_TARGET_APPLE)
         TLOG(ERROR) << "Vulkan not supported on MacOS";
 #else
-        renderer = std::make_unique<V4REnvRenderer>(envs, W, H, nullptr, false);
+        renderer = std::make_unique<V4REnvRenderer>(envs, W, H, nullptr, false, 0, obsOptions, commandStreams);
 #endif
+    else if (renderThreads > 1)
+        renderer = std::make_unique<MultiContextEnvRenderer>(envs, W, H, renderThreads, std::vector<int>{0}, obsOptions);
     else {
         constexpr auto debugDraw = false;
-        renderer = std::make_unique<MagnumEnvRenderer>(envs, W, H, debugDraw);
+        auto magnumRenderer = std::make_unique<MagnumEnvRenderer>(envs, W, H, debugDraw, false, nullptr, batchedRendering, obsOptions);
+        magnumRenderer->setLayoutBaking(bakeLayout);
+        magnumRenderer->setOcclusionCulling(occlusionCulling);
+        magnumRenderer->setFrontToBack(frontToBack);
+        magnumRenderer->setDepthPrepass(depthPrepass);
+        magnumRenderer->setSkipUnchangedViews(skipUnchangedViews);
+        renderer = std::move(magnumRenderer);
     }
 
-    VectorEnv vectorEnv{envs, *renderer, numSimulationThreads};
+    const auto scheduler = workStealing ? VectorEnv::Scheduler::WorkStealing : VectorEnv::Scheduler::Static;
+    VectorEnv vectorEnv{envs, *renderer, numSimulationThreads, scheduler, cpuAffinity};
+    vectorEnv.setSpinBudget(spinBudget);
+    vectorEnv.setPipelinedRendering(pipelinedRendering);
+    vectorEnv.setThreadAutoTuning(autoTuneThreads);
+    vectorEnv.setLowLatency(lowLatency);
     vectorEnv.reset();
 
+    if (benchmarkSteps > 0) {
+        BenchmarkOptions options;
+        options.numSteps = benchmarkSteps;
+        options.perfCounters = perfCounters;
+        const auto json = runBenchmark(vectorEnv, options).toJson();
+        vectorEnv.close();
+
+        std::cout << json << std::endl;
+        if (!benchmarkOutput.empty()) {
+            std::ofstream f{benchmarkOutput};
+            if (!(f << json << "\n")) {
+                TLOG(ERROR) << "Could not write the benchmark report to " << benchmarkOutput;
+                return EXIT_FAILURE;
+            }
+        }
+
+        return EXIT_SUCCESS;
+    }
+
     tprof().startTimer("loop");
-    auto nFrames = mainLoop(vectorEnv, *renderer, viz, performanceTest, randomActions, W, H, useVulkanRenderer, delayMs, maxNumFrames);
+    auto nFrames = mainLoop(vectorEnv, *renderer, viz, performanceTest, randomActions, W, H, delayMs, maxNumFrames);
     const auto usecPassed = tprof().stopTimer("loop");
     tprof().stopTimer("step");
 
@@ -279,5 +434,15 @@ int main(int argc, char** argv)
 
     TLOG(DEBUG) << "\n\n" << fps << " FPS! " << nFrames << " frames";
 
+    if (profile) {
+        sprof().collect();
+        TLOG(INFO) << "Profiler zones:\n" << sprof().summary();
+        if (sprof().droppedEvents())
+            TLOG(WARNING) << sprof().droppedEvents() << " profiler events were dropped";
+
+        if (!tracePath.empty() && sprof().writeChromeTrace(tracePath))
+            TLOG(INFO) << "Trace saved to " << tracePath;
+    }
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,215 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <Magnum/GL/TimeQuery.h>
+
+#include <util/util.hpp>
+#include <util/argparse.hpp>
+#include <util/tiny_logger.hpp>
+#include <util/string_utils.hpp>
+#include <util/tiny_profiler.hpp>
+
+#include <env/env.hpp>
+
+#include <scenarios/init.hpp>
+
+#if !defined(CORRADE_TARGET_APPLE)
+#include <v4r_rendering/v4r_env_renderer.hpp>
+#endif
+
+#include <magnum_rendering/magnum_env_renderer.hpp>
+
+#include "viewer_args.hpp"
+
+
+using namespace Megaverse;
+
+
+struct BenchmarkConfig
+{
+    bool vulkan;
+    int w, h, numEnvs, numAgents;
+};
+
+struct RenderStats
+{
+    float fps, drawMs, gpuMs, submitMs, waitMs;
+};
+
+
+/**
+ * Rotate all agents a little, so every frame has new camera matrices. No simulation happens, the scene is exactly
+ * what the scenario generated for the seed.
+ */
+void moveCameras(Envs &envs)
+{
+    for (auto &env : envs)
+        for (auto &agent : env->getAgents())
+            agent->rotateYAxis(0.02f);
+}
+
+void preDraw(EnvRenderer &renderer, Envs &envs)
+{
+    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx)
+        renderer.preDraw(*envs[envIdx], envIdx);
+}
+
+/**
+ * Renders the same scene snapshot for numFrames, first synchronously and then pipelined.
+ * GPU time is measured with timer queries in the OpenGL renderer and is not available for Vulkan.
+ */
+RenderStats benchmarkRenderer(const std::string &scenarioName, const BenchmarkConfig &cfg, int numFrames)
+{
+    Envs envs;
+    for (int i = 0; i < cfg.numEnvs; ++i) {
+        envs.emplace_back(std::make_unique<Env>(scenarioName, cfg.numAgents));
+        envs[i]->seed(42 + i);
+        envs[i]->reset();
+    }
+
+    std::unique_ptr<EnvRenderer> renderer;
+    if (cfg.vulkan)
+#if defined (CORRADE_TARGET_APPLE)
+        TLOG(ERROR) << "Vulkan not supported on MacOS";
+#else
+        renderer = std::make_unique<V4REnvRenderer>(envs, cfg.w, cfg.h, nullptr, false);
+#endif
+    else
+        renderer = std::make_unique<MagnumEnvRenderer>(envs, cfg.w, cfg.h);
+
+    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx)
+        renderer->reset(*envs[envIdx], envIdx);
+
+    // warmup: shader compilation, first uploads, lazy allocations
+    for (int i = 0; i < 10; ++i) {
+        preDraw(*renderer, envs);
+        renderer->draw(envs);
+    }
+
+    RenderStats stats{};
+    float totalUsec = 0, drawUsec = 0;
+    double gpuNs = 0;
+
+    for (int frame = 0; frame < numFrames; ++frame) {
+        tprof().startTimer("frame");
+        moveCameras(envs);
+        preDraw(*renderer, envs);
+
+        Magnum::GL::TimeQuery query{Magnum::NoCreate};
+        if (!cfg.vulkan) {
+            query = Magnum::GL::TimeQuery{Magnum::GL::TimeQuery::Target::TimeElapsed};
+            query.begin();
+        }
+
+        tprof().startTimer("draw");
+        renderer->draw(envs);
+        drawUsec += tprof().stopTimer("draw");
+
+        if (!cfg.vulkan) {
+            query.end();
+            gpuNs += double(query.result<Magnum::UnsignedLong>());
+        }
+
+        totalUsec += tprof().stopTimer("frame");
+    }
+
+    float submitUsec = 0, waitUsec = 0;
+    for (int frame = 0; frame < numFrames; ++frame) {
+        tprof().startTimer("wait");
+        renderer->waitForFrame();
+        waitUsec += tprof().stopTimer("wait");
+
+        moveCameras(envs);
+        preDraw(*renderer, envs);
+
+        tprof().startTimer("submit");
+        renderer->drawAsync(envs);
+        submitUsec += tprof().stopTimer("submit");
+    }
+    renderer->waitForFrame();
+
+    stats.fps = float(numFrames) / (totalUsec * 1e-6f);
+    stats.drawMs = drawUsec / 1000.0f / float(numFrames);
+    stats.gpuMs = cfg.vulkan ? -1.0f : float(gpuNs * 1e-6 / numFrames);
+    stats.submitMs = submitUsec / 1000.0f / float(numFrames);
+    stats.waitMs = waitUsec / 1000.0f / float(numFrames);
+    return stats;
+}
+
+std::vector<int> parseIntList(const std::string &s)
+{
+    std::vector<int> res;
+    for (const auto &item : splitString(s, ","))
+        res.emplace_back(std::stoi(item));
+
+    return res;
+}
+
+
+int main(int argc, char** argv)
+{
+    scenariosGlobalInit();
+
+    auto parser = viewerStandardArgParse("render_benchmark");
+    parser.add_description("Measures renderer throughput alone (no simulation): renders a fixed scene snapshot\n"
+                           "(scenario generated with a fixed seed) for every combination of resolution,\n"
+                           "number of envs and agents per env, and prints the results as CSV.\n"
+                           "gpu_ms is -1 when not available (Vulkan), wait_ms is the time spent in waitForFrame()\n"
+                           "in pipelined mode, i.e. rendering and readback that did not overlap with the CPU.\n\n"
+                           "Example:\n"
+                           "render_benchmark --scenario ObstaclesHard --resolutions 128x72,256x144 --num_envs_list 8,32 --num_agents_list 1,4\n");
+
+    parser.add_argument("--resolutions")
+        .help("comma-separated list of WxH")
+        .default_value(std::string{"128x72"});
+    parser.add_argument("--num_envs_list")
+        .help("comma-separated list of env counts")
+        .default_value(std::string{"1,8,32"});
+    parser.add_argument("--num_agents_list")
+        .help("comma-separated list of agents per env")
+        .default_value(std::string{"1,2,4"});
+    parser.add_argument("--num_frames")
+        .help("number of measured frames per configuration and mode")
+        .default_value(200)
+        .scan<'i', int>();
+    parser.add_argument("--csv")
+        .help("write the results to this file instead of stdout")
+        .default_value(std::string{});
+
+    parseArgs(parser, argc, argv);
+
+    const auto scenarioName = parser.get<std::string>("--scenario");
+    const auto vulkan = !parser.get<bool>("--use_opengl");
+    const auto numFrames = parser.get<int>("--num_frames");
+    const auto csvPath = parser.get<std::string>("--csv");
+
+    std::ofstream csvFile;
+    if (!csvPath.empty())
+        csvFile.open(csvPath);
+    std::ostream &out = csvPath.empty() ? std::cout : csvFile;
+
+    out << "renderer,scenario,width,height,num_envs,num_agents,fps,observations_per_sec,draw_ms,gpu_ms,submit_ms,wait_ms" << std::endl;
+
+    for (const auto &resolution : splitString(parser.get<std::string>("--resolutions"), ",")) {
+        const auto wh = splitString(resolution, "x");
+        if (wh.size() != 2) {
+            TLOG(ERROR) << "Could not parse resolution " << resolution;
+            return EXIT_FAILURE;
+        }
+
+        for (auto numEnvs : parseIntList(parser.get<std::string>("--num_envs_list"))) {
+            for (auto numAgents : parseIntList(parser.get<std::string>("--num_agents_list"))) {
+                const BenchmarkConfig cfg{vulkan, std::stoi(wh[0]), std::stoi(wh[1]), numEnvs, numAgents};
+                TLOG(INFO) << "Benchmarking " << cfg.w << "x" << cfg.h << " " << numEnvs << " envs " << numAgents << " agents";
+
+                const auto s = benchmarkRenderer(scenarioName, cfg, numFrames);
+                out << (vulkan ? "v4r" : "magnum") << "," << scenarioName << "," << cfg.w << "," << cfg.h << ","
+                    << numEnvs << "," << numAgents << "," << s.fps << "," << s.fps * float(numEnvs * numAgents) << ","
+                    << s.drawMs << "," << s.gpuMs << "," << s.submitMs << "," << s.waitMs << std::endl;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
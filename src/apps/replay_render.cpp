@@ -0,0 +1,208 @@
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <util/util.hpp>
+#include <util/argparse.hpp>
+#include <util/tiny_logger.hpp>
+#include <util/tiny_profiler.hpp>
+#include <util/filesystem_utils.hpp>
+
+#include <env/env.hpp>
+#include <env/trajectory_recorder.hpp>
+
+#include <scenarios/init.hpp>
+
+#if !defined(CORRADE_TARGET_APPLE)
+#include <v4r_rendering/v4r_env_renderer.hpp>
+#endif
+
+#include <magnum_rendering/magnum_env_renderer.hpp>
+
+#include "viewer_args.hpp"
+
+
+using namespace Megaverse;
+
+
+struct ReplayConfig
+{
+    bool vulkan;
+    int w, h;
+    std::string outDir;
+    int frameEvery, maxFrames;
+};
+
+
+struct ReplayStats
+{
+    int numFrames = 0;
+    float renderSec = 0;
+};
+
+/**
+ * Per-env replay state: the scene graph objects of the regenerated episode in recording order.
+ */
+struct ReplayEnv
+{
+    std::vector<Object3D *> objects;
+    bool needsRendererReset = false;
+};
+
+
+void applyTransforms(ReplayEnv &replayEnv, const TrajectoryReader::Record &record)
+{
+    for (const auto &[idx, transform] : record.transforms) {
+        // objects added by the scenario logic mid-episode don't exist in the regenerated scene
+        if (idx < int(replayEnv.objects.size()))
+            replayEnv.objects[idx]->setTransformation(transform);
+    }
+}
+
+void saveObservations(const EnvRenderer &renderer, const Envs &envs, const ReplayConfig &cfg, int frame)
+{
+    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
+        for (int agentIdx = 0; agentIdx < envs[envIdx]->getNumAgents(); ++agentIdx) {
+            const cv::Mat bgr(cfg.h, cfg.w, CV_8UC3, const_cast<uint8_t *>(renderer.getObservation(envIdx, agentIdx)));
+
+            std::ostringstream filename;
+            filename << "env" << envIdx << "_agent" << agentIdx << "_" << std::setw(6) << std::setfill('0') << frame << ".png";
+            cv::imwrite(pathJoin(cfg.outDir, filename.str()), bgr);
+        }
+    }
+}
+
+/**
+ * Regenerates the layout of every recorded episode from its seed and moves the scene graph objects to the recorded
+ * poses. Neither physics nor the scenario logic run after the layout generation, all envs are rendered in one
+ * batch per recorded frame.
+ */
+ReplayStats replay(TrajectoryReader &reader, const ReplayConfig &cfg)
+{
+    const auto &metadata = reader.getMetadata();
+
+    Envs envs;
+    for (auto numAgents : metadata.numAgents) {
+        envs.emplace_back(std::make_unique<Env>(metadata.scenario, numAgents, metadata.floatParams));
+        envs.back()->reset();
+    }
+
+    // frames go straight to imwrite()
+    const ObservationOptions obsOptions{ObservationFormat::BGR8};
+
+    std::unique_ptr<EnvRenderer> renderer;
+    if (cfg.vulkan)
+#if defined (CORRADE_TARGET_APPLE)
+        TLOG(ERROR) << "Vulkan not supported on MacOS";
+#else
+        renderer = std::make_unique<V4REnvRenderer>(envs, cfg.w, cfg.h, nullptr, false, 0, obsOptions);
+#endif
+    else
+        renderer = std::make_unique<MagnumEnvRenderer>(envs, cfg.w, cfg.h, false, false, nullptr, false, obsOptions);
+
+    ReplayStats stats;
+    if (!renderer)
+        return stats;
+
+    std::vector<ReplayEnv> replayEnvs(envs.size());
+    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
+        sceneObjectsInOrder(envs[envIdx]->getScene(), replayEnvs[envIdx].objects);
+        renderer->reset(*envs[envIdx], envIdx);
+    }
+
+    int frame = 0;
+    TrajectoryReader::Record record;
+
+    while (reader.next(record) && (cfg.maxFrames <= 0 || stats.numFrames < cfg.maxFrames)) {
+        if (record.type == TrajectoryRecorder::EPISODE) {
+            auto &env = *envs[record.envIdx];
+            env.resetWithLayoutSeed(record.layoutSeed);
+
+            auto &replayEnv = replayEnvs[record.envIdx];
+            sceneObjectsInOrder(env.getScene(), replayEnv.objects);
+            replayEnv.needsRendererReset = true;
+
+            applyTransforms(replayEnv, record);
+        } else if (record.type == TrajectoryRecorder::STEP) {
+            applyTransforms(replayEnvs[record.envIdx], record);
+        } else {
+            const bool render = frame++ % cfg.frameEvery == 0;
+            if (!render)
+                continue;
+
+            tprof().startTimer("render");
+            for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
+                if (replayEnvs[envIdx].needsRendererReset) {
+                    renderer->reset(*envs[envIdx], envIdx);
+                    replayEnvs[envIdx].needsRendererReset = false;
+                }
+
+                renderer->preDraw(*envs[envIdx], envIdx);
+            }
+
+            renderer->draw(envs);
+            stats.renderSec += tprof().stopTimer("render") * 1e-6f;
+
+            saveObservations(*renderer, envs, cfg, frame - 1);
+            ++stats.numFrames;
+        }
+    }
+
+    return stats;
+}
+
+
+int main(int argc, char** argv)
+{
+    scenariosGlobalInit();
+
+    auto parser = viewerStandardArgParse("replay_render");
+    parser.add_description("Renders a trajectory recording (see TrajectoryRecorder) again at an arbitrary resolution,\n"
+                           "without physics or scenario logic, and saves the agent views as PNG frames\n"
+                           "env<i>_agent<j>_<frame>.png. The scenario and env setup are taken from the recording.\n\n"
+                           "Example:\n"
+                           "replay_render --recording eval.mgtr --width 768 --height 432 --out_dir frames\n");
+
+    parser.add_argument("--recording")
+        .help("trajectory recording to replay")
+        .required();
+    parser.add_argument("--width")
+        .default_value(768)
+        .scan<'i', int>();
+    parser.add_argument("--height")
+        .default_value(432)
+        .scan<'i', int>();
+    parser.add_argument("--out_dir")
+        .help("directory for the frames, must exist")
+        .default_value(std::string{"."});
+    parser.add_argument("--frame_every")
+        .help("render every n-th recorded frame")
+        .default_value(1)
+        .scan<'i', int>();
+    parser.add_argument("--max_frames")
+        .help("stop after this many rendered frames, 0 renders the whole recording")
+        .default_value(0)
+        .scan<'i', int>();
+
+    parseArgs(parser, argc, argv);
+
+    const ReplayConfig cfg{
+        !parser.get<bool>("--use_opengl"), parser.get<int>("--width"), parser.get<int>("--height"),
+        parser.get<std::string>("--out_dir"), std::max(parser.get<int>("--frame_every"), 1), parser.get<int>("--max_frames"),
+    };
+
+    TrajectoryReader reader{parser.get<std::string>("--recording")};
+    if (!reader.isOpen())
+        return EXIT_FAILURE;
+
+    TLOG(INFO) << "Replaying " << reader.getMetadata().numAgents.size() << " envs of " << reader.getMetadata().scenario
+               << " at " << cfg.w << "x" << cfg.h;
+
+    const auto stats = replay(reader, cfg);
+    TLOG(INFO) << "Rendered " << stats.numFrames << " frames in " << stats.renderSec << " sec ("
+               << float(stats.numFrames) / std::max(stats.renderSec, 1e-6f) << " FPS)";
+    return EXIT_SUCCESS;
+}
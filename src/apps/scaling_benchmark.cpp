@@ -0,0 +1,214 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <util/util.hpp>
+#include <util/argparse.hpp>
+#include <util/tiny_logger.hpp>
+#include <util/string_utils.hpp>
+
+#include <env/env.hpp>
+#include <env/vector_env.hpp>
+#include <env/vector_env_benchmark.hpp>
+
+#include <scenarios/init.hpp>
+
+#if !defined(CORRADE_TARGET_APPLE)
+#include <v4r_rendering/v4r_env_renderer.hpp>
+#endif
+
+#include <magnum_rendering/magnum_env_renderer.hpp>
+
+#include "viewer_args.hpp"
+
+
+using namespace Megaverse;
+
+
+struct ScalingConfig
+{
+    std::string scenario, renderer;
+    int numThreads, numEnvs, numAgents;
+};
+
+
+/**
+ * Fresh envs, renderer and VectorEnv for every configuration, so the runs don't share caches or allocations
+ * (process-wide layout caches of the scenarios excepted).
+ */
+BenchmarkReport benchmarkConfig(const ScalingConfig &cfg, const BenchmarkOptions &options, int w, int h)
+{
+    auto envs = VectorEnv::createEnvs(cfg.numEnvs, cfg.numThreads, [&](int envIdx) {
+        auto env = std::make_unique<Env>(cfg.scenario, cfg.numAgents);
+        env->seed(42 + envIdx);
+        return env;
+    });
+
+    std::unique_ptr<EnvRenderer> renderer;
+    if (cfg.renderer == "v4r")
+#if defined (CORRADE_TARGET_APPLE)
+        TLOG(ERROR) << "Vulkan not supported on MacOS";
+#else
+        renderer = std::make_unique<V4REnvRenderer>(envs, w, h, nullptr, false);
+#endif
+    else
+        renderer = std::make_unique<MagnumEnvRenderer>(envs, w, h);  // windowless EGL context, no display needed
+
+    VectorEnv vectorEnv{envs, *renderer, cfg.numThreads};
+    vectorEnv.reset();
+
+    auto report = runBenchmark(vectorEnv, options);
+    vectorEnv.close();
+    return report;
+}
+
+std::vector<int> parseIntList(const std::string &s)
+{
+    std::vector<int> res;
+    for (const auto &item : splitString(s, ","))
+        res.emplace_back(std::stoi(item));
+
+    return res;
+}
+
+
+int main(int argc, char** argv)
+{
+    scenariosGlobalInit();
+
+    auto parser = viewerStandardArgParse("scaling_benchmark");
+    parser.add_description("Measures how VectorEnv scales: runs the built-in random policy benchmark (see runBenchmark())\n"
+                           "for every combination of scenario, renderer, number of simulation threads, envs and agents\n"
+                           "per env, and prints the results as CSV. scaling_efficiency is the FPS relative to the\n"
+                           "smallest thread count of the same configuration, divided by the ratio of thread counts.\n"
+                           "For every configuration the last thread count that still scales (efficiency above\n"
+                           "--efficiency_threshold) is logged.\n\n"
+                           "Example:\n"
+                           "scaling_benchmark --scenarios Collect,ObstaclesHard --renderers magnum --num_threads_list 1,2,4,8 --num_envs_list 16,64\n");
+
+    parser.add_argument("--scenarios")
+        .help("comma-separated list of scenarios, --scenario if empty")
+        .default_value(std::string{});
+    parser.add_argument("--renderers")
+        .help("comma-separated list of renderers (magnum, v4r), --use_opengl selects one if empty")
+        .default_value(std::string{});
+    parser.add_argument("--num_threads_list")
+        .help("comma-separated list of simulation thread counts, in increasing order")
+        .default_value(std::string{"1,2,4,8"});
+    parser.add_argument("--num_envs_list")
+        .help("comma-separated list of env counts")
+        .default_value(std::string{"16,64"});
+    parser.add_argument("--num_agents_list")
+        .help("comma-separated list of agents per env")
+        .default_value(std::string{"1"});
+    parser.add_argument("--num_steps")
+        .help("number of measured steps per configuration")
+        .default_value(500)
+        .scan<'i', int>();
+    parser.add_argument("--warmup_steps")
+        .help("number of steps before the measurement")
+        .default_value(100)
+        .scan<'i', int>();
+    parser.add_argument("--perf_counters")
+        .help("also count cycles, instructions, LLC and branch misses per stage (Linux perf_event, in the --json reports)")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--efficiency_threshold")
+        .help("scaling efficiency below which VectorEnv is considered to stop scaling")
+        .default_value(0.8f)
+        .scan<'g', float>();
+    parser.add_argument("--csv")
+        .help("write the results to this file instead of stdout")
+        .default_value(std::string{});
+    parser.add_argument("--json")
+        .help("also write the full reports (including the per-stage breakdown) to this file")
+        .default_value(std::string{});
+
+    parseArgs(parser, argc, argv);
+
+    auto scenarios = splitString(parser.get<std::string>("--scenarios"), ",");
+    if (scenarios.empty())
+        scenarios.emplace_back(parser.get<std::string>("--scenario"));
+
+    auto renderers = splitString(parser.get<std::string>("--renderers"), ",");
+    if (renderers.empty())
+        renderers.emplace_back(parser.get<bool>("--use_opengl") ? "magnum" : "v4r");
+
+    for (const auto &r : renderers)
+        if (r != "magnum" && r != "v4r") {
+            TLOG(ERROR) << "Unknown renderer " << r;
+            return EXIT_FAILURE;
+        }
+
+    const auto threadCounts = parseIntList(parser.get<std::string>("--num_threads_list"));
+    const auto threshold = parser.get<float>("--efficiency_threshold");
+
+    BenchmarkOptions options;
+    options.numSteps = parser.get<int>("--num_steps");
+    options.warmupSteps = parser.get<int>("--warmup_steps");
+    options.perfCounters = parser.get<bool>("--perf_counters");
+
+    const auto csvPath = parser.get<std::string>("--csv"), jsonPath = parser.get<std::string>("--json");
+
+    std::ofstream csvFile;
+    if (!csvPath.empty())
+        csvFile.open(csvPath);
+    std::ostream &out = csvPath.empty() ? std::cout : csvFile;
+
+    std::ofstream jsonFile;
+    if (!jsonPath.empty())
+        jsonFile.open(jsonPath), jsonFile << "[";
+    bool firstJson = true;
+
+    out << "renderer,scenario,num_threads,num_envs,num_agents,fps,steps_per_sec,scaling_efficiency,rss_mb" << std::endl;
+
+    constexpr int w = 128, h = 72;
+
+    for (const auto &scenario : scenarios) {
+        for (const auto &rendererName : renderers) {
+            for (auto numEnvs : parseIntList(parser.get<std::string>("--num_envs_list"))) {
+                for (auto numAgents : parseIntList(parser.get<std::string>("--num_agents_list"))) {
+                    double baseFps = 0;
+                    int baseThreads = 0, lastScaling = 0;
+
+                    for (auto numThreads : threadCounts) {
+                        const ScalingConfig cfg{scenario, rendererName, numThreads, numEnvs, numAgents};
+                        TLOG(INFO) << "Benchmarking " << scenario << " " << rendererName << " " << numThreads << " threads "
+                                   << numEnvs << " envs " << numAgents << " agents";
+
+                        const auto report = benchmarkConfig(cfg, options, w, h);
+                        if (!baseThreads)
+                            baseFps = report.fps, baseThreads = numThreads;
+
+                        const auto efficiency = baseFps > 0 ? report.fps / (baseFps * numThreads / baseThreads) : 0.0;
+                        if (efficiency >= threshold)
+                            lastScaling = numThreads;
+
+                        out << rendererName << "," << scenario << "," << numThreads << "," << numEnvs << "," << numAgents << ","
+                            << report.fps << "," << report.stepsPerSec << "," << efficiency << "," << report.rssBytes / (1 << 20) << std::endl;
+
+                        if (jsonFile.is_open()) {
+                            jsonFile << (firstJson ? "\n" : ",\n") << "{\"renderer\":\"" << rendererName << "\",\"scenario\":\"" << scenario
+                                     << "\",\"num_threads\":" << numThreads << ",\"scaling_efficiency\":" << efficiency
+                                     << ",\"report\":" << report.toJson() << "}";
+                            firstJson = false;
+                        }
+                    }
+
+                    TLOG(INFO) << scenario << " " << rendererName << " " << numEnvs << " envs " << numAgents
+                               << " agents: scales up to " << lastScaling << " threads (efficiency >= " << threshold << ")";
+                }
+            }
+        }
+    }
+
+    if (jsonFile.is_open()) {
+        jsonFile << "\n]\n";
+        if (!jsonFile) {
+            TLOG(ERROR) << "Could not write " << jsonPath;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
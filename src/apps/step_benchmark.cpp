@@ -0,0 +1,156 @@
+#include <cstdlib>
+
+#include <util/util.hpp>
+#include <util/argparse.hpp>
+#include <util/tiny_logger.hpp>
+#include <util/tiny_profiler.hpp>
+
+#include <env/env.hpp>
+#include <env/const.hpp>
+
+#include <scenarios/init.hpp>
+
+#include "viewer_args.hpp"
+
+
+using namespace Megaverse;
+
+
+struct BenchmarkResult
+{
+    /// average duration of Env::step() in microseconds
+    float stepUsec = 0;
+
+    /// to compare the behaviour of agent controllers: average distance an agent travels per step and reward per episode
+    float agentDistancePerStep = 0, rewardPerEpisode = 0;
+};
+
+/**
+ * Simulates numEnvs environments for numSteps steps with random actions, no rendering.
+ */
+BenchmarkResult benchmarkScenario(
+    const std::string &scenarioName, int numAgents, int numEnvs, int numSteps, bool kinematicFastPath,
+    const FloatParams &params = {}
+)
+{
+    std::vector<std::unique_ptr<Env>> envs;
+    for (int i = 0; i < numEnvs; ++i) {
+        envs.emplace_back(std::make_unique<Env>(scenarioName, numAgents, params));
+        envs[i]->seed(42 + i);
+        envs[i]->setKinematicStepFastPath(kinematicFastPath);
+        envs[i]->reset();
+    }
+
+    Rng rng{42};
+    BenchmarkResult result;
+    double distance = 0, reward = 0;
+    int numEpisodes = 0;
+
+    for (int step = 0; step < numSteps; ++step) {
+        for (auto &env : envs) {
+            std::vector<Magnum::Vector3> positions;
+            for (int i = 0; i < env->getNumAgents(); ++i) {
+                auto randomAction = randRange(0, int(Action::NumActions), rng);
+                env->setAction(i, Action(1 << randomAction));
+                positions.emplace_back(env->getAgents()[i]->absoluteTransformation().translation());
+            }
+
+            tprof().startTimer("step");
+            env->step();
+            result.stepUsec += tprof().stopTimer("step");
+
+            for (int i = 0; i < env->getNumAgents(); ++i)
+                distance += (env->getAgents()[i]->absoluteTransformation().translation() - positions[i]).length();
+
+            // resets are not what we're measuring here
+            if (env->isDone()) {
+                for (int i = 0; i < env->getNumAgents(); ++i)
+                    reward += env->getTotalReward(i);
+
+                ++numEpisodes;
+                env->reset();
+            }
+        }
+    }
+
+    result.stepUsec /= float(numEnvs * numSteps);
+    result.agentDistancePerStep = float(distance / (double(numEnvs) * numSteps * numAgents));
+    result.rewardPerEpisode = numEpisodes > 0 ? float(reward / (double(numEpisodes) * numAgents)) : 0.0f;
+    return result;
+}
+
+
+int main(int argc, char** argv)
+{
+    scenariosGlobalInit();
+
+    auto parser = viewerStandardArgParse("step_benchmark");
+    parser.add_description("Measures the cost of Env::step() (simulation only, no rendering) for each scenario\n"
+                           "with and without the kinematic-only physics fast path.\n"
+                           "With --compare_agents compares DefaultKinematicAgent to VoxelKinematicAgent instead,\n"
+                           "with --compare_broadphase the AABB tree to the sweep and prune broadphase.\n\n"
+                           "Example:\n"
+                           "step_benchmark --all_scenarios --num_envs 16 --num_steps 2000 --num_agents 1\n");
+
+    parser.add_argument("--all_scenarios")
+        .help("Benchmark every registered scenario instead of just --scenario")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--compare_agents")
+        .help("Benchmark the agent controllers: step time, distance traveled and reward with random actions")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--compare_broadphase")
+        .help("Benchmark the physics broadphases: btDbvtBroadphase vs btAxisSweep3 over the voxel grid bounds")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--num_envs")
+        .help("number of environments to simulate (sequentially, in one thread)")
+        .default_value(8)
+        .scan<'i', int>();
+    parser.add_argument("--num_steps")
+        .help("number of steps per environment")
+        .default_value(1000)
+        .scan<'i', int>();
+
+    parseArgs(parser, argc, argv);
+
+    const auto numAgents = parser.get<int>("--num_agents");
+    const auto numEnvs = parser.get<int>("--num_envs");
+    const auto numSteps = parser.get<int>("--num_steps");
+
+    std::vector<std::string> scenarios{parser.get<std::string>("--scenario")};
+    if (parser.get<bool>("--all_scenarios")) {
+        scenarios = Scenario::registeredScenarios();
+        scenarios.erase(std::remove(scenarios.begin(), scenarios.end(), "Test"), scenarios.end());
+    }
+
+    for (const auto &scenarioName : scenarios) {
+        if (parser.get<bool>("--compare_agents")) {
+            const auto d = benchmarkScenario(scenarioName, numAgents, numEnvs, numSteps, true);
+            const auto v = benchmarkScenario(scenarioName, numAgents, numEnvs, numSteps, true, {{Str::voxelAgentController, 1.0f}});
+
+            TLOG(INFO) << scenarioName << ": default agent " << d.stepUsec << " us, voxel agent " << v.stepUsec << " us ("
+                       << 100 * (1 - v.stepUsec / d.stepUsec) << "% saved), distance/step " << d.agentDistancePerStep
+                       << " vs " << v.agentDistancePerStep << ", reward/episode " << d.rewardPerEpisode << " vs " << v.rewardPerEpisode;
+            continue;
+        }
+
+        if (parser.get<bool>("--compare_broadphase")) {
+            const auto treeUsec = benchmarkScenario(scenarioName, numAgents, numEnvs, numSteps, true).stepUsec;
+            const auto sweepUsec = benchmarkScenario(scenarioName, numAgents, numEnvs, numSteps, true, {{Str::axisSweepBroadphase, 1.0f}}).stepUsec;
+
+            TLOG(INFO) << scenarioName << ": AABB tree " << treeUsec << " us, sweep and prune " << sweepUsec << " us ("
+                       << 100 * (1 - sweepUsec / treeUsec) << "% saved)";
+            continue;
+        }
+
+        const auto fullUsec = benchmarkScenario(scenarioName, numAgents, numEnvs, numSteps, false).stepUsec;
+        const auto fastUsec = benchmarkScenario(scenarioName, numAgents, numEnvs, numSteps, true).stepUsec;
+
+        TLOG(INFO) << scenarioName << ": full step " << fullUsec << " us, kinematic fast path " << fastUsec
+                   << " us, saved " << (fullUsec - fastUsec) << " us/step (" << 100 * (1 - fastUsec / fullUsec) << "%)";
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -69,7 +69,9 @@ void ViewerApp::tickEvent()
         env->reset();
     }
 
-    Viewer::step(std::vector<bool>(1, done));
+    std::vector<bool> dones(envs.size(), false);
+    dones[activeEnv] = done;
+    Viewer::step(dones);
 }
 
 void ViewerApp::drawEvent()
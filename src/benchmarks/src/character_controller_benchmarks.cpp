@@ -0,0 +1,77 @@
+#include <memory>
+
+#include <util/scoped_profiler.hpp>
+
+#include <character_controller_testbed.hpp>
+
+#include "microbenchmark.hpp"
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+// agents reach the end of the canned layout in about this many ticks, then the testbed is rebuilt
+constexpr int ticksPerEpisode = 100, warmupTicks = 5;
+
+/**
+ * One iteration is one tick of all agents. Time of the individual controller stages comes from the profiler zones
+ * of KinematicCharacterController and is reported per call.
+ */
+template<typename AgentT>
+void controllerImpl(BenchmarkState &state, ControllerLayout layout, int numAgents)
+{
+    std::unique_ptr<ControllerTestbed<AgentT>> testbed;
+
+    const auto wasEnabled = ScopedProfiler::enabled();
+    sprof().collect();
+    sprof().clear();
+
+    while (state.keepRunning()) {
+        if (!testbed || testbed->getNumTicks() >= ticksPerEpisode) {
+            state.pauseTiming();
+            sprof().setEnabled(false);
+
+            // drain the ring buffers before they overflow
+            sprof().collect();
+
+            testbed = std::make_unique<ControllerTestbed<AgentT>>(layout, numAgents);
+            for (int i = 0; i < warmupTicks; ++i)
+                testbed->tick();
+
+            sprof().setEnabled(true);
+            state.resumeTiming();
+        }
+
+        testbed->tick();
+    }
+
+    sprof().setEnabled(wasEnabled);
+    sprof().collect();
+
+    for (const auto zone : {"KCC::playerStep", "KCC::stepUp", "KCC::stepForwardAndStrafe", "KCC::stepDown", "KCC::recoverFromPenetration"}) {
+        const auto h = sprof().histogram(zone);
+        if (h.count)
+            state.setCounter(std::string{zone + 5} + "_ns", h.meanNs());
+    }
+
+    sprof().clear();
+}
+
+}
+
+
+MICROBENCHMARK(kinematicFloor1) { controllerImpl<DefaultKinematicAgent>(state, ControllerLayout::Floor, 1); }
+MICROBENCHMARK(kinematicFloor16) { controllerImpl<DefaultKinematicAgent>(state, ControllerLayout::Floor, 16); }
+MICROBENCHMARK(kinematicStairs1) { controllerImpl<DefaultKinematicAgent>(state, ControllerLayout::Stairs, 1); }
+MICROBENCHMARK(kinematicStairs16) { controllerImpl<DefaultKinematicAgent>(state, ControllerLayout::Stairs, 16); }
+MICROBENCHMARK(kinematicWalls1) { controllerImpl<DefaultKinematicAgent>(state, ControllerLayout::Walls, 1); }
+MICROBENCHMARK(kinematicWalls16) { controllerImpl<DefaultKinematicAgent>(state, ControllerLayout::Walls, 16); }
+MICROBENCHMARK(kinematicGaps1) { controllerImpl<DefaultKinematicAgent>(state, ControllerLayout::Gaps, 1); }
+MICROBENCHMARK(kinematicGaps16) { controllerImpl<DefaultKinematicAgent>(state, ControllerLayout::Gaps, 16); }
+
+// the cheaper controller, for comparison
+MICROBENCHMARK(voxelKinematicFloor16) { controllerImpl<VoxelKinematicAgent>(state, ControllerLayout::Floor, 16); }
+MICROBENCHMARK(voxelKinematicGaps16) { controllerImpl<VoxelKinematicAgent>(state, ControllerLayout::Gaps, 16); }
@@ -0,0 +1,84 @@
+#include <util/tiny_logger.hpp>
+
+#include <env/env.hpp>
+
+#include <scenarios/init.hpp>
+#include <scenarios/layout_utils.hpp>
+
+#include "microbenchmark.hpp"
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+/**
+ * Voxels of a real generated layout: the env is reset once and we copy the voxel grid of its scenario into a
+ * separate component, so that merging the boxes can be repeated without regenerating the level.
+ */
+template<typename VoxelT>
+void toBoundingBoxesImpl(BenchmarkState &state, const std::string &scenarioName)
+{
+    scenariosGlobalInit();
+
+    Env env{scenarioName, 1};
+    env.reset();
+
+    const auto layout = dynamic_cast<const VoxelGridComponent<VoxelT> *>(env.getScenario().layoutCollisionQuery());
+    if (!layout) {
+        TLOG(ERROR) << "Scenario " << scenarioName << " does not have a voxel layout of the expected type";
+        return;
+    }
+
+    const auto voxels = layout->snapshot();
+    VoxelGridComponent<VoxelT> vg{env.getScenario()};
+    vg.restore(voxels);
+
+    while (state.keepRunning())
+        doNotOptimize(vg.toBoundingBoxes());
+}
+
+/// Floor, walls and blocks as toBoundingBoxes() typically returns them.
+Boxes layoutBoxes()
+{
+    Boxes boxes;
+    boxes.push_back({{0, 0, 0}, {39, 0, 39}});
+
+    for (int i = 0; i < 40; i += 4) {
+        boxes.push_back({{i, 1, 0}, {i + 3, 4, 0}});
+        boxes.push_back({{0, 1, i}, {0, 4, i + 3}});
+        boxes.push_back({{i, 1, 20}, {i + 1, 1 + i % 3, 21}});
+    }
+
+    return boxes;
+}
+
+void addBoundingBoxesImpl(BenchmarkState &state, bool addCollisions)
+{
+    const auto boxes = layoutBoxes();
+
+    Env::EnvState envState{1};
+    DrawablesMap drawables;
+
+    while (state.keepRunning()) {
+        state.pauseTiming();
+        for (auto &d : drawables)
+            d.clear();
+        envState.reset();
+        state.resumeTiming();
+
+        addBoundingBoxes(drawables, envState, boxes, VoxelState::generateType(true, true), ColorRgb::LAYOUT_DEFAULT, 1.0f, addCollisions);
+    }
+}
+
+}
+
+
+MICROBENCHMARK(toBoundingBoxesObstaclesEasy) { toBoundingBoxesImpl<VoxelObstacles>(state, "ObstaclesEasy"); }
+MICROBENCHMARK(toBoundingBoxesObstaclesHard) { toBoundingBoxesImpl<VoxelObstacles>(state, "ObstaclesHard"); }
+MICROBENCHMARK(toBoundingBoxesCollect) { toBoundingBoxesImpl<VoxelCollect>(state, "Collect"); }
+
+MICROBENCHMARK(addBoundingBoxesDrawablesOnly) { addBoundingBoxesImpl(state, false); }
+MICROBENCHMARK(addBoundingBoxesWithCollisions) { addBoundingBoxesImpl(state, true); }
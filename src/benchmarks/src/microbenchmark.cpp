@@ -0,0 +1,126 @@
+#include <string>
+#include <chrono>
+#include <utility>
+#include <iomanip>
+#include <fstream>
+#include <iostream>
+
+#include <util/argparse.hpp>
+
+#include "microbenchmark.hpp"
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+uint64_t nowNs()
+{
+    using namespace std::chrono;
+    return uint64_t(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+struct Registration
+{
+    const char *name;
+    BenchmarkFunc func;
+};
+
+std::vector<Registration> & registry()
+{
+    static std::vector<Registration> benchmarks;
+    return benchmarks;
+}
+
+}
+
+
+void BenchmarkState::pauseTiming()
+{
+    totalNs += nowNs() - startNs;
+}
+
+void BenchmarkState::resumeTiming()
+{
+    startNs = nowNs();
+}
+
+bool Megaverse::registerMicrobenchmark(const char *name, BenchmarkFunc func)
+{
+    registry().push_back({name, func});
+    return true;
+}
+
+
+int main(int argc, char** argv)
+{
+    argparse::ArgumentParser parser("run_microbenchmarks");
+    parser.add_description("Microbenchmarks of the voxel storage and the layout helpers, prints ns per iteration.\n\n"
+                           "Example:\n"
+                           "run_microbenchmarks --filter chunked --min_time 0.5 --csv voxels.csv\n");
+
+    parser.add_argument("--filter")
+        .help("only run the benchmarks whose name contains this substring")
+        .default_value(std::string{});
+    parser.add_argument("--min_time")
+        .help("minimum measured time per benchmark, seconds")
+        .default_value(0.2f)
+        .scan<'g', float>();
+    parser.add_argument("--csv")
+        .help("also write the results to this file")
+        .default_value(std::string{});
+
+    try {
+        parser.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << std::endl << parser;
+        return EXIT_FAILURE;
+    }
+
+    const auto filter = parser.get<std::string>("--filter");
+    const auto minTimeNs = uint64_t(parser.get<float>("--min_time") * 1e9f);
+    const auto csvPath = parser.get<std::string>("--csv");
+
+    std::ofstream csv;
+    if (!csvPath.empty())
+        csv.open(csvPath), csv << "name,iterations,ns_per_iteration,counters\n";
+
+    std::cout << std::left << std::setw(48) << "benchmark" << std::right << std::setw(14) << "iterations" << std::setw(16) << "ns/iter" << "\n";
+
+    for (const auto &[name, func] : registry()) {
+        if (!filter.empty() && std::string{name}.find(filter) == std::string::npos)
+            continue;
+
+        // grow the number of iterations until the run is long enough to trust the timer
+        int64_t iterations = 1;
+        BenchmarkState state{iterations};
+        while (true) {
+            state = BenchmarkState{iterations};
+            func(state);
+
+            if (state.elapsedNs() >= minTimeNs || iterations >= (int64_t(1) << 40))
+                break;
+
+            const auto scale = state.elapsedNs() > 0 ? double(minTimeNs) * 1.2 / double(state.elapsedNs()) : 100.0;
+            iterations = std::max(iterations + 1, int64_t(double(iterations) * std::min(scale, 100.0)));
+        }
+
+        const auto nsPerIteration = double(state.elapsedNs()) / double(state.getIterations());
+        std::cout << std::left << std::setw(48) << name << std::right << std::setw(14) << state.getIterations()
+                  << std::setw(16) << std::fixed << std::setprecision(1) << nsPerIteration;
+        for (const auto &[counter, value] : state.getCounters())
+            std::cout << "  " << counter << "=" << value;
+        std::cout << std::endl;
+
+        if (csv.is_open()) {
+            csv << name << "," << state.getIterations() << "," << nsPerIteration << ",";
+            for (const auto &[counter, value] : state.getCounters())
+                csv << counter << "=" << value << ";";
+            csv << "\n";
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace Megaverse
+{
+
+/**
+ * Minimal Google-Benchmark-style harness: the benchmark body loops while keepRunning() and the runner picks the
+ * number of iterations so that each benchmark runs for at least the minimum time.
+ */
+class BenchmarkState
+{
+public:
+    explicit BenchmarkState(int64_t iterations)
+    : iterations{iterations}
+    {
+    }
+
+    bool keepRunning()
+    {
+        if (!running) {
+            running = true;
+            resumeTiming();
+        }
+
+        if (done < iterations) {
+            ++done;
+            return true;
+        }
+
+        pauseTiming();
+        return false;
+    }
+
+    /// Exclude the setup of the next iteration (i.e. resetting the state) from the measurement.
+    void pauseTiming();
+
+    void resumeTiming();
+
+    int64_t getIterations() const { return iterations; }
+
+    uint64_t elapsedNs() const { return totalNs; }
+
+    /// Extra result reported next to the time per iteration, i.e. the cost of the individual stages.
+    void setCounter(const std::string &name, double value) { counters.emplace_back(name, value); }
+
+    const std::vector<std::pair<std::string, double>> & getCounters() const { return counters; }
+
+private:
+    int64_t iterations, done = 0;
+    bool running = false;
+    uint64_t startNs = 0, totalNs = 0;
+
+    std::vector<std::pair<std::string, double>> counters;
+};
+
+using BenchmarkFunc = void (*)(BenchmarkState &);
+
+bool registerMicrobenchmark(const char *name, BenchmarkFunc func);
+
+/// Keeps the compiler from optimizing away the computation of the value.
+template<typename T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+}
+
+
+#define MICROBENCHMARK(name) \
+    static void name(::Megaverse::BenchmarkState &); \
+    static const bool name##Registered = ::Megaverse::registerMicrobenchmark(#name, name); \
+    static void name(::Megaverse::BenchmarkState &state)
@@ -0,0 +1,206 @@
+#include <random>
+
+#include <util/voxel_grid.hpp>
+
+#include <env/voxel_state.hpp>
+
+#include "microbenchmark.hpp"
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+constexpr int gridSize = 64, numCoords = 1 << 14;
+
+/// Coords of a typical layout: most of the random accesses hit the floor and the walls, some hit empty space.
+std::vector<VoxelCoords> randomCoords()
+{
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<int> xz{0, gridSize - 1}, y{0, 15};
+
+    std::vector<VoxelCoords> coords(numCoords);
+    for (auto &c : coords)
+        c = {xz(rng), y(rng), xz(rng)};
+
+    return coords;
+}
+
+const std::vector<VoxelCoords> & coords()
+{
+    static const auto c = randomCoords();
+    return c;
+}
+
+template<typename Grid>
+void fillLayout(Grid &grid)
+{
+    const auto solid = makeVoxel<VoxelState>(VoxelState::generateType(true, true));
+
+    // floor, outer walls and a few pillars
+    for (int x = 0; x < gridSize; ++x)
+        for (int z = 0; z < gridSize; ++z) {
+            const bool wall = x == 0 || z == 0 || x == gridSize - 1 || z == gridSize - 1;
+            const bool pillar = x % 8 == 4 && z % 8 == 4;
+            grid.setColumn(x, z, 0, wall || pillar ? 7 : 0, solid);
+        }
+}
+
+template<typename Grid>
+Grid makeGrid()
+{
+    Grid grid{size_t(gridSize * gridSize * 16), {0, 0, 0}, 1};
+    fillLayout(grid);
+    return grid;
+}
+
+template<typename Grid>
+void getImpl(BenchmarkState &state)
+{
+    const auto grid = makeGrid<Grid>();
+    const auto &c = coords();
+
+    size_t i = 0;
+    while (state.keepRunning()) {
+        doNotOptimize(grid.get(c[i]));
+        i = (i + 1) & (numCoords - 1);
+    }
+}
+
+template<typename Grid>
+void hasVoxelImpl(BenchmarkState &state)
+{
+    const auto grid = makeGrid<Grid>();
+    const auto &c = coords();
+
+    size_t i = 0;
+    while (state.keepRunning()) {
+        doNotOptimize(grid.hasVoxel(c[i]));
+        i = (i + 1) & (numCoords - 1);
+    }
+}
+
+template<typename Grid>
+void setImpl(BenchmarkState &state)
+{
+    auto grid = makeGrid<Grid>();
+    const auto &c = coords();
+    const auto solid = makeVoxel<VoxelState>(VoxelState::generateType(true, false));
+
+    size_t i = 0;
+    while (state.keepRunning()) {
+        grid.set(c[i], solid);
+        i = (i + 1) & (numCoords - 1);
+    }
+
+    doNotOptimize(grid);
+}
+
+/// Manual column scan, what the callers of the hash map grid have to do.
+template<typename Grid>
+void columnScanImpl(BenchmarkState &state)
+{
+    const auto grid = makeGrid<Grid>();
+    const auto &c = coords();
+
+    size_t i = 0;
+    while (state.keepRunning()) {
+        bool any = false;
+        for (int y = 1; y < 8 && !any; ++y) {
+            const auto v = grid.get({c[i].x(), y, c[i].z()});
+            any = v && v->solid();
+        }
+
+        doNotOptimize(any);
+        i = (i + 1) & (numCoords - 1);
+    }
+}
+
+/// Fill of a 16x4x16 box, i.e. a platform added to the layout.
+template<typename Grid>
+void bboxFillImpl(BenchmarkState &state)
+{
+    Grid grid{size_t(gridSize * gridSize * 16), {0, 0, 0}, 1};
+    const auto solid = makeVoxel<VoxelState>(VoxelState::generateType(true, true));
+
+    while (state.keepRunning()) {
+        state.pauseTiming();
+        grid.clear();
+        state.resumeTiming();
+
+        for (int x = 8; x < 24; ++x)
+            for (int y = 0; y < 4; ++y)
+                for (int z = 8; z < 24; ++z)
+                    grid.set({x, y, z}, solid);
+    }
+
+    doNotOptimize(grid);
+}
+
+template<typename Grid>
+void bboxFillColumnsImpl(BenchmarkState &state)
+{
+    Grid grid{size_t(gridSize * gridSize * 16), {0, 0, 0}, 1};
+    const auto solid = makeVoxel<VoxelState>(VoxelState::generateType(true, true));
+
+    while (state.keepRunning()) {
+        state.pauseTiming();
+        grid.clear();
+        state.resumeTiming();
+
+        for (int x = 8; x < 24; ++x)
+            for (int z = 8; z < 24; ++z)
+                grid.setColumn(x, z, 0, 3, solid);
+    }
+
+    doNotOptimize(grid);
+}
+
+using HashGrid = VoxelGrid<VoxelState>;
+using ChunkedGrid = ChunkedVoxelGrid<VoxelState>;
+
+}
+
+
+MICROBENCHMARK(hashGridGet) { getImpl<HashGrid>(state); }
+MICROBENCHMARK(chunkedGridGet) { getImpl<ChunkedGrid>(state); }
+
+MICROBENCHMARK(hashGridHasVoxel) { hasVoxelImpl<HashGrid>(state); }
+MICROBENCHMARK(chunkedGridHasVoxel) { hasVoxelImpl<ChunkedGrid>(state); }
+
+MICROBENCHMARK(hashGridSet) { setImpl<HashGrid>(state); }
+MICROBENCHMARK(chunkedGridSet) { setImpl<ChunkedGrid>(state); }
+
+MICROBENCHMARK(hashGridColumnScan) { columnScanImpl<HashGrid>(state); }
+MICROBENCHMARK(chunkedGridColumnScan) { columnScanImpl<ChunkedGrid>(state); }
+
+MICROBENCHMARK(chunkedGridAnyInColumn)
+{
+    const auto grid = makeGrid<ChunkedGrid>();
+    const auto &c = coords();
+
+    size_t i = 0;
+    while (state.keepRunning()) {
+        doNotOptimize(grid.anyInColumn(c[i].x(), c[i].z(), 1, 7, VOXEL_SOLID));
+        i = (i + 1) & (numCoords - 1);
+    }
+}
+
+MICROBENCHMARK(chunkedGridFindInColumn)
+{
+    const auto grid = makeGrid<ChunkedGrid>();
+    const auto &c = coords();
+
+    size_t i = 0;
+    while (state.keepRunning()) {
+        // first free voxel above the floor, i.e. spawn point search
+        doNotOptimize(grid.findInColumn(c[i].x(), c[i].z(), 0, 15, VOXEL_SOLID, false));
+        i = (i + 1) & (numCoords - 1);
+    }
+}
+
+MICROBENCHMARK(hashGridBboxFill) { bboxFillImpl<HashGrid>(state); }
+MICROBENCHMARK(chunkedGridBboxFill) { bboxFillImpl<ChunkedGrid>(state); }
+MICROBENCHMARK(chunkedGridBboxFillColumns) { bboxFillColumnsImpl<ChunkedGrid>(state); }
@@ -0,0 +1,434 @@
+#pragma once
+
+#include <memory>
+
+#include <env/env.hpp>
+#include <env/env_renderer.hpp>
+#include <env/ray_sensors.hpp>
+
+#include <rendering/symbolic_env_renderer.hpp>
+
+
+namespace Megaverse
+{
+
+class VectorEnv;
+class ObservationEncoder;
+
+
+/**
+ * One action per action space, each within the size of its space.
+ */
+template<typename T>
+bool validActions(const T *actions, int numActions)
+{
+    const auto &spaceSizes = Env::actionSpaceSizes;
+    if (numActions != int(spaceSizes.size()))
+        return false;
+
+    for (int i = 0; i < numActions; ++i)
+        if (actions[i] < 0 || actions[i] >= spaceSizes[i])
+            return false;
+
+    return true;
+}
+
+/**
+ * Convert a tuple of discrete actions (one per action space) into an action bitmask. Callers check the actions with
+ * validActions(), out of range values are ignored here.
+ */
+template<typename T>
+Action decodeActions(const T *actions, int numActions)
+{
+    // first bit of the mask for each action space, precomputed once
+    static const std::vector<int> actionOffsets = [] {
+        std::vector<int> offsets;
+        int actionIdx = 0;
+        for (auto spaceSize : Env::actionSpaceSizes) {
+            offsets.push_back(actionIdx);
+            actionIdx += spaceSize - 1;  // number of non-idle actions
+        }
+        return offsets;
+    }();
+
+    int actionMask = 0;
+    for (int i = 0; i < numActions && i < int(actionOffsets.size()); ++i) {
+        const auto action = int(actions[i]);
+        if (action > 0 && action < Env::actionSpaceSizes[i])
+            actionMask |= 1 << (actionOffsets[i] + action);
+    }
+
+    return Action(actionMask);
+}
+
+
+/**
+ * Batch of envs with their renderer and simulation threads behind one interface, for embedding Megaverse into C++
+ * programs (i.e. a C++ learner) without Python. The Python module is a thin wrapper over this class.
+ * Actions go in as one int32 array per step, observations, rewards and dones come out as pointers to contiguous
+ * buffers that are updated in place by every step (see VectorEnv), nothing is copied.
+ * Agents are indexed env-major: agent #i of env #e is e * numAgentsPerEnv + i.
+ *
+ * Typical loop:
+ *   BatchedEnv env{"ObstaclesEasy", 128, 72, 64, 2, 8, true, {}};
+ *   env.seed(42), env.reset();
+ *   while (...) {
+ *       env.setActionsBatched(actions);
+ *       env.stepAsync();  // observations of the previous step remain valid until stepWait()
+ *       env.stepWait();
+ *       consume(env.getObservationsBatch(), env.getRewards(), env.getDones());
+ *   }
+ *
+ * Configuration methods marked "before the first reset" only take effect when the renderer is created, in the
+ * first call to reset(). Not thread-safe: one instance should be used from the thread that created it (the OpenGL
+ * renderer makes its EGL context current there), different instances are independent.
+ */
+class BatchedEnv
+{
+public:
+    BatchedEnv(
+        const std::string &scenario, int w, int h, int numEnvs, int numAgentsPerEnv, int numSimulationThreads,
+        bool useVulkan, const FloatParams &floatParams
+    );
+
+    /**
+     * Multi-task batch: envs are split between the scenarios in contiguous blocks (see envScenarios()) and share
+     * the renderer, the simulation threads and all batched buffers. Rendering one big batch is much cheaper than
+     * one batch per scenario.
+     */
+    BatchedEnv(
+        const std::vector<std::string> &scenarios, int w, int h, int numEnvs, int numAgentsPerEnv,
+        int numSimulationThreads, bool useVulkan, const FloatParams &floatParams
+    );
+
+    ~BatchedEnv();
+
+    void seed(int seedValue);
+
+    /// Creates the renderer on the first call.
+    void reset();
+
+    int numEnvs() const;
+
+    int numAgents() const;
+
+    /// Scenario of every env.
+    std::vector<std::string> envScenarios() const;
+
+    /// Case-insensitive, the constructors abort on scenarios that are not registered.
+    static bool isRegisteredScenario(const std::string &scenario);
+
+    /**
+     * Shrink or grow the batch up to the number of envs it was created with, without rebuilding the envs, the threads
+     * or the renderer (see VectorEnv::setNumActiveEnvs()). Batched actions, observations, rewards and dones only
+     * cover the active envs.
+     */
+    void setNumActiveEnvs(int n);
+
+    int getNumActiveEnvs() const;
+
+    /// @return false if the agent does not exist or the actions fail validActions()
+    bool setActions(int envIdx, int agentIdx, const std::vector<int> &actions);
+
+    /**
+     * Set actions for all active agents at once.
+     * @param actions int32 array of shape (numActiveEnvs * numAgentsPerEnv, numActionSpaces), numActionSpaces must
+     * be Env::actionSpaceSizes.size().
+     * @return false if the shape does not match.
+     */
+    bool setActionsBatched(const int32_t *actions, int numAgentsTotal, int numActionSpaces);
+
+    /**
+     * Only agents with a non-zero entry get their observations rendered after the following steps, the others keep
+     * stale observations (see VectorEnv::setRenderMask()). An empty mask renders all agents again.
+     * @param mask numActiveEnvs * numAgentsPerEnv entries, or none.
+     */
+    bool setRenderMask(const uint8_t *mask, int size);
+
+    void step();
+
+    /**
+     * Launch the simulation step in the background. Observations from the previous step remain valid until
+     * stepWait() is called, but actions, rewards and dones should not be accessed in between.
+     */
+    void stepAsync();
+
+    void stepWait();
+
+    /**
+     * EnvPool-style stepping, see VectorEnv::send(): set the actions of the given envs and start stepping them.
+     * @param actions int32 array of shape (numEnvIds * numAgentsPerEnv, numActionSpaces), agents of envIds[0] first.
+     */
+    bool send(const int *envIds, int numEnvIds, const int32_t *actions, int numActionSpaces);
+
+    /// First batchSize envs that finished, their observations, rewards and dones are valid until they are sent again.
+    const std::vector<int> & recv(int batchSize);
+
+    /**
+     * Copy the current state of env envIdx into the target envs, i.e. for batched tree search (see VectorEnv::fork()).
+     * Observations of the targets are valid after the next step.
+     */
+    bool fork(int envIdx, const int *targetIds, int numTargets);
+
+    bool isDone(int envIdx) const;
+
+    /**
+     * Buffers of the last step, valid after the first call to reset() and until close(): one reward and true
+     * objective per agent, one done flag per env, and one per agent (agents can finish before their env does).
+     */
+    const float * getRewards() const;
+    const uint8_t * getDones() const;
+    const uint8_t * getAgentDones() const;
+    const float * getTrueObjectives() const;
+
+    /// Agents that finished before their env stop moving and are not rendered, see VectorEnv::setFreezeDoneAgents().
+    void setFreezeDoneAgents(bool freeze);
+
+    /// Step and render inline on the calling thread for interactive use with a few envs, see VectorEnv::setLowLatency().
+    void setLowLatency(bool enabled);
+
+    /// Helper threads that move the agents of each env in parallel, see VectorEnv::setPhysicsWorkers().
+    void setPhysicsWorkers(int numThreads);
+
+    /// Keep the last frame of every episode in a separate buffer, see VectorEnv::setTerminalObservations().
+    void setTerminalObservations(bool enabled);
+
+    /// Envs that finished in the last step, and their terminal frames (nullptr for the other envs).
+    const std::vector<int> & getTerminalEnvs() const;
+    const uint8_t * getTerminalObservation(int envIdx, int agentIdx) const;
+
+    /// Finished episodes kept between VectorEnv::popEpisodeStats() calls, 0 disables them.
+    void setEpisodeStatsCapacity(int capacity);
+
+    float trueObjective(int envIdx, int agentIdx) const;
+
+    /// Shape of one observation, (H, W, C) or the shape of the symbolic observations.
+    std::vector<int> observationShape() const;
+
+    const uint8_t * getObservation(int envIdx, int agentIdx) const;
+
+    /// All observations of the active agents in one buffer, nullptr for channels the renderer does not produce.
+    const uint8_t * getObservationsBatch(ObservationChannel channel = ObservationChannel::Color) const;
+
+    /// Observations in GPU memory, nullptr unless the renderer supports it (Vulkan without pipelining).
+    const uint8_t * getObservationsBatchDevice() const;
+
+    /// Render resolution, observations are downsampled from it, auxiliary channels are always at this resolution.
+    int width() const;
+    int height() const;
+
+    const ObservationOptions & getObservationOptions() const;
+
+    /// Call this before the first reset. See ObservationOptions for the encoding.
+    void setAuxiliaryOutputs(bool depth, bool segmentation);
+
+    /// Call this before the first reset. Observations are (w / downsample, h / downsample) in the given format.
+    bool setObservationFormat(ObservationFormat format, int downsample);
+
+    /// Call this before the first reset. Cheaper lighting for low-resolution observations, see ShadingModel.
+    void setShading(ShadingModel shading);
+
+    /**
+     * Call this before the first reset. Allocation of the observation buffers of the batch, see HostMemoryPolicy.
+     * Pinned buffers are registered with CUDA where the Vulkan renderer is built, otherwise they get huge pages only.
+     */
+    void setHostMemoryPolicy(HostMemoryPolicy policy);
+
+    /**
+     * Call this before the first reset. The renderer keeps the last numFrames observations of every agent in GPU
+     * memory, frames are stored time-major for the whole batch (all envs in every slot), see
+     * EnvRenderer::setDeviceFrameStack().
+     */
+    void setDeviceFrameStack(int numFrames);
+
+    int getDeviceFrameStackSize() const;
+
+    /// Oldest frame first, nullptr without a frame stack.
+    const uint8_t * getFrameStackDevice() const;
+
+    /**
+     * Vulkan renderer only. Call this before the first reset. With more than one GPU the envs are distributed
+     * between the devices round-robin.
+     */
+    void setRenderGpus(const std::vector<int> &gpuIds);
+
+    /**
+     * Single-GPU Vulkan renderer only. Call this before the first reset. The envs are split into numStreams shards
+     * with a command stream each, submitted by the simulation threads as soon as all envs of the shard are stepped
+     * (see EnvRenderer::numShards()), instead of the whole batch after the step. One stream per simulation thread
+     * works best. Observations are then gathered on the host, so they are not available in device memory.
+     */
+    void setRenderCommandStreams(int numStreams);
+
+    /**
+     * OpenGL renderer only. Call this before the first reset. The envs are split into numThreads shards drawn
+     * concurrently, each on a render thread with its own EGL context (on the render GPUs round-robin, see
+     * MultiContextEnvRenderer). Helps when a single context can't keep the GPU busy, i.e. many small envs.
+     */
+    void setRenderThreads(int numThreads);
+
+    /**
+     * Pin the simulation threads to CPUs (one entry per thread, thread 0 is the thread calling step/reset, -1 to skip)
+     * and re-create the envs on the threads that step them, so their memory is allocated on the local NUMA node.
+     * Call this right after construction, before seed() and reset().
+     */
+    void setCpuAffinity(const std::vector<int> &cpus);
+
+    /**
+     * Envs in groups of groupSize share the fixed-size parts of their Bullet worlds (collision pools, solver scratch
+     * memory), see PhysicsResources. Saves several MB per env in large batches of small scenarios.
+     * Call this before the first reset.
+     */
+    void setPhysicsGroupSize(int groupSize);
+
+    /// Repeat every action for numFrames ticks, see VectorEnv::setFrameSkip().
+    void setFrameSkip(int numFrames);
+
+    /**
+     * Done envs return the terminal observation and are reset on a spare thread during the next step, in which they
+     * are masked out (zero reward, actions are ignored), see VectorEnv::setBackgroundResets().
+     */
+    void setBackgroundResets(bool enabled);
+
+    /**
+     * Done envs spend at most about this much of every step on their reset and stay masked out until it completes,
+     * see VectorEnv::setIncrementalResets(). 0 resets in one go.
+     */
+    void setIncrementalResets(uint64_t stepBudgetNs);
+
+    /**
+     * Fall detection of all envs of a simulation thread is checked in one pass after their physics step,
+     * see VectorEnv::setBatchedComponents().
+     */
+    void setBatchedComponents(bool enabled);
+
+    /**
+     * Measure the step time with 1, 2, 4, ... simulation threads for calibrationSteps steps each and keep the fastest
+     * thread count, with the envs split by their measured cost. Repeated every retuneInterval steps if > 0.
+     * The chosen configuration is reported in the VectorEnv stats, see VectorEnv::setThreadAutoTuning().
+     */
+    void setThreadAutoTuning(int calibrationSteps, int retuneInterval);
+
+    /**
+     * Call this before the first reset. Frames are ray traced on the simulation threads by RaycastEnvRenderer
+     * instead of OpenGL or Vulkan, for machines without GPUs. Also applies to drawHires().
+     */
+    void setCpuRendering(bool enabled);
+
+    /**
+     * Call this before the first reset. Replaces the renderer with SymbolicEnvRenderer: nothing is rendered,
+     * observations are computed from the voxel grids on the simulation threads.
+     */
+    bool setSymbolicObservations(const SymbolicObservationOptions &options);
+
+    bool symbolicObservations() const;
+
+    const SymbolicObservationOptions & getSymbolicObservationOptions() const;
+
+    /**
+     * Record actions, rewards and object poses of all envs into a compressed file, see TrajectoryRecorder.
+     * Replaces the previous recording, an empty filename stops recording.
+     */
+    void recordTrajectories(const std::string &filename);
+
+    /**
+     * Generate the layouts of the next queueDepth episodes of every env on numThreads low-priority threads, see
+     * EpisodePregenerator. Only scenarios with a layout cache (Obstacles) benefit. 0 disables it.
+     */
+    void pregenerateEpisodes(int queueDepth, int numThreads);
+
+    /**
+     * Play only the episodes of a dataset written by bakeEpisodeDataset(), memory-mapped and shared by all envs.
+     * The envs of its scenario sweep it in order, envs of other scenarios keep generating. An empty filename
+     * detaches it. Call this before reset().
+     * @return false if the file can't be loaded or fits no env
+     */
+    bool setEpisodeDataset(const std::string &filename);
+
+    /// Bake episodes #0..numEpisodes-1 of the seed into a file, see EpisodeDataset::bake().
+    static bool bakeEpisodeDataset(
+        const std::string &scenario, int numAgentsPerEnv, const FloatParams &floatParams, int seed, int numEpisodes,
+        const std::string &filename
+    );
+
+    /// Per-agent ray sensors updated after every step and reset, see RaySensors. 0 rays disables them.
+    bool enableRaySensors(const RaySensorOptions &options);
+
+    /// nullptr unless ray sensors are enabled.
+    const RaySensors * getRaySensors() const;
+
+    /**
+     * Compress the color observations on the simulation threads after every step (frame delta + LZ4,
+     * see FrameEncoder), for actors that receive them over the network.
+     * @param keyframeInterval a key frame every n frames, also at the start of every episode. 0 disables the
+     * periodic key frames, a negative value disables the encoding.
+     */
+    void encodeObservations(int keyframeInterval);
+
+    /// nullptr before the first reset or if the encoding is disabled.
+    const ObservationEncoder * getObservationEncoder() const;
+
+    /// Call this before the first call to drawHires().
+    void setHiresResolution(int w, int h);
+
+    int hiresWidth() const;
+    int hiresHeight() const;
+
+    /// Hires frames are BGR, they are only shown and encoded with OpenCV.
+    const ObservationOptions & getHiresObservationOptions() const;
+
+    /**
+     * Envs drawn by drawHires(), all of them if empty. Renderers without a second output resolution (Vulkan) still
+     * draw every env, the selection only limits the video frames.
+     */
+    bool setHiresEnvs(const std::vector<int> &envIndices);
+
+    void drawHires();
+
+    /// nullptr if drawHires() was not called.
+    const uint8_t * getHiresObservation(int envIdx, int agentIdx) const;
+
+    /**
+     * Encode every frame rendered by drawHires() into <prefix><env_idx>.mp4 on a background thread, all agents
+     * of an env side by side. An empty prefix stops the recording and finishes the files.
+     */
+    void recordVideo(const std::string &filenamePrefix, float fps);
+
+    /**
+     * Open the viewer window of the first env if it is not open yet (only in builds with GUI support). The viewer
+     * runs on its own thread at its own frame rate (see ViewerThread), steps only hand over a snapshot of the scene.
+     */
+    void drawOverview();
+
+    std::map<std::string, float> getRewardShaping(int envIdx, int agentIdx) const;
+
+    void setRewardShaping(int envIdx, int agentIdx, const std::map<std::string, float> &rewardShaping);
+
+    /**
+     * Update the given rewards of all agents at once without stalling the sampler, see
+     * VectorEnv::publishRewardShaping(). Can be called from another thread while the envs are stepping.
+     * @param values numEnvs * numAgentsPerEnv rows of rewardNames.size() values (all envs, NaN keeps the current value).
+     */
+    bool setRewardShapingBatched(const std::vector<std::string> &rewardNames, const float *values, int numAgentsTotal);
+
+    /**
+     * Host the envs for VectorEnvClient instances in other processes, see VectorEnvServer. Blocks until the server
+     * is terminated by stopServing() (i.e. from another thread) or by one of the clients.
+     * A name of the form tcp://[host]:port serves VectorEnvTcpClient instances on other nodes, see VectorEnvTcpServer.
+     */
+    void serve(const std::string &name, int numSlices);
+
+    void stopServing();
+
+    /// Stats and memory report, nullptr before the first reset.
+    VectorEnv * getVectorEnv();
+
+    /// Destroy the envs and the renderer, the instance can't be used after this.
+    void close();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl;
+};
+
+}
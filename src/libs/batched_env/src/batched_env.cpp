@@ -0,0 +1,1206 @@
+#include <algorithm>
+
+#include <util/tiny_logger.hpp>
+
+#include <env/vector_env.hpp>
+#include <env/vector_env_server.hpp>
+#include <env/trajectory_recorder.hpp>
+#include <env/observation_encoder.hpp>
+#include <env/episode_dataset.hpp>
+#include <env/episode_pregenerator.hpp>
+
+#include <rendering/video_encoder.hpp>
+#include <rendering/raycast_env_renderer.hpp>
+
+#include <scenarios/init.hpp>
+
+#include <magnum_rendering/magnum_env_renderer.hpp>
+#include <magnum_rendering/multi_context_env_renderer.hpp>
+
+#ifndef CORRADE_TARGET_APPLE
+    #include <v4r_rendering/v4r_env_renderer.hpp>
+    #include <v4r_rendering/multi_gpu_env_renderer.hpp>
+#endif
+
+#ifdef WITH_GUI
+    #include <viewer/viewer.hpp>
+    #include <viewer/viewer_thread.hpp>
+#endif
+
+#include <batched_env/batched_env.hpp>
+
+
+using namespace Megaverse;
+
+
+struct BatchedEnv::Impl
+{
+public:
+    Impl(
+        const std::vector<std::string> &scenarios, int w, int h, int numEnvs, int numAgentsPerEnv,
+        int numSimulationThreads, bool useVulkan, const FloatParams &floatParams
+    )
+        : numEnvs{numEnvs}
+        , numActiveEnvs{numEnvs}
+        , numAgentsPerEnv{numAgentsPerEnv}
+        , useVulkan{useVulkan}
+        , w{w}
+        , h{h}
+        , numSimulationThreads{numSimulationThreads}
+        , scenarios{scenarios}
+        , floatParams{floatParams}
+    {
+        TCHECK(!scenarios.empty() && int(scenarios.size()) <= numEnvs);
+
+        scenariosGlobalInit();
+
+        createEnvs();
+    }
+
+    ~Impl()
+    {
+        close();
+    }
+
+    void reset()
+    {
+        if (!vectorEnv) {
+            if (symbolic)
+                renderer = std::make_unique<SymbolicEnvRenderer>(envs, symbolicOptions);
+            else if (cpuRendering)
+                renderer = std::make_unique<RaycastEnvRenderer>(envs, w, h, obsOptions);
+            else if (useVulkan)
+#ifdef CORRADE_TARGET_APPLE
+                TLOG(ERROR) << "Vulkan not supported on MacOS";
+#else
+            {
+                if (renderGpus.size() > 1)
+                    renderer = std::make_unique<MultiGpuEnvRenderer>(envs, w, h, renderGpus, obsOptions);
+                else
+                    renderer = std::make_unique<V4REnvRenderer>(
+                        envs, w, h, nullptr, false, renderGpus.empty() ? 0 : renderGpus.front(), obsOptions, renderCommandStreams
+                    );
+            }
+#endif
+            else if (renderThreads > 1)
+                renderer = std::make_unique<MultiContextEnvRenderer>(
+                    envs, w, h, renderThreads, renderGpus.empty() ? std::vector<int>{0} : renderGpus, obsOptions
+                );
+            else
+                renderer = std::make_unique<MagnumEnvRenderer>(envs, w, h, false, false, nullptr, false, obsOptions);
+
+            if (frameStack > 0 && !renderer->setDeviceFrameStack(frameStack))
+                TLOG(ERROR) << "GPU frame stacking is only supported by the single-GPU Vulkan renderer";
+
+            vectorEnv = std::make_unique<VectorEnv>(envs, *renderer, numSimulationThreads, VectorEnv::Scheduler::Static, cpuAffinity);
+            vectorEnv->setFrameSkip(frameSkip);
+            vectorEnv->setBackgroundResets(backgroundResets);
+            vectorEnv->setIncrementalResets(incrementalResetBudgetNs);
+            vectorEnv->setBatchedComponents(batchedComponents);
+            vectorEnv->setFreezeDoneAgents(freezeDoneAgents);
+            vectorEnv->setPhysicsWorkers(physicsWorkers);
+            vectorEnv->setLowLatency(lowLatency);
+            vectorEnv->setEpisodeStatsCapacity(episodeStatsCapacity);
+            if (terminalObservations)
+                vectorEnv->setTerminalObservations(frameBytes());
+            vectorEnv->setThreadAutoTuning(calibrationSteps, retuneInterval);
+            vectorEnv->setEpisodePregenerator(pregenerator.get());
+            vectorEnv->setRecorder(recorder.get());
+            vectorEnv->setRaySensors(raySensors.get());
+            createObservationEncoder();
+
+            if (numActiveEnvs < numEnvs)
+                vectorEnv->setNumActiveEnvs(numActiveEnvs);
+        }
+
+        // this also resets the main renderer
+        vectorEnv->reset();
+        publishToViewer();
+    }
+
+    void setCpuAffinity(const std::vector<int> &cpus)
+    {
+        if (vectorEnv) {
+            TLOG(ERROR) << "CPU affinity must be set before the first reset";
+            return;
+        }
+
+        cpuAffinity = cpus;
+
+        envs.clear();
+        createEnvs();
+        if (physicsGroupSize > 1)
+            createPhysicsGroups();
+        if (episodeDataset)
+            attachEpisodeDataset();
+    }
+
+    void setPhysicsGroupSize(int groupSize)
+    {
+        if (vectorEnv) {
+            TLOG(ERROR) << "Physics groups must be set before the first reset";
+            return;
+        }
+
+        physicsGroupSize = std::max(groupSize, 1);
+        createPhysicsGroups();
+    }
+
+    /**
+     * Contiguous blocks of physicsGroupSize envs share their PhysicsResources, the static scheduler steps such a
+     * block on one thread (except at the shard boundaries), so the group locks are mostly uncontended.
+     */
+    void createPhysicsGroups()
+    {
+        std::shared_ptr<PhysicsResources> resources;
+        for (int envIdx = 0; envIdx < numEnvs; ++envIdx) {
+            if (envIdx % physicsGroupSize == 0)
+                resources = std::make_shared<PhysicsResources>(physicsGroupSize > 1);
+
+            envs[envIdx]->setPhysicsResources(resources);
+        }
+    }
+
+    void recordTrajectories(const std::string &filename)
+    {
+        if (vectorEnv)
+            vectorEnv->setRecorder(nullptr);
+        recorder.reset();
+
+        if (filename.empty())
+            return;
+
+        // the recording stores a single scenario for all envs
+        if (scenarios.size() > 1) {
+            TLOG(ERROR) << "Trajectory recording is not supported for multi-task batches";
+            return;
+        }
+
+        recorder = std::make_unique<TrajectoryRecorder>(filename, envs);
+        if (vectorEnv)
+            vectorEnv->setRecorder(recorder.get());
+    }
+
+    void pregenerateEpisodes(int queueDepth, int numThreads)
+    {
+        if (vectorEnv)
+            vectorEnv->setEpisodePregenerator(nullptr);
+        pregenerator.reset();
+
+        if (queueDepth > 0) {
+            pregenerator = std::make_unique<EpisodePregenerator>(envs, [this](int envIdx) { return makeEnv(envIdx); }, queueDepth, numThreads);
+            if (vectorEnv)
+                vectorEnv->setEpisodePregenerator(pregenerator.get());
+        }
+    }
+
+    bool setEpisodeDataset(const std::string &filename)
+    {
+        episodeDataset.reset();
+        if (!filename.empty() && !(episodeDataset = EpisodeDataset::load(filename)))
+            return false;
+
+        return attachEpisodeDataset();
+    }
+
+    /// Envs of the matching scenario sweep the dataset together, the others keep generating their episodes.
+    bool attachEpisodeDataset()
+    {
+        std::vector<int> matching;
+        for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
+            envs[envIdx]->setEpisodeDataset(nullptr);
+            if (episodeDataset && episodeDataset->matches(*envs[envIdx]))
+                matching.push_back(envIdx);
+        }
+
+        for (int i = 0; i < int(matching.size()); ++i)
+            envs[matching[i]]->setEpisodeDataset(episodeDataset, uint64_t(i), matching.size());
+
+        if (episodeDataset && matching.empty()) {
+            TLOG(ERROR) << "Episode dataset does not match the scenario or parameters of any env";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool enableRaySensors(const RaySensorOptions &options)
+    {
+        if (vectorEnv)
+            vectorEnv->setRaySensors(nullptr);
+        raySensors.reset();
+
+        if (options.numRays <= 0)
+            return true;
+
+        if (options.pitchDegrees.empty() || options.maxDistance <= 0) {
+            TLOG(ERROR) << "Ray sensors need at least one pitch and a positive max distance";
+            return false;
+        }
+
+        raySensors = std::make_unique<RaySensors>(envs, options);
+        if (vectorEnv)
+            vectorEnv->setRaySensors(raySensors.get());
+
+        return true;
+    }
+
+    void drawHires()
+    {
+        if (!vectorEnv)
+            reset();
+
+        // the main renderer draws the second resolution from its own scene state if it can
+        if (!hiresTier && !hiresRenderer) {
+            hiresTier = renderer->setHiresOutput(renderW, renderH, hiresObsOptions);
+            if (!hiresTier && !createHiresRenderer())
+                return;
+        }
+
+        std::vector<int> envIndices = hiresEnvs;
+        if (envIndices.empty())
+            for (int envIdx = 0; envIdx < numActiveEnvs; ++envIdx)
+                envIndices.push_back(envIdx);
+
+        if (hiresTier)
+            renderer->drawHires(envs, envIndices);
+        else {
+            // a separate renderer has to follow every reset of every env
+            for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
+                if (vectorEnv->done[envIdx])
+                    hiresRenderer->reset(*envs[envIdx], envIdx);
+
+                hiresRenderer->preDraw(*envs[envIdx], envIdx);
+            }
+
+            hiresRenderer->draw(envs);
+        }
+
+        if (videoEncoder) {
+            std::vector<const uint8_t *> tiles;
+            for (auto envIdx : envIndices) {
+                tiles.clear();
+                for (int agentIdx = 0; agentIdx < envs[envIdx]->getNumAgents(); ++agentIdx)
+                    tiles.push_back(hiresObservation(envIdx, agentIdx));
+
+                videoEncoder->pushFrame(envIdx, tiles.data(), int(tiles.size()), renderW, renderH);
+            }
+        }
+    }
+
+    void drawOverview()
+    {
+#ifdef WITH_GUI
+        if (viewer && !viewer->isRunning())
+            viewer.reset();
+
+        if (!viewer && Viewer::viewerExists) {
+            TLOG(INFO) << "Only one viewer per process is supported";
+            return;
+        }
+
+        if (!viewer) {
+            TLOG(INFO) << __FUNCTION__ << " Starting the viewer thread";
+            viewer = std::make_unique<ViewerThread>();
+            if (vectorEnv)
+                publishToViewer();
+        }
+#else
+        // TLOG(ERROR) << "Megaverse was built without GUI support";
+#endif
+    }
+
+    void serve(const std::string &name, int numSlices)
+    {
+        if (!vectorEnv)
+            reset();
+
+        // symbolic crops are served as (layers * W, W, 4) frames
+        int obsW = obsOptions.width(w), obsH = obsOptions.height(h), obsChannels = obsOptions.channels();
+        if (symbolic) {
+            obsW = symbolicOptions.width();
+            obsH = symbolicOptions.layers() * obsW, obsChannels = SymbolicObservationOptions::channels;
+        }
+
+        // tcp://[host]:port, the host part is ignored, the server listens on all interfaces
+        if (name.rfind("tcp://", 0) == 0) {
+            std::string host;
+            int port = 0;
+            if (!parseHostPort(name.substr(6), host, port)) {
+                TLOG(ERROR) << "Expected tcp://[host]:port, got " << name;
+                return;
+            }
+
+            tcpServer = std::make_unique<VectorEnvTcpServer>(*vectorEnv, obsW, obsH, obsChannels, port, numSlices);
+            tcpServer->serve();
+            return;
+        }
+
+        server = std::make_unique<VectorEnvServer>(*vectorEnv, obsW, obsH, obsChannels, name, numSlices);
+        server->serve();
+    }
+
+    void close()
+    {
+        server.reset();
+        tcpServer.reset();
+
+        if (vectorEnv) {
+            vectorEnv->setRecorder(nullptr);
+            vectorEnv->setObservationEncoder(nullptr);
+            vectorEnv->setEpisodePregenerator(nullptr);
+            vectorEnv->setRaySensors(nullptr);
+            vectorEnv->close();
+        }
+        recorder.reset();
+        observationEncoder.reset();
+        pregenerator.reset();
+        raySensors.reset();
+
+#ifdef WITH_GUI
+        viewer.reset();
+#endif
+
+        videoEncoder.reset();
+        hiresRenderer.reset();
+        hiresTier = false;
+        renderer.reset();
+        vectorEnv.reset();
+
+        envs.clear();
+    }
+
+    const std::string & scenarioOf(int envIdx) const
+    {
+        return scenarios[size_t(envIdx) * scenarios.size() / size_t(numEnvs)];
+    }
+
+    size_t frameBytes() const
+    {
+        return symbolic ? symbolicOptions.bytesPerFrame() : obsOptions.bytesPerFrame(w, h);
+    }
+
+    void createObservationEncoder()
+    {
+        vectorEnv->setObservationEncoder(nullptr);
+        observationEncoder.reset();
+
+        if (encoderKeyframeInterval < 0)
+            return;
+
+        observationEncoder = std::make_unique<ObservationEncoder>(envs, frameBytes(), encoderKeyframeInterval);
+        vectorEnv->setObservationEncoder(observationEncoder.get());
+    }
+
+    /**
+     * Scenario construction (layout generators, level databases, physics worlds) runs in parallel on the simulation
+     * threads. The renderers are created later, in the first reset().
+     */
+    void createEnvs()
+    {
+        // Python wrapper always steps with step_async(), where the main thread only renders
+        envs = VectorEnv::createEnvs(numEnvs, numSimulationThreads, [this](int envIdx) { return makeEnv(envIdx); }, cpuAffinity, true);
+    }
+
+    void publishToViewer()
+    {
+#ifdef WITH_GUI
+        if (viewer)
+            viewer->publish(envs);
+#endif
+    }
+
+    const uint8_t * hiresObservation(int envIdx, int agentIdx) const
+    {
+        if (hiresTier)
+            return renderer->getHiresObservation(envIdx, agentIdx);
+
+        return hiresRenderer ? hiresRenderer->getObservation(envIdx, agentIdx) : nullptr;
+    }
+
+    /**
+     * Fallback for renderers without a second output resolution: a full renderer at the hires resolution that
+     * re-runs reset() and preDraw() for every env.
+     */
+    bool createHiresRenderer()
+    {
+        if (cpuRendering)
+            hiresRenderer = std::make_unique<RaycastEnvRenderer>(envs, renderW, renderH, hiresObsOptions);
+        else if (useVulkan)
+#ifdef CORRADE_TARGET_APPLE
+            TLOG(ERROR) << "Vulkan not supported on MacOS";
+#else
+        {
+            // the hires renderer relies on the main renderer to clean the scene graph, which requires
+            // both of them to render the same set of envs
+            if (renderGpus.size() > 1) {
+                TLOG(ERROR) << "Hires rendering is not supported with multiple render GPUs";
+                return false;
+            }
+
+            hiresRenderer = std::make_unique<V4REnvRenderer>(envs, renderW, renderH, dynamic_cast<V4REnvRenderer *>(renderer.get()), true, 0, hiresObsOptions);
+        }
+#endif
+        else
+            hiresRenderer = std::make_unique<MagnumEnvRenderer>(envs, renderW, renderH, false, false, nullptr, false, hiresObsOptions);
+
+        if (!hiresRenderer)
+            return false;
+
+        for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx)
+            hiresRenderer->reset(*envs[envIdx], envIdx);
+
+        return true;
+    }
+
+    std::unique_ptr<Env> makeEnv(int envIdx) const
+    {
+        return std::make_unique<Env>(scenarioOf(envIdx), numAgentsPerEnv, floatParams);
+    }
+
+public:
+    Envs envs;
+    int numEnvs, numActiveEnvs, numAgentsPerEnv;
+
+    std::unique_ptr<VectorEnv> vectorEnv;
+    std::unique_ptr<EnvRenderer> renderer, hiresRenderer;
+    std::unique_ptr<VectorEnvServer> server;
+    std::unique_ptr<VectorEnvTcpServer> tcpServer;
+    std::unique_ptr<TrajectoryRecorder> recorder;
+    std::unique_ptr<ObservationEncoder> observationEncoder;
+    std::unique_ptr<EpisodePregenerator> pregenerator;
+    std::shared_ptr<const EpisodeDataset> episodeDataset;
+    std::unique_ptr<RaySensors> raySensors;
+    std::unique_ptr<VideoEncoder> videoEncoder;
+
+#ifdef WITH_GUI
+    std::unique_ptr<ViewerThread> viewer;
+#endif
+
+    bool useVulkan;
+    int w, h;
+    int renderW = 768, renderH = 432;
+
+    std::vector<int> renderGpus;
+    int renderCommandStreams = 1;
+    int renderThreads = 1;
+
+    ObservationOptions obsOptions;
+
+    // number of frames kept in GPU memory by the renderer, 0 for no frame stack
+    int frameStack = 0;
+
+    bool cpuRendering = false;
+
+    bool symbolic = false;
+    SymbolicObservationOptions symbolicOptions;
+
+    // hires frames are only shown and encoded with OpenCV, in its channel order
+    ObservationOptions hiresObsOptions{ObservationFormat::BGR8};
+
+    // whether the main renderer draws the hires frames, otherwise hiresRenderer does
+    bool hiresTier = false;
+    std::vector<int> hiresEnvs;
+
+    int numSimulationThreads;
+    std::vector<int> cpuAffinity;
+    int physicsGroupSize = 1;
+    int frameSkip = 1;
+    bool backgroundResets = false;
+    uint64_t incrementalResetBudgetNs = 0;
+    bool batchedComponents = false;
+    bool freezeDoneAgents = false;
+    int physicsWorkers = 0;
+    bool lowLatency = false;
+    int episodeStatsCapacity = 4096;
+    bool terminalObservations = false;
+    int calibrationSteps = 0, retuneInterval = 0;
+    int encoderKeyframeInterval = -1;
+
+    // to (re-)create the envs on the simulation threads
+    std::vector<std::string> scenarios;
+    FloatParams floatParams;
+};
+
+
+BatchedEnv::BatchedEnv(
+    const std::string &scenario, int w, int h, int numEnvs, int numAgentsPerEnv, int numSimulationThreads,
+    bool useVulkan, const FloatParams &floatParams
+)
+: BatchedEnv{std::vector<std::string>{scenario}, w, h, numEnvs, numAgentsPerEnv, numSimulationThreads, useVulkan, floatParams}
+{
+}
+
+BatchedEnv::BatchedEnv(
+    const std::vector<std::string> &scenarios, int w, int h, int numEnvs, int numAgentsPerEnv,
+    int numSimulationThreads, bool useVulkan, const FloatParams &floatParams
+)
+{
+    pimpl = std::make_unique<Impl>(scenarios, w, h, numEnvs, numAgentsPerEnv, numSimulationThreads, useVulkan, floatParams);
+}
+
+BatchedEnv::~BatchedEnv() = default;
+
+void BatchedEnv::seed(int seedValue)
+{
+    TLOG(INFO) << "Seeding vector env with seed value " << seedValue;
+
+    // every env gets its own stream, so episodes don't depend on the number of envs or the order of resets
+    for (int envIdx = 0; envIdx < int(pimpl->envs.size()); ++envIdx)
+        pimpl->envs[envIdx]->seed(seedValue, envIdx);
+}
+
+void BatchedEnv::reset()
+{
+    pimpl->reset();
+}
+
+int BatchedEnv::numEnvs() const
+{
+    return pimpl->numEnvs;
+}
+
+int BatchedEnv::numAgents() const
+{
+    return pimpl->envs.front()->getNumAgents();
+}
+
+std::vector<std::string> BatchedEnv::envScenarios() const
+{
+    std::vector<std::string> res;
+    for (int envIdx = 0; envIdx < pimpl->numEnvs; ++envIdx)
+        res.push_back(pimpl->scenarioOf(envIdx));
+
+    return res;
+}
+
+bool BatchedEnv::isRegisteredScenario(const std::string &scenario)
+{
+    scenariosGlobalInit();
+
+    const auto scenarios = Scenario::registeredScenarios();
+    return std::find(scenarios.begin(), scenarios.end(), toLower(scenario)) != scenarios.end();
+}
+
+void BatchedEnv::setNumActiveEnvs(int n)
+{
+    if (n < 1 || n > pimpl->numEnvs) {
+        TLOG(ERROR) << "Number of active envs must be between 1 and " << pimpl->numEnvs;
+        return;
+    }
+
+    pimpl->numActiveEnvs = n;
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setNumActiveEnvs(n);
+}
+
+int BatchedEnv::getNumActiveEnvs() const
+{
+    return pimpl->numActiveEnvs;
+}
+
+bool BatchedEnv::setActions(int envIdx, int agentIdx, const std::vector<int> &actions)
+{
+    if (envIdx < 0 || envIdx >= pimpl->numEnvs || agentIdx < 0 || agentIdx >= pimpl->numAgentsPerEnv) {
+        TLOG(ERROR) << "No agent #" << agentIdx << " in env #" << envIdx;
+        return false;
+    }
+
+    if (!validActions(actions.data(), int(actions.size()))) {
+        TLOG(ERROR) << "Expected one action per action space, within " << Env::actionSpaceSizes;
+        return false;
+    }
+
+    pimpl->envs[envIdx]->setAction(agentIdx, decodeActions(actions.data(), int(actions.size())));
+    return true;
+}
+
+bool BatchedEnv::setActionsBatched(const int32_t *actions, int numAgentsTotal, int numActionSpaces)
+{
+    const auto numAgentsPerEnv = pimpl->numAgentsPerEnv;
+    const auto expectedAgents = pimpl->numActiveEnvs * numAgentsPerEnv, expectedSpaces = int(Env::actionSpaceSizes.size());
+
+    if (numAgentsTotal != expectedAgents || numActionSpaces != expectedSpaces) {
+        TLOG(ERROR) << "Expected actions of shape (" << expectedAgents << ", " << expectedSpaces << ")";
+        return false;
+    }
+
+    // all actions are checked before any is set
+    for (int agent = 0; agent < numAgentsTotal; ++agent) {
+        if (!validActions(actions + size_t(agent) * numActionSpaces, numActionSpaces)) {
+            TLOG(ERROR) << "Actions of agent #" << agent << " out of range " << Env::actionSpaceSizes;
+            return false;
+        }
+    }
+
+    for (int envIdx = 0; envIdx < pimpl->numActiveEnvs; ++envIdx)
+        for (int agentIdx = 0; agentIdx < numAgentsPerEnv; ++agentIdx, actions += numActionSpaces)
+            pimpl->envs[envIdx]->setAction(agentIdx, decodeActions(actions, numActionSpaces));
+
+    return true;
+}
+
+bool BatchedEnv::setRenderMask(const uint8_t *mask, int size)
+{
+    if (!pimpl->vectorEnv) {
+        TLOG(ERROR) << "Render mask can only be set after the first reset";
+        return false;
+    }
+
+    const auto numAgentsTotal = pimpl->numActiveEnvs * pimpl->numAgentsPerEnv;
+    if (size != 0 && size != numAgentsTotal) {
+        TLOG(ERROR) << "Expected a render mask of " << numAgentsTotal << " agents";
+        return false;
+    }
+
+    // agents of the inactive envs are not drawn anyway
+    std::vector<uint8_t> agentMask;
+    if (size != 0) {
+        agentMask.assign(size_t(pimpl->numEnvs) * size_t(pimpl->numAgentsPerEnv), 0);
+        std::copy_n(mask, numAgentsTotal, agentMask.begin());
+    }
+
+    pimpl->vectorEnv->setRenderMask(std::move(agentMask));
+    return true;
+}
+
+void BatchedEnv::step()
+{
+    pimpl->vectorEnv->step();
+    pimpl->publishToViewer();
+}
+
+void BatchedEnv::stepAsync()
+{
+    pimpl->vectorEnv->stepAsync();
+}
+
+void BatchedEnv::stepWait()
+{
+    pimpl->vectorEnv->stepWait();
+    pimpl->publishToViewer();
+}
+
+bool BatchedEnv::send(const int *envIds, int numEnvIds, const int32_t *actions, int numActionSpaces)
+{
+    if (!pimpl->vectorEnv) {
+        TLOG(ERROR) << "Envs can only be sent after the first reset";
+        return false;
+    }
+
+    const auto numAgentsPerEnv = pimpl->numAgentsPerEnv;
+    if (numActionSpaces != int(Env::actionSpaceSizes.size())) {
+        TLOG(ERROR) << "Expected " << Env::actionSpaceSizes.size() << " actions per agent";
+        return false;
+    }
+
+    // all ids are checked before any action is set, envs in flight are being stepped by the workers
+    std::vector<int> envIndices{envIds, envIds + numEnvIds};
+    if (!pimpl->vectorEnv->canSend(envIndices))
+        return false;
+
+    for (int agent = 0; agent < numEnvIds * numAgentsPerEnv; ++agent) {
+        if (!validActions(actions + size_t(agent) * numActionSpaces, numActionSpaces)) {
+            TLOG(ERROR) << "Actions of agent #" << agent << " out of range " << Env::actionSpaceSizes;
+            return false;
+        }
+    }
+
+    for (auto envIdx : envIndices)
+        for (int agentIdx = 0; agentIdx < numAgentsPerEnv; ++agentIdx, actions += numActionSpaces)
+            pimpl->envs[envIdx]->setAction(agentIdx, decodeActions(actions, numActionSpaces));
+
+    return pimpl->vectorEnv->send(envIndices);
+}
+
+const std::vector<int> & BatchedEnv::recv(int batchSize)
+{
+    // returned on errors
+    static const std::vector<int> none;
+
+    TCHECK(pimpl->vectorEnv);
+    auto &vectorEnv = *pimpl->vectorEnv;
+    if (batchSize < 1 || batchSize > vectorEnv.numEnvsInFlight()) {
+        TLOG(ERROR) << "Can't receive " << batchSize << " envs, " << vectorEnv.numEnvsInFlight() << " are in flight";
+        return none;
+    }
+
+    const auto &envIndices = vectorEnv.recv(batchSize);
+    pimpl->publishToViewer();
+    return envIndices;
+}
+
+bool BatchedEnv::fork(int envIdx, const int *targetIds, int numTargets)
+{
+    if (!pimpl->vectorEnv) {
+        TLOG(ERROR) << "Envs can only be forked after the first reset";
+        return false;
+    }
+
+    if (envIdx < 0 || envIdx >= pimpl->numActiveEnvs) {
+        TLOG(ERROR) << "Env index " << envIdx << " is not an active env";
+        return false;
+    }
+
+    return pimpl->vectorEnv->fork(envIdx, std::vector<int>{targetIds, targetIds + numTargets});
+}
+
+bool BatchedEnv::isDone(int envIdx) const
+{
+    return pimpl->vectorEnv->done[envIdx];
+}
+
+const float * BatchedEnv::getRewards() const
+{
+    return pimpl->vectorEnv->lastRewards.data();
+}
+
+const uint8_t * BatchedEnv::getDones() const
+{
+    return pimpl->vectorEnv->doneFlags.data();
+}
+
+const uint8_t * BatchedEnv::getAgentDones() const
+{
+    return pimpl->vectorEnv->agentDoneFlags.data();
+}
+
+void BatchedEnv::setFreezeDoneAgents(bool freeze)
+{
+    pimpl->freezeDoneAgents = freeze;
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setFreezeDoneAgents(freeze);
+}
+
+void BatchedEnv::setLowLatency(bool enabled)
+{
+    pimpl->lowLatency = enabled;
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setLowLatency(enabled);
+}
+
+void BatchedEnv::setPhysicsWorkers(int numThreads)
+{
+    pimpl->physicsWorkers = std::max(numThreads, 0);
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setPhysicsWorkers(pimpl->physicsWorkers);
+}
+
+void BatchedEnv::setTerminalObservations(bool enabled)
+{
+    pimpl->terminalObservations = enabled;
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setTerminalObservations(enabled ? pimpl->frameBytes() : 0);
+}
+
+const std::vector<int> & BatchedEnv::getTerminalEnvs() const
+{
+    return pimpl->vectorEnv->getTerminalEnvs();
+}
+
+const uint8_t * BatchedEnv::getTerminalObservation(int envIdx, int agentIdx) const
+{
+    return pimpl->vectorEnv->getTerminalObservation(envIdx, agentIdx);
+}
+
+void BatchedEnv::setEpisodeStatsCapacity(int capacity)
+{
+    pimpl->episodeStatsCapacity = std::max(capacity, 0);
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setEpisodeStatsCapacity(pimpl->episodeStatsCapacity);
+}
+
+const float * BatchedEnv::getTrueObjectives() const
+{
+    return pimpl->vectorEnv->lastTrueObjectives.data();
+}
+
+float BatchedEnv::trueObjective(int envIdx, int agentIdx) const
+{
+    return pimpl->vectorEnv->trueObjectives[envIdx][agentIdx];
+}
+
+std::vector<int> BatchedEnv::observationShape() const
+{
+    if (pimpl->symbolic) {
+        const auto &options = pimpl->symbolicOptions;
+        const auto w = options.width(), c = SymbolicObservationOptions::channels;
+        if (options.mode == SymbolicObservationMode::Crop)
+            return {options.layers(), w, w, c};
+
+        return {w, w, c};
+    }
+
+    const auto &options = pimpl->obsOptions;
+    return {options.height(pimpl->h), options.width(pimpl->w), options.channels()};
+}
+
+const uint8_t * BatchedEnv::getObservation(int envIdx, int agentIdx) const
+{
+    return pimpl->renderer->getObservation(envIdx, agentIdx);
+}
+
+const uint8_t * BatchedEnv::getObservationsBatch(ObservationChannel channel) const
+{
+    return pimpl->renderer->getObservationsBatch(channel);
+}
+
+const uint8_t * BatchedEnv::getObservationsBatchDevice() const
+{
+    return pimpl->renderer->getObservationsBatchDevice();
+}
+
+int BatchedEnv::width() const
+{
+    return pimpl->w;
+}
+
+int BatchedEnv::height() const
+{
+    return pimpl->h;
+}
+
+const ObservationOptions & BatchedEnv::getObservationOptions() const
+{
+    return pimpl->obsOptions;
+}
+
+void BatchedEnv::setAuxiliaryOutputs(bool depth, bool segmentation)
+{
+    if (pimpl->vectorEnv)
+        TLOG(ERROR) << "Auxiliary outputs must be set before the first reset";
+
+    pimpl->obsOptions.depth = depth;
+    pimpl->obsOptions.segmentation = segmentation;
+}
+
+bool BatchedEnv::setObservationFormat(ObservationFormat format, int downsample)
+{
+    if (pimpl->vectorEnv)
+        TLOG(ERROR) << "Observation format must be set before the first reset";
+
+    pimpl->obsOptions.format = format;
+
+    const auto w = pimpl->w, h = pimpl->h;
+    if (downsample < 1 || w % downsample != 0 || h % downsample != 0) {
+        TLOG(ERROR) << "Resolution " << w << "x" << h << " is not divisible by " << downsample;
+        pimpl->obsOptions.downsample = 1;
+        return false;
+    }
+
+    pimpl->obsOptions.downsample = downsample;
+    return true;
+}
+
+void BatchedEnv::setShading(ShadingModel shading)
+{
+    if (pimpl->vectorEnv)
+        TLOG(ERROR) << "Shading must be set before the first reset";
+
+    pimpl->obsOptions.shading = shading;
+}
+
+void BatchedEnv::setHostMemoryPolicy(HostMemoryPolicy policy)
+{
+    if (pimpl->vectorEnv)
+        TLOG(ERROR) << "Host memory policy must be set before the first reset";
+
+#ifndef CORRADE_TARGET_APPLE
+    // also for the OpenGL renderers, the Vulkan one installs it itself
+    if (policy == HostMemoryPolicy::Pinned)
+        installCudaHostPinning();
+#endif
+
+    pimpl->obsOptions.hostMemory = policy;
+}
+
+void BatchedEnv::setDeviceFrameStack(int numFrames)
+{
+    if (pimpl->vectorEnv)
+        TLOG(ERROR) << "Frame stack must be set before the first reset";
+
+    pimpl->frameStack = numFrames;
+}
+
+int BatchedEnv::getDeviceFrameStackSize() const
+{
+    return pimpl->frameStack;
+}
+
+const uint8_t * BatchedEnv::getFrameStackDevice() const
+{
+    return pimpl->renderer ? pimpl->renderer->getFrameStackDevice() : nullptr;
+}
+
+void BatchedEnv::setRenderGpus(const std::vector<int> &gpuIds)
+{
+    if (pimpl->vectorEnv)
+        TLOG(ERROR) << "Render GPUs must be set before the first reset";
+
+    pimpl->renderGpus = gpuIds;
+}
+
+void BatchedEnv::setRenderCommandStreams(int numStreams)
+{
+    if (pimpl->vectorEnv)
+        TLOG(ERROR) << "Command streams must be set before the first reset";
+
+    pimpl->renderCommandStreams = std::max(numStreams, 1);
+}
+
+void BatchedEnv::setRenderThreads(int numThreads)
+{
+    if (pimpl->vectorEnv)
+        TLOG(ERROR) << "Render threads must be set before the first reset";
+
+    pimpl->renderThreads = std::max(numThreads, 1);
+}
+
+void BatchedEnv::setCpuAffinity(const std::vector<int> &cpus)
+{
+    pimpl->setCpuAffinity(cpus);
+}
+
+void BatchedEnv::setPhysicsGroupSize(int groupSize)
+{
+    pimpl->setPhysicsGroupSize(groupSize);
+}
+
+void BatchedEnv::setFrameSkip(int numFrames)
+{
+    pimpl->frameSkip = numFrames;
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setFrameSkip(numFrames);
+}
+
+void BatchedEnv::setBackgroundResets(bool enabled)
+{
+    pimpl->backgroundResets = enabled;
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setBackgroundResets(enabled);
+}
+
+void BatchedEnv::setIncrementalResets(uint64_t stepBudgetNs)
+{
+    pimpl->incrementalResetBudgetNs = stepBudgetNs;
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setIncrementalResets(stepBudgetNs);
+}
+
+void BatchedEnv::setBatchedComponents(bool enabled)
+{
+    pimpl->batchedComponents = enabled;
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setBatchedComponents(enabled);
+}
+
+void BatchedEnv::setThreadAutoTuning(int calibrationSteps, int retuneInterval)
+{
+    pimpl->calibrationSteps = calibrationSteps;
+    pimpl->retuneInterval = retuneInterval;
+    if (pimpl->vectorEnv)
+        pimpl->vectorEnv->setThreadAutoTuning(calibrationSteps, retuneInterval);
+}
+
+void BatchedEnv::setCpuRendering(bool enabled)
+{
+    if (pimpl->vectorEnv) {
+        TLOG(ERROR) << "CPU rendering must be enabled before the first reset";
+        return;
+    }
+
+    pimpl->cpuRendering = enabled;
+}
+
+bool BatchedEnv::setSymbolicObservations(const SymbolicObservationOptions &options)
+{
+    if (pimpl->vectorEnv) {
+        TLOG(ERROR) << "Symbolic observations must be set before the first reset";
+        return false;
+    }
+
+    if (options.radius < 0 || options.below < 0 || options.above < 1) {
+        TLOG(ERROR) << "Symbolic view needs radius >= 0, below >= 0 and above >= 1";
+        return false;
+    }
+
+    pimpl->symbolicOptions = options;
+    pimpl->symbolic = true;
+    return true;
+}
+
+bool BatchedEnv::symbolicObservations() const
+{
+    return pimpl->symbolic;
+}
+
+const SymbolicObservationOptions & BatchedEnv::getSymbolicObservationOptions() const
+{
+    return pimpl->symbolicOptions;
+}
+
+void BatchedEnv::recordTrajectories(const std::string &filename)
+{
+    pimpl->recordTrajectories(filename);
+}
+
+void BatchedEnv::pregenerateEpisodes(int queueDepth, int numThreads)
+{
+    pimpl->pregenerateEpisodes(queueDepth, numThreads);
+}
+
+bool BatchedEnv::setEpisodeDataset(const std::string &filename)
+{
+    return pimpl->setEpisodeDataset(filename);
+}
+
+bool BatchedEnv::bakeEpisodeDataset(
+    const std::string &scenario, int numAgentsPerEnv, const FloatParams &floatParams, int seed, int numEpisodes,
+    const std::string &filename
+)
+{
+    scenariosGlobalInit();
+
+    Env env{scenario, numAgentsPerEnv, floatParams};
+    env.seed(seed);
+    return EpisodeDataset::bake(env, uint64_t(std::max(numEpisodes, 0)), filename);
+}
+
+bool BatchedEnv::enableRaySensors(const RaySensorOptions &options)
+{
+    return pimpl->enableRaySensors(options);
+}
+
+const RaySensors * BatchedEnv::getRaySensors() const
+{
+    return pimpl->raySensors.get();
+}
+
+void BatchedEnv::encodeObservations(int keyframeInterval)
+{
+    pimpl->encoderKeyframeInterval = keyframeInterval;
+
+    // otherwise created in the first reset, when the observation format is final
+    if (pimpl->vectorEnv)
+        pimpl->createObservationEncoder();
+}
+
+const ObservationEncoder * BatchedEnv::getObservationEncoder() const
+{
+    return pimpl->observationEncoder.get();
+}
+
+void BatchedEnv::setHiresResolution(int w, int h)
+{
+    pimpl->renderW = w;
+    pimpl->renderH = h;
+}
+
+int BatchedEnv::hiresWidth() const
+{
+    return pimpl->renderW;
+}
+
+int BatchedEnv::hiresHeight() const
+{
+    return pimpl->renderH;
+}
+
+const ObservationOptions & BatchedEnv::getHiresObservationOptions() const
+{
+    return pimpl->hiresObsOptions;
+}
+
+bool BatchedEnv::setHiresEnvs(const std::vector<int> &envIndices)
+{
+    for (auto envIdx : envIndices)
+        if (envIdx < 0 || envIdx >= pimpl->numEnvs) {
+            TLOG(ERROR) << "Env index " << envIdx << " is out of range";
+            return false;
+        }
+
+    pimpl->hiresEnvs = envIndices;
+    return true;
+}
+
+void BatchedEnv::drawHires()
+{
+    pimpl->drawHires();
+}
+
+const uint8_t * BatchedEnv::getHiresObservation(int envIdx, int agentIdx) const
+{
+    return pimpl->hiresObservation(envIdx, agentIdx);
+}
+
+void BatchedEnv::recordVideo(const std::string &filenamePrefix, float fps)
+{
+    pimpl->videoEncoder.reset();
+    if (!filenamePrefix.empty())
+        pimpl->videoEncoder = std::make_unique<VideoEncoder>(filenamePrefix, fps);
+}
+
+void BatchedEnv::drawOverview()
+{
+    pimpl->drawOverview();
+}
+
+std::map<std::string, float> BatchedEnv::getRewardShaping(int envIdx, int agentIdx) const
+{
+    return pimpl->envs[envIdx]->getScenario().getRewardShaping(agentIdx);
+}
+
+void BatchedEnv::setRewardShaping(int envIdx, int agentIdx, const std::map<std::string, float> &rewardShaping)
+{
+    pimpl->envs[envIdx]->getScenario().setRewardShaping(agentIdx, rewardShaping);
+}
+
+bool BatchedEnv::setRewardShapingBatched(const std::vector<std::string> &rewardNames, const float *values, int numAgentsTotal)
+{
+    if (pimpl->vectorEnv)
+        return pimpl->vectorEnv->publishRewardShaping(rewardNames, values, numAgentsTotal);
+
+    // nothing is stepping before the first reset
+    auto &envs = pimpl->envs;
+    if (numAgentsTotal != int(envs.size()) * pimpl->numAgentsPerEnv) {
+        TLOG(ERROR) << "Expected reward shaping for " << envs.size() * pimpl->numAgentsPerEnv << " agents, got " << numAgentsTotal;
+        return false;
+    }
+
+    std::vector<int> slots;
+    const auto numRewards = int(rewardNames.size());
+    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
+        auto &scenario = envs[envIdx]->getScenario();
+        scenario.rewardSlots(rewardNames, slots);
+
+        for (int agentIdx = 0; agentIdx < pimpl->numAgentsPerEnv; ++agentIdx) {
+            const auto agent = size_t(envIdx * pimpl->numAgentsPerEnv + agentIdx);
+            scenario.setRewardValues(agentIdx, slots.data(), values + agent * size_t(numRewards), numRewards);
+        }
+    }
+
+    return true;
+}
+
+void BatchedEnv::serve(const std::string &name, int numSlices)
+{
+    pimpl->serve(name, numSlices);
+}
+
+void BatchedEnv::stopServing()
+{
+    if (pimpl->server)
+        pimpl->server->terminate();
+    if (pimpl->tcpServer)
+        pimpl->tcpServer->terminate();
+}
+
+VectorEnv * BatchedEnv::getVectorEnv()
+{
+    return pimpl->vectorEnv.get();
+}
+
+void BatchedEnv::close()
+{
+    pimpl->close();
+}
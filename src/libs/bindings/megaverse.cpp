@@ -1,24 +1,20 @@
+#include <cstring>
+#include <stdexcept>
+
 #include <pybind11/stl.h>
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 
-#include <opencv2/core/mat.hpp>
-
 #include <util/tiny_logger.hpp>
+#include <util/frame_codec.hpp>
+#include <util/host_buffer.hpp>
+#include <util/scoped_profiler.hpp>
 
-#include <env/env.hpp>
-
-#include <scenarios/init.hpp>
+#include <env/vector_env.hpp>
+#include <env/vector_env_server.hpp>
+#include <env/observation_encoder.hpp>
 
-#include <magnum_rendering/magnum_env_renderer.hpp>
-
-#ifndef CORRADE_TARGET_APPLE
-    #include <v4r_rendering/v4r_env_renderer.hpp>
-#endif
-
-#ifdef WITH_GUI
-    #include <viewer/viewer.hpp>
-#endif
+#include <batched_env/batched_env.hpp>
 
 
 namespace py = pybind11;
@@ -32,235 +28,667 @@ void setMegaverseLogLevel(int level)
 }
 
 
-class MegaverseGym
+/**
+ * Python side of BatchedEnv: numpy views over its buffers, string options and dicts. Everything else is inherited.
+ *
+ * Thread-safety contract:
+ * - The constructor, step(), step_async(), step_wait(), reset() and draw_hires() release the GIL while running the simulation and
+ *   the renderers, so other Python threads can run in the meantime.
+ * - A single MegaverseGym instance must not be accessed concurrently from several threads, and should be used
+ *   from the same thread it was created in (OpenGL renderer creates an EGL context that is current in that thread).
+ * - Different MegaverseGym instances are independent and can be stepped concurrently from different Python threads.
+ * - Numpy views returned by get_observation*, get_*_view point to memory that is overwritten by the next step/reset,
+ *   don't read them while a step is running in another thread.
+ */
+class MegaverseGym : public BatchedEnv
 {
 public:
-    MegaverseGym(
-        const std::string &scenario,
-        int w, int h,
-        int numEnvs, int numAgentsPerEnv, int numSimulationThreads,
-        bool useVulkan,
-        const std::map<std::string, float> &floatParams
+    using BatchedEnv::BatchedEnv;
+
+    std::vector<int> actionSpaceSizes() const
+    {
+        return Env::actionSpaceSizes;
+    }
+
+    /**
+     * Set actions for all agents at once.
+     * @param actions int32 array of shape (numEnvs * numAgentsPerEnv, len(actionSpaceSizes)).
+     * Raises ValueError on a wrong shape or out of range actions.
+     */
+    void setActionsBatched(const py::array_t<int32_t, py::array::c_style | py::array::forcecast> &actions)
+    {
+        if (actions.ndim() != 2)
+            throw py::value_error("Expected a 2D array of actions");
+
+        if (!BatchedEnv::setActionsBatched(actions.data(), int(actions.shape(0)), int(actions.shape(1))))
+            throw py::value_error("Invalid actions, see the log for details");
+    }
+
+    /**
+     * @param mask uint8 array of shape (numActiveEnvs * numAgentsPerEnv,), empty to render all agents again.
+     */
+    void setRenderMask(const py::array_t<uint8_t, py::array::c_style | py::array::forcecast> &mask)
+    {
+        BatchedEnv::setRenderMask(mask.data(), int(mask.size()));
+    }
+
+    /**
+     * @param envIds int32 array of the envs to step, see VectorEnv::send().
+     * @param actions int32 array of shape (len(envIds) * numAgentsPerEnv, len(actionSpaceSizes)).
+     */
+    bool send(
+        const py::array_t<int32_t, py::array::c_style | py::array::forcecast> &envIds,
+        const py::array_t<int32_t, py::array::c_style | py::array::forcecast> &actions
     )
-        : numEnvs{numEnvs}
-          , numAgentsPerEnv{numAgentsPerEnv}
-          , useVulkan{useVulkan}
-          , w{w}
-          , h{h}
-          , numSimulationThreads{numSimulationThreads}
     {
-        scenariosGlobalInit();
+        const auto numEnvIds = int(envIds.size());
+        if (actions.ndim() != 2 || actions.shape(0) != py::ssize_t(numEnvIds) * numAgents()) {
+            TLOG(ERROR) << "Expected actions of shape (" << numEnvIds * numAgents() << ", num_action_spaces)";
+            return false;
+        }
 
-        for (int i = 0; i < numEnvs; ++i)
-            envs.emplace_back(std::make_unique<Env>(scenario, numAgentsPerEnv, floatParams));
+        py::gil_scoped_release release;
+        return BatchedEnv::send(envIds.data(), numEnvIds, actions.data(), int(actions.shape(1)));
+    }
 
-        rewards = std::vector<float>(size_t(numEnvs * numAgentsPerEnv));
+    /// @param targetIds int32 array of the envs that get a copy of env envIdx, see VectorEnv::fork().
+    bool fork(int envIdx, const py::array_t<int32_t, py::array::c_style | py::array::forcecast> &targetIds)
+    {
+        py::gil_scoped_release release;
+        return BatchedEnv::fork(envIdx, targetIds.data(), int(targetIds.size()));
     }
 
-    void seed(int seedValue)
+    /// Indices of the received envs (copied, the views index the full batch).
+    py::array_t<int32_t> recv(int batchSize)
     {
-        TLOG(INFO) << "Seeding vector env with seed value " << seedValue;
+        const std::vector<int> *envIndices;
+        {
+            py::gil_scoped_release release;
+            envIndices = &BatchedEnv::recv(batchSize);
+        }
+
+        return py::array_t<int32_t>(py::ssize_t(envIndices->size()), envIndices->data());
+    }
 
-        rng.seed((unsigned long) seedValue);
-        for (auto &e : envs) {
-            const auto noise = randRange(0, 1 << 30, rng);
-            e->seed(noise);
+    /**
+     * @param values float32 array of shape (numEnvs * numAgentsPerEnv, len(rewardNames)), NaN keeps the current value.
+     */
+    bool setRewardShapingBatched(
+        const std::vector<std::string> &rewardNames,
+        const py::array_t<float, py::array::c_style | py::array::forcecast> &values
+    )
+    {
+        if (values.ndim() != 2 || values.shape(1) != py::ssize_t(rewardNames.size())) {
+            TLOG(ERROR) << "Expected reward shaping values of shape (num_agents, " << rewardNames.size() << ")";
+            return false;
         }
+
+        py::gil_scoped_release release;
+        return BatchedEnv::setRewardShapingBatched(rewardNames, values.data(), int(values.shape(0)));
+    }
+
+    std::vector<float> getLastRewards()
+    {
+        return {getRewards(), getRewards() + numAgentsTotal()};
+    }
+
+    /**
+     * Persistent views over VectorEnv buffers that are updated in place on every step (no copies or allocations).
+     * Valid after the first call to reset() and until close().
+     */
+    py::array_t<float> getRewardsView()
+    {
+        return py::array_t<float>({numAgentsTotal()}, getRewards(), py::none{});
+    }
+
+    py::array_t<uint8_t> getDonesView()
+    {
+        return py::array_t<uint8_t>({getNumActiveEnvs()}, getDones(), py::none{});
     }
 
-    int numAgents() const
+    py::array_t<uint8_t> getAgentDonesView()
     {
-        return envs.front()->getNumAgents();
+        return py::array_t<uint8_t>({numAgentsTotal()}, getAgentDones(), py::none{});
     }
 
-    void reset()
+    py::array_t<float> getTrueObjectivesView()
     {
-        if (!vectorEnv) {
-            if (useVulkan)
-#ifdef CORRADE_TARGET_APPLE
-                TLOG(ERROR) << "Vulkan not supported on MacOS";
-#else
-                renderer = std::make_unique<V4REnvRenderer>(envs, w, h, nullptr, false);
-#endif
-            else
-                renderer = std::make_unique<MagnumEnvRenderer>(envs, w, h);
+        return py::array_t<float>({numAgentsTotal()}, getTrueObjectives(), py::none{});
+    }
+
+    /**
+     * Terminal frames of the envs that finished in the last step (copies), see setTerminalObservations():
+     * env indices of shape (n,) and observations of shape (n, agents per env, *observationShape()).
+     */
+    py::tuple getTerminalObservations()
+    {
+        const auto &envIndices = getTerminalEnvs();
+        const auto numEnvs = py::ssize_t(envIndices.size()), numAgents = py::ssize_t(this->numAgents());
+
+        auto obsShape = shape(observationShape());
+        obsShape.insert(obsShape.begin(), {numEnvs, numAgents});
+        py::array_t<uint8_t> obs(obsShape);
+
+        const auto frameBytes = size_t(obs.size()) / size_t(std::max(numEnvs * numAgents, py::ssize_t(1)));
+        for (py::ssize_t i = 0; i < numEnvs; ++i)
+            for (py::ssize_t agent = 0; agent < numAgents; ++agent)
+                memcpy(obs.mutable_data(i, agent), getTerminalObservation(envIndices[size_t(i)], int(agent)), frameBytes);
+
+        return py::make_tuple(py::array_t<int>(numEnvs, envIndices.data()), obs);
+    }
+
+    py::array_t<uint8_t> getObservation(int envIdx, int agentIdx)
+    {
+        return py::array_t<uint8_t>(shape(observationShape()), BatchedEnv::getObservation(envIdx, agentIdx), py::none{});  // numpy object does not own memory
+    }
+
+    /**
+     * All observations as a single (numEnvs * numAgentsPerEnv, H, W, C) array, C is 4 unless a different
+     * observation format is set.
+     * By default this is a view over the renderer's memory (no copies), valid until the next step.
+     * @param rgbChw drop the alpha channel and convert to (N, 3, H, W) (or (N, 1, H, W) for grayscale) in C++.
+     * This requires a copy into an internal buffer, which is also reused between calls.
+     */
+    py::array_t<uint8_t> getObservationsBatched(bool rgbChw)
+    {
+        const auto numAgentsTotal = this->numAgentsTotal();
+        const uint8_t *obsData = getObservationsBatch();
+        TCHECK(obsData);
+
+        auto batchShape = shape(observationShape());
+        batchShape.insert(batchShape.begin(), numAgentsTotal);
 
-            vectorEnv = std::make_unique<VectorEnv>(envs, *renderer, numSimulationThreads);
+        // symbolic observations are already channel-last uint8 codes, not images
+        if (!rgbChw || symbolicObservations())
+            return py::array_t<uint8_t>(batchShape, obsData, py::none{});  // numpy object does not own memory
+
+        const auto obsH = int(batchShape[1]), obsW = int(batchShape[2]), srcChannels = int(batchShape[3]);
+        const int channels = std::min(srcChannels, 3);
+        const auto pixelsPerFrame = size_t(obsH * obsW);
+        obsChw.resize(size_t(numAgentsTotal) * pixelsPerFrame * channels);
+
+        for (int agentIdx = 0; agentIdx < numAgentsTotal; ++agentIdx) {
+            const uint8_t *src = obsData + agentIdx * pixelsPerFrame * srcChannels;
+            uint8_t *dst = obsChw.data() + agentIdx * pixelsPerFrame * channels;
+
+            for (size_t pixel = 0; pixel < pixelsPerFrame; ++pixel)
+                for (int c = 0; c < channels; ++c)
+                    dst[c * pixelsPerFrame + pixel] = src[pixel * srcChannels + c];
         }
 
-        // this also resets the main renderer
-        vectorEnv->reset();
+        return py::array_t<uint8_t>({numAgentsTotal, channels, obsH, obsW}, obsChw.data(), py::none{});
     }
 
-    std::vector<int> actionSpaceSizes() const
+    /**
+     * @param channel "depth" or "segmentation"
+     * @return (numEnvs * numAgentsPerEnv, H, W) uint16 view over the renderer's memory, valid until the next step.
+     */
+    py::array_t<uint16_t> getAuxiliaryObservationsBatched(const std::string &channel)
     {
-        return Env::actionSpaceSizes;
+        const auto obsChannel = channel == "depth" ? ObservationChannel::Depth : ObservationChannel::Segmentation;
+        if (channel != "depth" && channel != "segmentation")
+            TLOG(ERROR) << "Unknown observation channel " << channel;
+
+        const auto data = getObservationsBatch(obsChannel);
+        if (!data) {
+            TLOG(ERROR) << "Observation channel " << channel << " was not requested or is not supported by the renderer";
+            return py::array_t<uint16_t>{};
+        }
+
+        return py::array_t<uint16_t>({numAgentsTotal(), height(), width()}, reinterpret_cast<const uint16_t *>(data), py::none{});
     }
 
-    void setActions(int envIdx, int agentIdx, std::vector<int> actions)
+    /**
+     * Observations in GPU memory described via __cuda_array_interface__ (i.e. torch.as_tensor(obj, device='cuda')
+     * will wrap it without copies). Shape is (num_envs * num_agents, H, W, 4), memory is overwritten by the next step.
+     * Rendering is synchronized with the host in step(), so the data is ready when this is called.
+     * Raises RuntimeError if the renderer does not keep the observations in GPU memory.
+     */
+    py::dict getObservationsCuda()
     {
-        int actionIdx = 0, actionMask = 0;
-        const auto &spaces = Env::actionSpaceSizes;
+        const uint8_t *devPtr = getObservationsBatchDevice();
+
+        if (!devPtr)
+            throw std::runtime_error("GPU observations are only supported by the Vulkan renderer without pipelining");
 
-        for (int i = 0; i < int(actions.size()); ++i) {
-            const auto action = actions[i];
+        py::dict interface;
+        interface["shape"] = py::make_tuple(numAgentsTotal(), height(), width(), 4);
+        interface["typestr"] = "|u1";
+        interface["data"] = py::make_tuple(reinterpret_cast<uintptr_t>(devPtr), true);  // read-only
+        interface["version"] = 2;
+        interface["strides"] = py::none{};  // C-contiguous
+
+        return interface;
+    }
+
+    /**
+     * Stacked observations in GPU memory via __cuda_array_interface__, shape is (num_envs * num_agents, num_frames,
+     * H, W, C), oldest frame first. Strided view over the frame stack of the renderer, nothing is copied, memory is
+     * overwritten by the next step. Raises RuntimeError without a GPU frame stack.
+     */
+    py::dict getFrameStackCuda()
+    {
+        const uint8_t *devPtr = getFrameStackDevice();
 
-            if (action > 0)
-                actionMask = actionMask | (1 << (actionIdx + action));
+        if (!devPtr)
+            throw std::runtime_error("No GPU frame stack, call set_frame_stack_cuda() before the first reset");
 
-            const auto numNonIdleActions = spaces[i] - 1;
-            actionIdx += numNonIdleActions;
+        // frames are stored time-major for the whole batch, agents of all envs in every slot
+        const auto &obsOptions = getObservationOptions();
+        const auto obsW = obsOptions.width(width()), obsH = obsOptions.height(height()), channels = obsOptions.channels();
+        const auto frameBytes = obsOptions.bytesPerFrame(width(), height());
+        const auto batchBytes = frameBytes * size_t(numEnvs()) * size_t(numAgents());
+
+        py::dict interface;
+        interface["shape"] = py::make_tuple(numAgentsTotal(), getDeviceFrameStackSize(), obsH, obsW, channels);
+        interface["typestr"] = "|u1";
+        interface["data"] = py::make_tuple(reinterpret_cast<uintptr_t>(devPtr), true);  // read-only
+        interface["version"] = 2;
+        interface["strides"] = py::make_tuple(frameBytes, batchBytes, size_t(obsW * channels), size_t(channels), size_t(1));
+
+        return interface;
+    }
+
+    /**
+     * @param format one of "rgba8" (default), "rgb8", "gray8", "bgra8", "bgr8".
+     * @param downsample observation resolution is (w / downsample, h / downsample).
+     */
+    void setObservationFormat(const std::string &format, int downsample)
+    {
+        static const std::map<std::string, ObservationFormat> formats{
+            {"rgba8", ObservationFormat::RGBA8}, {"rgb8", ObservationFormat::RGB8}, {"gray8", ObservationFormat::Gray8},
+            {"bgra8", ObservationFormat::BGRA8}, {"bgr8", ObservationFormat::BGR8},
+        };
+
+        auto obsFormat = getObservationOptions().format;
+        if (const auto it = formats.find(format); it != formats.end())
+            obsFormat = it->second;
+        else
+            TLOG(ERROR) << "Unknown observation format " << format;
+
+        BatchedEnv::setObservationFormat(obsFormat, downsample);
+    }
+
+    /// @param shading "phong", "lambert" or "flat", see ShadingModel.
+    void setShading(const std::string &shading)
+    {
+        static const std::map<std::string, ShadingModel> models{
+            {"phong", ShadingModel::BlinnPhong}, {"lambert", ShadingModel::Lambert}, {"flat", ShadingModel::Flat},
+        };
+
+        if (const auto it = models.find(shading); it != models.end())
+            BatchedEnv::setShading(it->second);
+        else
+            TLOG(ERROR) << "Unknown shading model " << shading;
+    }
+
+    /// @param policy "pageable", "huge_pages" or "pinned", see HostMemoryPolicy. Also applies to the rgb_chw copy.
+    void setHostMemoryPolicy(const std::string &policy)
+    {
+        static const std::map<std::string, HostMemoryPolicy> policies{
+            {"pageable", HostMemoryPolicy::Pageable}, {"huge_pages", HostMemoryPolicy::HugePages}, {"pinned", HostMemoryPolicy::Pinned},
+        };
+
+        if (const auto it = policies.find(policy); it != policies.end()) {
+            BatchedEnv::setHostMemoryPolicy(it->second);
+            obsChw = HostBuffer{0, it->second};
+        } else
+            TLOG(ERROR) << "Unknown host memory policy " << policy;
+    }
+
+    /**
+     * @param mode "crop" for (layers, W, W, 4) voxel crops, "top_down" for (W, W, 4) maps, see SymbolicObservationOptions.
+     * @param radius W = 2 * radius + 1
+     * @param below voxel levels below the agent, layers = below + above
+     */
+    void setSymbolicObservations(const std::string &mode, int radius, int below, int above)
+    {
+        SymbolicObservationOptions options;
+
+        if (mode == "crop")
+            options.mode = SymbolicObservationMode::Crop;
+        else if (mode == "top_down")
+            options.mode = SymbolicObservationMode::TopDown;
+        else {
+            TLOG(ERROR) << "Unknown symbolic observation mode " << mode;
+            return;
         }
 
-        envs[envIdx]->setAction(agentIdx, Action(actionMask));
+        options.radius = radius, options.below = below, options.above = above;
+        BatchedEnv::setSymbolicObservations(options);
     }
 
-    void step()
+    /// Shape of one symbolic observation, empty if symbolic observations are not enabled.
+    std::vector<py::ssize_t> symbolicShape() const
     {
-        vectorEnv->step();
+        return symbolicObservations() ? shape(observationShape()) : std::vector<py::ssize_t>{};
     }
 
-    bool isDone(int envIdx)
+    void enableRaySensors(int numRays, float fovDegrees, const std::vector<float> &pitchDegrees, float maxDistance)
     {
-        return vectorEnv->done[envIdx];
+        RaySensorOptions options;
+        options.numRays = numRays, options.fovDegrees = fovDegrees;
+        options.pitchDegrees = pitchDegrees, options.maxDistance = maxDistance;
+
+        BatchedEnv::enableRaySensors(options);
     }
 
-    std::vector<float> getLastRewards()
+    /**
+     * View of the ray sensors of the last step: (numEnvs * numAgentsPerEnv, raysPerAgent, 2) float, normalized
+     * distance and RayHitType of every ray. Sensors enabled after the last reset are only filled by the next step.
+     */
+    py::array_t<float> getRaySensorsView()
     {
-        int i = 0;
+        const auto *raySensors = getRaySensors();
+        TCHECK(raySensors);
 
-        for (int envIdx = 0; envIdx < numEnvs; ++envIdx)
-            for (int agentIdx = 0; agentIdx < numAgentsPerEnv; ++agentIdx)
-                rewards[i++] = envs[envIdx]->getLastReward(agentIdx);
+        const auto raysPerAgent = raySensors->getOptions().raysPerAgent();
+        return py::array_t<float>({numAgentsTotal(), raysPerAgent, RaySensors::valuesPerRay}, raySensors->getData(), py::none{});
+    }
+
+    /**
+     * Encoded observations of the last step: (numEnvs * numAgentsPerEnv, slot_bytes) uint8 and the number of valid
+     * bytes in each row (uint32). Both are views, overwritten by the next step.
+     */
+    std::tuple<py::array_t<uint8_t>, py::array_t<uint32_t>> getEncodedObservations()
+    {
+        const auto *observationEncoder = getObservationEncoder();
+        TCHECK(observationEncoder);
+
+        const auto &sizes = observationEncoder->getEncodedSizes();
+        const auto numAgentsTotal = int(sizes.size()), slotBytes = int(observationEncoder->getSlotBytes());
 
-        return rewards;
+        return {
+            py::array_t<uint8_t>({numAgentsTotal, slotBytes}, observationEncoder->getData(), py::none{}),
+            py::array_t<uint32_t>({numAgentsTotal}, sizes.data(), py::none{}),
+        };
     }
 
-    py::array_t<uint8_t> getObservation(int envIdx, int agentIdx)
+    /**
+     * (H, W, 3) BGR, ready for OpenCV.
+     */
+    py::array_t<uint8_t> getHiresObservation(int envIdx, int agentIdx)
     {
-        const uint8_t *obsData = renderer->getObservation(envIdx, agentIdx);
-        return py::array_t<uint8_t>({h, w, 4}, obsData, py::none{});  // numpy object does not own memory
+        const uint8_t *obsData = BatchedEnv::getHiresObservation(envIdx, agentIdx);
+        TCHECK(obsData);
+
+        return py::array_t<uint8_t>({hiresHeight(), hiresWidth(), getHiresObservationOptions().channels()}, obsData, py::none{});  // numpy object does not own memory
     }
 
     /**
-     * Call this before the first call to render()
+     * Turn on the timing zones needed by getMetrics(). The profiler is process-wide, so with several MegaverseGym
+     * instances in one process the latency percentiles include all of them (counters and utilization don't).
      */
-    void setRenderResolution(int hiresW, int hiresH)
+    void enableMetrics(bool enable)
     {
-        renderW = hiresW;
-        renderH = hiresH;
+        sprof().setEnabled(enable);
     }
 
-    void drawHires()
+    /**
+     * Snapshot of the sampling metrics since the start or the last call with reset=true.
+     * Latencies are per call: simulate is one vector step (all envs), pre_draw and reset are per env,
+     * draw is the whole frame, readback is the transfer of the observations to the host (for Vulkan it includes
+     * waiting for the GPU to finish the frame). The gpu_ entries are GPU time per frame: gpu_draw and gpu_readback
+     * from GL timer queries, gpu_frame is the whole frame (for Vulkan submit-to-completion per shard measured on the
+     * host). submit is the CPU time of the Vulkan submissions. Empty until enableMetrics(true).
+     */
+    py::dict getMetrics(bool reset)
     {
-        if (!hiresRenderer) {
-            if (useVulkan)
-#ifdef CORRADE_TARGET_APPLE
-                TLOG(ERROR) << "Vulkan not supported on MacOS";
-#else
-                hiresRenderer = std::make_unique<V4REnvRenderer>(envs, renderW, renderH, dynamic_cast<V4REnvRenderer *>(renderer.get()), true);
-#endif
-            else
-                hiresRenderer = std::make_unique<MagnumEnvRenderer>(envs, renderW, renderH);
+        sprof().collect();
+
+        constexpr double nsToMs = 1e-6;
+        const std::vector<std::pair<const char *, const char *>> zones{
+            {"simulate", "VectorEnv::simulate"}, {"pre_draw", "Renderer::preDraw"}, {"draw", "Renderer::draw"},
+            {"readback", "Renderer::readback"}, {"reset", "Env::reset"}, {"submit", "Renderer::submit"},
+            {"gpu_draw", "Renderer::gpu.draw"}, {"gpu_readback", "Renderer::gpu.readback"}, {"gpu_frame", "Renderer::gpu.frame"},
+        };
+
+        py::dict metrics;
+        for (const auto &[key, zone] : zones) {
+            const auto h = sprof().histogram(zone);
+
+            py::dict m;
+            m["count"] = h.count;
+            m["mean_ms"] = h.meanNs() * nsToMs;
+            m["p50_ms"] = h.percentile(0.5) * nsToMs;
+            m["p95_ms"] = h.percentile(0.95) * nsToMs;
+            m["p99_ms"] = h.percentile(0.99) * nsToMs;
+            m["max_ms"] = double(h.maxNs) * nsToMs;
+            metrics[key] = m;
+        }
 
-            for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx)
-                hiresRenderer->reset(*envs[envIdx], envIdx);
+        if (auto *vectorEnv = getVectorEnv()) {
+            const auto stats = vectorEnv->getStats();
+            const auto waitStats = vectorEnv->getWaitStats();
+            metrics["num_episode_resets"] = stats.numEpisodeResets;
+            metrics["num_resets"] = stats.numResets;
+            metrics["thread_utilization"] = stats.threadUtilization;
+            metrics["barrier_wait_ms"] = waitStats.totalWaitUsec / 1e3f;
+            metrics["num_parked"] = waitStats.numParked;
+            metrics["active_threads"] = stats.numActiveThreads;
+            metrics["envs_per_thread"] = stats.envsPerThread;
+            metrics["tuned_steps_per_sec"] = stats.tunedStepsPerSec;
+            metrics["num_thread_calibrations"] = stats.numCalibrations;
+
+            if (reset)
+                vectorEnv->resetStats();
         }
 
-        for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
-            if (isDone(envIdx))
-                hiresRenderer->reset(*envs[envIdx], envIdx);
+        metrics["dropped_events"] = sprof().droppedEvents();
+        if (reset)
+            sprof().clear();
+
+        return metrics;
+    }
 
-            hiresRenderer->preDraw(*envs[envIdx], envIdx);
+    /**
+     * Episodes finished since the last call (see VectorEnv::popEpisodeStats()) as numpy arrays of equal length, plus
+     * the number of episodes dropped because the buffer was full. Empty arrays before the first reset().
+     */
+    py::dict popEpisodeStats()
+    {
+        std::vector<VectorEnv::EpisodeStats> episodes;
+        uint64_t numDropped = 0;
+        if (auto *vectorEnv = getVectorEnv())
+            numDropped = vectorEnv->popEpisodeStats(episodes);
+
+        const auto n = py::ssize_t(episodes.size());
+        py::array_t<int> env(n), agent(n), length(n);
+        py::array_t<float> episodeReturn(n), trueObjective(n), wallTime(n);
+        py::array_t<uint64_t> doneStep(n);
+
+        for (py::ssize_t i = 0; i < n; ++i) {
+            const auto &e = episodes[size_t(i)];
+            env.mutable_at(i) = e.envIdx, agent.mutable_at(i) = e.agentIdx, length.mutable_at(i) = e.numSteps;
+            episodeReturn.mutable_at(i) = e.episodeReturn, trueObjective.mutable_at(i) = e.trueObjective;
+            wallTime.mutable_at(i) = e.wallTimeSec, doneStep.mutable_at(i) = e.doneStep;
         }
 
-        hiresRenderer->draw(envs);
+        py::dict stats;
+        stats["env"] = env;
+        stats["agent"] = agent;
+        stats["return"] = episodeReturn;
+        stats["length"] = length;
+        stats["true_objective"] = trueObjective;
+        stats["wall_time"] = wallTime;
+        stats["done_step"] = doneStep;
+        stats["num_dropped"] = numDropped;
+        return stats;
     }
 
-    void drawOverview()
+    /**
+     * Bytes by subsystem, see VectorEnv::memoryReport(). Empty before the first reset().
+     */
+    py::dict memoryReport(bool perEnv)
     {
-#ifdef WITH_GUI
-        if (!viewer && Viewer::viewerExists) {
-            TLOG(INFO) << "Only one viewer per process is supported";
-            return;
-        }
+        py::dict report;
+        auto *vectorEnv = getVectorEnv();
+        if (!vectorEnv)
+            return report;
 
-        if (!viewer) {
-            static int argc = 1;
-            static const char *argv[] = {"Overview"};
-            Magnum::Platform::Application::Arguments fakeArgs{argc, (char **) argv};
-            TLOG(INFO) << __FUNCTION__ << " Creating a viewer object";
-            viewer = std::make_unique<Viewer>(envs, useVulkan, renderer.get(), fakeArgs);
-        }
+        for (const auto &[subsystem, bytes] : vectorEnv->memoryReport(perEnv).entries())
+            report[py::str(subsystem)] = bytes;
 
-        viewer->step(vectorEnv->done);
-        viewer->mainLoopIteration();  // handle events, update the window, that kind of thing
-#else
-        // TLOG(ERROR) << "Megaverse was built without GUI support";
-#endif
+        return report;
     }
 
-    py::array_t<uint8_t> getHiresObservation(int envIdx, int agentIdx)
+private:
+    int numAgentsTotal() const { return getNumActiveEnvs() * numAgents(); }
+
+    static std::vector<py::ssize_t> shape(const std::vector<int> &dims)
     {
-        const uint8_t *obsData = hiresRenderer->getObservation(envIdx, agentIdx);
-        return py::array_t<uint8_t>({renderH, renderW, 4}, obsData, py::none{});  // numpy object does not own memory
+        return {dims.begin(), dims.end()};
     }
 
-    float trueObjective(int envIdx, int agentIdx) const
+private:
+    HostBuffer obsChw;
+};
+
+
+/**
+ * Receiving side of MegaverseGym.encode_observations(), one decoder per agent stream.
+ */
+class ObservationDecoder
+{
+public:
+    ObservationDecoder(int h, int w, int channels)
+        : h{h}, w{w}, channels{channels}
+        , decoder{size_t(h) * size_t(w) * size_t(channels)}
     {
-        return vectorEnv->trueObjectives[envIdx][agentIdx];
     }
 
-    std::map<std::string, float> getRewardShaping(int envIdx, int agentIdx)
+    /**
+     * @return (H, W, C) uint8 array, or None if the frame is corrupted or is a delta frame that arrived before
+     * the first key frame.
+     */
+    py::object decode(py::buffer encoded)
     {
-        return envs[envIdx]->getScenario().getRewardShaping(agentIdx);
+        const auto info = encoded.request();
+        py::array_t<uint8_t> frame({h, w, channels});
+
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = decoder.decode(static_cast<const uint8_t *>(info.ptr), size_t(info.size * info.itemsize), frame.mutable_data());
+        }
+
+        if (!ok)
+            return py::none{};
+        return std::move(frame);
     }
 
-    void setRewardShaping(int envIdx, int agentIdx, const std::map<std::string, float> &rewardShaping)
+private:
+    int h, w, channels;
+    FrameDecoder decoder;
+};
+
+
+/**
+ * Attaches to one slice of the envs served by MegaverseGym.serve() in another process. Views returned by get_*_view
+ * point directly to the shared memory, they are overwritten by the next step and valid while the client exists.
+ * With a tcp://host:port name the slice is received over the network into a local buffer with the same layout, so
+ * the views and the rest of the API are the same.
+ */
+class MegaverseClient
+{
+public:
+    MegaverseClient(const std::string &name, int sliceIdx, bool compressed)
     {
-        envs[envIdx]->getScenario().setRewardShaping(agentIdx, rewardShaping);
+        std::string host;
+        int port = 0;
+
+        if (name.rfind("tcp://", 0) != 0)
+            clientPtr = std::make_unique<VectorEnvClient>(name, sliceIdx);
+        else if (parseHostPort(name.substr(6), host, port))
+            clientPtr = std::make_unique<VectorEnvTcpClient>(host, port, sliceIdx, compressed);
+
+        if (!clientPtr || !clientPtr->isOpen())
+            TLOG(ERROR) << "Could not attach to slice " << sliceIdx << " of " << name;
+    }
+
+    int numEnvs() const { return client().numEnvs(); }
+
+    int numAgents() const { return client().numAgents(); }
+
+    /**
+     * Wait until the server has reset the envs after start, observations are valid after this.
+     */
+    bool waitForReset()
+    {
+        return client().waitForReset();
     }
 
     /**
-     * Explicitly destroy the env and the renderer to avoid doing this when the Python object goes out-of-scope.
+     * @param actions int32 array of shape (num_agents, len(action_space_sizes)), for the agents of this slice.
      */
-    void close()
+    void setActionsBatched(const py::array_t<int32_t, py::array::c_style | py::array::forcecast> &actions)
     {
-        if (vectorEnv)
-            vectorEnv->close();
+        const auto numActionSpaces = int(Env::actionSpaceSizes.size());
 
-#ifdef WITH_GUI
-        if (viewer)
-            viewer->exit(0);
-        viewer.reset();
-#endif
+        if (actions.ndim() != 2 || actions.shape(0) != numAgents() || actions.shape(1) != numActionSpaces)
+            throw py::value_error("Expected actions of shape (" + std::to_string(numAgents()) + ", " + std::to_string(numActionSpaces) + ")");
 
-        hiresRenderer.reset();
-        renderer.reset();
-        vectorEnv.reset();
+        const int32_t *data = actions.data();
+        for (int agentIdx = 0; agentIdx < numAgents(); ++agentIdx)
+            if (!validActions(data + agentIdx * numActionSpaces, numActionSpaces))
+                throw py::value_error("Actions of agent #" + std::to_string(agentIdx) + " are out of range");
 
-        envs.clear();
+        for (int agentIdx = 0; agentIdx < numAgents(); ++agentIdx, data += numActionSpaces)
+            client().actions()[agentIdx] = int32_t(decodeActions(data, numActionSpaces));
     }
 
-private:
-    Envs envs;
-    int numEnvs, numAgentsPerEnv;
-    std::vector<float> rewards;  // to avoid reallocating on every call
+    /**
+     * @return false if the server was terminated.
+     */
+    bool step()
+    {
+        return client().step();
+    }
 
-    std::unique_ptr<VectorEnv> vectorEnv;
-    std::unique_ptr<EnvRenderer> renderer, hiresRenderer;
+    /**
+     * Submit the actions without waiting, i.e. to step other slices while this one is in flight. The views must not
+     * be read until step_wait().
+     */
+    bool stepAsync()
+    {
+        return client().stepAsync();
+    }
 
-    Rng rng{std::random_device{}()};
+    bool stepWait()
+    {
+        return client().stepWait();
+    }
 
-#ifdef WITH_GUI
-    std::unique_ptr<Viewer> viewer;
-#endif
+    py::array_t<uint8_t> getObservationsView()
+    {
+        const auto &h = client().getHeader();
+        return py::array_t<uint8_t>({numAgents(), h.obsH, h.obsW, h.obsChannels}, client().observations(), py::none{});
+    }
 
-    bool useVulkan;
-    int w, h;
-    int renderW = 768, renderH = 432;
+    py::array_t<float> getRewardsView()
+    {
+        return py::array_t<float>({numAgents()}, client().rewards(), py::none{});
+    }
 
-    int numSimulationThreads;
+    py::array_t<uint8_t> getDonesView()
+    {
+        return py::array_t<uint8_t>({numEnvs()}, client().dones(), py::none{});
+    }
+
+    void terminate()
+    {
+        client().terminate();
+    }
+
+private:
+    VectorEnvClient & client() const
+    {
+        TCHECK(clientPtr);
+        return *clientPtr;
+    }
+
+private:
+    std::unique_ptr<VectorEnvClient> clientPtr;
 };
 
 
@@ -270,23 +698,106 @@ PYBIND11_MODULE(megaverse, m)
 
     m.def("set_megaverse_log_level", &setMegaverseLogLevel, "Megaverse Log Level (0 to disable all logs, 2 for warnings");
 
+    m.def(
+        "bake_episode_dataset", &BatchedEnv::bakeEpisodeDataset,
+        py::arg("scenario"), py::arg("num_agents_per_env"), py::arg("params"), py::arg("seed"), py::arg("num_episodes"), py::arg("filename"),
+        py::call_guard<py::gil_scoped_release>()
+    );
+
     py::class_<MegaverseGym>(m, "MegaverseGym")
-        .def(py::init<const std::string &, int, int, int, int, int, bool, const FloatParams &>())
+        .def(py::init<const std::string &, int, int, int, int, int, bool, const FloatParams &>(), py::call_guard<py::gil_scoped_release>())
+        .def(py::init<const std::vector<std::string> &, int, int, int, int, int, bool, const FloatParams &>(), py::call_guard<py::gil_scoped_release>())
         .def("num_agents", &MegaverseGym::numAgents)
+        .def("env_scenarios", &MegaverseGym::envScenarios)
+        .def("set_num_active_envs", &MegaverseGym::setNumActiveEnvs, py::arg("num_envs"), py::call_guard<py::gil_scoped_release>())
+        .def("num_active_envs", &MegaverseGym::getNumActiveEnvs)
         .def("action_space_sizes", &MegaverseGym::actionSpaceSizes)
         .def("seed", &MegaverseGym::seed)
-        .def("reset", &MegaverseGym::reset)
+        .def("reset", &MegaverseGym::reset, py::call_guard<py::gil_scoped_release>())
         .def("set_actions", &MegaverseGym::setActions)
-        .def("step", &MegaverseGym::step)
+        .def("set_actions_batched", &MegaverseGym::setActionsBatched)
+        .def("set_render_mask", &MegaverseGym::setRenderMask)
+        .def("step", &MegaverseGym::step, py::call_guard<py::gil_scoped_release>())
+        .def("step_async", &MegaverseGym::stepAsync, py::call_guard<py::gil_scoped_release>())
+        .def("step_wait", &MegaverseGym::stepWait, py::call_guard<py::gil_scoped_release>())
+        .def("send", &MegaverseGym::send, py::arg("env_ids"), py::arg("actions"))
+        .def("recv", &MegaverseGym::recv, py::arg("batch_size"))
+        .def("fork", &MegaverseGym::fork, py::arg("env_idx"), py::arg("target_ids"))
         .def("is_done", &MegaverseGym::isDone)
         .def("get_observation", &MegaverseGym::getObservation)
+        .def("get_observations_batched", &MegaverseGym::getObservationsBatched, py::arg("rgb_chw") = false)
+        .def("get_observations_cuda", &MegaverseGym::getObservationsCuda)
+        .def("set_frame_stack_cuda", &MegaverseGym::setDeviceFrameStack)
+        .def("get_frame_stack_cuda", &MegaverseGym::getFrameStackCuda)
+        .def("set_auxiliary_outputs", &MegaverseGym::setAuxiliaryOutputs, py::arg("depth") = false, py::arg("segmentation") = false)
+        .def("get_auxiliary_observations_batched", &MegaverseGym::getAuxiliaryObservationsBatched)
         .def("get_last_rewards", &MegaverseGym::getLastRewards)
+        .def("get_rewards_view", &MegaverseGym::getRewardsView)
+        .def("get_dones_view", &MegaverseGym::getDonesView)
+        .def("get_agent_dones_view", &MegaverseGym::getAgentDonesView)
+        .def("get_true_objectives_view", &MegaverseGym::getTrueObjectivesView)
         .def("true_objective", &MegaverseGym::trueObjective)
-        .def("set_render_resolution", &MegaverseGym::setRenderResolution)
-        .def("draw_hires", &MegaverseGym::drawHires)
+        .def("set_render_resolution", &MegaverseGym::setHiresResolution)
+        .def("set_render_gpus", &MegaverseGym::setRenderGpus)
+        .def("set_render_command_streams", &MegaverseGym::setRenderCommandStreams)
+        .def("set_render_threads", &MegaverseGym::setRenderThreads)
+        .def("set_cpu_affinity", &MegaverseGym::setCpuAffinity)
+        .def("set_physics_group_size", &MegaverseGym::setPhysicsGroupSize, py::arg("group_size"))
+        .def("set_frame_skip", &MegaverseGym::setFrameSkip)
+        .def("set_background_resets", &MegaverseGym::setBackgroundResets, py::arg("enabled") = true)
+        .def("set_incremental_resets", &MegaverseGym::setIncrementalResets, py::arg("step_budget_ns"))
+        .def("set_batched_components", &MegaverseGym::setBatchedComponents, py::arg("enabled") = true)
+        .def("set_freeze_done_agents", &MegaverseGym::setFreezeDoneAgents, py::arg("freeze") = true)
+        .def("set_physics_workers", &MegaverseGym::setPhysicsWorkers, py::arg("num_threads"))
+        .def("set_low_latency", &MegaverseGym::setLowLatency, py::arg("enabled") = true)
+        .def("set_episode_stats_capacity", &MegaverseGym::setEpisodeStatsCapacity, py::arg("capacity"))
+        .def("pop_episode_stats", &MegaverseGym::popEpisodeStats)
+        .def("set_terminal_observations", &MegaverseGym::setTerminalObservations, py::arg("enabled") = true)
+        .def("get_terminal_observations", &MegaverseGym::getTerminalObservations)
+        .def("set_thread_auto_tuning", &MegaverseGym::setThreadAutoTuning, py::arg("calibration_steps"), py::arg("retune_interval") = 0)
+        .def("set_observation_format", &MegaverseGym::setObservationFormat, py::arg("format"), py::arg("downsample") = 1)
+        .def("set_shading", &MegaverseGym::setShading)
+        .def("set_host_memory_policy", &MegaverseGym::setHostMemoryPolicy)
+        .def("set_cpu_rendering", &MegaverseGym::setCpuRendering, py::arg("enabled") = true)
+        .def("set_symbolic_observations", &MegaverseGym::setSymbolicObservations, py::arg("mode") = "crop", py::arg("radius") = 7, py::arg("below") = 2, py::arg("above") = 4)
+        .def("symbolic_shape", &MegaverseGym::symbolicShape)
+        .def("record_trajectories", &MegaverseGym::recordTrajectories, py::arg("filename"))
+        .def("pregenerate_episodes", &MegaverseGym::pregenerateEpisodes, py::arg("queue_depth") = 2, py::arg("num_threads") = 1)
+        .def("set_episode_dataset", &MegaverseGym::setEpisodeDataset, py::arg("filename"))
+        .def("enable_ray_sensors", &MegaverseGym::enableRaySensors, py::arg("num_rays") = 16, py::arg("fov_degrees") = 180.0f, py::arg("pitch_degrees") = std::vector<float>{0.0f}, py::arg("max_distance") = 20.0f)
+        .def("get_ray_sensors_view", &MegaverseGym::getRaySensorsView)
+        .def("encode_observations", &MegaverseGym::encodeObservations, py::arg("keyframe_interval") = 64)
+        .def("get_encoded_observations", &MegaverseGym::getEncodedObservations)
+        .def("set_hires_envs", &MegaverseGym::setHiresEnvs, py::arg("env_indices"))
+        .def("draw_hires", &MegaverseGym::drawHires, py::call_guard<py::gil_scoped_release>())
+        .def("record_video", &MegaverseGym::recordVideo, py::arg("filename_prefix"), py::arg("fps") = 15.0f)
         .def("draw_overview", &MegaverseGym::drawOverview)
         .def("get_hires_observation", &MegaverseGym::getHiresObservation)
         .def("get_reward_shaping", &MegaverseGym::getRewardShaping)
         .def("set_reward_shaping", &MegaverseGym::setRewardShaping)
+        .def("set_reward_shaping_batched", &MegaverseGym::setRewardShapingBatched, py::arg("reward_names"), py::arg("values"))
+        .def("enable_metrics", &MegaverseGym::enableMetrics, py::arg("enable") = true)
+        .def("get_metrics", &MegaverseGym::getMetrics, py::arg("reset") = false)
+        .def("memory_report", &MegaverseGym::memoryReport, py::arg("per_env") = false)
+        .def("serve", &MegaverseGym::serve, py::arg("name"), py::arg("num_slices") = 1, py::call_guard<py::gil_scoped_release>())
+        .def("stop_serving", &MegaverseGym::stopServing)
         .def("close", &MegaverseGym::close);
+
+    py::class_<ObservationDecoder>(m, "ObservationDecoder")
+        .def(py::init<int, int, int>(), py::arg("h"), py::arg("w"), py::arg("channels"))
+        .def("decode", &ObservationDecoder::decode, py::arg("encoded"));
+
+    py::class_<MegaverseClient>(m, "MegaverseClient")
+        .def(py::init<const std::string &, int, bool>(), py::arg("name"), py::arg("slice_idx") = 0, py::arg("compressed") = false)
+        .def("num_envs", &MegaverseClient::numEnvs)
+        .def("num_agents", &MegaverseClient::numAgents)
+        .def("wait_for_reset", &MegaverseClient::waitForReset, py::call_guard<py::gil_scoped_release>())
+        .def("set_actions_batched", &MegaverseClient::setActionsBatched)
+        .def("step", &MegaverseClient::step, py::call_guard<py::gil_scoped_release>())
+        .def("step_async", &MegaverseClient::stepAsync, py::call_guard<py::gil_scoped_release>())
+        .def("step_wait", &MegaverseClient::stepWait, py::call_guard<py::gil_scoped_release>())
+        .def("get_observations_view", &MegaverseClient::getObservationsView)
+        .def("get_rewards_view", &MegaverseClient::getRewardsView)
+        .def("get_dones_view", &MegaverseClient::getDonesView)
+        .def("terminate", &MegaverseClient::terminate);
 }
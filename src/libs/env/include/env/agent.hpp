@@ -8,6 +8,7 @@
 
 #include <util/magnum.hpp>
 #include <util/voxel_grid.hpp>
+#include <util/state_buffer.hpp>
 
 #include <env/physics.hpp>
 #include <env/voxel_state.hpp>
@@ -17,6 +18,19 @@
 namespace Megaverse
 {
 
+/**
+ * Movement commands of one agent for the current step, decoded from the action bits by Env::step().
+ * The axes are -1, 0 or 1: forward/backward, strafe left/right, look left/right, look up/down.
+ */
+struct AgentControls
+{
+    float forward = 0, strafeLeft = 0, yaw = 0, pitch = 0;
+    bool jump = false;
+
+    bool idle() const { return forward == 0 && strafeLeft == 0 && yaw == 0 && pitch == 0 && !jump; }
+};
+
+
 class AbstractAgent : public Object3D
 {
 public:
@@ -24,6 +38,18 @@ public:
 
     virtual void updateTransform() = 0;
 
+    /**
+     * Scene graph transform between the last two physics substeps, alpha in [0, 1] is the fraction of the substep
+     * the simulation time is past the last one. Used when physics runs at a different rate than the env steps.
+     */
+    virtual void updateInterpolatedTransform(float /*alpha*/) { updateTransform(); }
+
+    /**
+     * All movement of one step in a single call. The default goes through the individual virtuals below,
+     * agents override this with a direct implementation.
+     */
+    virtual void applyControls(const AgentControls &controls, float dt);
+
     virtual void lookLeft(float dt) = 0;
 
     virtual void lookRight(float dt) = 0;
@@ -38,6 +64,12 @@ public:
 
     virtual bool onGround() const = 0;
 
+    /**
+     * Standing still on the ground. Idle controls would not change anything for a settled agent,
+     * so Env::step() does not apply them.
+     */
+    virtual bool settled() const { return false; }
+
     virtual void accelerate(const btVector3 &acc, btScalar frameDuration) = 0;
 
     virtual void jump() = 0;
@@ -52,6 +84,18 @@ public:
 
     virtual Object3D * interactLocation() = 0;
 
+    /**
+     * Optional fast path for the character collision queries, see LayoutCollisionQuery.
+     */
+    virtual void setLayoutCollisionQuery(const LayoutCollisionQuery *) {}
+
+    /**
+     * Agent state that is not captured by the scene graph and the collision object transforms (see Env::saveState()).
+     */
+    virtual void saveState(StateBuffer &) const {}
+
+    virtual void restoreState(StateReader &) {}
+
 private:
     virtual void rotateYAxis(float radians) = 0;
 
@@ -74,6 +118,10 @@ public:
 
     void updateTransform() override;
 
+    void updateInterpolatedTransform(float alpha) override;
+
+    void applyControls(const AgentControls &controls, float dt) override;
+
     void lookLeft(float dt) override;
 
     void lookRight(float dt) override;
@@ -88,6 +136,8 @@ public:
 
     bool onGround() const override;
 
+    bool settled() const override;
+
     void accelerate(const btVector3 &acc, btScalar frameDuration) override;
 
     void jump() override;
@@ -102,9 +152,19 @@ public:
 
     Object3D * interactLocation() override { return pickupSpot; }
 
+    void setLayoutCollisionQuery(const LayoutCollisionQuery *query) override;
+
+    void saveState(StateBuffer &buffer) const override;
+
+    void restoreState(StateReader &reader) override;
+
 private:
     void rotateYAxis(float radians) override;
 
+    void setXRotation(float radians);
+
+    void applyWorldTransform(const btVector3 &origin, const btQuaternion &rotation);
+
 private:
     static constexpr auto rotateRadians = 3.5f, rotateXRadians = 1.5f;
     static constexpr auto agentHeight = 1.75f;
@@ -120,4 +180,127 @@ private:
     std::unique_ptr<KinematicCharacterController> bCharacter;
 };
 
-}
\ No newline at end of file
+
+/**
+ * Cheaper alternative to DefaultKinematicAgent for layouts made of axis-aligned boxes (i.e. flat voxel floors).
+ * The agent is an AABB that moves one axis at a time and stops at the first contact with the AABB of any other
+ * collision object, with the same acceleration, friction, gravity and jump tuning as KinematicCharacterController.
+ * There are no sweeps, no penetration recovery and no step-up/step-down: the agent cannot climb steps
+ * (neither can the default controller with its 0.2 step height and 1-unit voxels) and slopes are not supported.
+ * Runs as an action of the Bullet world, so it follows the physics substeps.
+ */
+class VoxelKinematicAgent final : public AbstractAgent, public btActionInterface, public ParallelAction
+{
+public:
+    explicit VoxelKinematicAgent(
+        Object3D *parent, btDynamicsWorld &bWorld, const Magnum::Vector3 &startingPosition,
+        float rotationRad, float verticalLookLimitRad
+    );
+
+    ~VoxelKinematicAgent() override;
+
+    void updateTransform() override;
+
+    void updateInterpolatedTransform(float alpha) override;
+
+    void applyControls(const AgentControls &controls, float dt) override;
+
+    void lookLeft(float dt) override { yaw += rotateRadians * dt; }
+
+    void lookRight(float dt) override { yaw -= rotateRadians * dt; }
+
+    void lookUp(float dt) override;
+
+    void lookDown(float dt) override;
+
+    btVector3 forwardDirection() const override;
+
+    btVector3 strafeLeftDirection() const override;
+
+    bool onGround() const override { return grounded; }
+
+    bool settled() const override { return grounded && horizontalVelocity.fuzzyZero(); }
+
+    void accelerate(const btVector3 &acc, btScalar frameDuration) override;
+
+    void jump() override;
+
+    void teleport(const btVector3 &position) override;
+
+    float getAgentHeight() override { return agentHeight; }
+
+    Magnum::SceneGraph::Camera3D * getCamera() override { return camera; }
+
+    Object3D * getCameraObject() override { return cameraObject; }
+
+    Object3D * interactLocation() override { return pickupSpot; }
+
+    void setLayoutCollisionQuery(const LayoutCollisionQuery *query) override { layoutQuery = query; }
+
+    void saveState(StateBuffer &buffer) const override;
+
+    void restoreState(StateReader &reader) override;
+
+    // btActionInterface
+    void updateAction(btCollisionWorld *collisionWorld, btScalar deltaTime) override;
+
+    // ParallelAction
+    void prepareAction(btCollisionWorld &world, btScalar dt) override;
+
+    void commitAction(btCollisionWorld &world) override;
+
+    void debugDraw(btIDebugDraw *) override {}
+
+private:
+    void rotateYAxis(float radians) override { yaw += radians; }
+
+    void setXRotation(float radians);
+
+    void applyWorldTransform(const btVector3 &origin);
+
+    /// AABB of the agent at the given position intersects another object
+    bool collides(btCollisionWorld &world, const btVector3 &position) const;
+
+    /**
+     * Move along one axis as far as possible, at most by delta.
+     * @return false if the agent hit something
+     */
+    bool moveAxis(btCollisionWorld &world, btVector3 &position, int axis, btScalar delta) const;
+
+private:
+    static constexpr auto rotateRadians = 3.5f, rotateXRadians = 1.5f;
+    static constexpr auto agentHeight = 1.75f;
+
+    // same tuning as KinematicCharacterController
+    static constexpr btScalar gravity = 1.4f * 9.8f, fallSpeed = 55.0f, jumpSpeed = 6.2f;
+    static constexpr btScalar maxHorizontalSpeed = 4.5f, maxAirSpeed = 1.0f, normalDeceleration = 15.0f;
+    static constexpr btScalar maxAcceleration = 35.0f + normalDeceleration, maxAirAcceleration = 3.0f;
+    static constexpr btScalar exceedingSpeedLimitDeceleration = maxAcceleration * 2;
+
+    struct State
+    {
+        float yaw, currXRotation;
+        btVector3 horizontalVelocity, previousPosition;
+        btScalar verticalVelocity;
+        bool grounded;
+    };
+
+    float yaw = 0.0f, currXRotation = 0.0f;
+    btVector3 horizontalVelocity{0, 0, 0}, previousPosition;
+    btScalar verticalVelocity = 0;
+    bool grounded = false;
+
+    // computed by prepareAction(), applied by commitAction()
+    btVector3 nextPosition{0, 0, 0};
+
+    const LayoutCollisionQuery *layoutQuery = nullptr;
+
+    Object3D *cameraObject;
+    Magnum::SceneGraph::Camera3D *camera;
+    Object3D *pickupSpot;
+
+    btBoxShape boxShape;
+    btCollisionObject collisionObject;
+};
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+#include <env/env.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Fall detection in a form that can be checked for many envs at once, see FallDetectionComponent.
+ */
+class BatchedFallDetection
+{
+public:
+    virtual ~BatchedFallDetection() = default;
+
+    /// Agents below this height fell off the level.
+    virtual float fallHeight() const = 0;
+
+    /// Called for every agent below fallHeight(), i.e. to put it back on the level.
+    virtual void respawnFallenAgent(Env &env, int agentIdx) = 0;
+};
+
+/**
+ * Components of a scenario that support the batched update, see Scenario::batchedComponents().
+ */
+struct BatchedComponents
+{
+    BatchedFallDetection *fallDetection = nullptr;
+
+    bool empty() const { return !fallDetection; }
+};
+
+/**
+ * ECS-style update of the batched components over a range of envs, i.e. the shard of a worker thread.
+ * Inputs of all envs are gathered into contiguous arrays and checked in one pass, per-env callbacks only run for the
+ * agents that need them. Runs between Env::simulate() and Env::finishStep() of the envs, which must have
+ * Env::setBatchedComponents() enabled. Buffers are kept between calls, so use one instance per thread.
+ */
+class BatchedComponentsPass
+{
+public:
+    /**
+     * @param components of every env in envs, indexed the same way.
+     * @param skipEnv optional per-env flags, envs with a non-zero flag are not updated (i.e. they were not stepped).
+     */
+    void run(Envs &envs, const std::vector<BatchedComponents> &components, int firstEnv, int endEnv, const uint8_t *skipEnv = nullptr);
+
+private:
+    std::vector<float> heights, thresholds;
+    std::vector<uint8_t> fell;
+
+    // env and agent of every entry
+    std::vector<std::pair<int, int>> agents;
+};
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <env/env.hpp>
+#include <env/kinematics_kernel.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Experimental: movement of the VoxelKinematicAgents of all envs as one data-parallel pass, for render-bound
+ * pipelines that keep the observations on the GPU (V4REnvRenderer). Agents only collide with a dense copy of the
+ * solid voxels of their env taken by syncEnv(), not with movable objects or other agents, so this fits scenarios
+ * with simple kinematics. Built with MEGAVERSE_CUDA_KINEMATICS the states and the voxels live on the device and a
+ * step runs one CUDA thread per agent, only the controls go up and the camera views and the compact event flags
+ * (KinematicEvent) come back. Otherwise the same kernel runs on the CPU.
+ * Buffers are indexed like the other per-agent buffers of VectorEnv.
+ */
+class BatchedKinematics
+{
+public:
+    static constexpr int viewFloats = 16;
+
+public:
+    explicit BatchedKinematics(const Envs &envs, const KinematicParams &params = {});
+
+    ~BatchedKinematics();
+
+    /**
+     * Copy the solid voxels of the scenario and the poses of the agents (at rest) from the env, i.e. after its reset.
+     * @return false if the scenario has no voxel grid, its solid voxels don't fit into maxGridVoxels, or the agents
+     * are not VoxelKinematicAgents
+     */
+    bool syncEnv(int envIdx, Env &env, size_t maxGridVoxels = 1 << 24);
+
+    /// Controls of all agents, applied once, then numSubsteps integration steps over dt.
+    void step(const KinematicControls *controls, float dt, int numSubsteps = 1);
+
+    /// Column-major view matrices of the last step, viewFloats per agent, see V4REnvRenderer::setCameraViews().
+    const float * getCameraViews() const { return views.data(); }
+
+    /// KinematicEvent bits of the last step, one byte per agent.
+    const uint8_t * getEvents() const { return events.data(); }
+
+    /// Downloads the states from the device if needed.
+    const std::vector<KinematicAgentState> & getAgentStates();
+
+    int numAgentsTotal() const { return int(agentEnvs.size()); }
+
+    bool onDevice() const;
+
+    size_t memoryBytes() const;
+
+private:
+    void updateViews();
+
+private:
+    KinematicParams params;
+
+    // numEnvs + 1 offsets
+    std::vector<int> agentOffsets, agentEnvs;
+    std::vector<KinematicGrid> grids;
+    std::vector<std::vector<uint8_t>> envVoxels;
+
+    std::vector<KinematicAgentState> states;
+    std::vector<float> views;
+    std::vector<uint8_t> events;
+
+    // device copies, see batched_kinematics.cu
+    struct Device;
+    std::unique_ptr<Device> device;
+    bool statesOnDevice = false;
+};
+
+}
@@ -16,6 +16,16 @@ namespace Str
     ConstStr episodeLengthSec = "episodeLengthSec",
              verticalLookLimitRad = "verticalLookLimitRad",
              useUIRewardIndicators = "useUIRewardIndicators";
+
+    // fixed physics timestep (0 means one substep per env step) and the cap on the substeps per env step
+    ConstStr physicsStepSec = "physicsStepSec",
+             maxPhysicsSubSteps = "maxPhysicsSubSteps";
+
+    // spawn VoxelKinematicAgent instead of DefaultKinematicAgent if > 0
+    ConstStr voxelAgentController = "voxelAgentController";
+
+    // sweep and prune broadphase (BroadphaseType::AxisSweep) over the voxel grid bounds instead of the AABB tree if > 0
+    ConstStr axisSweepBroadphase = "axisSweepBroadphase";
 }
 
 
@@ -87,6 +97,23 @@ const int numAgentColors = ARR_LENGTH(agentColors);
 
 inline Magnum::Color3 rgb(ColorRgb color) { return toRgbf((unsigned long long)color); }
 
+/**
+ * Integer color ID: index of the color in allColors, i.e. the index of the material or palette entry in the renderers.
+ * Aliases such as LAYOUT_DEFAULT have the ID of the color they alias.
+ */
+constexpr uint8_t noColorId = 0xff;
+
+inline uint8_t colorId(ColorRgb color)
+{
+    for (int i = 0; i < numColors; ++i)
+        if (allColors[i] == color)
+            return uint8_t(i);
+
+    return noColorId;
+}
+
+inline Magnum::Color3 colorById(uint8_t id) { return id < numColors ? rgb(allColors[id]) : Magnum::Color3{}; }
+
 inline ColorRgb sampleRandomColor(Rng &rng)
 {
     const auto idx = randRange(0, numColors, rng);
@@ -1,16 +1,23 @@
 #pragma once
 
 #include <map>
+#include <array>
+#include <memory>
 #include <random>
 #include <vector>
 #include <algorithm>
 
+#include <Magnum/Math/Range.h>
 #include <Magnum/SceneGraph/Scene.h>
 #include <Magnum/SceneGraph/SceneGraph.h>
 
 #include <util/util.hpp>
+#include <util/worker_pool.hpp>
+#include <util/episode_arena.hpp>
+#include <util/memory_report.hpp>
 
 #include <env/agent.hpp>
+#include <env/const.hpp>
 #include <env/physics.hpp>
 
 
@@ -18,6 +25,7 @@ namespace Megaverse
 {
 
 class Scenario;
+class EpisodeDataset;
 
 enum class Action
 {
@@ -71,20 +79,63 @@ enum class DrawableType
 
 struct SceneObjectInfo
 {
-    SceneObjectInfo(Object3D *objectPtr, const Magnum::Color3 &color)
+    SceneObjectInfo(Object3D *objectPtr, ColorRgb color, bool layout = false)
         : objectPtr{objectPtr}
-          , color{color}
+          , colorId{Megaverse::colorId(color)}
+          , layout{layout}
     {
     }
 
     Object3D *objectPtr;
+
+    // index of the color in allColors (see colorId()), renderers resolve it with colorById() or their own palette
+    uint8_t colorId;
+
+    // static layout (merged voxels, maze walls), renderers that trace the voxel grid directly skip these
+    bool layout;
+};
+
+
+/**
+ * Rectangle of the HUD, drawn by the renderers over the observation of the agent after the scene.
+ */
+struct HudQuad
+{
+    Magnum::Range2D rect;  // normalized device coordinates, y is up
     Magnum::Color3 color;
 };
 
 
+/**
+ * One element per drawable type, a flat replacement for std::map<DrawableType, T> on the reset and draw paths.
+ */
+template<typename T>
+class DrawableTypeArray
+{
+public:
+    static constexpr size_t numTypes = size_t(DrawableType::NumTypes);
+
+public:
+    T & operator[](DrawableType type) { return items[size_t(type)]; }
+
+    const T & operator[](DrawableType type) const { return items[size_t(type)]; }
+
+    T & at(DrawableType type) { return items.at(size_t(type)); }
+
+    const T & at(DrawableType type) const { return items.at(size_t(type)); }
+
+    auto begin() { return items.begin(); }
+    auto end() { return items.end(); }
+    auto begin() const { return items.begin(); }
+    auto end() const { return items.end(); }
+
+private:
+    std::array<T, numTypes> items{};
+};
+
 using FloatParams = std::map<std::string, float>;
 using Agents = std::vector<AbstractAgent *>;
-using DrawablesMap = std::map<DrawableType, std::vector<SceneObjectInfo>>;
+using DrawablesMap = DrawableTypeArray<std::vector<SceneObjectInfo>>;
 using RewardShaping = std::map<std::string, float>;
 
 class Env
@@ -95,10 +146,124 @@ public:
      */
     struct EnvPhysics
     {
-        EnvPhysics()
+        /**
+         * Exposes the bits of the world state that we need to reset when the world is reused between episodes.
+         */
+        class DynamicsWorld : public btDiscreteDynamicsWorld
+        {
+        public:
+            using btDiscreteDynamicsWorld::btDiscreteDynamicsWorld;
+
+            /// fixed-capacity broadphases would overrun their handle arrays, this makes it a clean error instead
+            void addCollisionObject(
+                btCollisionObject *object, int group = btBroadphaseProxy::DefaultFilter, int mask = btBroadphaseProxy::AllFilter
+            ) override
+            {
+                TCHECK(!maxObjects || getNumCollisionObjects() < maxObjects)
+                    << "More than " << maxObjects << " collision objects, increase BroadphaseOptions::maxObjects";
+                btDiscreteDynamicsWorld::addCollisionObject(object, group, mask);
+            }
+
+            void setMaxObjects(int numObjects) { maxObjects = numObjects; }
+
+            void resetLocalTime() { m_localTime = 0; }
+
+            /// simulation time accumulated since the last fixed substep
+            btScalar localTime() const { return m_localTime; }
+
+            /**
+             * True if there is nothing in the world for the solver to do: no dynamic or kinematic rigid bodies
+             * and no constraints. Agents are actions on ghost objects and don't count.
+             */
+            bool isKinematicOnly() const { return m_nonStaticRigidBodies.size() == 0 && m_constraints.size() == 0; }
+
+            /**
+             * Equivalent of stepSimulation() for worlds where isKinematicOnly() is true.
+             * Same fixed-timestep accounting, but each substep only refreshes the AABBs and the overlapping pairs
+             * (so ghost objects see the current contacts) and then runs the actions (character controllers).
+             * Narrowphase, islands, the constraint solver and integration are skipped entirely.
+             * @return number of substeps performed
+             */
+            /// Helpers for the parallel actions of this world (see ParallelAction), nullptr runs all actions in order.
+            void setWorkers(WorkerPool *pool) { workers = pool; }
+
+            int stepKinematicOnly(btScalar timeStep, int maxSubSteps, btScalar fixedTimeStep)
+            {
+                if (maxSubSteps <= 0)
+                    return stepSimulation(timeStep, maxSubSteps, fixedTimeStep);
+
+                int numSubSteps = 0;
+                m_fixedTimeStep = fixedTimeStep;
+                m_localTime += timeStep;
+                if (m_localTime >= fixedTimeStep) {
+                    numSubSteps = int(m_localTime / fixedTimeStep);
+                    m_localTime -= btScalar(numSubSteps) * fixedTimeStep;
+                }
+
+                const auto clampedSubSteps = std::min(numSubSteps, maxSubSteps);
+                for (int i = 0; i < clampedSubSteps; ++i) {
+                    updateAabbs();
+                    computeOverlappingPairs();
+                    updateActions(fixedTimeStep);
+                }
+
+                return numSubSteps;
+            }
+
+        protected:
+            /**
+             * With workers the parallel actions are prepared concurrently and committed in the order of the actions,
+             * then the other actions run as usual.
+             */
+            void updateActions(btScalar timeStep) override
+            {
+                parallelActions.clear(), sequentialActions.clear();
+                if (workers)
+                    for (int i = 0; i < m_actions.size(); ++i) {
+                        if (auto *action = dynamic_cast<ParallelAction *>(m_actions[i]))
+                            parallelActions.push_back(action);
+                        else
+                            sequentialActions.push_back(m_actions[i]);
+                    }
+
+                if (parallelActions.size() < 2) {
+                    btDiscreteDynamicsWorld::updateActions(timeStep);
+                    return;
+                }
+
+                workers->parallelFor(int(parallelActions.size()), actionsPerTask, [&](int begin, int end) {
+                    for (int i = begin; i < end; ++i)
+                        parallelActions[i]->prepareAction(*this, timeStep);
+                });
+
+                for (auto *action : parallelActions)
+                    action->commitAction(*this);
+                for (auto *action : sequentialActions)
+                    action->updateAction(this, timeStep);
+            }
+
+        private:
+            static constexpr int actionsPerTask = 4;
+
+            int maxObjects = 0;
+
+            WorkerPool *workers = nullptr;
+            std::vector<ParallelAction *> parallelActions;
+            std::vector<btActionInterface *> sequentialActions;
+        };
+
+        explicit EnvPhysics(
+            std::shared_ptr<PhysicsResources> resources = std::make_shared<PhysicsResources>(), const BroadphaseOptions &broadphaseOptions = {}
+        )
+        : resources{std::move(resources)}
+        , broadphaseOptions{broadphaseOptions}
+        , bBroadphase{createBroadphase(broadphaseOptions)}
         {
             // what does this really do?
-            bBroadphase.getOverlappingPairCache()->setInternalGhostPairCallback(&ghostPairCallback);
+            bBroadphase->getOverlappingPairCache()->setInternalGhostPairCallback(&ghostPairCallback);
+
+            if (broadphaseOptions.type == BroadphaseType::AxisSweep)
+                bWorld.setMaxObjects(broadphaseOptions.maxObjects);
         }
 
         ~EnvPhysics()
@@ -106,13 +271,45 @@ public:
             collisionShapes.clear();
         }
 
+        /**
+         * Bring the world to the freshly constructed state, keeping all the allocated pools.
+         * All collision objects must be removed from the world before this is called (i.e. scene graph destroyed).
+         * @return false if the world could not be reused
+         */
+        bool clear()
+        {
+            if (bWorld.getNumCollisionObjects() > 0) {
+                TLOG(ERROR) << "Collision objects left in the world after reset: " << bWorld.getNumCollisionObjects();
+                return false;
+            }
+
+            collisionShapes.clear();
+
+            // with no proxies left this resets the broadphase tree and proxy ids, so the next episode is deterministic
+            bBroadphase->resetPool(&bCollisionDispatcher);
+            bConstraintSolver.reset();
+
+            bWorld.clearForces();
+            bWorld.resetLocalTime();
+            return true;
+        }
+
+        // first member, so the allocations of the world below are counted
+        struct MemoryHooks
+        {
+            MemoryHooks() { BulletMemory::installHooks(); }
+        } memoryHooks;
+
+        std::shared_ptr<PhysicsResources> resources;
+        const BroadphaseOptions broadphaseOptions;
+
         btGhostPairCallback ghostPairCallback;
 
-        btDbvtBroadphase bBroadphase;
-        btSequentialImpulseConstraintSolver bConstraintSolver;
-        btDefaultCollisionConfiguration bCollisionConfiguration;
+        std::unique_ptr<btBroadphaseInterface> bBroadphase;
+        btSequentialImpulseConstraintSolver &bConstraintSolver = resources->constraintSolver;
+        btDefaultCollisionConfiguration &bCollisionConfiguration = resources->collisionConfiguration;
         btCollisionDispatcher bCollisionDispatcher{&bCollisionConfiguration};
-        btDiscreteDynamicsWorld bWorld{&bCollisionDispatcher, &bBroadphase, &bConstraintSolver, &bCollisionConfiguration};
+        DynamicsWorld bWorld{&bCollisionDispatcher, bBroadphase.get(), &bConstraintSolver, &bCollisionConfiguration};
 
         std::vector<std::unique_ptr<btCollisionShape>> collisionShapes;
     };
@@ -127,11 +324,22 @@ public:
         explicit EnvState(int numAgents)
         : physics{std::make_unique<EnvPhysics>()}
         , currAction(size_t(numAgents), Action::Idle)
+        , agentDone(size_t(numAgents), 0)
         , lastReward(size_t(numAgents), 0)
         , totalReward(size_t(numAgents), 0.0f)
         {
         }
 
+        ~EnvState()
+        {
+            // bodies leave the world (and return their contacts to the shared pools) when the scene is destroyed
+            const auto resources = physics->resources;
+            const auto physicsLock = resources->lock();
+            agents.clear();
+            scene.reset();
+            physics.reset();
+        }
+
         void reset()
         {
             done = false;
@@ -141,13 +349,20 @@ public:
             std::fill(currAction.begin(), currAction.end(), Action::Idle);
             std::fill(lastReward.begin(), lastReward.end(), 0.0f);
             std::fill(totalReward.begin(), totalReward.end(), 0.0f);
-
-            scene = std::make_unique<Scene3D>();
+            std::fill(agentDone.begin(), agentDone.end(), 0);
 
             agents.clear();
 
-            // completely reset the whole simulation
-            physics = std::make_unique<EnvPhysics>();
+            // destroying the scene graph removes all bodies and agents from the world, then we can reuse it
+            scene.reset();
+            episodeArena.release();
+
+            if (!retainPhysicsWorld || physics->broadphaseOptions != broadphase || !physics->clear()) {
+                // completely reset the whole simulation
+                physics = std::make_unique<EnvPhysics>(physics->resources, broadphase);
+            }
+
+            scene = std::make_unique<Scene3D>();
         }
 
     public:
@@ -160,15 +375,77 @@ public:
         float simulationStepSeconds = 1.0f / 15.0f;  // 15 FPS is default
         float lastFrameDurationSec = simulationStepSeconds;
         std::vector<Action> currAction;
+
+        // agents that finished their part of the episode before the env is done, see Scenario::setAgentDone()
+        std::vector<uint8_t> agentDone;
+        bool freezeDoneAgents = false;
         std::vector<float> lastReward, totalReward;
 
+        /**
+         * Storage for the episode-lifetime objects that the scene refers to (e.g. collision shapes of the layout),
+         * released in one go on reset. Declared before the scene so that it outlives the scene graph.
+         */
+        EpisodeArena episodeArena;
+
         std::unique_ptr<Scene3D> scene;
 
         Agents agents;
 
         Rng rng{std::random_device{}()};
+
+        // bake all static layout boxes into a single compound collision shape instead of a rigid body per box
+        bool compoundStaticLayout = false;
+
+        // use the voxel grid to skip static layout geometry in agent collision sweeps when possible
+        bool voxelCollisionFastPath = false;
+
+        // keep the Bullet world (broadphase, dispatcher, solver) between episodes instead of reconstructing it
+        bool retainPhysicsWorld = true;
+
+        // skip the full Bullet pipeline when the world has nothing but static bodies and kinematic agents
+        bool kinematicStepFastPath = true;
+
+        // broadphase of the world of the next episodes, see Scenario::broadphaseOptions()
+        BroadphaseOptions broadphase;
+
+        // seed used to generate the layout of the current episode, can be used as a key to cache layouts
+        int layoutSeed = 0;
+
+        // entry of the episode dataset with the layout of this episode, nullptr if it has to be generated
+        const uint8_t *bakedLayout = nullptr;
+        size_t bakedLayoutBytes = 0;
+
+        // layout seed of episode #i of this env is a function of (seed, stream, i), see Env::seed()
+        uint64_t seed = std::random_device{}();
+        uint32_t seedStream = 0;
+        uint64_t numEpisodes = 0;
+
+        // unique within the process, identifies the episode a state snapshot belongs to
+        uint64_t episodeId = 0;
+
+        // episode that generated the current layout, differs from episodeId in envs that replicate another env
+        uint64_t layoutEpisodeId = 0;
+
+        // components with a batched update skip their per-env step(), see BatchedComponentsPass
+        bool batchedComponents = false;
+
+        // shared helper threads for the agents of this env, see Env::setPhysicsWorkers()
+        WorkerPool *physicsWorkers = nullptr;
+    };
+
+    /// Env::step() is simulate() followed by finishStep().
+    enum class StepPhase
+    {
+        Full,
+        Simulate,
+        Finish,
     };
 
+    /**
+     * Env::step() loop instantiated for one scenario type, see simulateWith().
+     */
+    using StepFunc = void (*)(Env &, StepPhase);
+
 public:
     explicit Env(const std::string &scenarioName, int numAgents = 2, const FloatParams& customFloatParams = FloatParams{});
 
@@ -176,6 +453,8 @@ public:
 
     int getNumAgents() const { return numAgents; }
 
+    const std::string & getScenarioName() const { return scenarioName; }
+
     Scenario & getScenario() { return *scenario; }
 
     Scene3D & getScene() const { return *state.scene; }
@@ -199,13 +478,44 @@ public:
      */
     void setAction(int agentIdx, Action action);
 
+    /// Action set for the next tick, cleared by step().
+    Action getAction(int agentIdx) const { return state.currAction[agentIdx]; }
+
     /**
      * Advance simulation by one step.
      */
     void step();
 
+    /**
+     * First part of step(): agent controls, physics and Scenario::step(). Batched components (see
+     * BatchedComponentsPass) are updated between this and finishStep().
+     */
+    void simulate();
+
+    /// Second part of step(): episode time, done flag and the rewards of the step.
+    void finishStep();
+
+    /**
+     * The step loop with the per-tick scenario hooks called directly, ScenarioT must be the exact type of the
+     * scenario (or Scenario for virtual calls). Defined in env/env_step.hpp and instantiated by the scenario
+     * registration, step() calls the instantiation for this env's scenario.
+     */
+    template<typename ScenarioT>
+    void simulateWith(ScenarioT &scenario);
+
+    template<typename ScenarioT>
+    void finishStepWith(ScenarioT &scenario);
+
     bool isDone() const { return state.done; }
 
+    /// The agent finished (i.e. reached the exit) and does not affect the rest of the episode, or the env is done.
+    bool isAgentDone(int agentIdx) const { return state.done || state.agentDone[agentIdx]; }
+
+    /**
+     * Done agents ignore their actions and come to rest where they are, so the controllers have nothing to update.
+     */
+    void setFreezeDoneAgents(bool freeze) { state.freezeDoneAgents = freeze; }
+
     /**
      * @param agentIdx agent for which to query the last reward
      * @return reward in the last tick
@@ -229,15 +539,100 @@ public:
 
     void terminateEpisodeOnNextFrame();
 
+    /**
+     * HUD of the agent for the current step, see Scenario::hud(). Quads are appended.
+     */
+    void hud(int agentIdx, std::vector<HudQuad> &quads) const;
+
+    /**
+     * Snapshot of the simulation state: env counters and rewards, RNG, transforms of all scene graph objects,
+     * Bullet collision objects (transforms, velocities, flags), agent controllers and the scenario state
+     * (see Scenario::saveState()). The buffer is overwritten and can be reused, then saving does not allocate.
+     * @return false if the scenario does not support snapshots
+     */
+    bool saveState(StateBuffer &buffer) const;
+
+    /**
+     * Within the layout of the snapshot (same episode, or an episode that already replicated it) this only copies
+     * the state back and resyncs the physics world, drawables stay the same.
+     * Snapshots of other episodes (or other envs of the same scenario) are restored on top of a regenerated layout,
+     * i.e. reset() with the layout seed of the snapshot. Then episodeId() changes and the renderer has to be reset
+     * for this env.
+     * @return false if the snapshot does not match the scenario, the env must be reset then
+     */
+    bool restoreState(const StateBuffer &buffer);
+
+    /**
+     * Replicate the current state into another env of the same scenario (saveState() + restoreState()).
+     * The first clone in the target regenerates the layout (from the layout cache if the scenario has one), the
+     * following clones of this episode only copy the dynamic state.
+     * @return false if the scenario does not support snapshots or the target does not match
+     */
+    bool clone(Env &target) const;
+
+    uint64_t episodeId() const { return state.episodeId; }
+
+    /// Same as episodeId() unless the layout was replicated from another env, see restoreState().
+    uint64_t layoutEpisodeId() const { return state.layoutEpisodeId; }
+
+    /**
+     * Estimated memory of this env by subsystem: scene graph, Bullet world, drawables, episode arena and whatever
+     * the scenario reports (i.e. the voxel grid). Process-wide counters are added by VectorEnv::memoryReport().
+     */
+    void memoryReport(MemoryReport &report) const;
+
     /**
      * We need this because of the requirements of the Vulkan renderer (materials have to be known in advance)
      */
     std::vector<Magnum::Color3> getPalette() const;
 
     /**
-     * Seed the rng with specific seed value.
+     * Seed the sequence of episodes. Envs in a vector use the same seed with different streams (i.e. env indices).
+     */
+    void seed(int seedValue, int stream = 0);
+
+    /**
+     * Layout seed of the episode #episodeIdx since the last seed(), computed directly from the counter-based rng.
+     */
+    int episodeLayoutSeed(uint64_t episodeIdx) const;
+
+    /**
+     * Regenerate the episode #episodeIdx since the last seed(), the following resets continue from there.
+     */
+    void resetToEpisode(uint64_t episodeIdx);
+
+    /**
+     * Regenerate the episode with this layout seed (see getLayoutSeed()), i.e. to replay a recorded episode.
+     * Does not advance the episode counter.
      */
-    void seed(int seedValue);
+    void resetWithLayoutSeed(int seed);
+
+    /**
+     * Time-sliced reset() for resets that shouldn't take a whole step. The reset runs as a sequence of stages (clearing
+     * the world, Scenario::reset(), spawning the agents, the episode drawables and bodies, the agent drawables), and
+     * continueReset() runs them in order until the time budget is spent. Every call runs at least one stage, so the
+     * reset completes after at most numResetStages calls. Until then the env must not be stepped, drawn or saved.
+     * Another reset abandons the one in progress.
+     */
+    void beginReset();
+
+    /// @return true if the reset is complete
+    bool continueReset(uint64_t budgetNs);
+
+    bool resetInProgress() const { return resetStage != ResetStage::Done; }
+
+    int getLayoutSeed() const { return state.layoutSeed; }
+
+    /**
+     * Play only the episodes of the dataset: episode #i is the entry (firstEntry + i * entryStride) modulo the
+     * dataset size, so envs of a vector (first entry = env index, stride = number of envs) sweep the whole dataset
+     * in order. Resets with a layout seed of the dataset instantiate the layout from the entry. nullptr detaches it.
+     * @return false if the dataset was baked for another scenario, parameters or number of agents
+     */
+    bool setEpisodeDataset(std::shared_ptr<const EpisodeDataset> dataset, uint64_t firstEntry = 0, uint64_t entryStride = 1);
+
+    /// Index of the next episode for reset(), see episodeLayoutSeed().
+    uint64_t nextEpisodeIdx() const { return state.numEpisodes; }
 
     Rng &getRng() { return state.rng; }
 
@@ -250,10 +645,53 @@ public:
 
     void setSimulationResolution(float sec) { state.simulationStepSeconds = sec; }
 
+    void setRetainPhysicsWorld(bool retain) { state.retainPhysicsWorld = retain; }
+
+    void setCompoundStaticLayout(bool compound) { state.compoundStaticLayout = compound; }
+
+    void setVoxelCollisionFastPath(bool fastPath) { state.voxelCollisionFastPath = fastPath; }
+
+    void setKinematicStepFastPath(bool fastPath) { state.kinematicStepFastPath = fastPath; }
+
+    /**
+     * Build the Bullet world on top of resources shared with other envs (see PhysicsResources), before the first reset.
+     * @return false if the env already has objects in its world.
+     */
+    bool setPhysicsResources(std::shared_ptr<PhysicsResources> resources);
+
+    /// The caller runs a BatchedComponentsPass between simulate() and finishStep() of this env.
+    void setBatchedComponents(bool batched) { state.batchedComponents = batched; }
+
+    bool getBatchedComponents() const { return state.batchedComponents; }
+
+    /**
+     * Move the agents of this env in parallel on the pool (see ParallelAction), for large scenes with many agents.
+     * Agents then collide with the positions of the other agents at the start of the substep instead of the ones
+     * that moved before them. The pool can be shared between envs, nullptr moves the agents one after another.
+     */
+    void setPhysicsWorkers(WorkerPool *pool) { state.physicsWorkers = pool; }
+
 public:
     // need better mechanism for this
     static const std::vector<int> actionSpaceSizes;
 
+    static constexpr int numResetStages = 5;
+
+private:
+    enum class ResetStage
+    {
+        World,
+        Scenario,
+        Agents,
+        Drawables,
+        AgentDrawables,
+        Done,
+    };
+
+    void startReset(int seed);
+
+    void runResetStage();
+
 private:
     std::string scenarioName;
     std::unique_ptr<Scenario> scenario;
@@ -261,6 +699,18 @@ private:
     EnvState state;
     int numAgents;
     DrawablesMap drawables;
+
+    // scratch buffer for Env::step()
+    std::vector<AgentControls> agentControls;
+
+    // registered together with the scenario type, generic version with virtual scenario calls otherwise
+    StepFunc stepFunc = nullptr;
+
+    std::shared_ptr<const EpisodeDataset> episodeDataset;
+    uint64_t datasetFirstEntry = 0, datasetEntryStride = 1;
+
+    ResetStage resetStage = ResetStage::Done;
+    int resetSeed = 0;
 };
 
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <util/host_buffer.hpp>
+
 #include <env/env.hpp>
 
 
@@ -9,6 +11,86 @@ namespace Megaverse
 // defined later in render_utils.cpp
 class Overview;
 
+/**
+ * Rows are always top-down. BGR(A) is the channel order OpenCV expects, so frames can be passed to imshow(),
+ * imwrite() or a VideoWriter as they are.
+ */
+enum class ObservationFormat
+{
+    RGBA8,
+    RGB8,
+    Gray8,
+    BGRA8,
+    BGR8,
+};
+
+/**
+ * Lighting of the observations. At low resolutions the specular highlight adds little signal, the cheaper models
+ * save fragment work on fill-limited GPUs. Lambert is the diffuse term evaluated once per face (the primitive meshes
+ * have per-face normals), Flat is the unlit palette color.
+ */
+enum class ShadingModel
+{
+    BlinnPhong,
+    Lambert,
+    Flat,
+};
+
+enum class ObservationChannel
+{
+    Color,
+    Depth,
+    Segmentation,
+};
+
+/**
+ * Layout of the observations produced by the renderer. Everything except the default RGBA8 at full resolution is
+ * converted before the readback, so less data has to be transferred and copied.
+ */
+struct ObservationOptions
+{
+    ObservationFormat format = ObservationFormat::RGBA8;
+
+    // observations are (w / downsample, h / downsample), each pixel is the average of a downsample x downsample block
+    int downsample = 1;
+
+    // auxiliary channels rendered in the same pass as color, always at full resolution with one uint16 per pixel
+    // depth: linear view depth, 65535 is the far plane of the agent camera
+    // segmentation: material ID, i.e. color ID of the object + 1 (see colorId()), 0 is the background
+    bool depth = false, segmentation = false;
+
+    ShadingModel shading = ShadingModel::BlinnPhong;
+
+    // allocation of the host buffers that hold the observations of the whole batch
+    HostMemoryPolicy hostMemory = HostMemoryPolicy::Pageable;
+
+    bool convertsColor() const { return format != ObservationFormat::RGBA8 || downsample != 1; }
+
+    bool hasAuxiliaryChannels() const { return depth || segmentation; }
+
+    bool swapsRedBlue() const { return format == ObservationFormat::BGRA8 || format == ObservationFormat::BGR8; }
+
+    int channels() const
+    {
+        switch (format) {
+            case ObservationFormat::RGB8:
+            case ObservationFormat::BGR8: return 3;
+            case ObservationFormat::Gray8: return 1;
+            default: return 4;
+        }
+    }
+
+    int width(int w) const { return w / downsample; }
+    int height(int h) const { return h / downsample; }
+
+    size_t bytesPerFrame(int w, int h) const { return size_t(width(w)) * size_t(height(h)) * size_t(channels()); }
+
+    size_t bytesPerFrame(ObservationChannel channel, int w, int h) const
+    {
+        return channel == ObservationChannel::Color ? bytesPerFrame(w, h) : size_t(w) * size_t(h) * sizeof(uint16_t);
+    }
+};
+
 class EnvRenderer
 {
 public:
@@ -16,10 +98,60 @@ public:
 
     virtual void reset(Env &env, int envIdx) = 0;
 
+    /**
+     * Reset can be split in two parts. prepareReset() is called from a worker thread right after the env itself
+     * is reset, so it must only touch the data that belongs to this particular env.
+     * finishReset() does the rest and is always called from the main thread (i.e. the one that owns the
+     * rendering context).
+     * By default everything is done in finishReset().
+     */
+    virtual void prepareReset(Env &, int) {}
+
+    virtual void finishReset(Env &env, int envIdx) { reset(env, envIdx); }
+
     virtual void preDraw(Env &env, int envIndex) = 0;
 
     virtual void draw(Envs &envs) = 0;
 
+    /**
+     * Pipelined rendering: submit the frame and return without waiting for the GPU, so the next frame can be
+     * simulated in the meantime. waitForFrame() must be called before any changes to the render state that is
+     * not covered by preDraw() (i.e. reset).
+     * getObservation() keeps returning the last frame finished by waitForFrame(), so in this mode observations
+     * lag behind the simulation by one frame.
+     * By default rendering is synchronous.
+     */
+    virtual void drawAsync(Envs &envs) { draw(envs); }
+
+    virtual void waitForFrame() {}
+
+    /**
+     * Renderers with several command streams split the envs into shards of consecutive envs that are submitted
+     * separately. VectorEnv calls submitShard() from the worker thread that pre-draws the last active env of a shard
+     * in a step, so the GPU starts on it while the other shards are still simulating; draw() submits the remaining
+     * shards and waits for all of them. Calls for different shards are concurrent.
+     * Only in synchronous mode (draw()): shards with envs reset in the step, or not pre-drawn by the workers, are
+     * submitted by draw().
+     * By default the frame is submitted as a whole.
+     */
+    virtual int numShards() const { return 1; }
+    virtual int shardOf(int /*envIdx*/) const { return 0; }
+    virtual void submitShard(int /*shardIdx*/) {}
+
+    /**
+     * Envs from numEnvs onwards are inactive (see VectorEnv::setNumActiveEnvs()): they get no preDraw() calls until
+     * they are reset again, and renderers that can skip them in draw() do. Their slots in the observation buffers
+     * are kept, so the layout of the batch does not change.
+     */
+    virtual void setNumActiveEnvs(int /*numEnvs*/) {}
+
+    /**
+     * Only agents with a non-zero entry (env-major, indexed like the per-agent buffers of VectorEnv) are rendered
+     * and read back in the following draw() calls, observations of the other agents are not updated and should not
+     * be used. An empty mask renders all agents. Renderers that can't skip agents render everyone.
+     */
+    virtual void setRenderMask(const std::vector<uint8_t> & /*agentMask*/) {}
+
     /**
      * Query the pointer to memory holding the latest observation for an agent in an env.
      * @param envIdx env index.
@@ -28,7 +160,73 @@ public:
      */
     virtual const uint8_t *getObservation(int envIdx, int agentIdx) const = 0;
 
+    /**
+     * Same as above for the auxiliary channels requested in ObservationOptions.
+     * @return nullptr if the channel was not requested or is not supported by the renderer.
+     */
+    virtual const uint8_t *getObservation(int envIdx, int agentIdx, ObservationChannel channel) const
+    {
+        return channel == ObservationChannel::Color ? getObservation(envIdx, agentIdx) : nullptr;
+    }
+
+    /**
+     * Observations of all agents in all envs in one contiguous buffer (env-major, then agent), see ObservationOptions.
+     * @return pointer to the first observation, or nullptr if the renderer does not keep observations in one buffer.
+     */
+    virtual const uint8_t *getObservationsBatch() const { return nullptr; }
+
+    virtual const uint8_t *getObservationsBatch(ObservationChannel channel) const
+    {
+        return channel == ObservationChannel::Color ? getObservationsBatch() : nullptr;
+    }
+
+    /**
+     * Same layout as getObservationsBatch(), but in GPU memory (CUDA device pointer), so observations can be passed
+     * to the policy without a round trip through the host memory.
+     * @return device pointer, or nullptr if not supported by the renderer.
+     */
+    virtual const uint8_t *getObservationsBatchDevice() const { return nullptr; }
+
+    /**
+     * Keep the last numFrames color observations of every agent in GPU memory, so frame stacking needs no copies of
+     * the same frames on every step. Call before the first reset, an env that is reset starts with a history made of
+     * its first frame.
+     * @return false if not supported by the renderer.
+     */
+    virtual bool setDeviceFrameStack(int /*numFrames*/) { return false; }
+
+    /**
+     * Latest stack in GPU memory, oldest frame first: numFrames consecutive batches in the layout of
+     * getObservationsBatch(), so frame #i of agent #j is at (i * numAgents + j) * bytesPerFrame.
+     * @return device pointer, or nullptr if there is no frame stack.
+     */
+    virtual const uint8_t *getFrameStackDevice() const { return nullptr; }
+
+    /**
+     * Second output resolution (i.e. hires frames for evaluation videos) for a subset of envs, drawn on demand from
+     * the scene state of the last preDraw(). Instance data, transforms and GPU buffers are shared with the policy
+     * observations, only the target framebuffer and the frames are separate. Color only, the auxiliary channels of
+     * the options are ignored.
+     * @return false if the renderer has no second resolution, then drawHires() does nothing and callers need
+     * a separate renderer.
+     */
+    virtual bool setHiresOutput(int /*w*/, int /*h*/, const ObservationOptions &/*options*/) { return false; }
+
+    /**
+     * Draw the given envs at the resolution of setHiresOutput(). Called from the main thread after draw(), frames
+     * of the other envs keep their previous contents.
+     */
+    virtual void drawHires(Envs &/*envs*/, const std::vector<int> &/*envIndices*/) {}
+
+    /// @return nullptr if the env has never been drawn by drawHires()
+    virtual const uint8_t *getHiresObservation(int /*envIdx*/, int /*agentIdx*/) const { return nullptr; }
+
     virtual Overview * getOverview() = 0;
+
+    /**
+     * Memory of the renderer by subsystem, host memory under "render." and video memory under "gpu.".
+     */
+    virtual void memoryReport(MemoryReport &) const {}
 };
 
 inline std::tuple<float, float, float, float> agentCameraParameters()
@@ -37,6 +235,17 @@ inline std::tuple<float, float, float, float> agentCameraParameters()
     return std::make_tuple(fov, near, far, aspectRatio);
 }
 
+/**
+ * Linear view depth from the window-space depth of a perspective projection, scaled to the uint16 representation
+ * of the depth channel.
+ */
+inline uint16_t depthToUint16(float windowDepth, float near, float far)
+{
+    const auto ndc = 2.0f * windowDepth - 1.0f;
+    const auto linear = 2.0f * near * far / (far + near - ndc * (far - near));
+    return uint16_t(std::min(linear / far, 1.0f) * 65535.0f + 0.5f);
+}
+
 inline std::tuple<float, float, float, float> overviewCameraParameters()
 {
     auto [fov, near, far, aspectRatio] = agentCameraParameters();
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include <util/scoped_profiler.hpp>
+
+#include <env/env.hpp>
+#include <env/scenario.hpp>
+
+
+/**
+ * Env::step() loop, instantiated for every scenario type in registerScenario() (scenarios/init.hpp) and once for the
+ * type-erased Scenario in env.cpp.
+ */
+
+namespace Megaverse
+{
+
+/// The first action of each pair wins if both are set.
+inline float actionAxis(Action a, Action positive, Action negative)
+{
+    return !!(a & positive) ? 1.0f : (!!(a & negative) ? -1.0f : 0.0f);
+}
+
+inline AgentControls decodeAction(Action a)
+{
+    AgentControls c;
+    c.forward = actionAxis(a, Action::Forward, Action::Backward);
+    c.strafeLeft = actionAxis(a, Action::Left, Action::Right);
+    c.yaw = actionAxis(a, Action::LookLeft, Action::LookRight);
+    c.pitch = actionAxis(a, Action::LookUp, Action::LookDown);
+    c.jump = !!(a & Action::Jump);
+    return c;
+}
+
+
+/**
+ * Per-tick scenario hooks. The factory of ScenarioT creates exactly ScenarioT, so we can call its implementations
+ * directly instead of going through the vtable, and the compiler can inline them into the step loop.
+ * Scenario itself is the type-erased fallback with virtual calls.
+ */
+template<typename ScenarioT>
+struct ScenarioHooks
+{
+    static constexpr bool exactType = !std::is_same_v<ScenarioT, Scenario>;
+
+    static void preStep(ScenarioT &scenario)
+    {
+        if constexpr (exactType)
+            scenario.ScenarioT::preStep();
+        else
+            scenario.preStep();
+    }
+
+    static void step(ScenarioT &scenario)
+    {
+        if constexpr (exactType)
+            scenario.ScenarioT::step();
+        else
+            scenario.step();
+    }
+
+    static float episodeLengthSec(const ScenarioT &scenario)
+    {
+        if constexpr (exactType)
+            return scenario.ScenarioT::episodeLengthSec();
+        else
+            return scenario.episodeLengthSec();
+    }
+};
+
+template<typename ScenarioT>
+void Env::simulateWith(ScenarioT &scenario)
+{
+    PROFILE_ZONE("Env::step");
+
+    std::fill(state.lastReward.begin(), state.lastReward.end(), 0.0f);
+
+    const auto lastFrameDurationSec = state.lastFrameDurationSec;
+
+    // decode all actions first, then apply them with one call per agent
+    agentControls.resize(size_t(numAgents));
+    for (int i = 0; i < numAgents; ++i) {
+        const auto frozen = state.freezeDoneAgents && state.agentDone[i];
+        agentControls[i] = decodeAction(frozen ? Action::Idle : state.currAction[i]);
+    }
+
+    for (int i = 0; i < numAgents; ++i)
+        if (!agentControls[i].idle() || !state.agents[i]->settled())
+            state.agents[i]->applyControls(agentControls[i], lastFrameDurationSec);
+
+    ScenarioHooks<ScenarioT>::preStep(scenario);
+
+    // by default the physics makes exactly one substep per env step, scenarios can decouple the two
+    auto fixedStepSec = state.simulationStepSeconds;
+    int maxSubSteps = 1;
+    const bool decoupledPhysics = scenario.physicsStepSec() > 0;
+    if (decoupledPhysics) {
+        fixedStepSec = scenario.physicsStepSec();
+        maxSubSteps = scenario.maxPhysicsSubSteps();
+        if (maxSubSteps == 0)
+            maxSubSteps = std::max(int(std::ceil(lastFrameDurationSec / fixedStepSec)), 1);
+    }
+
+    auto &bWorld = state.physics->bWorld;
+    bWorld.setWorkers(state.physicsWorkers);
+    {
+        PROFILE_ZONE("stepSimulation");
+        if (state.kinematicStepFastPath && bWorld.isKinematicOnly())
+            bWorld.stepKinematicOnly(lastFrameDurationSec, maxSubSteps, fixedStepSec);
+        else
+            bWorld.stepSimulation(lastFrameDurationSec, maxSubSteps, fixedStepSec);
+    }
+
+    if (decoupledPhysics) {
+        // Bullet extrapolates the rigid bodies through their motion states, agents are drawn between the last two
+        // substeps (up to one substep behind, but never inside the geometry)
+        const auto alpha = std::min(float(bWorld.localTime() / fixedStepSec), 1.0f);
+        for (auto agent : state.agents)
+            agent->updateInterpolatedTransform(alpha);
+    } else {
+        for (auto agent : state.agents)
+            agent->updateTransform();
+    }
+
+    {
+        PROFILE_ZONE("Scenario::step");
+        ScenarioHooks<ScenarioT>::step(scenario);
+    }
+}
+
+template<typename ScenarioT>
+void Env::finishStepWith(ScenarioT &scenario)
+{
+    state.currEpisodeSec += state.lastFrameDurationSec;
+
+    if (state.currEpisodeSec >= ScenarioHooks<ScenarioT>::episodeLengthSec(scenario))
+        state.done = true;
+
+    // clear the actions
+    for (int i = 0; i < numAgents; ++i)
+        state.currAction[i] = Action::Idle;
+
+    for (int i = 0; i < int(state.agents.size()); ++i) {
+        state.totalReward[i] += state.lastReward[i];
+
+//        if (fabs(state.lastReward[i]) > SIMD_EPSILON)
+//            TLOG(INFO) << "Last reward for agent #" << i << ":  " << state.lastReward[i] << ", total reward:  " << state.totalReward[i];
+    }
+
+    ++state.numFrames;
+}
+
+template<typename ScenarioT>
+void stepScenario(Env &env, Env::StepPhase phase)
+{
+    auto &scenario = static_cast<ScenarioT &>(env.getScenario());
+    if (phase != Env::StepPhase::Finish)
+        env.simulateWith(scenario);
+    if (phase != Env::StepPhase::Simulate)
+        env.finishStepWith(scenario);
+}
+
+}
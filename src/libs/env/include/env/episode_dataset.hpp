@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include <util/filesystem_utils.hpp>
+
+
+namespace Megaverse
+{
+
+class Env;
+
+/**
+ * Layouts of N episodes of one scenario (same parameters and number of agents) generated offline into a single
+ * versioned binary file, i.e. for evaluation or a fixed curriculum. The file is memory-mapped, so nothing is read
+ * until an entry is used and all envs (and processes) share the pages. Envs with a dataset (see
+ * Env::setEpisodeDataset()) play only its episodes, and the scenario instantiates them from the entry instead of
+ * generating the layout, see Scenario::bakeLayout().
+ */
+class EpisodeDataset
+{
+public:
+    static constexpr uint32_t formatVersion = 1;
+
+public:
+    /**
+     * Generate episodes #0..numEpisodes-1 of the env (see Env::seed()) and write their layouts. Duplicate layout
+     * seeds are stored once. The env is reset in the process and should not have a dataset itself.
+     * @return false if the scenario can't bake its layouts or the file can't be written
+     */
+    static bool bake(Env &env, uint64_t numEpisodes, const std::string &filename);
+
+    /// nullptr if the file is missing, truncated or has another format version.
+    static std::shared_ptr<const EpisodeDataset> load(const std::string &filename);
+
+    /// Scenario, number of agents and parameters (after the defaults are applied), entries only fit such envs.
+    static std::string datasetKey(Env &env);
+
+    bool matches(Env &env) const { return key == datasetKey(env); }
+
+    size_t size() const { return size_t(header().numEntries); }
+
+    /// Entries are sorted by layout seed.
+    int layoutSeed(size_t idx) const { return entries()[idx].layoutSeed; }
+
+    /// Entry with this layout seed, -1 if the dataset does not have it.
+    int64_t find(int layoutSeed) const;
+
+    /// Layout written by Scenario::bakeLayout(), points into the mapping.
+    const uint8_t * layout(size_t idx) const { return image() + entries()[idx].offset; }
+
+    size_t layoutBytes(size_t idx) const { return size_t(entries()[idx].size); }
+
+private:
+    EpisodeDataset() = default;
+
+    /**
+     * File layout: header, key (padded to 8 bytes), entry table, layouts.
+     */
+    struct Header
+    {
+        char magic[8];
+        uint32_t version, keyBytes;
+        uint64_t numEntries;
+    };
+
+    struct Entry
+    {
+        int32_t layoutSeed;
+        uint32_t reserved;
+        uint64_t offset, size;
+    };
+
+    static constexpr char magic[8] = {'M', 'V', 'E', 'P', 'S', 'E', 'T', 'S'};
+
+    static size_t entriesOffset(const Header &h) { return sizeof(Header) + (uint64_t(h.keyBytes) + 7) / 8 * 8; }
+
+    const uint8_t * image() const { return reinterpret_cast<const uint8_t *>(mapped->data()); }
+
+    const Header & header() const { return *reinterpret_cast<const Header *>(image()); }
+
+    const Entry * entries() const { return reinterpret_cast<const Entry *>(image() + entriesOffset(header())); }
+
+private:
+    std::unique_ptr<MappedFile> mapped;
+    std::string key;
+};
+
+}
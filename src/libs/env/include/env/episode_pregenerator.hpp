@@ -0,0 +1,80 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include <env/env.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Generates the layouts of the next few episodes of every env on low-priority background threads, so Env::reset()
+ * only restores a cached layout instead of generating the level and merging the voxels on the critical path.
+ * Episodes are generated by scratch envs of the same scenario (one per scenario and thread) that are never stepped
+ * or rendered, and end up in the layout cache of the scenario, see Scenario::reserveLayoutCache(). Layout seeds
+ * are known in advance (see Env::episodeLayoutSeed()), so the episodes are exactly the ones the env is going to
+ * play. Envs of scenarios without a layout cache are ignored.
+ */
+class EpisodePregenerator
+{
+public:
+    using EnvFactory = std::function<std::unique_ptr<Env>(int envIdx)>;
+
+public:
+    /**
+     * @param makeEnv creates a scratch env with the same scenario, number of agents and parameters as env #envIdx
+     * @param queueDepth number of upcoming episodes per env kept ready
+     */
+    EpisodePregenerator(const Envs &envs, EnvFactory makeEnv, int queueDepth = 2, int numThreads = 1);
+
+    ~EpisodePregenerator();
+
+    /**
+     * Called by VectorEnv after env #envIdx started an episode, on the thread that reset it. Enqueues the episodes
+     * that follow, requests for the episodes it already played are dropped.
+     */
+    void episodeStarted(int envIdx, const Env &env);
+
+    /// Layouts generated so far, cache hits of the envs are counted by the cache itself.
+    uint64_t numGenerated() const { return generated.load(std::memory_order_relaxed); }
+
+private:
+    struct Request
+    {
+        int envIdx;
+        uint64_t episodeIdx;
+        int layoutSeed;
+    };
+
+    void generatorLoop();
+
+private:
+    EnvFactory makeEnv;
+    int queueDepth;
+
+    std::vector<std::string> scenarioNames;
+    std::vector<bool> supported;
+
+    // per env, everything before this episode is already played
+    std::vector<std::atomic<uint64_t>> nextEpisode;
+
+    // per env, episodes before this one were already requested, guarded by the mutex
+    std::vector<uint64_t> queuedUpTo;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Request> requests;
+    bool stop = false;
+
+    std::atomic<uint64_t> generated{0};
+
+    std::vector<std::thread> threads;
+};
+
+}
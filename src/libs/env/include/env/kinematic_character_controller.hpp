@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstdint>
+
 #include "LinearMath/btVector3.h"
+#include "LinearMath/btTransform.h"
 
 #include "BulletDynamics/Dynamics/btActionInterface.h"
 #include "BulletCollision/BroadphaseCollision/btCollisionAlgorithm.h"
@@ -16,6 +19,8 @@ class btPairCachingGhostObject;
 namespace Megaverse
 {
 
+class LayoutCollisionQuery;
+
 ///btKinematicCharacterController is an object that supports a sliding motion in a world.
 ///It uses a ghost object and convex sweep test to test for upcoming collisions. This is combined with discrete collision detection to recover from penetrations.
 ///Interaction between btKinematicCharacterController and dynamic rigid bodies needs to be explicity implemented by the user.
@@ -33,6 +38,7 @@ public:
     ///btActionInterface interface
     void updateAction(btCollisionWorld *collisionWorld, btScalar deltaTime) override
     {
+        m_previousPosition = m_ghostObject->getWorldTransform().getOrigin();
         preStep(collisionWorld);
         playerStep(collisionWorld, deltaTime);
     }
@@ -78,6 +84,12 @@ public:
 
     btScalar getStepHeight() const { return m_stepHeight; }
 
+    /**
+     * With the query set, convex sweeps skip the static layout bodies whenever the query reports that the swept
+     * volume contains no layout geometry. Other objects (agents, movable boxes, etc.) are always tested by Bullet.
+     */
+    void setLayoutCollisionQuery(const LayoutCollisionQuery *query) { m_layoutQuery = query; }
+
     void setFallSpeed(btScalar fallSpeed);
 
     btScalar getFallSpeed() const { return m_fallSpeed; }
@@ -117,10 +129,33 @@ public:
 
     bool onGround() const;
 
+    /// The last step left the agent standing where it was, see playerStep().
+    bool isResting() const { return m_resting; }
+
     void setUpInterpolate(bool value);
 
     void setAcceleration(btVector3 acc, btScalar dt);
 
+    /**
+     * Everything that changes while the character moves, for env snapshots. Parameters (speeds, slopes, etc.)
+     * are set once on construction and are not included.
+     */
+    struct State
+    {
+        btVector3 horizontalVelocity, angularVelocity, jumpPosition, jumpAxis;
+        btVector3 currentPosition, targetPosition, touchingNormal, previousPosition;
+        btQuaternion currentOrientation, targetOrientation;
+        btScalar verticalVelocity, verticalOffset, currentStepOffset, jumpSpeed;
+        bool touchingContact, wasOnGround, wasJumping;
+    };
+
+    State getState() const;
+
+    /// Ghost object position before the last physics substep, to interpolate the rendered transform.
+    const btVector3 & getPreviousPosition() const { return m_previousPosition; }
+
+    void setState(const State &state);
+
 protected:
     static btVector3 *getUpAxisDirections();
 
@@ -132,6 +167,9 @@ protected:
 
     bool recoverFromPenetration(btCollisionWorld *collisionWorld, int iteration);
 
+    /// Hash of the objects overlapping the ghost object and their positions.
+    uint64_t contactSignature() const;
+
     void stepUp(btCollisionWorld *collisionWorld);
 
     void updateTargetPositionBasedOnCollision(const btVector3 &hit_normal, btScalar closestHitFraction);
@@ -147,6 +185,11 @@ protected:
     btQuaternion getRotation(btVector3 &v0, btVector3 &v1) const;
 
 protected:
+    /**
+     * Removes the layout group from the sweep filter mask if the swept volume is free of layout geometry.
+     */
+    void excludeFreeLayout(int &collisionFilterMask, const btTransform &start, const btTransform &end) const;
+
     btScalar m_halfHeight;
 
     btPairCachingGhostObject *m_ghostObject;
@@ -182,6 +225,7 @@ protected:
 
     //some internal variables
     btVector3 m_currentPosition;
+    btVector3 m_previousPosition;
     btScalar m_currentStepOffset;
     btVector3 m_targetPosition;
 
@@ -203,6 +247,13 @@ protected:
     btVector3 m_jumpAxis;
 
     bool m_interpolateUp;
+
+    const LayoutCollisionQuery *m_layoutQuery = nullptr;
+
+    // the last step left a grounded, idle agent where it was, with these contacts (see playerStep())
+    bool m_resting = false;
+    btVector3 m_restingPosition;
+    uint64_t m_restingContacts = 0;
 };
 
 }
\ No newline at end of file
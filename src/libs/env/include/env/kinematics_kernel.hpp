@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#ifdef __CUDACC__
+    #define MEGAVERSE_HOST_DEVICE __host__ __device__
+#else
+    #define MEGAVERSE_HOST_DEVICE
+#endif
+
+
+/**
+ * Movement of VoxelKinematicAgent as a plain function over POD state, shared by the CPU loop and the CUDA kernel of
+ * BatchedKinematics. No Magnum or Bullet here, this header is compiled by nvcc.
+ */
+
+namespace Megaverse
+{
+
+enum KinematicEvent : uint8_t
+{
+    KINEMATIC_LANDED = 0b1,
+    KINEMATIC_HIT_WALL = 0b10,
+    KINEMATIC_HIT_CEILING = 0b100,
+    // started the step inside a solid voxel
+    KINEMATIC_STUCK = 0b1000,
+};
+
+/// Same axes as AgentControls.
+struct KinematicControls
+{
+    float forward = 0, strafeLeft = 0, yaw = 0, pitch = 0;
+    uint8_t jump = 0;
+};
+
+/// The position is the center of the agent's box, like the collision object of VoxelKinematicAgent.
+struct KinematicAgentState
+{
+    float position[3];
+    float horizontalVelocity[2];  // x, z
+    float verticalVelocity;
+    float yaw, pitch;
+    uint8_t grounded;
+};
+
+/**
+ * Box of the dense copy of the solid voxels of one env, one byte per voxel at ((y * sizeZ) + z) * sizeX + x.
+ * Everything outside of the box is free.
+ */
+struct KinematicGrid
+{
+    int size[3];
+    float origin[3];
+    float voxelSize;
+};
+
+/// Same tuning as VoxelKinematicAgent (and KinematicCharacterController).
+struct KinematicParams
+{
+    float gravity = 1.4f * 9.8f, fallSpeed = 55.0f, jumpSpeed = 6.2f;
+    float maxHorizontalSpeed = 4.5f, maxAirSpeed = 1.0f, normalDeceleration = 15.0f;
+    float maxAcceleration = 35.0f + 15.0f, maxAirAcceleration = 3.0f;
+    float exceedingSpeedLimitDeceleration = (35.0f + 15.0f) * 2;
+    float rotateRadians = 3.5f, rotateXRadians = 1.5f;
+    float verticalLookLimitRad = 0.2f;  // default of Str::verticalLookLimitRad
+    float halfExtents[3] = {0.33f, 0.855f, 0.33f};
+
+    // camera above the center of the box, see VoxelKinematicAgent::applyWorldTransform() and setupCamera()
+    float cameraHeight = 0.05f + 0.41f;
+};
+
+
+MEGAVERSE_HOST_DEVICE inline bool kinematicCollides(const KinematicGrid &grid, const uint8_t *voxels, const KinematicParams &p, const float *position)
+{
+    int lo[3], hi[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        // touching counts, like the AABB test of the CPU agent
+        lo[axis] = int(floorf((position[axis] - p.halfExtents[axis] - grid.origin[axis]) / grid.voxelSize));
+        hi[axis] = int(floorf((position[axis] + p.halfExtents[axis] - grid.origin[axis]) / grid.voxelSize));
+        lo[axis] = lo[axis] < 0 ? 0 : lo[axis];
+        hi[axis] = hi[axis] >= grid.size[axis] ? grid.size[axis] - 1 : hi[axis];
+        if (lo[axis] > hi[axis])
+            return false;
+    }
+
+    for (int y = lo[1]; y <= hi[1]; ++y)
+        for (int z = lo[2]; z <= hi[2]; ++z)
+            for (int x = lo[0]; x <= hi[0]; ++x)
+                if (voxels[(int64_t(y) * grid.size[2] + z) * grid.size[0] + x])
+                    return true;
+
+    return false;
+}
+
+/// See VoxelKinematicAgent::moveAxis(), false if the agent hit something.
+MEGAVERSE_HOST_DEVICE inline bool kinematicMoveAxis(
+    const KinematicGrid &grid, const uint8_t *voxels, const KinematicParams &p, float *position, int axis, float delta
+)
+{
+    if (delta == 0)
+        return true;
+
+    float target[3] = {position[0], position[1], position[2]};
+    target[axis] += delta;
+    if (!kinematicCollides(grid, voxels, p, target)) {
+        position[axis] = target[axis];
+        return true;
+    }
+
+    float freeFraction = 0, blockedFraction = 1;
+    for (int i = 0; i < 6; ++i) {
+        const auto fraction = (freeFraction + blockedFraction) / 2;
+        target[axis] = position[axis] + delta * fraction;
+        if (kinematicCollides(grid, voxels, p, target))
+            blockedFraction = fraction;
+        else
+            freeFraction = fraction;
+    }
+
+    position[axis] += delta * freeFraction;
+    return false;
+}
+
+/// VoxelKinematicAgent::applyControls() followed by numSubsteps calls of prepareAction()/commitAction().
+MEGAVERSE_HOST_DEVICE inline uint8_t integrateKinematicAgent(
+    const KinematicGrid &grid, const uint8_t *voxels, const KinematicParams &p, const KinematicControls &c,
+    KinematicAgentState &s, float dt, int numSubsteps
+)
+{
+    uint8_t events = 0;
+
+    // controls
+    s.yaw += c.yaw * p.rotateRadians * dt;
+    if (c.pitch > 0)
+        s.pitch = fminf(p.verticalLookLimitRad, s.pitch + p.rotateXRadians * dt);
+    else if (c.pitch < 0)
+        s.pitch = fmaxf(-p.verticalLookLimitRad, s.pitch - p.rotateXRadians * dt * 1.1f);
+
+    const float sinYaw = sinf(s.yaw), cosYaw = cosf(s.yaw);
+    float acc[2] = {-c.forward * sinYaw - c.strafeLeft * cosYaw, -c.forward * cosYaw + c.strafeLeft * sinYaw};
+    const float accLength = sqrtf(acc[0] * acc[0] + acc[1] * acc[1]);
+    if (accLength > 1e-6f) {
+        const auto scale = (s.grounded ? p.maxAcceleration : p.maxAirAcceleration) / accLength;
+        acc[0] *= scale, acc[1] *= scale;
+    }
+
+    auto &v = s.horizontalVelocity;
+    if (s.grounded) {
+        v[0] += acc[0] * dt, v[1] += acc[1] * dt;
+        const auto speed = sqrtf(v[0] * v[0] + v[1] * v[1]);
+        if (speed > p.maxHorizontalSpeed) {
+            const auto scale = fmaxf(speed - p.exceedingSpeedLimitDeceleration * dt, p.maxHorizontalSpeed) / speed;
+            v[0] *= scale, v[1] *= scale;
+        }
+    } else {
+        const float newV[2] = {v[0] + acc[0] * dt, v[1] + acc[1] * dt};
+        const auto newSpeed = sqrtf(newV[0] * newV[0] + newV[1] * newV[1]);
+        if (newSpeed <= p.maxAirSpeed || newSpeed < sqrtf(v[0] * v[0] + v[1] * v[1]))
+            v[0] = newV[0], v[1] = newV[1];
+    }
+
+    if (c.jump && s.grounded) {
+        s.verticalVelocity = p.jumpSpeed;
+        s.grounded = 0;
+    }
+
+    // substeps
+    const auto h = dt / float(numSubsteps);
+    for (int substep = 0; substep < numSubsteps; ++substep) {
+        const float previous[3] = {s.position[0], s.position[1], s.position[2]};
+        const bool wasGrounded = s.grounded;
+
+        s.verticalVelocity = fminf(fmaxf(s.verticalVelocity - p.gravity * h, -p.fallSpeed), p.jumpSpeed);
+
+        if (kinematicCollides(grid, voxels, p, s.position)) {
+            s.position[0] += v[0] * h, s.position[1] += s.verticalVelocity * h, s.position[2] += v[1] * h;
+            s.grounded = 0;
+            events |= KINEMATIC_STUCK;
+        } else {
+            if (!kinematicMoveAxis(grid, voxels, p, s.position, 0, v[0] * h))
+                events |= KINEMATIC_HIT_WALL;
+            if (!kinematicMoveAxis(grid, voxels, p, s.position, 2, v[1] * h))
+                events |= KINEMATIC_HIT_WALL;
+
+            if (!kinematicMoveAxis(grid, voxels, p, s.position, 1, s.verticalVelocity * h)) {
+                s.grounded = s.verticalVelocity <= 0;
+                events |= s.grounded ? (wasGrounded ? 0 : KINEMATIC_LANDED) : KINEMATIC_HIT_CEILING;
+                s.verticalVelocity = 0;
+            } else {
+                s.grounded = 0;
+            }
+        }
+
+        v[0] = (s.position[0] - previous[0]) / h, v[1] = (s.position[2] - previous[2]) / h;
+
+        if (s.grounded) {
+            const auto speed = sqrtf(v[0] * v[0] + v[1] * v[1]);
+            if (speed - p.normalDeceleration * h < 0)
+                v[0] = v[1] = 0;
+            else
+                v[0] *= (speed - p.normalDeceleration * h) / speed, v[1] *= (speed - p.normalDeceleration * h) / speed;
+        }
+    }
+
+    return events;
+}
+
+/**
+ * Column-major view matrix of the agent's camera, the inverse of translation * rotationY(yaw) * rotationX(pitch),
+ * same as Camera3D::cameraMatrix() of VoxelKinematicAgent.
+ */
+MEGAVERSE_HOST_DEVICE inline void kinematicCameraView(const KinematicParams &p, const KinematicAgentState &s, float *view)
+{
+    const float sy = sinf(s.yaw), cy = cosf(s.yaw), sx = sinf(s.pitch), cx = cosf(s.pitch);
+    const float r[3][3] = {{cy, sy * sx, sy * cx}, {0, cx, -sx}, {-sy, cy * sx, cy * cx}};
+    const float t[3] = {s.position[0], s.position[1] + p.cameraHeight, s.position[2]};
+
+    for (int col = 0; col < 3; ++col) {
+        for (int row = 0; row < 3; ++row)
+            view[col * 4 + row] = r[col][row];
+        view[col * 4 + 3] = 0;
+    }
+
+    for (int row = 0; row < 3; ++row)
+        view[12 + row] = -(r[0][row] * t[0] + r[1][row] * t[1] + r[2][row] * t[2]);
+    view[15] = 1;
+}
+
+}
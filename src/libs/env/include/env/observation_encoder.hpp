@@ -0,0 +1,58 @@
+#pragma once
+
+#include <util/frame_codec.hpp>
+
+#include <env/env_renderer.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Optional VectorEnv stage after draw(): the observation of every agent is encoded with its own FrameEncoder on the
+ * simulation threads, for actors that receive the observations over the network (decode with FrameDecoder).
+ * Each agent has a fixed-size slot of maxEncodedBytes() in one contiguous buffer (indexed like the other per-agent
+ * buffers of VectorEnv), so the batch can be sent or exposed to Python without gathering the streams first.
+ */
+class ObservationEncoder
+{
+public:
+    /**
+     * @param frameBytes size of one color observation, see ObservationOptions::bytesPerFrame()
+     */
+    ObservationEncoder(const Envs &envs, size_t frameBytes, int keyframeInterval = 64);
+
+    /**
+     * Called by VectorEnv for one env at a time, envs can be encoded concurrently.
+     * @param keyframe i.e. the env just started a new episode
+     */
+    void encodeEnv(int envIdx, const EnvRenderer &renderer, bool keyframe);
+
+    /// Next frame of every agent is a key frame, i.e. after VectorEnv::reset().
+    void requestKeyframes();
+
+    size_t getFrameBytes() const { return frameBytes; }
+
+    size_t getSlotBytes() const { return slotBytes; }
+
+    /// Encoded frame of agent #i starts at i * getSlotBytes().
+    const uint8_t * getData() const { return data.data(); }
+
+    const std::vector<uint32_t> & getEncodedSizes() const { return encodedSizes; }
+
+    size_t totalEncodedBytes() const;
+
+private:
+    size_t frameBytes, slotBytes;
+
+    std::vector<int> agentOffsets;
+    std::vector<FrameEncoder> encoders;
+
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> encodedSizes;
+
+    // per agent, so envs on different threads never share one
+    std::vector<std::vector<uint8_t>> scratch;
+};
+
+}
@@ -1,14 +1,18 @@
 #pragma once
 
+#include <mutex>
+
 #include <btBulletDynamicsCommon.h>
 
 #include <Corrade/Containers/Pointer.h>
 
+#include <Magnum/Math/Range.h>
 #include <Magnum/BulletIntegration/Integration.h>
 #include <Magnum/BulletIntegration/MotionState.h>
 #include <Magnum/SceneGraph/TranslationRotationScalingTransformation3D.h>
 
 #include <util/magnum.hpp>
+#include <util/memory_report.hpp>
 
 #include <util/tiny_logger.hpp>
 
@@ -16,11 +20,192 @@
 namespace Megaverse
 {
 
-class RigidBody : public Object3D
+/**
+ * Collision filter groups of the env objects. Bullet only makes a broadphase pair if the group of each object is in
+ * the mask of the other, so pairs that never matter are pruned before the narrowphase and the agent ghost objects.
+ * Static objects (StaticFilter: platforms, walls, static boxes), static layout boxes (the geometry that mirrors solid
+ * voxels in the voxel grid) and movable boxes (picked up and placed by agents, static while placed) never pair with
+ * each other. Agents pair with everything. Objects with collisions turned off (i.e. carried boxes, see
+ * RigidBody::setColliding()) are in no group and have an empty mask, so they are invisible to pairs and queries.
+ */
+constexpr int layoutCollisionGroup = 1 << 6;  // first group not used by Bullet
+constexpr int movableCollisionGroup = 1 << 7;
+constexpr int agentCollisionGroup = btBroadphaseProxy::CharacterFilter | btBroadphaseProxy::DefaultFilter;
+
+constexpr int staticCollisionMask = btBroadphaseProxy::AllFilter ^ (btBroadphaseProxy::StaticFilter | layoutCollisionGroup | movableCollisionGroup);
+constexpr int layoutCollisionMask = staticCollisionMask;
+constexpr int movableCollisionMask = staticCollisionMask;
+constexpr int agentCollisionMask =
+    btBroadphaseProxy::StaticFilter | btBroadphaseProxy::CharacterFilter | btBroadphaseProxy::DefaultFilter | layoutCollisionGroup | movableCollisionGroup;
+
+/**
+ * Fast path for character collision queries. Answers whether any static layout geometry intersects a world-space
+ * AABB, i.e. by looking up the voxel grid. Returning true is always safe, false must guarantee free space.
+ */
+class LayoutCollisionQuery
+{
+public:
+    virtual ~LayoutCollisionQuery() = default;
+
+    virtual bool layoutInAabb(const btVector3 &aabbMin, const btVector3 &aabbMax) const = 0;
+};
+
+/**
+ * Action (character controller) that can compute its move concurrently with the other ones in the world, see
+ * Env::setPhysicsWorkers(). prepareAction() only queries the world, so all actions see the state at the start of
+ * the substep, commitAction() then moves the collision object. Sequentially this is the same as updateAction().
+ */
+class ParallelAction
 {
 public:
-    RigidBody(Object3D *parent, Magnum::Float mass, btCollisionShape *bShape, btDynamicsWorld &bWorld)
-        : Object3D{parent}, bWorld{bWorld}
+    virtual ~ParallelAction() = default;
+
+    virtual void prepareAction(btCollisionWorld &world, btScalar dt) = 0;
+
+    virtual void commitAction(btCollisionWorld &world) = 0;
+};
+
+enum class BroadphaseType
+{
+    DynamicTree,
+    AxisSweep,
+};
+
+/**
+ * Broadphase of the Bullet world of an env.
+ * DynamicTree (btDbvtBroadphase) needs no configuration and takes any number of objects, but rebalances its trees as
+ * objects move. AxisSweep (btAxisSweep3) keeps the sorted AABB bounds of all objects along each axis, so an update is
+ * proportional to how far the few moving objects (agents, movable boxes) travel among the static ones. It needs the
+ * world bounds (objects outside are clamped to them and still collide correctly) and preallocates maxObjects handles.
+ */
+struct BroadphaseOptions
+{
+    BroadphaseType type = BroadphaseType::DynamicTree;
+    Magnum::Range3D bounds{Magnum::Vector3{-1000.0f}, Magnum::Vector3{1000.0f}};
+    int maxObjects = 16384;
+
+    bool operator==(const BroadphaseOptions &other) const
+    {
+        return type == other.type && (type == BroadphaseType::DynamicTree || (bounds == other.bounds && maxObjects == other.maxObjects));
+    }
+
+    bool operator!=(const BroadphaseOptions &other) const { return !(*this == other); }
+};
+
+std::unique_ptr<btBroadphaseInterface> createBroadphase(const BroadphaseOptions &options);
+
+/**
+ * Counts the memory that Bullet allocates through btAlignedAlloc (nearly everything, including the objects with
+ * BT_DECLARE_ALIGNED_ALLOCATOR), process-wide. Hooks are installed by the first EnvPhysics and stay for the rest of
+ * the process, allocations made before that are not counted.
+ */
+class BulletMemory
+{
+public:
+    static void installHooks();
+
+    static MemoryCounter & counter();
+};
+
+/**
+ * Recycles memory of btRigidBody objects between episodes, so that resets (which create thousands of static
+ * layout boxes) mostly don't touch the allocator. The pool is thread-local, no synchronization needed.
+ */
+class RigidBodyPool
+{
+public:
+    static btRigidBody * acquire(const btRigidBody::btRigidBodyConstructionInfo &info);
+    static void release(btRigidBody *body);
+
+    // max number of free bodies kept per thread
+    static constexpr size_t maxPoolSize = 1 << 14;
+};
+
+/**
+ * Process-wide cache of immutable box shapes, shared by all envs.
+ * Instead of allocating a unit btBoxShape for every object and rescaling it in place, bodies that use unitBox()
+ * switch to a shared pre-scaled shape from this cache in RigidBody::syncPose().
+ * Shared shapes must never be modified, and they live until the end of the process.
+ */
+class CollisionShapeCache
+{
+public:
+    /**
+     * Shared unit box (half extents 1). Pass this to the RigidBody ctor instead of a private btBoxShape.
+     */
+    static btCollisionShape * unitBox();
+
+    /**
+     * @return shared box shape equivalent to a unit box with the given local scaling.
+     */
+    static btCollisionShape * box(const btVector3 &scaling);
+
+    static bool isShared(const btCollisionShape *shape) { return shape->getUserIndex() == sharedShapeUserIndex; }
+
+    /**
+     * @return total number of distinct shapes allocated in the process.
+     */
+    static size_t numShapes();
+
+private:
+    // used to tag the shared shapes, so we know not to call setLocalScaling on them
+    static constexpr int sharedShapeUserIndex = 0x5ba4ed;
+};
+
+/**
+ * Parts of a Bullet world that can serve several worlds: the collision configuration (pools of contact manifolds and
+ * collision algorithms, which are most of the fixed memory of a world) and the scratch arrays of the constraint
+ * solver. Envs that share one instance only pay for these once, see Env::setPhysicsResources().
+ * None of it is thread-safe, so envs hold lock() while they step, reset or are destroyed. Uncontended if the envs
+ * of a group are stepped by the same thread, i.e. contiguous envs with the static scheduler.
+ */
+class PhysicsResources
+{
+public:
+    explicit PhysicsResources(bool shared = false) : shared{shared} {}
+
+    std::unique_lock<std::recursive_mutex> lock()
+    {
+        return shared ? std::unique_lock{mutex} : std::unique_lock<std::recursive_mutex>{};
+    }
+
+    bool isShared() const { return shared; }
+
+private:
+    // first member, so the allocations of the pools below are counted, see BulletMemory
+    struct MemoryHooks
+    {
+        MemoryHooks() { BulletMemory::installHooks(); }
+    } memoryHooks;
+
+public:
+    btSequentialImpulseConstraintSolver constraintSolver;
+    btDefaultCollisionConfiguration collisionConfiguration;
+
+private:
+    const bool shared;
+    std::recursive_mutex mutex;
+};
+
+struct PooledRigidBodyDeleter
+{
+    void operator()(btRigidBody *body) const { RigidBodyPool::release(body); }
+};
+
+/**
+ * Memory of the node itself is pooled too, on top of the btRigidBody pool.
+ */
+class RigidBody : public Object3D, public PooledAllocation<RigidBody>
+{
+public:
+    /**
+     * Default collision group and mask are the ones for static objects, see staticCollisionMask.
+     */
+    RigidBody(
+        Object3D *parent, Magnum::Float mass, btCollisionShape *bShape, btDynamicsWorld &bWorld,
+        int collisionGroup = btBroadphaseProxy::StaticFilter, int collisionMask = staticCollisionMask
+    )
+        : Object3D{parent}, bWorld{bWorld}, collisionGroup{collisionGroup}, collisionMask{collisionMask}
     {
         // calculate inertia so the object reacts as it should with rotation and everything
         btVector3 bInertia(0.0f, 0.0f, 0.0f);
@@ -29,12 +214,12 @@ public:
 
         // bullet rigid body setup
         motionState = std::make_unique<Magnum::BulletIntegration::MotionState>(*this);
-        bRigidBody = std::make_unique<btRigidBody>(btRigidBody::btRigidBodyConstructionInfo{mass, &motionState->btMotionState(), bShape, bInertia});
+        bRigidBody.reset(RigidBodyPool::acquire(btRigidBody::btRigidBodyConstructionInfo{mass, &motionState->btMotionState(), bShape, bInertia}));
 
         bRigidBody->setCollisionFlags(btCollisionObject::CF_STATIC_OBJECT);
 
         // bRigidBody->forceActivationState(DISABLE_DEACTIVATION);  // do we need this?
-        bWorld.addRigidBody(bRigidBody.get());
+        bWorld.addRigidBody(bRigidBody.get(), collisionGroup, collisionMask);
     }
 
     ~RigidBody() override
@@ -70,23 +255,36 @@ public:
     {
         const auto &m = absoluteTransformationMatrix();
         bRigidBody->setWorldTransform(btTransform{btMatrix3x3{m.rotation()}, btVector3{m.translation() + collisionOffset}});
-        bRigidBody->getCollisionShape()->setLocalScaling(btVector3{m.scaling() * collisionScale});
+
+        const auto scaling = btVector3{m.scaling() * collisionScale};
+        if (CollisionShapeCache::isShared(bRigidBody->getCollisionShape()))
+            bRigidBody->setCollisionShape(CollisionShapeCache::box(scaling));
+        else
+            bRigidBody->getCollisionShape()->setLocalScaling(scaling);
     }
 
-    void toggleCollision()
+    void toggleCollision() { setColliding(!colliding()); }
+
+    /**
+     * Without collisions the body also leaves its collision groups, so it stops making broadphase pairs (and is skipped
+     * by ray and sweep queries) instead of being paired and then ignored for having no contact response.
+     * The proxy is re-created in place, the order of the collision objects in the world does not change.
+     */
+    void setColliding(bool enabled)
     {
         const auto flags = bRigidBody->getCollisionFlags();
-        if (flags & btCollisionObject::CF_NO_CONTACT_RESPONSE) {
-            // no collisions for this object, enabling collisions...
-            bRigidBody->setCollisionFlags(flags & ~btCollisionObject::CF_NO_CONTACT_RESPONSE);
-        } else {
-            bRigidBody->setCollisionFlags(flags | btCollisionObject::CF_NO_CONTACT_RESPONSE);
-        }
+        bRigidBody->setCollisionFlags(enabled ? flags & ~btCollisionObject::CF_NO_CONTACT_RESPONSE : flags | btCollisionObject::CF_NO_CONTACT_RESPONSE);
+
+        auto *proxy = bRigidBody->getBroadphaseHandle();
+        proxy->m_collisionFilterGroup = enabled ? collisionGroup : 0;
+        proxy->m_collisionFilterMask = enabled ? collisionMask : 0;
+        bWorld.refreshBroadphaseProxy(bRigidBody.get());
     }
 
 private:
     btDynamicsWorld &bWorld;
-    std::unique_ptr<btRigidBody> bRigidBody;
+    const int collisionGroup, collisionMask;
+    std::unique_ptr<btRigidBody, PooledRigidBodyDeleter> bRigidBody;
     std::unique_ptr<Magnum::BulletIntegration::MotionState> motionState;
     Magnum::Vector3 collisionScale{1, 1, 1};
     Magnum::Vector3 collisionOffset;
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+
+#include <env/env.hpp>
+
+
+namespace Megaverse
+{
+
+enum RayHitType
+{
+    RAY_HIT_NONE = 0,
+    RAY_HIT_LAYOUT = 1,
+    RAY_HIT_OBJECT = 2,
+    RAY_HIT_AGENT = 3,
+};
+
+struct RaySensorOptions
+{
+    // horizontal fan centered on the heading of the agent, from the position of its camera, left to right
+    int numRays = 16;
+    float fovDegrees = 180.0f;
+
+    // one fan per pitch, i.e. {0, -30} adds a second fan looking down
+    std::vector<float> pitchDegrees{0.0f};
+
+    float maxDistance = 20.0f;
+
+    int raysPerAgent() const { return numRays * int(pitchDegrees.size()); }
+};
+
+/**
+ * Optional VectorEnv stage: low-dimensional sensors for every agent, computed on the simulation threads right after
+ * the env is stepped or reset. Each ray reports the distance to the first hit divided by maxDistance (1 if nothing
+ * was hit) and a RayHitType, as two floats.
+ * Rays of an agent are batched: one broadphase query with the AABB of the whole fan collects the candidate
+ * collision objects, and each ray is only tested against those (btCollisionWorld::rayTestSingle()), instead of
+ * traversing the broadphase once per ray. The static layout is traced in the voxel grid of the scenario if it has
+ * one (see Scenario::layoutVoxelQuery()), then layout bodies are excluded from the candidates.
+ * Values are in one contiguous buffer indexed like the other per-agent buffers of VectorEnv.
+ */
+class RaySensors
+{
+public:
+    static constexpr int valuesPerRay = 2;
+
+public:
+    explicit RaySensors(const Envs &envs, const RaySensorOptions &options = {});
+
+    /// Called by VectorEnv for one env at a time, envs can be sensed concurrently.
+    void senseEnv(int envIdx, Env &env);
+
+    const RaySensorOptions & getOptions() const { return options; }
+
+    size_t valuesPerAgent() const { return size_t(options.raysPerAgent()) * valuesPerRay; }
+
+    /// Values of agent #i start at i * valuesPerAgent().
+    const float * getData() const { return data.data(); }
+
+    size_t memoryBytes() const;
+
+private:
+    void senseAgent(Env &env, int agentIdx, std::vector<const btCollisionObject *> &candidates, float *out) const;
+
+private:
+    RaySensorOptions options;
+
+    std::vector<int> agentOffsets;
+    std::vector<float> data;
+
+    // per env, so envs on different threads never share one
+    std::vector<std::vector<const btCollisionObject *>> candidates;
+};
+
+}
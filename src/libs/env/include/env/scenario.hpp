@@ -1,14 +1,20 @@
 #pragma once
 
 #include <map>
+#include <cmath>
+#include <limits>
 #include <memory>
 #include <string>
+#include <functional>
+#include <algorithm>
 
+#include <util/voxel_grid.hpp>
 #include <util/tiny_logger.hpp>
 #include <util/string_utils.hpp>
 
 #include <env/env.hpp>
 #include <env/const.hpp>
+#include <env/batched_components.hpp>
 
 
 namespace Megaverse
@@ -16,6 +22,44 @@ namespace Megaverse
 
 class ScenarioComponent;
 
+/**
+ * Contents of one voxel as seen by the symbolic observations, independent of the voxel type of the scenario.
+ */
+struct SymbolicVoxel
+{
+    uint8_t voxelType = 0, terrain = 0;
+    ColorRgb color = ColorRgb::LAYOUT_DEFAULT;
+
+    // voxel holds a movable object, i.e. a box that can be picked up
+    bool object = false;
+};
+
+/**
+ * Read-only access to the voxel grid of the scenario, for renderers that work with the voxels instead of the
+ * drawables (see SymbolicEnvRenderer and RaycastEnvRenderer).
+ */
+class LayoutVoxelQuery
+{
+public:
+    using VoxelFunc = std::function<void(const VoxelCoords &, const SymbolicVoxel &)>;
+
+public:
+    virtual ~LayoutVoxelQuery() = default;
+
+    virtual VoxelCoords voxelCoords(const Magnum::Vector3 &position) const = 0;
+
+    /// World position of the corner of voxel {0, 0, 0}.
+    virtual Magnum::Vector3 gridOrigin() const = 0;
+
+    virtual float voxelSize() const = 0;
+
+    /// @return false if there is no voxel at these coords
+    virtual bool voxel(const VoxelCoords &coords, SymbolicVoxel &v) const = 0;
+
+    /// Every voxel of the grid, order is not specified.
+    virtual void forEachVoxel(const VoxelFunc &func) const = 0;
+};
+
 class Scenario
 {
     friend class ScenarioComponent;
@@ -23,7 +67,14 @@ class Scenario
 public:
     using ScenarioPtr = std::unique_ptr<Scenario>;
     using FactoryFunc = ScenarioPtr (*)(const std::string &, Env &, Env::EnvState &);
-    using ScenarioRegistry = std::map<std::string, FactoryFunc>;
+
+    struct Registration
+    {
+        FactoryFunc factoryFunc = nullptr;
+        Env::StepFunc stepFunc = nullptr;
+    };
+
+    using ScenarioRegistry = std::map<std::string, Registration>;
 
 public:
     explicit Scenario(std::string scenarioName, Env &env, Env::EnvState &envState)
@@ -40,11 +91,15 @@ public:
  * Scenario registry and factory methods for instantiating custom scenarios.
  */
 public:
-    static void registerScenario(const std::string &scenarioName, FactoryFunc factoryFunc)
+    /**
+     * @param stepFunc Env::step() loop instantiated for the type created by factoryFunc (see env/env_step.hpp),
+     * nullptr to step the scenario through virtual calls.
+     */
+    static void registerScenario(const std::string &scenarioName, FactoryFunc factoryFunc, Env::StepFunc stepFunc = nullptr)
     {
         auto &scenarioRegistry = getScenarioRegistry();
         const auto scenarioNameLowercase = toLower(scenarioName);
-        scenarioRegistry[scenarioNameLowercase] = factoryFunc;
+        scenarioRegistry[scenarioNameLowercase] = {factoryFunc, stepFunc};
         TLOG(INFO) << "Scenario " << scenarioNameLowercase << " registered! " << scenarioRegistry.size() << " scenarios.";
     }
 
@@ -71,11 +126,18 @@ public:
         if (!scenarioRegistry.count(scenarioNameLowercase))
             TLOG(FATAL) << "Unknown scenario " << scenarioNameLowercase << ". Did you register the scenario in scenariosGlobalInit()?";
 
-        const auto factoryFunc = scenarioRegistry.at(scenarioNameLowercase);
+        const auto factoryFunc = scenarioRegistry.at(scenarioNameLowercase).factoryFunc;
 
         return factoryFunc(scenarioNameLowercase, env, envState);
     }
 
+    static Env::StepFunc registeredStepFunc(const std::string &scenarioName)
+    {
+        const auto &scenarioRegistry = getScenarioRegistry();
+        const auto it = scenarioRegistry.find(toLower(scenarioName));
+        return it == scenarioRegistry.end() ? nullptr : it->second.stepFunc;
+    }
+
     template<typename ScenarioType>
     static std::unique_ptr<Scenario> scenarioFactory(const std::string &scenarioName, Env &env, Env::EnvState &envState)
     {
@@ -100,6 +162,9 @@ public:
 
         // initialize default reward shaping specific for this scenario
         initRewardShaping();
+
+        resolveParameters();
+        resolveRewardShaping();
     }
 
     /**
@@ -116,6 +181,11 @@ public:
         envState.currEpisodeSec = std::max(envState.currEpisodeSec, episodeLengthSec() - remainingTimeSeconds);
     }
 
+    /**
+     * The agent finished its part of the episode, the others keep going, see Env::isAgentDone().
+     */
+    void setAgentDone(int agentIdx) { envState.agentDone[agentIdx] = 1; }
+
     /**
      * This is called by the environment before the physics simulation step.
      */
@@ -127,11 +197,6 @@ public:
      */
     virtual void step() {}
 
-    /**
-     * Called after every step() by the environment, use to adjust health bars, etc.
-     */
-    virtual void updateUI() {}
-
     /**
      * @return vector with starting positions of the agents.
      */
@@ -153,9 +218,65 @@ public:
     virtual void addEpisodeAgentsDrawables(DrawablesMap &) {}
 
     /**
-     * We display a rudimentary HUD just by drawing a bunch of geometric primitives very close to the camera.
+     * Rudimentary HUD (timer, reward indicators) as a few screen-space quads, queried by the renderers before every
+     * frame. Derived from the current state of the env only, so it needs no scene graph objects or snapshot data.
+     */
+    virtual void hud(int /*agentIdx*/, std::vector<HudQuad> &) const {}
+
+    /**
+     * @return voxel-based query for the static layout (if the scenario has one) to speed up agent collision checks.
+     */
+    virtual const LayoutCollisionQuery * layoutCollisionQuery() const { return nullptr; }
+
+    /**
+     * @return voxel grid of the scenario for the renderers that trace the voxels directly, nullptr if there is none.
+     * Opaque voxels of the grid must match the drawables marked as layout (see SceneObjectInfo).
+     */
+    virtual const LayoutVoxelQuery * layoutVoxelQuery() const { return nullptr; }
+
+    /**
+     * Components that can be updated for many envs at once by a BatchedComponentsPass. They skip their per-env
+     * update while Env::setBatchedComponents() is on. Must stay the same for the lifetime of the scenario.
+     */
+    virtual BatchedComponents batchedComponents() { return {}; }
+
+    /**
+     * Scenario part of Env::memoryReport(), i.e. the voxel grid. Keys are relative, the env adds its own prefix.
+     */
+    virtual void memoryReport(MemoryReport &) const {}
+
+    /**
+     * Scenario part of Env::saveState(): counters, voxel grid contents, etc. Transforms of the scene graph objects,
+     * Bullet collision objects and agents are saved by the env.
+     * Scenarios that change the scene graph topology during the episode (i.e. picking up objects) can't be restored
+     * this way.
+     * @return false if the scenario does not support snapshots (default)
      */
-    virtual void addUIDrawables(DrawablesMap &) {}
+    virtual bool saveState(StateBuffer &) const { return false; }
+
+    /**
+     * Called after the env restored the transforms and the bodies. Must read exactly what saveState() wrote.
+     */
+    virtual void restoreState(StateReader &) {}
+
+    /**
+     * Scenarios with a process-wide layout cache can have the layouts of upcoming episodes generated ahead of time
+     * by a scratch env (see EpisodePregenerator), reset() then only restores them.
+     * @param numLayouts the cache keeps at least that many layouts, regardless of the parameters
+     * @return false if the scenario does not cache layouts (default)
+     */
+    virtual bool reserveLayoutCache(size_t /*numLayouts*/) { return false; }
+
+    /// Layout with this seed can be restored from the cache by the next reset(), see reserveLayoutCache().
+    virtual bool isLayoutCached(int /*layoutSeed*/) const { return false; }
+
+    /**
+     * Layout of the current episode (right after reset()) for an EpisodeDataset: everything reset() generates,
+     * including the RNG state after the generation. reset() instantiates it instead of generating when
+     * EnvState::bakedLayout is set, and falls back to the generation if the entry can't be read.
+     * @return false if the scenario does not support episode datasets (default)
+     */
+    virtual bool bakeLayout(StateBuffer &) const { return false; }
 
     /**
      * @return a set of colors used by the renderer in this scenario.
@@ -171,10 +292,32 @@ public:
     /**
      * @return episode duration in seconds, this can be overridden
      */
-    virtual float episodeLengthSec() const
+    virtual float episodeLengthSec() const { return resolvedParams.episodeLengthSec; }
+
+    /**
+     * Physics timestep set through FloatParams, 0 if the physics should follow the env steps.
+     */
+    float physicsStepSec() const { return resolvedParams.physicsStepSec; }
+
+    /// 0 means as many substeps as needed to keep up with the env steps
+    int maxPhysicsSubSteps() const { return resolvedParams.maxPhysicsSubSteps; }
+
+    /**
+     * Broadphase of the physics world of the next episode, selected by the axisSweepBroadphase parameter.
+     * Sweep and prune covers the voxel grid of the layout (see layoutVoxelQuery()) with a margin for falling agents,
+     * scenarios with larger or smaller layouts can override this.
+     */
+    virtual BroadphaseOptions broadphaseOptions() const
     {
-        const auto episodeLengthSec = getFloatParams().at(Str::episodeLengthSec);
-        return episodeLengthSec;
+        BroadphaseOptions options;
+        const auto query = layoutVoxelQuery();
+        if (!resolvedParams.axisSweepBroadphase || !query)
+            return options;
+
+        const auto voxel = query->voxelSize();
+        options.type = BroadphaseType::AxisSweep;
+        options.bounds = {query->gridOrigin() + Magnum::Vector3{-64, -64, -64} * voxel, query->gridOrigin() + Magnum::Vector3{256, 128, 256} * voxel};
+        return options;
     }
 
     /**
@@ -206,13 +349,44 @@ public:
      * @param agentIdx
      * @return current reward shaping for the agent
      */
-    virtual RewardShaping & getRewardShaping(int agentIdx) { return rewardShaping[agentIdx]; }
+    virtual const RewardShaping & getRewardShaping(int agentIdx) const { return rewardShaping[agentIdx]; }
 
     /**
      * @param agentIdx
      * @param rs new reward shaping for the agent
      */
-    virtual void setRewardShaping(int agentIdx, const RewardShaping &rs) { rewardShaping[agentIdx] = rs; }
+    virtual void setRewardShaping(int agentIdx, const RewardShaping &rs)
+    {
+        rewardShaping[agentIdx] = rs;
+        resolveRewardShaping();
+    }
+
+    /**
+     * Indices of the given rewards in the resolved table for setRewardValues(), -1 for rewards no agent has.
+     */
+    void rewardSlots(const std::vector<std::string> &names, std::vector<int> &slots) const
+    {
+        slots.resize(names.size());
+        for (size_t i = 0; i < names.size(); ++i) {
+            const auto it = std::find(rewardNames.begin(), rewardNames.end(), names[i]);
+            slots[i] = it == rewardNames.end() ? -1 : int(it - rewardNames.begin());
+        }
+    }
+
+    /**
+     * Overwrite existing rewards of the agent in place, without rebuilding the reward table (batched updates,
+     * see VectorEnv::publishRewardShaping()). Negative slots and NaN values are skipped.
+     */
+    void setRewardValues(int agentIdx, const int *slots, const float *values, int numValues)
+    {
+        for (int i = 0; i < numValues; ++i) {
+            if (slots[i] < 0 || std::isnan(values[i]))
+                continue;
+
+            rewardValues[agentIdx][slots[i]] = values[i];
+            rewardShaping[agentIdx][rewardNames[slots[i]]] = values[i];
+        }
+    }
 
 /**
  * Other utility functions.
@@ -239,6 +413,8 @@ public:
     {
         for (const auto &[k, v] : customFloatParams)
             floatParams[k] = v;
+
+        resolveParameters();
     }
 
 protected:
@@ -247,16 +423,21 @@ protected:
      * Since different agents can be controlled by different policies, they can also have different reward shaping
      * associated with them (e.g. when we're doing PBT).
      * Therefore we need a separate rewardShaping dictionary for every agent.
+     * rewardName has to be a string with static storage (i.e. one of the Str:: constants), since it is cached by pointer.
      */
-    virtual float getReward(const std::string &rewardName, int agentIdx) const
+    virtual float getReward(const char *rewardName, int agentIdx) const
     {
-        return rewardShaping[agentIdx].at(rewardName);
+        const auto slot = rewardSlot(rewardName);
+        if (slot < 0 || std::isnan(rewardValues[agentIdx][slot]))
+            return rewardShaping[agentIdx].at(rewardName);  // unknown reward, throws
+
+        return rewardValues[agentIdx][slot];
     }
 
     /**
      * Reward agent individually, do not reward other agents even if teamSpirit > 0
      */
-    virtual void rewardAgent(const std::string &rewardName, int agentIdx, float multiplier)
+    virtual void rewardAgent(const char *rewardName, int agentIdx, float multiplier)
     {
         envState.lastReward[agentIdx] += getReward(rewardName, agentIdx) * multiplier;
     }
@@ -288,7 +469,7 @@ protected:
      * TeamSpirit is expected to be in [0, 1] range.
      * The agent whose action was rewarded gets the full reward. Other agents get teamSpirit * reward.
      */
-    virtual void rewardTeam(const std::string &rewardName, int agentIdx, float multiplier)
+    virtual void rewardTeam(const char *rewardName, int agentIdx, float multiplier)
     {
         const auto currTeam = teamAffinity(agentIdx);
         rewardAgent(rewardName, agentIdx, multiplier * (1 - teamSpirit(agentIdx)));
@@ -300,12 +481,66 @@ protected:
     /**
      * Reward all agents equally, regardless of team spirit.
      */
-    virtual void rewardAll(const std::string &rewardName, float multiplier)
+    virtual void rewardAll(const char *rewardName, float multiplier)
     {
         for (int i = 0; i < env.getNumAgents(); ++i)
             rewardAgent(rewardName, i, multiplier);
     }
 
+    /**
+     * Copy the base parameters out of floatParams, called whenever the params change.
+     */
+    void resolveParameters()
+    {
+        // not every scenario starts from the base defaults
+        const auto param = [this](const char *key, float defaultValue) {
+            const auto it = floatParams.find(key);
+            return it == floatParams.end() ? defaultValue : it->second;
+        };
+
+        resolvedParams.episodeLengthSec = param(Str::episodeLengthSec, 60.0f);
+        resolvedParams.useUIRewardIndicators = param(Str::useUIRewardIndicators, 0.0f) > 0;
+        resolvedParams.physicsStepSec = std::max(param(Str::physicsStepSec, 0.0f), 0.0f);
+        resolvedParams.maxPhysicsSubSteps = std::max(int(param(Str::maxPhysicsSubSteps, 0.0f)), 0);
+        resolvedParams.axisSweepBroadphase = param(Str::axisSweepBroadphase, 0.0f) > 0;
+    }
+
+    /**
+     * Reward values of all agents as [agent][slot] arrays, NaN where an agent's shaping has no such reward.
+     */
+    void resolveRewardShaping()
+    {
+        rewardNames.clear(), rewardSlotCache.clear();
+        for (const auto &rs : rewardShaping)
+            for (const auto &[rewardName, value] : rs)
+                if (std::find(rewardNames.begin(), rewardNames.end(), rewardName) == rewardNames.end())
+                    rewardNames.emplace_back(rewardName);
+
+        rewardValues.assign(rewardShaping.size(), std::vector<float>(rewardNames.size(), std::numeric_limits<float>::quiet_NaN()));
+        for (size_t i = 0; i < rewardShaping.size(); ++i)
+            for (size_t slot = 0; slot < rewardNames.size(); ++slot) {
+                auto it = rewardShaping[i].find(rewardNames[slot]);
+                if (it != rewardShaping[i].end())
+                    rewardValues[i][slot] = it->second;
+            }
+    }
+
+    /**
+     * Reward names are the Str:: constants, so after the first lookup of a name we find its slot by the pointer.
+     * @return index in rewardValues, -1 if no agent has this reward
+     */
+    int rewardSlot(const char *rewardName) const
+    {
+        for (const auto &[name, slot] : rewardSlotCache)
+            if (name == rewardName)
+                return slot;
+
+        const auto it = std::find(rewardNames.begin(), rewardNames.end(), rewardName);
+        const int slot = it == rewardNames.end() ? -1 : int(it - rewardNames.begin());
+        rewardSlotCache.emplace_back(rewardName, slot);
+        return slot;
+    }
+
 private:
     static ScenarioRegistry & getScenarioRegistry()
     {
@@ -330,6 +565,20 @@ protected:
 
     // reward shaping schemes for every agent in the env
     std::vector<RewardShaping> rewardShaping;
+
+    // the same resolved for the step path, see resolveParameters() and resolveRewardShaping()
+    struct ResolvedParams
+    {
+        float episodeLengthSec = 0.0f;
+        bool useUIRewardIndicators = false;
+        float physicsStepSec = 0.0f;
+        int maxPhysicsSubSteps = 0;
+        bool axisSweepBroadphase = false;
+    } resolvedParams;
+
+    std::vector<std::string> rewardNames;
+    std::vector<std::vector<float>> rewardValues;
+    mutable std::vector<std::pair<const char *, int>> rewardSlotCache;
 };
 
 }
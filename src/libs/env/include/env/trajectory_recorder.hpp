@@ -0,0 +1,159 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <condition_variable>
+
+#include <util/state_buffer.hpp>
+
+#include <env/env.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Scene graph objects of an env in depth-first order, the order in which the recorder numbers the poses.
+ * The scene of an episode regenerated with the same layout seed has the same objects in the same order.
+ */
+void sceneObjectsInOrder(Object3D &root, std::vector<Object3D *> &objects);
+
+/**
+ * Recording of the envs in a VectorEnv: the layout seed of every episode, and per step the actions, rewards, dones and
+ * transforms of the scene graph objects that changed since the previous step. Poses are enough to render the
+ * episodes again offline (layouts are regenerated from the seeds), at a fraction of the size of the frames.
+ *
+ * File layout: magic, version, size of the metadata block and the metadata (scenario, float params, agents per env),
+ * followed by chunks (uint32 raw size, uint32 compressed size, LZ4 block). A chunk holds whole frames, so the file
+ * stays readable up to the last complete chunk if the process dies.
+ */
+class TrajectoryRecorder
+{
+public:
+    static constexpr uint32_t magic = 0x5254474d;  // "MGTR"
+    static constexpr uint32_t version = 1;
+
+    enum RecordType : uint8_t
+    {
+        EPISODE = 1,
+        STEP = 2,
+
+        // end of one VectorEnv step, all records before it belong to the same frame
+        FRAME = 3,
+    };
+
+public:
+    explicit TrajectoryRecorder(const std::string &filename, const Envs &envs, size_t chunkBytes = 1 << 20);
+
+    /// Writes the last partial chunk.
+    ~TrajectoryRecorder();
+
+    bool isOpen() const { return file.is_open(); }
+
+    /**
+     * Per-env records can be written concurrently from the threads that step the envs, as long as each env is only
+     * touched by one thread at a time.
+     */
+    void recordEpisodeStart(int envIdx, Env &env);
+
+    void recordStep(int envIdx, Env &env, const Action *actions, const float *rewards, bool done);
+
+    /**
+     * Main thread, after all envs are stepped: moves the records of the frame into the current chunk, full chunks
+     * are compressed and written by the background thread.
+     */
+    void endFrame();
+
+    /// Hand over the current chunk even if it is not full yet.
+    void flush();
+
+private:
+    void writePoses(int envIdx, Env &env, bool fullPose);
+
+    void ioLoop();
+
+private:
+    struct EnvRecords
+    {
+        StateBuffer records;
+
+        std::vector<Object3D *> objects;
+        std::vector<Magnum::Matrix4> prevTransforms;
+    };
+
+    size_t chunkBytes;
+    std::vector<EnvRecords> envRecords;
+    StateBuffer chunk;
+
+    std::ofstream file;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> pendingChunks;
+    bool stop = false;
+
+    std::thread ioThread;
+};
+
+/**
+ * Sequential reader of the recordings, transforms are reconstructed into full matrices.
+ */
+class TrajectoryReader
+{
+public:
+    struct Metadata
+    {
+        std::string scenario;
+        FloatParams floatParams;
+        std::vector<int> numAgents;  // per env
+    };
+
+    struct Record
+    {
+        TrajectoryRecorder::RecordType type{};
+        int envIdx = 0;
+
+        // EPISODE
+        int layoutSeed = 0;
+
+        // STEP
+        std::vector<Action> actions;
+        std::vector<float> rewards;
+        bool done = false;
+
+        // EPISODE and STEP: (object index, new transform), for EPISODE this is the pose of every object
+        std::vector<std::pair<int, Magnum::Matrix4>> transforms;
+    };
+
+public:
+    explicit TrajectoryReader(const std::string &filename);
+
+    bool isOpen() const { return opened; }
+
+    const Metadata & getMetadata() const { return metadata; }
+
+    /**
+     * @return false at the end of the file or if the rest of the file is corrupted.
+     */
+    bool next(Record &record);
+
+private:
+    bool readChunk();
+
+private:
+    std::ifstream file;
+    bool opened = false;
+
+    Metadata metadata;
+
+    std::vector<uint8_t> compressed, chunk;
+    size_t chunkPos = 0;
+
+    // current pose of every object, per env
+    std::vector<std::vector<Magnum::Matrix4>> transforms;
+};
+
+}
@@ -1,11 +1,22 @@
 #pragma once
 
+#include <deque>
+#include <mutex>
 #include <atomic>
 #include <thread>
-#include <condition_variable>
+#include <functional>
+
+#include <util/barrier.hpp>
+#include <util/mpmc_queue.hpp>
+#include <util/triple_buffer.hpp>
 
 #include <env/env.hpp>
 #include <env/env_renderer.hpp>
+#include <env/batched_components.hpp>
+#include <env/trajectory_recorder.hpp>
+#include <env/observation_encoder.hpp>
+#include <env/episode_pregenerator.hpp>
+#include <env/ray_sensors.hpp>
 
 
 namespace Megaverse
@@ -19,27 +30,436 @@ public:
         IDLE,
         STEP,
         RESET,
+        ENCODE,
+        POOL,
+        FORK,
+        TERMINAL_RESET,
         TERMINATE,
     };
 
+    /**
+     * Static scheduler gives each thread a fixed contiguous block of envs.
+     * WorkStealing distributes envs over per-thread queues, and threads that finish early steal work from others,
+     * so one slow env (i.e. expensive reset) does not stall the entire block.
+     */
+    enum class Scheduler
+    {
+        Static,
+        WorkStealing,
+    };
+
 public:
-    explicit VectorEnv(Envs &envs, EnvRenderer &renderer, int numThreads);
+    /**
+     * @param cpuAffinity optional logical CPU per thread, thread 0 is the calling (main) thread, -1 leaves a thread unpinned.
+     */
+    explicit VectorEnv(
+        Envs &envs, EnvRenderer &renderer, int numThreads, Scheduler scheduler = Scheduler::Static,
+        const std::vector<int> &cpuAffinity = {}
+    );
+
+    /**
+     * Construct the envs on the threads that are going to step them (pinned to the same CPUs), so the Env,
+     * its EnvState and the Bullet world are first-touched on the NUMA node of that thread.
+     * Follows the initial static distribution, which is also where work stealing starts from. With asyncStepping
+     * the main thread does not simulate (see stepAsync()) and the envs are distributed between the workers only.
+     */
+    static Envs createEnvs(
+        int numEnvs, int numThreads, const std::function<std::unique_ptr<Env>(int envIdx)> &makeEnv,
+        const std::vector<int> &cpuAffinity = {}, bool asyncStepping = false
+    );
 
     void step();
 
+    /**
+     * Split-phase version of step(). stepAsync() launches the simulation on the worker threads and returns
+     * immediately, stepWait() waits for the workers and renders the new frame.
+     * Observations of the previous frame are not touched until stepWait(), so they can be consumed in between.
+     * Actions, rewards and dones must not be accessed until stepWait() returns.
+     * The main thread does not simulate any envs in this mode, so the step is done by numThreads - 1 workers
+     * (or synchronously in stepAsync() if there are no worker threads).
+     */
+    void stepAsync();
+
+    void stepWait();
+
     void reset();
 
+    /**
+     * EnvPool-style asynchronous stepping, for batches where some envs are much slower than others (i.e. mid-reset).
+     * send() hands envs to the workers, which step each of them as soon as they get to it, recv() waits for the
+     * first batchSize envs to finish and returns them in completion order, the rest keep running.
+     * Set the actions of the envs before sending them, and don't send an env again before recv() returned it.
+     * Rewards, dones and observations of the returned envs are valid until they are sent again.
+     * Workers never touch the renderer in this mode: the renderer updates of the returned envs (including resets)
+     * are done in recv() by the calling thread, which then draws only their agents (see EnvRenderer::setRenderMask()),
+     * so renderers only have to support drawing an arbitrary subset of the agents.
+     * The pool starts with the first send() and runs until stopPool(), which also finishes the envs that were sent
+     * but not received yet; step(), stepAsync(), reset() and close() stop it. The recorder, the observation encoder
+     * and background resets are not supported.
+     * @return false if the pool can't be started with the current settings.
+     */
+    bool send(const std::vector<int> &envIndices);
+
+    /**
+     * Whether send() would accept these envs: active, none of them in flight and no index twice. Lets callers check
+     * before they set the actions of the envs, which workers may be stepping.
+     */
+    bool canSend(const std::vector<int> &envIndices) const;
+
+    /// Requires at least batchSize envs in flight. The returned vector is reused by the next call.
+    const std::vector<int> & recv(int batchSize);
+
+    void stopPool();
+
+    /// Envs that were sent and not received yet.
+    int numEnvsInFlight() const { return poolInFlight; }
+
     void close();
 
+    /**
+     * Replicate the current state of env envIdx into the target envs (see Env::clone()), i.e. to expand the
+     * children of a search node and step them in one batch. Targets restore the state on the threads that step them.
+     * The first fork into a target within an episode of the source regenerates the layout there (shared through
+     * the layout cache if the scenario has one) and resets the target in the renderer, the following forks only copy
+     * the dynamic state. Targets get the rewards and the done flag of the source, leave the background reset queue
+     * and start a new key frame; their observations are valid after the next step. Stops the env pool.
+     * Must not be called during an asynchronous step.
+     * @return false if the scenario does not support snapshots or a target does not match the source (i.e. other
+     * scenario), such targets must be reset.
+     */
+    bool fork(int envIdx, const std::vector<int> &targetIndices);
+
+    /**
+     * Batched reward shaping, i.e. for PBT: new values of the given rewards for every agent, rewardNames.size()
+     * values per agent in the order of lastRewards (all envs, NaN keeps the current value). Never blocks, so it can
+     * be called while the envs are stepping, from one thread at a time: the table is handed over lock-free
+     * (see TripleBuffer) and applied at the start of the next step() or reset(), after the pool is stopped.
+     * Rewards a scenario doesn't have are ignored.
+     * @return false if the number of agents does not match.
+     */
+    bool publishRewardShaping(const std::vector<std::string> &rewardNames, const float *values, int numAgentsTotal);
+
+    /**
+     * How many iterations threads spin on the dispatch/completion barriers before parking.
+     * Lower values free up the CPU (i.e. for the learner process), higher values reduce the wake-up latency.
+     */
+    void setSpinBudget(int numIterations);
+
+    /**
+     * Only threads [0, numThreads) simulate, the others skip every step and park on the barriers right away, so they
+     * don't compete with the renderer or the learner for the cores. Envs are split between the active threads in
+     * contiguous blocks of about the same step cost once costs are measured (see setThreadAutoTuning()), evenly before.
+     * In stepAsync() the workers [1, max(numThreads, 2)) simulate. The env pool (send()) always uses all threads.
+     * Must not be called during an asynchronous step.
+     */
+    void setNumActiveThreads(int numThreads);
+
+    int getNumActiveThreads() const { return numActiveThreads; }
+
+    /**
+     * Pick the number of active threads and the env partitioning by measurement: step() runs calibrationSteps steps
+     * with each candidate thread count (1, 2, 4, ... and all threads), recording the wall time of the whole step
+     * (barrier waits and the renderer included) and the simulation time of every env, and keeps the fastest
+     * candidate with envs split by their measured cost. The first step of each candidate is not counted, and one
+     * thread goes first, so the costs are known before the envs are partitioned. With retuneInterval > 0 the
+     * calibration is repeated after that many steps, i.e. when episodes get more expensive over training.
+     * Only step() calibrates, stepAsync() and the pool keep the current configuration. 0 calibration steps disables it.
+     */
+    void setThreadAutoTuning(int calibrationSteps, int retuneInterval = 0);
+
+    /**
+     * In pipelined mode the frame is submitted to the renderer at the end of step() and rendered on the GPU
+     * while the workers simulate the next step. Observations therefore lag behind the simulation by one frame,
+     * i.e. after step() the observation buffer holds the frame rendered at the end of the previous step().
+     * Only makes a difference for renderers that support asynchronous drawing (V4R).
+     */
+    void setPipelinedRendering(bool enabled) { pipelinedRendering = enabled; }
+
+    /**
+     * Latency-optimized mode for a handful of envs (interactive evaluation, real-time inference): step(), reset() and
+     * the other tasks run inline on the calling thread, one env after another, and the workers stay parked, so there
+     * are no dispatch or completion barriers to wake them up and wait for. Renderers with shards (see
+     * EnvRenderer::numShards()) have every shard submitted as soon as its envs are pre-drawn, so the GPU starts on
+     * the first envs while the rest are still simulated. Turns off the thread auto-tuning. Pipelined rendering
+     * should stay off, it adds a frame of latency. Must not be called during an asynchronous step.
+     */
+    void setLowLatency(bool enabled);
+
+    bool isLowLatency() const { return lowLatency; }
+
+    /**
+     * Action repeat: every step() simulates each env for up to numFrames ticks with the same actions and renders
+     * only the last one. Rewards are summed over the ticks. An env that finishes the episode stops repeating,
+     * and is reset as usual.
+     */
+    void setFrameSkip(int numFrames) { frameSkip = std::max(numFrames, 1); }
+
+    int getFrameSkip() const { return frameSkip; }
+
+    /**
+     * Envs that finish an episode are not reset by the worker that stepped them. Their observation is the terminal
+     * frame, and during the next step the env is masked out (not simulated, zero reward, actions are dropped) while
+     * a dedicated reset thread prepares the new episode in parallel with the simulation of the other envs.
+     * The first frame of the new episode is observed after that step, so episode boundaries cost one frame of
+     * latency, but expensive resets no longer hold up the worker (and with it the whole step). A reset that takes
+     * longer than the step itself still stalls stepWait() by the difference.
+     * Envs that are done when this is disabled still finish their reset in the background.
+     * Must not be called during an asynchronous step.
+     */
+    void setBackgroundResets(bool enabled);
+
+    /**
+     * Time-sliced auto-resets: an env that finishes an episode runs its reset in stages (see Env::beginReset())
+     * on the worker that steps it, spending at most about stepBudgetNs per step (at least one stage). The terminal
+     * frame is not drawn, and the env stays masked (not simulated or drawn, zero reward, actions are dropped) until
+     * the reset completes, so an expensive reset costs a few steps of latency for that env instead of holding up the
+     * whole step. Background resets, terminal observations and the asynchronous pool take precedence, or reject
+     * it. 0 (default) resets in one go. Must not be called during an asynchronous step.
+     */
+    void setIncrementalResets(uint64_t stepBudgetNs);
+
+    /// The env is being reset in the background during the current step or incrementally, see setBackgroundResets().
+    bool isMasked(int envIdx) const { return masked[envIdx] != 0; }
+
+    /**
+     * Record every step (after the last repeated frame) and every episode start, see TrajectoryRecorder.
+     * Envs that are already running start the recording with their current pose. nullptr stops the recording.
+     * Must not be called during an asynchronous step.
+     */
+    void setRecorder(TrajectoryRecorder *trajectoryRecorder);
+
+    /**
+     * Encode the observations after every draw (step and reset), on the simulation threads. With pipelined
+     * rendering this is the frame from the end of the previous step, same as the observation buffer.
+     * The first frame after this call and the first frame of every episode are key frames. nullptr disables it.
+     * Must not be called during an asynchronous step.
+     */
+    void setObservationEncoder(ObservationEncoder *observationEncoder);
+
+    /**
+     * Notify the pregenerator about every episode start, so the layouts of the following episodes of the env are
+     * generated in the background. nullptr disables it.
+     * Must not be called during an asynchronous step.
+     */
+    void setEpisodePregenerator(EpisodePregenerator *episodePregenerator);
+
+    /**
+     * Update the batched scenario components (see Scenario::batchedComponents(), i.e. fall detection) for the whole
+     * block of envs of a thread at once: in synchronous steps with the static scheduler and without frame skip, every
+     * thread simulates all its envs, runs one BatchedComponentsPass over them and then finishes their steps.
+     * Other modes update the components per env as usual.
+     * Must not be called during an asynchronous step.
+     */
+    void setBatchedComponents(bool enabled);
+
+    /**
+     * Update the ray sensors of every agent after each step and reset, on the simulation threads, right before the
+     * renderer gets the env. The sensors must be created for the envs of this VectorEnv. nullptr disables them.
+     * Must not be called during an asynchronous step.
+     */
+    void setRaySensors(RaySensors *raySensors);
+
+    /**
+     * Only the first numEnvs envs are stepped, reset and drawn, the others stay allocated (together with their slots
+     * in the renderer and in the per-agent buffers) and can be brought back later, so the batch can shrink and grow
+     * without rebuilding the threads or the renderer. Envs that become active again start a new episode, their
+     * observations are valid after the next step. Per-agent buffers keep the capacity of all envs, only the prefix
+     * of the active envs is updated.
+     * Must not be called during an asynchronous step.
+     */
+    void setNumActiveEnvs(int numEnvs);
+
+    int getNumActiveEnvs() const { return numActiveEnvs; }
+
+    /**
+     * Render only the agents with a non-zero entry after the following steps (indexed like the per-agent buffers),
+     * i.e. when some policies don't act on every step. Observations of the other agents are stale. Agents of envs
+     * that start a new episode are always rendered, and so is everyone on reset(). An empty mask renders all agents.
+     * Must not be called during an asynchronous step.
+     */
+    void setRenderMask(std::vector<uint8_t> agentMask);
+
+    /**
+     * Agents that are done before their env (see Env::isAgentDone()) stop moving and are not rendered anymore
+     * (on top of the render mask), their observations stay at the last frame before they finished.
+     * Must not be called during an asynchronous step.
+     */
+    void setFreezeDoneAgents(bool freeze);
+
+    /**
+     * Move the agents of every env in parallel on numThreads helper threads shared by all envs (see
+     * Env::setPhysicsWorkers()), for a few large envs with many agents where there are more cores than envs.
+     * The helpers only work while an env is moving its agents. 0 disables them. Must not be called during an
+     * asynchronous step.
+     */
+    void setPhysicsWorkers(int numThreads);
+
+    /**
+     * Keep the last frame of every episode: envs that finish are first drawn in their terminal state (only the agents
+     * of those envs are rendered in that pass), their frames are copied into a separate buffer, and only then are
+     * they reset and drawn again for the regular observation, so the learner can bootstrap from the terminal frame
+     * without rendering the episode twice itself. Slots are allocated for the envs that finished in the last step
+     * only. frameBytes is the size of one observation, 0 disables it.
+     * Has no effect with background resets (the observation of the done step is the terminal frame there) and with
+     * pipelined rendering. The env pool does not support it.
+     * Must not be called during an asynchronous step.
+     */
+    void setTerminalObservations(size_t frameBytes);
+
+    /// Envs that finished in the last step, in the order of their slots in the terminal observation buffer.
+    const std::vector<int> & getTerminalEnvs() const { return terminalEnvs; }
+
+    /// Terminal frame of the agent, nullptr unless the env finished in the last step. Valid until the next step.
+    const uint8_t * getTerminalObservation(int envIdx, int agentIdx) const;
+
+    /**
+     * Summary of a finished episode of one agent, recorded by the thread that stepped the env.
+     */
+    struct EpisodeStats
+    {
+        int envIdx = 0, agentIdx = 0;
+
+        /// sum of the rewards of the agent, including the last step, and the true objective at the end
+        float episodeReturn = 0;
+        float trueObjective = 0;
+
+        /// steps (a step with frame skip counts once) and wall time since the episode was reset
+        int numSteps = 0;
+        float wallTimeSec = 0;
+
+        /// step(), stepAsync() or send() call in which the episode finished, counted from 1
+        uint64_t doneStep = 0;
+    };
+
+    /**
+     * Append the episodes finished since the last call to out, oldest first. Finished episodes are kept in a ring
+     * buffer (see setEpisodeStatsCapacity()), so the learner can drain them once per rollout instead of tracking
+     * returns in Python on every step. If the buffer fills up between calls the oldest episodes are dropped.
+     * @return number of episodes dropped since the last call.
+     */
+    uint64_t popEpisodeStats(std::vector<EpisodeStats> &out);
+
+    /// Size of the ring buffer in agent episodes, 4096 by default. 0 disables the statistics. Drops pending episodes.
+    void setEpisodeStatsCapacity(int capacity);
+
+    /**
+     * Wait times accumulated since the last call to resetWaitStats(). Worker stats are updated by the workers
+     * themselves after they wake up, so they can lag behind by one step.
+     */
+    struct WaitStats
+    {
+        /// time the main thread spent waiting for the workers during the last step/reset
+        float lastMainThreadWaitUsec = 0;
+
+        /// total time spent waiting on the barriers by all threads
+        float totalWaitUsec = 0;
+
+        /// number of times a thread ran out of spin budget and had to sleep
+        uint64_t numParked = 0;
+    };
+
+    WaitStats getWaitStats() const;
+
+    void resetWaitStats();
+
+    /**
+     * Counters accumulated since construction or the last call to resetStats().
+     */
+    struct Stats
+    {
+        /// fraction of wall time each thread (0 is the main thread) spent stepping, resetting or encoding envs
+        std::vector<float> threadUtilization;
+
+        /// envs that finished an episode and were auto-reset during step()
+        uint64_t numEpisodeResets = 0;
+
+        /// calls to reset()
+        uint64_t numResets = 0;
+
+        /// current configuration, see setNumActiveThreads(); not affected by resetStats()
+        int numActiveThreads = 0;
+        std::vector<int> envsPerThread;
+
+        /// steps per second of the configuration chosen by the last calibration, see setThreadAutoTuning()
+        float tunedStepsPerSec = 0;
+        uint64_t numCalibrations = 0;
+    };
+
+    Stats getStats() const;
+
+    /// Also resets the wait stats.
+    void resetStats();
+
+    /**
+     * Memory by subsystem: the envs (summed up under "env.", or under "env.<idx>." with perEnv), the renderer,
+     * the buffers of the vector env itself and the process-wide counters (Bullet allocator, scene graph nodes,
+     * resident and virtual memory of the process) under "process.".
+     * Call from the main thread between steps.
+     */
+    MemoryReport memoryReport(bool perEnv = false) const;
+
 private:
     void taskFunc(Task task, int threadIdx);
 
     void executeTask(Task task);
 
+    void fillWorkQueues(int firstThreadIdx);
+
+    void updateEnvSplits();
+
+    void startCalibration();
+
+    void tuneThreads(uint64_t stepNs);
+
+    bool popWork(int threadIdx, int &envIdx);
+
+    void finishStep();
+
     void stepEnv(int envIdx);
 
+    void stepShard(int threadIdx, int firstEnv, int endEnv);
+
+    void finishEnvStep(int envIdx);
+
     void resetEnv(int envIdx);
 
+    void beginEpisode(int envIdx);
+
+    /// @return true if the reset completed
+    bool continueIncrementalReset(int envIdx);
+
+    void forkEnv(int envIdx);
+
+    void recordEpisodeStats(int envIdx);
+
+    bool drawsTerminalFrames() const { return terminalFrameBytes > 0 && !backgroundResetsEnabled && !pipelinedRendering; }
+
+    void drawTerminalFrames();
+
+    void resetTerminalEnv(int envIdx);
+
+    void encodeEnv(int envIdx);
+
+    void senseEnv(int envIdx);
+
+    void poolLoop(int threadIdx);
+
+    void finishPoolEnv(int envIdx);
+
+    void applyRewardShaping();
+
+    void prepareShards();
+
+    void envPreDrawn(int envIdx);
+
+    void backgroundResetLoop();
+
+    bool poolUsesWorkers() const { return numThreads > 1 && !lowLatency; }
+
+    void startBackgroundResets();
+
+    void finishBackgroundResets();
+
 public:
     std::vector<std::unique_ptr<Env>> &envs;
     EnvRenderer &renderer;
@@ -47,13 +467,183 @@ public:
     std::vector<bool> done;
     std::vector<std::vector<float>> trueObjectives;
 
+    /**
+     * Contiguous buffers updated in place on every step, so they can be exposed to Python without copies.
+     * Per-agent buffers are indexed by envIdx * numAgents + agentIdx.
+     * Rewards are recorded before the auto-reset, so they include the reward for the last step of the episode.
+     */
+    std::vector<float> lastRewards;
+    std::vector<float> lastTrueObjectives;  // only updated for agents in envs that are done
+    std::vector<uint8_t> doneFlags;  // one byte per env (std::vector<bool> is not safe for concurrent writes)
+    std::vector<uint8_t> agentDoneFlags;  // per agent, see Env::isAgentDone(), set for all agents of done envs
+
+    /// index of the first agent of each env in per-agent buffers
+    std::vector<int> agentOffsets;
+
+private:
+    // actions of the current step, re-applied for the repeated frames (per-agent, like lastRewards)
+    std::vector<Action> repeatedActions;
+
+    // per env: frame drawn in the last step is the first frame of an episode (i.e. for key frames)
+    std::vector<uint8_t> episodeStarted;
+
+    // per agent, see setRenderMask(), and the mask of the current frame with the first frames of new episodes
+    std::vector<uint8_t> renderMask, frameRenderMask;
+    bool freezeDoneAgents = false, maskedEnvsDrawn = false;
+
+    std::unique_ptr<WorkerPool> physicsWorkers;
+
+    // per env: being reset by the reset thread during the current step, written by the main thread between steps
+    std::vector<uint8_t> masked;
+    std::vector<int> backgroundResets;
+
+    // see setIncrementalResets(), the status of the reset of every env is in its EnvSlot
+    uint64_t incrementalResetBudgetNs = 0;
+
+    // see setBatchedComponents(): components of every env and the scratch buffers of every thread
+    bool batchedComponents = false;
+    std::vector<BatchedComponents> envComponents;
+    std::vector<BatchedComponentsPass> componentPasses;
+
+    // snapshot of the source env and the per-env status of the targets, see fork()
+    StateBuffer forkState;
+    std::vector<uint8_t> forkTargets;
+    int forkSource = 0;
+
+    // see setTerminalObservations(): first agent slot of every done env (-1 for the others) and the frames of the slots
+    size_t terminalFrameBytes = 0;
+    std::vector<int> terminalEnvs, terminalSlots;
+    std::vector<uint8_t> terminalObservations;
+
+    // see popEpisodeStats(): ring buffer filled by the workers, the progress of the episodes is in the EnvSlots
+    std::atomic<uint64_t> numVectorSteps{0};  // written by the main thread, read by the pool workers
+
+    std::mutex episodeStatsMutex;
+    std::vector<EpisodeStats> episodeStats;
+    size_t episodeStatsHead = 0, numEpisodeStats = 0;
+    uint64_t numDroppedEpisodeStats = 0;
+
+private:
+    // own cache line, the queues of neighbouring threads are locked concurrently
+    struct alignas(64) WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<int> envIndices;
+    };
+
 private:
-    int numThreads{}, envsPerThread{};
+    int numThreads{};
+    int numActiveEnvs{};
+
+    // see setNumActiveThreads(): envs of thread i are [envSplits[i], envSplits[i + 1]) in synchronous steps
+    int numActiveThreads{};
+    std::vector<int> envSplits;
+
+    // threads that take part in the current task, published to the workers by the dispatch barrier
+    int numWorkingThreads{};
+
+    /**
+     * Internal per-env state written by the thread stepping the env. One cache line per env: with work stealing or
+     * a few envs per thread neighbouring envs are stepped by different threads, packed arrays would share lines
+     * between them. The buffers exported to Python (doneFlags, lastRewards, ...) keep their packed layout.
+     */
+    struct alignas(64) EnvSlot
+    {
+        // simulation time while calibrating, see setThreadAutoTuning()
+        uint64_t stepNs = 0;
+
+        // progress of the current episode, see popEpisodeStats()
+        uint64_t episodeStartNs = 0;
+        int episodeSteps = 0;
+
+        // status of the reset, see setIncrementalResets()
+        uint8_t incrementalReset = 0;
+    };
+
+    bool measureEnvCosts = false;
+    std::vector<EnvSlot> envSlots;
+
+    // see setThreadAutoTuning(), calibrating while candidate >= 0
+    struct ThreadTuning
+    {
+        int calibrationSteps = 0, retuneInterval = 0;
+        std::vector<int> candidates;
+        std::vector<uint64_t> candidateNs;
+        int candidate = -1, step = 0;
+        int stepsSinceCalibration = 0;
+
+        float stepsPerSec = 0;
+        uint64_t numCalibrations = 0;
+    };
+
+    ThreadTuning threadTuning;
+    Scheduler scheduler;
+    std::vector<std::unique_ptr<WorkQueue>> workQueues;
+
     std::vector<std::thread> backgroundThreads;
-    std::vector<Task> currTasks;
-    std::condition_variable cvTask;
-    std::mutex mutex;
-    std::atomic<int> numReady = 0;
+
+    // written by the main thread before the dispatch barrier, barrier guarantees the visibility for the workers
+    Task currTask = Task::IDLE;
+    bool useWorkQueues = false;
+    bool asyncStepInProgress = false;
+    bool pipelinedRendering = false;
+    bool lowLatency = false;
+    int frameSkip = 1;
+    TrajectoryRecorder *recorder = nullptr;
+    ObservationEncoder *encoder = nullptr;
+    EpisodePregenerator *pregenerator = nullptr;
+    RaySensors *sensors = nullptr;
+
+    Barrier dispatchBarrier, completionBarrier;
+
+    bool backgroundResetsEnabled = false, backgroundResetsInProgress = false, terminateResetThread = false;
+    Barrier resetDispatchBarrier, resetCompletionBarrier;
+    std::thread resetThread;
+
+    uint64_t lastMainThreadWaitNs = 0;
+
+    // per-thread status, each slot is only written by its thread and has a cache line of its own
+    struct alignas(64) ThreadSlot
+    {
+        // time spent in the tasks
+        std::atomic<uint64_t> busyNs{0};
+    };
+
+    std::vector<ThreadSlot> threadSlots;
+    uint64_t statsStartNs = 0;
+    uint64_t numEpisodeResets = 0, numResets = 0;
+
+    // simulation time of stepAsync()/stepWait() doesn't fit in a single scope
+    uint64_t asyncStepStartNs = 0;
+
+    // asynchronous pool, see send(): both queues fit every env, so pushes never fail
+    MpmcQueue<int> sentEnvs, completedEnvs;
+    bool poolRunning = false;
+    int poolInFlight = 0;
+    std::vector<uint8_t> poolEnvsInFlight;  // per env, sent and not received yet
+    std::atomic<bool> stopPoolWorkers{false};
+    std::vector<int> receivedEnvs;
+    std::vector<uint8_t> poolRenderMask;
+
+    // see publishRewardShaping(), values are [agent][reward]
+    struct RewardShapingTable
+    {
+        std::vector<std::string> rewardNames;
+        std::vector<float> values;
+    };
+
+    TripleBuffer<RewardShapingTable> rewardShapingUpdates;
+    std::vector<int> rewardSlots;
+
+    // renderer shards submitted by the workers, see EnvRenderer::numShards(): envs left to pre-draw in each shard
+    struct alignas(64) ShardSlot
+    {
+        std::atomic<int> pending{0};
+    };
+
+    bool submitShards = false;
+    std::vector<ShardSlot> shardSlots;
+    std::vector<int> envShards;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <util/perf_counters.hpp>
+
+#include <env/vector_env.hpp>
+
+
+namespace Megaverse
+{
+
+struct BenchmarkOptions
+{
+    /// steps before the measurement starts (caches, first episodes, renderer allocations)
+    int warmupSteps = 100;
+    int numSteps = 1000;
+
+    uint64_t seed = 42;
+
+    /// probability that an agent keeps its previous action, so random agents actually get somewhere
+    float repeatProbability = 0.0f;
+
+    /**
+     * Optional scripted policy instead of random actions, i.e. a recorded trajectory. Action of agent a
+     * (index into the per-agent buffers) at step t is script[(t * numAgentsTotal + a) % script.size()].
+     */
+    std::vector<Action> script;
+
+    /// also count hardware events per stage (ScopedProfiler::setCountersEnabled()), for data layout work
+    bool perfCounters = false;
+};
+
+/**
+ * Steady-state measurement of a VectorEnv, see runBenchmark().
+ */
+struct BenchmarkReport
+{
+    struct Stage
+    {
+        std::string name;
+        uint64_t count = 0;
+        double meanUsec = 0, p50Usec = 0, p99Usec = 0, maxUsec = 0;
+
+        /// totals over the measurement, zero unless hasCounters
+        PerfCounterValues counters;
+    };
+
+    int numEnvs = 0, numAgents = 0, numSteps = 0;
+
+    double wallSec = 0;
+
+    /// agent frames (observations) per second and VectorEnv::step() calls per second
+    double fps = 0, stepsPerSec = 0;
+
+    /// from the VectorEnv::step() call to the observations being ready, what a real-time caller waits for, usec
+    double latencyMeanUsec = 0, latencyP50Usec = 0, latencyP99Usec = 0, latencyMaxUsec = 0;
+
+    /// see VectorEnv::setLowLatency()
+    bool lowLatency = false;
+
+    /// profiler zones recorded during the measurement (Env::step, stepSimulation, Renderer::draw, ...)
+    std::vector<Stage> stages;
+
+    /// BenchmarkOptions::perfCounters was set and the counters were available
+    bool hasCounters = false;
+
+    std::vector<float> threadUtilization;
+    uint64_t numEpisodeResets = 0;
+
+    /// see VectorEnv::setNumActiveThreads()
+    int numActiveThreads = 0;
+
+    /// process memory at the end of the measurement, bytes
+    double vmBytes = 0, rssBytes = 0;
+
+    /// Single JSON object, for regression tracking scripts.
+    std::string toJson() const;
+};
+
+/**
+ * Drives the VectorEnv with a per-env random policy (every env has its own Philox stream, so runs are reproducible
+ * and do not depend on the number of threads) or with a scripted one, with nothing else on the main thread.
+ * The scoped profiler is enabled for the measured steps to get the per-stage breakdown, and restored afterwards.
+ * The env must be reset; profiler histograms collected so far are cleared.
+ */
+BenchmarkReport runBenchmark(VectorEnv &venv, const BenchmarkOptions &options = {});
+
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <util/tcp_socket.hpp>
+#include <util/frame_codec.hpp>
+#include <util/shared_memory.hpp>
+
+#include <env/vector_env.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Header at the start of the shared memory segment of a VectorEnvServer, followed by the buffers:
+ * agent offsets (int32 per env + 1), actions (int32 Action bitmask per agent), observations (obsBytesPerAgent per
+ * agent, same layout as EnvRenderer::getObservationsBatch()), rewards (float per agent) and dones (uint8 per env).
+ * The protocol is lockstep: each client writes the actions of its slice and arrives on slicesReady, the server
+ * steps all envs once every slice has arrived, publishes the results and bumps frame.
+ */
+struct VectorEnvShmHeader
+{
+    static constexpr uint32_t magicValue = 0x4d475653;  // "MGVS"
+
+    uint32_t magic;
+    int32_t numEnvs, numAgents, numSlices;
+    int32_t obsW, obsH, obsChannels;
+    uint64_t obsBytesPerAgent;
+
+    uint64_t agentOffsetsOffset, actionsOffset, obsOffset, rewardsOffset, donesOffset;
+
+    // futex words
+    std::atomic<uint32_t> frame, slicesReady, terminated;
+
+    /**
+     * Fill in the buffer offsets for the counts and the observation size in the header.
+     * @return size of the whole segment.
+     */
+    size_t computeLayout();
+};
+
+/**
+ * Hosts a VectorEnv and its renderer for clients in other processes. One process owning the batch renderer can
+ * serve many policy workers, which read the observations straight from the shared memory.
+ * Envs are split into numSlices contiguous blocks, one per client.
+ */
+class VectorEnvServer
+{
+public:
+    VectorEnvServer(VectorEnv &vectorEnv, int obsW, int obsH, int obsChannels, const std::string &name, int numSlices);
+
+    /**
+     * Reset the envs, then step them every time all slices are ready, until terminate() is called (by the server
+     * or any of the clients). Blocks the calling thread.
+     */
+    void serve();
+
+    void terminate();
+
+    bool isOpen() const { return shm.isOpen(); }
+
+private:
+    void publish();
+
+private:
+    VectorEnv &vectorEnv;
+    SharedMemory shm;
+    VectorEnvShmHeader *header = nullptr;
+};
+
+/**
+ * Serves the envs to VectorEnvTcpClient instances on other nodes, one persistent connection per slice.
+ * Unlike the shared memory server the slices are not stepped in lockstep: the envs of a slice are handed to the env
+ * pool (see VectorEnv::send()) as soon as its actions arrive and its results go out as soon as all of them finished,
+ * so a client that keeps several slices in flight (see VectorEnvClient::stepAsync()) hides the network round trip
+ * behind the simulation of the other slices.
+ * Observations can be compressed per agent with FrameEncoder (delta to the previous frame of the agent), chosen by
+ * each client when it connects.
+ *
+ * Messages, all integers in host byte order (the nodes of one cluster share it):
+ * client hello: magic, slice index, flags (uint32 each);
+ * server hello: numEnvs, numAgents, numSlices, obsW, obsH, obsChannels (int32), agent offsets (int32 per env + 1);
+ * client step: uint32 step message, int32 Action bitmask per agent of the slice;
+ * server frame: uint32 frame message, rewards (float per agent), dones (uint8 per env), observations of the slice,
+ * either raw or a uint32 size and the encoded frame per agent.
+ * A terminate message from either side stops the server.
+ */
+class VectorEnvTcpServer
+{
+public:
+    static constexpr uint32_t magicValue = 0x4d475654;  // "MGVT"
+
+    enum Message : uint32_t
+    {
+        STEP = 1,
+        FRAME = 2,
+        TERMINATE = 3,
+    };
+
+    enum Flags : uint32_t
+    {
+        COMPRESSED = 1,
+    };
+
+public:
+    VectorEnvTcpServer(VectorEnv &vectorEnv, int obsW, int obsH, int obsChannels, int port, int numSlices);
+
+    ~VectorEnvTcpServer();
+
+    /**
+     * Wait for the clients of all slices, reset the envs and serve their steps until terminate() is called (by the
+     * server or any of the clients) or a client disconnects. Blocks the calling thread.
+     */
+    void serve();
+
+    /// Can be called from another thread.
+    void terminate() { terminated = true; }
+
+    bool isOpen() const { return listener.isOpen(); }
+
+    int port() const { return listener.localPort(); }
+
+private:
+    struct Slice;
+
+    bool acceptClients();
+
+    bool sendFrame(Slice &slice);
+
+private:
+    VectorEnv &vectorEnv;
+    int obsW, obsH, obsChannels, numSlices;
+    size_t obsBytesPerAgent;
+
+    TcpSocket listener;
+    std::vector<std::unique_ptr<Slice>> slices;
+
+    std::atomic<bool> terminated{false};
+};
+
+/**
+ * Client side of VectorEnvServer, attached to one slice of the envs.
+ */
+class VectorEnvClient
+{
+public:
+    VectorEnvClient(const std::string &name, int sliceIdx);
+
+    virtual ~VectorEnvClient() = default;
+
+    bool isOpen() const { return header != nullptr; }
+
+    int numEnvs() const { return lastEnv - firstEnv; }
+
+    int numAgents() const { return lastAgent - firstAgent; }
+
+    int numAgentsPerEnv(int envIdx) const { return agentOffsets[firstEnv + envIdx + 1] - agentOffsets[firstEnv + envIdx]; }
+
+    const VectorEnvShmHeader & getHeader() const { return *header; }
+
+    /// Views over the slice in the shared memory. Observations, rewards and dones are overwritten by step().
+    int32_t * actions() const { return reinterpret_cast<int32_t *>(data + header->actionsOffset) + firstAgent; }
+
+    const uint8_t * observations() const { return data + header->obsOffset + firstAgent * header->obsBytesPerAgent; }
+
+    const float * rewards() const { return reinterpret_cast<const float *>(data + header->rewardsOffset) + firstAgent; }
+
+    const uint8_t * dones() const { return data + header->donesOffset + firstEnv; }
+
+    /**
+     * Submit the actions of the slice and wait until the server has stepped all envs.
+     * @return false if the server was terminated.
+     */
+    bool step() { return stepAsync() && stepWait(); }
+
+    /**
+     * Submit the actions and return right away, the views must not be accessed until stepWait(). Other slices
+     * (other clients) can be stepped in the meantime.
+     */
+    virtual bool stepAsync();
+
+    virtual bool stepWait();
+
+    /// Wait for the initial reset of the server.
+    virtual bool waitForReset();
+
+    /// Stop the server and wake up all other clients.
+    virtual void terminate();
+
+protected:
+    VectorEnvClient() = default;
+
+    /// Views over a buffer with the layout of the shared memory segment.
+    bool attachSlice(uint8_t *buffer, int sliceIdx);
+
+private:
+    bool waitForFrame(uint32_t prevFrame);
+
+protected:
+    uint8_t *data = nullptr;
+    VectorEnvShmHeader *header = nullptr;
+    const int32_t *agentOffsets = nullptr;
+
+    int sliceIdx = 0, firstEnv = 0, lastEnv = 0, firstAgent = 0, lastAgent = 0;
+
+private:
+    SharedMemory shm;
+    uint32_t stepFrame = 0;
+};
+
+/**
+ * Client of VectorEnvTcpServer with the same views as the shared memory client: the results of the slice are
+ * received into a local buffer with the layout of the shared memory segment, so policies don't care where the envs
+ * run. Keep one client per slice and alternate between them with stepAsync()/stepWait() to have several steps in
+ * flight.
+ */
+class VectorEnvTcpClient : public VectorEnvClient
+{
+public:
+    VectorEnvTcpClient(const std::string &host, int port, int sliceIdx, bool compressed);
+
+    bool stepAsync() override;
+
+    bool stepWait() override;
+
+    bool waitForReset() override { return stepWait(); }
+
+    void terminate() override;
+
+private:
+    TcpSocket socket;
+    bool compressed = false;
+
+    std::vector<uint8_t> buffer;
+    std::vector<FrameDecoder> decoders;
+    std::vector<uint8_t> encoded;
+};
+
+}
@@ -1,4 +1,8 @@
+#include <cmath>
 #include <memory>
+#include <algorithm>
+
+#include <LinearMath/btAabbUtil2.h>
 
 #include <Magnum/Magnum.h>
 #include <Magnum/SceneGraph/Camera.h>
@@ -14,6 +18,24 @@ using namespace Magnum::Math::Literals;
 using namespace Megaverse;
 
 
+namespace
+{
+
+void setupCamera(Object3D &cameraObject, SceneGraph::Camera3D &camera, Object3D &pickupSpot)
+{
+    cameraObject.translate(Magnum::Vector3{0, 0.41f, 0});
+
+    auto [fov, near, far, aspectRatio] = agentCameraParameters();
+    camera.setAspectRatioPolicy(SceneGraph::AspectRatioPolicy::Extend)
+          .setProjectionMatrix(Matrix4::perspectiveProjection(Deg(fov), aspectRatio, near, far))
+          .setViewport(GL::defaultFramebuffer.viewport().size());
+
+    pickupSpot.translate({0.0f, -0.44f, -1.0f});
+}
+
+}
+
+
 AbstractAgent::AbstractAgent(Object3D *parent, btDynamicsWorld &bWorld, float verticalLookLimitRad)
 : Object(parent)
 , verticalLookLimitRad{verticalLookLimitRad}
@@ -21,6 +43,26 @@ AbstractAgent::AbstractAgent(Object3D *parent, btDynamicsWorld &bWorld, float ve
 {
 }
 
+void AbstractAgent::applyControls(const AgentControls &c, float dt)
+{
+    const auto acceleration = c.forward * forwardDirection() + c.strafeLeft * strafeLeftDirection();
+
+    if (c.yaw > 0)
+        lookLeft(dt);
+    else if (c.yaw < 0)
+        lookRight(dt);
+
+    if (c.pitch > 0)
+        lookUp(dt);
+    else if (c.pitch < 0)
+        lookDown(dt);
+
+    accelerate(acceleration, dt);
+
+    if (c.jump)
+        jump();
+}
+
 
 DefaultKinematicAgent::DefaultKinematicAgent(Object3D *parent, btDynamicsWorld &bWorld, const Vector3 &startingPosition,
                                              float rotationRad, float verticalLookLimitRad)
@@ -30,14 +72,7 @@ DefaultKinematicAgent::DefaultKinematicAgent(Object3D *parent, btDynamicsWorld &
 , pickupSpot{&(cameraObject->addChild<Object3D>())}
 {
     // cameraObject.rotateY(0.0_degf);
-    cameraObject->translate(Magnum::Vector3{0, 0.41f, 0});
-
-    auto [fov, near, far, aspectRatio] = agentCameraParameters();
-    camera->setAspectRatioPolicy(SceneGraph::AspectRatioPolicy::Extend)
-           .setProjectionMatrix(Matrix4::perspectiveProjection(Deg(fov), aspectRatio, near, far))
-           .setViewport(GL::defaultFramebuffer.viewport().size());
-
-    pickupSpot->translate({0.0f, -0.44f, -1.0f});
+    setupCamera(*cameraObject, *camera, *pickupSpot);
 
     btTransform startTransform;
     startTransform.setIdentity();
@@ -60,7 +95,7 @@ DefaultKinematicAgent::DefaultKinematicAgent(Object3D *parent, btDynamicsWorld &
     bCharacter = std::make_unique<KinematicCharacterController>(&ghostObject, capsuleShape.get(), stepHeight, btVector3(0.0, 1.0, 0.0));
 
 //    bWorld.addCollisionObject(&ghostObject, btBroadphaseProxy::CharacterFilter, btBroadphaseProxy::StaticFilter | btBroadphaseProxy::CharacterFilter);
-    bWorld.addCollisionObject(&ghostObject, btBroadphaseProxy::CharacterFilter | btBroadphaseProxy::DefaultFilter, btBroadphaseProxy::StaticFilter | btBroadphaseProxy::CharacterFilter | btBroadphaseProxy::DefaultFilter);
+    bWorld.addCollisionObject(&ghostObject, agentCollisionGroup, agentCollisionMask);
     bWorld.addAction(bCharacter.get());
 }
 
@@ -70,14 +105,42 @@ DefaultKinematicAgent::~DefaultKinematicAgent()
     bWorld.removeAction(bCharacter.get());
 }
 
+void DefaultKinematicAgent::setLayoutCollisionQuery(const LayoutCollisionQuery *query)
+{
+    bCharacter->setLayoutCollisionQuery(query);
+}
+
+void DefaultKinematicAgent::saveState(StateBuffer &buffer) const
+{
+    buffer.write(currXRotation);
+    buffer.write(bCharacter->getState());
+}
+
+void DefaultKinematicAgent::restoreState(StateReader &reader)
+{
+    reader.read(currXRotation);
+    bCharacter->setState(reader.read<KinematicCharacterController::State>());
+}
+
 void DefaultKinematicAgent::updateTransform()
 {
-    auto worldTrans = ghostObject.getWorldTransform();
+    const auto &worldTrans = ghostObject.getWorldTransform();
+    applyWorldTransform(worldTrans.getOrigin(), worldTrans.getRotation());
+}
+
+void DefaultKinematicAgent::updateInterpolatedTransform(float alpha)
+{
+    // only the position is interpolated, rotations are applied directly by the actions and not by the physics
+    const auto &worldTrans = ghostObject.getWorldTransform();
+    applyWorldTransform(bCharacter->getPreviousPosition().lerp(worldTrans.getOrigin(), alpha), worldTrans.getRotation());
+}
 
-    auto position = Vector3{worldTrans.getOrigin()};
-    const auto axis = Vector3{worldTrans.getRotation().getAxis()};
+void DefaultKinematicAgent::applyWorldTransform(const btVector3 &origin, const btQuaternion &worldRotation)
+{
+    auto position = Vector3{origin};
+    const auto axis = Vector3{worldRotation.getAxis()};
     const auto normalizedAxis = axis.normalized();
-    const Float rotation = worldTrans.getRotation().getAngle();
+    const Float rotation = worldRotation.getAngle();
 
     /* Bullet sometimes reports NaNs for all the parameters and nobody is sure
        why: https://pybullet.org/Bullet/phpBB3/viewtopic.php?t=12080. The body
@@ -94,7 +157,42 @@ void DefaultKinematicAgent::updateTransform()
 
     position += Vector3{0, 0.05f, 0.0f};
 
-    this->resetTransformation().rotate(Rad{rotation}, normalizedAxis).translate(position);
+    // setting the transformation marks the whole subtree dirty for the renderers, even if nothing has changed
+    const auto transformation = Matrix4::translation(position) * Matrix4::rotation(Rad{rotation}, normalizedAxis);
+    if (transformation != transformationMatrix())
+        setTransformation(transformation);
+}
+
+void DefaultKinematicAgent::applyControls(const AgentControls &c, float dt)
+{
+    auto &xform = ghostObject.getWorldTransform();
+    const auto &basis = xform.getBasis();
+
+    // directions come from the orientation before this step's rotation, same as going through the virtuals
+    auto forwardDir = basis[2], strafeDir = basis[0];
+    forwardDir.setZ(-forwardDir.z()), strafeDir.setX(-strafeDir.x());
+    const auto acceleration = c.forward * forwardDir.normalize() + c.strafeLeft * strafeDir.normalize();
+
+    if (c.yaw != 0)
+        xform.setBasis(basis * btMatrix3x3(btQuaternion(btVector3(0, 1, 0), c.yaw * rotateRadians * dt)));
+
+    // looking down is made easier than up, see lookDown()
+    if (c.pitch > 0)
+        setXRotation(std::min(verticalLookLimitRad, currXRotation + rotateXRadians * dt));
+    else if (c.pitch < 0)
+        setXRotation(std::max(-verticalLookLimitRad, currXRotation - rotateXRadians * dt * 1.1f));
+
+    bCharacter->setAcceleration(acceleration, dt);
+
+    if (c.jump && bCharacter->onGround())
+        bCharacter->jump(btVector3(0, 6.2, 0));
+}
+
+void DefaultKinematicAgent::setXRotation(float radians)
+{
+    // rotations around the same local axis commute, so a single rotation by the difference is enough
+    cameraObject->rotateXLocal(Math::Rad<float>(radians - currXRotation));
+    currXRotation = radians;
 }
 
 void DefaultKinematicAgent::lookLeft(float dt)
@@ -169,3 +267,269 @@ bool DefaultKinematicAgent::onGround() const
 {
     return bCharacter->onGround();
 }
+
+bool DefaultKinematicAgent::settled() const
+{
+    return bCharacter->isResting();
+}
+
+
+VoxelKinematicAgent::VoxelKinematicAgent(Object3D *parent, btDynamicsWorld &bWorld, const Vector3 &startingPosition,
+                                         float rotationRad, float verticalLookLimitRad)
+: AbstractAgent(parent, bWorld, verticalLookLimitRad)
+, yaw{rotationRad}
+, cameraObject{&(addChild<Object3D>())}
+, camera{&(cameraObject->addFeature<SceneGraph::Camera3D>())}
+, pickupSpot{&(cameraObject->addChild<Object3D>())}
+, boxShape{btVector3{0.33f, 0.855f, 0.33f}}  // bounding box of the default agent's capsule
+{
+    setupCamera(*cameraObject, *camera, *pickupSpot);
+
+    btTransform startTransform;
+    startTransform.setIdentity();
+    startTransform.setOrigin(btVector3(startingPosition.x(), startingPosition.y() + getAgentHeight(), startingPosition.z()));
+    previousPosition = startTransform.getOrigin();
+
+    // the collision object is never rotated, so its AABB is the exact shape of the agent
+    collisionObject.setWorldTransform(startTransform);
+    collisionObject.setCollisionShape(&boxShape);
+    collisionObject.setCollisionFlags(btCollisionObject::CF_CHARACTER_OBJECT);
+
+    bWorld.addCollisionObject(&collisionObject, agentCollisionGroup, agentCollisionMask);
+    bWorld.addAction(this);
+}
+
+VoxelKinematicAgent::~VoxelKinematicAgent()
+{
+    bWorld.removeCollisionObject(&collisionObject);
+    bWorld.removeAction(this);
+}
+
+void VoxelKinematicAgent::saveState(StateBuffer &buffer) const
+{
+    buffer.write(State{yaw, currXRotation, horizontalVelocity, previousPosition, verticalVelocity, grounded});
+}
+
+void VoxelKinematicAgent::restoreState(StateReader &reader)
+{
+    const auto s = reader.read<State>();
+    // the camera transform itself is restored with the scene graph
+    yaw = s.yaw, currXRotation = s.currXRotation;
+    horizontalVelocity = s.horizontalVelocity, previousPosition = s.previousPosition;
+    verticalVelocity = s.verticalVelocity, grounded = s.grounded;
+}
+
+void VoxelKinematicAgent::updateTransform()
+{
+    applyWorldTransform(collisionObject.getWorldTransform().getOrigin());
+}
+
+void VoxelKinematicAgent::updateInterpolatedTransform(float alpha)
+{
+    applyWorldTransform(previousPosition.lerp(collisionObject.getWorldTransform().getOrigin(), alpha));
+}
+
+void VoxelKinematicAgent::applyWorldTransform(const btVector3 &origin)
+{
+    // don't mark the subtree dirty for the renderers if nothing has changed
+    const auto transformation = Matrix4::translation(Vector3{origin} + Vector3{0, 0.05f, 0.0f}) * Matrix4::rotationY(Rad{yaw});
+    if (transformation != transformationMatrix())
+        setTransformation(transformation);
+}
+
+void VoxelKinematicAgent::applyControls(const AgentControls &c, float dt)
+{
+    const auto acceleration = c.forward * forwardDirection() + c.strafeLeft * strafeLeftDirection();
+
+    yaw += c.yaw * rotateRadians * dt;
+
+    if (c.pitch > 0)
+        lookUp(dt);
+    else if (c.pitch < 0)
+        lookDown(dt);
+
+    accelerate(acceleration, dt);
+
+    if (c.jump)
+        jump();
+}
+
+void VoxelKinematicAgent::lookUp(float dt)
+{
+    setXRotation(std::min(verticalLookLimitRad, currXRotation + rotateXRadians * dt));
+}
+
+void VoxelKinematicAgent::lookDown(float dt)
+{
+    // same bias towards looking down as DefaultKinematicAgent::lookDown()
+    setXRotation(std::max(-verticalLookLimitRad, currXRotation - rotateXRadians * dt * 1.1f));
+}
+
+void VoxelKinematicAgent::setXRotation(float radians)
+{
+    cameraObject->rotateXLocal(Math::Rad<float>(radians - currXRotation));
+    currXRotation = radians;
+}
+
+btVector3 VoxelKinematicAgent::forwardDirection() const
+{
+    // same directions as the basis of the rotated transform in DefaultKinematicAgent
+    return {-std::sin(yaw), 0, -std::cos(yaw)};
+}
+
+btVector3 VoxelKinematicAgent::strafeLeftDirection() const
+{
+    return {-std::cos(yaw), 0, std::sin(yaw)};
+}
+
+void VoxelKinematicAgent::accelerate(const btVector3 &direction, btScalar dt)
+{
+    // see KinematicCharacterController::setAcceleration()
+    auto acc = direction;
+    if (!acc.fuzzyZero())
+        acc *= (grounded ? maxAcceleration : maxAirAcceleration) / acc.length();
+
+    if (grounded) {
+        horizontalVelocity += acc * dt;
+        const auto speed = horizontalVelocity.length();
+
+        if (speed > maxHorizontalSpeed)
+            horizontalVelocity *= std::max(speed - exceedingSpeedLimitDeceleration * dt, maxHorizontalSpeed) / speed;
+    } else {
+        const auto newHorizontalVelocity = horizontalVelocity + acc * dt;
+        const auto newSpeed = newHorizontalVelocity.length();
+        if (newSpeed <= maxAirSpeed || newSpeed < horizontalVelocity.length())
+            horizontalVelocity = newHorizontalVelocity;
+    }
+}
+
+void VoxelKinematicAgent::jump()
+{
+    if (grounded) {
+        verticalVelocity = jumpSpeed;
+        grounded = false;
+    }
+}
+
+void VoxelKinematicAgent::teleport(const btVector3 &position)
+{
+    collisionObject.getWorldTransform().setOrigin(position);
+    bWorld.updateSingleAabb(&collisionObject);
+
+    previousPosition = position;
+    horizontalVelocity.setZero();
+    verticalVelocity = 0;
+    grounded = false;
+}
+
+bool VoxelKinematicAgent::collides(btCollisionWorld &world, const btVector3 &position) const
+{
+    struct Callback : public btBroadphaseAabbCallback
+    {
+        const btCollisionObject *self;
+        btVector3 aabbMin, aabbMax;
+        bool checkLayout, hit = false;
+
+        bool process(const btBroadphaseProxy *proxy) override
+        {
+            const auto *obj = static_cast<const btCollisionObject *>(proxy->m_clientObject);
+            if (hit || obj == self || !obj->hasContactResponse() || !(proxy->m_collisionFilterGroup & agentCollisionMask))
+                return true;
+            if (!checkLayout && (proxy->m_collisionFilterGroup & layoutCollisionGroup))
+                return true;
+
+            hit = TestAabbAgainstAabb2(aabbMin, aabbMax, proxy->m_aabbMin, proxy->m_aabbMax);
+            return true;
+        }
+    } callback;
+
+    const auto halfExtents = boxShape.getHalfExtentsWithMargin();
+    callback.self = &collisionObject;
+    callback.aabbMin = position - halfExtents, callback.aabbMax = position + halfExtents;
+
+    // layout bodies can be skipped entirely if the voxel grid says the volume is free
+    callback.checkLayout = !layoutQuery || layoutQuery->layoutInAabb(callback.aabbMin, callback.aabbMax);
+
+    world.getBroadphase()->aabbTest(callback.aabbMin, callback.aabbMax, callback);
+    return callback.hit;
+}
+
+bool VoxelKinematicAgent::moveAxis(btCollisionWorld &world, btVector3 &position, int axis, btScalar delta) const
+{
+    if (delta == 0)
+        return true;
+
+    auto target = position;
+    target[axis] += delta;
+    if (!collides(world, target)) {
+        position = target;
+        return true;
+    }
+
+    // blocked, bisect for the point of contact
+    btScalar freeFraction = 0, blockedFraction = 1;
+    for (int i = 0; i < 6; ++i) {
+        const auto fraction = (freeFraction + blockedFraction) / 2;
+        target[axis] = position[axis] + delta * fraction;
+        if (collides(world, target))
+            blockedFraction = fraction;
+        else
+            freeFraction = fraction;
+    }
+
+    position[axis] += delta * freeFraction;
+    return false;
+}
+
+void VoxelKinematicAgent::updateAction(btCollisionWorld *world, btScalar dt)
+{
+    prepareAction(*world, dt);
+    commitAction(*world);
+}
+
+void VoxelKinematicAgent::prepareAction(btCollisionWorld &world, btScalar dt)
+{
+    // only queries the world, the collision object stays where it is until commitAction()
+    previousPosition = collisionObject.getWorldTransform().getOrigin();
+    auto position = previousPosition;
+
+    verticalVelocity = std::clamp(verticalVelocity - gravity * dt, -fallSpeed, jumpSpeed);
+
+    if (collides(world, position)) {
+        // started inside something (i.e. spawned on top of another agent), move freely until we're out
+        position += (horizontalVelocity + btVector3{0, verticalVelocity, 0}) * dt;
+        grounded = false;
+    } else {
+        moveAxis(world, position, 0, horizontalVelocity.x() * dt);
+        moveAxis(world, position, 2, horizontalVelocity.z() * dt);
+
+        if (!moveAxis(world, position, 1, verticalVelocity * dt)) {
+            // landed or hit the ceiling
+            grounded = verticalVelocity <= 0;
+            verticalVelocity = 0;
+        } else {
+            grounded = false;
+        }
+    }
+
+    // how far we actually traveled, hitting a wall arrests the momentum
+    horizontalVelocity = (position - previousPosition) / dt;
+    horizontalVelocity.setY(0);
+
+    if (grounded) {
+        // friction
+        const auto speed = horizontalVelocity.length();
+        if (speed - normalDeceleration * dt < 0)
+            horizontalVelocity.setZero();
+        else
+            horizontalVelocity *= (speed - normalDeceleration * dt) / speed;
+    }
+
+    nextPosition = position;
+}
+
+void VoxelKinematicAgent::commitAction(btCollisionWorld &world)
+{
+    collisionObject.getWorldTransform().setOrigin(nextPosition);
+    world.updateSingleAabb(&collisionObject);
+}
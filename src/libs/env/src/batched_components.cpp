@@ -0,0 +1,40 @@
+#include <util/scoped_profiler.hpp>
+
+#include <env/batched_components.hpp>
+
+
+using namespace Megaverse;
+
+
+void BatchedComponentsPass::run(Envs &envs, const std::vector<BatchedComponents> &components, int firstEnv, int endEnv, const uint8_t *skipEnv)
+{
+    PROFILE_ZONE("BatchedComponentsPass::run");
+
+    heights.clear(), thresholds.clear(), agents.clear();
+
+    for (int envIdx = firstEnv; envIdx < endEnv; ++envIdx) {
+        const auto fallDetection = components[envIdx].fallDetection;
+        if (!fallDetection || (skipEnv && skipEnv[envIdx]))
+            continue;
+
+        const auto threshold = fallDetection->fallHeight();
+        auto &env = *envs[envIdx];
+        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+            heights.push_back(env.getAgents()[agentIdx]->absoluteTransformation().translation().y());
+            thresholds.push_back(threshold);
+            agents.emplace_back(envIdx, agentIdx);
+        }
+    }
+
+    // one branch-free comparison over all agents of the shard, the compiler vectorizes this
+    const auto numAgents = heights.size();
+    fell.resize(numAgents);
+    for (size_t i = 0; i < numAgents; ++i)
+        fell[i] = heights[i] < thresholds[i];
+
+    for (size_t i = 0; i < numAgents; ++i)
+        if (fell[i]) {
+            const auto [envIdx, agentIdx] = agents[i];
+            components[envIdx].fallDetection->respawnFallenAgent(*envs[envIdx], agentIdx);
+        }
+}
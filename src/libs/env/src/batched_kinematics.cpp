@@ -0,0 +1,303 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#ifdef MEGAVERSE_CUDA_KINEMATICS
+    #include <cuda_runtime.h>
+#endif
+
+#include <util/tiny_logger.hpp>
+#include <util/memory_report.hpp>
+#include <util/scoped_profiler.hpp>
+
+#include <env/agent.hpp>
+#include <env/scenario.hpp>
+#include <env/voxel_state.hpp>
+#include <env/batched_kinematics.hpp>
+
+
+using namespace Magnum;
+using namespace Megaverse;
+
+
+#ifdef MEGAVERSE_CUDA_KINEMATICS
+
+namespace Megaverse
+{
+
+// batched_kinematics.cu
+void launchBatchedKinematics(
+    const KinematicGrid *grids, const uint8_t *const *voxels, const int *agentEnvs, const KinematicControls *controls,
+    KinematicAgentState *states, float *views, uint8_t *events, const KinematicParams &params, int numAgents,
+    float dt, int numSubsteps
+);
+
+}
+
+struct BatchedKinematics::Device
+{
+    template<typename T>
+    static T * alloc(size_t n)
+    {
+        void *ptr = nullptr;
+        TCHECK(cudaMalloc(&ptr, std::max(n, size_t(1)) * sizeof(T)) == cudaSuccess);
+        return static_cast<T *>(ptr);
+    }
+
+    Device(int numEnvs, int numAgents)
+    : grids{alloc<KinematicGrid>(size_t(numEnvs))}
+    , envVoxelPtrs{alloc<const uint8_t *>(size_t(numEnvs))}
+    , agentEnvs{alloc<int>(size_t(numAgents))}
+    , controls{alloc<KinematicControls>(size_t(numAgents))}
+    , states{alloc<KinematicAgentState>(size_t(numAgents))}
+    , views{alloc<float>(size_t(numAgents) * viewFloats)}
+    , events{alloc<uint8_t>(size_t(numAgents))}
+    , envVoxels(size_t(numEnvs), nullptr)
+    , envVoxelBytes(size_t(numEnvs), 0)
+    , dirty(size_t(numEnvs), 0)
+    {
+    }
+
+    ~Device()
+    {
+        for (auto *voxels : envVoxels)
+            cudaFree(voxels);
+
+        cudaFree(grids), cudaFree(envVoxelPtrs), cudaFree(agentEnvs), cudaFree(controls);
+        cudaFree(states), cudaFree(views), cudaFree(events);
+    }
+
+    KinematicGrid *grids;
+    const uint8_t **envVoxelPtrs;
+    int *agentEnvs;
+    KinematicControls *controls;
+    KinematicAgentState *states;
+    float *views;
+    uint8_t *events;
+
+    std::vector<uint8_t *> envVoxels;
+    std::vector<size_t> envVoxelBytes;
+
+    // envs synced since the last step, their voxels and agent states are uploaded by the next one
+    std::vector<uint8_t> dirty;
+};
+
+#else
+
+struct BatchedKinematics::Device
+{
+};
+
+#endif
+
+
+BatchedKinematics::BatchedKinematics(const Envs &envs, const KinematicParams &params)
+: params{params}
+, grids(envs.size(), KinematicGrid{})
+, envVoxels(envs.size())
+{
+    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
+        agentOffsets.push_back(int(agentEnvs.size()));
+        agentEnvs.insert(agentEnvs.end(), size_t(envs[envIdx]->getNumAgents()), envIdx);
+    }
+    agentOffsets.push_back(int(agentEnvs.size()));
+
+    states.resize(agentEnvs.size(), KinematicAgentState{});
+    views.resize(agentEnvs.size() * viewFloats);
+    events.resize(agentEnvs.size(), 0);
+    updateViews();
+
+#ifdef MEGAVERSE_CUDA_KINEMATICS
+    int numDevices = 0;
+    if (cudaGetDeviceCount(&numDevices) != cudaSuccess || numDevices == 0) {
+        cudaGetLastError();
+        TLOG(WARNING) << "No CUDA devices, batched kinematics run on the CPU";
+        return;
+    }
+
+    device = std::make_unique<Device>(int(envs.size()), numAgentsTotal());
+    TCHECK(cudaMemcpy(device->agentEnvs, agentEnvs.data(), agentEnvs.size() * sizeof(int), cudaMemcpyHostToDevice) == cudaSuccess);
+    TCHECK(cudaMemcpy(device->states, states.data(), states.size() * sizeof(KinematicAgentState), cudaMemcpyHostToDevice) == cudaSuccess);
+    TCHECK(cudaMemcpy(device->grids, grids.data(), grids.size() * sizeof(KinematicGrid), cudaMemcpyHostToDevice) == cudaSuccess);
+    TCHECK(cudaMemcpy(device->envVoxelPtrs, device->envVoxels.data(), device->envVoxels.size() * sizeof(uint8_t *), cudaMemcpyHostToDevice) == cudaSuccess);
+#endif
+}
+
+BatchedKinematics::~BatchedKinematics() = default;
+
+bool BatchedKinematics::onDevice() const
+{
+    return device != nullptr;
+}
+
+bool BatchedKinematics::syncEnv(int envIdx, Env &env, size_t maxGridVoxels)
+{
+    PROFILE_ZONE("BatchedKinematics::syncEnv");
+
+    const auto *query = env.getScenario().layoutVoxelQuery();
+    if (!query) {
+        TLOG(ERROR) << "Scenario " << env.getScenarioName() << " has no voxel grid";
+        return false;
+    }
+
+    const auto firstAgent = agentOffsets[envIdx];
+    auto &agents = env.getAgents();
+    if (int(agents.size()) != agentOffsets[envIdx + 1] - firstAgent) {
+        TLOG(ERROR) << "Env #" << envIdx << " has " << agents.size() << " agents instead of " << agentOffsets[envIdx + 1] - firstAgent;
+        return false;
+    }
+
+    for (auto *agent : agents) {
+        if (!dynamic_cast<VoxelKinematicAgent *>(agent)) {
+            TLOG(ERROR) << "Batched kinematics need VoxelKinematicAgents, see Str::voxelAgentController";
+            return false;
+        }
+    }
+
+    // box around the static solid voxels, movable objects are not copied
+    constexpr int maxInt = std::numeric_limits<int>::max();
+    VoxelCoords lo{maxInt}, hi{-maxInt};
+    query->forEachVoxel([&](const VoxelCoords &coords, const SymbolicVoxel &v) {
+        if ((v.voxelType & VOXEL_SOLID) && !v.object)
+            lo = Math::min(lo, coords), hi = Math::max(hi, coords);
+    });
+
+    KinematicGrid grid{};
+    std::vector<uint8_t> voxels;
+    if (lo.x() <= hi.x()) {
+        const auto size = hi - lo + VoxelCoords{1};
+        const auto numVoxels = size_t(size.x()) * size_t(size.y()) * size_t(size.z());
+        if (numVoxels > maxGridVoxels) {
+            TLOG(ERROR) << "Solid voxels of env #" << envIdx << " span " << numVoxels << " voxels, more than " << maxGridVoxels;
+            return false;
+        }
+
+        voxels.assign(numVoxels, 0);
+        query->forEachVoxel([&](const VoxelCoords &coords, const SymbolicVoxel &v) {
+            if ((v.voxelType & VOXEL_SOLID) && !v.object) {
+                const auto c = coords - lo;
+                voxels[(size_t(c.y()) * size_t(size.z()) + size_t(c.z())) * size_t(size.x()) + size_t(c.x())] = 1;
+            }
+        });
+
+        const auto origin = query->gridOrigin() + Vector3{lo} * query->voxelSize();
+        for (int axis = 0; axis < 3; ++axis)
+            grid.size[axis] = size[axis], grid.origin[axis] = origin[axis];
+        grid.voxelSize = query->voxelSize();
+    }
+
+    grids[envIdx] = grid;
+    envVoxels[envIdx] = std::move(voxels);
+
+    // agents start at rest, like after a teleport
+    for (int agentIdx = 0; agentIdx < int(agents.size()); ++agentIdx) {
+        auto *agent = agents[agentIdx];
+        const auto camera = agent->getCameraObject()->absoluteTransformation();
+        const auto position = camera.translation() - Vector3{0, params.cameraHeight, 0};
+        const auto forward = agent->forwardDirection();
+
+        auto &s = states[firstAgent + agentIdx];
+        s = KinematicAgentState{};
+        for (int axis = 0; axis < 3; ++axis)
+            s.position[axis] = position[axis];
+        s.yaw = std::atan2(-forward.x(), -forward.z());
+        s.pitch = std::asin(std::clamp(-camera.backward().y(), -1.0f, 1.0f));
+        s.grounded = agent->onGround();
+
+        events[firstAgent + agentIdx] = 0;
+        kinematicCameraView(params, s, views.data() + size_t(firstAgent + agentIdx) * viewFloats);
+    }
+
+#ifdef MEGAVERSE_CUDA_KINEMATICS
+    if (device)
+        device->dirty[envIdx] = 1;
+#endif
+
+    return true;
+}
+
+void BatchedKinematics::step(const KinematicControls *controls, float dt, int numSubsteps)
+{
+    PROFILE_ZONE("BatchedKinematics::step");
+
+    numSubsteps = std::max(numSubsteps, 1);
+    const auto numAgents = numAgentsTotal();
+
+#ifdef MEGAVERSE_CUDA_KINEMATICS
+    if (device) {
+        auto &d = *device;
+
+        bool voxelsMoved = false;
+        for (int envIdx = 0; envIdx < int(grids.size()); ++envIdx) {
+            if (!d.dirty[envIdx])
+                continue;
+
+            const auto &voxels = envVoxels[envIdx];
+            if (voxels.size() > d.envVoxelBytes[envIdx]) {
+                cudaFree(d.envVoxels[envIdx]);
+                d.envVoxels[envIdx] = Device::alloc<uint8_t>(voxels.size());
+                d.envVoxelBytes[envIdx] = voxels.size();
+                voxelsMoved = true;
+            }
+
+            if (!voxels.empty())
+                TCHECK(cudaMemcpy(d.envVoxels[envIdx], voxels.data(), voxels.size(), cudaMemcpyHostToDevice) == cudaSuccess);
+            TCHECK(cudaMemcpy(d.grids + envIdx, &grids[envIdx], sizeof(KinematicGrid), cudaMemcpyHostToDevice) == cudaSuccess);
+
+            // only the agents of this env, the host copy of the others may be stale
+            const auto first = size_t(agentOffsets[envIdx]);
+            const auto count = size_t(agentOffsets[envIdx + 1]) - first;
+            TCHECK(cudaMemcpy(d.states + first, states.data() + first, count * sizeof(KinematicAgentState), cudaMemcpyHostToDevice) == cudaSuccess);
+
+            d.dirty[envIdx] = 0;
+        }
+
+        if (voxelsMoved)
+            TCHECK(cudaMemcpy(d.envVoxelPtrs, d.envVoxels.data(), d.envVoxels.size() * sizeof(uint8_t *), cudaMemcpyHostToDevice) == cudaSuccess);
+
+        TCHECK(cudaMemcpy(d.controls, controls, size_t(numAgents) * sizeof(KinematicControls), cudaMemcpyHostToDevice) == cudaSuccess);
+        launchBatchedKinematics(d.grids, d.envVoxelPtrs, d.agentEnvs, d.controls, d.states, d.views, d.events, params, numAgents, dt, numSubsteps);
+
+        // the states stay on the device, only what the renderer and the scenario logic need comes back
+        TCHECK(cudaMemcpy(views.data(), d.views, views.size() * sizeof(float), cudaMemcpyDeviceToHost) == cudaSuccess);
+        TCHECK(cudaMemcpy(events.data(), d.events, events.size(), cudaMemcpyDeviceToHost) == cudaSuccess);
+        statesOnDevice = true;
+        return;
+    }
+#endif
+
+    for (int i = 0; i < numAgents; ++i) {
+        const auto envIdx = agentEnvs[i];
+        events[i] = integrateKinematicAgent(grids[envIdx], envVoxels[envIdx].data(), params, controls[i], states[i], dt, numSubsteps);
+    }
+
+    updateViews();
+}
+
+const std::vector<KinematicAgentState> & BatchedKinematics::getAgentStates()
+{
+#ifdef MEGAVERSE_CUDA_KINEMATICS
+    if (statesOnDevice) {
+        TCHECK(cudaMemcpy(states.data(), device->states, states.size() * sizeof(KinematicAgentState), cudaMemcpyDeviceToHost) == cudaSuccess);
+        statesOnDevice = false;
+    }
+#endif
+
+    return states;
+}
+
+void BatchedKinematics::updateViews()
+{
+    for (size_t i = 0; i < states.size(); ++i)
+        kinematicCameraView(params, states[i], views.data() + i * viewFloats);
+}
+
+size_t BatchedKinematics::memoryBytes() const
+{
+    size_t bytes = vectorBytes(agentOffsets) + vectorBytes(agentEnvs) + vectorBytes(grids) + vectorBytes(envVoxels);
+    bytes += vectorBytes(states) + vectorBytes(views) + vectorBytes(events);
+    for (const auto &voxels : envVoxels)
+        bytes += vectorBytes(voxels);
+
+    return bytes;
+}
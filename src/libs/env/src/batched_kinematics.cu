@@ -0,0 +1,49 @@
+#include <cuda_runtime.h>
+
+#include <util/tiny_logger.hpp>
+
+#include <env/kinematics_kernel.hpp>
+
+
+namespace Megaverse
+{
+
+namespace
+{
+
+__global__ void batchedKinematicsKernel(
+    const KinematicGrid *grids, const uint8_t *const *voxels, const int *agentEnvs, const KinematicControls *controls,
+    KinematicAgentState *states, float *views, uint8_t *events, KinematicParams params, int numAgents, float dt,
+    int numSubsteps
+)
+{
+    const auto i = int(blockIdx.x * blockDim.x + threadIdx.x);
+    if (i >= numAgents)
+        return;
+
+    const auto envIdx = agentEnvs[i];
+    auto state = states[i];
+    events[i] = integrateKinematicAgent(grids[envIdx], voxels[envIdx], params, controls[i], state, dt, numSubsteps);
+    kinematicCameraView(params, state, views + size_t(i) * 16);
+    states[i] = state;
+}
+
+}
+
+void launchBatchedKinematics(
+    const KinematicGrid *grids, const uint8_t *const *voxels, const int *agentEnvs, const KinematicControls *controls,
+    KinematicAgentState *states, float *views, uint8_t *events, const KinematicParams &params, int numAgents,
+    float dt, int numSubsteps
+)
+{
+    if (numAgents <= 0)
+        return;
+
+    constexpr int blockSize = 128;
+    const auto numBlocks = (numAgents + blockSize - 1) / blockSize;
+
+    batchedKinematicsKernel<<<numBlocks, blockSize>>>(grids, voxels, agentEnvs, controls, states, views, events, params, numAgents, dt, numSubsteps);
+    TCHECK(cudaGetLastError() == cudaSuccess);
+}
+
+}
@@ -1,11 +1,17 @@
+#include <cmath>
+#include <atomic>
 #include <random>
+#include <functional>
 
 #include <Magnum/SceneGraph/Camera.h>
 
 #include <util/tiny_logger.hpp>
+#include <util/scoped_profiler.hpp>
 
 #include <env/env.hpp>
 #include <env/scenario.hpp>
+#include <env/env_step.hpp>
+#include <env/episode_dataset.hpp>
 
 
 using namespace Magnum;
@@ -14,6 +20,41 @@ using namespace Magnum::Math::Literals;
 using namespace Megaverse;
 
 
+namespace
+{
+
+constexpr uint32_t snapshotMagic = 0x53535643;  // "CVSS"
+
+void saveTransforms(const Object3D &object, StateBuffer &buffer, uint32_t &numObjects)
+{
+    for (auto child = object.children().first(); child; child = child->nextSibling()) {
+        buffer.write(child->transformationMatrix());
+        ++numObjects;
+        saveTransforms(*child, buffer, numObjects);
+    }
+}
+
+void restoreTransforms(Object3D &object, StateReader &reader, uint32_t &numObjects)
+{
+    for (auto child = object.children().first(); child && reader.ok(); child = child->nextSibling()) {
+        child->setTransformation(reader.read<Matrix4>());
+        ++numObjects;
+        restoreTransforms(*child, reader, numObjects);
+    }
+}
+
+uint32_t countObjects(const Object3D &object)
+{
+    uint32_t numObjects = 0;
+    for (auto child = object.children().first(); child; child = child->nextSibling())
+        numObjects += 1 + countObjects(*child);
+
+    return numObjects;
+}
+
+}
+
+
 /**
 Left = 1 << 1,
 Right = 1 << 2,
@@ -39,116 +80,178 @@ Env::Env(const std::string &scenarioName, int numAgents, const FloatParams& cust
     , numAgents{numAgents}
 {
     scenario = Scenario::create(scenarioName, *this, state);
+    stepFunc = Scenario::registeredStepFunc(scenarioName);
+    if (!stepFunc)
+        stepFunc = stepScenario<Scenario>;
+
     scenario->init();
     scenario->setCustomParameters(customFloatParams);
-
-    // empty list of drawables for each supported drawable type
-    for (int drawableType = int(DrawableType::First); drawableType < int(DrawableType::NumTypes); ++drawableType)
-        drawables[DrawableType(drawableType)] = std::vector<SceneObjectInfo>{};
 }
 
 Env::~Env() = default;
 
-void Env::seed(int seedValue)
+bool Env::setPhysicsResources(std::shared_ptr<PhysicsResources> resources)
 {
-    state.rng.seed((unsigned long)seedValue);
+    if (state.physics->bWorld.getNumCollisionObjects() > 0) {
+        TLOG(ERROR) << "Physics resources can only be replaced before the first reset";
+        return false;
+    }
+
+    state.physics = std::make_unique<EnvPhysics>(std::move(resources), state.broadphase);
+    return true;
 }
 
-void Env::reset()
+void Env::seed(int seedValue, int stream)
 {
-    state.reset();
-
-    auto seed = randRange(0, 1 << 30, state.rng);
-    state.rng.seed((unsigned long)seed);
-    // TLOG(INFO) << "Using seed " << seed;
-
-    // remove dangling pointers from the previous episode
-    for (int drawableType = int(DrawableType::First); drawableType < int(DrawableType::NumTypes); ++drawableType)
-        drawables[DrawableType(drawableType)].clear();
-
-    scenario->reset();
+    state.seed = uint64_t(uint32_t(seedValue)), state.seedStream = uint32_t(stream);
+    state.numEpisodes = 0;
+    state.rng.seed(state.seed);
+}
 
-    scenario->spawnAgents(state.agents);
+int Env::episodeLayoutSeed(uint64_t episodeIdx) const
+{
+    if (episodeDataset && episodeDataset->size())
+        return episodeDataset->layoutSeed((datasetFirstEntry + episodeIdx * datasetEntryStride) % episodeDataset->size());
 
-    scenario->addEpisodeDrawables(drawables);
-    scenario->addEpisodeAgentsDrawables(drawables);
-    scenario->addUIDrawables(drawables);
+    auto rng = Rng::forStream(state.seed, state.seedStream, episodeIdx);
+    return randRange(0, 1 << 30, rng);
 }
 
-void Env::setAction(int agentIdx, Action action)
+void Env::reset()
 {
-    state.currAction[agentIdx] = action;
+    resetToEpisode(state.numEpisodes);
 }
 
-void Env::step()
+void Env::resetToEpisode(uint64_t episodeIdx)
 {
-    std::fill(state.lastReward.begin(), state.lastReward.end(), 0.0f);
+    state.numEpisodes = episodeIdx + 1;
+    resetWithLayoutSeed(episodeLayoutSeed(episodeIdx));
+}
 
-    const auto lastFrameDurationSec = state.lastFrameDurationSec;
+void Env::resetWithLayoutSeed(int seed)
+{
+    PROFILE_ZONE("Env::reset");
 
-    for (int i = 0; i < numAgents; ++i) {
-        const auto a = state.currAction[i];
-        const auto &agent = state.agents[i];
+    const auto physicsLock = state.physics->resources->lock();
 
-        auto acceleration = btVector3{0, 0, 0};
+    startReset(seed);
+    while (resetInProgress())
+        runResetStage();
+}
 
-        if (!!(a & Action::Forward))
-            acceleration += agent->forwardDirection();
-        else if (!!(a & Action::Backward))
-            acceleration -= agent->forwardDirection();
+void Env::beginReset()
+{
+    const auto episodeIdx = state.numEpisodes++;
+    startReset(episodeLayoutSeed(episodeIdx));
+}
 
-        if (!!(a & Action::Left))
-            acceleration += agent->strafeLeftDirection();
-        else if (!!(a & Action::Right))
-            acceleration -= agent->strafeLeftDirection();
+bool Env::continueReset(uint64_t budgetNs)
+{
+    PROFILE_ZONE("Env::continueReset");
 
-        if (!!(a & Action::LookLeft))
-            agent->lookLeft(lastFrameDurationSec);
-        else if (!!(a & Action::LookRight))
-            agent->lookRight(lastFrameDurationSec);
+    const auto physicsLock = state.physics->resources->lock();
+    const auto startNs = ScopedProfiler::nowNs();
 
-        if (!!(a & Action::LookUp))
-            agent->lookUp(lastFrameDurationSec);
-        else if (!!(a & Action::LookDown))
-            agent->lookDown(lastFrameDurationSec);
+    do
+        runResetStage();
+    while (resetInProgress() && ScopedProfiler::nowNs() - startNs < budgetNs);
 
-        // if (acceleration.length() > 0)
-        //    TLOG(INFO) << "acc direction: " << acceleration.x() << " " << acceleration.y() << " " << acceleration.z();
+    return !resetInProgress();
+}
 
-        agent->accelerate(acceleration, lastFrameDurationSec);
+void Env::startReset(int seed)
+{
+    resetSeed = seed;
+    resetStage = ResetStage::World;
+}
 
-        if (!!(a & Action::Jump))
-            agent->jump();
+void Env::runResetStage()
+{
+    switch (resetStage) {
+        case ResetStage::World: {
+            static std::atomic<uint64_t> nextEpisodeId{1};
+
+            state.broadphase = scenario->broadphaseOptions();
+            state.reset();
+            state.episodeId = nextEpisodeId.fetch_add(1, std::memory_order_relaxed);
+            state.layoutEpisodeId = state.episodeId;
+
+            state.rng.seed((unsigned long)resetSeed);
+            state.layoutSeed = resetSeed;
+
+            const auto entry = episodeDataset ? episodeDataset->find(resetSeed) : -1;
+            state.bakedLayout = entry >= 0 ? episodeDataset->layout(size_t(entry)) : nullptr;
+            state.bakedLayoutBytes = entry >= 0 ? episodeDataset->layoutBytes(size_t(entry)) : 0;
+            // TLOG(INFO) << "Using seed " << resetSeed;
+
+            // remove dangling pointers from the previous episode
+            for (auto &sceneObjects : drawables)
+                sceneObjects.clear();
+
+            resetStage = ResetStage::Scenario;
+            break;
+        }
+        case ResetStage::Scenario: {
+            PROFILE_ZONE("Scenario::reset");
+            scenario->reset();
+            resetStage = ResetStage::Agents;
+            break;
+        }
+        case ResetStage::Agents: {
+            scenario->spawnAgents(state.agents);
+
+            const auto layoutQuery = state.voxelCollisionFastPath ? scenario->layoutCollisionQuery() : nullptr;
+            for (auto agent : state.agents)
+                agent->setLayoutCollisionQuery(layoutQuery);
+
+            resetStage = ResetStage::Drawables;
+            break;
+        }
+        case ResetStage::Drawables:
+            scenario->addEpisodeDrawables(drawables);
+            resetStage = ResetStage::AgentDrawables;
+            break;
+        case ResetStage::AgentDrawables:
+            scenario->addEpisodeAgentsDrawables(drawables);
+            resetStage = ResetStage::Done;
+            break;
+        case ResetStage::Done:
+            break;
     }
+}
 
-    scenario->preStep();
-
-    state.physics->bWorld.stepSimulation(lastFrameDurationSec, 1, state.simulationStepSeconds);
-
-    for (auto agent : state.agents)
-        agent->updateTransform();
-
-    scenario->step();
-
-    state.currEpisodeSec += state.lastFrameDurationSec;
-
-    scenario->updateUI();
+bool Env::setEpisodeDataset(std::shared_ptr<const EpisodeDataset> dataset, uint64_t firstEntry, uint64_t entryStride)
+{
+    if (dataset && !dataset->matches(*this)) {
+        TLOG(ERROR) << "Episode dataset was baked for other parameters than " << EpisodeDataset::datasetKey(*this);
+        return false;
+    }
 
-    if (state.currEpisodeSec >= episodeLengthSec())
-        state.done = true;
+    episodeDataset = std::move(dataset);
+    datasetFirstEntry = firstEntry, datasetEntryStride = std::max<uint64_t>(entryStride, 1);
+    return true;
+}
 
-    // clear the actions
-    for (int i = 0; i < numAgents; ++i)
-        state.currAction[i] = Action::Idle;
+void Env::setAction(int agentIdx, Action action)
+{
+    state.currAction[agentIdx] = action;
+}
 
-    for (int i = 0; i < int(state.agents.size()); ++i) {
-        state.totalReward[i] += state.lastReward[i];
+void Env::step()
+{
+    const auto physicsLock = state.physics->resources->lock();
+    stepFunc(*this, StepPhase::Full);
+}
 
-//        if (fabs(state.lastReward[i]) > SIMD_EPSILON)
-//            TLOG(INFO) << "Last reward for agent #" << i << ":  " << state.lastReward[i] << ", total reward:  " << state.totalReward[i];
-    }
+void Env::simulate()
+{
+    const auto physicsLock = state.physics->resources->lock();
+    stepFunc(*this, StepPhase::Simulate);
+}
 
-    ++state.numFrames;
+void Env::finishStep()
+{
+    stepFunc(*this, StepPhase::Finish);
 }
 
 std::vector<Magnum::Color3> Env::getPalette() const
@@ -170,3 +273,169 @@ void Env::terminateEpisodeOnNextFrame()
 {
     scenario->doneWithTimer(0.001f);
 }
+
+void Env::hud(int agentIdx, std::vector<HudQuad> &quads) const
+{
+    scenario->hud(agentIdx, quads);
+}
+
+void Env::memoryReport(MemoryReport &report) const
+{
+    // rigid bodies and agents are bigger than plain nodes, they are counted in the physics below
+    report.add("scene_graph", countObjects(*state.scene) * sizeof(SceneNode));
+
+    const auto &world = state.physics->bWorld;
+    const auto numObjects = size_t(world.getNumCollisionObjects());
+    const auto numPairs = size_t(state.physics->bBroadphase->getOverlappingPairCache()->getNumOverlappingPairs());
+    const auto numManifolds = size_t(state.physics->bCollisionDispatcher.getNumManifolds());
+
+    // every object has a proxy and a leaf in the dynamic AABB tree, which has as many internal nodes as leaves
+    report.add("physics.objects", numObjects * (sizeof(btRigidBody) + sizeof(btDbvtProxy) + 2 * sizeof(btDbvtNode)));
+    report.add("physics.pairs", numPairs * sizeof(btBroadphasePair) + numManifolds * sizeof(btPersistentManifold));
+    report.add("physics.shapes", state.physics->collisionShapes.size() * sizeof(btBoxShape));
+
+    size_t drawablesBytes = 0;
+    for (const auto &d : drawables)
+        drawablesBytes += vectorBytes(d);
+    report.add("drawables", drawablesBytes);
+
+    report.add("episode_arena", state.episodeArena.bytesReserved());
+
+    scenario->memoryReport(report);
+}
+
+bool Env::saveState(StateBuffer &buffer) const
+{
+    buffer.clear();
+
+    buffer.write(snapshotMagic);
+    buffer.write(std::hash<std::string>{}(scenarioName));
+    buffer.write(numAgents);
+    buffer.write(state.layoutEpisodeId);
+    buffer.write(state.layoutSeed);
+
+    buffer.write(state.done);
+    buffer.write(state.numFrames);
+    buffer.write(state.currEpisodeSec);
+    buffer.write(state.lastFrameDurationSec);
+    buffer.write(state.currAction.data(), state.currAction.size() * sizeof(Action));
+    buffer.write(state.lastReward.data(), state.lastReward.size() * sizeof(float));
+    buffer.write(state.totalReward.data(), state.totalReward.size() * sizeof(float));
+    buffer.write(state.agentDone.data(), state.agentDone.size());
+    buffer.write(state.rng);
+
+    uint32_t numObjects = 0;
+    saveTransforms(*state.scene, buffer, numObjects);
+    buffer.write(numObjects);
+
+    const auto &objects = state.physics->bWorld.getCollisionObjectArray();
+    buffer.write(objects.size());
+    for (int i = 0; i < objects.size(); ++i) {
+        const auto *obj = objects[i];
+        buffer.write(obj->getWorldTransform());
+        buffer.write(obj->getCollisionFlags());
+        buffer.write(obj->getActivationState());
+        buffer.write(int(obj->getBroadphaseHandle()->m_collisionFilterGroup));
+        buffer.write(int(obj->getBroadphaseHandle()->m_collisionFilterMask));
+
+        if (const auto *body = btRigidBody::upcast(obj)) {
+            buffer.write(body->getLinearVelocity());
+            buffer.write(body->getAngularVelocity());
+        }
+    }
+
+    for (auto agent : state.agents)
+        agent->saveState(buffer);
+
+    return scenario->saveState(buffer);
+}
+
+bool Env::restoreState(const StateBuffer &buffer)
+{
+    const auto physicsLock = state.physics->resources->lock();
+    StateReader reader{buffer};
+
+    if (reader.read<uint32_t>() != snapshotMagic || reader.read<size_t>() != std::hash<std::string>{}(scenarioName)
+        || reader.read<int>() != numAgents) {
+        TLOG(ERROR) << "Snapshot does not belong to a " << scenarioName << " env with " << numAgents << " agents";
+        return false;
+    }
+
+    const auto layoutEpisodeId = reader.read<uint64_t>();
+    const auto layoutSeed = reader.read<int>();
+    if (layoutEpisodeId != state.layoutEpisodeId) {
+        resetWithLayoutSeed(layoutSeed);
+        state.layoutEpisodeId = layoutEpisodeId;
+    }
+
+    reader.read(state.done);
+    reader.read(state.numFrames);
+    reader.read(state.currEpisodeSec);
+    reader.read(state.lastFrameDurationSec);
+    reader.read(state.currAction.data(), state.currAction.size() * sizeof(Action));
+    reader.read(state.lastReward.data(), state.lastReward.size() * sizeof(float));
+    reader.read(state.totalReward.data(), state.totalReward.size() * sizeof(float));
+    reader.read(state.agentDone.data(), state.agentDone.size());
+    reader.read(state.rng);
+
+    uint32_t numObjects = 0;
+    restoreTransforms(*state.scene, reader, numObjects);
+    if (reader.read<uint32_t>() != numObjects) {
+        TLOG(ERROR) << "Scene graph of the snapshot does not match, " << numObjects << " objects in the env";
+        return false;
+    }
+
+    auto &bWorld = state.physics->bWorld;
+    auto &objects = bWorld.getCollisionObjectArray();
+    if (reader.read<int>() != objects.size()) {
+        TLOG(ERROR) << "Number of collision objects in the snapshot does not match, " << objects.size() << " in the env";
+        return false;
+    }
+
+    for (int i = 0; i < objects.size(); ++i) {
+        auto *obj = objects[i];
+        const auto transform = reader.read<btTransform>();
+        obj->setWorldTransform(transform);
+        obj->setInterpolationWorldTransform(transform);
+        obj->setCollisionFlags(reader.read<int>());
+        obj->forceActivationState(reader.read<int>());
+
+        // collision filters change when objects are picked up, the proxy is re-created so that its pairs match
+        auto *proxy = obj->getBroadphaseHandle();
+        const auto group = reader.read<int>(), mask = reader.read<int>();
+        if (proxy->m_collisionFilterGroup != group || proxy->m_collisionFilterMask != mask) {
+            proxy->m_collisionFilterGroup = group, proxy->m_collisionFilterMask = mask;
+            bWorld.refreshBroadphaseProxy(obj);
+        }
+
+        if (auto *body = btRigidBody::upcast(obj)) {
+            body->setLinearVelocity(reader.read<btVector3>());
+            body->setAngularVelocity(reader.read<btVector3>());
+            body->setInterpolationLinearVelocity(body->getLinearVelocity());
+            body->setInterpolationAngularVelocity(body->getAngularVelocity());
+        }
+    }
+
+    for (auto agent : state.agents)
+        agent->restoreState(reader);
+
+    scenario->restoreState(reader);
+
+    if (!reader.finished()) {
+        TLOG(ERROR) << "Snapshot does not match the state layout of " << scenarioName;
+        return false;
+    }
+
+    // broadphase and ghost object pairs, so the next step sees the same contacts
+    bWorld.updateAabbs();
+    bWorld.computeOverlappingPairs();
+
+    return true;
+}
+
+bool Env::clone(Env &target) const
+{
+    // reused between clones, one per thread so that different envs can be cloned concurrently
+    thread_local StateBuffer buffer;
+    return saveState(buffer) && target.restoreState(buffer);
+}
@@ -0,0 +1,135 @@
+#include <map>
+#include <vector>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+#include <util/tiny_logger.hpp>
+#include <util/state_buffer.hpp>
+
+#include <env/env.hpp>
+#include <env/scenario.hpp>
+#include <env/episode_dataset.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+/// [offset, offset + count * elemSize) lies within a file of this size, without overflowing on corrupt entries.
+bool rangeInFile(uint64_t offset, uint64_t count, uint64_t elemSize, uint64_t fileSize)
+{
+    return offset <= fileSize && count <= (fileSize - offset) / elemSize;
+}
+
+}
+
+
+bool EpisodeDataset::bake(Env &env, uint64_t numEpisodes, const std::string &filename)
+{
+    // ordered by seed, which is the order of the entry table
+    std::map<int, std::vector<uint8_t>> layouts;
+
+    // scenarios with a layout cache bake the layouts they record for it
+    env.getScenario().reserveLayoutCache(1);
+
+    StateBuffer buffer;
+    for (uint64_t episode = 0; episode < numEpisodes; ++episode) {
+        const auto seed = env.episodeLayoutSeed(episode);
+        if (layouts.count(seed))
+            continue;
+
+        env.resetWithLayoutSeed(seed);
+
+        buffer.clear();
+        if (!env.getScenario().bakeLayout(buffer)) {
+            TLOG(ERROR) << "Scenario " << env.getScenarioName() << " does not support episode datasets";
+            return false;
+        }
+
+        layouts[seed].assign(buffer.data(), buffer.data() + buffer.size());
+    }
+
+    const auto key = datasetKey(env);
+
+    Header h{};
+    memcpy(h.magic, magic, sizeof(magic));
+    h.version = formatVersion;
+    h.keyBytes = uint32_t(key.size());
+    h.numEntries = layouts.size();
+
+    std::vector<char> file(entriesOffset(h) + layouts.size() * sizeof(Entry));
+    memcpy(file.data(), &h, sizeof(h));
+    memcpy(file.data() + sizeof(h), key.data(), key.size());
+
+    size_t entryIdx = 0;
+    for (const auto &[seed, layout] : layouts) {
+        // layouts start at 8-byte boundaries, scenarios read them with memcpy anyway
+        file.resize((file.size() + 7) / 8 * 8);
+
+        const Entry entry{seed, 0, file.size(), layout.size()};
+        memcpy(file.data() + entriesOffset(h) + entryIdx++ * sizeof(Entry), &entry, sizeof(entry));
+        file.insert(file.end(), layout.begin(), layout.end());
+    }
+
+    if (!writeFileAtomic(filename, file.data(), file.size())) {
+        TLOG(ERROR) << "Could not write the episode dataset to " << filename;
+        return false;
+    }
+
+    TLOG(INFO) << "Baked " << layouts.size() << " episodes of " << env.getScenarioName() << " into " << filename;
+    return true;
+}
+
+std::shared_ptr<const EpisodeDataset> EpisodeDataset::load(const std::string &filename)
+{
+    auto file = std::make_unique<MappedFile>(filename);
+    if (!file->isOpen() || file->size() < sizeof(Header)) {
+        TLOG(ERROR) << "Could not open the episode dataset " << filename;
+        return nullptr;
+    }
+
+    Header h{};
+    memcpy(&h, file->data(), sizeof(h));
+    if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != formatVersion) {
+        TLOG(ERROR) << filename << " is not an episode dataset of version " << formatVersion;
+        return nullptr;
+    }
+
+    // only the table is checked here, the layouts stay untouched until they are used
+    bool valid = rangeInFile(entriesOffset(h), h.numEntries, sizeof(Entry), file->size());
+    const auto *table = reinterpret_cast<const Entry *>(file->data() + entriesOffset(h));
+    for (uint64_t i = 0; valid && i < h.numEntries; ++i)
+        valid = rangeInFile(table[i].offset, table[i].size, 1, file->size()) && (i == 0 || table[i - 1].layoutSeed < table[i].layoutSeed);
+
+    if (!valid) {
+        TLOG(ERROR) << "Episode dataset " << filename << " is truncated";
+        return nullptr;
+    }
+
+    std::shared_ptr<EpisodeDataset> dataset{new EpisodeDataset};
+    dataset->key.assign(file->data() + sizeof(Header), h.keyBytes);
+    dataset->mapped = std::move(file);
+    return dataset;
+}
+
+std::string EpisodeDataset::datasetKey(Env &env)
+{
+    std::ostringstream key;
+    key << env.getScenarioName() << ':' << env.getNumAgents();
+
+    for (const auto &[k, v] : env.getScenario().getFloatParams())
+        key << ':' << k << '=' << v;
+
+    return key.str();
+}
+
+int64_t EpisodeDataset::find(int layoutSeed) const
+{
+    const auto *begin = entries(), *end = entries() + size();
+    const auto it = std::lower_bound(begin, end, layoutSeed, [](const Entry &e, int seed) { return e.layoutSeed < seed; });
+
+    return it != end && it->layoutSeed == layoutSeed ? it - begin : -1;
+}
@@ -0,0 +1,108 @@
+#include <map>
+#include <algorithm>
+
+#include <util/os_utils.hpp>
+#include <util/tiny_logger.hpp>
+#include <util/scoped_profiler.hpp>
+
+#include <env/scenario.hpp>
+#include <env/episode_pregenerator.hpp>
+
+
+using namespace Megaverse;
+
+
+EpisodePregenerator::EpisodePregenerator(const Envs &envs, EnvFactory makeEnv, int queueDepth, int numThreads)
+: makeEnv{std::move(makeEnv)}
+, queueDepth{std::max(queueDepth, 1)}
+, nextEpisode(envs.size())
+, queuedUpTo(envs.size())
+{
+    // prepared layouts must survive in the cache until the envs get to them
+    const auto numLayouts = envs.size() * size_t(this->queueDepth + 1);
+
+    for (const auto &env : envs) {
+        scenarioNames.emplace_back(env->getScenarioName());
+        supported.push_back(env->getScenario().reserveLayoutCache(numLayouts));
+        if (!supported.back())
+            TLOG(DEBUG) << "Scenario " << env->getScenarioName() << " does not cache layouts, episodes are not pregenerated";
+    }
+
+    for (int i = 0; i < numThreads; ++i)
+        threads.emplace_back([this] { generatorLoop(); });
+}
+
+EpisodePregenerator::~EpisodePregenerator()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stop = true;
+    }
+
+    cv.notify_all();
+    for (auto &t : threads)
+        t.join();
+}
+
+void EpisodePregenerator::episodeStarted(int envIdx, const Env &env)
+{
+    if (!supported[envIdx])
+        return;
+
+    const auto next = env.nextEpisodeIdx();
+    nextEpisode[envIdx].store(next, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+
+        // usually only the episode that just came into the window is new, unless the env jumped (i.e. resetToEpisode())
+        auto first = std::max(next, queuedUpTo[envIdx]);
+        if (first > next + queueDepth)
+            first = next;
+
+        for (auto episodeIdx = first; episodeIdx < next + queueDepth; ++episodeIdx)
+            requests.push_back({envIdx, episodeIdx, env.episodeLayoutSeed(episodeIdx)});
+
+        queuedUpTo[envIdx] = next + queueDepth;
+    }
+
+    cv.notify_one();
+}
+
+void EpisodePregenerator::generatorLoop()
+{
+    // only use the CPU time the simulation threads leave
+    if (!setThreadIdlePriority(pthread_self()))
+        TLOG(DEBUG) << "Could not lower the priority of the episode generator thread";
+
+    // scratch envs of this thread, by scenario
+    std::map<std::string, std::unique_ptr<Env>> scratchEnvs;
+
+    while (true) {
+        Request request{};
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            cv.wait(lock, [this] { return stop || !requests.empty(); });
+            if (stop)
+                break;
+
+            request = requests.front();
+            requests.pop_front();
+        }
+
+        // the env got there first
+        if (request.episodeIdx < nextEpisode[request.envIdx].load(std::memory_order_relaxed))
+            continue;
+
+        auto &scratch = scratchEnvs[scenarioNames[request.envIdx]];
+        if (!scratch)
+            scratch = makeEnv(request.envIdx);
+
+        if (scratch->getScenario().isLayoutCached(request.layoutSeed))
+            continue;
+
+        PROFILE_ZONE("EpisodePregenerator::generate");
+        scratch->resetWithLayoutSeed(request.layoutSeed);
+        generated.fetch_add(1, std::memory_order_relaxed);
+    }
+}
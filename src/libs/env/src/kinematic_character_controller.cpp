@@ -7,8 +7,10 @@
 #include "BulletCollision/CollisionDispatch/btCollisionWorld.h"
 #include "LinearMath/btDefaultMotionState.h"
 
+#include <env/physics.hpp>
 #include <env/kinematic_character_controller.hpp>
 #include <util/tiny_logger.hpp>
+#include <util/scoped_profiler.hpp>
 
 
 using namespace Megaverse;
@@ -122,6 +124,7 @@ btVector3 KinematicCharacterController::perpindicularComponent(const btVector3&
 KinematicCharacterController::KinematicCharacterController(btPairCachingGhostObject* ghostObject, btConvexShape* convexShape, btScalar stepHeight, const btVector3& up)
 {
     m_ghostObject = ghostObject;
+    m_previousPosition = ghostObject->getWorldTransform().getOrigin();
     m_up.setValue(0.0f, 1.0f, 0.0f);
     m_jumpAxis.setValue(0.0f, 1.0f, 0.0f);
     horizontalVelocity.setValue(0.0, 0.0, 0.0);
@@ -155,6 +158,8 @@ btPairCachingGhostObject* KinematicCharacterController::getGhostObject()
 
 bool KinematicCharacterController::recoverFromPenetration(btCollisionWorld* collisionWorld, int /*iteration*/)
 {
+    PROFILE_ZONE("KCC::recoverFromPenetration");
+
     // Here we must refresh the overlapping paircache as the penetrating movement itself or the
     // previous recovery iteration might have used setWorldTransform and pushed us into an object
     // that is not in the previous cache contents from the last timestep, as will happen if we
@@ -220,8 +225,46 @@ bool KinematicCharacterController::recoverFromPenetration(btCollisionWorld* coll
     return penetration;
 }
 
+uint64_t KinematicCharacterController::contactSignature() const
+{
+    // FNV-1a over the other objects of the overlapping pairs and their origins
+    uint64_t h = 14695981039346656037ULL;
+    const auto mix = [&h](const void *data, size_t size) {
+        for (size_t i = 0; i < size; ++i)
+            h = (h ^ static_cast<const uint8_t *>(data)[i]) * 1099511628211ULL;
+    };
+
+    const auto &pairs = m_ghostObject->getOverlappingPairCache()->getOverlappingPairArray();
+    for (int i = 0; i < pairs.size(); ++i) {
+        const auto *proxy = pairs[i].m_pProxy0->m_clientObject == m_ghostObject ? pairs[i].m_pProxy1 : pairs[i].m_pProxy0;
+        const auto *obj = static_cast<const btCollisionObject *>(proxy->m_clientObject);
+        mix(&obj, sizeof(obj));
+        mix(obj->getWorldTransform().getOrigin().m_floats, 3 * sizeof(btScalar));
+    }
+
+    return h;
+}
+
+void KinematicCharacterController::excludeFreeLayout(int &collisionFilterMask, const btTransform &start, const btTransform &end) const
+{
+    if (!m_layoutQuery)
+        return;
+
+    btVector3 aabbMin, aabbMax, endMin, endMax;
+    m_convexShape->getAabb(start, aabbMin, aabbMax);
+    m_convexShape->getAabb(end, endMin, endMax);
+    aabbMin.setMin(endMin), aabbMax.setMax(endMax);
+
+    // be conservative: touching contacts (within the margins) still count as collisions
+    const btScalar eps = 0.05f;
+    if (!m_layoutQuery->layoutInAabb(aabbMin - btVector3{eps, eps, eps}, aabbMax + btVector3{eps, eps, eps}))
+        collisionFilterMask &= ~layoutCollisionGroup;
+}
+
 void KinematicCharacterController::stepUp(btCollisionWorld* world)
 {
+    PROFILE_ZONE("KCC::stepUp");
+
     btScalar stepHeight = 0.0f;
     if (m_verticalVelocity < 0.0)
         stepHeight = m_stepHeight;
@@ -246,6 +289,7 @@ void KinematicCharacterController::stepUp(btCollisionWorld* world)
     KinematicClosestNotMeConvexResultCallback callback(m_ghostObject, -m_up, m_maxSlopeCosine);
     callback.m_collisionFilterGroup = getGhostObject()->getBroadphaseHandle()->m_collisionFilterGroup;
     callback.m_collisionFilterMask = getGhostObject()->getBroadphaseHandle()->m_collisionFilterMask;
+    excludeFreeLayout(callback.m_collisionFilterMask, start, end);
 
     if (m_useGhostObjectSweepTest)
     {
@@ -336,6 +380,8 @@ void KinematicCharacterController::updateTargetPositionBasedOnCollision(const bt
  */
 void KinematicCharacterController::stepForwardAndStrafe(btCollisionWorld* collisionWorld, const btVector3& horizontalVelocity, btScalar dt)
 {
+    PROFILE_ZONE("KCC::stepForwardAndStrafe");
+
     m_targetPosition = m_currentPosition + horizontalVelocity * dt;
 
     btTransform start, end;
@@ -360,6 +406,7 @@ void KinematicCharacterController::stepForwardAndStrafe(btCollisionWorld* collis
 
         if (!(start == end)) {
             // desired movement is > 0
+            excludeFreeLayout(callback.m_collisionFilterMask, start, end);
             m_ghostObject->convexSweepTest(m_convexShape, start, end, callback, collisionWorld->getDispatchInfo().m_allowedCcdPenetration);
         }
 
@@ -399,6 +446,8 @@ void KinematicCharacterController::stepForwardAndStrafe(btCollisionWorld* collis
  */
 void KinematicCharacterController::stepDown(btCollisionWorld *collisionWorld, btScalar dt)
 {
+    PROFILE_ZONE("KCC::stepDown");
+
     btScalar downVelocity = (m_verticalVelocity < 0.f ? -m_verticalVelocity : 0.f);
 
     // limit fall terminal velocity??
@@ -422,6 +471,7 @@ void KinematicCharacterController::stepDown(btCollisionWorld *collisionWorld, bt
         start.setRotation(m_currentOrientation);
         end.setRotation(m_targetOrientation);
 
+        excludeFreeLayout(callback.m_collisionFilterMask, start, end);
         m_ghostObject->convexSweepTest(m_convexShape, start, end, callback, collisionWorld->getDispatchInfo().m_allowedCcdPenetration);
     }
 
@@ -512,6 +562,8 @@ void KinematicCharacterController::warp(const btVector3& origin)
     xform.setIdentity();
     xform.setOrigin(origin);
     m_ghostObject->setWorldTransform(xform);
+    m_previousPosition = origin;
+    m_resting = false;
     horizontalVelocity.setValue(0, 0, 0);
     m_verticalVelocity = 0;
 }
@@ -527,8 +579,19 @@ void KinematicCharacterController::preStep(btCollisionWorld* /*collisionWorld*/)
 
 void KinematicCharacterController::playerStep(btCollisionWorld* collisionWorld, btScalar dt)
 {
+    PROFILE_ZONE("KCC::playerStep");
+
     const auto originalPosition = m_currentPosition;
 
+    // An idle agent standing on the ground: if the previous step did not move it and nothing around it has changed,
+    // this step would not move it either, so the sweeps and the penetration recovery can be skipped.
+    const bool idle = onGround() && horizontalVelocity.fuzzyZero() && m_AngVel.fuzzyZero();
+    const auto contacts = idle ? contactSignature() : 0;
+    if (idle && m_resting && originalPosition == m_restingPosition && contacts == m_restingContacts) {
+        m_wasOnGround = true;
+        return;
+    }
+
     if (m_AngVel.length2() > 0.0f)
         m_AngVel *= btPow(btScalar(1) - m_angularDamping, dt);
 
@@ -598,6 +661,14 @@ void KinematicCharacterController::playerStep(btCollisionWorld* collisionWorld,
             horizontalVelocity *= (currHorizontalSpeed - normalDeceleration * dt) / currHorizontalSpeed;
     }
 
+    // positions of a resting agent only change by the floating point noise of the sweeps
+    constexpr btScalar restingDistance2 = 1e-8f;
+    m_resting = idle && onGround() && !m_touchingContact && (m_currentPosition - originalPosition).length2() < restingDistance2;
+    if (m_resting) {
+        m_restingPosition = m_ghostObject->getWorldTransform().getOrigin();
+        m_restingContacts = contacts;
+    }
+
 //     TLOG(INFO) << "Horizontal speed: " << horizontalVelocity.length();
 }
 
@@ -676,6 +747,33 @@ btScalar KinematicCharacterController::getMaxPenetrationDepth() const
     return m_maxPenetrationDepth;
 }
 
+KinematicCharacterController::State KinematicCharacterController::getState() const
+{
+    State s;
+    s.horizontalVelocity = horizontalVelocity, s.angularVelocity = m_AngVel;
+    s.jumpPosition = m_jumpPosition, s.jumpAxis = m_jumpAxis;
+    s.currentPosition = m_currentPosition, s.targetPosition = m_targetPosition, s.touchingNormal = m_touchingNormal;
+    s.previousPosition = m_previousPosition;
+    s.currentOrientation = m_currentOrientation, s.targetOrientation = m_targetOrientation;
+    s.verticalVelocity = m_verticalVelocity, s.verticalOffset = m_verticalOffset;
+    s.currentStepOffset = m_currentStepOffset, s.jumpSpeed = m_jumpSpeed;
+    s.touchingContact = m_touchingContact, s.wasOnGround = m_wasOnGround, s.wasJumping = m_wasJumping;
+    return s;
+}
+
+void KinematicCharacterController::setState(const State &s)
+{
+    horizontalVelocity = s.horizontalVelocity, m_AngVel = s.angularVelocity;
+    m_jumpPosition = s.jumpPosition, m_jumpAxis = s.jumpAxis;
+    m_currentPosition = s.currentPosition, m_targetPosition = s.targetPosition, m_touchingNormal = s.touchingNormal;
+    m_previousPosition = s.previousPosition;
+    m_resting = false;
+    m_currentOrientation = s.currentOrientation, m_targetOrientation = s.targetOrientation;
+    m_verticalVelocity = s.verticalVelocity, m_verticalOffset = s.verticalOffset;
+    m_currentStepOffset = s.currentStepOffset, m_jumpSpeed = s.jumpSpeed;
+    m_touchingContact = s.touchingContact, m_wasOnGround = s.wasOnGround, m_wasJumping = s.wasJumping;
+}
+
 bool KinematicCharacterController::onGround() const
 {
     return (fabs(m_verticalVelocity) < SIMD_EPSILON) && (fabs(m_verticalOffset) < SIMD_EPSILON);
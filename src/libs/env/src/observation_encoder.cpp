@@ -0,0 +1,54 @@
+#include <cstring>
+#include <numeric>
+
+#include <util/scoped_profiler.hpp>
+
+#include <env/observation_encoder.hpp>
+
+
+using namespace Megaverse;
+
+
+ObservationEncoder::ObservationEncoder(const Envs &envs, size_t frameBytes, int keyframeInterval)
+: frameBytes{frameBytes}
+, slotBytes{FrameEncoder::maxEncodedBytes(frameBytes)}
+{
+    int numAgentsTotal = 0;
+    for (const auto &env : envs) {
+        agentOffsets.push_back(numAgentsTotal);
+        numAgentsTotal += env->getNumAgents();
+    }
+
+    encoders.assign(size_t(numAgentsTotal), FrameEncoder{frameBytes, keyframeInterval});
+    data.resize(size_t(numAgentsTotal) * slotBytes);
+    encodedSizes.resize(size_t(numAgentsTotal));
+    scratch.resize(size_t(numAgentsTotal));
+}
+
+void ObservationEncoder::encodeEnv(int envIdx, const EnvRenderer &renderer, bool keyframe)
+{
+    PROFILE_ZONE("ObservationEncoder::encode");
+
+    const auto numAgents = (envIdx + 1 < int(agentOffsets.size()) ? agentOffsets[envIdx + 1] : int(encoders.size())) - agentOffsets[envIdx];
+    for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx) {
+        const auto i = size_t(agentOffsets[envIdx] + agentIdx);
+
+        auto &encoded = scratch[i];
+        encoded.clear();
+        encoders[i].encode(renderer.getObservation(envIdx, agentIdx), keyframe, encoded);
+
+        memcpy(data.data() + i * slotBytes, encoded.data(), encoded.size());
+        encodedSizes[i] = uint32_t(encoded.size());
+    }
+}
+
+void ObservationEncoder::requestKeyframes()
+{
+    for (auto &encoder : encoders)
+        encoder.requestKeyframe();
+}
+
+size_t ObservationEncoder::totalEncodedBytes() const
+{
+    return std::accumulate(encodedSizes.begin(), encodedSizes.end(), size_t(0));
+}
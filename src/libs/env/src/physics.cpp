@@ -0,0 +1,192 @@
+#include <new>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include <unordered_map>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+#include <env/physics.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+size_t allocationSize(void *mem)
+{
+#ifdef __APPLE__
+    return malloc_size(mem);
+#else
+    return malloc_usable_size(mem);
+#endif
+}
+
+/**
+ * Same as the default Bullet allocator (plain malloc), the sizes come from the allocator itself, so blocks
+ * allocated before the hooks were installed can still be freed through them.
+ */
+void * countingAlloc(size_t size)
+{
+    auto mem = malloc(size);
+    if (mem)
+        BulletMemory::counter().allocated(allocationSize(mem));
+
+    return mem;
+}
+
+void countingFree(void *mem)
+{
+    if (!mem)
+        return;
+
+    BulletMemory::counter().freed(allocationSize(mem));
+    free(mem);
+}
+
+struct FreeList
+{
+    ~FreeList()
+    {
+        for (auto mem : blocks)
+            btAlignedFree(mem);
+    }
+
+    std::vector<void *> blocks;
+};
+
+thread_local FreeList freeRigidBodies;
+
+
+// shapes are keyed by the scaling quantized to 1e-4
+using ShapeKey = std::tuple<int64_t, int64_t, int64_t>;
+
+struct ShapeKeyHash
+{
+    size_t operator()(const ShapeKey &k) const
+    {
+        auto h = size_t(std::get<0>(k));
+        h = h * 1000003 ^ size_t(std::get<1>(k));
+        h = h * 1000003 ^ size_t(std::get<2>(k));
+        return h;
+    }
+};
+
+ShapeKey shapeKey(const btVector3 &scaling)
+{
+    const auto q = [](btScalar v) { return int64_t(std::llround(double(v) * 1e4)); };
+    return {q(scaling.x()), q(scaling.y()), q(scaling.z())};
+}
+
+std::unique_ptr<btBoxShape> makeSharedBox(const btVector3 &scaling, int userIndex)
+{
+    // exactly the same as a unit box rescaled in place, including the margin handling
+    auto shape = std::make_unique<btBoxShape>(btVector3{1, 1, 1});
+    shape->setLocalScaling(scaling);
+    shape->setUserIndex(userIndex);
+    return shape;
+}
+
+std::mutex shapesMutex;
+std::unordered_map<ShapeKey, std::unique_ptr<btBoxShape>, ShapeKeyHash> sharedShapes;
+
+// most lookups hit this and don't need the lock
+thread_local std::unordered_map<ShapeKey, btCollisionShape *, ShapeKeyHash> localShapes;
+
+}
+
+
+void BulletMemory::installHooks()
+{
+    static std::once_flag installed;
+    std::call_once(installed, [] { btAlignedAllocSetCustom(countingAlloc, countingFree); });
+}
+
+MemoryCounter & BulletMemory::counter()
+{
+    static MemoryCounter bulletMemory;
+    return bulletMemory;
+}
+
+btRigidBody * RigidBodyPool::acquire(const btRigidBody::btRigidBodyConstructionInfo &info)
+{
+    auto &blocks = freeRigidBodies.blocks;
+
+    void *mem;
+    if (blocks.empty())
+        mem = btAlignedAlloc(sizeof(btRigidBody), 16);  // same as btRigidBody::operator new
+    else
+        mem = blocks.back(), blocks.pop_back();
+
+    return new (mem) btRigidBody(info);
+}
+
+void RigidBodyPool::release(btRigidBody *body)
+{
+    if (!body)
+        return;
+
+    body->~btRigidBody();
+
+    auto &blocks = freeRigidBodies.blocks;
+    if (blocks.size() < maxPoolSize)
+        blocks.emplace_back(body);
+    else
+        btAlignedFree(body);
+}
+
+btCollisionShape * CollisionShapeCache::unitBox()
+{
+    return box(btVector3{1, 1, 1});
+}
+
+btCollisionShape * CollisionShapeCache::box(const btVector3 &scaling)
+{
+    const auto key = shapeKey(scaling);
+
+    auto it = localShapes.find(key);
+    if (it != localShapes.end())
+        return it->second;
+
+    btCollisionShape *shape;
+    {
+        std::lock_guard<std::mutex> lock{shapesMutex};
+        auto &sharedShape = sharedShapes[key];
+        if (!sharedShape)
+            sharedShape = makeSharedBox(scaling, sharedShapeUserIndex);
+
+        shape = sharedShape.get();
+    }
+
+    localShapes.emplace(key, shape);
+    return shape;
+}
+
+size_t CollisionShapeCache::numShapes()
+{
+    std::lock_guard<std::mutex> lock{shapesMutex};
+    return sharedShapes.size();
+}
+
+std::unique_ptr<btBroadphaseInterface> Megaverse::createBroadphase(const BroadphaseOptions &options)
+{
+    if (options.type == BroadphaseType::DynamicTree)
+        return std::make_unique<btDbvtBroadphase>();
+
+    const btVector3 min{options.bounds.min()}, max{options.bounds.max()};
+
+    // 16-bit handles are half the memory, one handle is reserved as the sentinel
+    if (options.maxObjects < 0x7fff)
+        return std::make_unique<btAxisSweep3>(min, max, static_cast<unsigned short>(options.maxObjects));
+
+    return std::make_unique<bt32BitAxisSweep3>(min, max, static_cast<unsigned int>(options.maxObjects));
+}
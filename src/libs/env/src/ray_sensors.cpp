@@ -0,0 +1,208 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <LinearMath/btAabbUtil2.h>
+
+#include <util/scoped_profiler.hpp>
+
+#include <env/scenario.hpp>
+#include <env/voxel_state.hpp>
+#include <env/ray_sensors.hpp>
+
+
+using namespace Magnum;
+using namespace Megaverse;
+
+
+namespace
+{
+
+RayHitType hitType(const btCollisionObject *obj)
+{
+    const auto group = obj->getBroadphaseHandle() ? obj->getBroadphaseHandle()->m_collisionFilterGroup : 0;
+
+    if (group & btBroadphaseProxy::CharacterFilter)
+        return RAY_HIT_AGENT;
+    if (group & (layoutCollisionGroup | btBroadphaseProxy::StaticFilter))
+        return RAY_HIT_LAYOUT;
+    return RAY_HIT_OBJECT;
+}
+
+/**
+ * 3D DDA through the solid voxels of the layout, up to maxDistance (world units, dir is normalized).
+ * The voxel that contains the origin is ignored, so agents that touch a wall still see past it.
+ * @return distance to the first solid voxel or a negative number if there is none
+ */
+float traceLayout(const LayoutVoxelQuery &query, const Vector3 &origin, const Vector3 &dir, float maxDistance)
+{
+    const auto voxelSize = query.voxelSize();
+    const auto g = (origin - query.gridOrigin()) / voxelSize;
+    const auto maxT = maxDistance / voxelSize;
+    constexpr auto noHit = std::numeric_limits<float>::max();
+
+    VoxelCoords cell, step;
+    Vector3 tNext, tDelta;
+    for (int i = 0; i < 3; ++i) {
+        cell[i] = int(std::floor(g[i]));
+        step[i] = dir[i] > 0 ? 1 : -1;
+
+        if (std::abs(dir[i]) < 1e-8f) {
+            tNext[i] = tDelta[i] = noHit;
+            continue;
+        }
+
+        const auto boundary = float(cell[i] + (dir[i] > 0 ? 1 : 0));
+        tNext[i] = (boundary - g[i]) / dir[i];
+        tDelta[i] = std::abs(1.0f / dir[i]);
+    }
+
+    SymbolicVoxel v;
+    while (true) {
+        const auto axis = tNext.x() < tNext.y() ? (tNext.x() < tNext.z() ? 0 : 2) : (tNext.y() < tNext.z() ? 1 : 2);
+        const auto t = tNext[axis];
+        if (t >= maxT)
+            return -1.0f;
+
+        cell[axis] += step[axis];
+        tNext[axis] += tDelta[axis];
+
+        if (query.voxel(cell, v) && (v.voxelType & VOXEL_SOLID))
+            return t * voxelSize;
+    }
+}
+
+}
+
+
+RaySensors::RaySensors(const Envs &envs, const RaySensorOptions &options)
+: options{options}
+, candidates(envs.size())
+{
+    int numAgentsTotal = 0;
+    for (const auto &env : envs) {
+        agentOffsets.push_back(numAgentsTotal);
+        numAgentsTotal += env->getNumAgents();
+    }
+
+    data.resize(size_t(numAgentsTotal) * valuesPerAgent());
+}
+
+void RaySensors::senseEnv(int envIdx, Env &env)
+{
+    PROFILE_ZONE("RaySensors::senseEnv");
+
+    for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+        auto out = data.data() + size_t(agentOffsets[envIdx] + agentIdx) * valuesPerAgent();
+        senseAgent(env, agentIdx, candidates[envIdx], out);
+    }
+}
+
+void RaySensors::senseAgent(Env &env, int agentIdx, std::vector<const btCollisionObject *> &objects, float *out) const
+{
+    const auto *query = env.getScenario().layoutVoxelQuery();
+    auto &world = env.getPhysics().bWorld;
+
+    auto *agent = env.getAgents()[agentIdx];
+    const auto origin = agent->getCameraObject()->absoluteTransformation().translation();
+
+    Vector3 forward{agent->forwardDirection()}, left{agent->strafeLeftDirection()};
+    forward.y() = left.y() = 0;
+    forward = forward.dot() > 1e-6f ? forward.normalized() : Vector3{0, 0, -1};
+    left = left.dot() > 1e-6f ? left.normalized() : Vector3{forward.z(), 0, -forward.x()};
+
+    const auto numRays = options.numRays;
+    const auto fov = float(Rad{Deg{options.fovDegrees}});
+    const auto yawStep = numRays > 1 ? fov / float(numRays - 1) : 0.0f;
+
+    // directions of the whole fan first, so one broadphase query covers all of the rays
+    std::vector<Vector3> directions;
+    directions.reserve(size_t(options.raysPerAgent()));
+
+    btVector3 aabbMin{origin}, aabbMax{origin};
+    for (auto pitchDeg : options.pitchDegrees) {
+        const auto pitch = float(Rad{Deg{pitchDeg}});
+
+        for (int ray = 0; ray < numRays; ++ray) {
+            // leftmost ray first
+            const auto yaw = numRays > 1 ? 0.5f * fov - yawStep * float(ray) : 0.0f;
+            const auto horizontal = forward * std::cos(yaw) + left * std::sin(yaw);
+            const auto dir = (horizontal * std::cos(pitch) + Vector3{0, 1, 0} * std::sin(pitch)).normalized();
+            directions.push_back(dir);
+
+            const btVector3 end{origin + dir * options.maxDistance};
+            aabbMin.setMin(end), aabbMax.setMax(end);
+        }
+    }
+
+    struct Callback : public btBroadphaseAabbCallback
+    {
+        std::vector<const btCollisionObject *> *objects;
+        btVector3 origin;
+        bool skipLayout;
+
+        bool process(const btBroadphaseProxy *proxy) override
+        {
+            if (skipLayout && (proxy->m_collisionFilterGroup & layoutCollisionGroup))
+                return true;
+
+            // collisions turned off (carried objects, see RigidBody::setColliding()), the body is not where it's drawn
+            if (!proxy->m_collisionFilterGroup)
+                return true;
+
+            // the agent's own body (and anything it is inside of) would hide everything else
+            if (TestPointAgainstAabb2(proxy->m_aabbMin, proxy->m_aabbMax, origin))
+                return true;
+
+            objects->push_back(static_cast<const btCollisionObject *>(proxy->m_clientObject));
+            return true;
+        }
+    } callback;
+
+    objects.clear();
+    callback.objects = &objects;
+    callback.origin = btVector3{origin};
+    callback.skipLayout = query != nullptr;
+    world.getBroadphase()->aabbTest(aabbMin, aabbMax, callback);
+
+    btTransform from, to;
+    from.setIdentity(), to.setIdentity();
+    from.setOrigin(btVector3{origin});
+
+    for (const auto &dir : directions) {
+        auto distance = options.maxDistance;
+        auto type = RAY_HIT_NONE;
+
+        if (query) {
+            if (const auto d = traceLayout(*query, origin, dir, distance); d >= 0)
+                distance = d, type = RAY_HIT_LAYOUT;
+        }
+
+        if (!objects.empty()) {
+            const btVector3 end{origin + dir * distance};
+            to.setOrigin(end);
+
+            btCollisionWorld::ClosestRayResultCallback result{from.getOrigin(), end};
+            for (const auto *obj : objects) {
+                btCollisionWorld::rayTestSingle(
+                    from, to, const_cast<btCollisionObject *>(obj), obj->getCollisionShape(), obj->getWorldTransform(), result
+                );
+            }
+
+            if (result.hasHit())
+                distance *= result.m_closestHitFraction, type = hitType(result.m_collisionObject);
+        }
+
+        *out++ = distance / options.maxDistance;
+        *out++ = float(type);
+    }
+}
+
+size_t RaySensors::memoryBytes() const
+{
+    size_t bytes = vectorBytes(data) + vectorBytes(agentOffsets) + vectorBytes(candidates);
+    for (const auto &c : candidates)
+        bytes += vectorBytes(c);
+
+    return bytes;
+}
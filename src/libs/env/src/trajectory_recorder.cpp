@@ -0,0 +1,378 @@
+#include <cstring>
+
+#include <util/lz_block.hpp>
+#include <util/tiny_logger.hpp>
+#include <util/scoped_profiler.hpp>
+
+#include <env/scenario.hpp>
+#include <env/trajectory_recorder.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+constexpr int matrixElements = 16;
+
+void writeVarint(StateBuffer &buffer, uint64_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        buffer.write(uint8_t(value | 0x80));
+    buffer.write(uint8_t(value));
+}
+
+uint64_t readVarint(StateReader &reader)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && reader.ok(); shift += 7) {
+        const auto b = reader.read<uint8_t>();
+        value |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            break;
+    }
+
+    return value;
+}
+
+void writeString(StateBuffer &buffer, const std::string &s)
+{
+    writeVarint(buffer, s.size());
+    buffer.write(s.data(), s.size());
+}
+
+std::string readString(StateReader &reader)
+{
+    std::string s(readVarint(reader), '\0');
+    reader.read(s.data(), s.size());
+    return s;
+}
+
+/**
+ * Bitmask of the matrix elements that differ, compared bit by bit so that the replay is exact.
+ */
+uint16_t changedElements(const Magnum::Matrix4 &a, const Magnum::Matrix4 &b)
+{
+    uint16_t mask = 0;
+    for (int i = 0; i < matrixElements; ++i)
+        if (memcmp(a.data() + i, b.data() + i, sizeof(float)) != 0)
+            mask |= uint16_t(1 << i);
+
+    return mask;
+}
+
+void collectObjects(Object3D &object, std::vector<Object3D *> &objects)
+{
+    for (auto child = object.children().first(); child; child = child->nextSibling()) {
+        objects.push_back(child);
+        collectObjects(*child, objects);
+    }
+}
+
+}
+
+
+void Megaverse::sceneObjectsInOrder(Object3D &root, std::vector<Object3D *> &objects)
+{
+    objects.clear();
+    collectObjects(root, objects);
+}
+
+
+TrajectoryRecorder::TrajectoryRecorder(const std::string &filename, const Envs &envs, size_t chunkBytes)
+: chunkBytes{chunkBytes}
+, envRecords(envs.size())
+, file{filename, std::ios::out | std::ios::binary | std::ios::trunc}
+{
+    if (!file.is_open()) {
+        TLOG(ERROR) << "Could not open " << filename << " to record trajectories";
+        return;
+    }
+
+    StateBuffer metadata;
+    writeString(metadata, envs.front()->getScenarioName());
+
+    const auto &floatParams = envs.front()->getScenario().getFloatParams();
+    writeVarint(metadata, floatParams.size());
+    for (const auto &[name, value] : floatParams) {
+        writeString(metadata, name);
+        metadata.write(value);
+    }
+
+    writeVarint(metadata, envs.size());
+    for (const auto &env : envs)
+        writeVarint(metadata, uint64_t(env->getNumAgents()));
+
+    const auto metadataSize = uint32_t(metadata.size());
+    file.write(reinterpret_cast<const char *>(&magic), sizeof(magic));
+    file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    file.write(reinterpret_cast<const char *>(&metadataSize), sizeof(metadataSize));
+    file.write(reinterpret_cast<const char *>(metadata.data()), metadata.size());
+
+    ioThread = std::thread{[this] { ioLoop(); }};
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    if (!ioThread.joinable())
+        return;
+
+    flush();
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stop = true;
+    }
+    cv.notify_one();
+
+    ioThread.join();
+}
+
+void TrajectoryRecorder::recordEpisodeStart(int envIdx, Env &env)
+{
+    auto &r = envRecords[envIdx];
+    r.records.write(uint8_t(EPISODE));
+    writeVarint(r.records, uint64_t(envIdx));
+    r.records.write(int32_t(env.getLayoutSeed()));
+
+    writePoses(envIdx, env, true);
+}
+
+void TrajectoryRecorder::recordStep(int envIdx, Env &env, const Action *actions, const float *rewards, bool done)
+{
+    auto &r = envRecords[envIdx];
+    r.records.write(uint8_t(STEP));
+    writeVarint(r.records, uint64_t(envIdx));
+
+    writeVarint(r.records, uint64_t(env.getNumAgents()));
+    for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+        writeVarint(r.records, uint64_t(actions[agentIdx]));
+        r.records.write(rewards[agentIdx]);
+    }
+    r.records.write(uint8_t(done));
+
+    writePoses(envIdx, env, false);
+}
+
+void TrajectoryRecorder::writePoses(int envIdx, Env &env, bool fullPose)
+{
+    auto &r = envRecords[envIdx];
+
+    sceneObjectsInOrder(env.getScene(), r.objects);
+
+    // the full pose of a new episode is stored as a delta against identity transforms, most of the elements match
+    if (fullPose)
+        r.prevTransforms.clear();
+    r.prevTransforms.resize(r.objects.size(), Magnum::Matrix4{Magnum::Math::IdentityInit});
+
+    writeVarint(r.records, r.objects.size());
+
+    int numChanged = 0;
+    for (size_t i = 0; i < r.objects.size(); ++i)
+        numChanged += changedElements(r.objects[i]->transformationMatrix(), r.prevTransforms[i]) != 0;
+
+    writeVarint(r.records, uint64_t(numChanged));
+
+    int prevIdx = -1;
+    for (int i = 0; i < int(r.objects.size()); ++i) {
+        const auto &t = r.objects[i]->transformationMatrix();
+        const auto mask = changedElements(t, r.prevTransforms[i]);
+        if (!mask)
+            continue;
+
+        writeVarint(r.records, uint64_t(i - prevIdx - 1));
+        r.records.write(mask);
+        for (int e = 0; e < matrixElements; ++e)
+            if (mask & (1 << e))
+                r.records.write(t.data()[e]);
+
+        r.prevTransforms[i] = t;
+        prevIdx = i;
+    }
+}
+
+void TrajectoryRecorder::endFrame()
+{
+    if (!isOpen())
+        return;
+
+    for (auto &r : envRecords) {
+        chunk.write(r.records.data(), r.records.size());
+        r.records.clear();
+    }
+
+    chunk.write(uint8_t(FRAME));
+
+    if (chunk.size() >= chunkBytes)
+        flush();
+}
+
+void TrajectoryRecorder::flush()
+{
+    if (chunk.size() == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        pendingChunks.emplace_back(chunk.data(), chunk.data() + chunk.size());
+    }
+    cv.notify_one();
+
+    chunk.clear();
+}
+
+void TrajectoryRecorder::ioLoop()
+{
+    std::vector<uint8_t> compressed;
+
+    while (true) {
+        std::vector<uint8_t> raw;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            cv.wait(lock, [this] { return stop || !pendingChunks.empty(); });
+
+            if (pendingChunks.empty())
+                break;
+
+            raw = std::move(pendingChunks.front());
+            pendingChunks.pop_front();
+        }
+
+        PROFILE_ZONE("TrajectoryRecorder::writeChunk");
+
+        compressed.clear();
+        lzCompress(raw.data(), raw.size(), compressed);
+
+        const uint32_t sizes[] = {uint32_t(raw.size()), uint32_t(compressed.size())};
+        file.write(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+        file.write(reinterpret_cast<const char *>(compressed.data()), std::streamsize(compressed.size()));
+        file.flush();
+    }
+}
+
+
+TrajectoryReader::TrajectoryReader(const std::string &filename)
+: file{filename, std::ios::in | std::ios::binary}
+{
+    uint32_t header[3]{};
+    if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != TrajectoryRecorder::magic) {
+        TLOG(ERROR) << filename << " is not a trajectory recording";
+        return;
+    }
+
+    if (header[1] != TrajectoryRecorder::version) {
+        TLOG(ERROR) << "Unsupported version " << header[1] << " of the trajectory recording " << filename;
+        return;
+    }
+
+    std::vector<uint8_t> bytes(header[2]);
+    file.read(reinterpret_cast<char *>(bytes.data()), std::streamsize(bytes.size()));
+
+    StateReader reader{bytes.data(), bytes.size()};
+    metadata.scenario = readString(reader);
+
+    const auto numParams = readVarint(reader);
+    for (uint64_t i = 0; i < numParams && reader.ok(); ++i) {
+        const auto name = readString(reader);
+        metadata.floatParams[name] = reader.read<float>();
+    }
+
+    metadata.numAgents.resize(readVarint(reader));
+    for (auto &n : metadata.numAgents)
+        n = int(readVarint(reader));
+
+    if (!reader.finished()) {
+        TLOG(ERROR) << "Corrupted metadata in the trajectory recording " << filename;
+        return;
+    }
+
+    transforms.resize(metadata.numAgents.size());
+    opened = true;
+}
+
+bool TrajectoryReader::readChunk()
+{
+    uint32_t sizes[2];
+    if (!file.read(reinterpret_cast<char *>(sizes), sizeof(sizes)))
+        return false;
+
+    compressed.resize(sizes[1]);
+    if (!file.read(reinterpret_cast<char *>(compressed.data()), std::streamsize(compressed.size())))
+        return false;
+
+    chunk.clear();
+    chunkPos = 0;
+    return lzDecompress(compressed.data(), compressed.size(), sizes[0], chunk);
+}
+
+bool TrajectoryReader::next(Record &record)
+{
+    if (!opened)
+        return false;
+
+    if (chunkPos == chunk.size() && !readChunk())
+        return false;
+
+    StateReader reader{chunk.data() + chunkPos, chunk.size() - chunkPos};
+
+    record.type = TrajectoryRecorder::RecordType(reader.read<uint8_t>());
+    record.transforms.clear();
+
+    if (record.type != TrajectoryRecorder::FRAME) {
+        const auto envIdx = readVarint(reader);
+        if (envIdx >= transforms.size()) {
+            TLOG(ERROR) << "Record of env " << envIdx << " out of " << transforms.size();
+            return false;
+        }
+        record.envIdx = int(envIdx);
+
+        if (record.type == TrajectoryRecorder::EPISODE)
+            record.layoutSeed = reader.read<int32_t>();
+        else {
+            const auto numAgents = readVarint(reader);
+            record.actions.resize(numAgents), record.rewards.resize(numAgents);
+            for (uint64_t agentIdx = 0; agentIdx < numAgents && reader.ok(); ++agentIdx) {
+                record.actions[agentIdx] = Action(readVarint(reader));
+                record.rewards[agentIdx] = reader.read<float>();
+            }
+            record.done = reader.read<uint8_t>() != 0;
+        }
+
+        auto &envTransforms = transforms[envIdx];
+        if (record.type == TrajectoryRecorder::EPISODE)
+            envTransforms.clear();
+        envTransforms.resize(readVarint(reader), Magnum::Matrix4{Magnum::Math::IdentityInit});
+
+        const auto numChanged = readVarint(reader);
+        int idx = -1;
+        for (uint64_t i = 0; i < numChanged && reader.ok(); ++i) {
+            idx += int(readVarint(reader)) + 1;
+            const auto mask = reader.read<uint16_t>();
+            if (idx >= int(envTransforms.size())) {
+                TLOG(ERROR) << "Pose of object " << idx << " out of " << envTransforms.size();
+                return false;
+            }
+
+            auto &t = envTransforms[idx];
+            for (int e = 0; e < matrixElements; ++e)
+                if (mask & (1 << e))
+                    t.data()[e] = reader.read<float>();
+
+            if (record.type == TrajectoryRecorder::STEP)
+                record.transforms.emplace_back(idx, t);
+        }
+
+        if (record.type == TrajectoryRecorder::EPISODE)
+            for (int i = 0; i < int(envTransforms.size()); ++i)
+                record.transforms.emplace_back(i, envTransforms[i]);
+    }
+
+    if (!reader.ok() || (record.type != TrajectoryRecorder::EPISODE && record.type != TrajectoryRecorder::STEP && record.type != TrajectoryRecorder::FRAME)) {
+        TLOG(ERROR) << "Corrupted trajectory record";
+        return false;
+    }
+
+    chunkPos = chunk.size() - reader.remaining();
+    return true;
+}
@@ -1,34 +1,151 @@
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <algorithm>
+
+#include <util/os_utils.hpp>
+#include <util/tiny_logger.hpp>
+#include <util/scoped_profiler.hpp>
+
+#include <env/scenario.hpp>
 #include <env/vector_env.hpp>
 
+
 using namespace Megaverse;
 
 
-VectorEnv::VectorEnv(std::vector<std::unique_ptr<Env>> &envs, EnvRenderer &renderer, int numThreads)
+namespace
+{
+
+const auto simulateZone = sprof().registerZone("VectorEnv::simulate");
+
+// status of the envs in VectorEnv::forkTargets
+enum : uint8_t
+{
+    FORK_NONE,
+    FORK_PENDING,
+    FORK_RESTORED,
+    FORK_NEW_EPISODE,
+    FORK_FAILED,
+    FORK_DONE,  // until the next frame is drawn
+};
+
+// status of the envs in VectorEnv::EnvSlot::incrementalReset
+enum : uint8_t
+{
+    RESET_NONE,
+    RESET_RUNNING,
+    RESET_FINISHED,  // until the main thread finishes the renderer reset
+};
+
+/**
+ * Contiguous block of envs of a thread when they're split evenly between threads [firstThreadIdx, numThreads).
+ */
+std::pair<int, int> envRange(int numEnvs, int numThreads, int firstThreadIdx, int threadIdx)
+{
+    if (threadIdx < firstThreadIdx)
+        return {0, 0};
+
+    const int numWorkers = numThreads - firstThreadIdx;
+    const int envsPerWorker = (numEnvs / numWorkers) + (numEnvs % numWorkers != 0);
+    const int startIdx = std::min((threadIdx - firstThreadIdx) * envsPerWorker, numEnvs);
+    return {startIdx, std::min(startIdx + envsPerWorker, numEnvs)};
+}
+
+/**
+ * Boundaries of contiguous blocks of envs for every thread: threads [firstThreadIdx, endThreadIdx) get blocks of about
+ * the same total cost, the others empty ones. The block of thread i is [splits[i], splits[i + 1]).
+ * Without costs the envs are split evenly, same as envRange().
+ */
+template<typename EnvCost>
+std::vector<int> balancedSplits(EnvCost &&cost, int numEnvs, int numThreads, int firstThreadIdx, int endThreadIdx)
+{
+    std::vector<int> splits(size_t(numThreads + 1), 0);
+    const int numWorkers = endThreadIdx - firstThreadIdx;
+
+    uint64_t total = 0;
+    for (int envIdx = 0; envIdx < numEnvs; ++envIdx)
+        total += cost(envIdx);
+
+    int envIdx = 0;
+    uint64_t prefix = 0;
+    for (int worker = 1; worker < numWorkers; ++worker) {
+        if (!total) {
+            splits[firstThreadIdx + worker] = envRange(numEnvs, endThreadIdx, firstThreadIdx, firstThreadIdx + worker).first;
+            continue;
+        }
+
+        // cut where the cost of the envs so far is closest to the share of the workers so far
+        const auto target = double(total) * worker / numWorkers;
+        while (envIdx < numEnvs && double(prefix + cost(envIdx)) <= target)
+            prefix += cost(envIdx++);
+        if (envIdx < numEnvs && target - double(prefix) > double(prefix + cost(envIdx)) - target)
+            prefix += cost(envIdx++);
+
+        splits[firstThreadIdx + worker] = envIdx;
+    }
+
+    for (int threadIdx = endThreadIdx; threadIdx <= numThreads; ++threadIdx)
+        splits[threadIdx] = numEnvs;
+
+    return splits;
+}
+
+void pinCurrentThread(const std::vector<int> &cpuAffinity, int threadIdx)
+{
+    if (threadIdx >= int(cpuAffinity.size()) || cpuAffinity[threadIdx] < 0)
+        return;
+
+    if (!setThreadAffinity(pthread_self(), cpuAffinity[threadIdx]))
+        TLOG(WARNING) << "Could not pin thread " << threadIdx << " to CPU " << cpuAffinity[threadIdx];
+}
+
+}
+
+
+VectorEnv::VectorEnv(
+    std::vector<std::unique_ptr<Env>> &envs, EnvRenderer &renderer, int numThreads, Scheduler scheduler,
+    const std::vector<int> &cpuAffinity
+)
 : envs(envs)
 , renderer(renderer)
 , numThreads{numThreads}  // use master threads as one of the threads
+, scheduler{scheduler}
+, dispatchBarrier{numThreads}
+, completionBarrier{numThreads}
+, resetDispatchBarrier{2}
+, resetCompletionBarrier{2}
+, threadSlots(size_t(numThreads))
+, statsStartNs{ScopedProfiler::nowNs()}
+, sentEnvs{envs.size()}
+, completedEnvs{envs.size()}
 {
     const int numEnvs = int(envs.size());
-    envsPerThread = (numEnvs / numThreads) + (numEnvs % numThreads != 0);
+    numActiveEnvs = numEnvs;
+    numActiveThreads = numWorkingThreads = numThreads;
+    envSlots = std::vector<EnvSlot>(envs.size());
+    for (auto &slot : envSlots)
+        slot.episodeStartNs = ScopedProfiler::nowNs();
+    updateEnvSplits();
 
-    currTasks = std::vector<Task>(size_t(numThreads), Task::IDLE);
+    for (int i = 0; i < numThreads; ++i)
+        workQueues.emplace_back(std::make_unique<WorkQueue>());
 
     for (int i = 1; i < numThreads; ++i) {
         std::thread t{
-            [this](int threadIdx) {
+            [this, cpuAffinity](int threadIdx) {
+                pinCurrentThread(cpuAffinity, threadIdx);
 
                 while (true) {
-                    std::unique_lock<std::mutex> lock{mutex};
-
-                    while (currTasks[threadIdx] == Task::IDLE)
-                        cvTask.wait(lock);
-
-                    const auto task = currTasks[threadIdx];
-                    currTasks[threadIdx] = Task::IDLE;
-                    lock.unlock();
+                    dispatchBarrier.arriveAndWait();
 
+                    const auto task = currTask;
+                    const auto idle = threadIdx >= numWorkingThreads;
                     taskFunc(task, threadIdx);
-                    ++numReady;
+
+                    // inactive threads have nothing to wait for, spinning would only take the core from the others
+                    completionBarrier.arriveAndWait(idle ? 0 : -1);
 
                     if (task == Task::TERMINATE)
                         break;
@@ -39,21 +156,533 @@ VectorEnv::VectorEnv(std::vector<std::unique_ptr<Env>> &envs, EnvRenderer &rende
         backgroundThreads.emplace_back(std::move(t));
     }
 
+    pinCurrentThread(cpuAffinity, 0);
+
     done = std::vector<bool>(envs.size());
+    doneFlags = std::vector<uint8_t>(envs.size());
+    episodeStarted = std::vector<uint8_t>(envs.size());
+    masked = std::vector<uint8_t>(envs.size());
+    forkTargets = std::vector<uint8_t>(envs.size());
+    poolEnvsInFlight = std::vector<uint8_t>(envs.size());
     trueObjectives = std::vector<std::vector<float>>(envs.size());
-    for (int envIdx = 0; envIdx < numEnvs; ++envIdx)
+    episodeStats = std::vector<EpisodeStats>(4096);
+
+    int numAgentsTotal = 0;
+    for (int envIdx = 0; envIdx < numEnvs; ++envIdx) {
         trueObjectives[envIdx] = std::vector<float>(envs[envIdx]->getNumAgents());
+        agentOffsets.push_back(numAgentsTotal);
+        numAgentsTotal += envs[envIdx]->getNumAgents();
+    }
+
+    lastRewards = std::vector<float>(size_t(numAgentsTotal));
+    repeatedActions = std::vector<Action>(size_t(numAgentsTotal), Action::Idle);
+    lastTrueObjectives = std::vector<float>(size_t(numAgentsTotal));
+    agentDoneFlags = std::vector<uint8_t>(size_t(numAgentsTotal));
+
+    // renderers with several command streams, see EnvRenderer::numShards()
+    if (renderer.numShards() > 1) {
+        shardSlots = std::vector<ShardSlot>(size_t(renderer.numShards()));
+        for (int envIdx = 0; envIdx < numEnvs; ++envIdx)
+            envShards.push_back(renderer.shardOf(envIdx));
+    }
+}
+
+Envs VectorEnv::createEnvs(
+    int numEnvs, int numThreads, const std::function<std::unique_ptr<Env>(int envIdx)> &makeEnv,
+    const std::vector<int> &cpuAffinity, bool asyncStepping
+)
+{
+    Envs envs(size_t(numEnvs));
+    const int firstThreadIdx = asyncStepping && numThreads > 1 ? 1 : 0;
+
+    std::vector<std::thread> threads;
+    for (int threadIdx = firstThreadIdx; threadIdx < numThreads; ++threadIdx) {
+        threads.emplace_back([&, threadIdx] {
+            pinCurrentThread(cpuAffinity, threadIdx);
+
+            const auto [startIdx, endIdx] = envRange(numEnvs, numThreads, firstThreadIdx, threadIdx);
+            for (int envIdx = startIdx; envIdx < endIdx; ++envIdx)
+                envs[envIdx] = makeEnv(envIdx);
+        });
+    }
+
+    for (auto &t : threads)
+        t.join();
+
+    return envs;
 }
 
 void VectorEnv::stepEnv(int envIdx)
 {
-    envs[envIdx]->step();
-    renderer.preDraw(*envs[envIdx], envIdx);
+    auto &env = *envs[envIdx];
+    const auto agentOffset = agentOffsets[envIdx];
+    const auto numAgents = env.getNumAgents();
+
+    if (masked[envIdx]) {
+        // the reset thread owns the env until the end of the step, incremental resets continue here instead
+        std::fill_n(lastRewards.begin() + agentOffset, numAgents, 0.0f);
+        std::fill_n(agentDoneFlags.begin() + agentOffset, numAgents, 0);
+        doneFlags[envIdx] = 0;
+
+        if (envSlots[envIdx].incrementalReset == RESET_RUNNING)
+            continueIncrementalReset(envIdx);
+        return;
+    }
+
+    // not part of a shard pass, the components update themselves
+    if (batchedComponents)
+        env.setBatchedComponents(false);
+
+    if (frameSkip == 1) {
+        // the recorder needs the actions after Env::step() clears them
+        if (recorder)
+            for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx)
+                repeatedActions[agentOffset + agentIdx] = env.getAction(agentIdx);
+
+        env.step();
+
+        for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx)
+            lastRewards[agentOffset + agentIdx] = env.getLastReward(agentIdx);
+    } else {
+        // Env::step() clears the actions, so they have to be set again for every frame
+        for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx) {
+            repeatedActions[agentOffset + agentIdx] = env.getAction(agentIdx);
+            lastRewards[agentOffset + agentIdx] = 0;
+        }
+
+        for (int frame = 0; frame < frameSkip && !env.isDone(); ++frame) {
+            if (frame > 0)
+                for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx)
+                    env.setAction(agentIdx, repeatedActions[agentOffset + agentIdx]);
+
+            env.step();
+
+            for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx)
+                lastRewards[agentOffset + agentIdx] += env.getLastReward(agentIdx);
+        }
+    }
+
+    finishEnvStep(envIdx);
+}
+
+void VectorEnv::stepShard(int threadIdx, int firstEnv, int endEnv)
+{
+    // all envs of the block simulate first, then the batched components are updated for all of them in one pass
+    for (int envIdx = firstEnv; envIdx < endEnv; ++envIdx) {
+        if (masked[envIdx])
+            continue;
+
+        auto &env = *envs[envIdx];
+        if (recorder)
+            for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+                repeatedActions[agentOffsets[envIdx] + agentIdx] = env.getAction(agentIdx);
+
+        env.setBatchedComponents(true);
+        env.simulate();
+    }
+
+    componentPasses[threadIdx].run(envs, envComponents, firstEnv, endEnv, masked.data());
+
+    for (int envIdx = firstEnv; envIdx < endEnv; ++envIdx) {
+        if (masked[envIdx]) {
+            stepEnv(envIdx);
+            continue;
+        }
+
+        auto &env = *envs[envIdx];
+        env.finishStep();
+
+        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+            lastRewards[agentOffsets[envIdx] + agentIdx] = env.getLastReward(agentIdx);
+
+        finishEnvStep(envIdx);
+    }
+}
+
+void VectorEnv::finishEnvStep(int envIdx)
+{
+    auto &env = *envs[envIdx];
+    const auto agentOffset = agentOffsets[envIdx];
+
+    doneFlags[envIdx] = env.isDone();
+    ++envSlots[envIdx].episodeSteps;
+    for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+        agentDoneFlags[agentOffset + agentIdx] = env.isAgentDone(agentIdx);
+
+    if (recorder)
+        recorder->recordStep(envIdx, env, &repeatedActions[agentOffset], &lastRewards[agentOffset], doneFlags[envIdx]);
+
+    if (doneFlags[envIdx]) {
+        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+            trueObjectives[envIdx][agentIdx] = env.trueObjective(agentIdx);
+            lastTrueObjectives[agentOffset + agentIdx] = trueObjectives[envIdx][agentIdx];
+        }
+
+        recordEpisodeStats(envIdx);
+
+        if (poolRunning) {
+            // the renderer is updated by recv() on the main thread
+            resetEnv(envIdx);
+            return;
+        }
+
+        if (backgroundResetsEnabled) {
+            // the terminal frame is drawn, the reset thread starts the new episode during the next step
+            senseEnv(envIdx);
+
+            {
+                PROFILE_ZONE("Renderer::preDraw");
+                renderer.preDraw(env, envIdx);
+            }
+
+            envPreDrawn(envIdx);
+            return;
+        }
+
+        if (drawsTerminalFrames()) {
+            // the terminal frame is drawn first, finishStep() resets the env after copying it
+            senseEnv(envIdx);
+
+            PROFILE_ZONE("Renderer::preDraw");
+            renderer.preDraw(env, envIdx);
+            return;
+        }
+
+        if (incrementalResetBudgetNs > 0) {
+            // the env is masked until the reset completes, see setIncrementalResets()
+            env.beginReset();
+            continueIncrementalReset(envIdx);
+            return;
+        }
+
+        // auto-reset in the worker thread, only the part of the renderer reset that needs the main thread is deferred
+        resetEnv(envIdx);
+
+        PROFILE_ZONE("Renderer::prepareReset");
+        renderer.prepareReset(env, envIdx);
+    } else {
+        senseEnv(envIdx);
+        if (poolRunning)
+            return;
+
+        {
+            PROFILE_ZONE("Renderer::preDraw");
+            renderer.preDraw(env, envIdx);
+        }
+
+        envPreDrawn(envIdx);
+    }
+}
+
+void VectorEnv::prepareShards()
+{
+    // pipelined frames are submitted as a whole right after the step, terminal passes draw the shards twice
+    submitShards = !shardSlots.empty() && !pipelinedRendering && !drawsTerminalFrames();
+    if (!submitShards)
+        return;
+
+    for (auto &slot : shardSlots)
+        slot.pending.store(0, std::memory_order_relaxed);
+
+    // published to the workers by the dispatch barrier
+    for (int envIdx = 0; envIdx < numActiveEnvs; ++envIdx)
+        shardSlots[envShards[envIdx]].pending.fetch_add(1, std::memory_order_relaxed);
+}
+
+void VectorEnv::envPreDrawn(int envIdx)
+{
+    if (!submitShards)
+        return;
+
+    // the last env of the shard submits it, acq_rel makes the preDraw() of the other envs visible to this thread
+    const auto shard = envShards[envIdx];
+    if (shardSlots[shard].pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        PROFILE_ZONE("Renderer::submitShard");
+        renderer.submitShard(shard);
+    }
+}
+
+void VectorEnv::recordEpisodeStats(int envIdx)
+{
+    if (episodeStats.empty())
+        return;
+
+    const auto &env = *envs[envIdx];
+    const auto &slot = envSlots[envIdx];
+    const auto wallTimeSec = float(double(ScopedProfiler::nowNs() - slot.episodeStartNs) * 1e-9);
+
+    std::lock_guard lock{episodeStatsMutex};
+    for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+        auto &stats = episodeStats[(episodeStatsHead + numEpisodeStats) % episodeStats.size()];
+        stats = {envIdx, agentIdx, env.getTotalReward(agentIdx), trueObjectives[envIdx][agentIdx], slot.episodeSteps, wallTimeSec, numVectorSteps.load(std::memory_order_relaxed)};
+
+        // full, the oldest entry was just overwritten
+        if (numEpisodeStats == episodeStats.size()) {
+            episodeStatsHead = (episodeStatsHead + 1) % episodeStats.size();
+            ++numDroppedEpisodeStats;
+        } else
+            ++numEpisodeStats;
+    }
+}
+
+uint64_t VectorEnv::popEpisodeStats(std::vector<EpisodeStats> &out)
+{
+    std::lock_guard lock{episodeStatsMutex};
+
+    for (size_t i = 0; i < numEpisodeStats; ++i)
+        out.push_back(episodeStats[(episodeStatsHead + i) % episodeStats.size()]);
+
+    episodeStatsHead = numEpisodeStats = 0;
+    return std::exchange(numDroppedEpisodeStats, 0);
+}
+
+void VectorEnv::setEpisodeStatsCapacity(int capacity)
+{
+    TCHECK(!asyncStepInProgress);
+    TCHECK(capacity >= 0);
+
+    std::lock_guard lock{episodeStatsMutex};
+    episodeStats = std::vector<EpisodeStats>(size_t(capacity));
+    episodeStatsHead = numEpisodeStats = 0;
+    numDroppedEpisodeStats = 0;
+}
+
+void VectorEnv::drawTerminalFrames()
+{
+    terminalEnvs.clear();
+    std::fill(terminalSlots.begin(), terminalSlots.end(), -1);
+
+    int numSlots = 0;
+    for (int envIdx = 0; envIdx < numActiveEnvs; ++envIdx)
+        if (doneFlags[envIdx]) {
+            terminalEnvs.push_back(envIdx);
+            terminalSlots[envIdx] = numSlots;
+            numSlots += envs[envIdx]->getNumAgents();
+        }
+
+    if (terminalEnvs.empty())
+        return;
+
+    {
+        PROFILE_ZONE("VectorEnv::drawTerminalFrames");
+
+        frameRenderMask.assign(lastRewards.size(), 0);
+        for (auto envIdx : terminalEnvs)
+            std::fill_n(frameRenderMask.begin() + agentOffsets[envIdx], envs[envIdx]->getNumAgents(), 1);
+
+        renderer.setRenderMask(frameRenderMask);
+        renderer.draw(envs);
+
+        // the buffer only grows, so steps with fewer done envs don't reallocate it
+        if (terminalObservations.size() < size_t(numSlots) * terminalFrameBytes)
+            terminalObservations.resize(size_t(numSlots) * terminalFrameBytes);
+
+        for (auto envIdx : terminalEnvs)
+            for (int agentIdx = 0; agentIdx < envs[envIdx]->getNumAgents(); ++agentIdx)
+                memcpy(
+                    terminalObservations.data() + size_t(terminalSlots[envIdx] + agentIdx) * terminalFrameBytes,
+                    renderer.getObservation(envIdx, agentIdx), terminalFrameBytes
+                );
+    }
+
+    // the envs are reset by the threads that step them, the rest of the step proceeds like an auto-reset
+    executeTask(Task::TERMINAL_RESET);
+}
+
+void VectorEnv::resetTerminalEnv(int envIdx)
+{
+    if (terminalSlots[envIdx] < 0)
+        return;
+
+    resetEnv(envIdx);
+
+    PROFILE_ZONE("Renderer::prepareReset");
+    renderer.prepareReset(*envs[envIdx], envIdx);
+}
+
+const uint8_t * VectorEnv::getTerminalObservation(int envIdx, int agentIdx) const
+{
+    if (envIdx < 0 || size_t(envIdx) >= terminalSlots.size() || terminalSlots[envIdx] < 0)
+        return nullptr;
+
+    return terminalObservations.data() + size_t(terminalSlots[envIdx] + agentIdx) * terminalFrameBytes;
+}
+
+void VectorEnv::setTerminalObservations(size_t frameBytes)
+{
+    TCHECK(!asyncStepInProgress);
+
+    terminalFrameBytes = frameBytes;
+    terminalEnvs.clear();
+    terminalSlots.assign(envs.size(), -1);
+    if (!frameBytes)
+        terminalObservations = std::vector<uint8_t>{};
 }
 
 void VectorEnv::resetEnv(int envIdx)
 {
     envs[envIdx]->reset();
+    beginEpisode(envIdx);
+}
+
+bool VectorEnv::continueIncrementalReset(int envIdx)
+{
+    auto &env = *envs[envIdx];
+    if (!env.continueReset(incrementalResetBudgetNs)) {
+        envSlots[envIdx].incrementalReset = RESET_RUNNING;
+        return false;
+    }
+
+    envSlots[envIdx].incrementalReset = RESET_FINISHED;
+    beginEpisode(envIdx);
+
+    PROFILE_ZONE("Renderer::prepareReset");
+    renderer.prepareReset(env, envIdx);
+    return true;
+}
+
+void VectorEnv::beginEpisode(int envIdx)
+{
+    envSlots[envIdx].episodeSteps = 0;
+    envSlots[envIdx].episodeStartNs = ScopedProfiler::nowNs();
+    if (recorder)
+        recorder->recordEpisodeStart(envIdx, *envs[envIdx]);
+    if (pregenerator)
+        pregenerator->episodeStarted(envIdx, *envs[envIdx]);
+
+    senseEnv(envIdx);
+}
+
+void VectorEnv::forkEnv(int envIdx)
+{
+    if (forkTargets[envIdx] != FORK_PENDING)
+        return;
+
+    auto &env = *envs[envIdx];
+    const auto episodeId = env.episodeId();
+
+    if (!env.restoreState(forkState))
+        forkTargets[envIdx] = FORK_FAILED;
+    else
+        forkTargets[envIdx] = env.episodeId() == episodeId ? FORK_RESTORED : FORK_NEW_EPISODE;
+
+    // the target continues the episode of the source
+    if (forkTargets[envIdx] != FORK_FAILED)
+        envSlots[envIdx].episodeSteps = envSlots[forkSource].episodeSteps, envSlots[envIdx].episodeStartNs = envSlots[forkSource].episodeStartNs;
+
+    senseEnv(envIdx);
+}
+
+void VectorEnv::encodeEnv(int envIdx)
+{
+    // a new episode has nothing in common with the previous frame
+    encoder->encodeEnv(envIdx, renderer, episodeStarted[envIdx] != 0);
+}
+
+void VectorEnv::senseEnv(int envIdx)
+{
+    if (sensors)
+        sensors->senseEnv(envIdx, *envs[envIdx]);
+}
+
+void VectorEnv::backgroundResetLoop()
+{
+    while (true) {
+        resetDispatchBarrier.arriveAndWait();
+        if (terminateResetThread)
+            break;
+
+        for (auto envIdx : backgroundResets) {
+            PROFILE_ZONE("VectorEnv::backgroundReset");
+            resetEnv(envIdx);
+            renderer.prepareReset(*envs[envIdx], envIdx);
+        }
+
+        resetCompletionBarrier.arriveAndWait();
+    }
+}
+
+void VectorEnv::startBackgroundResets()
+{
+    if (backgroundResets.empty())
+        return;
+
+    resetDispatchBarrier.arriveAndWait();
+    backgroundResetsInProgress = true;
+}
+
+void VectorEnv::finishBackgroundResets()
+{
+    if (!backgroundResetsInProgress)
+        return;
+
+    {
+        PROFILE_ZONE("VectorEnv::waitForBackgroundResets");
+        lastMainThreadWaitNs += resetCompletionBarrier.arriveAndWait();
+        backgroundResetsInProgress = false;
+    }
+
+    for (auto envIdx : backgroundResets) {
+        masked[envIdx] = 0;
+
+        // deactivated in the meantime, the renderer is reset when the env comes back
+        if (envIdx >= numActiveEnvs)
+            continue;
+
+        episodeStarted[envIdx] = 1;
+        renderer.finishReset(*envs[envIdx], envIdx);
+        renderer.preDraw(*envs[envIdx], envIdx);
+    }
+
+    backgroundResets.clear();
+}
+
+void VectorEnv::fillWorkQueues(int firstThreadIdx)
+{
+    // initial distribution is the same as for the static scheduler, so without imbalance no stealing is needed
+    const auto stepNs = [this](int envIdx) { return envSlots[envIdx].stepNs; };
+    const auto splits = firstThreadIdx == 0 ? envSplits : balancedSplits(stepNs, numActiveEnvs, numThreads, firstThreadIdx, numWorkingThreads);
+
+    for (int threadIdx = 0; threadIdx < numThreads; ++threadIdx) {
+        auto &q = *workQueues[threadIdx];
+        std::lock_guard<std::mutex> lock{q.mutex};
+
+        q.envIndices.clear();
+        for (int envIdx = splits[threadIdx]; envIdx < splits[threadIdx + 1]; ++envIdx)
+            q.envIndices.push_back(envIdx);
+    }
+}
+
+void VectorEnv::updateEnvSplits()
+{
+    envSplits = balancedSplits([this](int envIdx) { return envSlots[envIdx].stepNs; }, numActiveEnvs, numThreads, 0, numActiveThreads);
+}
+
+bool VectorEnv::popWork(int threadIdx, int &envIdx)
+{
+    // first take work from the front of our own queue
+    {
+        auto &q = *workQueues[threadIdx];
+        std::lock_guard<std::mutex> lock{q.mutex};
+        if (!q.envIndices.empty()) {
+            envIdx = q.envIndices.front();
+            q.envIndices.pop_front();
+            return true;
+        }
+    }
+
+    // our queue is empty, try to steal from the back of someone else's queue
+    for (int i = 1; i < numWorkingThreads; ++i) {
+        auto &q = *workQueues[(threadIdx + i) % numWorkingThreads];
+        std::lock_guard<std::mutex> lock{q.mutex};
+        if (!q.envIndices.empty()) {
+            envIdx = q.envIndices.back();
+            q.envIndices.pop_back();
+            return true;
+        }
+    }
+
+    return false;
 }
 
 void VectorEnv::taskFunc(Task task, int threadIdx)
@@ -61,67 +690,928 @@ void VectorEnv::taskFunc(Task task, int threadIdx)
     auto func = &VectorEnv::stepEnv;
     if (task == Task::RESET)
         func = &VectorEnv::resetEnv;
+    else if (task == Task::FORK)
+        func = &VectorEnv::forkEnv;
+    else if (task == Task::ENCODE)
+        func = &VectorEnv::encodeEnv;
+    else if (task == Task::TERMINAL_RESET)
+        func = &VectorEnv::resetTerminalEnv;
+
+    if (task == Task::TERMINATE)
+        return;
+
+    if (task == Task::POOL) {
+        poolLoop(threadIdx);
+        return;
+    }
+
+    if (threadIdx >= numWorkingThreads)
+        return;
 
-    const auto startIdx = threadIdx * envsPerThread;
-    const auto endIdx = std::min(startIdx + envsPerThread, int(envs.size()));
-    for (int envIdx = startIdx; envIdx < endIdx; ++envIdx)
+    const auto startNs = ScopedProfiler::nowNs();
+
+    const auto measure = measureEnvCosts && task == Task::STEP;
+    const auto run = [&](int envIdx) {
+        if (!measure) {
+            (this->*func)(envIdx);
+            return;
+        }
+
+        const auto envStartNs = ScopedProfiler::nowNs();
         (this->*func)(envIdx);
+        envSlots[envIdx].stepNs += ScopedProfiler::nowNs() - envStartNs;
+    };
+
+    if (useWorkQueues) {
+        int envIdx;
+        while (popWork(threadIdx, envIdx))
+            run(envIdx);
+    } else if (task == Task::STEP && batchedComponents && frameSkip == 1 && !measure) {
+        stepShard(threadIdx, envSplits[threadIdx], envSplits[threadIdx + 1]);
+    } else {
+        for (int envIdx = envSplits[threadIdx]; envIdx < envSplits[threadIdx + 1]; ++envIdx)
+            run(envIdx);
+    }
+
+    threadSlots[threadIdx].busyNs.fetch_add(ScopedProfiler::nowNs() - startNs, std::memory_order_relaxed);
 }
 
 void VectorEnv::executeTask(Task task)
 {
-    numReady = 0;
+    TCHECK(!asyncStepInProgress);
+
+    if (lowLatency && task != Task::TERMINATE) {
+        // everything on the calling thread, the workers stay parked on the dispatch barrier, see setLowLatency()
+        numWorkingThreads = 1;
+        useWorkQueues = false;
+        currTask = task;
+        lastMainThreadWaitNs = 0;
+
+        taskFunc(task, 0);
+        return;
+    }
 
-    std::unique_lock<std::mutex> lock{mutex};
-    for (int threadIdx = 1; threadIdx < numThreads; ++threadIdx)
-        currTasks[threadIdx] = task;
+    numWorkingThreads = task == Task::TERMINATE ? numThreads : numActiveThreads;
+    useWorkQueues = scheduler == Scheduler::WorkStealing && task != Task::TERMINATE;
+    if (useWorkQueues)
+        fillWorkQueues(0);
 
-    cvTask.notify_all();
-    lock.unlock();
+    currTask = task;
+    lastMainThreadWaitNs = dispatchBarrier.arriveAndWait();
 
     taskFunc(task, 0);
 
-    // just waiting on an atomic, this is a bit faster than conditional variable
-    // tradeoff - using more CPU cycles?
-    while (numReady < numThreads - 1);
+    lastMainThreadWaitNs += completionBarrier.arriveAndWait();
 }
 
 void VectorEnv::step()
 {
-    executeTask(Task::STEP);
+    const auto startNs = threadTuning.calibrationSteps > 0 ? ScopedProfiler::nowNs() : 0;
 
-    // do this in background thread??
-    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
-        if (envs[envIdx]->isDone()) {
-            done[envIdx] = true;
-            for (int agentIdx = 0; agentIdx < envs[envIdx]->getNumAgents(); ++agentIdx)
-                trueObjectives[envIdx][agentIdx] = envs[envIdx]->trueObjective(agentIdx);
-            envs[envIdx]->reset();
-            renderer.reset(*envs[envIdx], envIdx);
-            renderer.preDraw(*envs[envIdx], envIdx);
-        } else {
-            done[envIdx] = false;
-        }
+    stopPool();
+    applyRewardShaping();
+    numVectorSteps.fetch_add(1, std::memory_order_relaxed);
+    startBackgroundResets();
+    prepareShards();
+
+    {
+        ProfilerZone zone{simulateZone};
+        executeTask(Task::STEP);
     }
 
-    renderer.draw(envs);
+    finishStep();
+
+    if (threadTuning.calibrationSteps > 0)
+        tuneThreads(ScopedProfiler::nowNs() - startNs);
 }
 
-void VectorEnv::reset()
+void VectorEnv::stepAsync()
 {
-    // reset renderer on the main thread
-    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
-        envs[envIdx]->reset();
-        renderer.reset(*envs[envIdx], envIdx);
-        renderer.preDraw(*envs[envIdx], envIdx);
+    TCHECK(!asyncStepInProgress);
+    stopPool();
+    applyRewardShaping();
+    numVectorSteps.fetch_add(1, std::memory_order_relaxed);
+
+    if (numThreads == 1 || lowLatency) {
+        // no workers to offload the simulation to
+        startBackgroundResets();
+        prepareShards();
+        ProfilerZone zone{simulateZone};
+        numWorkingThreads = 1;
+        useWorkQueues = false;
+        taskFunc(Task::STEP, 0);
+        return;
     }
 
-    renderer.draw(envs);
+    asyncStepStartNs = ScopedProfiler::nowNs();
+    startBackgroundResets();
+    prepareShards();
+
+    // main thread is not participating, so distribute everything between the workers
+    numWorkingThreads = std::max(numActiveThreads, 2);
+    useWorkQueues = true;
+    fillWorkQueues(1);
+
+    currTask = Task::STEP;
+    lastMainThreadWaitNs = dispatchBarrier.arriveAndWait();
+    asyncStepInProgress = true;
 }
 
-void VectorEnv::close()
+void VectorEnv::stepWait()
 {
-    executeTask(Task::TERMINATE);
-    for (auto &t : backgroundThreads)
-        t.join();
+    if (asyncStepInProgress) {
+        lastMainThreadWaitNs += completionBarrier.arriveAndWait();
+        asyncStepInProgress = false;
+
+        if (ScopedProfiler::enabled())
+            sprof().record(simulateZone, asyncStepStartNs, ScopedProfiler::nowNs(), 0);
+    }
+
+    finishStep();
+}
+
+void VectorEnv::finishStep()
+{
+    // previous frame was rendered while we were simulating
+    if (pipelinedRendering) {
+        PROFILE_ZONE("Renderer::waitForFrame");
+        renderer.waitForFrame();
+    }
+
+    std::fill(episodeStarted.begin(), episodeStarted.end(), 0);
+    finishBackgroundResets();
+
+    if (drawsTerminalFrames())
+        drawTerminalFrames();
+
+    // forked envs jumped to another state, so their frames start over as well
+    for (int envIdx = 0; envIdx < numActiveEnvs; ++envIdx)
+        if (std::exchange(forkTargets[envIdx], uint8_t(FORK_NONE)) != FORK_NONE)
+            episodeStarted[envIdx] = 1;
+
+    // envs are already reset by the workers, here we just finish the renderer-side registration
+    {
+        PROFILE_ZONE("Renderer::finishReset");
+        for (int envIdx = 0; envIdx < numActiveEnvs; ++envIdx) {
+            done[envIdx] = doneFlags[envIdx];
+            numEpisodeResets += done[envIdx];
+
+            // incremental resets finish in a later step, the env stays masked until then
+            const auto incrementalReset = envSlots[envIdx].incrementalReset;
+            if (incrementalReset == RESET_RUNNING) {
+                masked[envIdx] = 1;
+                continue;
+            }
+
+            if (incrementalReset == RESET_FINISHED)
+                envSlots[envIdx].incrementalReset = RESET_NONE, masked[envIdx] = 0;
+            else if (!done[envIdx])
+                continue;
+
+            if (backgroundResetsEnabled && incrementalReset == RESET_NONE) {
+                // started by the next step, see setBackgroundResets()
+                masked[envIdx] = 1;
+                backgroundResets.push_back(envIdx);
+            } else {
+                episodeStarted[envIdx] = 1;
+                renderer.finishReset(*envs[envIdx], envIdx);
+                renderer.preDraw(*envs[envIdx], envIdx);
+            }
+        }
+    }
+
+    const bool anyMasked = std::any_of(masked.begin(), masked.begin() + numActiveEnvs, [](auto m) { return m != 0; });
+
+    // the terminal pass left a mask of the done envs in the renderer
+    if (!renderMask.empty() || freezeDoneAgents || !terminalEnvs.empty() || anyMasked) {
+        if (renderMask.empty())
+            frameRenderMask.assign(lastRewards.size(), 1);
+        else
+            frameRenderMask = renderMask;
+
+        for (int envIdx = 0; envIdx < numActiveEnvs; ++envIdx) {
+            const auto agentOffset = agentOffsets[envIdx], numAgents = envs[envIdx]->getNumAgents();
+            if (episodeStarted[envIdx])
+                std::fill_n(frameRenderMask.begin() + agentOffset, numAgents, 1);
+            else if (masked[envIdx])
+                std::fill_n(frameRenderMask.begin() + agentOffset, numAgents, 0);
+            else if (freezeDoneAgents)
+                for (int agent = agentOffset; agent < agentOffset + numAgents; ++agent)
+                    frameRenderMask[agent] &= !agentDoneFlags[agent];
+        }
+
+        renderer.setRenderMask(frameRenderMask);
+    } else if (maskedEnvsDrawn)
+        renderer.setRenderMask(renderMask);
+
+    maskedEnvsDrawn = anyMasked;
+
+    {
+        PROFILE_ZONE("Renderer::draw");
+        if (pipelinedRendering)
+            renderer.drawAsync(envs);
+        else
+            renderer.draw(envs);
+    }
+
+    if (encoder) {
+        PROFILE_ZONE("VectorEnv::encode");
+        executeTask(Task::ENCODE);
+    }
+
+    if (recorder)
+        recorder->endFrame();
+
+    // drain the per-thread buffers once per step, well before they can overflow
+    if (ScopedProfiler::enabled())
+        sprof().collect();
+}
+
+void VectorEnv::reset()
+{
+    PROFILE_ZONE("VectorEnv::reset");
+    ++numResets;
+
+    stopPool();
+    applyRewardShaping();
+
+    renderer.waitForFrame();
+
+    std::fill(lastRewards.begin(), lastRewards.end(), 0.0f);
+    std::fill(doneFlags.begin(), doneFlags.end(), 0);
+    std::fill(agentDoneFlags.begin(), agentDoneFlags.end(), 0);
+    terminalEnvs.clear();
+    std::fill(terminalSlots.begin(), terminalSlots.end(), -1);
+
+    // every env starts a new episode anyway
+    std::fill(masked.begin(), masked.end(), 0);
+    for (auto &slot : envSlots)
+        slot.incrementalReset = RESET_NONE;
+    std::fill(forkTargets.begin(), forkTargets.end(), 0);
+    backgroundResets.clear();
+
+    // envs are reset by the threads that step them, so the new episode is allocated on their NUMA node
+    executeTask(Task::RESET);
+
+    if (recorder)
+        recorder->endFrame();
+
+    // reset renderer on the main thread
+    for (int envIdx = 0; envIdx < numActiveEnvs; ++envIdx) {
+        PROFILE_ZONE("Renderer::reset");
+        renderer.reset(*envs[envIdx], envIdx);
+        renderer.preDraw(*envs[envIdx], envIdx);
+    }
+
+    {
+        PROFILE_ZONE("Renderer::draw");
+        if (!renderMask.empty())
+            renderer.setRenderMask({});
+
+        renderer.draw(envs);
+    }
+
+    if (encoder) {
+        PROFILE_ZONE("VectorEnv::encode");
+        encoder->requestKeyframes();
+        executeTask(Task::ENCODE);
+    }
+}
+
+bool VectorEnv::fork(int envIdx, const std::vector<int> &targetIndices)
+{
+    PROFILE_ZONE("VectorEnv::fork");
+    TCHECK(!asyncStepInProgress);
+    TCHECK(envIdx >= 0 && envIdx < numActiveEnvs);
+
+    for (auto target : targetIndices)
+        if (target < 0 || target >= numActiveEnvs || target == envIdx) {
+            TLOG(ERROR) << "Env " << target << " can't be a fork target of env " << envIdx;
+            return false;
+        }
+
+    if (masked[envIdx]) {
+        TLOG(ERROR) << "Env " << envIdx << " is waiting for a reset and can't be forked";
+        return false;
+    }
+
+    stopPool();
+
+    auto &source = *envs[envIdx];
+    if (!source.saveState(forkState)) {
+        TLOG(ERROR) << "Scenario " << source.getScenarioName() << " does not support snapshots";
+        return false;
+    }
+
+    renderer.waitForFrame();
+
+    forkSource = envIdx;
+    for (auto target : targetIndices) {
+        forkTargets[target] = FORK_PENDING;
+
+        // the state of the source replaces the terminal state, restoring it abandons an incremental reset
+        if (masked[target]) {
+            masked[target] = 0;
+            if (envSlots[target].incrementalReset != RESET_NONE)
+                envSlots[target].incrementalReset = RESET_NONE;
+            else
+                backgroundResets.erase(std::find(backgroundResets.begin(), backgroundResets.end(), target));
+        }
+    }
+
+    // targets restore the snapshot on the threads that own them, in parallel
+    executeTask(Task::FORK);
+
+    bool success = true;
+    for (auto target : targetIndices) {
+        auto &env = *envs[target];
+
+        // listed more than once
+        const auto status = std::exchange(forkTargets[target], uint8_t(FORK_DONE));
+        if (status == FORK_DONE)
+            continue;
+
+        if (status == FORK_FAILED) {
+            TLOG(ERROR) << "Could not fork env " << envIdx << " into env " << target;
+            success = false;
+            continue;
+        }
+
+        std::copy_n(lastRewards.begin() + agentOffsets[envIdx], env.getNumAgents(), lastRewards.begin() + agentOffsets[target]);
+        doneFlags[target] = doneFlags[envIdx], done[target] = done[envIdx];
+
+        if (recorder)
+            recorder->recordEpisodeStart(target, env);
+
+        if (status == FORK_NEW_EPISODE)
+            renderer.reset(env, target);
+        renderer.preDraw(env, target);
+    }
+
+    if (recorder && !targetIndices.empty())
+        recorder->endFrame();
+
+    return success;
+}
+
+bool VectorEnv::canSend(const std::vector<int> &envIndices) const
+{
+    std::vector<uint8_t> seen(envs.size());
+    for (auto envIdx : envIndices) {
+        if (envIdx < 0 || envIdx >= numActiveEnvs) {
+            TLOG(ERROR) << "Env index " << envIdx << " is not an active env";
+            return false;
+        }
+
+        if (poolEnvsInFlight[envIdx] || seen[envIdx]) {
+            TLOG(ERROR) << "Env " << envIdx << " is sent twice or still in flight";
+            return false;
+        }
+        seen[envIdx] = 1;
+    }
+
+    return true;
+}
+
+bool VectorEnv::send(const std::vector<int> &envIndices)
+{
+    TCHECK(!asyncStepInProgress);
+
+    // nothing is queued unless all envs can go, a duplicate would be stepped by two workers at once
+    if (!canSend(envIndices))
+        return false;
+
+    if (!poolRunning) {
+        const bool anyMasked = std::any_of(masked.begin(), masked.end(), [](auto m) { return m != 0; });
+        if (recorder || encoder || backgroundResetsEnabled || incrementalResetBudgetNs || anyMasked || terminalFrameBytes) {
+            TLOG(ERROR) << "Asynchronous env pool does not support recording, encoding, background or incremental resets and terminal observations";
+            return false;
+        }
+
+        // frames are drawn synchronously in recv()
+        renderer.waitForFrame();
+
+        poolRunning = true;
+        stopPoolWorkers.store(false, std::memory_order_relaxed);
+
+        // the main thread only sends, receives and renders
+        if (poolUsesWorkers()) {
+            numWorkingThreads = numThreads;
+            currTask = Task::POOL;
+            lastMainThreadWaitNs = dispatchBarrier.arriveAndWait();
+        }
+    }
+
+    numVectorSteps.fetch_add(1, std::memory_order_relaxed);
+    for (auto envIdx : envIndices) {
+        poolEnvsInFlight[envIdx] = 1;
+        ++poolInFlight;
+
+        if (poolUsesWorkers())
+            TCHECK(sentEnvs.push(envIdx));
+        else {
+            stepEnv(envIdx);
+            TCHECK(completedEnvs.push(envIdx));
+        }
+    }
+
+    return true;
+}
+
+const std::vector<int> & VectorEnv::recv(int batchSize)
+{
+    TCHECK(poolRunning && batchSize >= 1 && batchSize <= poolInFlight);
+
+    receivedEnvs.clear();
+    {
+        PROFILE_ZONE("VectorEnv::recv");
+
+        int envIdx;
+        while (int(receivedEnvs.size()) < batchSize) {
+            if (completedEnvs.pop(envIdx))
+                receivedEnvs.push_back(envIdx);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    poolInFlight -= batchSize;
+
+    poolRenderMask.assign(lastRewards.size(), 0);
+    for (auto envIdx : receivedEnvs) {
+        poolEnvsInFlight[envIdx] = 0;
+        finishPoolEnv(envIdx);
+
+        // the render mask still applies, except for the first frame of an episode
+        const auto agentOffset = agentOffsets[envIdx], numAgents = envs[envIdx]->getNumAgents();
+        for (int agent = agentOffset; agent < agentOffset + numAgents; ++agent) {
+            const bool frozen = freezeDoneAgents && agentDoneFlags[agent];
+            poolRenderMask[agent] = episodeStarted[envIdx] || ((renderMask.empty() || renderMask[agent]) && !frozen);
+        }
+    }
+
+    renderer.setRenderMask(poolRenderMask);
+    {
+        PROFILE_ZONE("Renderer::draw");
+        renderer.draw(envs);
+    }
+
+    return receivedEnvs;
+}
+
+void VectorEnv::stopPool()
+{
+    if (!poolRunning)
+        return;
+
+    // workers finish everything that is still queued before they leave the loop
+    if (poolUsesWorkers()) {
+        stopPoolWorkers.store(true, std::memory_order_release);
+        lastMainThreadWaitNs = completionBarrier.arriveAndWait();
+    }
+
+    // envs that were never received still need their renderer update before the next frame
+    int envIdx;
+    while (completedEnvs.pop(envIdx))
+        finishPoolEnv(envIdx);
+
+    poolInFlight = 0;
+    std::fill(poolEnvsInFlight.begin(), poolEnvsInFlight.end(), 0);
+    poolRunning = false;
+
+    renderer.setRenderMask(renderMask);
+}
+
+void VectorEnv::poolLoop(int threadIdx)
+{
+    constexpr int spinIterations = 1024;
+
+    int envIdx, idleIterations = 0;
+    while (true) {
+        // envs sent before the stop flag are visible once it is, so checking it first leaves nothing in the queue
+        const auto stopping = stopPoolWorkers.load(std::memory_order_acquire);
+
+        if (sentEnvs.pop(envIdx)) {
+            const auto startNs = ScopedProfiler::nowNs();
+            stepEnv(envIdx);
+            threadSlots[threadIdx].busyNs.fetch_add(ScopedProfiler::nowNs() - startNs, std::memory_order_relaxed);
+
+            TCHECK(completedEnvs.push(envIdx));
+            idleIterations = 0;
+        } else if (stopping)
+            break;
+        else if (++idleIterations < spinIterations)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+void VectorEnv::finishPoolEnv(int envIdx)
+{
+    auto &env = *envs[envIdx];
+
+    done[envIdx] = doneFlags[envIdx];
+    episodeStarted[envIdx] = doneFlags[envIdx];
+
+    if (done[envIdx]) {
+        ++numEpisodeResets;
+
+        // the env itself was reset by the worker
+        PROFILE_ZONE("Renderer::reset");
+        renderer.reset(env, envIdx);
+    }
+
+    renderer.preDraw(env, envIdx);
+}
+
+bool VectorEnv::publishRewardShaping(const std::vector<std::string> &rewardNames, const float *values, int numAgentsTotal)
+{
+    if (numAgentsTotal != int(lastRewards.size())) {
+        TLOG(ERROR) << "Expected reward shaping for " << lastRewards.size() << " agents, got " << numAgentsTotal;
+        return false;
+    }
+
+    // assign() reuses the capacity of the slot, so periodic updates don't allocate
+    auto &table = rewardShapingUpdates.writeSlot();
+    table.rewardNames.assign(rewardNames.begin(), rewardNames.end());
+    table.values.assign(values, values + size_t(numAgentsTotal) * rewardNames.size());
+
+    rewardShapingUpdates.publish();
+    return true;
+}
+
+void VectorEnv::applyRewardShaping()
+{
+    // workers are idle here
+    if (!rewardShapingUpdates.update())
+        return;
+
+    const auto &table = rewardShapingUpdates.readSlot();
+    const auto numRewards = int(table.rewardNames.size());
+
+    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
+        auto &scenario = envs[envIdx]->getScenario();
+        scenario.rewardSlots(table.rewardNames, rewardSlots);
+
+        for (int agentIdx = 0; agentIdx < envs[envIdx]->getNumAgents(); ++agentIdx) {
+            const auto *agentValues = table.values.data() + size_t(agentOffsets[envIdx] + agentIdx) * numRewards;
+            scenario.setRewardValues(agentIdx, rewardSlots.data(), agentValues, numRewards);
+        }
+    }
+}
+
+void VectorEnv::setRecorder(TrajectoryRecorder *trajectoryRecorder)
+{
+    TCHECK(!asyncStepInProgress);
+
+    if (recorder)
+        recorder->flush();
+
+    // nothing to record until the first reset (episode ids start from 1)
+    recorder = trajectoryRecorder;
+    if (!recorder || envs.front()->episodeId() == 0)
+        return;
+
+    for (int envIdx = 0; envIdx < numActiveEnvs; ++envIdx)
+        recorder->recordEpisodeStart(envIdx, *envs[envIdx]);
+    recorder->endFrame();
+}
+
+void VectorEnv::setRenderMask(std::vector<uint8_t> agentMask)
+{
+    TCHECK(!asyncStepInProgress);
+    TCHECK(agentMask.empty() || agentMask.size() == lastRewards.size());
+
+    renderMask = std::move(agentMask);
+    if (renderMask.empty())
+        renderer.setRenderMask({});
+}
+
+void VectorEnv::setFreezeDoneAgents(bool freeze)
+{
+    TCHECK(!asyncStepInProgress);
+
+    freezeDoneAgents = freeze;
+    for (auto &env : envs)
+        env->setFreezeDoneAgents(freeze);
+
+    if (!freeze && renderMask.empty())
+        renderer.setRenderMask({});
+}
+
+void VectorEnv::setPhysicsWorkers(int numThreads)
+{
+    TCHECK(!asyncStepInProgress);
+
+    for (auto &env : envs)
+        env->setPhysicsWorkers(nullptr);
+
+    physicsWorkers = numThreads > 0 ? std::make_unique<WorkerPool>(numThreads) : nullptr;
+    for (auto &env : envs)
+        env->setPhysicsWorkers(physicsWorkers.get());
+}
+
+void VectorEnv::setNumActiveEnvs(int numEnvs)
+{
+    TCHECK(!asyncStepInProgress);
+    TCHECK(numEnvs >= 1 && numEnvs <= int(envs.size()));
+
+    const auto prevNumActive = numActiveEnvs;
+    numActiveEnvs = numEnvs;
+    updateEnvSplits();
+
+    renderer.waitForFrame();
+    renderer.setNumActiveEnvs(numEnvs);
+
+    // envs that come back start a new episode, the rest of the batch keeps running
+    for (int envIdx = prevNumActive; envIdx < numEnvs; ++envIdx) {
+        PROFILE_ZONE("VectorEnv::activateEnv");
+
+        auto &env = *envs[envIdx];
+        resetEnv(envIdx);
+
+        doneFlags[envIdx] = 0, done[envIdx] = false;
+        if (masked[envIdx]) {
+            masked[envIdx] = 0;
+            if (envSlots[envIdx].incrementalReset != RESET_NONE)
+                envSlots[envIdx].incrementalReset = RESET_NONE;
+            else
+                backgroundResets.erase(std::find(backgroundResets.begin(), backgroundResets.end(), envIdx));
+        }
+        std::fill_n(lastRewards.begin() + agentOffsets[envIdx], env.getNumAgents(), 0.0f);
+
+        renderer.reset(env, envIdx);
+        renderer.preDraw(env, envIdx);
+    }
+
+    if (recorder && numEnvs > prevNumActive)
+        recorder->endFrame();
+}
+
+void VectorEnv::setBatchedComponents(bool enabled)
+{
+    TCHECK(!asyncStepInProgress);
+
+    batchedComponents = enabled;
+    envComponents.clear();
+    if (enabled) {
+        for (auto &env : envs)
+            envComponents.push_back(env->getScenario().batchedComponents());
+
+        componentPasses.resize(size_t(numThreads));
+    }
+
+    for (auto &env : envs)
+        env->setBatchedComponents(false);
+}
+
+void VectorEnv::setNumActiveThreads(int numThreadsActive)
+{
+    TCHECK(!asyncStepInProgress);
+
+    // the calling thread steps every env in the low-latency mode
+    numActiveThreads = lowLatency ? 1 : std::clamp(numThreadsActive, 1, numThreads);
+    updateEnvSplits();
+}
+
+void VectorEnv::setLowLatency(bool enabled)
+{
+    TCHECK(!asyncStepInProgress);
+
+    // the pool and the thread tuning both need the workers
+    stopPool();
+    if (enabled)
+        setThreadAutoTuning(0, 0);
+
+    lowLatency = enabled;
+    setNumActiveThreads(numThreads);
+}
+
+void VectorEnv::setThreadAutoTuning(int calibrationSteps, int retuneInterval)
+{
+    TCHECK(!asyncStepInProgress);
+
+    auto &t = threadTuning;
+    if (calibrationSteps <= 0 || numThreads == 1) {
+        // an unfinished calibration leaves a candidate active, a finished one keeps its result
+        if (t.candidate >= 0)
+            setNumActiveThreads(numThreads);
+
+        t.calibrationSteps = 0, t.candidate = -1;
+        measureEnvCosts = false;
+        return;
+    }
+
+    t.calibrationSteps = calibrationSteps;
+    t.retuneInterval = retuneInterval;
+    startCalibration();
+}
+
+void VectorEnv::startCalibration()
+{
+    auto &t = threadTuning;
+
+    t.candidates.clear();
+    for (int n = 1; n < numThreads; n *= 2)
+        t.candidates.push_back(n);
+    t.candidates.push_back(numThreads);
+
+    t.candidateNs.assign(t.candidates.size(), 0);
+    t.candidate = 0, t.step = 0;
+
+    // a single thread needs no partitioning, by the next candidate the costs are known
+    for (auto &slot : envSlots)
+        slot.stepNs = 0;
+    measureEnvCosts = true;
+    setNumActiveThreads(t.candidates.front());
+}
+
+void VectorEnv::tuneThreads(uint64_t stepNs)
+{
+    auto &t = threadTuning;
+
+    if (t.candidate < 0) {
+        if (t.retuneInterval > 0 && ++t.stepsSinceCalibration >= t.retuneInterval)
+            startCalibration();
+        return;
+    }
+
+    // the first step of a candidate moves envs between threads and wakes up the new ones
+    if (t.step++ > 0)
+        t.candidateNs[t.candidate] += stepNs;
+    if (t.step <= t.calibrationSteps)
+        return;
+
+    if (++t.candidate < int(t.candidates.size())) {
+        t.step = 0;
+        setNumActiveThreads(t.candidates[t.candidate]);
+        return;
+    }
+
+    const auto best = int(std::min_element(t.candidateNs.begin(), t.candidateNs.end()) - t.candidateNs.begin());
+    t.stepsPerSec = float(1e9 * t.calibrationSteps / double(std::max(t.candidateNs[best], uint64_t(1))));
+    t.candidate = -1, t.stepsSinceCalibration = 0;
+    ++t.numCalibrations;
+
+    // the measured costs keep defining the partitioning until the next calibration
+    measureEnvCosts = false;
+    setNumActiveThreads(t.candidates[best]);
+
+    TLOG(INFO) << "Thread auto-tuning: " << numActiveThreads << " of " << numThreads << " simulation threads, "
+               << t.stepsPerSec << " steps/sec";
+}
+
+void VectorEnv::setBackgroundResets(bool enabled)
+{
+    TCHECK(!asyncStepInProgress);
+
+    backgroundResetsEnabled = enabled;
+    if (enabled && !resetThread.joinable())
+        resetThread = std::thread{[this] { backgroundResetLoop(); }};
+}
+
+void VectorEnv::setIncrementalResets(uint64_t stepBudgetNs)
+{
+    TCHECK(!asyncStepInProgress);
+
+    // resets already in progress continue with the new budget, at least one stage per step
+    incrementalResetBudgetNs = stepBudgetNs;
+}
+
+void VectorEnv::setEpisodePregenerator(EpisodePregenerator *episodePregenerator)
+{
+    TCHECK(!asyncStepInProgress);
+    pregenerator = episodePregenerator;
+}
+
+void VectorEnv::setObservationEncoder(ObservationEncoder *observationEncoder)
+{
+    TCHECK(!asyncStepInProgress);
+
+    encoder = observationEncoder;
+    if (encoder)
+        encoder->requestKeyframes();
+}
+
+void VectorEnv::setRaySensors(RaySensors *raySensors)
+{
+    TCHECK(!asyncStepInProgress);
+    sensors = raySensors;
+}
+
+void VectorEnv::close()
+{
+    stopPool();
+
+    if (asyncStepInProgress) {
+        completionBarrier.arriveAndWait();
+        asyncStepInProgress = false;
+    }
+
+    if (backgroundResetsInProgress) {
+        resetCompletionBarrier.arriveAndWait();
+        backgroundResetsInProgress = false;
+    }
+
+    if (resetThread.joinable()) {
+        terminateResetThread = true;
+        resetDispatchBarrier.arriveAndWait();
+        resetThread.join();
+    }
+
+    renderer.waitForFrame();
+
+    executeTask(Task::TERMINATE);
+    for (auto &t : backgroundThreads)
+        t.join();
+
+    // the envs outlive the vector env
+    if (physicsWorkers)
+        setPhysicsWorkers(0);
+}
+
+void VectorEnv::setSpinBudget(int numIterations)
+{
+    dispatchBarrier.setSpinBudget(numIterations);
+    completionBarrier.setSpinBudget(numIterations);
+    resetDispatchBarrier.setSpinBudget(numIterations);
+    resetCompletionBarrier.setSpinBudget(numIterations);
+}
+
+VectorEnv::WaitStats VectorEnv::getWaitStats() const
+{
+    WaitStats stats;
+    stats.lastMainThreadWaitUsec = float(lastMainThreadWaitNs) / 1e3f;
+    stats.totalWaitUsec = float(dispatchBarrier.totalWaitNs() + completionBarrier.totalWaitNs()) / 1e3f;
+    stats.numParked = dispatchBarrier.numParked() + completionBarrier.numParked();
+    return stats;
+}
+
+void VectorEnv::resetWaitStats()
+{
+    dispatchBarrier.resetStats();
+    completionBarrier.resetStats();
+}
+
+VectorEnv::Stats VectorEnv::getStats() const
+{
+    Stats stats;
+    stats.numEpisodeResets = numEpisodeResets;
+    stats.numResets = numResets;
+
+    stats.numActiveThreads = numActiveThreads;
+    for (int threadIdx = 0; threadIdx < numThreads; ++threadIdx)
+        stats.envsPerThread.push_back(envSplits[threadIdx + 1] - envSplits[threadIdx]);
+    stats.tunedStepsPerSec = threadTuning.stepsPerSec;
+    stats.numCalibrations = threadTuning.numCalibrations;
+
+    const auto wallNs = double(std::max(ScopedProfiler::nowNs() - statsStartNs, uint64_t(1)));
+    for (const auto &slot : threadSlots)
+        stats.threadUtilization.emplace_back(float(double(slot.busyNs.load(std::memory_order_relaxed)) / wallNs));
+
+    return stats;
+}
+
+MemoryReport VectorEnv::memoryReport(bool perEnv) const
+{
+    MemoryReport report;
+
+    for (size_t i = 0; i < envs.size(); ++i) {
+        MemoryReport envReport;
+        envs[i]->memoryReport(envReport);
+        report.merge(envReport, perEnv ? "env." + std::to_string(i) + "." : "env.");
+    }
+
+    renderer.memoryReport(report);
+
+    report.add("vector_env.buffers", vectorBytes(lastRewards) + vectorBytes(lastTrueObjectives) + vectorBytes(doneFlags) + vectorBytes(agentDoneFlags)
+        + vectorBytes(trueObjectives) + vectorBytes(repeatedActions) + vectorBytes(agentOffsets) + vectorBytes(episodeStats) + vectorBytes(terminalObservations) + vectorBytes(envSlots));
+    // contiguous slots plus the per-agent scratch buffers of about the same size
+    if (encoder)
+        report.add("vector_env.encoder", encoder->getSlotBytes() * encoder->getEncodedSizes().size() * 2);
+    if (sensors)
+        report.add("vector_env.ray_sensors", sensors->memoryBytes());
+
+    report.add("process.bullet", BulletMemory::counter().liveBytes());
+    report.add("process.bullet_peak", BulletMemory::counter().peakBytes());
+    report.add("process.scene_graph", SceneNode::memoryCounter().liveBytes() + RigidBody::memoryCounter().liveBytes());
+
+    double vmBytes, rssBytes;
+    unixProcessMemUsage(vmBytes, rssBytes);
+    report.add("process.rss", size_t(rssBytes));
+    report.add("process.vm", size_t(vmBytes));
+
+    return report;
+}
+
+void VectorEnv::resetStats()
+{
+    resetWaitStats();
+
+    for (auto &slot : threadSlots)
+        slot.busyNs.store(0, std::memory_order_relaxed);
+
+    statsStartNs = ScopedProfiler::nowNs();
+    numEpisodeResets = numResets = 0;
 }
@@ -0,0 +1,189 @@
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include <util/philox.hpp>
+#include <util/os_utils.hpp>
+#include <util/scoped_profiler.hpp>
+
+#include <env/vector_env_benchmark.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+class ActionDriver
+{
+public:
+    ActionDriver(VectorEnv &venv, const BenchmarkOptions &options)
+    : venv{venv}
+    , options{options}
+    {
+        for (int envIdx = 0; envIdx < int(venv.envs.size()); ++envIdx)
+            rngs.emplace_back(Philox4x32::forStream(options.seed, uint32_t(envIdx), 0));
+
+        const auto &last = venv.envs.back();
+        prevActions.assign(size_t(venv.agentOffsets.back() + last->getNumAgents()), Action::Idle);
+    }
+
+    void setActions(int step)
+    {
+        // 24 bits of the random word are compared against the probability, the rest picks the action
+        const auto repeatThreshold = uint32_t(options.repeatProbability * float(1 << 24));
+
+        for (int envIdx = 0; envIdx < venv.getNumActiveEnvs(); ++envIdx) {
+            auto &env = *venv.envs[envIdx];
+            auto &rng = rngs[envIdx];
+
+            for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+                const auto i = size_t(venv.agentOffsets[envIdx] + agentIdx);
+                auto &action = prevActions[i];
+
+                if (!options.script.empty())
+                    action = options.script[(size_t(step) * prevActions.size() + i) % options.script.size()];
+                else {
+                    const auto r = rng();
+                    if ((r & 0xffffff) >= repeatThreshold || action == Action::Idle)
+                        action = Action(1 << ((r >> 24) % uint32_t(Action::NumActions)));
+                }
+
+                env.setAction(agentIdx, action);
+            }
+        }
+    }
+
+private:
+    VectorEnv &venv;
+    const BenchmarkOptions &options;
+
+    std::vector<Philox4x32> rngs;
+    std::vector<Action> prevActions;
+};
+
+}
+
+
+BenchmarkReport Megaverse::runBenchmark(VectorEnv &venv, const BenchmarkOptions &options)
+{
+    ActionDriver driver{venv, options};
+
+    for (int step = 0; step < options.warmupSteps; ++step) {
+        driver.setActions(step);
+        venv.step();
+    }
+
+    const auto profilerWasEnabled = ScopedProfiler::enabled(), countersWereEnabled = ScopedProfiler::countersEnabled();
+    sprof().collect();
+    sprof().clear();
+    sprof().setEnabled(true);
+
+    // worker threads open their counters on their first zone, the main thread tells whether it works at all
+    const auto hasCounters = options.perfCounters && sprof().setCountersEnabled(true);
+    if (options.perfCounters && !hasCounters)
+        sprof().setCountersEnabled(countersWereEnabled);
+    venv.resetStats();
+
+    std::vector<uint64_t> stepNs;
+    stepNs.reserve(size_t(options.numSteps));
+
+    const auto startNs = ScopedProfiler::nowNs();
+    for (int step = 0; step < options.numSteps; ++step) {
+        driver.setActions(options.warmupSteps + step);
+
+        const auto stepStartNs = ScopedProfiler::nowNs();
+        venv.step();
+        stepNs.push_back(ScopedProfiler::nowNs() - stepStartNs);
+    }
+    const auto wallNs = ScopedProfiler::nowNs() - startNs;
+
+    sprof().setEnabled(profilerWasEnabled);
+    sprof().setCountersEnabled(countersWereEnabled);
+    sprof().collect();
+
+    BenchmarkReport report;
+    report.hasCounters = hasCounters;
+    report.numEnvs = venv.getNumActiveEnvs();
+    for (int envIdx = 0; envIdx < report.numEnvs; ++envIdx)
+        report.numAgents += venv.envs[envIdx]->getNumAgents();
+
+    report.numSteps = options.numSteps;
+    report.wallSec = double(wallNs) * 1e-9;
+    if (report.wallSec > 0) {
+        report.stepsPerSec = options.numSteps / report.wallSec;
+        report.fps = report.stepsPerSec * report.numAgents * venv.getFrameSkip();
+    }
+
+    constexpr double nsToUsec = 1e-3;
+
+    report.lowLatency = venv.isLowLatency();
+    if (!stepNs.empty()) {
+        std::sort(stepNs.begin(), stepNs.end());
+        const auto percentile = [&](double p) { return double(stepNs[size_t(p * double(stepNs.size() - 1))]) * nsToUsec; };
+
+        double totalNs = 0;
+        for (auto ns : stepNs)
+            totalNs += double(ns);
+
+        report.latencyMeanUsec = totalNs / double(stepNs.size()) * nsToUsec;
+        report.latencyP50Usec = percentile(0.5), report.latencyP99Usec = percentile(0.99);
+        report.latencyMaxUsec = double(stepNs.back()) * nsToUsec;
+    }
+
+    const auto hists = sprof().histograms();
+    for (size_t zone = 0; zone < hists.size(); ++zone) {
+        const auto &h = hists[zone];
+        if (!h.count)
+            continue;
+
+        const auto &name = sprof().zoneName(ProfilerZoneId(zone));
+        report.stages.push_back({
+            name, h.count, h.meanNs() * nsToUsec, h.percentile(0.5) * nsToUsec, h.percentile(0.99) * nsToUsec,
+            double(h.maxNs) * nsToUsec, hasCounters ? sprof().counters(name) : PerfCounterValues{}
+        });
+    }
+
+    const auto stats = venv.getStats();
+    report.threadUtilization = stats.threadUtilization;
+    report.numEpisodeResets = stats.numEpisodeResets;
+    report.numActiveThreads = stats.numActiveThreads;
+
+    unixProcessMemUsage(report.vmBytes, report.rssBytes);
+    return report;
+}
+
+std::string BenchmarkReport::toJson() const
+{
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(3);
+    s << "{\"num_envs\":" << numEnvs << ",\"num_agents\":" << numAgents << ",\"num_steps\":" << numSteps
+      << ",\"wall_sec\":" << wallSec << ",\"fps\":" << fps << ",\"steps_per_sec\":" << stepsPerSec
+      << ",\"num_episode_resets\":" << numEpisodeResets << ",\"active_threads\":" << numActiveThreads
+      << ",\"vm_bytes\":" << uint64_t(vmBytes) << ",\"rss_bytes\":" << uint64_t(rssBytes)
+      << ",\"low_latency\":" << (lowLatency ? "true" : "false") << ",\"latency_mean_us\":" << latencyMeanUsec
+      << ",\"latency_p50_us\":" << latencyP50Usec << ",\"latency_p99_us\":" << latencyP99Usec
+      << ",\"latency_max_us\":" << latencyMaxUsec;
+
+    s << ",\"thread_utilization\":[";
+    for (size_t i = 0; i < threadUtilization.size(); ++i)
+        s << (i ? "," : "") << threadUtilization[i];
+
+    s << "],\"stages\":[";
+    for (size_t i = 0; i < stages.size(); ++i) {
+        const auto &st = stages[i];
+        s << (i ? "," : "") << "{\"name\":\"" << st.name << "\",\"count\":" << st.count << ",\"mean_us\":" << st.meanUsec
+          << ",\"p50_us\":" << st.p50Usec << ",\"p99_us\":" << st.p99Usec << ",\"max_us\":" << st.maxUsec;
+
+        if (hasCounters) {
+            const auto &c = st.counters;
+            s << ",\"cycles\":" << c.cycles << ",\"instructions\":" << c.instructions << ",\"ipc\":" << c.ipc()
+              << ",\"llc_misses\":" << c.llcMisses << ",\"branch_misses\":" << c.branchMisses;
+        }
+        s << "}";
+    }
+    s << "]}";
+
+    return s.str();
+}
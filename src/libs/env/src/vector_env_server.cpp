@@ -0,0 +1,617 @@
+#include <new>
+#include <deque>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include <poll.h>
+
+#include <util/tiny_logger.hpp>
+
+#include <env/vector_env_server.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+constexpr size_t bufferAlignment = 64;
+
+size_t alignUp(size_t offset) { return (offset + bufferAlignment - 1) / bufferAlignment * bufferAlignment; }
+
+/**
+ * First env of the slice when the envs are split evenly between the slices.
+ */
+int sliceBegin(int numEnvs, int numSlices, int sliceIdx) { return int(int64_t(numEnvs) * sliceIdx / numSlices); }
+
+/**
+ * Actions come from other processes, only the bits of the action space are accepted (Action::Idle is 0, the actions
+ * start at bit 1).
+ */
+constexpr int32_t actionMask = ((1 << int(Action::NumActions)) - 1) & ~1;
+
+bool validAction(int32_t action) { return (action & ~actionMask) == 0; }
+
+/**
+ * Upper bound for the observation of one agent a client accepts from a server.
+ */
+constexpr uint64_t maxObsBytes = uint64_t(1) << 28;
+
+bool validObsSize(int32_t obsW, int32_t obsH, int32_t obsChannels)
+{
+    return obsW >= 1 && obsH >= 1 && obsChannels >= 1 && uint64_t(obsW) * uint64_t(obsH) * uint64_t(obsChannels) <= maxObsBytes;
+}
+
+/**
+ * Counts and agent offsets a client got from the server, checked before anything is indexed with them.
+ */
+bool validLayout(const VectorEnvShmHeader &h, const int32_t *agentOffsets)
+{
+    if (h.numEnvs < 1 || h.numAgents < h.numEnvs || h.numSlices < 1 || h.numSlices > h.numEnvs)
+        return false;
+
+    if (agentOffsets[0] != 0 || agentOffsets[h.numEnvs] != h.numAgents)
+        return false;
+
+    for (int envIdx = 0; envIdx < h.numEnvs; ++envIdx)
+        if (agentOffsets[envIdx + 1] <= agentOffsets[envIdx])
+            return false;
+
+    return true;
+}
+
+template<typename T>
+void append(std::vector<uint8_t> &message, const T *values, size_t count)
+{
+    const auto bytes = reinterpret_cast<const uint8_t *>(values);
+    message.insert(message.end(), bytes, bytes + count * sizeof(T));
+}
+
+}
+
+
+size_t VectorEnvShmHeader::computeLayout()
+{
+    agentOffsetsOffset = alignUp(sizeof(VectorEnvShmHeader));
+    actionsOffset = alignUp(agentOffsetsOffset + (numEnvs + 1) * sizeof(int32_t));
+    obsOffset = alignUp(actionsOffset + numAgents * sizeof(int32_t));
+    rewardsOffset = alignUp(obsOffset + numAgents * obsBytesPerAgent);
+    donesOffset = alignUp(rewardsOffset + numAgents * sizeof(float));
+
+    return donesOffset + numEnvs;
+}
+
+VectorEnvServer::VectorEnvServer(VectorEnv &vectorEnv, int obsW, int obsH, int obsChannels, const std::string &name, int numSlices)
+: vectorEnv{vectorEnv}
+{
+    const auto numEnvs = int(vectorEnv.envs.size());
+    const auto numAgents = int(vectorEnv.lastRewards.size());
+    const auto obsBytesPerAgent = size_t(obsW) * size_t(obsH) * size_t(obsChannels);
+
+    if (numSlices < 1 || numSlices > numEnvs) {
+        TLOG(ERROR) << "Cannot split " << numEnvs << " envs into " << numSlices << " slices";
+        return;
+    }
+
+    VectorEnvShmHeader layout{};
+    layout.numEnvs = numEnvs, layout.numAgents = numAgents;
+    layout.obsBytesPerAgent = obsBytesPerAgent;
+
+    shm = SharedMemory::create(name, layout.computeLayout());
+    if (!shm.isOpen())
+        return;
+
+    // segment is zero-filled, so the atomics start at 0
+    header = reinterpret_cast<VectorEnvShmHeader *>(shm.data());
+    header->numEnvs = numEnvs, header->numAgents = numAgents, header->numSlices = numSlices;
+    header->obsW = obsW, header->obsH = obsH, header->obsChannels = obsChannels;
+    header->obsBytesPerAgent = obsBytesPerAgent;
+    header->computeLayout();
+
+    auto agentOffsets = reinterpret_cast<int32_t *>(shm.data() + header->agentOffsetsOffset);
+    for (int envIdx = 0; envIdx < numEnvs; ++envIdx)
+        agentOffsets[envIdx] = vectorEnv.agentOffsets[envIdx];
+    agentOffsets[numEnvs] = numAgents;
+
+    // clients check the magic value last, after the rest of the header is filled
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = VectorEnvShmHeader::magicValue;
+
+    TLOG(INFO) << "Serving " << numEnvs << " envs in " << numSlices << " slices through shared memory " << name;
+}
+
+void VectorEnvServer::serve()
+{
+    if (!header)
+        return;
+
+    vectorEnv.reset();
+    publish();
+    header->frame.fetch_add(1, std::memory_order_release);
+    futexWakeAll(header->frame);
+
+    const auto numSlices = uint32_t(header->numSlices);
+    const auto actions = reinterpret_cast<const int32_t *>(shm.data() + header->actionsOffset);
+
+    while (true) {
+        uint32_t ready;
+        while (!header->terminated.load(std::memory_order_acquire) && (ready = header->slicesReady.load(std::memory_order_acquire)) < numSlices)
+            futexWait(header->slicesReady, ready);
+
+        if (header->terminated.load(std::memory_order_acquire))
+            break;
+
+        // clients only arrive again after they see the new frame, so nobody can increment this in the meantime
+        header->slicesReady.store(0, std::memory_order_relaxed);
+
+        const auto numAgents = header->numAgents;
+        const auto invalid = std::find_if_not(actions, actions + numAgents, validAction);
+        if (invalid != actions + numAgents) {
+            TLOG(ERROR) << "Invalid action " << *invalid << " of agent " << (invalid - actions) << ", stopping";
+            terminate();
+            break;
+        }
+
+        for (int envIdx = 0; envIdx < header->numEnvs; ++envIdx) {
+            auto &env = *vectorEnv.envs[envIdx];
+            for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+                env.setAction(agentIdx, Action(actions[vectorEnv.agentOffsets[envIdx] + agentIdx]));
+        }
+
+        vectorEnv.step();
+        publish();
+
+        header->frame.fetch_add(1, std::memory_order_release);
+        futexWakeAll(header->frame);
+    }
+
+    TLOG(INFO) << "Shared memory server " << shm.name() << " terminated";
+}
+
+void VectorEnvServer::terminate()
+{
+    if (!header)
+        return;
+
+    header->terminated.store(1, std::memory_order_release);
+    futexWakeAll(header->slicesReady);
+    futexWakeAll(header->frame);
+}
+
+void VectorEnvServer::publish()
+{
+    const auto numAgents = size_t(header->numAgents);
+    const auto obsBytes = header->obsBytesPerAgent;
+    auto obs = shm.data() + header->obsOffset;
+
+    // the only copy of the observations on their way to the clients
+    if (const auto batch = vectorEnv.renderer.getObservationsBatch())
+        memcpy(obs, batch, numAgents * obsBytes);
+    else
+        for (int envIdx = 0; envIdx < header->numEnvs; ++envIdx)
+            for (int agentIdx = 0; agentIdx < vectorEnv.envs[envIdx]->getNumAgents(); ++agentIdx)
+                memcpy(obs + (vectorEnv.agentOffsets[envIdx] + agentIdx) * obsBytes, vectorEnv.renderer.getObservation(envIdx, agentIdx), obsBytes);
+
+    memcpy(shm.data() + header->rewardsOffset, vectorEnv.lastRewards.data(), numAgents * sizeof(float));
+    memcpy(shm.data() + header->donesOffset, vectorEnv.doneFlags.data(), vectorEnv.doneFlags.size());
+}
+
+
+VectorEnvClient::VectorEnvClient(const std::string &name, int sliceIdx)
+: shm{SharedMemory::attach(name)}
+{
+    if (!shm.isOpen())
+        return;
+
+    auto h = reinterpret_cast<VectorEnvShmHeader *>(shm.data());
+    if (shm.size() < sizeof(VectorEnvShmHeader) || h->magic != VectorEnvShmHeader::magicValue) {
+        TLOG(ERROR) << "Shared memory " << name << " does not belong to a VectorEnvServer or is not ready yet";
+        return;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // the buffers are only indexed through the offsets in the header, they must match the counts and the segment
+    VectorEnvShmHeader layout{};
+    layout.numEnvs = h->numEnvs, layout.numAgents = h->numAgents;
+    layout.obsBytesPerAgent = h->obsBytesPerAgent;
+
+    const bool validCounts = h->numEnvs >= 1 && h->numAgents >= h->numEnvs && validObsSize(h->obsW, h->obsH, h->obsChannels)
+        && h->obsBytesPerAgent == uint64_t(h->obsW) * uint64_t(h->obsH) * uint64_t(h->obsChannels);
+
+    if (!validCounts || shm.size() != layout.computeLayout() || h->agentOffsetsOffset != layout.agentOffsetsOffset
+        || h->actionsOffset != layout.actionsOffset || h->obsOffset != layout.obsOffset
+        || h->rewardsOffset != layout.rewardsOffset || h->donesOffset != layout.donesOffset) {
+        TLOG(ERROR) << "Shared memory " << name << " of size " << shm.size() << " is truncated or does not match the layout of its header";
+        return;
+    }
+
+    attachSlice(shm.data(), sliceIdx);
+}
+
+bool VectorEnvClient::attachSlice(uint8_t *buffer, int slice)
+{
+    auto h = reinterpret_cast<VectorEnvShmHeader *>(buffer);
+    if (slice < 0 || slice >= h->numSlices) {
+        TLOG(ERROR) << "Slice " << slice << " is out of range, server has " << h->numSlices << " slices";
+        return false;
+    }
+
+    const auto offsets = reinterpret_cast<const int32_t *>(buffer + h->agentOffsetsOffset);
+    if (!validLayout(*h, offsets)) {
+        TLOG(ERROR) << "Inconsistent env and agent counts from the server";
+        return false;
+    }
+
+    data = buffer;
+    header = h;
+    agentOffsets = offsets;
+
+    sliceIdx = slice;
+    firstEnv = sliceBegin(header->numEnvs, header->numSlices, sliceIdx);
+    lastEnv = sliceBegin(header->numEnvs, header->numSlices, sliceIdx + 1);
+    firstAgent = agentOffsets[firstEnv], lastAgent = agentOffsets[lastEnv];
+    return true;
+}
+
+bool VectorEnvClient::stepAsync()
+{
+    stepFrame = header->frame.load(std::memory_order_acquire);
+
+    // release makes the actions visible to the server
+    header->slicesReady.fetch_add(1, std::memory_order_acq_rel);
+    futexWakeAll(header->slicesReady);
+    return !header->terminated.load(std::memory_order_acquire);
+}
+
+bool VectorEnvClient::stepWait()
+{
+    return waitForFrame(stepFrame);
+}
+
+bool VectorEnvClient::waitForReset()
+{
+    return waitForFrame(0);
+}
+
+void VectorEnvClient::terminate()
+{
+    header->terminated.store(1, std::memory_order_release);
+    futexWakeAll(header->slicesReady);
+    futexWakeAll(header->frame);
+}
+
+bool VectorEnvClient::waitForFrame(uint32_t prevFrame)
+{
+    while (!header->terminated.load(std::memory_order_acquire)) {
+        if (header->frame.load(std::memory_order_acquire) != prevFrame)
+            return true;
+
+        futexWait(header->frame, prevFrame);
+    }
+
+    return false;
+}
+
+
+struct VectorEnvTcpServer::Slice
+{
+    TcpSocket socket;
+    bool compressed = false;
+
+    std::vector<int> envIndices;
+    int firstAgent = 0, lastAgent = 0;
+
+    // envs of the current step that are still in the pool, the client has at most one step in flight
+    int numPending = 0;
+
+    std::vector<int32_t> actions;
+    std::vector<FrameEncoder> encoders;
+    std::vector<uint8_t> message;
+};
+
+VectorEnvTcpServer::VectorEnvTcpServer(VectorEnv &vectorEnv, int obsW, int obsH, int obsChannels, int port, int numSlices)
+: vectorEnv{vectorEnv}
+, obsW{obsW}, obsH{obsH}, obsChannels{obsChannels}, numSlices{numSlices}
+, obsBytesPerAgent{size_t(obsW) * size_t(obsH) * size_t(obsChannels)}
+{
+    const auto numEnvs = int(vectorEnv.envs.size());
+    if (numSlices < 1 || numSlices > numEnvs) {
+        TLOG(ERROR) << "Cannot split " << numEnvs << " envs into " << numSlices << " slices";
+        return;
+    }
+
+    listener = TcpSocket::listen(port);
+    if (listener.isOpen())
+        TLOG(INFO) << "Serving " << numEnvs << " envs in " << numSlices << " slices on port " << listener.localPort();
+}
+
+VectorEnvTcpServer::~VectorEnvTcpServer() = default;
+
+bool VectorEnvTcpServer::acceptClients()
+{
+    const auto numEnvs = int(vectorEnv.envs.size()), numAgents = int(vectorEnv.lastRewards.size());
+    slices = std::vector<std::unique_ptr<Slice>>(size_t(numSlices));
+
+    int numConnected = 0;
+    while (numConnected < numSlices) {
+        if (terminated)
+            return false;
+
+        // wake up regularly to check for terminate()
+        auto socket = listener.accept(100);
+        if (!socket.isOpen())
+            continue;
+
+        uint32_t magic = 0, sliceIdx = 0, flags = 0;
+        if (!socket.recvValue(magic) || !socket.recvValue(sliceIdx) || !socket.recvValue(flags) || magic != magicValue) {
+            TLOG(WARNING) << "Rejected a connection that is not a VectorEnvTcpClient";
+            continue;
+        }
+
+        if (sliceIdx >= uint32_t(numSlices) || slices[sliceIdx]) {
+            TLOG(WARNING) << "Rejected a client for slice " << sliceIdx << ", it is out of range or already taken";
+            continue;
+        }
+
+        if (flags & ~uint32_t(COMPRESSED)) {
+            TLOG(WARNING) << "Rejected a client for slice " << sliceIdx << " with unknown flags " << flags;
+            continue;
+        }
+
+        const int32_t hello[] = {numEnvs, numAgents, numSlices, obsW, obsH, obsChannels};
+        std::vector<int32_t> agentOffsets{vectorEnv.agentOffsets.begin(), vectorEnv.agentOffsets.end()};
+        agentOffsets.push_back(numAgents);
+
+        if (!socket.sendAll(hello, sizeof(hello)) || !socket.sendAll(agentOffsets.data(), agentOffsets.size() * sizeof(int32_t)))
+            continue;
+
+        auto slice = std::make_unique<Slice>();
+        slice->socket = std::move(socket);
+        slice->compressed = flags & COMPRESSED;
+
+        const auto firstEnv = sliceBegin(numEnvs, numSlices, int(sliceIdx)), lastEnv = sliceBegin(numEnvs, numSlices, int(sliceIdx) + 1);
+        for (int envIdx = firstEnv; envIdx < lastEnv; ++envIdx)
+            slice->envIndices.push_back(envIdx);
+
+        slice->firstAgent = agentOffsets[firstEnv], slice->lastAgent = agentOffsets[lastEnv];
+        slice->actions.resize(size_t(slice->lastAgent - slice->firstAgent));
+        if (slice->compressed)
+            slice->encoders = std::vector<FrameEncoder>(slice->actions.size(), FrameEncoder{obsBytesPerAgent});
+
+        slices[sliceIdx] = std::move(slice);
+        ++numConnected;
+    }
+
+    return true;
+}
+
+bool VectorEnvTcpServer::sendFrame(Slice &slice)
+{
+    auto &message = slice.message;
+    message.clear();
+
+    const auto numAgents = size_t(slice.lastAgent - slice.firstAgent);
+    const auto firstEnv = slice.envIndices.front();
+
+    const uint32_t type = FRAME;
+    append(message, &type, 1);
+    append(message, vectorEnv.lastRewards.data() + slice.firstAgent, numAgents);
+    append(message, vectorEnv.doneFlags.data() + firstEnv, slice.envIndices.size());
+
+    for (auto envIdx : slice.envIndices)
+        for (int agentIdx = 0; agentIdx < vectorEnv.envs[envIdx]->getNumAgents(); ++agentIdx) {
+            const auto obs = vectorEnv.renderer.getObservation(envIdx, agentIdx);
+            if (!slice.compressed) {
+                append(message, obs, obsBytesPerAgent);
+                continue;
+            }
+
+            // size prefix is filled in after encoding, the first frame of an episode has nothing to refer to
+            const auto sizeAt = message.size();
+            message.resize(sizeAt + sizeof(uint32_t));
+            slice.encoders[size_t(vectorEnv.agentOffsets[envIdx] + agentIdx - slice.firstAgent)].encode(obs, vectorEnv.doneFlags[envIdx], message);
+
+            const auto size = uint32_t(message.size() - sizeAt - sizeof(uint32_t));
+            memcpy(message.data() + sizeAt, &size, sizeof(size));
+        }
+
+    return slice.socket.sendAll(message.data(), message.size());
+}
+
+void VectorEnvTcpServer::serve()
+{
+    if (!listener.isOpen() || !acceptClients())
+        return;
+
+    vectorEnv.reset();
+    for (auto &slice : slices)
+        sendFrame(*slice);
+
+    std::vector<int> envSlices(vectorEnv.envs.size());
+    for (int sliceIdx = 0; sliceIdx < numSlices; ++sliceIdx)
+        for (auto envIdx : slices[sliceIdx]->envIndices)
+            envSlices[envIdx] = sliceIdx;
+
+    std::vector<pollfd> fds;
+    for (const auto &slice : slices)
+        fds.push_back({slice->socket.descriptor(), POLLIN, 0});
+
+    // slices with envs in the pool, in the order their steps arrived
+    std::deque<int> pendingSlices;
+    int numInFlight = 0;
+
+    while (!terminated) {
+        // only block while there is nothing to simulate
+        if (poll(fds.data(), fds.size(), numInFlight > 0 ? 0 : 100) < 0 && errno != EINTR)
+            break;
+
+        for (int sliceIdx = 0; sliceIdx < numSlices && !terminated; ++sliceIdx) {
+            if (!(fds[sliceIdx].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            auto &slice = *slices[sliceIdx];
+            uint32_t type = 0;
+            if (!slice.socket.recvValue(type) || type != STEP || slice.numPending > 0) {
+                if (type != TERMINATE)
+                    TLOG(WARNING) << "Client of slice " << sliceIdx << " disconnected or broke the protocol, stopping";
+                terminated = true;
+                break;
+            }
+
+            if (!slice.socket.recvAll(slice.actions.data(), slice.actions.size() * sizeof(int32_t))) {
+                terminated = true;
+                break;
+            }
+
+            const auto invalid = std::find_if_not(slice.actions.begin(), slice.actions.end(), validAction);
+            if (invalid != slice.actions.end()) {
+                TLOG(WARNING) << "Client of slice " << sliceIdx << " sent the invalid action " << *invalid << ", stopping";
+                slice.socket.close();
+                terminated = true;
+                break;
+            }
+
+            for (auto envIdx : slice.envIndices) {
+                auto &env = *vectorEnv.envs[envIdx];
+                for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+                    env.setAction(agentIdx, Action(slice.actions[size_t(vectorEnv.agentOffsets[envIdx] + agentIdx - slice.firstAgent)]));
+            }
+
+            if (!vectorEnv.send(slice.envIndices)) {
+                terminated = true;
+                break;
+            }
+
+            slice.numPending = int(slice.envIndices.size());
+            numInFlight += slice.numPending;
+            pendingSlices.push_back(sliceIdx);
+        }
+
+        if (terminated || numInFlight == 0)
+            continue;
+
+        // the oldest step goes out first, envs of the other slices that finish on the way are kept
+        const auto &received = vectorEnv.recv(slices[pendingSlices.front()]->numPending);
+        numInFlight -= int(received.size());
+
+        for (auto envIdx : received) {
+            const auto sliceIdx = envSlices[envIdx];
+            auto &slice = *slices[sliceIdx];
+            if (--slice.numPending > 0)
+                continue;
+
+            pendingSlices.erase(std::find(pendingSlices.begin(), pendingSlices.end(), sliceIdx));
+            if (!sendFrame(slice))
+                terminated = true;
+        }
+    }
+
+    vectorEnv.stopPool();
+
+    const uint32_t type = TERMINATE;
+    for (auto &slice : slices)
+        slice->socket.sendValue(type);
+
+    TLOG(INFO) << "TCP server on port " << listener.localPort() << " terminated";
+}
+
+
+VectorEnvTcpClient::VectorEnvTcpClient(const std::string &host, int port, int sliceIdx, bool compressed)
+: socket{TcpSocket::connect(host, port)}
+, compressed{compressed}
+{
+    if (!socket.isOpen())
+        return;
+
+    const uint32_t hello[] = {VectorEnvTcpServer::magicValue, uint32_t(sliceIdx), compressed ? uint32_t(VectorEnvTcpServer::COMPRESSED) : 0u};
+    int32_t serverHello[6] = {};
+
+    if (!socket.sendAll(hello, sizeof(hello)) || !socket.recvAll(serverHello, sizeof(serverHello))) {
+        TLOG(ERROR) << "Server " << host << ":" << port << " rejected slice " << sliceIdx;
+        return;
+    }
+
+    // counts come from the network, the agent offsets are checked by attachSlice()
+    const auto numEnvs = serverHello[0], numAgents = serverHello[1], numSlices = serverHello[2];
+    const auto obsW = serverHello[3], obsH = serverHello[4], obsChannels = serverHello[5];
+    if (numEnvs < 1 || numAgents < numEnvs || numSlices < 1 || numSlices > numEnvs || sliceIdx >= numSlices
+        || !validObsSize(obsW, obsH, obsChannels)) {
+        TLOG(ERROR) << "Server " << host << ":" << port << " sent an invalid hello, closing the connection";
+        socket.close();
+        return;
+    }
+
+    // same layout as the shared memory segment, so the views of the base class work as they are
+    VectorEnvShmHeader layout{};
+    layout.numEnvs = serverHello[0], layout.numAgents = serverHello[1];
+    layout.obsBytesPerAgent = size_t(serverHello[3]) * size_t(serverHello[4]) * size_t(serverHello[5]);
+    buffer.assign(layout.computeLayout(), 0);
+
+    auto h = new (buffer.data()) VectorEnvShmHeader{};
+    h->magic = VectorEnvShmHeader::magicValue;
+    h->numEnvs = serverHello[0], h->numAgents = serverHello[1], h->numSlices = serverHello[2];
+    h->obsW = serverHello[3], h->obsH = serverHello[4], h->obsChannels = serverHello[5];
+    h->obsBytesPerAgent = layout.obsBytesPerAgent;
+    h->computeLayout();
+
+    if (!socket.recvAll(buffer.data() + h->agentOffsetsOffset, size_t(h->numEnvs + 1) * sizeof(int32_t)) || !attachSlice(buffer.data(), sliceIdx)) {
+        header = nullptr;
+        socket.close();
+        return;
+    }
+
+    if (compressed)
+        decoders = std::vector<FrameDecoder>(size_t(numAgents()), FrameDecoder{h->obsBytesPerAgent});
+}
+
+bool VectorEnvTcpClient::stepAsync()
+{
+    const uint32_t type = VectorEnvTcpServer::STEP;
+    return socket.sendValue(type) && socket.sendAll(actions(), size_t(numAgents()) * sizeof(int32_t));
+}
+
+bool VectorEnvTcpClient::stepWait()
+{
+    uint32_t type = 0;
+    if (!socket.recvValue(type) || type != VectorEnvTcpServer::FRAME) {
+        header->terminated.store(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    auto rewards = data + header->rewardsOffset + size_t(firstAgent) * sizeof(float);
+    auto dones = data + header->donesOffset + firstEnv;
+    auto obs = data + header->obsOffset + size_t(firstAgent) * header->obsBytesPerAgent;
+    const auto obsBytes = header->obsBytesPerAgent;
+
+    if (!socket.recvAll(rewards, size_t(numAgents()) * sizeof(float)) || !socket.recvAll(dones, size_t(numEnvs())))
+        return false;
+
+    if (!compressed)
+        return socket.recvAll(obs, size_t(numAgents()) * obsBytes);
+
+    for (int agentIdx = 0; agentIdx < numAgents(); ++agentIdx) {
+        uint32_t size = 0;
+        if (!socket.recvValue(size))
+            return false;
+
+        encoded.resize(size);
+        if (!socket.recvAll(encoded.data(), size))
+            return false;
+
+        if (!decoders[size_t(agentIdx)].decode(encoded.data(), size, obs + size_t(agentIdx) * obsBytes)) {
+            TLOG(ERROR) << "Could not decode the observation of agent " << agentIdx << " of slice " << sliceIdx;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void VectorEnvTcpClient::terminate()
+{
+    socket.sendValue(uint32_t(VectorEnvTcpServer::TERMINATE));
+    socket.close();
+}
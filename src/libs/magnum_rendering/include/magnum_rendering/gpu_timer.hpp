@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <Magnum/GL/TimeQuery.h>
+
+#include <util/scoped_profiler.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * GPU durations of the render passes of a frame from GL timestamp queries, recorded into the profiler with
+ * ScopedProfiler::recordGpu(): every zone gets the sum of its passes in the frame, "Renderer::gpu.frame" the time
+ * from the first to the last query. Results are picked up a few frames later, when they are available, so the
+ * queries never stall the pipeline (frames still pending when their slot is needed again are dropped).
+ * Only does anything while the profiler is enabled. Must be used with the GL context of the renderer current.
+ */
+class GpuTimer
+{
+public:
+    /**
+     * Pass of the current frame, from construction to destruction.
+     */
+    class Scope
+    {
+    public:
+        Scope(GpuTimer &timer, ProfilerZoneId zone);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        void operator=(const Scope &) = delete;
+
+    private:
+        GpuTimer &timer;
+        int interval = -1;
+    };
+
+public:
+    GpuTimer();
+
+    /// Record the frames that finished on the GPU and start a new one.
+    void beginFrame();
+
+    void endFrame();
+
+private:
+    int begin(ProfilerZoneId zone);
+    void end(int interval);
+
+private:
+    struct Frame
+    {
+        // start and end timestamps of interval i are queries 2i and 2i + 1, interval 0 is the whole frame
+        std::vector<Magnum::GL::TimeQuery> queries;
+        std::vector<ProfilerZoneId> zones;
+
+        uint64_t cpuStartNs = 0;
+        bool pending = false;
+    };
+
+    static constexpr int numFrames = 3;
+
+    /// Record the results of the frame if they are available, without waiting.
+    void resolve(Frame &frame);
+
+    Magnum::GL::TimeQuery & query(Frame &frame, size_t idx);
+
+private:
+    std::array<Frame, numFrames> frames;
+    int current = 0;
+    bool active = false;
+
+    ProfilerZoneId frameZone;
+};
+
+}
+
+
+/// GPU pass of the rest of the enclosing scope, see GpuTimer. The name must be a string literal.
+#define GPU_PROFILE_ZONE(timer, name) \
+    static const ::Megaverse::ProfilerZoneId PROFILE_ZONE_CONCAT(gpuZoneId_, __LINE__) = \
+        ::Megaverse::ScopedProfiler::instance().registerZone(name); \
+    ::Megaverse::GpuTimer::Scope PROFILE_ZONE_CONCAT(gpuZone_, __LINE__){timer, PROFILE_ZONE_CONCAT(gpuZoneId_, __LINE__)}
@@ -20,28 +20,114 @@ namespace Megaverse
 class MagnumEnvRenderer : public EnvRenderer
 {
 public:
+    /**
+     * @param batched render all agents as tiles of one framebuffer with one readback per frame.
+     * Debug draw is not supported in this mode. Falls back to per-agent rendering if the batch does not fit
+     * into one framebuffer.
+     * @param obsOptions observation format, non-default formats are produced by a conversion pass before the readback.
+     * Depth and segmentation disable pipelined rendering (drawAsync() renders synchronously).
+     */
     explicit MagnumEnvRenderer(
-        Envs &envs, int w, int h, bool withDebugDraw = false, bool withOverview = false, RenderingContext *ctx = nullptr
+        Envs &envs, int w, int h, bool withDebugDraw = false, bool withOverview = false, RenderingContext *ctx = nullptr,
+        bool batched = false, const ObservationOptions &obsOptions = {}
+    );
+
+    /**
+     * Renderer for a subset of envs, i.e. the one env shown by a viewer. Resources are allocated for these envs only.
+     * Env indices passed to the other methods are indices in this subset.
+     */
+    explicit MagnumEnvRenderer(
+        const std::vector<Env *> &envs, int w, int h, bool withDebugDraw = false, bool withOverview = false,
+        RenderingContext *ctx = nullptr, bool batched = false, const ObservationOptions &obsOptions = {}
     );
 
     ~MagnumEnvRenderer() override;
 
     void reset(Env &env, int envIdx) override;
 
+    void prepareReset(Env &env, int envIdx) override;
+
+    void finishReset(Env &env, int envIdx) override;
+
     void preDraw(Env &env, int envIdx) override;
 
     void draw(Envs &envs) override;
 
+    /**
+     * Observations of a pipelined frame are read back asynchronously through pixel pack buffers,
+     * getObservation() returns the mapped buffer memory after waitForFrame().
+     */
+    void drawAsync(Envs &envs) override;
+
+    void waitForFrame() override;
+
+    void setNumActiveEnvs(int numEnvs) override;
+
+    void setRenderMask(const std::vector<uint8_t> &agentMask) override;
+
     void drawAgent(Env &env, int envIdx, int agentIndex, bool readToBuffer);
 
     const uint8_t * getObservation(int envIdx, int agentIdx) const override;
 
+    const uint8_t * getObservation(int envIdx, int agentIdx, ObservationChannel channel) const override;
+
+    const uint8_t * getObservationsBatch() const override;
+
+    const uint8_t * getObservationsBatch(ObservationChannel channel) const override;
+
+    bool setHiresOutput(int w, int h, const ObservationOptions &options) override;
+
+    /**
+     * Renders into its own framebuffer with the instance buffers of the policy observations, the readback is
+     * synchronous and converted on the CPU.
+     */
+    void drawHires(Envs &envs, const std::vector<int> &envIndices) override;
+
+    const uint8_t * getHiresObservation(int envIdx, int agentIdx) const override;
+
     Magnum::GL::Framebuffer *getFramebuffer();
 
     void toggleDebugMode();
 
+    /**
+     * Merge the static layout boxes of each env into one mesh at reset, so only the dynamic objects are instanced and
+     * tracked for uploads. Faces hidden by the voxel grid of the scenario (Scenario::layoutVoxelQuery()) are not
+     * emitted. Takes effect from the next reset of each env.
+     */
+    void setLayoutBaking(bool enabled);
+
+    /**
+     * Skip the culling cells that are hidden behind the static layout boxes from the agent camera (see
+     * OcclusionBuffer). Only with frustum culling, pays off in mazes and other wall-heavy layouts.
+     */
+    void setOcclusionCulling(bool enabled);
+
+    /**
+     * Draw the visible instances of every agent camera roughly front to back, binned by the distance of their culling
+     * cells, so large boxes behind the nearby objects fail the depth test early. Only with frustum culling.
+     */
+    void setFrontToBack(bool enabled);
+
+    /**
+     * Draw everything twice, depth only and then color with LessOrEqual, so every pixel is shaded once. Costs
+     * vertex work, pays off with heavy overdraw (i.e. mazes).
+     */
+    void setDepthPrepass(bool enabled);
+
+    /**
+     * Don't draw agents that would see exactly what they saw in their last frame: nothing in the env moved, the camera
+     * and the HUD pixels are the same. Their observations keep the previous frame. Only for synchronous draws into
+     * the host buffer (not drawAsync()) and without debug draw.
+     */
+    void setSkipUnchangedViews(bool enabled);
+
+    /// Agents whose previous frame was reused in the last draw, see setSkipUnchangedViews().
+    int numReusedFrames() const;
+
     Overview * getOverview() override;
 
+    void memoryReport(MemoryReport &report) const override;
+
 private:
     struct Impl;
     std::unique_ptr<Impl> pimpl;
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include <util/host_buffer.hpp>
+
+#include <env/env_renderer.hpp>
+
+#include <magnum_rendering/magnum_env_renderer.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * OpenGL rendering on several threads: envs are split into shards of consecutive envs, each rendered by a
+ * MagnumEnvRenderer on a render thread of its own, with its own EGL context (on gpuIds[shard % numGpus]) and
+ * framebuffer. Shards are drawn concurrently and the observations are gathered into a single host buffer with the
+ * usual layout, so this is a drop-in replacement for a single MagnumEnvRenderer (like MultiGpuEnvRenderer for V4R).
+ * Contexts don't share resources, every shard uploads its own meshes and shaders. Relies on Magnum keeping the
+ * current GL context per thread (the default MAGNUM_BUILD_MULTITHREADED).
+ * The calls that touch GL are executed on the render threads and wait for them, the others (prepareReset(),
+ * preDraw()) are CPU-only and run on the calling thread as usual. No second output resolution.
+ */
+class MultiContextEnvRenderer : public EnvRenderer
+{
+public:
+    explicit MultiContextEnvRenderer(
+        Envs &envs, int w, int h, int numRenderThreads, const std::vector<int> &gpuIds = {0},
+        const ObservationOptions &obsOptions = {}
+    );
+
+    ~MultiContextEnvRenderer() override;
+
+    void reset(Env &env, int envIdx) override;
+
+    void prepareReset(Env &env, int envIdx) override;
+
+    void finishReset(Env &env, int envIdx) override;
+
+    void preDraw(Env &env, int envIdx) override;
+
+    void draw(Envs &envs) override;
+
+    /// Returns once the frame is submitted by all shards, the readbacks finish in waitForFrame().
+    void drawAsync(Envs &envs) override;
+
+    void waitForFrame() override;
+
+    void setNumActiveEnvs(int numEnvs) override;
+
+    void setRenderMask(const std::vector<uint8_t> &agentMask) override;
+
+    const uint8_t * getObservation(int envIdx, int agentIdx) const override;
+
+    const uint8_t * getObservation(int envIdx, int agentIdx, ObservationChannel channel) const override;
+
+    const uint8_t * getObservationsBatch() const override { return frames[int(ObservationChannel::Color)].data(); }
+
+    const uint8_t * getObservationsBatch(ObservationChannel channel) const override;
+
+    Overview * getOverview() override;
+
+    /// Sum over the shard renderers plus the gathered buffers.
+    void memoryReport(MemoryReport &report) const override;
+
+private:
+    /**
+     * Render thread of a shard: owns the GL context and the renderer, which are created, used and destroyed there.
+     */
+    struct Shard
+    {
+        int firstEnv = 0, numEnvs = 0;
+        std::vector<Env *> envs;
+
+        std::unique_ptr<WindowlessContext> ctx;
+        std::unique_ptr<MagnumEnvRenderer> renderer;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> tasks;
+        int numPending = 0;
+        bool terminate = false;
+
+        std::thread thread;
+
+        void loop();
+    };
+
+    /// Queue the task on the render thread of the shard.
+    static void post(Shard &shard, std::function<void()> task);
+
+    /// Wait until the render threads have finished all queued tasks.
+    void sync();
+
+    /// Run f(shard) on all render threads concurrently and wait for them.
+    void forEachShard(const std::function<void(Shard &)> &f);
+
+    Shard & shardOf(int envIdx) { return *shards[envShards[envIdx]]; }
+
+    int localIdx(int envIdx) const { return envIdx - shards[envShards[envIdx]]->firstEnv; }
+
+    /// Copy the observations of every shard into the gathered buffers, one block per shard.
+    void gather();
+
+private:
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<int> envShards;
+
+    // index of the first agent of each env in the gathered buffers, plus the total number of agents at the end
+    std::vector<int> agentOffsets;
+
+    ObservationOptions obsOptions;
+    int w, h;
+
+    // gathered frames of each channel, empty if the channel is not rendered
+    HostBuffer frames[3];
+    bool frameInFlight = false;
+};
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include <Magnum/GL/AbstractShaderProgram.h>
+
+
+namespace Megaverse
+{
+
+/**
+ * Linked GL programs saved with ARB_get_program_binary, so renderers created later (in this process or after a
+ * restart) skip compiling and linking. Binaries are kept in memory and in MEGAVERSE_SHADER_CACHE (default
+ * ~/.cache/megaverse/shaders, an empty value disables the disk cache). Entries are keyed by the sources and
+ * the GL vendor, renderer and version, so a driver update or any change to the shaders is just a miss, and a binary
+ * the driver rejects is compiled again.
+ *
+ * Usage: if (!loadProgramBinary(program, key)) { compile, bind locations, prepareProgramBinary(), link,
+ * storeProgramBinary() }.
+ */
+
+/// @param key everything that goes into the program: sources, defines, attribute and output locations.
+bool loadProgramBinary(Magnum::GL::AbstractShaderProgram &program, const std::string &key);
+
+/// Call before link(), so the driver keeps the binary.
+void prepareProgramBinary(Magnum::GL::AbstractShaderProgram &program);
+
+/// Call after a successful link().
+void storeProgramBinary(Magnum::GL::AbstractShaderProgram &program, const std::string &key);
+
+}
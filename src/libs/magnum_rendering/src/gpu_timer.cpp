@@ -0,0 +1,111 @@
+#include <algorithm>
+
+#include <magnum_rendering/gpu_timer.hpp>
+
+
+using namespace Megaverse;
+using namespace Magnum;
+
+
+GpuTimer::Scope::Scope(GpuTimer &timer, ProfilerZoneId zone)
+: timer{timer}
+, interval{timer.begin(zone)}
+{
+}
+
+GpuTimer::Scope::~Scope()
+{
+    timer.end(interval);
+}
+
+GpuTimer::GpuTimer()
+: frameZone{sprof().registerZone("Renderer::gpu.frame")}
+{
+}
+
+GL::TimeQuery & GpuTimer::query(Frame &frame, size_t idx)
+{
+    // queries are reused between frames, creating them is not free
+    while (frame.queries.size() <= idx)
+        frame.queries.emplace_back(GL::TimeQuery::Target::Timestamp);
+
+    return frame.queries[idx];
+}
+
+void GpuTimer::beginFrame()
+{
+    for (auto &frame : frames)
+        if (frame.pending)
+            resolve(frame);
+
+    active = ScopedProfiler::enabled();
+    if (!active)
+        return;
+
+    current = (current + 1) % numFrames;
+    auto &frame = frames[current];
+    frame.pending = false;  // dropped if the GPU is still this far behind
+    frame.zones.clear();
+    frame.cpuStartNs = ScopedProfiler::nowNs();
+
+    begin(frameZone);
+}
+
+void GpuTimer::endFrame()
+{
+    if (!active)
+        return;
+
+    end(0);
+    frames[current].pending = true;
+    active = false;
+}
+
+int GpuTimer::begin(ProfilerZoneId zone)
+{
+    if (!active)
+        return -1;
+
+    auto &frame = frames[current];
+    const auto interval = int(frame.zones.size());
+    frame.zones.emplace_back(zone);
+    query(frame, 2 * size_t(interval)).timestamp();
+    return interval;
+}
+
+void GpuTimer::end(int interval)
+{
+    if (!active || interval < 0)
+        return;
+
+    query(frames[current], 2 * size_t(interval) + 1).timestamp();
+}
+
+void GpuTimer::resolve(Frame &frame)
+{
+    // timestamps complete in order and the end of the frame is the last one
+    if (!frame.queries[1].resultAvailable())
+        return;
+
+    frame.pending = false;
+
+    const auto frameStart = frame.queries[0].result<UnsignedLong>();
+    const auto frameEnd = frame.queries[1].result<UnsignedLong>();
+    sprof().recordGpu(frameZone, frame.cpuStartNs, frameEnd - frameStart);
+
+    // one event per zone: the sum of its passes, placed at the first of them
+    std::vector<std::pair<ProfilerZoneId, std::pair<UnsignedLong, UnsignedLong>>> zoneTimes;
+    for (size_t i = 1; i < frame.zones.size(); ++i) {
+        const auto start = frame.queries[2 * i].result<UnsignedLong>();
+        const auto duration = frame.queries[2 * i + 1].result<UnsignedLong>() - start;
+
+        const auto it = std::find_if(zoneTimes.begin(), zoneTimes.end(), [&](const auto &z) { return z.first == frame.zones[i]; });
+        if (it == zoneTimes.end())
+            zoneTimes.push_back({frame.zones[i], {start, duration}});
+        else
+            it->second.second += duration;
+    }
+
+    for (const auto &[zone, time] : zoneTimes)
+        sprof().recordGpu(zone, frame.cpuStartNs + (time.first - frameStart), time.second);
+}
@@ -1,31 +1,57 @@
+#include <array>
+#include <string>
+#include <algorithm>
+
 #include <Corrade/Containers/GrowableArray.h>
 
+#include <Magnum/GL/AbstractShaderProgram.h>
 #include <Magnum/GL/Buffer.h>
 #include <Magnum/GL/DefaultFramebuffer.h>
 #include <Magnum/GL/Mesh.h>
 #include <Magnum/GL/Renderer.h>
 #include <Magnum/ImageView.h>
 #include <Magnum/Math/Color.h>
+#include <Magnum/Math/Matrix3.h>
 #include <Magnum/Math/Matrix4.h>
+#include <Magnum/Math/Packing.h>
+#include <Magnum/Math/Quaternion.h>
+#include <Magnum/Math/Algorithms/GramSchmidt.h>
 #include <Magnum/Trade/MeshData.h>
+#include <Magnum/Shaders/Flat.h>
 #include <Magnum/Shaders/Phong.h>
 #include <Magnum/SceneGraph/Camera.h>
 #include <Magnum/SceneGraph/Drawable.h>
 #include <Magnum/MeshTools/Compile.h>
+#include <Magnum/Primitives/Square.h>
 #include <Magnum/GL/RenderbufferFormat.h>
 #include <Magnum/GL/Version.h>
 #include <Magnum/GL/Framebuffer.h>
 #include <Magnum/GL/Renderbuffer.h>
+#include <Magnum/GL/Shader.h>
+#include <Magnum/GL/Texture.h>
+#include <Magnum/GL/TextureFormat.h>
 #include <Magnum/GL/Context.h>
+#include <Magnum/GL/Extensions.h>
+#include <Magnum/GL/OpenGL.h>
 #include <Magnum/PixelFormat.h>
+#include <Magnum/PixelStorage.h>
 #include <Magnum/BulletIntegration/DebugDraw.h>
 
 #include <util/tiny_logger.hpp>
+#include <util/host_buffer.hpp>
+#include <util/scoped_profiler.hpp>
+
+#include <env/scenario.hpp>
+#include <env/voxel_state.hpp>
 
+#include <rendering/culling.hpp>
 #include <rendering/render_utils.hpp>
+#include <rendering/transform_cache.hpp>
 
 #include <magnum_rendering/rendering_context.hpp>
 
+#include <magnum_rendering/gpu_timer.hpp>
+#include <magnum_rendering/program_cache.hpp>
 #include <magnum_rendering/magnum_env_renderer.hpp>
 
 using namespace Magnum;
@@ -34,32 +60,485 @@ using namespace Magnum::Math::Literals;
 using namespace Megaverse;
 
 
+/**
+ * Rows of packed observations are not padded, 3-channel and 1-channel frames are not 4-byte aligned.
+ */
+inline PixelStorage observationStorage()
+{
+    return PixelStorage{}.setAlignment(1);
+}
+
+/**
+ * GL stores the framebuffer bottom-up. Rendering with the Y axis of the clip space flipped makes the readback
+ * top-down, same as the rows of the V4R frames and of the images in OpenCV and numpy, so nobody has to flip the
+ * observations afterwards. This reverses the winding of the triangles, see the front face in the constructor.
+ */
+inline Matrix4 topDownProjection(const SceneGraph::Camera3D &camera)
+{
+    return Matrix4::scaling({1.0f, -1.0f, 1.0f}) * camera.projectionMatrix();
+}
+
+inline PixelFormat observationPixelFormat(const ObservationOptions &options)
+{
+    switch (options.format) {
+        case ObservationFormat::RGB8:
+        case ObservationFormat::BGR8: return PixelFormat::RGB8Unorm;
+        case ObservationFormat::Gray8: return PixelFormat::R8Unorm;
+        default: return PixelFormat::RGBA8Unorm;
+    }
+}
+
+
+/**
+ * Transformation of an instance decomposed into position, rotation and scale, recomposed in PaletteShader: 28 bytes
+ * per instance instead of a 64-byte Matrix4. The color is looked up by color ID in the palette texture.
+ */
 struct InstanceData {
-    Magnum::Matrix4 transformationMatrix;
-    Magnum::Matrix3x3 normalMatrix;
-    Magnum::Color3 color;
+    InstanceData() = default;
+
+    InstanceData(const Matrix4 &transformation, UnsignedByte colorId)
+    : colorId{colorId}
+    {
+        setTransformation(transformation);
+    }
+
+    /**
+     * Transformations of the drawables are translation * rotation * scaling, mirroring goes into the sign of the
+     * scale. Shear (rotated children of non-uniformly scaled parents) can't be represented and is dropped.
+     */
+    void setTransformation(const Matrix4 &t)
+    {
+        position = t.translation();
+
+        auto basis = t.rotationScaling();
+        Vector3 s{basis[0].length(), basis[1].length(), basis[2].length()};
+        if (basis.determinant() < 0.0f)
+            s.x() = -s.x();
+
+        for (int i = 0; i < 3; ++i)
+            basis[i] = std::abs(s[i]) > 1e-12f ? basis[i] / s[i] : Matrix3x3{Math::IdentityInit}[i];
+
+        const auto q = Quaternion::fromMatrix(Math::Algorithms::gramSchmidtOrthonormalize(basis));
+        rotation = Math::pack<Vector4s>(Vector4{q.vector(), q.scalar()});
+        scale = Math::packHalf(s);
+    }
+
+    Vector3 position;
+    Vector4s rotation;  // quaternion xyzw, normalized shorts
+    Vector3us scale;  // half floats
+    UnsignedByte colorId{};
+    UnsignedByte padding{};
+};
+
+static_assert(sizeof(InstanceData) == 28, "Instance layout must match the attributes of PaletteShader");
+
+struct BakedVertex {
+    Vector3 position, normal;  // world space
+    UnsignedByte colorId;
+    UnsignedByte padding[3]{};
+};
+
+/**
+ * Static layout boxes of one env (SceneObjectInfo::layout) merged into a single world-space mesh at reset, so they
+ * are drawn with one draw call and never re-uploaded during the episode. Faces that are covered by neighbouring
+ * layout voxels are left out. Vertices are built in prepareReset() and uploaded in finishReset(), see
+ * MagnumEnvRenderer::setLayoutBaking().
+ */
+struct BakedLayout
+{
+    std::vector<BakedVertex> vertices;
+    std::vector<UnsignedInt> indices;
+
+    GL::Buffer vertexBuffer{NoCreate}, indexBuffer{NoCreate};
+    GL::Mesh mesh{NoCreate};
+    size_t gpuBytes = 0;
 };
 
+/**
+ * Bit of an axis-aligned box face in the masks of hiddenBoxFaces(): axis * 2 + 1 for the positive direction,
+ * 0 if the world-space normal is not axis-aligned.
+ */
+inline uint8_t boxFaceBit(const Vector3 &normal)
+{
+    const auto a = Math::abs(normal);
+    const int axis = a.x() > a.y() ? (a.x() > a.z() ? 0 : 2) : (a.y() > a.z() ? 1 : 2);
+    if (a[axis] < 0.999f)
+        return 0;
+
+    return uint8_t(1u << (axis * 2 + (normal[axis] > 0)));
+}
+
+/**
+ * Faces of a layout box that can't be seen: covered by opaque layout voxels on their whole area, or the bottom face
+ * at the lowest level of the grid. Boxes that don't line up with the voxel grid keep all of their faces.
+ */
+inline uint8_t hiddenBoxFaces(const Range3D &bounds, const LayoutVoxelQuery &query)
+{
+    const auto lo = (bounds.min() - query.gridOrigin()) / query.voxelSize();
+    const auto hi = (bounds.max() - query.gridOrigin()) / query.voxelSize();
+    const VoxelCoords min{Math::round(lo)}, max{Math::round(hi)};
+    if ((Math::abs(lo - Vector3{min}) + Math::abs(hi - Vector3{max})).max() > 1e-3f)
+        return 0;
+
+    uint8_t hidden = 0;
+    SymbolicVoxel v;
+    for (int axis = 0; axis < 3; ++axis)
+        for (int positive = 0; positive < 2; ++positive) {
+            const auto bit = uint8_t(1u << (axis * 2 + positive));
+            VoxelCoords c;
+            c[axis] = positive ? max[axis] : min[axis] - 1;
+
+            if (axis == 1 && c[axis] < 0) {
+                hidden |= bit;
+                continue;
+            }
+
+            // voxels right outside of the face, same criterion as the voxels the layout boxes are merged from
+            const int u = (axis + 1) % 3, w = (axis + 2) % 3;
+            bool covered = true;
+            for (c[u] = min[u]; covered && c[u] < max[u]; ++c[u])
+                for (c[w] = min[w]; covered && c[w] < max[w]; ++c[w])
+                    covered = query.voxel(c, v) && (v.voxelType & VOXEL_OPAQUE) && !v.object;
+
+            if (covered)
+                hidden |= bit;
+        }
+
+    return hidden;
+}
+
+
+/**
+ * World-space instances of one mesh type in one env. They live in a GPU buffer that is fully uploaded
+ * once per episode, after that only the instances of objects that moved are re-uploaded.
+ * The camera transformation is applied in the shader, so the same buffer is used for all agents of the env.
+ * Instances are sorted by the cells of the culling grid, so visible cells are drawn as ranges of the buffer.
+ * There is one mesh per level of detail, all of them read the same instance buffer.
+ */
+struct EnvInstances
+{
+    Range3D localBounds;
+    CullingGrid grid;
+
+    Containers::Array<InstanceData> data;
+    std::vector<UnsignedInt> dirty;
+    bool uploadAll = true;
+
+    GL::Buffer buffer{NoCreate};
+    std::vector<GL::Mesh> lodMeshes;
+    size_t capacity = 0;
 
-class CustomDrawable : public SceneGraph::Drawable3D
+    // persistently mapped buffer memory (GL 4.4), nullptr if instances are uploaded with setSubData()
+    InstanceData *mapped = nullptr;
+};
+
+
+/**
+ * Fullscreen pass that converts a region of the rendered RGBA frame into the observation format: averages
+ * downsample x downsample blocks and optionally converts to grayscale or swaps red and blue. Output goes to the red
+ * channel for Gray8.
+ */
+class ObservationConversionShader : public GL::AbstractShaderProgram
 {
 public:
-    explicit CustomDrawable(
-        SceneGraph::AbstractObject3D &parentObject,
-        Containers::Array<InstanceData> &instanceData,
-        const Color3 &color,
-        SceneGraph::DrawableGroup3D &drawables
-    )
-    : SceneGraph::Drawable3D{parentObject, &drawables}, _instanceData(instanceData), _color{color}
-    {}
+    explicit ObservationConversionShader(NoCreateT)
+    : GL::AbstractShaderProgram{NoCreate}
+    {
+    }
+
+    explicit ObservationConversionShader(const ObservationOptions &options)
+    {
+        const auto defines = "#define DOWNSAMPLE " + std::to_string(options.downsample) + "\n"
+            + "#define GRAYSCALE " + std::to_string(int(options.format == ObservationFormat::Gray8)) + "\n"
+            + "#define SWAP_RED_BLUE " + std::to_string(int(options.swapsRedBlue())) + "\n";
+
+        const std::string vertSource = R"(
+void main()
+{
+    // single triangle that covers the whole viewport
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+        const std::string fragSource = defines + R"(
+uniform sampler2D source;
+uniform ivec2 sourceOffset;
+
+out vec4 color;
+
+void main()
+{
+    ivec2 base = sourceOffset + ivec2(gl_FragCoord.xy) * DOWNSAMPLE;
+
+    vec3 sum = vec3(0.0);
+    for (int y = 0; y < DOWNSAMPLE; ++y)
+        for (int x = 0; x < DOWNSAMPLE; ++x)
+            sum += texelFetch(source, base + ivec2(x, y), 0).rgb;
+
+    vec3 c = sum / float(DOWNSAMPLE * DOWNSAMPLE);
+#if GRAYSCALE
+    c = vec3(dot(c, vec3(0.299, 0.587, 0.114)));
+#endif
+#if SWAP_RED_BLUE
+    c = c.bgr;
+#endif
+
+    color = vec4(c, 1.0);
+}
+)";
+
+        const auto cacheKey = "conversion\n" + vertSource + fragSource;
+        if (!loadProgramBinary(*this, cacheKey)) {
+            GL::Shader vert{GL::Version::GL330, GL::Shader::Type::Vertex};
+            vert.addSource(vertSource);
+            GL::Shader frag{GL::Version::GL330, GL::Shader::Type::Fragment};
+            frag.addSource(fragSource);
+
+            CORRADE_INTERNAL_ASSERT_OUTPUT(GL::Shader::compile({vert, frag}));
+            attachShaders({vert, frag});
+            bindFragmentDataLocation(0, "color");
+            prepareProgramBinary(*this);
+            CORRADE_INTERNAL_ASSERT_OUTPUT(link());
+            storeProgramBinary(*this, cacheKey);
+        }
+
+        setUniform(uniformLocation("source"), 0);
+        sourceOffsetUniform = uniformLocation("sourceOffset");
+    }
+
+    ObservationConversionShader & setSourceOffset(const Vector2i &offset)
+    {
+        setUniform(sourceOffsetUniform, offset);
+        return *this;
+    }
+
+    ObservationConversionShader & bindSource(GL::Texture2D &texture)
+    {
+        texture.bind(0);
+        return *this;
+    }
 
 private:
-    void draw(const Matrix4& t, SceneGraph::Camera3D&) override {
-        arrayAppend(_instanceData, Containers::InPlaceInit, t, t.normalMatrix(), _color);
+    Int sourceOffsetUniform{};
+};
+
+
+/**
+ * Instanced Phong shading of the drawables, with the color of every instance fetched from a palette texture by its
+ * color ID (one texel per entry of allColors). Same lighting as the Shaders::Phong setup it replaced: one light in
+ * camera space, the color scales both the ambient and the diffuse term. With segmentation, the material ID
+ * (color ID + 1) goes to the object ID output.
+ * Lambert and Flat shading (see ShadingModel) compute the color in the vertex shader and pass it to the fragments as
+ * a flat varying, so the fragment shader only writes it out.
+ * The baked variant draws world-space vertices with per-vertex color IDs instead of instances (see BakedLayout).
+ */
+class PaletteShader : public GL::AbstractShaderProgram
+{
+public:
+    using Position = Shaders::Generic3D::Position;
+    using Normal = Shaders::Generic3D::Normal;
+
+    // instance attributes, see InstanceData
+    using InstancePosition = GL::Attribute<Shaders::Generic3D::TransformationMatrix::Location, Vector3>;
+    using InstanceRotation = GL::Attribute<Shaders::Generic3D::TransformationMatrix::Location + 1, Vector4>;
+    using InstanceScale = GL::Attribute<Shaders::Generic3D::TransformationMatrix::Location + 2, Vector3>;
+    using ColorId = GL::Attribute<Shaders::Generic3D::ObjectId::Location, UnsignedInt>;
+
+    enum: UnsignedInt
+    {
+        ColorOutput = Shaders::Phong::ColorOutput,
+        ObjectIdOutput = Shaders::Phong::ObjectIdOutput,
+    };
+
+public:
+    explicit PaletteShader(NoCreateT)
+    : GL::AbstractShaderProgram{NoCreate}
+    {
     }
 
-    Containers::Array<InstanceData>& _instanceData;
-    Color3 _color;
+    explicit PaletteShader(bool objectId, bool baked = false, ShadingModel shading = ShadingModel::BlinnPhong)
+    {
+        const auto defines = "#define OBJECT_ID " + std::to_string(int(objectId)) + "\n"
+            + "#define BAKED " + std::to_string(int(baked)) + "\n"
+            + "#define SHADING " + std::to_string(int(shading)) + "\n";
+
+        // SHADING values follow ShadingModel
+        const auto lighting = R"(
+#define BLINN_PHONG 0
+#define LAMBERT 1
+#define FLAT 2
+
+const vec3 ambientColor = vec3(0.333);  // 0x555555
+const vec3 diffuseColor = vec3(0.733);  // 0xbbbbbb
+const vec3 lightColor = vec3(0.667);  // 0xaaaaaa
+const float shininess = 300.0;
+
+#if SHADING != FLAT
+uniform vec3 lightPosition;
+#endif
+)";
+
+        const std::string vertSource = defines + lighting + R"(
+uniform mat4 projectionMatrix;
+uniform mat4 cameraMatrix;
+uniform sampler2D palette;
+
+in vec4 position;
+in vec3 normal;
+#if !BAKED
+in vec3 instancePosition;
+in vec4 instanceRotation;
+in vec3 instanceScale;
+#endif
+in uint instanceColorId;
+
+#if SHADING == BLINN_PHONG
+out vec3 transformedPosition;
+out vec3 transformedNormal;
+out vec3 color;
+#else
+flat out vec3 color;
+#endif
+#if OBJECT_ID
+flat out uint objectId;
+#endif
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+#if BAKED
+    vec3 world = position.xyz;
+    vec3 worldNormal = normal;
+#else
+    // the inverse transpose of rotation * scaling is rotation * inverse scaling
+    vec4 q = normalize(instanceRotation);
+    vec3 world = instancePosition + rotate(q, instanceScale * position.xyz);
+    vec3 worldNormal = rotate(q, normal / instanceScale);
+#endif
+    vec4 p = cameraMatrix * vec4(world, 1.0);
+
+    color = texelFetch(palette, ivec2(int(instanceColorId), 0), 0).rgb;
+
+#if SHADING == BLINN_PHONG
+    // the camera is rigid, so its rotation also transforms the normals
+    transformedPosition = p.xyz;
+    transformedNormal = mat3(cameraMatrix) * worldNormal;
+#elif SHADING == LAMBERT
+    // the provoking vertex decides for the whole face
+    vec3 n = normalize(mat3(cameraMatrix) * worldNormal);
+    float intensity = max(0.0, dot(n, normalize(lightPosition - p.xyz)));
+    color *= ambientColor + diffuseColor * lightColor * intensity;
+#endif
+#if OBJECT_ID
+    objectId = instanceColorId + 1u;
+#endif
+
+    gl_Position = projectionMatrix * p;
+}
+)";
+
+        const std::string fragSource = defines + lighting + R"(
+#if SHADING == BLINN_PHONG
+in vec3 transformedPosition;
+in vec3 transformedNormal;
+in vec3 color;
+#else
+flat in vec3 color;
+#endif
+#if OBJECT_ID
+flat in uint objectId;
+#endif
+
+out vec4 fragmentColor;
+#if OBJECT_ID
+out uint fragmentObjectId;
+#endif
+
+void main()
+{
+#if SHADING == BLINN_PHONG
+    vec3 n = normalize(transformedNormal);
+    vec3 l = normalize(lightPosition - transformedPosition);
+    float intensity = max(0.0, dot(n, l));
+
+    vec3 c = color * (ambientColor + diffuseColor * lightColor * intensity);
+    if (intensity > 0.001)
+        c += lightColor * pow(max(0.0, dot(normalize(-transformedPosition), reflect(-l, n))), shininess);
+#else
+    vec3 c = color;
+#endif
+
+    fragmentColor = vec4(c, 1.0);
+#if OBJECT_ID
+    fragmentObjectId = objectId;
+#endif
+}
+)";
+
+        // the attribute and output locations are part of the program too
+        const auto locations = std::to_string(Position::Location) + " " + std::to_string(Normal::Location) + " "
+            + std::to_string(InstancePosition::Location) + " " + std::to_string(ColorId::Location) + " "
+            + std::to_string(ColorOutput) + " " + std::to_string(ObjectIdOutput) + "\n";
+        const auto cacheKey = "palette\n" + locations + vertSource + fragSource;
+
+        if (!loadProgramBinary(*this, cacheKey)) {
+            GL::Shader vert{GL::Version::GL330, GL::Shader::Type::Vertex};
+            vert.addSource(vertSource);
+            GL::Shader frag{GL::Version::GL330, GL::Shader::Type::Fragment};
+            frag.addSource(fragSource);
+
+            CORRADE_INTERNAL_ASSERT_OUTPUT(GL::Shader::compile({vert, frag}));
+            attachShaders({vert, frag});
+
+            bindAttributeLocation(Position::Location, "position");
+            bindAttributeLocation(Normal::Location, "normal");
+            bindAttributeLocation(InstancePosition::Location, "instancePosition");
+            bindAttributeLocation(InstanceRotation::Location, "instanceRotation");
+            bindAttributeLocation(InstanceScale::Location, "instanceScale");
+            bindAttributeLocation(ColorId::Location, "instanceColorId");
+            bindFragmentDataLocation(ColorOutput, "fragmentColor");
+            if (objectId)
+                bindFragmentDataLocation(ObjectIdOutput, "fragmentObjectId");
+
+            prepareProgramBinary(*this);
+            CORRADE_INTERNAL_ASSERT_OUTPUT(link());
+            storeProgramBinary(*this, cacheKey);
+        }
+
+        setUniform(uniformLocation("palette"), 0);
+        projectionMatrixUniform = uniformLocation("projectionMatrix");
+        cameraMatrixUniform = uniformLocation("cameraMatrix");
+        if (shading != ShadingModel::Flat)
+            setUniform(uniformLocation("lightPosition"), Vector3{0, 4, 2});
+    }
+
+    PaletteShader & setProjectionMatrix(const Matrix4 &matrix)
+    {
+        setUniform(projectionMatrixUniform, matrix);
+        return *this;
+    }
+
+    PaletteShader & setCameraMatrix(const Matrix4 &matrix)
+    {
+        setUniform(cameraMatrixUniform, matrix);
+        return *this;
+    }
+
+    PaletteShader & bindPalette(GL::Texture2D &texture)
+    {
+        texture.bind(0);
+        return *this;
+    }
+
+    using GL::AbstractShaderProgram::draw;
+
+private:
+    Int projectionMatrixUniform{}, cameraMatrixUniform{};
 };
 
 
@@ -99,7 +578,10 @@ private:
 struct MagnumEnvRenderer::Impl
 {
 public:
-    explicit Impl(Envs &envs, int w, int h, bool withDebugDraw = false, bool withOverview = false, RenderingContext *ctx = nullptr);
+    explicit Impl(
+        const std::vector<Env *> &envs, int w, int h, bool withDebugDraw = false, bool withOverview = false, RenderingContext *ctx = nullptr,
+        bool batched = false, const ObservationOptions &obsOptions = {}
+    );
 
     ~Impl();
 
@@ -111,39 +593,270 @@ public:
      */
     void reset(Env &env, int envIndex);
 
+    /**
+     * Only touches the drawables of this particular env, safe to call concurrently for different envs.
+     */
+    void prepareReset(Env &env, int envIndex);
+
+    void finishReset(Env &env, int envIndex);
+
     void preDraw(Env &env, int envIndex);
-    void draw(Envs &envs);
+    void draw();
     void drawAgent(Env &env, int envIndex, int agentIdx, bool readToBuffer);
 
-    uint8_t * getObservation(int envIdx, int agentIdx);
+    /**
+     * Render every agent of every env into its own tile of batchFramebuffer.
+     * Each tile reuses the persistent instance buffers of its env. Only the drawn tiles are read back, one read per
+     * run of consecutive drawn rows in a column, so masked, frozen and unchanged tiles keep their last frame.
+     */
+    void drawBatched();
+
+    /**
+     * Upload the dirty instances of the env (or all of them after reset), called from the main thread.
+     */
+    void uploadInstances(int envIndex);
+
+    /**
+     * Draw all instances of the env from the point of view of the camera into the currently bound framebuffer.
+     */
+    void drawInstances(int envIndex, SceneGraph::Camera3D &camera);
+
+    /**
+     * Append a layout box with this world transformation to the baked mesh, without the faces that are hidden by
+     * the voxel grid of the scenario (if it has one, see hiddenBoxFaces()).
+     */
+    void bakeBox(BakedLayout &baked, const Matrix4 &transformation, UnsignedByte colorId, const LayoutVoxelQuery *query) const;
+
+    void uploadBakedLayout(BakedLayout &baked);
+
+    /**
+     * Screen-space pass over the current viewport: HUD quads of the agent (see Env::hud()), one draw of the unit
+     * square each, without depth test.
+     */
+    void drawHudOverlay(Env &env, int envIndex, int agentIdx);
+
+    /**
+     * Pipelined rendering: same as draw(), but the observations are read into the next pixel pack buffer of the ring,
+     * guarded by a fence. waitForFrame() waits for the fence and maps the buffer, so the GPU renders and transfers
+     * frame N while the CPU simulates frame N+1.
+     */
+    void drawAsync();
+    void waitForFrame();
+
+    /// inactive envs are not drawn, their observations keep the last frame
+    void setNumActiveEnvs(int numEnvs) { numActiveEnvs = numEnvs; }
+
+    void setRenderMask(const std::vector<uint8_t> &agentMask) { renderMask = agentMask; }
+
+    /// agent is the index of the agent in the whole batch
+    bool rendersAgent(int agent) const { return renderMask.empty() || renderMask[agent]; }
+
+    /// Draw and read back every agent of the active envs that is not masked out.
+    void drawAgents();
+
+    /**
+     * Copy a region of the framebuffer into the observation buffer at the given byte offset.
+     * Goes to the current pixel pack buffer in pipelined mode and is a synchronous read otherwise.
+     */
+    void readObservations(GL::Framebuffer &fb, const Range2Di &region, MutableImageView2D &view, size_t offset);
+
+    /**
+     * Run the conversion pass over a region of the color texture, the result is in the bottom left corner of
+     * conversionFramebuffer.
+     */
+    void convertObservations(GL::Texture2D &source, const Range2Di &region);
+
+    /**
+     * Observation conversion renders into textures instead of renderbuffers, so the conversion pass can sample them.
+     * Color is stored as plain RGBA8: without GL_FRAMEBUFFER_SRGB the bytes are the same as in an SRGB8Alpha8 buffer,
+     * but sampling does not apply the sRGB decode.
+     */
+    void attachColor(GL::Framebuffer &fb, GL::Renderbuffer &renderbuffer, GL::Texture2D &texture, const Vector2i &size);
+
+    void initObservationConversion(const Vector2i &maxRegionSize);
+
+    /**
+     * Segmentation IDs go to a second color attachment written by the same Phong pass, depth is read from the depth
+     * attachment, so auxiliary channels don't need another render.
+     */
+    void attachAuxiliary(GL::Framebuffer &fb, GL::Renderbuffer &segmentation, const Vector2i &size);
+
+    void clearAuxiliary(GL::Framebuffer &fb);
+
+    /**
+     * Read the depth and segmentation of the region that holds consecutive frames starting at firstFrame.
+     * Always a synchronous read, pipelined rendering is disabled when auxiliary channels are requested.
+     */
+    void readAuxiliary(GL::Framebuffer &fb, const Range2Di &region, size_t firstFrame);
+
+    /**
+     * @return false if the batched mode is not supported by the context or the batch does not fit into a framebuffer
+     */
+    bool initBatchedRendering(size_t totalNumAgents);
+
+    SceneGraph::Camera3D * agentCamera(Env &env, int envIndex, int agentIdx);
+
+    const uint8_t * getObservation(int envIdx, int agentIdx) const;
+
+    const uint8_t * getObservation(int envIdx, int agentIdx, ObservationChannel channel) const;
+
+    const uint8_t * getObservationsBatch() const { return usePboFrames ? pboFrames : frames.data(); }
+
+    const uint8_t * getObservationsBatch(ObservationChannel channel) const;
+
+    bool setHiresOutput(int w, int h, const ObservationOptions &options);
+
+    void drawHires(const std::vector<int> &envIndices);
 
     GL::Framebuffer * getFramebuffer() { return &framebuffer; }
 
     void toggleDebugMode() { withDebugDraw = !withDebugDraw; }
 
+    void setLayoutBaking(bool enabled) { layoutBaking = enabled; }
+
+    void setOcclusionCulling(bool enabled) { occlusionCulling = enabled; }
+
+    void setFrontToBack(bool enabled) { frontToBack = enabled; }
+
+    void setDepthPrepass(bool enabled) { depthPrepass = enabled; }
+
+    void setSkipUnchangedViews(bool enabled) { skipUnchangedViews = enabled, invalidateViews(); }
+
+    /// reuse is only safe when the frame goes straight to the host buffer, see setSkipUnchangedViews()
+    bool skipsUnchangedViews() const { return skipUnchangedViews && !readToPbo && !withDebugDraw; }
+
+    /**
+     * Compare what the agent would see now (env version, camera, HUD quads in framebuffer pixels) with the state at
+     * its last draw and remember the new one. agent is the index of the agent in the whole batch.
+     * @return true if the agent has to be drawn again
+     */
+    bool viewChanged(Env &env, int envIndex, int agentIdx, int agent);
+
+    /// the next frame draws every agent, i.e. after the host buffer was overwritten with something else
+    void invalidateViews() { for (auto &view : agentViews) view.envVersion = 0; }
+
     Overview * getOverview() { return &overview; }
 
+    void memoryReport(MemoryReport &report) const;
+
 public:
     std::unique_ptr<WindowlessContext> windowlessContextPtr{nullptr};
     RenderingContext *ctx = nullptr;
 
     Vector2i framebufferSize;
 
-    std::vector<SceneGraph::DrawableGroup3D> envDrawables;
+    std::vector<DrawableTypeArray<EnvInstances>> envInstances;
+
+    // world transformations of the instanced objects, picked up in preDraw()
+    std::vector<TransformCache> transformCaches;
+
+    // per env, instance of every object of the transform cache
+    std::vector<std::vector<std::pair<DrawableType, UnsignedInt>>> cachedInstances;
+
+    bool persistentMapping = false;
+
+    // draw only the cells of the culling grid that intersect the camera frustum (needs ARB_base_instance)
+    bool frustumCulling = false;
+
+    // also skip the cells hidden behind the static layout of the env, needs frustum culling
+    bool occlusionCulling = false;
+    OcclusionBuffer occlusionBuffer;
+
+    // per env, world transformations of the layout boxes, rasterized into the occlusion buffer for every camera
+    std::vector<std::vector<Matrix4>> occluders;
+
+    // instanced draws of one camera, bin is the distance of the culling cells in units of depthBinSize
+    struct DrawRun
+    {
+        GL::Mesh *mesh;
+        UnsignedInt first, count;
+        int bin;
+    };
+
+    static constexpr float depthBinSize = 4.0f;
+    static constexpr int maxDepthBins = 64;
+
+    // GPU time of the draw and readback passes, only while profiling
+    GpuTimer gpuTimer;
+
+    // sort the visible runs by distance from the camera, needs frustum culling (the runs come from the culling grid)
+    bool frontToBack = false;
+
+    // lay down depth with color writes off, then shade only the visible fragments
+    bool depthPrepass = false;
+    std::vector<DrawRun> drawRuns;
+
+    // agents whose view did not change since their last draw keep the previous frame of the host buffer
+    bool skipUnchangedViews = false;
+    int reusedFrames = 0;
+
+    // HUD quad as it is rasterized, the default HUD (i.e. the timer bar) moves by less than a pixel most steps
+    struct HudPixels
+    {
+        Range2Di rect;
+        Color3 color;
+
+        bool operator==(const HudPixels &other) const { return rect == other.rect && color == other.color; }
+    };
+
+    struct AgentView
+    {
+        uint64_t envVersion = 0;  // 0: no frame in the host buffer to reuse
+        Matrix4 cameraMatrix{Math::ZeroInit};
+        std::vector<HudPixels> hud;
+    };
+
+    // per env, bumped on reset and every frame in which an instance moved
+    std::vector<uint64_t> envVersions;
+
+    // per agent of the batch
+    std::vector<AgentView> agentViews;
+    std::vector<HudPixels> hudPixels;
+
+    // merge the static layout boxes into one mesh per env at reset instead of drawing them as instances
+    bool layoutBaking = false;
+    std::vector<BakedLayout> bakedLayouts;
+    PaletteShader bakedShader{NoCreate};
+
+    // unit box of the baked layouts, same mesh as the Box instances
+    std::vector<Vector3> boxPositions, boxNormals;
+    std::vector<UnsignedInt> boxIndices;
+    Range3D boxBounds;
 
-    std::map<DrawableType, GL::Buffer> instanceBuffers;
-    std::map<DrawableType, Containers::Array<InstanceData>> instanceData;
+    // created on the first frame with HUD quads, most envs never draw any
+    Shaders::Flat2D hudShader{NoCreate};
+    GL::Mesh hudQuadMesh{NoCreate};
+    std::vector<HudQuad> hudQuads;
+    PaletteShader shaderInstanced{NoCreate};
 
-    Shaders::Phong shader{NoCreate};
-    Shaders::Phong shaderInstanced{NoCreate};
+    // one RGBA8 texel per entry of allColors, indexed by the color IDs of the instances
+    GL::Texture2D paletteTexture{NoCreate};
 
     GL::Framebuffer framebuffer;
     GL::Renderbuffer colorBuffer, depthBuffer;
 
+    ObservationOptions obsOptions;
+    GL::Texture2D colorTexture{NoCreate}, batchColorTexture{NoCreate};
+    ObservationConversionShader conversionShader{NoCreate};
+    GL::Framebuffer conversionFramebuffer{NoCreate};
+    GL::Renderbuffer conversionBuffer{NoCreate};
+    GL::Mesh fullscreenTriangle{NoCreate};
+
+    GL::Renderbuffer segmentationBuffer{NoCreate}, batchSegmentationBuffer{NoCreate};
+
+    // full resolution uint16 per pixel, same frame order as the color observations
+    Containers::Array<uint8_t> depthFrames, segmentationFrames;
+    Containers::Array<Float> depthScratch;
+
+    // vertex and index buffers are shared by the meshes of all envs, only the instance buffers are per env
     std::map<DrawableType, Trade::MeshData> meshData;
-    std::map<DrawableType, GL::Mesh> meshes;
+    DrawableTypeArray<std::vector<Trade::MeshData>> lodMeshData;
+    DrawableTypeArray<std::vector<std::pair<GL::Buffer, GL::Buffer>>> meshBuffers;  // [type][lod]
 
-    std::vector<std::vector<Containers::Array<uint8_t>>> agentFrames;
+    // observations of all agents in all envs packed into a single buffer, so they can be exported as one tensor
+    HostBuffer framesBuffer;
+    Containers::ArrayView<uint8_t> frames;
+    std::vector<std::vector<uint8_t *>> agentFrames;
     std::vector<std::vector<std::unique_ptr<MutableImageView2D>>> agentImageViews;
 
     bool withDebugDraw = false;
@@ -152,29 +865,72 @@ public:
     bool withOverviewCamera = false;
 
     Overview overview;
+
+    // envs this renderer was created for, indices passed to the methods are indices in this vector
+    std::vector<Env *> renderEnvs;
+
+    // envs from this index onwards are not drawn, see EnvRenderer::setNumActiveEnvs()
+    int numActiveEnvs = 0;
+
+    // per agent of the batch, see EnvRenderer::setRenderMask()
+    std::vector<uint8_t> renderMask;
+
+    // batched mode: all agents are tiles of one big framebuffer, agentsPerColumn tiles stacked vertically in a column
+    // so that each column is read back straight into the contiguous observation buffer
+    bool batched = false;
+    int agentsPerColumn = 0;
+    GL::Framebuffer batchFramebuffer{NoCreate};
+    GL::Renderbuffer batchColorBuffer{NoCreate}, batchDepthBuffer{NoCreate};
+    int numBatchColumns = 0;
+
+    // pipelined mode: ring of pixel pack buffers, one is written by the GPU while the other is mapped for reading
+    static constexpr int numPbos = 2;
+    std::array<GL::Buffer, numPbos> pbos{GL::Buffer{NoCreate}, GL::Buffer{NoCreate}};
+    std::array<GLsync, numPbos> pboFences{};
+    int writePbo = 0, mappedPbo = -1;
+    bool readToPbo = false, frameInFlight = false, usePboFrames = false;
+    const uint8_t *pboFrames = nullptr;
+
+    // second output resolution, see setHiresOutput()
+    Vector2i hiresSize;
+    ObservationOptions hiresObsOptions;
+    GL::Framebuffer hiresFramebuffer{NoCreate};
+    GL::Renderbuffer hiresColorBuffer{NoCreate}, hiresDepthBuffer{NoCreate};
+    std::vector<uint8_t> hiresRgba;
+
+    // per env and agent, empty until the env is drawn for the first time
+    std::vector<std::vector<std::vector<uint8_t>>> hiresFrames;
 };
 
 
-MagnumEnvRenderer::Impl::Impl(Envs &envs, int w, int h, bool withDebugDraw, bool withOverview, RenderingContext *ctx)
+MagnumEnvRenderer::Impl::Impl(
+    const std::vector<Env *> &envs, int w, int h, bool withDebugDraw, bool withOverview, RenderingContext *ctx, bool batched,
+    const ObservationOptions &obsOptions
+)
 : ctx{initContext(ctx)}
 , framebufferSize{w, h}
 , framebuffer{Magnum::Range2Di{{}, framebufferSize}}
+, obsOptions{obsOptions}
 , withDebugDraw{withDebugDraw}
 , withOverviewCamera{withOverview}
+, renderEnvs{envs}
 {
     assert(!envs.empty());
+    numActiveEnvs = int(envs.size());
 
     MAGNUM_ASSERT_GL_VERSION_SUPPORTED(GL::Version::GL330);
 
     GL::Renderer::enable(GL::Renderer::Feature::DepthTest);
     GL::Renderer::enable(GL::Renderer::Feature::FaceCulling);
+    GL::Renderer::setFrontFace(GL::Renderer::FrontFace::ClockWise);  // see topDownProjection()
 
-    colorBuffer.setStorage(GL::RenderbufferFormat::SRGB8Alpha8, framebufferSize);
+    TCHECK(obsOptions.downsample >= 1 && w % obsOptions.downsample == 0 && h % obsOptions.downsample == 0);
+
+    attachColor(framebuffer, colorBuffer, colorTexture, framebufferSize);
     depthBuffer.setStorage(GL::RenderbufferFormat::DepthComponent24, framebufferSize);
 
-    framebuffer.attachRenderbuffer(GL::Framebuffer::ColorAttachment{0}, colorBuffer);
     framebuffer.attachRenderbuffer(GL::Framebuffer::BufferAttachment::Depth, depthBuffer);
-    framebuffer.mapForDraw({{Shaders::Phong::ColorOutput, GL::Framebuffer::ColorAttachment{0}}});
+    attachAuxiliary(framebuffer, segmentationBuffer, framebufferSize);
 
     framebuffer.clearColor(0, Color3{0.125f}).clearDepth(1.0).bind();
 
@@ -182,171 +938,1094 @@ MagnumEnvRenderer::Impl::Impl(Envs &envs, int w, int h, bool withDebugDraw, bool
 
     TLOG(INFO) << "Creating Magnum env renderer " << w << " " << h << " " << envs.size();
 
+    const auto bytesPerFrame = obsOptions.bytesPerFrame(w, h);
+    const Vector2i obsSize{obsOptions.width(w), obsOptions.height(h)};
+    size_t totalNumAgents = 0;
+    for (const auto &e : envs)
+        totalNumAgents += size_t(e->getNumAgents());
+
+    framesBuffer = HostBuffer{totalNumAgents * bytesPerFrame, obsOptions.hostMemory};
+    frames = {framesBuffer.data(), framesBuffer.size()};
+
+    envVersions.assign(envs.size(), 1);
+    agentViews.resize(totalNumAgents);
+
+    size_t offset = 0;
     for (const auto &e : envs) {
-        std::vector<Containers::Array<uint8_t>> envAgentFrames;
+        std::vector<uint8_t *> envAgentFrames;
         std::vector<std::unique_ptr<MutableImageView2D>> envAgentImageViews;
 
         for (int i = 0; i < e->getNumAgents(); ++i) {
-            envAgentFrames.emplace_back(size_t(framebufferSize.x() * framebufferSize.y() * 4));
+            envAgentFrames.emplace_back(frames.data() + offset);
             envAgentImageViews.emplace_back(
-                std::make_unique<MutableImageView2D>(PixelFormat::RGBA8Unorm, framebufferSize, envAgentFrames[i])
+                std::make_unique<MutableImageView2D>(observationStorage(), observationPixelFormat(obsOptions), obsSize, frames.slice(offset, offset + bytesPerFrame))
             );
+            offset += bytesPerFrame;
         }
 
         agentFrames.emplace_back(std::move(envAgentFrames));
         agentImageViews.emplace_back(std::move(envAgentImageViews));
     }
 
-    shaderInstanced = Shaders::Phong{Shaders::Phong::Flag::VertexColor | Shaders::Phong::Flag::InstancedTransformation};
-    shaderInstanced.setShininess(300).setLightPosition({0, 4, 2}).setLightColor(0xaaaaaa_rgbf);
-    shaderInstanced.setDiffuseColor(0xbbbbbb_rgbf);
-    shaderInstanced.setAmbientColor(0x555555_rgbf);
+    shaderInstanced = PaletteShader{obsOptions.segmentation, false, obsOptions.shading};
+    bakedShader = PaletteShader{obsOptions.segmentation, true, obsOptions.shading};
 
-    shader = Shaders::Phong{};
+    {
+        Color4ub palette[numColors];
+        for (int i = 0; i < numColors; ++i)
+            palette[i] = Math::pack<Color4ub>(Color4{colorById(uint8_t(i))});
+
+        paletteTexture = GL::Texture2D{};
+        paletteTexture.setMinificationFilter(GL::SamplerFilter::Nearest).setMagnificationFilter(GL::SamplerFilter::Nearest)
+                      .setStorage(1, GL::TextureFormat::RGBA8, {numColors, 1})
+                      .setSubImage(0, {}, ImageView2D{PixelFormat::RGBA8Unorm, {numColors, 1}, palette});
+    }
+
+    hudQuadMesh = MeshTools::compile(Primitives::squareSolid());
 
     // meshes
     {
         initPrimitives(meshData);
-        for (const auto &[drawable, data] : meshData)
-            meshes[drawable] = MeshTools::compile(data);
-
-        for (auto &[k, v] : meshes) {
-            instanceBuffers[k] = GL::Buffer{};
-            v.addVertexBufferInstanced(
-                instanceBuffers[k], 1, 0,
-                Shaders::Phong::TransformationMatrix{},
-                Shaders::Phong::NormalMatrix{},
-                Shaders::Phong::Color3{}
-            );
+        initPrimitiveLods(lodMeshData);
+        for (int drawable = int(DrawableType::First); drawable < int(DrawableType::NumTypes); ++drawable) {
+            for (const auto &data : lodMeshData[DrawableType(drawable)])
+                meshBuffers[DrawableType(drawable)].emplace_back(
+                    GL::Buffer{GL::Buffer::TargetHint::ElementArray, data.indexData()},
+                    GL::Buffer{GL::Buffer::TargetHint::Array, data.vertexData()}
+                );
         }
     }
 
-    // drawables
+    // instances
     {
-        envDrawables = std::vector<SceneGraph::DrawableGroup3D>(envs.size());
+        envInstances = std::vector<DrawableTypeArray<EnvInstances>>(envs.size());
+        transformCaches.resize(envs.size()), cachedInstances.resize(envs.size());
+
+        persistentMapping = GL::Context::current().isExtensionSupported<GL::Extensions::ARB::buffer_storage>();
+        frustumCulling = GL::Context::current().isExtensionSupported<GL::Extensions::ARB::base_instance>();
+        TLOG(INFO) << "Persistently mapped instance buffers: " << persistentMapping << ", frustum culling: " << frustumCulling;
+
+        for (auto &envMeshInstances : envInstances)
+            for (const auto &[drawableType, data] : meshData)
+                envMeshInstances[drawableType].localBounds = meshBounds(data);
+
+        bakedLayouts.resize(envs.size());
+        occluders.resize(envs.size());
+
+        const auto &box = meshData.at(DrawableType::Box);
+        boxBounds = meshBounds(box);
+        for (const auto &position : box.positions3DAsArray())
+            boxPositions.push_back(position);
+        for (const auto &normal : box.normalsAsArray())
+            boxNormals.push_back(normal);
+        for (auto index : box.indicesAsArray())
+            boxIndices.push_back(index);
     }
 
     if (withDebugDraw) {
         debugDraw = BulletIntegration::DebugDraw{};
         debugDraw.setMode(BulletIntegration::DebugDraw::Mode::DrawWireframe);
     }
+
+    if (batched)
+        this->batched = initBatchedRendering(totalNumAgents);
+
+    if (obsOptions.hasAuxiliaryChannels()) {
+        const auto auxBytes = totalNumAgents * obsOptions.bytesPerFrame(ObservationChannel::Depth, w, h);
+        if (obsOptions.depth) {
+            depthFrames = Containers::Array<uint8_t>{Containers::ValueInit, auxBytes};
+            depthScratch = Containers::Array<Float>{Containers::NoInit, size_t(w * (this->batched ? agentsPerColumn * h : h))};
+        }
+        if (obsOptions.segmentation)
+            segmentationFrames = Containers::Array<uint8_t>{Containers::ValueInit, auxBytes};
+    }
+
+    if (obsOptions.convertsColor()) {
+        const auto maxRegionHeight = this->batched ? agentsPerColumn * h : h;
+        initObservationConversion({obsSize.x(), maxRegionHeight / obsOptions.downsample});
+    }
+
+    framebuffer.bind();
 }
 
-MagnumEnvRenderer::Impl::~Impl()
+void MagnumEnvRenderer::Impl::attachColor(GL::Framebuffer &fb, GL::Renderbuffer &renderbuffer, GL::Texture2D &texture, const Vector2i &size)
 {
-    TLOG(INFO) << __PRETTY_FUNCTION__;
-    if (windowlessContextPtr)
-        windowlessContextPtr->makeCurrent();
+    if (!obsOptions.convertsColor()) {
+        renderbuffer.setStorage(GL::RenderbufferFormat::SRGB8Alpha8, size);
+        fb.attachRenderbuffer(GL::Framebuffer::ColorAttachment{0}, renderbuffer);
+        return;
+    }
+
+    texture = GL::Texture2D{};
+    texture.setStorage(1, GL::TextureFormat::RGBA8, size)
+        .setMinificationFilter(GL::SamplerFilter::Nearest)
+        .setMagnificationFilter(GL::SamplerFilter::Nearest);
+    fb.attachTexture(GL::Framebuffer::ColorAttachment{0}, texture, 0);
 }
 
-RenderingContext * MagnumEnvRenderer::Impl::initContext(RenderingContext *context)
+void MagnumEnvRenderer::Impl::attachAuxiliary(GL::Framebuffer &fb, GL::Renderbuffer &segmentation, const Vector2i &size)
 {
-    if (context) {
-        // we're given a rendering context
-    } else {
-        // don't have an active rendering context, let's create one
-        TLOG(INFO) << windowlessContextPtr.get();
-        windowlessContextPtr = std::make_unique<WindowlessContext>();
-        context = windowlessContextPtr.get();
+    if (!obsOptions.segmentation) {
+        fb.mapForDraw({{Shaders::Phong::ColorOutput, GL::Framebuffer::ColorAttachment{0}}});
+        return;
     }
 
-    return context;
+    segmentation = GL::Renderbuffer{};
+    segmentation.setStorage(GL::RenderbufferFormat::R16UI, size);
+    fb.attachRenderbuffer(GL::Framebuffer::ColorAttachment{1}, segmentation);
+    fb.mapForDraw({
+        {Shaders::Phong::ColorOutput, GL::Framebuffer::ColorAttachment{0}},
+        {Shaders::Phong::ObjectIdOutput, GL::Framebuffer::ColorAttachment{1}},
+    });
 }
 
-void MagnumEnvRenderer::Impl::reset(Env &env, int envIndex)
+void MagnumEnvRenderer::Impl::clearAuxiliary(GL::Framebuffer &fb)
 {
-    ctx->makeCurrent();
+    if (obsOptions.segmentation)
+        fb.clearColor(Shaders::Phong::ObjectIdOutput, Vector4ui{0});
+}
 
-    // reset renderer data structures
-    {
-        envDrawables[envIndex] = SceneGraph::DrawableGroup3D{};
+void MagnumEnvRenderer::Impl::readAuxiliary(GL::Framebuffer &fb, const Range2Di &region, size_t firstFrame)
+{
+    PROFILE_ZONE("Renderer::readback");
+    GPU_PROFILE_ZONE(gpuTimer, "Renderer::gpu.readback");
 
-        for (const auto &it : meshes)
-            arrayResize(instanceData[it.first], 0);
-    }
+    const auto w = framebufferSize.x(), h = framebufferSize.y();
+    const auto offset = firstFrame * obsOptions.bytesPerFrame(ObservationChannel::Depth, w, h);
+    const auto numBytes = size_t(region.size().product()) * sizeof(uint16_t);
 
-    // drawables
-    {
-        const auto &drawables = env.getDrawables();
+    if (obsOptions.depth) {
+        const auto numPixels = size_t(region.size().product());
+        fb.read(region, MutableImageView2D{PixelFormat::Depth32F, region.size(), depthScratch.prefix(numPixels)});
+
+        const auto [fov, near, far, aspectRatio] = agentCameraParameters();
+        auto dst = reinterpret_cast<uint16_t *>(depthFrames.data() + offset);
+        for (size_t i = 0; i < numPixels; ++i)
+            dst[i] = depthToUint16(depthScratch[i], near, far);
+    }
+
+    if (obsOptions.segmentation) {
+        fb.mapForRead(GL::Framebuffer::ColorAttachment{1});
+        fb.read(region, MutableImageView2D{observationStorage(), PixelFormat::R16UI, region.size(), segmentationFrames.slice(offset, offset + numBytes)});
+        fb.mapForRead(GL::Framebuffer::ColorAttachment{0});
+    }
+}
+
+void MagnumEnvRenderer::Impl::initObservationConversion(const Vector2i &maxRegionSize)
+{
+    TLOG(INFO) << "Observation conversion pass: " << obsOptions.channels() << " channels, downsample " << obsOptions.downsample;
+
+    conversionShader = ObservationConversionShader{obsOptions};
+
+    conversionBuffer = GL::Renderbuffer{};
+    const auto format = obsOptions.format == ObservationFormat::Gray8 ? GL::RenderbufferFormat::R8 : GL::RenderbufferFormat::RGBA8;
+    conversionBuffer.setStorage(format, maxRegionSize);
+
+    conversionFramebuffer = GL::Framebuffer{Range2Di{{}, maxRegionSize}};
+    conversionFramebuffer.attachRenderbuffer(GL::Framebuffer::ColorAttachment{0}, conversionBuffer);
+    conversionFramebuffer.mapForDraw({{0, GL::Framebuffer::ColorAttachment{0}}});
+    CORRADE_INTERNAL_ASSERT(conversionFramebuffer.checkStatus(GL::FramebufferTarget::Draw) == GL::Framebuffer::Status::Complete);
 
-        for (auto &it : meshes) {
-            for (const auto &sceneObjectInfo : drawables.at(it.first)) {
-                const auto &color = sceneObjectInfo.color;
-                sceneObjectInfo.objectPtr->addFeature<CustomDrawable>(instanceData[it.first], color, envDrawables[envIndex]);
+    // vertices are generated from gl_VertexID, a vertex array object is all the core profile needs
+    fullscreenTriangle = GL::Mesh{};
+    fullscreenTriangle.setCount(3);
+}
+
+bool MagnumEnvRenderer::Impl::initBatchedRendering(size_t totalNumAgents)
+{
+    const auto maxSize = GL::Renderbuffer::maxSize();
+    const auto w = framebufferSize.x(), h = framebufferSize.y();
+
+    agentsPerColumn = std::max(1, std::min(int(totalNumAgents), maxSize / h));
+    const auto numColumns = (int(totalNumAgents) + agentsPerColumn - 1) / agentsPerColumn;
+    if (numColumns * w > maxSize) {
+        TLOG(WARNING) << "Cannot fit " << totalNumAgents << " observations into a " << maxSize << "x" << maxSize << " framebuffer, batched rendering disabled";
+        return false;
+    }
+
+    const Vector2i batchSize{numColumns * w, agentsPerColumn * h};
+    TLOG(INFO) << "Batched rendering into " << batchSize.x() << "x" << batchSize.y() << " framebuffer";
+
+    batchColorBuffer = GL::Renderbuffer{};
+    batchDepthBuffer = GL::Renderbuffer{};
+    batchDepthBuffer.setStorage(GL::RenderbufferFormat::DepthComponent24, batchSize);
+
+    batchFramebuffer = GL::Framebuffer{Range2Di{{}, batchSize}};
+    attachColor(batchFramebuffer, batchColorBuffer, batchColorTexture, batchSize);
+    batchFramebuffer.attachRenderbuffer(GL::Framebuffer::BufferAttachment::Depth, batchDepthBuffer);
+    attachAuxiliary(batchFramebuffer, batchSegmentationBuffer, batchSize);
+    batchFramebuffer.mapForRead(GL::Framebuffer::ColorAttachment{0});
+
+    CORRADE_INTERNAL_ASSERT(batchFramebuffer.checkStatus(GL::FramebufferTarget::Draw) == GL::Framebuffer::Status::Complete);
+    numBatchColumns = numColumns;
+
+    return true;
+}
+
+void MagnumEnvRenderer::Impl::memoryReport(MemoryReport &report) const
+{
+    report.add("render.observations", frames.size() + depthFrames.size() + segmentationFrames.size() + depthScratch.size() * sizeof(Float));
+
+    // observations themselves are in the frames buffer, these are the pointers and the image views into it
+    size_t agentFramesBytes = vectorBytes(agentFrames) + vectorBytes(agentImageViews);
+    for (const auto &views : agentImageViews)
+        agentFramesBytes += views.size() * sizeof(MutableImageView2D);
+    report.add("render.agent_frames", agentFramesBytes);
+
+    size_t instancesBytes = 0, cullingBytes = 0, gpuInstancesBytes = 0;
+    for (const auto &envInstancesByType : envInstances)
+        for (const auto &instances : envInstancesByType) {
+            instancesBytes += instances.data.size() * sizeof(InstanceData) + vectorBytes(instances.dirty);
+            cullingBytes += instances.grid.memoryBytes();
+            gpuInstancesBytes += instances.capacity * sizeof(InstanceData);
+        }
+
+    report.add("render.instances", instancesBytes);
+    for (const auto &envOccluders : occluders)
+        cullingBytes += vectorBytes(envOccluders);
+
+    report.add("render.culling", cullingBytes + vectorBytes(occluders) + occlusionBuffer.memoryBytes() + vectorBytes(drawRuns));
+    report.add("gpu.instances", gpuInstancesBytes);
+
+    size_t bakedBytes = 0, gpuBakedBytes = 0;
+    for (const auto &baked : bakedLayouts) {
+        bakedBytes += vectorBytes(baked.vertices) + vectorBytes(baked.indices);
+        gpuBakedBytes += baked.gpuBytes;
+    }
+    report.add("render.baked_layout", bakedBytes + vectorBytes(bakedLayouts));
+    report.add("gpu.baked_layout", gpuBakedBytes);
+
+    size_t transformsBytes = vectorBytes(cachedInstances);
+    for (const auto &cache : transformCaches)
+        transformsBytes += cache.memoryBytes();
+    report.add("render.transform_cache", transformsBytes);
+
+    size_t meshBytes = 0;
+    for (const auto &[type, mesh] : meshData)
+        meshBytes += mesh.vertexData().size() + mesh.indexData().size();
+    for (const auto &lods : lodMeshData)
+        for (const auto &mesh : lods)
+            meshBytes += mesh.vertexData().size() + mesh.indexData().size();
+    report.add("render.meshes", meshBytes);
+    report.add("gpu.meshes", meshBytes);
+
+    // RGBA8 color, 24-bit depth padded to 32 and the optional 16-bit segmentation
+    const size_t bytesPerPixel = 4 + 4 + (obsOptions.segmentation ? 2 : 0);
+    auto pixels = size_t(framebufferSize.product());
+    if (batched)
+        pixels += size_t(numBatchColumns) * size_t(agentsPerColumn) * size_t(framebufferSize.product());
+    report.add("gpu.framebuffers", pixels * bytesPerPixel);
+
+    if (pbos[0].id())
+        report.add("gpu.pixel_pack_buffers", numPbos * frames.size());
+
+    if (hiresFramebuffer.id()) {
+        size_t hiresBytes = vectorBytes(hiresRgba) + vectorBytes(hiresFrames);
+        for (const auto &envFrames : hiresFrames) {
+            hiresBytes += vectorBytes(envFrames);
+            for (const auto &frame : envFrames)
+                hiresBytes += vectorBytes(frame);
+        }
+
+        report.add("render.hires_frames", hiresBytes);
+        report.add("gpu.hires_framebuffer", size_t(hiresSize.product()) * (4 + 4));
+    }
+}
+
+SceneGraph::Camera3D * MagnumEnvRenderer::Impl::agentCamera(Env &env, int envIndex, int agentIdx)
+{
+    auto cameraPtr = env.getAgents()[agentIdx]->getCamera();
+    if (withOverviewCamera && overview.enabled && envIndex == 0)
+        cameraPtr = overview.camera;
+
+    // updates the cached camera matrix
+    cameraPtr->object().setClean();
+    return cameraPtr;
+}
+
+MagnumEnvRenderer::Impl::~Impl()
+{
+    TLOG(INFO) << __PRETTY_FUNCTION__;
+    if (windowlessContextPtr)
+        windowlessContextPtr->makeCurrent();
+
+    for (auto &fence : pboFences)
+        if (fence)
+            glDeleteSync(fence);
+
+    if (mappedPbo >= 0)
+        pbos[mappedPbo].unmap();
+}
+
+RenderingContext * MagnumEnvRenderer::Impl::initContext(RenderingContext *context)
+{
+    if (context) {
+        // we're given a rendering context
+    } else {
+        // don't have an active rendering context, let's create one
+        TLOG(INFO) << windowlessContextPtr.get();
+        windowlessContextPtr = std::make_unique<WindowlessContext>();
+        context = windowlessContextPtr.get();
+    }
+
+    return context;
+}
+
+void MagnumEnvRenderer::Impl::reset(Env &env, int envIndex)
+{
+    prepareReset(env, envIndex);
+    finishReset(env, envIndex);
+}
+
+void MagnumEnvRenderer::Impl::prepareReset(Env &env, int envIndex)
+{
+    const auto &drawables = env.getDrawables();
+
+    auto &baked = bakedLayouts[envIndex];
+    baked.vertices.clear(), baked.indices.clear();
+    const auto *voxelQuery = env.getScenario().layoutVoxelQuery();
+
+    auto &envOccluders = occluders[envIndex];
+    envOccluders.clear();
+
+    // baked boxes never move, so they are not instanced and stay out of the transform cache
+    DrawableTypeArray<std::vector<const SceneObjectInfo *>> instanced;
+    std::vector<Object3D *> objects;
+    for (int drawableType = int(DrawableType::First); drawableType < int(DrawableType::NumTypes); ++drawableType)
+        for (const auto &sceneObjectInfo : drawables[DrawableType(drawableType)]) {
+            if (sceneObjectInfo.layout && DrawableType(drawableType) == DrawableType::Box)
+                envOccluders.emplace_back(sceneObjectInfo.objectPtr->absoluteTransformationMatrix());
+
+            if (layoutBaking && sceneObjectInfo.layout && DrawableType(drawableType) == DrawableType::Box) {
+                bakeBox(baked, sceneObjectInfo.objectPtr->absoluteTransformationMatrix(), sceneObjectInfo.colorId, voxelQuery);
+                continue;
             }
+
+            instanced[DrawableType(drawableType)].emplace_back(&sceneObjectInfo);
+            objects.emplace_back(sceneObjectInfo.objectPtr);
+        }
+
+    auto &cache = transformCaches[envIndex];
+    cache.build(objects);
+
+    auto &objectInstances = cachedInstances[envIndex];
+    objectInstances.resize(objects.size());
+
+    int firstObject = 0;
+    for (int drawableType = int(DrawableType::First); drawableType < int(DrawableType::NumTypes); ++drawableType) {
+        auto &instances = envInstances[envIndex][DrawableType(drawableType)];
+        arrayResize(instances.data, 0);
+        instances.dirty.clear();
+        instances.uploadAll = true;
+
+        const auto &sceneObjects = instanced[DrawableType(drawableType)];
+
+        std::vector<Range3D> bounds;
+        for (int i = 0; i < int(sceneObjects.size()); ++i)
+            bounds.emplace_back(transformedBounds(cache.transformation(firstObject + i), instances.localBounds));
+
+        for (auto i : instances.grid.build(bounds)) {
+            const auto &t = cache.transformation(firstObject + int(i));
+            const auto instanceIdx = UnsignedInt(instances.data.size());
+
+            arrayAppend(instances.data, Containers::InPlaceInit, t, sceneObjects[i]->colorId);
+            objectInstances[firstObject + i] = {DrawableType(drawableType), instanceIdx};
         }
+
+        firstObject += int(sceneObjects.size());
     }
+}
+
+void MagnumEnvRenderer::Impl::bakeBox(BakedLayout &baked, const Matrix4 &transformation, UnsignedByte colorId, const LayoutVoxelQuery *query) const
+{
+    const auto hidden = query ? hiddenBoxFaces(transformedBounds(transformation, boxBounds), *query) : uint8_t(0);
+    const auto normalMatrix = transformation.normalMatrix();
+
+    // vertices of the visible faces only, each emitted once
+    constexpr auto notEmitted = ~UnsignedInt(0);
+    std::vector<UnsignedInt> emitted(boxPositions.size(), notEmitted);
+
+    for (size_t triangle = 0; triangle + 2 < boxIndices.size(); triangle += 3) {
+        const auto faceNormal = (normalMatrix * boxNormals[boxIndices[triangle]]).normalized();
+        if (hidden & boxFaceBit(faceNormal))
+            continue;
+
+        for (size_t corner = triangle; corner < triangle + 3; ++corner) {
+            const auto index = boxIndices[corner];
+            if (emitted[index] == notEmitted) {
+                emitted[index] = UnsignedInt(baked.vertices.size());
+                baked.vertices.push_back({transformation.transformPoint(boxPositions[index]), (normalMatrix * boxNormals[index]).normalized(), colorId});
+            }
+
+            baked.indices.push_back(emitted[index]);
+        }
+    }
+}
+
+void MagnumEnvRenderer::Impl::uploadBakedLayout(BakedLayout &baked)
+{
+    baked.gpuBytes = 0;
+    if (baked.indices.empty()) {
+        baked.mesh = GL::Mesh{NoCreate};
+        return;
+    }
+
+    baked.vertexBuffer = GL::Buffer{GL::Buffer::TargetHint::Array};
+    baked.vertexBuffer.setData(baked.vertices, GL::BufferUsage::StaticDraw);
+    baked.indexBuffer = GL::Buffer{GL::Buffer::TargetHint::ElementArray};
+    baked.indexBuffer.setData(baked.indices, GL::BufferUsage::StaticDraw);
+
+    baked.mesh = GL::Mesh{};
+    baked.mesh.setCount(Int(baked.indices.size()))
+        .addVertexBuffer(
+            baked.vertexBuffer, 0,
+            PaletteShader::Position{},
+            PaletteShader::Normal{},
+            PaletteShader::ColorId{PaletteShader::ColorId::DataType::UnsignedByte},
+            sizeof(BakedVertex::padding)
+        )
+        .setIndexBuffer(baked.indexBuffer, 0, MeshIndexType::UnsignedInt);
+
+    // the GPU has its copy for the rest of the episode
+    baked.gpuBytes = vectorBytes(baked.vertices) + vectorBytes(baked.indices);
+    baked.vertices = {}, baked.indices = {};
+}
+
+void MagnumEnvRenderer::Impl::finishReset(Env &env, int envIndex)
+{
+    ctx->makeCurrent();
+    uploadInstances(envIndex);
+    uploadBakedLayout(bakedLayouts[envIndex]);
+    ++envVersions[envIndex];
 
     if (withOverviewCamera && envIndex == 0)
         overview.reset(&env.getScene());
 }
 
-void MagnumEnvRenderer::Impl::preDraw(Env &, int)
+void MagnumEnvRenderer::Impl::preDraw(Env &, int envIndex)
 {
+    auto &cache = transformCaches[envIndex];
+
+    const auto &moved = cache.update();
+    if (!moved.empty())
+        ++envVersions[envIndex];
+
+    // moved instances are marked for upload
+    for (auto objectIdx : moved) {
+        const auto [drawableType, instanceIdx] = cachedInstances[envIndex][objectIdx];
+        auto &instances = envInstances[envIndex][drawableType];
+        const auto &t = cache.transformation(objectIdx);
+
+        instances.data[instanceIdx].setTransformation(t);
+        instances.dirty.emplace_back(instanceIdx);
+        instances.grid.update(instanceIdx, transformedBounds(t, instances.localBounds));
+    }
 }
 
-void MagnumEnvRenderer::Impl::drawAgent(Env &env, int envIndex, int agentIdx, bool readToBuffer)
+void MagnumEnvRenderer::Impl::uploadInstances(int envIndex)
 {
-    framebuffer
-        .clearColor(0, Color3{0})
-        .clearDepth(1.0f)
-        .bind();
+    for (int drawableType = int(DrawableType::First); drawableType < int(DrawableType::NumTypes); ++drawableType) {
+        auto &instances = envInstances[envIndex][DrawableType(drawableType)];
+        const auto numInstances = instances.data.size();
+
+        if (numInstances > instances.capacity) {
+            // immutable storage can't grow, so the buffer and the mesh that references it are recreated
+            const auto capacity = std::max(numInstances, instances.capacity * 3 / 2);
+            const auto numBytes = capacity * sizeof(InstanceData);
+
+            instances.buffer = GL::Buffer{};
+            if (persistentMapping) {
+                const auto flags = GL::Buffer::StorageFlag::MapWrite | GL::Buffer::StorageFlag::MapPersistent | GL::Buffer::StorageFlag::MapCoherent;
+                instances.buffer.setStorage({nullptr, numBytes}, flags);
+
+                const auto mapFlags = GL::Buffer::MapFlag::Write | GL::Buffer::MapFlag::Persistent | GL::Buffer::MapFlag::Coherent;
+                instances.mapped = reinterpret_cast<InstanceData *>(instances.buffer.map(0, GLsizeiptr(numBytes), mapFlags).data());
+            } else {
+                instances.buffer.setData({nullptr, numBytes}, GL::BufferUsage::DynamicDraw);
+            }
 
-    for (auto &it : meshes)
-        arrayResize(instanceData[it.first], 0);
+            const auto &lods = lodMeshData[DrawableType(drawableType)];
+            auto &lodBuffers = meshBuffers[DrawableType(drawableType)];
+            instances.lodMeshes.clear();
+
+            for (size_t lod = 0; lod < lods.size(); ++lod) {
+                auto &[indices, vertices] = lodBuffers[lod];
+                auto mesh = MeshTools::compile(lods[lod], indices, vertices);
+                mesh.addVertexBufferInstanced(
+                    instances.buffer, 1, 0,
+                    PaletteShader::InstancePosition{},
+                    PaletteShader::InstanceRotation{PaletteShader::InstanceRotation::DataType::Short, PaletteShader::InstanceRotation::DataOption::Normalized},
+                    PaletteShader::InstanceScale{PaletteShader::InstanceScale::DataType::Half},
+                    PaletteShader::ColorId{PaletteShader::ColorId::DataType::UnsignedByte},
+                    sizeof(UnsignedByte)
+                );
+
+                instances.lodMeshes.emplace_back(std::move(mesh));
+            }
 
-    auto activeCameraPtr = env.getAgents()[agentIdx]->getCamera();
-    if (withOverviewCamera && overview.enabled && envIndex == 0)
-        activeCameraPtr = overview.camera;
+            instances.capacity = capacity;
+            instances.uploadAll = true;
+        }
 
-    // Would be nice to implement frustrum culling here: https://doc.magnum.graphics/magnum/classMagnum_1_1SceneGraph_1_1Drawable.html#SceneGraph-Drawable-draw-order
-    // Although Vulkan renderer is so much faster, who cares
-    activeCameraPtr->draw(envDrawables[envIndex]);
+        if (instances.uploadAll) {
+            if (instances.mapped)
+                std::copy(instances.data.begin(), instances.data.end(), instances.mapped);
+            else if (numInstances)
+                instances.buffer.setSubData(0, instances.data);
 
-    shaderInstanced.setProjectionMatrix(activeCameraPtr->projectionMatrix());
+            instances.uploadAll = false;
+            instances.dirty.clear();
+            continue;
+        }
+
+        auto &dirty = instances.dirty;
+        if (dirty.empty())
+            continue;
+
+        std::sort(dirty.begin(), dirty.end());
+        dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+        // upload contiguous runs of dirty instances at once
+        for (size_t runStart = 0, i = 1; i <= dirty.size(); ++i) {
+            if (i < dirty.size() && dirty[i] == dirty[i - 1] + 1)
+                continue;
+
+            const auto first = dirty[runStart], count = dirty[i - 1] - first + 1;
+            const auto run = instances.data.slice(first, first + count);
+            if (instances.mapped)
+                std::copy(run.begin(), run.end(), instances.mapped + first);
+            else
+                instances.buffer.setSubData(GLintptr(first * sizeof(InstanceData)), run);
 
-    // Upload instance data to the GPU (orphaning the previous buffer contents) and draw all meshes in one call
-    for (auto &[drawableType, mesh] : meshes)
-        if (!instanceData[drawableType].empty()) {
-            instanceBuffers[drawableType].setData(instanceData[drawableType], GL::BufferUsage::DynamicDraw);
-            mesh.setInstanceCount(Int(instanceData[drawableType].size()));
-            shaderInstanced.draw(mesh);
+            runStart = i;
         }
 
-    // Bullet debug draw
-    if (withDebugDraw) {
-        if (!env.getPhysics().bWorld.getDebugDrawer())
-            env.getPhysics().bWorld.setDebugDrawer(&debugDraw);
+        dirty.clear();
+    }
+}
+
+void MagnumEnvRenderer::Impl::drawInstances(int envIndex, SceneGraph::Camera3D &camera)
+{
+    const auto &cameraMatrix = camera.cameraMatrix();
+    const auto projection = topDownProjection(camera);
+    shaderInstanced
+        .setProjectionMatrix(projection)
+        .setCameraMatrix(cameraMatrix)
+        .bindPalette(paletteTexture);
+
+    const auto viewProjection = projection * cameraMatrix;
+    const auto cameraPosition = cameraMatrix.invertedRigid().translation();
+
+    auto &baked = bakedLayouts[envIndex];
+    if (baked.mesh.id())
+        bakedShader.setProjectionMatrix(projection).setCameraMatrix(cameraMatrix).bindPalette(paletteTexture);
+
+    const OcclusionBuffer *occlusion = nullptr;
+    if (frustumCulling && occlusionCulling && !occluders[envIndex].empty()) {
+        occlusionBuffer.clear(viewProjection);
+        for (const auto &transformation : occluders[envIndex])
+            occlusionBuffer.addOccluder(transformation, boxBounds);
+
+        occlusion = &occlusionBuffer;
+    }
+
+    drawRuns.clear();
+    for (auto &instances : envInstances[envIndex]) {
+        if (instances.data.empty())
+            continue;
+
+        if (frustumCulling) {
+            // level of detail is selected per culling cell, by the distance from the camera to the cell bounds,
+            // runs are also split between distance bins so they can be drawn front to back
+            const auto numLevels = int(instances.lodMeshes.size());
+            const auto cellKey = [&](const CullingGrid::Cell &cell) {
+                const auto distance = distanceToBounds(cameraPosition, cell.bounds);
+                const auto lod = numLevels > 1 ? lodForDistance(distance, numLevels) : 0;
+                const auto bin = frontToBack ? std::min(int(distance / depthBinSize), maxDepthBins - 1) : 0;
+                return bin * numLevels + lod;
+            };
+
+            instances.grid.forEachVisibleRun(viewProjection, cellKey, [&](UnsignedInt first, UnsignedInt count, int key) {
+                drawRuns.push_back({&instances.lodMeshes[key % numLevels], first, count, key / numLevels});
+            }, occlusion);
+        } else
+            drawRuns.push_back({&instances.lodMeshes.front(), 0, UnsignedInt(instances.data.size()), 0});
+    }
+
+    // bins of all drawable types are interleaved, within a bin the types keep their order
+    if (frontToBack)
+        std::stable_sort(drawRuns.begin(), drawRuns.end(), [](const DrawRun &a, const DrawRun &b) { return a.bin < b.bin; });
+
+    const auto drawAll = [&] {
+        // baked layout first, the walls and floors occlude most of the instances
+        if (baked.mesh.id())
+            bakedShader.draw(baked.mesh);
+
+        for (const auto &run : drawRuns) {
+            if (frustumCulling)
+                run.mesh->setBaseInstance(run.first);
+            run.mesh->setInstanceCount(Int(run.count));
+            shaderInstanced.draw(*run.mesh);
+        }
+    };
+
+    if (depthPrepass) {
+        // fragments of the color pass are shaded only where they end up visible, same shaders so depth is identical
+        GL::Renderer::setColorMask(false, false, false, false);
+        drawAll();
+        GL::Renderer::setColorMask(true, true, true, true);
 
         GL::Renderer::setDepthFunction(GL::Renderer::DepthFunction::LessOrEqual);
-        debugDraw.setTransformationProjectionMatrix(activeCameraPtr->projectionMatrix()*activeCameraPtr->cameraMatrix());
-        env.getPhysics().bWorld.debugDrawWorld();
+        drawAll();
         GL::Renderer::setDepthFunction(GL::Renderer::DepthFunction::Less);
+    } else
+        drawAll();
+}
+
+void MagnumEnvRenderer::Impl::drawHudOverlay(Env &env, int envIndex, int agentIdx)
+{
+    // the overview camera shows the scene only
+    if (withOverviewCamera && overview.enabled && envIndex == 0)
+        return;
+
+    hudQuads.clear();
+    env.hud(agentIdx, hudQuads);
+    if (hudQuads.empty())
+        return;
+
+    if (!hudShader.id())
+        hudShader = Shaders::Flat2D{obsOptions.segmentation ? Shaders::Flat2D::Flag::ObjectId : Shaders::Flat2D::Flags{}};
+
+    GL::Renderer::disable(GL::Renderer::Feature::DepthTest);
+    GL::Renderer::disable(GL::Renderer::Feature::FaceCulling);
+
+    for (const auto &quad : hudQuads) {
+        // same vertical flip as topDownProjection()
+        const auto t = Matrix3::scaling({1.0f, -1.0f}) * Matrix3::translation(quad.rect.center()) * Matrix3::scaling(quad.rect.size() * 0.5f);
+        hudShader.setTransformationProjectionMatrix(t).setColor(quad.color);
+        if (obsOptions.segmentation)
+            hudShader.setObjectId(0);
+
+        hudShader.draw(hudQuadMesh);
+    }
+
+    GL::Renderer::enable(GL::Renderer::Feature::DepthTest);
+    GL::Renderer::enable(GL::Renderer::Feature::FaceCulling);
+}
+
+bool MagnumEnvRenderer::Impl::viewChanged(Env &env, int envIndex, int agentIdx, int agent)
+{
+    const auto &cameraMatrix = agentCamera(env, envIndex, agentIdx)->cameraMatrix();
+
+    hudQuads.clear();
+    env.hud(agentIdx, hudQuads);
+
+    // pixel centers covered by the quad, same flip as drawHudOverlay()
+    const auto size = Vector2{framebufferSize};
+    hudPixels.clear();
+    for (const auto &quad : hudQuads) {
+        const auto toPixels = [&size](const Vector2 &ndc) { return Vector2i{Math::ceil((ndc + Vector2{1.0f}) * 0.5f * size - Vector2{0.5f})}; };
+        const Vector2 min{quad.rect.left(), -quad.rect.top()}, max{quad.rect.right(), -quad.rect.bottom()};
+        hudPixels.push_back({{toPixels(min), toPixels(max)}, quad.color});
+    }
+
+    auto &view = agentViews[agent];
+    if (view.envVersion == envVersions[envIndex] && view.cameraMatrix == cameraMatrix && view.hud == hudPixels)
+        return false;
+
+    view.envVersion = envVersions[envIndex];
+    view.cameraMatrix = cameraMatrix;
+    view.hud = hudPixels;
+    return true;
+}
+
+void MagnumEnvRenderer::Impl::drawAgent(Env &env, int envIndex, int agentIdx, bool readToBuffer)
+{
+    {
+        GPU_PROFILE_ZONE(gpuTimer, "Renderer::gpu.draw");
+
+        framebuffer
+            .clearColor(0, Color3{0})
+            .clearDepth(1.0f)
+            .bind();
+        clearAuxiliary(framebuffer);
+
+        auto activeCameraPtr = agentCamera(env, envIndex, agentIdx);
+
+        uploadInstances(envIndex);
+        drawInstances(envIndex, *activeCameraPtr);
+
+        // Bullet debug draw
+        if (withDebugDraw) {
+            if (!env.getPhysics().bWorld.getDebugDrawer())
+                env.getPhysics().bWorld.setDebugDrawer(&debugDraw);
+
+            GL::Renderer::setDepthFunction(GL::Renderer::DepthFunction::LessOrEqual);
+            debugDraw.setTransformationProjectionMatrix(topDownProjection(*activeCameraPtr) * activeCameraPtr->cameraMatrix());
+            env.getPhysics().bWorld.debugDrawWorld();
+            GL::Renderer::setDepthFunction(GL::Renderer::DepthFunction::Less);
+        }
+
+        drawHudOverlay(env, envIndex, agentIdx);
     }
 
     if (readToBuffer) {
-        framebuffer.mapForRead(GL::Framebuffer::ColorAttachment{0});
-        framebuffer.read(framebuffer.viewport(), *agentImageViews[envIndex][agentIdx]);
+        const auto offset = size_t(agentFrames[envIndex][agentIdx] - frames.data());
+        readObservations(framebuffer, framebuffer.viewport(), *agentImageViews[envIndex][agentIdx], offset);
+
+        if (obsOptions.hasAuxiliaryChannels())
+            readAuxiliary(framebuffer, framebuffer.viewport(), offset / obsOptions.bytesPerFrame(framebufferSize.x(), framebufferSize.y()));
+    }
+}
+
+void MagnumEnvRenderer::Impl::convertObservations(GL::Texture2D &source, const Range2Di &region)
+{
+    conversionFramebuffer.setViewport({{}, region.size() / obsOptions.downsample}).bind();
+    conversionShader.setSourceOffset(region.min()).bindSource(source).draw(fullscreenTriangle);
+}
+
+void MagnumEnvRenderer::Impl::readObservations(GL::Framebuffer &fb, const Range2Di &region, MutableImageView2D &view, size_t offset)
+{
+    PROFILE_ZONE("Renderer::readback");
+    GPU_PROFILE_ZONE(gpuTimer, "Renderer::gpu.readback");
+
+    auto *readFb = &fb;
+    auto readRegion = region;
+
+    if (obsOptions.convertsColor()) {
+        convertObservations(&fb == &batchFramebuffer ? batchColorTexture : colorTexture, region);
+        readFb = &conversionFramebuffer;
+        readRegion = {{}, region.size() / obsOptions.downsample};
+    }
+
+    readFb->mapForRead(GL::Framebuffer::ColorAttachment{0});
+
+    if (!readToPbo) {
+        readFb->read(readRegion, view);
+        return;
     }
+
+    GLenum format = GL_RGBA;
+    if (obsOptions.channels() == 3)
+        format = GL_RGB;
+    else if (obsOptions.format == ObservationFormat::Gray8)
+        format = GL_RED;
+
+    // Magnum can't read into an offset of an existing buffer, so this is done in raw GL and the state tracker is told about it
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFb->id());
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[writePbo].id());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(readRegion.left(), readRegion.bottom(), readRegion.sizeX(), readRegion.sizeY(), format, GL_UNSIGNED_BYTE, reinterpret_cast<GLvoid *>(offset));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    GL::Context::current().resetState(GL::Context::State::Framebuffers | GL::Context::State::Buffers | GL::Context::State::PixelStorage);
 }
 
-void MagnumEnvRenderer::Impl::draw(Envs &envs)
+void MagnumEnvRenderer::Impl::drawBatched()
+{
+    gpuTimer.beginFrame();
+
+    const auto fullViewport = batchFramebuffer.viewport();
+    const auto w = framebufferSize.x(), h = framebufferSize.y();
+
+    // tiles of masked, frozen and unchanged agents are neither drawn nor read back, their frames stay as they are
+    const auto numTiles = int(agentViews.size());
+    std::vector<bool> tileDrawn(numTiles);
+    const bool skipUnchanged = skipsUnchangedViews();
+    reusedFrames = 0;
+
+    for (int envIdx = 0, agent = 0; envIdx < numActiveEnvs; ++envIdx) {
+        for (int agentIdx = 0; agentIdx < renderEnvs[envIdx]->getNumAgents(); ++agentIdx, ++agent) {
+            if (!rendersAgent(agent))
+                continue;
+
+            if (!skipUnchanged || viewChanged(*renderEnvs[envIdx], envIdx, agentIdx, agent))
+                tileDrawn[agent] = true;
+            else
+                ++reusedFrames;
+        }
+    }
+
+    {
+        GPU_PROFILE_ZONE(gpuTimer, "Renderer::gpu.draw");
+
+        batchFramebuffer.clearColor(0, Color3{0}).clearDepth(1.0f).bind();
+        clearAuxiliary(batchFramebuffer);
+
+        for (int envIdx = 0, agent = 0; envIdx < numActiveEnvs; ++envIdx) {
+            bool uploaded = false;
+            for (int agentIdx = 0; agentIdx < renderEnvs[envIdx]->getNumAgents(); ++agentIdx, ++agent) {
+                if (!tileDrawn[agent])
+                    continue;
+
+                auto cameraPtr = agentCamera(*renderEnvs[envIdx], envIdx, agentIdx);
+                if (!uploaded)
+                    uploadInstances(envIdx), uploaded = true;
+
+                const auto column = agent / agentsPerColumn, row = agent % agentsPerColumn;
+                batchFramebuffer.setViewport({{column * w, row * h}, {(column + 1) * w, (row + 1) * h}});
+
+                drawInstances(envIdx, *cameraPtr);
+                drawHudOverlay(*renderEnvs[envIdx], envIdx, agentIdx);
+            }
+        }
+
+        batchFramebuffer.setViewport(fullViewport);
+    }
+
+    // tiles of one column are consecutive agents, so a run of rows maps onto a contiguous slice of the frames buffer
+    const auto bytesPerFrame = obsOptions.bytesPerFrame(w, h);
+    for (int column = 0; column < numBatchColumns; ++column) {
+        const auto numRows = std::min(agentsPerColumn, numTiles - column * agentsPerColumn);
+
+        for (int row = 0; row < numRows;) {
+            const auto first = column * agentsPerColumn + row;
+            int runLength = 1;
+            while (row + runLength < numRows && tileDrawn[first + runLength] == tileDrawn[first])
+                ++runLength;
+
+            const auto offset = size_t(first) * bytesPerFrame, numBytes = size_t(runLength) * bytesPerFrame;
+            if (tileDrawn[first]) {
+                const Range2Di region{{column * w, row * h}, {(column + 1) * w, (row + runLength) * h}};
+                MutableImageView2D view{observationStorage(), observationPixelFormat(obsOptions), region.size() / obsOptions.downsample, frames.slice(offset, offset + numBytes)};
+                readObservations(batchFramebuffer, region, view, offset);
+
+                if (obsOptions.hasAuxiliaryChannels())
+                    readAuxiliary(batchFramebuffer, region, size_t(first));
+            } else if (readToPbo) {
+                // the pixel pack buffer being written holds a frame from two steps ago, carry the latest one over
+                pbos[writePbo].setSubData(GLintptr(offset), Containers::arrayView(getObservationsBatch() + offset, numBytes));
+            }
+
+            row += runLength;
+        }
+    }
+
+    gpuTimer.endFrame();
+}
+
+void MagnumEnvRenderer::Impl::draw()
 {
     ctx->makeCurrent();
 
-    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx)
-        for (int agentIdx = 0; agentIdx < envs[envIdx]->getNumAgents(); ++agentIdx)
-            drawAgent(*envs[envIdx], envIdx, agentIdx, true);
+    // synchronous frames always go to the host buffer
+    waitForFrame();
+    usePboFrames = false;
+
+    if (batched) {
+        drawBatched();
+        return;
+    }
+
+    drawAgents();
 }
 
-uint8_t * MagnumEnvRenderer::Impl::getObservation(int envIdx, int agentIdx)
+void MagnumEnvRenderer::Impl::drawAgents()
 {
-    return agentFrames[envIdx][agentIdx].data();
+    gpuTimer.beginFrame();
+
+    const bool skipUnchanged = skipsUnchangedViews();
+    reusedFrames = 0;
+
+    for (int envIdx = 0, agent = 0; envIdx < numActiveEnvs; ++envIdx) {
+        for (int agentIdx = 0; agentIdx < renderEnvs[envIdx]->getNumAgents(); ++agentIdx, ++agent) {
+            if (!rendersAgent(agent))
+                continue;
+
+            if (skipUnchanged && !viewChanged(*renderEnvs[envIdx], envIdx, agentIdx, agent))
+                ++reusedFrames;
+            else
+                drawAgent(*renderEnvs[envIdx], envIdx, agentIdx, true);
+        }
+    }
+
+    gpuTimer.endFrame();
 }
 
-MagnumEnvRenderer::MagnumEnvRenderer(Envs &envs, int w, int h, bool withDebugDraw, bool withOverview, RenderingContext *ctx)
+void MagnumEnvRenderer::Impl::drawAsync()
 {
-    pimpl = std::make_unique<Impl>(envs, w, h, withDebugDraw, withOverview, ctx);
+    // auxiliary channels are read synchronously and would be one frame ahead of the color
+    if (obsOptions.hasAuxiliaryChannels()) {
+        draw();
+        return;
+    }
+
+    ctx->makeCurrent();
+    waitForFrame();
+
+    if (!pbos[writePbo].id()) {
+        for (auto &pbo : pbos) {
+            pbo = GL::Buffer{};
+            pbo.setData({nullptr, frames.size()}, GL::BufferUsage::StreamRead);
+        }
+    }
+
+    // the frames go to the pixel pack buffers, the host buffer is stale from now on
+    invalidateViews();
+
+    // the other buffer of the ring may still be mapped with the observations of the previous frame
+    readToPbo = true;
+    if (batched)
+        drawBatched();
+    else
+        drawAgents();
+    readToPbo = false;
+
+    pboFences[writePbo] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GL::Renderer::flush();
+
+    frameInFlight = true;
+}
+
+void MagnumEnvRenderer::Impl::waitForFrame()
+{
+    if (!frameInFlight)
+        return;
+
+    PROFILE_ZONE("Renderer::readback");
+
+    ctx->makeCurrent();
+
+    auto &fence = pboFences[writePbo];
+    constexpr GLuint64 timeoutNs = 1'000'000'000;
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeoutNs) == GL_TIMEOUT_EXPIRED)
+        TLOG(WARNING) << "Still waiting for the frame readback...";
+
+    glDeleteSync(fence);
+    fence = nullptr;
+    frameInFlight = false;
+
+    if (mappedPbo >= 0)
+        pbos[mappedPbo].unmap();
+
+    mappedPbo = writePbo;
+    pboFrames = reinterpret_cast<const uint8_t *>(pbos[mappedPbo].map(0, GLsizeiptr(frames.size()), GL::Buffer::MapFlag::Read).data());
+    usePboFrames = true;
+
+    writePbo = (writePbo + 1) % numPbos;
+}
+
+const uint8_t * MagnumEnvRenderer::Impl::getObservation(int envIdx, int agentIdx) const
+{
+    if (usePboFrames)
+        return pboFrames + (agentFrames[envIdx][agentIdx] - frames.data());
+
+    return agentFrames[envIdx][agentIdx];
+}
+
+const uint8_t * MagnumEnvRenderer::Impl::getObservation(int envIdx, int agentIdx, ObservationChannel channel) const
+{
+    if (channel == ObservationChannel::Color)
+        return getObservation(envIdx, agentIdx);
+
+    const auto batch = getObservationsBatch(channel);
+    if (!batch)
+        return nullptr;
+
+    // frame index from the position of the color frame in the contiguous buffer
+    const auto w = framebufferSize.x(), h = framebufferSize.y();
+    const auto frameIdx = size_t(agentFrames[envIdx][agentIdx] - frames.data()) / obsOptions.bytesPerFrame(w, h);
+    return batch + frameIdx * obsOptions.bytesPerFrame(channel, w, h);
+}
+
+const uint8_t * MagnumEnvRenderer::Impl::getObservationsBatch(ObservationChannel channel) const
+{
+    switch (channel) {
+        case ObservationChannel::Depth: return obsOptions.depth ? depthFrames.data() : nullptr;
+        case ObservationChannel::Segmentation: return obsOptions.segmentation ? segmentationFrames.data() : nullptr;
+        default: return getObservationsBatch();
+    }
+}
+
+bool MagnumEnvRenderer::Impl::setHiresOutput(int w, int h, const ObservationOptions &options)
+{
+    TCHECK(options.downsample >= 1 && w % options.downsample == 0 && h % options.downsample == 0);
+    ctx->makeCurrent();
+
+    hiresSize = {w, h};
+    hiresObsOptions = options;
+    hiresObsOptions.depth = hiresObsOptions.segmentation = false;
+
+    hiresColorBuffer = GL::Renderbuffer{};
+    hiresColorBuffer.setStorage(GL::RenderbufferFormat::RGBA8, hiresSize);
+    hiresDepthBuffer = GL::Renderbuffer{};
+    hiresDepthBuffer.setStorage(GL::RenderbufferFormat::DepthComponent24, hiresSize);
+
+    hiresFramebuffer = GL::Framebuffer{Range2Di{{}, hiresSize}};
+    hiresFramebuffer.attachRenderbuffer(GL::Framebuffer::ColorAttachment{0}, hiresColorBuffer);
+    hiresFramebuffer.attachRenderbuffer(GL::Framebuffer::BufferAttachment::Depth, hiresDepthBuffer);
+    hiresFramebuffer.mapForDraw({{Shaders::Phong::ColorOutput, GL::Framebuffer::ColorAttachment{0}}});
+    CORRADE_INTERNAL_ASSERT(hiresFramebuffer.checkStatus(GL::FramebufferTarget::Draw) == GL::Framebuffer::Status::Complete);
+
+    hiresRgba.resize(size_t(hiresSize.product()) * 4);
+    hiresFrames.assign(agentFrames.size(), {});
+
+    framebuffer.bind();
+    return true;
+}
+
+void MagnumEnvRenderer::Impl::drawHires(const std::vector<int> &envIndices)
+{
+    PROFILE_ZONE("Renderer::drawHires");
+
+    TCHECK(hiresFramebuffer.id());
+    ctx->makeCurrent();
+
+    // instance buffers may still be read by a pipelined frame
+    waitForFrame();
+
+    const auto bytesPerFrame = hiresObsOptions.bytesPerFrame(hiresSize.x(), hiresSize.y());
+    MutableImageView2D rgbaView{observationStorage(), PixelFormat::RGBA8Unorm, hiresSize, Containers::arrayView(hiresRgba)};
+
+    for (auto envIdx : envIndices) {
+        auto &env = *renderEnvs[envIdx];
+        auto &envFrames = hiresFrames[envIdx];
+        envFrames.resize(size_t(env.getNumAgents()));
+
+        uploadInstances(envIdx);
+
+        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+            hiresFramebuffer.clearColor(0, Color3{0}).clearDepth(1.0f).bind();
+
+            auto cameraPtr = env.getAgents()[agentIdx]->getCamera();
+            cameraPtr->object().setClean();
+
+            drawInstances(envIdx, *cameraPtr);
+            drawHudOverlay(env, envIdx, agentIdx);
+
+            hiresFramebuffer.mapForRead(GL::Framebuffer::ColorAttachment{0});
+            hiresFramebuffer.read(hiresFramebuffer.viewport(), rgbaView);
+
+            auto &frame = envFrames[agentIdx];
+            frame.resize(bytesPerFrame);
+            if (hiresObsOptions.convertsColor())
+                convertObservations(hiresRgba.data(), hiresSize.x(), hiresSize.y(), 1, hiresObsOptions, frame.data());
+            else
+                std::copy(hiresRgba.begin(), hiresRgba.end(), frame.begin());
+        }
+    }
+
+    framebuffer.bind();
+}
+
+MagnumEnvRenderer::MagnumEnvRenderer(
+    Envs &envs, int w, int h, bool withDebugDraw, bool withOverview, RenderingContext *ctx, bool batched,
+    const ObservationOptions &obsOptions
+)
+{
+    std::vector<Env *> envPtrs;
+    for (auto &e : envs)
+        envPtrs.emplace_back(e.get());
+
+    pimpl = std::make_unique<Impl>(envPtrs, w, h, withDebugDraw, withOverview, ctx, batched, obsOptions);
+}
+
+MagnumEnvRenderer::MagnumEnvRenderer(
+    const std::vector<Env *> &envs, int w, int h, bool withDebugDraw, bool withOverview, RenderingContext *ctx,
+    bool batched, const ObservationOptions &obsOptions
+)
+{
+    pimpl = std::make_unique<Impl>(envs, w, h, withDebugDraw, withOverview, ctx, batched, obsOptions);
 }
 
 MagnumEnvRenderer::~MagnumEnvRenderer() = default;
@@ -357,6 +2036,16 @@ void MagnumEnvRenderer::reset(Env &env, int envIdx)
     pimpl->reset(env, envIdx);
 }
 
+void MagnumEnvRenderer::prepareReset(Env &env, int envIdx)
+{
+    pimpl->prepareReset(env, envIdx);
+}
+
+void MagnumEnvRenderer::finishReset(Env &env, int envIdx)
+{
+    pimpl->finishReset(env, envIdx);
+}
+
 void MagnumEnvRenderer::preDraw(Env &env, int envIdx)
 {
     pimpl->preDraw(env, envIdx);
@@ -364,7 +2053,27 @@ void MagnumEnvRenderer::preDraw(Env &env, int envIdx)
 
 void MagnumEnvRenderer::draw(Envs &envs)
 {
-    pimpl->draw(envs);
+    pimpl->draw();
+}
+
+void MagnumEnvRenderer::drawAsync(Envs &envs)
+{
+    pimpl->drawAsync();
+}
+
+void MagnumEnvRenderer::setNumActiveEnvs(int numEnvs)
+{
+    pimpl->setNumActiveEnvs(numEnvs);
+}
+
+void MagnumEnvRenderer::setRenderMask(const std::vector<uint8_t> &agentMask)
+{
+    pimpl->setRenderMask(agentMask);
+}
+
+void MagnumEnvRenderer::waitForFrame()
+{
+    pimpl->waitForFrame();
 }
 
 void MagnumEnvRenderer::drawAgent(Env &env, int envIndex, int agentIndex, bool readToBuffer)
@@ -377,6 +2086,21 @@ const uint8_t * MagnumEnvRenderer::getObservation(int envIdx, int agentIdx) cons
     return pimpl->getObservation(envIdx, agentIdx);
 }
 
+const uint8_t * MagnumEnvRenderer::getObservation(int envIdx, int agentIdx, ObservationChannel channel) const
+{
+    return pimpl->getObservation(envIdx, agentIdx, channel);
+}
+
+const uint8_t * MagnumEnvRenderer::getObservationsBatch() const
+{
+    return pimpl->getObservationsBatch();
+}
+
+const uint8_t * MagnumEnvRenderer::getObservationsBatch(ObservationChannel channel) const
+{
+    return pimpl->getObservationsBatch(channel);
+}
+
 Magnum::GL::Framebuffer *MagnumEnvRenderer::getFramebuffer()
 {
     return pimpl->getFramebuffer();
@@ -387,6 +2111,60 @@ void MagnumEnvRenderer::toggleDebugMode()
     pimpl->toggleDebugMode();
 }
 
+void MagnumEnvRenderer::setLayoutBaking(bool enabled)
+{
+    pimpl->setLayoutBaking(enabled);
+}
+
+void MagnumEnvRenderer::setOcclusionCulling(bool enabled)
+{
+    pimpl->setOcclusionCulling(enabled);
+}
+
+void MagnumEnvRenderer::setFrontToBack(bool enabled)
+{
+    pimpl->setFrontToBack(enabled);
+}
+
+void MagnumEnvRenderer::setDepthPrepass(bool enabled)
+{
+    pimpl->setDepthPrepass(enabled);
+}
+
+void MagnumEnvRenderer::setSkipUnchangedViews(bool enabled)
+{
+    pimpl->setSkipUnchangedViews(enabled);
+}
+
+int MagnumEnvRenderer::numReusedFrames() const
+{
+    return pimpl->reusedFrames;
+}
+
+bool MagnumEnvRenderer::setHiresOutput(int w, int h, const ObservationOptions &options)
+{
+    return pimpl->setHiresOutput(w, h, options);
+}
+
+void MagnumEnvRenderer::drawHires(Envs &envs, const std::vector<int> &envIndices)
+{
+    pimpl->drawHires(envIndices);
+}
+
+const uint8_t * MagnumEnvRenderer::getHiresObservation(int envIdx, int agentIdx) const
+{
+    const auto &frames = pimpl->hiresFrames;
+    if (envIdx >= int(frames.size()) || agentIdx >= int(frames[envIdx].size()))
+        return nullptr;
+
+    return frames[envIdx][agentIdx].data();
+}
+
+void MagnumEnvRenderer::memoryReport(MemoryReport &report) const
+{
+    pimpl->memoryReport(report);
+}
+
 Overview * Megaverse::MagnumEnvRenderer::getOverview()
 {
     return pimpl->getOverview();
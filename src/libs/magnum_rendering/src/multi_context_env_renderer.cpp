@@ -0,0 +1,281 @@
+#include <cstring>
+#include <algorithm>
+
+#include <util/tiny_logger.hpp>
+#include <util/scoped_profiler.hpp>
+
+#include <magnum_rendering/multi_context_env_renderer.hpp>
+
+
+using namespace Megaverse;
+
+
+void MultiContextEnvRenderer::Shard::loop()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock{mutex};
+            cv.wait(lock, [this] { return terminate || !tasks.empty(); });
+            if (tasks.empty())
+                break;
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+
+        {
+            std::lock_guard lock{mutex};
+            --numPending;
+        }
+        cv.notify_all();
+    }
+
+    // GL objects have to be deleted with their context current
+    renderer.reset();
+    ctx.reset();
+}
+
+MultiContextEnvRenderer::MultiContextEnvRenderer(
+    Envs &envs, int w, int h, int numRenderThreads, const std::vector<int> &gpuIds, const ObservationOptions &obsOptions
+)
+: obsOptions{obsOptions}
+, w{w}
+, h{h}
+{
+    TCHECK(!gpuIds.empty());
+
+    agentOffsets.push_back(0);
+    for (const auto &e : envs)
+        agentOffsets.push_back(agentOffsets.back() + e->getNumAgents());
+
+    const auto numEnvs = int(envs.size());
+    const auto numShards = std::clamp(numRenderThreads, 1, std::max(numEnvs, 1));
+    envShards.resize(size_t(numEnvs));
+
+    for (int shardIdx = 0; shardIdx < numShards; ++shardIdx) {
+        auto shard = std::make_unique<Shard>();
+        shard->firstEnv = numEnvs * shardIdx / numShards;
+        shard->numEnvs = numEnvs * (shardIdx + 1) / numShards - shard->firstEnv;
+
+        for (int envIdx = shard->firstEnv; envIdx < shard->firstEnv + shard->numEnvs; ++envIdx) {
+            shard->envs.emplace_back(envs[envIdx].get());
+            envShards[envIdx] = shardIdx;
+        }
+
+        const auto gpuId = gpuIds[size_t(shardIdx) % gpuIds.size()];
+        TLOG(INFO) << "Rendering " << shard->numEnvs << " envs on render thread " << shardIdx << ", GPU " << gpuId;
+
+        shard->thread = std::thread{&Shard::loop, shard.get()};
+
+        // frames of the shards are only gathered, the batch the learner copies from is the one to pin
+        auto shardOptions = obsOptions;
+        if (shardOptions.hostMemory == HostMemoryPolicy::Pinned)
+            shardOptions.hostMemory = HostMemoryPolicy::HugePages;
+
+        auto &s = *shard;
+        post(s, [&s, gpuId, w, h, shardOptions] {
+            s.ctx = std::make_unique<WindowlessContext>(gpuId);
+            s.renderer = std::make_unique<MagnumEnvRenderer>(s.envs, w, h, false, false, s.ctx.get(), false, shardOptions);
+        });
+
+        shards.emplace_back(std::move(shard));
+    }
+
+    sync();
+
+    const auto numAgentsTotal = size_t(agentOffsets.back());
+    frames[int(ObservationChannel::Color)] = HostBuffer{numAgentsTotal * obsOptions.bytesPerFrame(w, h), obsOptions.hostMemory};
+    if (obsOptions.depth)
+        frames[int(ObservationChannel::Depth)].resize(numAgentsTotal * obsOptions.bytesPerFrame(ObservationChannel::Depth, w, h));
+    if (obsOptions.segmentation)
+        frames[int(ObservationChannel::Segmentation)].resize(numAgentsTotal * obsOptions.bytesPerFrame(ObservationChannel::Segmentation, w, h));
+}
+
+MultiContextEnvRenderer::~MultiContextEnvRenderer()
+{
+    for (auto &shard : shards) {
+        {
+            std::lock_guard lock{shard->mutex};
+            shard->terminate = true;
+        }
+        shard->cv.notify_all();
+    }
+
+    for (auto &shard : shards)
+        shard->thread.join();
+}
+
+void MultiContextEnvRenderer::post(Shard &shard, std::function<void()> task)
+{
+    {
+        std::lock_guard lock{shard.mutex};
+        shard.tasks.emplace_back(std::move(task));
+        ++shard.numPending;
+    }
+    shard.cv.notify_all();
+}
+
+void MultiContextEnvRenderer::sync()
+{
+    for (auto &shard : shards) {
+        std::unique_lock lock{shard->mutex};
+        shard->cv.wait(lock, [&shard] { return shard->numPending == 0; });
+    }
+}
+
+void MultiContextEnvRenderer::forEachShard(const std::function<void(Shard &)> &f)
+{
+    for (auto &shard : shards) {
+        auto &s = *shard;
+        post(s, [&f, &s] { f(s); });
+    }
+
+    sync();
+}
+
+void MultiContextEnvRenderer::reset(Env &env, int envIdx)
+{
+    auto &shard = shardOf(envIdx);
+    post(shard, [&shard, &env, idx = localIdx(envIdx)] { shard.renderer->reset(env, idx); });
+    sync();
+}
+
+void MultiContextEnvRenderer::prepareReset(Env &env, int envIdx)
+{
+    shardOf(envIdx).renderer->prepareReset(env, localIdx(envIdx));
+}
+
+void MultiContextEnvRenderer::finishReset(Env &env, int envIdx)
+{
+    // preDraw() of the env follows right away, so this can't be deferred
+    auto &shard = shardOf(envIdx);
+    post(shard, [&shard, &env, idx = localIdx(envIdx)] { shard.renderer->finishReset(env, idx); });
+    sync();
+}
+
+void MultiContextEnvRenderer::preDraw(Env &env, int envIdx)
+{
+    shardOf(envIdx).renderer->preDraw(env, localIdx(envIdx));
+}
+
+void MultiContextEnvRenderer::draw(Envs &)
+{
+    waitForFrame();
+
+    // sub-renderers draw their own subset of envs, the argument is ignored by MagnumEnvRenderer
+    forEachShard([](Shard &shard) {
+        Envs unused;
+        shard.renderer->draw(unused);
+    });
+
+    gather();
+}
+
+void MultiContextEnvRenderer::drawAsync(Envs &)
+{
+    waitForFrame();
+
+    // the instance uploads read what preDraw() wrote, so the next step can only start when all shards submitted
+    forEachShard([](Shard &shard) {
+        Envs unused;
+        shard.renderer->drawAsync(unused);
+    });
+
+    frameInFlight = true;
+}
+
+void MultiContextEnvRenderer::waitForFrame()
+{
+    if (!frameInFlight)
+        return;
+
+    forEachShard([](Shard &shard) { shard.renderer->waitForFrame(); });
+    frameInFlight = false;
+
+    gather();
+}
+
+void MultiContextEnvRenderer::setNumActiveEnvs(int numEnvs)
+{
+    // CPU-only, the render threads are idle between the calls
+    for (auto &shard : shards)
+        shard->renderer->setNumActiveEnvs(std::clamp(numEnvs - shard->firstEnv, 0, shard->numEnvs));
+}
+
+void MultiContextEnvRenderer::setRenderMask(const std::vector<uint8_t> &agentMask)
+{
+    for (auto &shard : shards) {
+        if (agentMask.empty()) {
+            shard->renderer->setRenderMask({});
+            continue;
+        }
+
+        const auto first = agentMask.begin() + agentOffsets[shard->firstEnv];
+        const auto last = agentMask.begin() + agentOffsets[shard->firstEnv + shard->numEnvs];
+        shard->renderer->setRenderMask(std::vector<uint8_t>(first, last));
+    }
+}
+
+void MultiContextEnvRenderer::gather()
+{
+    PROFILE_ZONE("Renderer::gather");
+
+    for (auto channel : {ObservationChannel::Color, ObservationChannel::Depth, ObservationChannel::Segmentation}) {
+        auto &gathered = frames[int(channel)];
+        if (gathered.empty())
+            continue;
+
+        // agents of a shard are contiguous in its renderer and in the gathered batch
+        const auto bytesPerFrame = obsOptions.bytesPerFrame(channel, w, h);
+        for (const auto &shard : shards) {
+            if (shard->numEnvs == 0)
+                continue;
+
+            const auto firstAgent = size_t(agentOffsets[shard->firstEnv]);
+            const auto numAgents = size_t(agentOffsets[shard->firstEnv + shard->numEnvs]) - firstAgent;
+            const auto src = shard->renderer->getObservationsBatch(channel);
+            if (src)
+                memcpy(gathered.data() + firstAgent * bytesPerFrame, src, numAgents * bytesPerFrame);
+        }
+    }
+}
+
+const uint8_t * MultiContextEnvRenderer::getObservation(int envIdx, int agentIdx) const
+{
+    return getObservation(envIdx, agentIdx, ObservationChannel::Color);
+}
+
+const uint8_t * MultiContextEnvRenderer::getObservation(int envIdx, int agentIdx, ObservationChannel channel) const
+{
+    const auto batch = getObservationsBatch(channel);
+    if (!batch)
+        return nullptr;
+
+    return batch + size_t(agentOffsets[envIdx] + agentIdx) * obsOptions.bytesPerFrame(channel, w, h);
+}
+
+const uint8_t * MultiContextEnvRenderer::getObservationsBatch(ObservationChannel channel) const
+{
+    const auto &gathered = frames[int(channel)];
+    return gathered.empty() ? nullptr : gathered.data();
+}
+
+Overview * MultiContextEnvRenderer::getOverview()
+{
+    return shards.front()->renderer->getOverview();
+}
+
+void MultiContextEnvRenderer::memoryReport(MemoryReport &report) const
+{
+    for (const auto &shard : shards)
+        shard->renderer->memoryReport(report);
+
+    size_t gatheredBytes = 0;
+    for (const auto &gathered : frames)
+        gatheredBytes += gathered.size();
+
+    report.add("render.observations", gatheredBytes);
+}
@@ -0,0 +1,186 @@
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <unordered_map>
+
+#include <Magnum/GL/Context.h>
+#include <Magnum/GL/Extensions.h>
+#include <Magnum/GL/OpenGL.h>
+
+#include <util/tiny_logger.hpp>
+#include <util/filesystem_utils.hpp>
+
+#include <magnum_rendering/program_cache.hpp>
+
+
+using namespace Magnum;
+using namespace Megaverse;
+
+
+namespace
+{
+
+struct ProgramBinary
+{
+    GLenum format = 0;
+    std::vector<char> data;
+};
+
+/**
+ * File layout: magic, format, key size, key, binary. The full key is compared on load, the file name is only its hash.
+ */
+constexpr uint32_t programBinaryMagic = 0x4d475042;  // "MGPB"
+
+class ProgramCache
+{
+public:
+    static ProgramCache & instance()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+    bool supported() const
+    {
+        return GL::Context::hasCurrent() && GL::Context::current().isExtensionSupported<GL::Extensions::ARB::get_program_binary>();
+    }
+
+    std::string fullKey(const std::string &key) const
+    {
+        const auto &ctx = GL::Context::current();
+        return ctx.vendorString() + "\n" + ctx.rendererString() + "\n" + ctx.versionString() + "\n" + key;
+    }
+
+    bool find(const std::string &key, ProgramBinary &binary)
+    {
+        std::lock_guard lock{mutex};
+
+        if (const auto it = binaries.find(key); it != binaries.end()) {
+            binary = it->second;
+            return true;
+        }
+
+        if (dir.empty())
+            return false;
+
+        std::vector<char> file;
+        if (!fileExists(filename(key)) || !readAllBytes(filename(key), file))
+            return false;
+
+        // truncated or foreign files are misses, they are overwritten by the next store
+        const auto header = 3 * sizeof(uint32_t);
+        uint32_t magic = 0, format = 0, keySize = 0;
+        if (file.size() < header)
+            return false;
+        memcpy(&magic, file.data(), sizeof(magic));
+        memcpy(&format, file.data() + 4, sizeof(format));
+        memcpy(&keySize, file.data() + 8, sizeof(keySize));
+
+        if (magic != programBinaryMagic || file.size() < header + keySize || key.compare(0, std::string::npos, file.data() + header, keySize) != 0)
+            return false;
+
+        binary.format = format;
+        binary.data.assign(file.begin() + std::ptrdiff_t(header + keySize), file.end());
+        binaries[key] = binary;
+        return true;
+    }
+
+    void store(const std::string &key, ProgramBinary binary)
+    {
+        std::lock_guard lock{mutex};
+        if (binaries.count(key))
+            return;
+
+        if (!dir.empty()) {
+            const auto keySize = uint32_t(key.size()), format = uint32_t(binary.format);
+            std::vector<char> file(3 * sizeof(uint32_t));
+            memcpy(file.data(), &programBinaryMagic, 4);
+            memcpy(file.data() + 4, &format, 4);
+            memcpy(file.data() + 8, &keySize, 4);
+            file.insert(file.end(), key.begin(), key.end());
+            file.insert(file.end(), binary.data.begin(), binary.data.end());
+
+            if (!writeFileAtomic(filename(key), file.data(), file.size()))
+                TLOG(WARNING) << "Could not write the program binary to " << filename(key);
+        }
+
+        binaries.emplace(key, std::move(binary));
+    }
+
+private:
+    ProgramCache()
+    {
+        const auto envvarCacheDir = std::getenv("MEGAVERSE_SHADER_CACHE");
+        if (envvarCacheDir)
+            dir = envvarCacheDir;
+        else if (const auto home = std::getenv("HOME"); home && strlen(home) > 0)
+            dir = pathJoin(home, ".cache", "megaverse", "shaders");
+
+        if (!dir.empty() && !createDirectories(dir)) {
+            TLOG(WARNING) << "Could not create the shader cache directory " << dir << ", programs are cached in memory only";
+            dir.clear();
+        }
+    }
+
+    std::string filename(const std::string &key) const
+    {
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>{}(key) << ".bin";
+        return pathJoin(dir, name.str());
+    }
+
+private:
+    std::mutex mutex;
+    std::string dir;
+    std::unordered_map<std::string, ProgramBinary> binaries;
+};
+
+}
+
+
+bool Megaverse::loadProgramBinary(GL::AbstractShaderProgram &program, const std::string &key)
+{
+    auto &cache = ProgramCache::instance();
+    if (!cache.supported())
+        return false;
+
+    ProgramBinary binary;
+    if (!cache.find(cache.fullKey(key), binary))
+        return false;
+
+    glProgramBinary(program.id(), binary.format, binary.data.data(), GLsizei(binary.data.size()));
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program.id(), GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE)
+        TLOG(DEBUG) << "Cached program binary rejected by the driver, compiling";
+
+    return linked == GL_TRUE;
+}
+
+void Megaverse::prepareProgramBinary(GL::AbstractShaderProgram &program)
+{
+    if (ProgramCache::instance().supported())
+        glProgramParameteri(program.id(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void Megaverse::storeProgramBinary(GL::AbstractShaderProgram &program, const std::string &key)
+{
+    auto &cache = ProgramCache::instance();
+    if (!cache.supported())
+        return;
+
+    GLint size = 0;
+    glGetProgramiv(program.id(), GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0)
+        return;
+
+    ProgramBinary binary;
+    binary.data.resize(size_t(size));
+    glGetProgramBinary(program.id(), size, nullptr, &binary.format, binary.data.data());
+
+    cache.store(cache.fullKey(key), std::move(binary));
+}
@@ -6,7 +6,7 @@
 
 class BreadthFirstSearch : public SpanningtreeAlgorithm {
  public:
-  std::vector<std::pair<int, int>> SpanningTree(int, const Graph&);
+  const std::vector<std::pair<int, int>>& SpanningTree(int, const Graph&) override;
 
  private:
   std::vector<bool> visited;
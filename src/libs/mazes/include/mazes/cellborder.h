@@ -1,41 +1,35 @@
 #ifndef CELLBORDER_H
 #define CELLBORDER_H
 
-#include <tuple>
+#include <cstdint>
 #include <string>
+#include <tuple>
 
-
+// Border between two cells (or a cell and the outside): a line segment or an
+// arc. Plain value type, a maze keeps all of its borders in one array.
 class CellBorder {
  public:
-  virtual ~CellBorder() = default;
-  virtual std::string GnuplotPrintString() const = 0;
-  virtual std::string SVGPrintString() const = 0;
-};
+  enum class Type : uint8_t { Line, Arc };
 
-class LineBorder : public CellBorder {
-public:
-    std::string GnuplotPrintString() const override;
-    std::string SVGPrintString() const override;
-    LineBorder(double, double, double, double);
-    explicit LineBorder(std::tuple<double, double, double, double>);
+  static CellBorder Line(double, double, double, double);
+  static CellBorder Line(std::tuple<double, double, double, double>);
+  static CellBorder Arc(double, double, double, double, double);
 
-    [[nodiscard]] std::tuple<double, double, double, double> getBorderCoords() const
-    {
-        return std::make_tuple(x1_, y1_, x2_, y2_);
-    }
+  Type GetType() const { return type_; }
 
-protected:
-  double x1_, y1_, x2_, y2_;
-};
+  std::string GnuplotPrintString() const;
+  std::string SVGPrintString() const;
 
-class ArcBorder : public CellBorder {
- public:
-  std::string GnuplotPrintString() const override;
-  std::string SVGPrintString() const override;
-  ArcBorder(double, double, double, double, double);
+  // Endpoints of a line border
+  [[nodiscard]] std::tuple<double, double, double, double> getBorderCoords()
+      const {
+    return std::make_tuple(p_[0], p_[1], p_[2], p_[3]);
+  }
 
- protected:
-  double cx_, cy_, r_, theta1_, theta2_;
+ private:
+  Type type_ = Type::Line;
+  // line: x1, y1, x2, y2; arc: cx, cy, r, theta1, theta2
+  double p_[5] = {};
 };
 
 #endif /* end of include guard: CELLBORDER_H */
@@ -8,7 +8,7 @@ public:
     explicit CircularHexagonMaze(int);
 
 protected:
-    std::shared_ptr<CellBorder> GetEdge(int, int, int, int) const override;
+    CellBorder GetEdge(int, int, int, int) const override;
     std::tuple<double, double, double, double> GetCoordinateBounds() const override;
 };
 
@@ -6,9 +6,9 @@
 class CircularMaze : public Maze {
  public:
   CircularMaze(int);
-  virtual void InitialiseGraph();
 
  protected:
+  void AddBorders() override;
   int size_;
   std::vector<int> ringnodecount_, ringnodeprefixsum_;
 
@@ -0,0 +1,49 @@
+#ifndef COMPACTMAZE_H
+#define COMPACTMAZE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class Maze;
+
+// Maze types, same numbering as the -m option of mazegen
+enum MazeType {
+  kRectangularMaze = 0,
+  kHexagonalMaze = 1,
+  kHoneyCombMaze = 2,
+  kCircularMaze = 3,
+  kCircularHexagonMaze = 4,
+  kUserMaze = 5,
+};
+
+// Wall of a generated maze with everything needed to place it precomputed.
+// All coordinates are in maze units (cell radius 1).
+struct MazeWall {
+  float cx, cy;      // center
+  float halfLength;
+  float rotation;    // around the vertical axis, pi/2 for walls along y
+  int cell1, cell2;  // cell2 is -1 for the outer walls
+};
+
+// Generated maze flattened into an edge list: cell centers plus every
+// remaining wall exactly once, no per-wall allocations.
+struct CompactMaze {
+  int size = 0;
+  std::vector<std::pair<double, double>> cellCenters;
+  std::vector<MazeWall> walls;
+  double xmin = 0, ymin = 0, xmax = 0, ymax = 0;
+};
+
+// Flatten a maze after GenerateMaze(). Only mazes with straight borders can be
+// represented, returns false if there are arcs.
+bool MakeCompactMaze(Maze&, int size, CompactMaze*);
+
+// Binary pack of many mazes of one type (see mazegen -n), written atomically
+// and read back through a memory mapping.
+bool WriteMazePack(const std::string& filename, MazeType,
+                   const std::vector<CompactMaze>&);
+bool ReadMazePack(const std::string& filename, MazeType*,
+                  std::vector<CompactMaze>*);
+
+#endif /* end of include guard: COMPACTMAZE_H */
@@ -6,10 +6,12 @@
 
 class DepthFirstSearch : public SpanningtreeAlgorithm {
  public:
-  std::vector<std::pair<int, int>> SpanningTree(int, const Graph &);
+  const std::vector<std::pair<int, int>>& SpanningTree(int, const Graph&) override;
 
  private:
   std::vector<bool> visited;
+  std::vector<int> nodeorder;
+  std::vector<std::pair<int, int>> stack;  // vertex, next edge to try
   void DFS(int, const Graph &);
 };
 
@@ -0,0 +1,58 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <utility>
+#include <vector>
+
+// Half-edge of the cell graph. vertex is -1 for a border with the outside,
+// border indexes the maze's border array.
+struct GraphEdge {
+  int vertex;
+  int border;
+};
+
+// Cell adjacency in CSR form: the edges of vertex u are
+// edges_[offsets_[u]..offsets_[u + 1]), in the order they were added.
+// Buffers are reused when a graph is rebuilt, so regenerating a maze of the
+// same size does not allocate.
+class Graph {
+ public:
+  class Range {
+   public:
+    Range(const GraphEdge* first, const GraphEdge* last)
+        : first_(first), last_(last) {}
+    const GraphEdge* begin() const { return first_; }
+    const GraphEdge* end() const { return last_; }
+    int size() const { return int(last_ - first_); }
+    const GraphEdge& operator[](int i) const { return first_[i]; }
+
+   private:
+    const GraphEdge *first_, *last_;
+  };
+
+  void Clear();
+
+  // Both directions, only one if v is -1 (outside). Call Build() afterwards.
+  void AddEdge(int u, int v, int border);
+  void Build(int vertices);
+
+  // Remove the edges u-v (one half-edge in each direction)
+  void RemoveEdges(const std::vector<std::pair<int, int>>&);
+
+  int Vertices() const { return int(offsets_.size()) - 1; }
+  int Edges() const { return int(edges_.size()); }
+  // Position of the first edge of u, in [0, Edges())
+  int Offset(int u) const { return offsets_[u]; }
+  Range operator[](int u) const {
+    return {edges_.data() + offsets_[u], edges_.data() + offsets_[u + 1]};
+  }
+
+ private:
+  std::vector<int> offsets_{0};
+  std::vector<GraphEdge> edges_;
+  // half-edges accumulated by AddEdge() until Build()
+  std::vector<std::pair<int, GraphEdge>> pending_;
+  std::vector<int> scratch_;
+};
+
+#endif /* end of include guard: GRAPH_H */
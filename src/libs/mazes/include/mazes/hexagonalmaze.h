@@ -6,12 +6,12 @@
 class HexagonalMaze : public Maze {
  public:
   explicit HexagonalMaze(int);
-  void InitialiseGraph() override;
 
  protected:
+  void AddBorders() override;
   int size_;
 
-  virtual std::shared_ptr<CellBorder> GetEdge(int, int, int, int) const;
+  virtual CellBorder GetEdge(int, int, int, int) const;
   int VertexIndex(int, int, int, int) const;
   std::tuple<double, double, double, double> GetCoordinateBounds() const override;
 };
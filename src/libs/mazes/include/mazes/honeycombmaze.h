@@ -6,7 +6,6 @@
 class HoneyCombMaze : public Maze {
  public:
   explicit HoneyCombMaze(int);
-  void InitialiseGraph() override;
 
   std::tuple<double, double, double, double> GetCoordinateBounds() const override;
 
@@ -14,6 +13,8 @@ public:
     bool bordersForEntranceAndExit = true;
 
 protected:
+    void AddBorders() override;
+
     int size_;
     static const int neigh[6][2];
 
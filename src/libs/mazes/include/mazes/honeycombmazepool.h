@@ -0,0 +1,28 @@
+#ifndef HONEYCOMBMAZEPOOL_H
+#define HONEYCOMBMAZEPOOL_H
+
+#include <mazes/compactmaze.h>
+#include <string>
+
+// Process-wide pool of Kruskal honeycomb mazes. Maze #index of a given size
+// is generated on first use from a fixed seed and then shared read-only, so
+// resets don't build a graph and a spanning tree every episode.
+// A pack written by mazegen -n can be loaded instead, then the mazes of the
+// sizes it contains come from the pack.
+class HoneyCombMazePool {
+ public:
+  static constexpr int kMazesPerSize = 64;
+
+  // Returns false if the file can't be read or is not a honeycomb pack
+  static bool LoadPack(const std::string& filename);
+
+  // Number of mazes available for this size
+  static int NumMazes(int size);
+
+  // Thread-safe, index in [0, NumMazes(size))
+  static const CompactMaze& Get(int size, int index);
+
+  static CompactMaze Generate(int size, unsigned seed);
+};
+
+#endif /* end of include guard: HONEYCOMBMAZEPOOL_H */
@@ -6,10 +6,11 @@
 
 class Kruskal : public SpanningtreeAlgorithm {
  public:
-  std::vector<std::pair<int, int>> SpanningTree(int, const Graph&);
+  const std::vector<std::pair<int, int>>& SpanningTree(int, const Graph&) override;
 
  private:
   std::vector<int> parent_;
+  std::vector<std::pair<int, int>> edges_;
 
   int GetParent(int);
 };
@@ -6,10 +6,10 @@
 
 class LoopErasedRandomWalk : public SpanningtreeAlgorithm {
  public:
-  std::vector<std::pair<int, int>> SpanningTree(int, const Graph &);
+  const std::vector<std::pair<int, int>>& SpanningTree(int, const Graph&) override;
 
  private:
-  std::vector<int> visited;
+  std::vector<int> visited, nodes, current;
   void LERW(int, int, const Graph &);
 };
 
@@ -2,32 +2,38 @@
 #define MAZE_H
 
 #include "cellborder.h"
+#include "graph.h"
 #include "spanningtreealgorithm.h"
 #include <memory>
 #include <vector>
 
 
-using AdjList = std::vector<std::vector<std::pair<int, std::shared_ptr<CellBorder>>>>;
-
 class Maze {
  public:
   explicit Maze(int = 0, int = 0, int = 1);
   virtual ~Maze() = default;
+  void InitialiseGraph();
   void GenerateMaze(SpanningtreeAlgorithm*);
   void PrintMazeGnuplot(const std::string&) const;
   void PrintMazeSVG(const std::string&) const;
   void RemoveBorders(const std::vector<std::pair<int, int>>&);
-  virtual void InitialiseGraph() = 0;
 
-  AdjList & getAdjacencyList() { return adjacencylist_; }
+  // Cell graph, after GenerateMaze() only the edges with walls remain
+  const Graph& getGraph() const { return graph_; }
+  const std::vector<CellBorder>& getBorders() const { return borders_; }
   std::vector<std::pair<double, double>> & getCellCenters() { return cellCenters; }
 
   virtual std::tuple<double, double, double, double> GetCoordinateBounds() const = 0;
 
 protected:
+    // Called by InitialiseGraph() to add all cell borders with AddBorder()
+    virtual void AddBorders() = 0;
+    void AddBorder(int u, int v, const CellBorder& border);
+
     // Solving a maze is equivalent to finding a path in a graph
     int vertices_;
-    AdjList adjacencylist_;
+    Graph graph_;
+    std::vector<CellBorder> borders_;
     int startvertex_, endvertex_;
     std::vector<std::pair<double, double>> cellCenters;
 };
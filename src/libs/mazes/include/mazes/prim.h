@@ -6,10 +6,13 @@
 
 class Prim : public SpanningtreeAlgorithm {
  public:
-  std::vector<std::pair<int, int>> SpanningTree(int, const Graph &);
+  const std::vector<std::pair<int, int>>& SpanningTree(int, const Graph&) override;
 
  private:
   void PrimAlgorithm(int, const Graph &);
+
+  std::vector<bool> visited;
+  std::vector<std::pair<int, int>> boundary;
 };
 
 #endif /* end of include guard: PRIM_H */
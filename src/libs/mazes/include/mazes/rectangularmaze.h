@@ -3,9 +3,9 @@
 class RectangularMaze : public Maze {
 public:
     RectangularMaze(int, int);
-    void InitialiseGraph() override;
-
 private:
+    void AddBorders() override;
+
     int width_, height_;
 
     int VertexIndex(int, int);
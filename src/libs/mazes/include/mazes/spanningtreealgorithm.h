@@ -1,18 +1,20 @@
 #ifndef SPANNINGTREEALGORITHM_H
 #define SPANNINGTREEALGORITHM_H
 
-#include "cellborder.h"
+#include "graph.h"
 #include <memory>
 #include <random>
 #include <vector>
 
-typedef std::vector<std::vector<std::pair<int, std::shared_ptr<CellBorder>>>>
-    Graph;
-
 class SpanningtreeAlgorithm {
  public:
   SpanningtreeAlgorithm();
-  virtual std::vector<std::pair<int, int>> SpanningTree(int, const Graph&) = 0;
+  virtual ~SpanningtreeAlgorithm() = default;
+  // The returned tree and the internal buffers are reused by the next call
+  virtual const std::vector<std::pair<int, int>>& SpanningTree(
+      int, const Graph&) = 0;
+  // Replace the random_device seed, for reproducible mazes
+  void Seed(unsigned);
 
  protected:
   std::vector<std::pair<int, int>> spanningtree;
@@ -3,9 +3,10 @@
 class UserMaze : public Maze {
  public:
   UserMaze(std::string);
-  virtual void InitialiseGraph();
 
  private:
+  void AddBorders() override;
+
   double xmin_, ymin_, xmax_, ymax_;
   std::string filename_;
 
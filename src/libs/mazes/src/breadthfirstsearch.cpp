@@ -2,9 +2,10 @@
 #include <algorithm>
 #include <iostream>
 
-std::vector<std::pair<int, int>> BreadthFirstSearch::SpanningTree(
+const std::vector<std::pair<int, int>>& BreadthFirstSearch::SpanningTree(
     int vertices, const Graph& adjacencylist) {
-  visited = std::vector<bool>(vertices, false);
+  visited.assign(vertices, false);
+  currentlevel.clear(), nextlevel.clear();
 
   int startvertex =
       std::uniform_int_distribution<int>(0, vertices - 1)(generator);
@@ -15,7 +16,7 @@ std::vector<std::pair<int, int>> BreadthFirstSearch::SpanningTree(
   while (!currentlevel.empty()) {
     for (auto vertex : currentlevel) {
       for (const auto& edge : adjacencylist[vertex]) {
-        int nextvertex = edge.first;
+        int nextvertex = edge.vertex;
         if (nextvertex < 0 or visited[nextvertex]) continue;
         visited[nextvertex] = true;
         spanningtree.push_back({vertex, nextvertex});
@@ -4,13 +4,12 @@
 
 CircularHexagonMaze::CircularHexagonMaze(int size) : HexagonalMaze(size) {}
 
-std::shared_ptr<CellBorder> CircularHexagonMaze::GetEdge(int sector, int row,
-                                                         int column,
-                                                         int edge) const {
+CellBorder CircularHexagonMaze::GetEdge(int sector, int row, int column,
+                                        int edge) const {
   if (edge == 0) {
     // Edge 0 is the bottom edge, hence connecting
     // (row+1,column)-(row+1,column+1) with an arc
-    return std::make_shared<ArcBorder>(
+    return CellBorder::Arc(
         0, 0, row + 1, (sector - 2) * M_PI / 3 + column * M_PI / 3 / (row + 1),
         (sector - 2) * M_PI / 3 + (column + 1) * M_PI / 3 / (row + 1));
   }
@@ -37,7 +36,7 @@ std::shared_ptr<CellBorder> CircularHexagonMaze::GetEdge(int sector, int row,
     ex2 = (row + 1) * cos(theta2);
     ey2 = (row + 1) * sin(theta2);
   }
-  return std::make_shared<LineBorder>(ex1, ey1, ex2, ey2);
+  return CellBorder::Line(ex1, ey1, ex2, ey2);
 }
 
 std::tuple<double, double, double, double>
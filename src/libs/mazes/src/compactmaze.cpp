@@ -0,0 +1,156 @@
+#include <mazes/compactmaze.h>
+#include <mazes/maze.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <util/filesystem_utils.hpp>
+
+namespace {
+
+constexpr char kPackMagic[8] = {'M', 'V', 'M', 'A', 'Z', 'E', 'P', '1'};
+
+// File layout: header, one record per maze, then the cell centers and walls
+// of every maze at the offsets given by its record.
+struct PackHeader {
+  char magic[8];
+  uint32_t mazeType, numMazes;
+};
+
+struct PackRecord {
+  int32_t size;
+  uint32_t numCells, numWalls, reserved;
+  double xmin, ymin, xmax, ymax;
+  uint64_t cellsOffset, wallsOffset;
+};
+
+// cell center as stored in the file, std::pair is not trivially copyable
+struct PackCell {
+  double x, y;
+};
+
+// [offset, offset + count * elemSize) lies within a file of this size,
+// without overflowing on corrupt offsets or counts
+bool rangeInFile(uint64_t offset, uint64_t count, uint64_t elemSize,
+                 uint64_t fileSize) {
+  return offset <= fileSize && count <= (fileSize - offset) / elemSize;
+}
+
+}  // namespace
+
+bool MakeCompactMaze(Maze& maze, int size, CompactMaze* compact) {
+  compact->size = size;
+  compact->cellCenters = maze.getCellCenters();
+  std::tie(compact->xmin, compact->ymin, compact->xmax, compact->ymax) =
+      maze.GetCoordinateBounds();
+  compact->walls.clear();
+
+  const auto& graph = maze.getGraph();
+  for (int cell = 0; cell < graph.Vertices(); ++cell) {
+    for (const auto& edge : graph[cell]) {
+      // interior walls are listed by both cells
+      const int adjCell = edge.vertex;
+      if (adjCell != -1 && adjCell < cell) continue;
+
+      const auto& border = maze.getBorders()[edge.border];
+      if (border.GetType() != CellBorder::Type::Line) return false;
+      const auto [x1, y1, x2, y2] = border.getBorderCoords();
+
+      MazeWall wall;
+      wall.cx = float(x1 + x2) / 2, wall.cy = float(y1 + y2) / 2;
+      wall.halfLength = 0.5f * float(std::hypot(x1 - x2, y1 - y2));
+      wall.rotation = std::fabs(x1 - x2) > 1e-5
+                          ? -std::atan(float((y1 - y2) / (x1 - x2)))
+                          : float(M_PI_2);
+      wall.cell1 = cell, wall.cell2 = adjCell;
+      compact->walls.push_back(wall);
+    }
+  }
+
+  return true;
+}
+
+bool WriteMazePack(const std::string& filename, MazeType type,
+                   const std::vector<CompactMaze>& mazes) {
+  PackHeader header;
+  memcpy(header.magic, kPackMagic, sizeof(kPackMagic));
+  header.mazeType = uint32_t(type), header.numMazes = uint32_t(mazes.size());
+
+  std::vector<PackRecord> records(mazes.size());
+  uint64_t offset = sizeof(header) + records.size() * sizeof(PackRecord);
+  for (size_t i = 0; i < mazes.size(); ++i) {
+    const auto& m = mazes[i];
+    auto& r = records[i];
+    r.size = m.size, r.reserved = 0;
+    r.numCells = uint32_t(m.cellCenters.size());
+    r.numWalls = uint32_t(m.walls.size());
+    r.xmin = m.xmin, r.ymin = m.ymin, r.xmax = m.xmax, r.ymax = m.ymax;
+    r.cellsOffset = offset;
+    offset += r.numCells * sizeof(PackCell);
+    r.wallsOffset = offset;
+    offset += r.numWalls * sizeof(MazeWall);
+  }
+
+  std::vector<char> bytes(offset);
+  memcpy(bytes.data(), &header, sizeof(header));
+  memcpy(bytes.data() + sizeof(header), records.data(),
+         records.size() * sizeof(PackRecord));
+  for (size_t i = 0; i < mazes.size(); ++i) {
+    const auto& m = mazes[i];
+    for (size_t c = 0; c < m.cellCenters.size(); ++c) {
+      const PackCell cell{m.cellCenters[c].first, m.cellCenters[c].second};
+      memcpy(bytes.data() + records[i].cellsOffset + c * sizeof(PackCell),
+             &cell, sizeof(cell));
+    }
+    memcpy(bytes.data() + records[i].wallsOffset, m.walls.data(),
+           m.walls.size() * sizeof(MazeWall));
+  }
+
+  return Megaverse::writeFileAtomic(filename, bytes.data(), bytes.size());
+}
+
+bool ReadMazePack(const std::string& filename, MazeType* type,
+                  std::vector<CompactMaze>* mazes) {
+  Megaverse::MappedFile file(filename);
+  if (!file.isOpen() || file.size() < sizeof(PackHeader)) return false;
+
+  PackHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, kPackMagic, sizeof(kPackMagic)) != 0) return false;
+
+  const auto recordsEnd =
+      sizeof(header) + uint64_t(header.numMazes) * sizeof(PackRecord);
+  if (recordsEnd > file.size()) return false;
+
+  const auto* records =
+      reinterpret_cast<const PackRecord*>(file.data() + sizeof(header));
+
+  mazes->resize(header.numMazes);
+  for (uint32_t i = 0; i < header.numMazes; ++i) {
+    const auto& r = records[i];
+    auto& m = (*mazes)[i];
+
+    if (!rangeInFile(r.cellsOffset, r.numCells, sizeof(PackCell),
+                     file.size()) ||
+        !rangeInFile(r.wallsOffset, r.numWalls, sizeof(MazeWall),
+                     file.size()))
+      return false;
+
+    m.size = r.size;
+    m.xmin = r.xmin, m.ymin = r.ymin, m.xmax = r.xmax, m.ymax = r.ymax;
+    m.cellCenters.resize(r.numCells);
+    for (uint32_t c = 0; c < r.numCells; ++c) {
+      PackCell cell;
+      memcpy(&cell, file.data() + r.cellsOffset + c * sizeof(PackCell),
+             sizeof(cell));
+      m.cellCenters[c] = {cell.x, cell.y};
+    }
+    m.walls.resize(r.numWalls);
+    if (r.numWalls)
+      memcpy(m.walls.data(), file.data() + r.wallsOffset,
+             r.numWalls * sizeof(MazeWall));
+  }
+
+  *type = MazeType(header.mazeType);
+  return true;
+}
@@ -1,25 +1,45 @@
 #include <mazes/depthfirstsearch.h>
 #include <algorithm>
+#include <numeric>
 
-std::vector<std::pair<int, int>> DepthFirstSearch::SpanningTree(
+const std::vector<std::pair<int, int>>& DepthFirstSearch::SpanningTree(
     int vertices, const Graph& adjacencylist) {
   spanningtree.clear();
-  visited = std::vector<bool>(vertices, 0);
+  visited.assign(vertices, 0);
   DFS(std::uniform_int_distribution<int>(0, vertices - 1)(generator),
       adjacencylist);
   return spanningtree;
 }
 
 void DepthFirstSearch::DFS(int vertex, const Graph& adjacencylist) {
-  visited[vertex] = 1;
-  std::vector<int> nodeorder(adjacencylist[vertex].size());
-  std::iota(nodeorder.begin(), nodeorder.end(), 0);
-  shuffle(nodeorder.begin(), nodeorder.end(), generator);
+  // Explicit stack instead of recursion, with the same visiting order. The
+  // shuffled edge order of a vertex is kept at its offset in the graph, every
+  // vertex is entered only once.
+  nodeorder.resize(adjacencylist.Edges());
+  const auto enter = [&](int v) {
+    visited[v] = 1;
+    const auto first = nodeorder.begin() + adjacencylist.Offset(v),
+               last = first + adjacencylist[v].size();
+    std::iota(first, last, 0);
+    shuffle(first, last, generator);
+    stack.push_back({v, 0});
+  };
 
-  for (auto index : nodeorder) {
-    int nextvertex = adjacencylist[vertex][index].first;
+  stack.clear();
+  enter(vertex);
+
+  while (!stack.empty()) {
+    const int u = stack.back().first;
+    const int pos = stack.back().second++;
+    if (pos == adjacencylist[u].size()) {
+      stack.pop_back();
+      continue;
+    }
+
+    int nextvertex =
+        adjacencylist[u][nodeorder[adjacencylist.Offset(u) + pos]].vertex;
     if (nextvertex < 0 or visited[nextvertex]) continue;
-    spanningtree.push_back({vertex, nextvertex});
-    DFS(nextvertex, adjacencylist);
+    spanningtree.push_back({u, nextvertex});
+    enter(nextvertex);
   }
 }
@@ -0,0 +1,55 @@
+#include <mazes/graph.h>
+#include <algorithm>
+
+void Graph::Clear() {
+  offsets_.assign(1, 0);
+  edges_.clear();
+  pending_.clear();
+}
+
+void Graph::AddEdge(int u, int v, int border) {
+  pending_.push_back({u, {v, border}});
+  if (v != -1) pending_.push_back({v, {u, border}});
+}
+
+void Graph::Build(int vertices) {
+  // counting sort by the source vertex, stable so every vertex keeps its edges
+  // in the order they were added
+  offsets_.assign(vertices + 1, 0);
+  for (const auto& halfedge : pending_) ++offsets_[halfedge.first + 1];
+  for (int u = 0; u < vertices; ++u) offsets_[u + 1] += offsets_[u];
+
+  edges_.resize(pending_.size());
+  std::vector<int>& next = scratch_;
+  next.assign(offsets_.begin(), offsets_.end() - 1);
+  for (const auto& halfedge : pending_)
+    edges_[next[halfedge.first]++] = halfedge.second;
+
+  pending_.clear();
+}
+
+void Graph::RemoveEdges(const std::vector<std::pair<int, int>>& removed) {
+  const auto removeHalfEdge = [this](int u, int v) {
+    auto first = edges_.begin() + offsets_[u],
+         last = edges_.begin() + offsets_[u + 1];
+    auto it = std::find_if(first, last,
+                           [v](const GraphEdge& e) { return e.vertex == v; });
+    if (it != last) it->border = -1;
+  };
+
+  for (const auto& edge : removed) {
+    removeHalfEdge(edge.first, edge.second);
+    removeHalfEdge(edge.second, edge.first);
+  }
+
+  // compact in place, the relative order of the remaining edges is kept
+  int out = 0;
+  for (int u = 0, in = 0; u < Vertices(); ++u) {
+    const int last = offsets_[u + 1];
+    offsets_[u] = out;
+    for (; in < last; ++in)
+      if (edges_[in].border != -1) edges_[out++] = edges_[in];
+  }
+  offsets_.back() = out;
+  edges_.resize(out);
+}
@@ -7,9 +7,7 @@ HexagonalMaze::HexagonalMaze(int size) : Maze(6 * size * size), size_(size) {
   endvertex_ = VertexIndex(3, 1, size_ - 1, 0);
 }
 
-void HexagonalMaze::InitialiseGraph() {
-  Maze::InitialiseGraph();
-
+void HexagonalMaze::AddBorders() {
   // Hexagon can be split into 6 triangular sectors
   // Each of which is subdivided into size_*size triangles
 
@@ -17,31 +15,24 @@ void HexagonalMaze::InitialiseGraph() {
     // Outer boundary, except entry and exit
     for (int i = 0; i < size_; ++i) {
       if ((i > 0) or (sector % 3 != 0)) {
-        std::shared_ptr<CellBorder> ptr =
-            this->GetEdge(sector, size_ - 1, i, 0);
-        adjacencylist_[VertexIndex(sector, 0, size_ - 1, i)].push_back(
-            {-1, ptr});
+        AddBorder(VertexIndex(sector, 0, size_ - 1, i), -1,
+                  this->GetEdge(sector, size_ - 1, i, 0));
       }
     }
 
     // Border between the 6 major triangles
     for (int i = 0; i < size_; ++i) {
-      std::shared_ptr<CellBorder> ptr = this->GetEdge(sector, i, i, 1);
-      adjacencylist_[VertexIndex(sector, 0, i, i)].push_back(
-          {VertexIndex((sector + 1) % 6, 0, i, 0), ptr});
-      adjacencylist_[VertexIndex((sector + 1) % 6, 0, i, 0)].push_back(
-          {VertexIndex(sector, 0, i, i), ptr});
+      AddBorder(VertexIndex(sector, 0, i, i),
+                VertexIndex((sector + 1) % 6, 0, i, 0),
+                this->GetEdge(sector, i, i, 1));
     }
 
     // 0-type edge
     // Between up vertex (i,j) and down vertex (i,j)
     for (int i = 0; i < size_ - 1; ++i) {
       for (int j = 0; j <= i; ++j) {
-        std::shared_ptr<CellBorder> ptr = this->GetEdge(sector, i, j, 0);
-        adjacencylist_[VertexIndex(sector, 0, i, j)].push_back(
-            {VertexIndex(sector, 1, i, j), ptr});
-        adjacencylist_[VertexIndex(sector, 1, i, j)].push_back(
-            {VertexIndex(sector, 0, i, j), ptr});
+        AddBorder(VertexIndex(sector, 0, i, j), VertexIndex(sector, 1, i, j),
+                  this->GetEdge(sector, i, j, 0));
       }
     }
 
@@ -49,11 +40,9 @@ void HexagonalMaze::InitialiseGraph() {
     // Between up vertex (i,j) and down vertex (i-1,j)
     for (int i = 0; i < size_; ++i) {
       for (int j = 0; j < i; ++j) {
-        std::shared_ptr<CellBorder> ptr = this->GetEdge(sector, i, j, 1);
-        adjacencylist_[VertexIndex(sector, 0, i, j)].push_back(
-            {VertexIndex(sector, 1, i - 1, j), ptr});
-        adjacencylist_[VertexIndex(sector, 1, i - 1, j)].push_back(
-            {VertexIndex(sector, 0, i, j), ptr});
+        AddBorder(VertexIndex(sector, 0, i, j),
+                  VertexIndex(sector, 1, i - 1, j),
+                  this->GetEdge(sector, i, j, 1));
       }
     }
 
@@ -61,18 +50,16 @@ void HexagonalMaze::InitialiseGraph() {
     // Between up vertex (i,j) and down vertex (i-1,j-1)
     for (int i = 0; i < size_; ++i) {
       for (int j = 1; j <= i; ++j) {
-        std::shared_ptr<CellBorder> ptr = this->GetEdge(sector, i, j, 2);
-        adjacencylist_[VertexIndex(sector, 0, i, j)].push_back(
-            {VertexIndex(sector, 1, i - 1, j - 1), ptr});
-        adjacencylist_[VertexIndex(sector, 1, i - 1, j - 1)].push_back(
-            {VertexIndex(sector, 0, i, j), ptr});
+        AddBorder(VertexIndex(sector, 0, i, j),
+                  VertexIndex(sector, 1, i - 1, j - 1),
+                  this->GetEdge(sector, i, j, 2));
       }
     }
   }
 }
 
-std::shared_ptr<CellBorder> HexagonalMaze::GetEdge(int sector, int row,
-                                                   int column, int edge) const {
+CellBorder HexagonalMaze::GetEdge(int sector, int row, int column,
+                                  int edge) const {
   // Coordinates of vertices of 0th sector
   double x1 = 0, y1 = 0, x2 = -size_ / 2.0, y2 = sqrt(3) * x2, x3 = -x2,
          y3 = y2;
@@ -104,7 +91,7 @@ std::shared_ptr<CellBorder> HexagonalMaze::GetEdge(int sector, int row,
   // Finally rotate to actual sector
   double theta = sector * M_PI / 3, sintheta = sin(theta),
          costheta = cos(theta);
-  return std::make_shared<LineBorder>(
+  return CellBorder::Line(
       ex1 * costheta - ey1 * sintheta, ex1 * sintheta + ey1 * costheta,
       ex2 * costheta - ey2 * sintheta, ex2 * sintheta + ey2 * costheta);
 }
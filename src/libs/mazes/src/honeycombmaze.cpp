@@ -7,9 +7,7 @@ const int HoneyCombMaze::neigh[6][2] = {{-1, 0}, {-1, 1}, {0, 1},
 HoneyCombMaze::HoneyCombMaze(int size)
     : Maze(3 * size * (size - 1) + 1, 0, 3 * size * (size - 1)), size_(size) {}
 
-void HoneyCombMaze::InitialiseGraph() {
-  Maze::InitialiseGraph();
-
+void HoneyCombMaze::AddBorders() {
   for (int u = -size_ + 1; u < size_; ++u) {
     auto vextent = VExtent(u);
     for (int v = vextent.first; v <= vextent.second; ++v) {
@@ -22,17 +20,13 @@ void HoneyCombMaze::InitialiseGraph() {
         if (IsValidNode(uu, vv)) {
           int nnode = VertexIndex(uu, vv);
           if (nnode > node) continue;
-          std::shared_ptr<LineBorder> ptr =
-              std::make_shared<LineBorder>(GetEdge(u, v, n));
-          adjacencylist_[node].push_back({nnode, ptr});
-          adjacencylist_[nnode].push_back({node, ptr});
+          AddBorder(node, nnode, CellBorder::Line(GetEdge(u, v, n)));
         } else {
             if (!bordersForEntranceAndExit)
               if ((node == startvertex_ and n == 0) or
                   (node == endvertex_ and n == 3))
                 continue;
-          adjacencylist_[node].push_back(
-              {-1, std::make_shared<LineBorder>(GetEdge(u, v, n))});
+          AddBorder(node, -1, CellBorder::Line(GetEdge(u, v, n)));
         }
       }
     }
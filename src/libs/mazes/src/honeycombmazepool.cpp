@@ -0,0 +1,61 @@
+#include <mazes/honeycombmazepool.h>
+#include <mazes/honeycombmaze.h>
+#include <mazes/kruskal.h>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+std::mutex poolMutex;
+std::map<std::pair<int, int>, std::unique_ptr<CompactMaze>> generatedMazes;
+std::map<int, std::vector<CompactMaze>> packedMazes;
+
+}  // namespace
+
+bool HoneyCombMazePool::LoadPack(const std::string& filename) {
+  MazeType type;
+  std::vector<CompactMaze> mazes;
+  if (!ReadMazePack(filename, &type, &mazes) || type != kHoneyCombMaze)
+    return false;
+
+  std::lock_guard<std::mutex> lock(poolMutex);
+  for (auto& maze : mazes)
+    packedMazes[maze.size].push_back(std::move(maze));
+
+  return true;
+}
+
+int HoneyCombMazePool::NumMazes(int size) {
+  std::lock_guard<std::mutex> lock(poolMutex);
+
+  auto it = packedMazes.find(size);
+  return it == packedMazes.end() ? kMazesPerSize : int(it->second.size());
+}
+
+const CompactMaze& HoneyCombMazePool::Get(int size, int index) {
+  std::lock_guard<std::mutex> lock(poolMutex);
+
+  auto packed = packedMazes.find(size);
+  if (packed != packedMazes.end()) return packed->second[index];
+
+  auto& maze = generatedMazes[{size, index}];
+  if (!maze)
+    maze = std::make_unique<CompactMaze>(
+        Generate(size, unsigned(size * kMazesPerSize + index)));
+
+  return *maze;
+}
+
+CompactMaze HoneyCombMazePool::Generate(int size, unsigned seed) {
+  HoneyCombMaze maze(size);
+  Kruskal algorithm;
+  algorithm.Seed(seed);
+
+  maze.InitialiseGraph();
+  maze.GenerateMaze(&algorithm);
+
+  CompactMaze compact;
+  MakeCompactMaze(maze, size, &compact);
+  return compact;
+}
@@ -3,21 +3,21 @@
 #include <numeric>
 #include <random>
 
-std::vector<std::pair<int, int>> Kruskal::SpanningTree(
+const std::vector<std::pair<int, int>>& Kruskal::SpanningTree(
     int vertices, const Graph& adjacencylist) {
-  std::vector<std::pair<int, int>> edges;
+  edges_.clear();
   for (int i = 0; i < vertices; ++i) {
     for (const auto& edge : adjacencylist[i]) {
-      if (edge.first > i) edges.push_back({i, edge.first});
+      if (edge.vertex > i) edges_.push_back({i, edge.vertex});
     }
   }
-  shuffle(edges.begin(), edges.end(), generator);
+  shuffle(edges_.begin(), edges_.end(), generator);
 
-  parent_ = std::vector<int>(vertices);
+  parent_.resize(vertices);
   std::iota(parent_.begin(), parent_.end(), 0);
 
   spanningtree.clear();
-  for (const auto& edge : edges) {
+  for (const auto& edge : edges_) {
     int u = GetParent(edge.first), v = GetParent(edge.second);
     if (u == v) continue;
     parent_[u] = v;
@@ -1,12 +1,12 @@
 #include <mazes/looperasedrandomwalk.h>
 #include <algorithm>
 
-std::vector<std::pair<int, int>> LoopErasedRandomWalk::SpanningTree(
+const std::vector<std::pair<int, int>>& LoopErasedRandomWalk::SpanningTree(
     int vertices, const Graph& adjacencylist) {
   spanningtree.clear();
-  visited = std::vector<int>(vertices, 0);
+  visited.assign(vertices, 0);
 
-  std::vector<int> nodes(vertices);
+  nodes.resize(vertices);
   std::iota(nodes.begin(), nodes.end(), 0);
   shuffle(nodes.begin(), nodes.end(), generator);
   visited[nodes[0]] = 1;
@@ -21,7 +21,7 @@ std::vector<std::pair<int, int>> LoopErasedRandomWalk::SpanningTree(
 
 void LoopErasedRandomWalk::LERW(int vertex, int round,
                                 const Graph& adjacencylist) {
-  std::vector<int> current;
+  current.clear();
 
   while (!visited[vertex]) {
     visited[vertex] = round;
@@ -32,7 +32,7 @@ void LoopErasedRandomWalk::LERW(int vertex, int round,
           adjacencylist[vertex]
                        [std::uniform_int_distribution<int>(
                             0, adjacencylist[vertex].size() - 1)(generator)]
-                           .first;
+                           .vertex;
     } while (nextvertex < 0);
 
     if (visited[nextvertex] == round) {
@@ -7,32 +7,29 @@ Maze::Maze(int vertices, int startvertex, int endvertex)
     : vertices_(vertices), startvertex_(startvertex), endvertex_(endvertex) {}
 
 void Maze::InitialiseGraph() {
-  adjacencylist_.clear();
-  adjacencylist_.resize(vertices_);
+  graph_.Clear();
+  borders_.clear();
+  cellCenters.assign(vertices_, {0, 0});
+
+  AddBorders();
+
+  // vertex count can be known only after the borders (user mazes)
   cellCenters.resize(vertices_);
+  graph_.Build(vertices_);
+}
+
+void Maze::AddBorder(int u, int v, const CellBorder& border) {
+  graph_.AddEdge(u, v, int(borders_.size()));
+  borders_.push_back(border);
 }
 
 void Maze::GenerateMaze(SpanningtreeAlgorithm* algorithm) {
-  auto spanningtree = algorithm->SpanningTree(vertices_, adjacencylist_);
+  const auto& spanningtree = algorithm->SpanningTree(vertices_, graph_);
   RemoveBorders(spanningtree);
 }
 
 void Maze::RemoveBorders(const std::vector<std::pair<int, int>>& edges) {
-  for (const auto& edge : edges) {
-    int u = edge.first, v = edge.second;
-    for (int i = 0; i < (int)adjacencylist_[u].size(); ++i) {
-      if (adjacencylist_[u][i].first == v) {
-        adjacencylist_[u].erase(adjacencylist_[u].begin() + i);
-        break;
-      }
-    }
-    for (int i = 0; i < (int)adjacencylist_[v].size(); ++i) {
-      if (adjacencylist_[v][i].first == u) {
-        adjacencylist_[v].erase(adjacencylist_[v].begin() + i);
-        break;
-      }
-    }
-  }
+  graph_.RemoveEdges(edges);
 }
 
 void Maze::PrintMazeGnuplot(const std::string& outputprefix) const {
@@ -64,9 +61,9 @@ void Maze::PrintMazeGnuplot(const std::string& outputprefix) const {
   gnuplotfile << "set output '" << outputprefix << ".png'\n";
   gnuplotfile << "set multiplot\n";
   for (int i = 0; i < vertices_; ++i) {
-    for (const auto& edge : adjacencylist_[i]) {
-      if (edge.first < i)
-        gnuplotfile << edge.second->GnuplotPrintString() << "\n";
+    for (const auto& edge : graph_[i]) {
+      if (edge.vertex < i)
+        gnuplotfile << borders_[edge.border].GnuplotPrintString() << "\n";
     }
   }
   gnuplotfile << "plot 1/0 notitle\n";
@@ -95,9 +92,9 @@ void Maze::PrintMazeSVG(const std::string& outputprefix) const {
           << "\" fill=\"white\"/>" << std::endl;
 
   for (int i = 0; i < vertices_; ++i) {
-    for (const auto& edge : adjacencylist_[i]) {
-      if (edge.first < i) {
-        svgfile << edge.second->SVGPrintString() << "\n";
+    for (const auto& edge : graph_[i]) {
+      if (edge.vertex < i) {
+        svgfile << borders_[edge.border].SVGPrintString() << "\n";
       }
     }
   }
@@ -1,7 +1,7 @@
 #include <mazes/prim.h>
 #include <algorithm>
 
-std::vector<std::pair<int, int>> Prim::SpanningTree(
+const std::vector<std::pair<int, int>>& Prim::SpanningTree(
     int vertices, const Graph& adjacencylist) {
   spanningtree.clear();
 
@@ -10,15 +10,15 @@ std::vector<std::pair<int, int>> Prim::SpanningTree(
 }
 
 void Prim::PrimAlgorithm(int vertices, const Graph& adjacencylist) {
-  std::vector<bool> visited(vertices, false);
-  std::vector<std::pair<int, int>> boundary;
+  visited.assign(vertices, false);
+  boundary.clear();
   int vertex = std::uniform_int_distribution<int>(0, vertices - 1)(generator);
 
   for (int i = 1; i < vertices; ++i) {
     visited[vertex] = true;
     for (auto p : adjacencylist[vertex]) {
-      if (p.first != -1 and !visited[p.first])
-        boundary.push_back({vertex, p.first});
+      if (p.vertex != -1 and !visited[p.vertex])
+        boundary.push_back({vertex, p.vertex});
     }
 
     std::pair<int, int> nextedge = {-1, -1};
@@ -3,3 +3,5 @@
 SpanningtreeAlgorithm::SpanningtreeAlgorithm() {
   generator = std::mt19937(randomdevice());
 }
+
+void SpanningtreeAlgorithm::Seed(unsigned seed) { generator.seed(seed); }
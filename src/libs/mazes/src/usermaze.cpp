@@ -3,17 +3,12 @@
 
 UserMaze::UserMaze(std::string filename) : filename_(filename) {}
 
-void UserMaze::InitialiseGraph() {
-  Maze::InitialiseGraph();
-
+void UserMaze::AddBorders() {
   std::ifstream in(filename_);
   in >> vertices_;
   startvertex_ = 0;
   endvertex_ = vertices_ - 1;
 
-  adjacencylist_.clear();
-  adjacencylist_.resize(vertices_);
-
   xmin_ = std::numeric_limits<double>::max(), ymin_ = xmin_;
   xmax_ = std::numeric_limits<double>::min(), ymax_ = xmax_;
   int i, j;
@@ -27,8 +22,7 @@ void UserMaze::InitialiseGraph() {
       ymax_ = std::max(ymax_, y2);
       xmin_ = std::min(xmin_, x1);
       ymin_ = std::min(ymin_, y1);
-      adjacencylist_[i].push_back(
-          {j, std::make_shared<LineBorder>(x1, y1, x2, y2)});
+      AddBorder(i, j, CellBorder::Line(x1, y1, x2, y2));
     } else if (bordertype == "Arc") {
       double cx, cy, r, theta1, theta2;
       in >> cx >> cy >> r >> theta1 >> theta2;
@@ -36,12 +30,9 @@ void UserMaze::InitialiseGraph() {
       ymax_ = std::max(ymax_, cy + r);
       xmin_ = std::min(xmin_, cx - r);
       ymin_ = std::min(ymin_, cy - r);
-      adjacencylist_[i].push_back(
-          {j, std::make_shared<ArcBorder>(cx, cy, r, theta1, theta2)});
+      AddBorder(i, j, CellBorder::Arc(cx, cy, r, theta1, theta2));
     } else
       continue;
-    if (j != -1)
-      adjacencylist_[j].push_back({i, adjacencylist_[i].back().second});
   }
 }
 
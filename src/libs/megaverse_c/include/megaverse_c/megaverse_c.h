@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * C ABI over BatchedEnv, for samplers written in other languages (Rust, JAX FFI, ctypes) that want to call Megaverse
+ * without marshalling. Buffers returned by the megaverse_get_* functions belong to the env: they are updated in place
+ * by every step and reset, and stay valid until megaverse_destroy() (observations and per-agent buffers only cover
+ * the active envs, see megaverse_set_num_active_envs()). Agents are indexed env-major like in BatchedEnv.
+ * Functions that can fail return 0 (or the requested value) on success and a negative value or NULL otherwise,
+ * details are in the log. This includes a NULL env and C++ exceptions, which never propagate out of the API.
+ * A handle must not be used from several threads at the same time, and should stay on the thread that created it.
+ */
+
+#if defined(_WIN32)
+    #ifdef MEGAVERSE_C_BUILD
+        #define MEGAVERSE_C_API __declspec(dllexport)
+    #else
+        #define MEGAVERSE_C_API __declspec(dllimport)
+    #endif
+#else
+    #define MEGAVERSE_C_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct MegaverseEnv MegaverseEnv;
+
+/// Same order as Megaverse::ObservationFormat.
+typedef enum MegaverseObservationFormat
+{
+    MEGAVERSE_OBS_RGBA8 = 0,
+    MEGAVERSE_OBS_RGB8 = 1,
+    MEGAVERSE_OBS_GRAY8 = 2,
+    MEGAVERSE_OBS_BGRA8 = 3,
+    MEGAVERSE_OBS_BGR8 = 4,
+} MegaverseObservationFormat;
+
+/// Same order as Megaverse::LogLevel: 0 only logs fatal errors, 1 errors, 2 warnings, 3 info, up to 5 for debug.
+MEGAVERSE_C_API void megaverse_set_log_level(int level);
+
+/**
+ * @param paramNames, paramValues scenario float parameters, numParams entries each (both may be NULL if 0).
+ * @return NULL if the arguments are invalid or the scenario is not registered.
+ */
+MEGAVERSE_C_API MegaverseEnv * megaverse_create(
+    const char *scenario, int w, int h, int numEnvs, int numAgentsPerEnv, int numSimulationThreads, int useVulkan,
+    const char *const *paramNames, const float *paramValues, int numParams
+);
+
+/// Closes the env, NULL is ignored.
+MEGAVERSE_C_API void megaverse_destroy(MegaverseEnv *env);
+
+MEGAVERSE_C_API void megaverse_seed(MegaverseEnv *env, int seed);
+
+/** Call these before the first reset. */
+MEGAVERSE_C_API int megaverse_set_observation_format(MegaverseEnv *env, MegaverseObservationFormat format, int downsample);
+MEGAVERSE_C_API void megaverse_set_cpu_rendering(MegaverseEnv *env, int enabled);
+MEGAVERSE_C_API void megaverse_set_frame_skip(MegaverseEnv *env, int numFrames);
+
+/// The first reset creates the renderer, buffers are valid after it.
+MEGAVERSE_C_API int megaverse_reset(MegaverseEnv *env);
+
+MEGAVERSE_C_API int megaverse_num_envs(const MegaverseEnv *env);
+MEGAVERSE_C_API int megaverse_num_agents_per_env(const MegaverseEnv *env);
+
+MEGAVERSE_C_API int megaverse_set_num_active_envs(MegaverseEnv *env, int numEnvs);
+MEGAVERSE_C_API int megaverse_num_active_envs(const MegaverseEnv *env);
+
+/**
+ * @param sizes receives the size of every discrete action space, may be NULL.
+ * @return number of action spaces.
+ */
+MEGAVERSE_C_API int megaverse_action_space_sizes(int *sizes, int maxSizes);
+
+/**
+ * @param actions int32 array of shape (numAgentsTotal, numActionSpaces), numAgentsTotal is the number of agents in
+ * the active envs.
+ */
+MEGAVERSE_C_API int megaverse_set_actions(MegaverseEnv *env, const int32_t *actions, int numAgentsTotal, int numActionSpaces);
+
+/// Step synchronously, or launch the step and wait for it (observations of the last step stay valid in between).
+MEGAVERSE_C_API int megaverse_step(MegaverseEnv *env);
+MEGAVERSE_C_API int megaverse_step_async(MegaverseEnv *env);
+MEGAVERSE_C_API int megaverse_step_wait(MegaverseEnv *env);
+
+/**
+ * @param shape receives the shape of one observation, (H, W, C) for images.
+ * @return number of dimensions.
+ */
+MEGAVERSE_C_API int megaverse_observation_shape(const MegaverseEnv *env, int *shape, int maxDims);
+
+/// (numAgentsTotal, shape...) uint8, zero-copy view of the renderer's observation buffer.
+MEGAVERSE_C_API const uint8_t * megaverse_get_observations(const MegaverseEnv *env);
+
+/// Same layout in GPU memory, NULL unless the renderer supports it (Vulkan without pipelining).
+MEGAVERSE_C_API const uint8_t * megaverse_get_observations_device(const MegaverseEnv *env);
+
+/// One float per agent.
+MEGAVERSE_C_API const float * megaverse_get_rewards(const MegaverseEnv *env);
+MEGAVERSE_C_API const float * megaverse_get_true_objectives(const MegaverseEnv *env);
+
+/// One byte per env.
+MEGAVERSE_C_API const uint8_t * megaverse_get_dones(const MegaverseEnv *env);
+
+/**
+ * XLA custom call targets (legacy API, custom_call_api_version=0) for stepping inside a jitted JAX function, see
+ * megaverse/megaverse_xla.py. Operands are the int32 actions (numAgentsTotal, numActionSpaces) and the env handle as
+ * a uint64 scalar, results are the observations, rewards and dones in the layout of the megaverse_get_* buffers.
+ * One call sets the actions, steps and copies the results into the XLA buffers.
+ * The CPU target reads the handle from the operand, the GPU target (Vulkan renderer) from the opaque string
+ * (decimal handle), copies the actions to the host on the stream and the outputs back to the device. Observations
+ * are copied device-to-device when the renderer keeps them in GPU memory.
+ * XLA calls these on its own threads, so the env must render with Vulkan or on the CPU (megaverse_set_cpu_rendering()),
+ * an OpenGL env is bound to the thread that created it. The legacy API has no error status: a handle rendering with
+ * OpenGL or invalid actions abort the process.
+ */
+MEGAVERSE_C_API void megaverse_xla_step_cpu(void *out, const void **in);
+MEGAVERSE_C_API void megaverse_xla_step_gpu(void *stream, void **buffers, const char *opaque, size_t opaqueLen);
+
+#ifdef __cplusplus
+}
+#endif
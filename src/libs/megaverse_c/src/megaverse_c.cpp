@@ -0,0 +1,349 @@
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+
+#ifdef MEGAVERSE_XLA_CUDA
+    #include <cuda_runtime.h>
+#endif
+
+#include <util/macro.hpp>
+#include <util/tiny_logger.hpp>
+
+#include <batched_env/batched_env.hpp>
+
+#include <megaverse_c/megaverse_c.h>
+
+
+using namespace Megaverse;
+
+
+struct MegaverseEnv
+{
+    template<typename... Args>
+    explicit MegaverseEnv(Args &&... args)
+    : env{std::forward<Args>(args)...}
+    {
+    }
+
+    /// The OpenGL context is current on the thread that created the env, XLA calls the custom calls on its own threads.
+    bool rendersWithOpenGL() const { return !useVulkan && !cpuRendering; }
+
+    BatchedEnv env;
+    bool useVulkan = false, cpuRendering = false;
+
+    // host copy of the actions of the GPU custom call
+    std::vector<int32_t> actions;
+};
+
+
+namespace
+{
+
+struct StepSizes
+{
+    int numAgentsTotal, numActionSpaces;
+    size_t obsBytes, rewardBytes, doneBytes;
+};
+
+StepSizes stepSizes(const MegaverseEnv &env)
+{
+    StepSizes sizes{};
+    sizes.numAgentsTotal = env.env.getNumActiveEnvs() * env.env.numAgents();
+    sizes.numActionSpaces = int(Env::actionSpaceSizes.size());
+
+    size_t obsBytesPerAgent = 1;
+    for (auto dim : env.env.observationShape())
+        obsBytesPerAgent *= size_t(dim);
+
+    sizes.obsBytes = obsBytesPerAgent * size_t(sizes.numAgentsTotal);
+    sizes.rewardBytes = sizeof(float) * size_t(sizes.numAgentsTotal);
+    sizes.doneBytes = size_t(env.env.getNumActiveEnvs());
+    return sizes;
+}
+
+/// Exceptions must not cross the C ABI, they are logged and turn into the error value of the function.
+template<typename T, typename Func>
+T guarded(const char *function, T onError, Func &&func)
+{
+    try {
+        return func();
+    } catch (const std::exception &e) {
+        TLOG(ERROR) << "Exception in " << function << ": " << e.what();
+    } catch (...) {
+        TLOG(ERROR) << "Unknown exception in " << function;
+    }
+
+    return onError;
+}
+
+/// The legacy custom call API has no status, so a step that can't be done aborts like a failed TCHECK.
+void xlaStep(MegaverseEnv &env, const int32_t *actions, const StepSizes &sizes)
+{
+    if (env.rendersWithOpenGL())
+        TLOG(FATAL) << "OpenGL envs can't be stepped by XLA, which runs custom calls on its own threads. Use Vulkan or CPU rendering";
+
+    const bool stepped = guarded("xlaStep", false, [&] {
+        if (!env.env.setActionsBatched(actions, sizes.numAgentsTotal, sizes.numActionSpaces))
+            return false;
+
+        env.env.step();
+        return true;
+    });
+
+    if (!stepped)
+        TLOG(FATAL) << "XLA step failed, see the errors above";
+}
+
+}
+
+#define CHECK_ENV(env, onError) \
+    do { \
+        if (!(env)) { \
+            TLOG(ERROR) << "NULL env passed to " << __FUNCTION__; \
+            return onError; \
+        } \
+    } while (false)
+
+
+void megaverse_set_log_level(int level)
+{
+    setLogLevel(LogLevel(std::clamp(level, int(FATAL), int(DEBUG))));
+}
+
+MegaverseEnv * megaverse_create(
+    const char *scenario, int w, int h, int numEnvs, int numAgentsPerEnv, int numSimulationThreads, int useVulkan,
+    const char *const *paramNames, const float *paramValues, int numParams
+)
+{
+    if (!scenario || w <= 0 || h <= 0 || numEnvs <= 0 || numAgentsPerEnv <= 0 || numSimulationThreads <= 0) {
+        TLOG(ERROR) << "Invalid arguments of " << __FUNCTION__;
+        return nullptr;
+    }
+
+    if (numParams > 0 && (!paramNames || !paramValues)) {
+        TLOG(ERROR) << "Missing float parameters";
+        return nullptr;
+    }
+
+    return guarded(__FUNCTION__, static_cast<MegaverseEnv *>(nullptr), [&]() -> MegaverseEnv * {
+        if (!BatchedEnv::isRegisteredScenario(scenario)) {
+            TLOG(ERROR) << "Unknown scenario " << scenario;
+            return nullptr;
+        }
+
+        FloatParams floatParams;
+        for (int i = 0; i < numParams; ++i) {
+            if (!paramNames[i]) {
+                TLOG(ERROR) << "Float parameter #" << i << " has no name";
+                return nullptr;
+            }
+            floatParams[paramNames[i]] = paramValues[i];
+        }
+
+        auto env = new MegaverseEnv{std::string{scenario}, w, h, numEnvs, numAgentsPerEnv, numSimulationThreads, useVulkan != 0, floatParams};
+        env->useVulkan = useVulkan != 0;
+        return env;
+    });
+}
+
+void megaverse_destroy(MegaverseEnv *env)
+{
+    if (!env)
+        return;
+
+    guarded(__FUNCTION__, 0, [&] { env->env.close(); return 0; });
+    delete env;
+}
+
+void megaverse_seed(MegaverseEnv *env, int seed)
+{
+    CHECK_ENV(env, );
+    guarded(__FUNCTION__, 0, [&] { env->env.seed(seed); return 0; });
+}
+
+int megaverse_set_observation_format(MegaverseEnv *env, MegaverseObservationFormat format, int downsample)
+{
+    CHECK_ENV(env, -1);
+
+    if (int(format) < int(MEGAVERSE_OBS_RGBA8) || int(format) > int(MEGAVERSE_OBS_BGR8)) {
+        TLOG(ERROR) << "Unknown observation format " << int(format);
+        return -1;
+    }
+
+    return guarded(__FUNCTION__, -1, [&] { return env->env.setObservationFormat(ObservationFormat(format), downsample) ? 0 : -1; });
+}
+
+void megaverse_set_cpu_rendering(MegaverseEnv *env, int enabled)
+{
+    CHECK_ENV(env, );
+    guarded(__FUNCTION__, 0, [&] { env->env.setCpuRendering(enabled != 0); env->cpuRendering = enabled != 0; return 0; });
+}
+
+void megaverse_set_frame_skip(MegaverseEnv *env, int numFrames)
+{
+    CHECK_ENV(env, );
+    guarded(__FUNCTION__, 0, [&] { env->env.setFrameSkip(numFrames); return 0; });
+}
+
+int megaverse_reset(MegaverseEnv *env)
+{
+    CHECK_ENV(env, -1);
+    return guarded(__FUNCTION__, -1, [&] { env->env.reset(); return 0; });
+}
+
+int megaverse_num_envs(const MegaverseEnv *env)
+{
+    CHECK_ENV(env, -1);
+    return env->env.numEnvs();
+}
+
+int megaverse_num_agents_per_env(const MegaverseEnv *env)
+{
+    CHECK_ENV(env, -1);
+    return env->env.numAgents();
+}
+
+int megaverse_set_num_active_envs(MegaverseEnv *env, int numEnvs)
+{
+    CHECK_ENV(env, -1);
+
+    if (numEnvs < 1 || numEnvs > env->env.numEnvs()) {
+        TLOG(ERROR) << "Number of active envs must be between 1 and " << env->env.numEnvs();
+        return -1;
+    }
+
+    return guarded(__FUNCTION__, -1, [&] { env->env.setNumActiveEnvs(numEnvs); return 0; });
+}
+
+int megaverse_num_active_envs(const MegaverseEnv *env)
+{
+    CHECK_ENV(env, -1);
+    return env->env.getNumActiveEnvs();
+}
+
+int megaverse_action_space_sizes(int *sizes, int maxSizes)
+{
+    const auto &actionSpaceSizes = Env::actionSpaceSizes;
+
+    for (int i = 0; sizes && i < maxSizes && i < int(actionSpaceSizes.size()); ++i)
+        sizes[i] = actionSpaceSizes[i];
+
+    return int(actionSpaceSizes.size());
+}
+
+int megaverse_set_actions(MegaverseEnv *env, const int32_t *actions, int numAgentsTotal, int numActionSpaces)
+{
+    CHECK_ENV(env, -1);
+
+    if (!actions) {
+        TLOG(ERROR) << "NULL actions passed to " << __FUNCTION__;
+        return -1;
+    }
+
+    return guarded(__FUNCTION__, -1, [&] { return env->env.setActionsBatched(actions, numAgentsTotal, numActionSpaces) ? 0 : -1; });
+}
+
+int megaverse_step(MegaverseEnv *env)
+{
+    CHECK_ENV(env, -1);
+    return guarded(__FUNCTION__, -1, [&] { env->env.step(); return 0; });
+}
+
+int megaverse_step_async(MegaverseEnv *env)
+{
+    CHECK_ENV(env, -1);
+    return guarded(__FUNCTION__, -1, [&] { env->env.stepAsync(); return 0; });
+}
+
+int megaverse_step_wait(MegaverseEnv *env)
+{
+    CHECK_ENV(env, -1);
+    return guarded(__FUNCTION__, -1, [&] { env->env.stepWait(); return 0; });
+}
+
+int megaverse_observation_shape(const MegaverseEnv *env, int *shape, int maxDims)
+{
+    CHECK_ENV(env, -1);
+
+    return guarded(__FUNCTION__, -1, [&] {
+        const auto dims = env->env.observationShape();
+
+        for (int i = 0; shape && i < maxDims && i < int(dims.size()); ++i)
+            shape[i] = dims[i];
+
+        return int(dims.size());
+    });
+}
+
+const uint8_t * megaverse_get_observations(const MegaverseEnv *env)
+{
+    CHECK_ENV(env, nullptr);
+    return guarded(__FUNCTION__, static_cast<const uint8_t *>(nullptr), [&] { return env->env.getObservationsBatch(); });
+}
+
+const uint8_t * megaverse_get_observations_device(const MegaverseEnv *env)
+{
+    CHECK_ENV(env, nullptr);
+    return guarded(__FUNCTION__, static_cast<const uint8_t *>(nullptr), [&] { return env->env.getObservationsBatchDevice(); });
+}
+
+const float * megaverse_get_rewards(const MegaverseEnv *env)
+{
+    CHECK_ENV(env, nullptr);
+    return env->env.getRewards();
+}
+
+const float * megaverse_get_true_objectives(const MegaverseEnv *env)
+{
+    CHECK_ENV(env, nullptr);
+    return env->env.getTrueObjectives();
+}
+
+const uint8_t * megaverse_get_dones(const MegaverseEnv *env)
+{
+    CHECK_ENV(env, nullptr);
+    return env->env.getDones();
+}
+
+void megaverse_xla_step_cpu(void *out, const void **in)
+{
+    auto *env = reinterpret_cast<MegaverseEnv *>(uintptr_t(*static_cast<const uint64_t *>(in[1])));
+    auto **outputs = static_cast<void **>(out);
+    const auto sizes = stepSizes(*env);
+
+    xlaStep(*env, static_cast<const int32_t *>(in[0]), sizes);
+
+    memcpy(outputs[0], env->env.getObservationsBatch(), sizes.obsBytes);
+    memcpy(outputs[1], env->env.getRewards(), sizes.rewardBytes);
+    memcpy(outputs[2], env->env.getDones(), sizes.doneBytes);
+}
+
+void megaverse_xla_step_gpu(void *stream, void **buffers, const char *opaque, size_t opaqueLen)
+{
+#ifdef MEGAVERSE_XLA_CUDA
+    auto *env = reinterpret_cast<MegaverseEnv *>(uintptr_t(std::stoull(std::string{opaque, opaqueLen})));
+    auto cudaStream = static_cast<cudaStream_t>(stream);
+    const auto sizes = stepSizes(*env);
+
+    // buffers: actions, handle (unused, it's on the device), observations, rewards, dones
+    env->actions.resize(size_t(sizes.numAgentsTotal) * size_t(sizes.numActionSpaces));
+    TCHECK(cudaMemcpyAsync(env->actions.data(), buffers[0], env->actions.size() * sizeof(int32_t), cudaMemcpyDeviceToHost, cudaStream) == cudaSuccess);
+    TCHECK(cudaStreamSynchronize(cudaStream) == cudaSuccess);
+
+    xlaStep(*env, env->actions.data(), sizes);
+
+    // observations stay on the device with the Vulkan renderer, otherwise they are uploaded like rewards and dones
+    const uint8_t *obsDevice = env->env.getObservationsBatchDevice();
+    const auto obsSrc = obsDevice ? obsDevice : env->env.getObservationsBatch();
+    TCHECK(cudaMemcpyAsync(buffers[2], obsSrc, sizes.obsBytes, cudaMemcpyDefault, cudaStream) == cudaSuccess);
+    TCHECK(cudaMemcpyAsync(buffers[3], env->env.getRewards(), sizes.rewardBytes, cudaMemcpyHostToDevice, cudaStream) == cudaSuccess);
+    TCHECK(cudaMemcpyAsync(buffers[4], env->env.getDones(), sizes.doneBytes, cudaMemcpyHostToDevice, cudaStream) == cudaSuccess);
+
+    // the host buffers are overwritten by the next step, which can be issued before the stream gets to the copies
+    TCHECK(cudaStreamSynchronize(cudaStream) == cudaSuccess);
+#else
+    UNUSED(stream), UNUSED(buffers), UNUSED(opaque), UNUSED(opaqueLen);
+    TLOG(FATAL) << "Megaverse was built without CUDA, the GPU custom call is not available";
+#endif
+}
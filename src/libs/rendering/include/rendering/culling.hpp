@@ -0,0 +1,156 @@
+#pragma once
+
+#include <vector>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Range.h>
+#include <Magnum/Math/Matrix4.h>
+#include <Magnum/Trade/Trade.h>
+
+
+namespace Megaverse
+{
+
+/**
+ * @return bounds of the vertex positions of the mesh in its local space.
+ */
+Magnum::Range3D meshBounds(const Magnum::Trade::MeshData &mesh);
+
+/**
+ * @return axis-aligned box that contains the local box after the transformation.
+ */
+Magnum::Range3D transformedBounds(const Magnum::Matrix4 &transformation, const Magnum::Range3D &local);
+
+/**
+ * @return distance from the point to the closest point of the box, 0 if the point is inside.
+ */
+float distanceToBounds(const Magnum::Vector3 &point, const Magnum::Range3D &bounds);
+
+/**
+ * Coarse software depth buffer for occlusion culling. The static layout boxes (walls of the mazes, merged voxels) are
+ * rasterized from the camera at low resolution, then bounds are tested against the nearest occluder depth in their
+ * screen rectangle. The rectangle is grown by a pixel, so an occluder that misses a pixel center by a bit can't hide
+ * what is visible through a thin gap.
+ */
+class OcclusionBuffer
+{
+public:
+    explicit OcclusionBuffer(int width = 64, int height = 32)
+    : width{width}
+    , height{height}
+    {
+    }
+
+    /// Start a new view, all pixels at the far plane.
+    void clear(const Magnum::Matrix4 &viewProjection);
+
+    /// Rasterize the local box with this world transformation.
+    void addOccluder(const Magnum::Matrix4 &transformation, const Magnum::Range3D &local);
+
+    /**
+     * @return false only if the bounds are entirely behind occluders. Bounds that cross the near plane or are
+     * outside of the view are visible, those are left to frustum culling.
+     */
+    bool visible(const Magnum::Range3D &bounds) const;
+
+    size_t memoryBytes() const { return depth.capacity() * sizeof(float); }
+
+private:
+    // x and y in pixels, z is NDC depth
+    void rasterizeTriangle(const Magnum::Vector3 &a, const Magnum::Vector3 &b, const Magnum::Vector3 &c);
+
+private:
+    int width, height;
+    Magnum::Matrix4 viewProjection;
+    std::vector<float> depth;
+};
+
+/**
+ * Coarse spatial index over the drawables of one env, used to cull instances against agent camera frustums.
+ * Items are bucketed into a uniform grid in the XZ plane and every cell keeps the union of the bounds of its items.
+ * Items of one cell are consecutive in the order returned by build(), so a renderer that stores instances in
+ * this order can draw runs of visible cells directly from its instance buffer.
+ * Moving items only grow the bounds of the cell they were assigned to, until the next build().
+ */
+class CullingGrid
+{
+public:
+    struct Cell
+    {
+        Magnum::Range3D bounds;
+        Magnum::UnsignedInt first, count;
+    };
+
+public:
+    explicit CullingGrid(float cellSize = 8.0f)
+    : cellSize{cellSize}
+    {
+    }
+
+    /**
+     * @param bounds world-space bounds of all items.
+     * @return permutation: order[pos] is the index of the item at position pos.
+     */
+    std::vector<Magnum::UnsignedInt> build(const std::vector<Magnum::Range3D> &bounds);
+
+    /**
+     * The item at position pos has moved.
+     */
+    void update(Magnum::UnsignedInt pos, const Magnum::Range3D &bounds);
+
+    /**
+     * @param visible for every cell, whether it intersects the frustum of the view-projection matrix.
+     * @param occlusion if not nullptr, cells hidden behind its occluders are not visible either.
+     */
+    void cellVisibility(const Magnum::Matrix4 &viewProjection, std::vector<bool> &visible, const OcclusionBuffer *occlusion = nullptr) const;
+
+    /**
+     * Calls f(first, count) for every maximal run of consecutive positions that belong to visible cells.
+     */
+    template<typename F>
+    void forEachVisibleRun(const Magnum::Matrix4 &viewProjection, F &&f)
+    {
+        forEachVisibleRun(viewProjection, [](const Cell &) { return 0; }, [&](auto first, auto count, int) { f(first, count); });
+    }
+
+    /**
+     * Same, but runs are also split between cells with different key(cell), f(first, count, key).
+     * Used to draw runs of cells at the same level of detail.
+     */
+    template<typename K, typename F>
+    void forEachVisibleRun(const Magnum::Matrix4 &viewProjection, K &&key, F &&f, const OcclusionBuffer *occlusion = nullptr)
+    {
+        cellVisibility(viewProjection, visibleCells, occlusion);
+
+        for (size_t cell = 0; cell < cells.size();) {
+            if (!visibleCells[cell]) {
+                ++cell;
+                continue;
+            }
+
+            const auto first = cells[cell].first;
+            const auto runKey = key(cells[cell]);
+            auto count = 0u;
+            for (; cell < cells.size() && visibleCells[cell] && key(cells[cell]) == runKey; ++cell)
+                count += cells[cell].count;
+
+            f(first, count, runKey);
+        }
+    }
+
+    const std::vector<Cell> & getCells() const { return cells; }
+
+    Magnum::UnsignedInt cellOf(Magnum::UnsignedInt pos) const { return itemCell[pos]; }
+
+    size_t memoryBytes() const { return cells.capacity() * sizeof(Cell) + itemCell.capacity() * sizeof(Magnum::UnsignedInt); }
+
+private:
+    float cellSize;
+
+    std::vector<Cell> cells;
+    std::vector<Magnum::UnsignedInt> itemCell;
+
+    std::vector<bool> visibleCells;
+};
+
+}
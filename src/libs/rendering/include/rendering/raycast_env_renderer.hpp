@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+
+#include <env/env_renderer.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Software renderer for machines without GPUs: every agent's frame is ray traced on the CPU in preDraw(), i.e. on
+ * the simulation threads of VectorEnv, and draw() has nothing left to do. The static layout is traversed directly in
+ * the voxel grid of the scenario (3D DDA over a dense copy of the opaque voxels, see Scenario::layoutVoxelQuery()),
+ * all other drawables are intersected analytically as the unit primitives of initPrimitives(). Scenarios without
+ * a voxel grid trace all of their drawables analytically, which is much slower for large layouts.
+ * Flat colors with one directional light, no shadows or textures. Depth and segmentation come from the same rays.
+ * Meant for small observations (i.e. 128x72), the cost is proportional to the number of pixels.
+ */
+class RaycastEnvRenderer : public EnvRenderer
+{
+public:
+    explicit RaycastEnvRenderer(Envs &envs, int w, int h, const ObservationOptions &obsOptions = {});
+
+    ~RaycastEnvRenderer() override;
+
+    void reset(Env &env, int envIdx) override;
+
+    void preDraw(Env &env, int envIdx) override;
+
+    void draw(Envs &) override {}
+
+    const uint8_t * getObservation(int envIdx, int agentIdx) const override;
+
+    const uint8_t * getObservation(int envIdx, int agentIdx, ObservationChannel channel) const override;
+
+    const uint8_t * getObservationsBatch() const override;
+
+    const uint8_t * getObservationsBatch(ObservationChannel channel) const override;
+
+    /// Traced on the calling thread with the voxels and primitives collected by the last preDraw().
+    bool setHiresOutput(int w, int h, const ObservationOptions &options) override;
+
+    void drawHires(Envs &envs, const std::vector<int> &envIndices) override;
+
+    const uint8_t * getHiresObservation(int envIdx, int agentIdx) const override;
+
+    Overview * getOverview() override { return nullptr; }
+
+    void memoryReport(MemoryReport &report) const override;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl;
+};
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <env/env.hpp>
+
+#include <rendering/transform_cache.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Everything a viewer needs to draw one env, copied out of the scene graph, so it can be rendered on another thread
+ * while the env keeps simulating (see TripleBuffer).
+ */
+struct RenderSnapshot
+{
+    struct Instance
+    {
+        Magnum::Matrix4 transformation;
+        uint8_t colorId;
+    };
+
+    DrawableTypeArray<std::vector<Instance>> instances;
+
+    // world transformations of the agent cameras
+    std::vector<Magnum::Matrix4> agentCameras;
+
+    uint64_t episodeId = 0;
+};
+
+/**
+ * Fills snapshots of one env. The transformations come from a TransformCache that is only rebuilt when the episode
+ * changes, so a capture walks the nodes that moved since the previous one and copies the rest.
+ * Must not run while the env is being stepped or reset.
+ */
+class SnapshotCapture
+{
+public:
+    void capture(Env &env, RenderSnapshot &snapshot);
+
+private:
+    TransformCache cache;
+    uint64_t episodeId = 0;
+    bool built = false;
+};
+
+}
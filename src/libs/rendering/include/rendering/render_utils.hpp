@@ -1,10 +1,15 @@
 #pragma once
 
 #include <map>
+#include <array>
 #include <tuple>
+#include <vector>
+#include <algorithm>
 
 #include <env/env.hpp>
+#include <env/env_renderer.hpp>
 
+#include <Magnum/Math/Packing.h>
 #include <Magnum/Trade/MeshData.h>
 
 
@@ -13,6 +18,49 @@ namespace Megaverse
 
 void initPrimitives(std::map<DrawableType, Magnum::Trade::MeshData> &meshData);
 
+/**
+ * Level-of-detail variants of the primitives. lods[type][0] is the same mesh as in initPrimitives(), following levels
+ * have fewer rings and segments, which is indistinguishable at observation resolution for distant objects.
+ * Boxes have a single level.
+ */
+void initPrimitiveLods(DrawableTypeArray<std::vector<Magnum::Trade::MeshData>> &lods);
+
+// level i + 1 is used for objects further than lodDistances[i] from the camera
+constexpr std::array<float, 2> lodDistances{16.0f, 40.0f};
+
+inline int lodForDistance(float distance, int numLevels)
+{
+    int lod = 0;
+    while (lod + 1 < numLevels && lod < int(lodDistances.size()) && distance > lodDistances[lod])
+        ++lod;
+
+    return lod;
+}
+
+/**
+ * Convert consecutive w x h RGBA8 frames into the format described by the options, for renderers that can't do this
+ * on the GPU. Grayscale uses BT.601 luma weights, same as the GL conversion pass.
+ */
+void convertObservations(const uint8_t *rgba, int w, int h, size_t numFrames, const ObservationOptions &options, uint8_t *dst);
+
+/**
+ * Pixels covered by the NDC rectangle in a w x h frame with top-down rows, clamped to the frame.
+ */
+Magnum::Range2Di hudPixelRect(const Magnum::Range2D &ndc, int w, int h);
+
+/**
+ * Draw the HUD quads into a w x h RGBA8 frame with top-down rows, for renderers without an overlay pass.
+ */
+void drawHud(const std::vector<HudQuad> &quads, uint8_t *rgba, int w, int h);
+
+/**
+ * Material ID of a drawable or voxel color as in the segmentation channel: color ID + 1 (see colorId()), 0 for colors
+ * outside of allColors.
+ */
+inline uint8_t materialId(uint8_t colorId) { return colorId < numColors ? uint8_t(colorId + 1) : uint8_t(0); }
+
+inline uint8_t materialId(ColorRgb color) { return materialId(colorId(color)); }
+
 class Overview
 {
 public:
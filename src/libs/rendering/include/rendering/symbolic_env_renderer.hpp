@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+
+#include <env/env_renderer.hpp>
+
+#include <rendering/render_utils.hpp>
+
+
+namespace Megaverse
+{
+
+enum class SymbolicObservationMode
+{
+    // (layers, width, width, 4): voxels around the agent, one layer per voxel level, bottom to top
+    Crop,
+
+    // (width, width, 4): one cell per voxel column around the agent
+    TopDown,
+};
+
+/**
+ * Layout of the symbolic observations. Both modes are egocentric: centered on the agent and rotated with its heading,
+ * row 0 is the farthest ahead, column 0 is on the left. Every cell has 4 uint8 channels:
+ *   0: VoxelType bits of the voxel | terrain << 2 (crop), height of the top solid voxel of the column relative
+ *      to the agent's voxel level + 128, 0 if there is none (top-down)
+ *   1: color of the voxel (crop) or of the top voxel (top-down), color ID + 1 as in the segmentation channel
+ *      (see materialId()), 0 is empty
+ *   2: object, DrawableType + 1 of the non-layout objects (i.e. collectibles, balls) and of the movable objects of
+ *      the voxel grid (boxes that can be picked up), 0 is none
+ *   3: agent, 1 for the agent itself, 2 for teammates, 3 for everyone else, 0 is none
+ */
+struct SymbolicObservationOptions
+{
+    SymbolicObservationMode mode = SymbolicObservationMode::Crop;
+
+    // view covers (2 * radius + 1) x (2 * radius + 1) voxel columns
+    int radius = 7;
+
+    // voxel levels below the agent and from its own level up, top-down looks for objects and agents in the same range
+    int below = 2, above = 4;
+
+    static constexpr int channels = 4;
+
+    int width() const { return 2 * radius + 1; }
+
+    int layers() const { return mode == SymbolicObservationMode::Crop ? below + above : 1; }
+
+    size_t bytesPerFrame() const { return size_t(layers()) * size_t(width()) * size_t(width()) * channels; }
+};
+
+/**
+ * Renders nothing: observations are computed directly from the voxel grids of the scenarios (see
+ * Scenario::layoutVoxelQuery()), the drawables and the agents in preDraw(), on the simulation threads, so VectorEnv
+ * is bound by the simulation alone. For pretraining and debugging. Scenarios without a voxel grid (i.e. the hexagonal
+ * mazes) only get the object and agent channels.
+ */
+class SymbolicEnvRenderer : public EnvRenderer
+{
+public:
+    explicit SymbolicEnvRenderer(Envs &envs, const SymbolicObservationOptions &options = {});
+
+    void reset(Env &, int) override {}
+
+    void preDraw(Env &env, int envIdx) override;
+
+    void draw(Envs &) override {}
+
+    const uint8_t * getObservation(int envIdx, int agentIdx) const override;
+
+    const uint8_t * getObservationsBatch() const override { return observations.data(); }
+
+    Overview * getOverview() override { return nullptr; }
+
+    void memoryReport(MemoryReport &report) const override;
+
+    const SymbolicObservationOptions & getOptions() const { return options; }
+
+private:
+    // world-space position and drawable type of a non-layout object
+    struct ObjectPoint
+    {
+        Magnum::Vector3 position;
+        uint8_t type;
+    };
+
+    void observeAgent(Env &env, int agentIdx, const std::vector<ObjectPoint> &objects, uint8_t *obs) const;
+
+private:
+    SymbolicObservationOptions options;
+
+    std::vector<int> agentOffsets;
+
+    // per env, so envs on different threads never share one
+    std::vector<std::vector<ObjectPoint>> objectPoints;
+
+    std::vector<uint8_t> observations;
+};
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+#include <Magnum/Math/Matrix4.h>
+
+#include <util/magnum.hpp>
+#include <util/memory_report.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * World transformations of the drawables of one env, flattened out of the scene graph. Drawables and all their
+ * ancestors are stored once in topological order (parents before children) with the indices of their parents,
+ * so one linear pass recomputes the transformations of the nodes that moved and of their subtrees, without walking
+ * the hierarchy per object like absoluteTransformationMatrix() and SceneGraph::setClean() do.
+ * Renderers read the transformations directly, each keeps its own cache and the scene graph is never cleaned.
+ */
+class TransformCache
+{
+public:
+    /**
+     * Call after the layout of the episode is built. Objects must outlive the cache or the next build().
+     */
+    void build(const std::vector<Object3D *> &objects);
+
+    /**
+     * Picks up the local transformations that changed since the last update (objects that were reparented, i.e.
+     * picked up or dropped, rebuild the cache).
+     * @return indices into the objects passed to build() whose world transformation changed.
+     */
+    const std::vector<int> & update();
+
+    const Magnum::Matrix4 & transformation(int objectIdx) const { return world[objectNodes[objectIdx]]; }
+
+    int numObjects() const { return int(objectNodes.size()); }
+
+    size_t memoryBytes() const
+    {
+        return vectorBytes(drawableObjects) + vectorBytes(nodes) + vectorBytes(parents) + vectorBytes(nodeObjects)
+            + vectorBytes(local) + vectorBytes(world) + vectorBytes(moved) + vectorBytes(objectNodes) + vectorBytes(changed);
+    }
+
+private:
+    int addNode(Object3D *object, int parentIdx);
+
+private:
+    std::vector<Object3D *> drawableObjects;
+
+    // per node, in topological order
+    std::vector<Object3D *> nodes;
+    std::vector<int> parents, nodeObjects;
+    std::vector<Magnum::Matrix4> local, world;
+    std::vector<bool> moved;
+
+    // node of every object passed to build()
+    std::vector<int> objectNodes;
+
+    std::vector<int> changed;
+};
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+
+namespace cv
+{
+class VideoWriter;
+}
+
+
+namespace Megaverse
+{
+
+/**
+ * Encodes rendered frames into video files on a background thread, so capturing frames (i.e. hires renders of
+ * evaluation episodes) costs the render loop a copy instead of the conversion and the encoding.
+ * Frames go through a fixed-size single-producer single-consumer ring of preallocated slots. If the encoder falls
+ * behind and the ring is full, new frames are dropped (see numDroppedFrames()) instead of stalling the producer.
+ * One file per stream (i.e. per env), written with OpenCV. Hardware encoders are used when the FFmpeg backend of
+ * OpenCV supports them, otherwise a software codec.
+ */
+class VideoEncoder
+{
+public:
+    /**
+     * @param filenamePrefix stream #i is written to <prefix><i>.mp4
+     * @param capacity number of frames in the ring, rounded up to a power of two
+     */
+    VideoEncoder(std::string filenamePrefix, float fps, int capacity = 64);
+
+    /// Encodes all queued frames and closes the files.
+    ~VideoEncoder();
+
+    /**
+     * Queue one frame made of numTiles images of tileW x tileH placed side by side (i.e. all agents of an env).
+     * Tiles are top-down BGR8 (ObservationFormat::BGR8), what the VideoWriter takes without any conversion.
+     * Must always be called from the same thread. The size of a stream is fixed by its first frame.
+     * @return false if the frame was dropped
+     */
+    bool pushFrame(int stream, const uint8_t *const *tiles, int numTiles, int tileW, int tileH);
+
+    uint64_t numDroppedFrames() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    void encoderLoop();
+
+    void encode(int stream, const uint8_t *bgr, int w, int h);
+
+private:
+    struct Slot
+    {
+        int stream = 0, w = 0, h = 0;
+        std::vector<uint8_t> bgr;
+    };
+
+    std::string filenamePrefix;
+    float fps;
+
+    std::vector<Slot> slots;
+
+    // head is only written by the producer, tail by the encoder thread, both only grow (index is value % capacity,
+    // the capacity is a power of two so that this survives the wrap-around)
+    std::atomic<uint32_t> head{0}, tail{0};
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> dropped{0};
+
+    std::vector<std::unique_ptr<cv::VideoWriter>> writers;
+    std::vector<bool> failedStreams;
+
+    std::thread encoderThread;
+};
+
+}
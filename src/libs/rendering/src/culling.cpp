@@ -0,0 +1,195 @@
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+#include <Magnum/Math/Frustum.h>
+#include <Magnum/Math/Intersection.h>
+#include <Magnum/Trade/MeshData.h>
+
+#include <rendering/culling.hpp>
+
+
+using namespace Magnum;
+using namespace Megaverse;
+
+
+Range3D Megaverse::meshBounds(const Trade::MeshData &mesh)
+{
+    const auto positions = mesh.positions3DAsArray();
+    const auto [min, max] = Math::minmax(positions);
+    return Range3D{min, max};
+}
+
+Range3D Megaverse::transformedBounds(const Matrix4 &transformation, const Range3D &local)
+{
+    const auto center = transformation.transformPoint(local.center());
+    const auto halfSize = local.size() / 2;
+
+    // extents of the rotated and scaled box along world axes
+    Vector3 extents;
+    for (int row = 0; row < 3; ++row) {
+        extents[row] = 0;
+        for (int col = 0; col < 3; ++col)
+            extents[row] += std::abs(transformation[col][row]) * halfSize[col];
+    }
+
+    return Range3D{center - extents, center + extents};
+}
+
+float Megaverse::distanceToBounds(const Vector3 &point, const Range3D &bounds)
+{
+    const auto closest = Math::clamp(point, bounds.min(), bounds.max());
+    return (point - closest).length();
+}
+
+std::vector<UnsignedInt> CullingGrid::build(const std::vector<Range3D> &bounds)
+{
+    const auto numItems = bounds.size();
+
+    std::vector<std::pair<int, int>> keys(numItems);
+    for (size_t i = 0; i < numItems; ++i) {
+        const auto center = bounds[i].center();
+        keys[i] = {int(std::floor(center.x() / cellSize)), int(std::floor(center.z() / cellSize))};
+    }
+
+    std::vector<UnsignedInt> order(numItems);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) { return keys[a] < keys[b]; });
+
+    cells.clear(), itemCell.resize(numItems);
+
+    for (UnsignedInt pos = 0; pos < numItems; ++pos) {
+        const auto item = order[pos];
+        if (cells.empty() || keys[item] != keys[order[cells.back().first]])
+            cells.push_back({bounds[item], pos, 0});
+
+        auto &cell = cells.back();
+        cell.bounds = Math::join(cell.bounds, bounds[item]);
+        ++cell.count;
+        itemCell[pos] = UnsignedInt(cells.size() - 1);
+    }
+
+    return order;
+}
+
+void CullingGrid::update(UnsignedInt pos, const Range3D &bounds)
+{
+    auto &cell = cells[itemCell[pos]];
+    cell.bounds = Math::join(cell.bounds, bounds);
+}
+
+void CullingGrid::cellVisibility(const Matrix4 &viewProjection, std::vector<bool> &visible, const OcclusionBuffer *occlusion) const
+{
+    const auto frustum = Frustum::fromMatrix(viewProjection);
+
+    visible.resize(cells.size());
+    for (size_t i = 0; i < cells.size(); ++i)
+        visible[i] = Math::Intersection::rangeFrustum(cells[i].bounds, frustum) && (!occlusion || occlusion->visible(cells[i].bounds));
+}
+
+void OcclusionBuffer::clear(const Matrix4 &vp)
+{
+    viewProjection = vp;
+    depth.assign(size_t(width) * size_t(height), 1.0f);
+}
+
+void OcclusionBuffer::addOccluder(const Matrix4 &transformation, const Range3D &local)
+{
+    const auto mvp = viewProjection * transformation;
+
+    Vector4 clip[8];
+    for (int i = 0; i < 8; ++i) {
+        const Vector3 corner{(i & 1) ? local.max().x() : local.min().x(), (i & 2) ? local.max().y() : local.min().y(), (i & 4) ? local.max().z() : local.min().z()};
+        clip[i] = mvp * Vector4{corner, 1.0f};
+    }
+
+    // two triangles per face, winding doesn't matter since every pixel keeps the nearest depth
+    constexpr int faces[6][4] = {{0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6}};
+
+    for (const auto &face : faces)
+        for (const auto &[i0, i1, i2] : {std::array<int, 3>{face[0], face[1], face[2]}, std::array<int, 3>{face[0], face[2], face[3]}}) {
+            // clip against the near plane (z + w >= 0), a triangle becomes a polygon of up to four vertices
+            const Vector4 in[3] = {clip[i0], clip[i1], clip[i2]};
+            Vector4 out[4];
+            int numOut = 0;
+            for (int v = 0; v < 3; ++v) {
+                const auto &p = in[v], &q = in[(v + 1) % 3];
+                const auto dp = p.z() + p.w(), dq = q.z() + q.w();
+                if (dp >= 0)
+                    out[numOut++] = p;
+                if ((dp >= 0) != (dq >= 0))
+                    out[numOut++] = Math::lerp(p, q, dp / (dp - dq));
+            }
+
+            Vector3 screen[4];
+            for (int v = 0; v < numOut; ++v) {
+                const auto ndc = out[v].xyz() / Math::max(out[v].w(), 1e-6f);
+                screen[v] = {(ndc.x() * 0.5f + 0.5f) * float(width), (ndc.y() * 0.5f + 0.5f) * float(height), ndc.z()};
+            }
+
+            for (int v = 2; v < numOut; ++v)
+                rasterizeTriangle(screen[0], screen[v - 1], screen[v]);
+        }
+}
+
+void OcclusionBuffer::rasterizeTriangle(const Vector3 &a, const Vector3 &b, const Vector3 &c)
+{
+    const auto edge = [](const Vector3 &from, const Vector3 &to, const Vector2 &p) {
+        return (to.x() - from.x()) * (p.y() - from.y()) - (to.y() - from.y()) * (p.x() - from.x());
+    };
+
+    const auto area = edge(a, b, c.xy());
+    if (std::abs(area) < 1e-8f)
+        return;
+
+    const auto x0 = std::max(0, int(std::floor(std::min({a.x(), b.x(), c.x()})))), x1 = std::min(width - 1, int(std::ceil(std::max({a.x(), b.x(), c.x()}))));
+    const auto y0 = std::max(0, int(std::floor(std::min({a.y(), b.y(), c.y()})))), y1 = std::min(height - 1, int(std::ceil(std::max({a.y(), b.y(), c.y()}))));
+
+    for (int y = y0; y <= y1; ++y)
+        for (int x = x0; x <= x1; ++x) {
+            const Vector2 center{float(x) + 0.5f, float(y) + 0.5f};
+            const auto wa = edge(b, c, center) / area, wb = edge(c, a, center) / area, wc = 1.0f - wa - wb;
+            if (wa < 0 || wb < 0 || wc < 0)
+                continue;
+
+            auto &d = depth[size_t(y) * size_t(width) + size_t(x)];
+            d = std::min(d, wa * a.z() + wb * b.z() + wc * c.z());
+        }
+}
+
+bool OcclusionBuffer::visible(const Range3D &bounds) const
+{
+    if (depth.empty())
+        return true;
+
+    Vector2 min{std::numeric_limits<float>::max()}, max{std::numeric_limits<float>::lowest()};
+    auto nearest = std::numeric_limits<float>::max();
+
+    for (int i = 0; i < 8; ++i) {
+        const Vector3 corner{(i & 1) ? bounds.max().x() : bounds.min().x(), (i & 2) ? bounds.max().y() : bounds.min().y(), (i & 4) ? bounds.max().z() : bounds.min().z()};
+        const auto clip = viewProjection * Vector4{corner, 1.0f};
+        if (clip.w() < 1e-6f || clip.z() + clip.w() < 0)
+            return true;
+
+        const auto ndc = clip.xyz() / clip.w();
+        const Vector2 screen{(ndc.x() * 0.5f + 0.5f) * float(width), (ndc.y() * 0.5f + 0.5f) * float(height)};
+        min = Math::min(min, screen), max = Math::max(max, screen);
+        nearest = std::min(nearest, ndc.z());
+    }
+
+    const auto x0 = std::max(0, int(std::floor(min.x())) - 1), x1 = std::min(width - 1, int(std::floor(max.x())) + 1);
+    const auto y0 = std::max(0, int(std::floor(min.y())) - 1), y1 = std::min(height - 1, int(std::floor(max.y())) + 1);
+    if (x0 > x1 || y0 > y1)
+        return true;
+
+    // bias for the bounds of the occluders themselves, their depth is the same as the depth they wrote
+    constexpr float bias = 1e-5f;
+    for (int y = y0; y <= y1; ++y)
+        for (int x = x0; x <= x1; ++x)
+            if (nearest <= depth[size_t(y) * size_t(width) + size_t(x)] + bias)
+                return true;
+
+    return false;
+}
@@ -0,0 +1,730 @@
+#include <cmath>
+#include <tuple>
+#include <limits>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include <Magnum/Math/Packing.h>
+#include <Magnum/Math/Matrix4.h>
+
+#include <util/scoped_profiler.hpp>
+
+#include <env/scenario.hpp>
+#include <env/voxel_state.hpp>
+
+#include <rendering/render_utils.hpp>
+#include <rendering/raycast_env_renderer.hpp>
+
+
+using namespace Magnum;
+using namespace Megaverse;
+
+
+namespace
+{
+
+constexpr float ambient = 0.55f, diffuse = 0.45f;
+
+constexpr float noHit = std::numeric_limits<float>::max();
+
+const Color3ub backgroundColor{32, 32, 32};
+
+struct Hit
+{
+    float t = noHit;
+    Vector3 normal;
+    Color3 color;
+    uint8_t materialId = 0;
+};
+
+/**
+ * Non-layout drawable as a unit primitive in its local space, with a world-space bounding sphere for early rejection.
+ */
+struct Primitive
+{
+    DrawableType type;
+    Matrix4 worldToLocal;
+    Matrix3x3 normalMatrix;
+    Vector3 center;
+    float radius;
+    Color3 color;
+    uint8_t materialId;
+};
+
+/**
+ * Opaque voxels of the layout in a dense box, one palette ID per voxel (0 is empty).
+ */
+struct DenseVoxels
+{
+    Vector3 origin;
+    float voxelSize = 1;
+    VoxelCoords min, dims;
+    std::vector<uint8_t> ids;
+
+    uint8_t at(int x, int y, int z) const { return ids[(size_t(x) * size_t(dims.y()) + size_t(y)) * size_t(dims.z()) + size_t(z)]; }
+};
+
+/// @return number of real roots, t0 <= t1
+int solveQuadratic(float a, float b, float c, float &t0, float &t1)
+{
+    if (std::abs(a) < 1e-8f) {
+        if (std::abs(b) < 1e-8f)
+            return 0;
+
+        t0 = t1 = -c / b;
+        return 1;
+    }
+
+    const auto discriminant = b * b - 4 * a * c;
+    if (discriminant < 0)
+        return 0;
+
+    const auto sq = std::sqrt(discriminant);
+    t0 = (-b - sq) / (2 * a), t1 = (-b + sq) / (2 * a);
+    if (t0 > t1)
+        std::swap(t0, t1);
+
+    return 2;
+}
+
+/**
+ * Local-space intersections with the unit primitives, only front faces count (i.e. the camera inside the body of its
+ * own agent does not see it). @return false if there is no hit in (tMin, t), otherwise t and the local normal.
+ */
+bool intersectBox(const Vector3 &o, const Vector3 &d, float tMin, float &t, Vector3 &n)
+{
+    float tNear = -noHit, tFar = noHit;
+    int axis = 0;
+
+    for (int i = 0; i < 3; ++i) {
+        if (std::abs(d[i]) < 1e-8f) {
+            if (o[i] < -1 || o[i] > 1)
+                return false;
+            continue;
+        }
+
+        auto t1 = (-1 - o[i]) / d[i], t2 = (1 - o[i]) / d[i];
+        if (t1 > t2)
+            std::swap(t1, t2);
+
+        if (t1 > tNear)
+            tNear = t1, axis = i;
+        tFar = std::min(tFar, t2);
+    }
+
+    if (tNear > tFar || tNear <= tMin || tNear >= t)
+        return false;
+
+    t = tNear;
+    n = {};
+    n[axis] = d[axis] > 0 ? -1.0f : 1.0f;
+    return true;
+}
+
+bool intersectSphere(const Vector3 &o, const Vector3 &d, const Vector3 &center, float tMin, float &t, Vector3 &n)
+{
+    const auto oc = o - center;
+    float t0, t1;
+    if (!solveQuadratic(d.dot(), 2 * Math::dot(oc, d), oc.dot() - 1, t0, t1) || t0 <= tMin || t0 >= t)
+        return false;
+
+    t = t0;
+    n = oc + d * t0;
+    return true;
+}
+
+/// Side of the unit-radius cylinder around Y between -halfLength and halfLength.
+bool intersectCylinderSide(const Vector3 &o, const Vector3 &d, float halfLength, float tMin, float &t, Vector3 &n)
+{
+    float t0, t1;
+    if (!solveQuadratic(d.x() * d.x() + d.z() * d.z(), 2 * (o.x() * d.x() + o.z() * d.z()), o.x() * o.x() + o.z() * o.z() - 1, t0, t1))
+        return false;
+
+    const auto y = o.y() + d.y() * t0;
+    if (t0 <= tMin || t0 >= t || std::abs(y) > halfLength)
+        return false;
+
+    t = t0;
+    n = {o.x() + d.x() * t0, 0, o.z() + d.z() * t0};
+    return true;
+}
+
+/// Disk of unit radius at height y, facing up (facing = 1) or down (-1).
+bool intersectCap(const Vector3 &o, const Vector3 &d, float y, float facing, float tMin, float &t, Vector3 &n)
+{
+    if ((o.y() - y) * facing <= 0 || d.y() * facing >= 0)
+        return false;
+
+    const auto tCap = (y - o.y()) / d.y();
+    const auto x = o.x() + d.x() * tCap, z = o.z() + d.z() * tCap;
+    if (tCap <= tMin || tCap >= t || x * x + z * z > 1)
+        return false;
+
+    t = tCap;
+    n = {0, facing, 0};
+    return true;
+}
+
+/// Apex at y = 0.5, unit-radius base at y = -0.5, same as Primitives::coneSolid().
+bool intersectCone(const Vector3 &o, const Vector3 &d, float tMin, float &t, Vector3 &n)
+{
+    bool hit = intersectCap(o, d, -0.5f, -1, tMin, t, n);
+
+    const auto k = 0.5f - o.y();
+    const auto a = d.x() * d.x() + d.z() * d.z() - d.y() * d.y();
+    const auto b = 2 * (o.x() * d.x() + o.z() * d.z() + k * d.y());
+    const auto c = o.x() * o.x() + o.z() * o.z() - k * k;
+
+    float roots[2];
+    const auto numRoots = solveQuadratic(a, b, c, roots[0], roots[1]);
+    for (int i = 0; i < numRoots; ++i) {
+        const auto y = o.y() + d.y() * roots[i];
+        if (roots[i] > tMin && roots[i] < t && y >= -0.5f && y <= 0.5f) {
+            const auto p = o + d * roots[i];
+            t = roots[i];
+            n = {p.x(), 0.5f - p.y(), p.z()};
+            hit = true;
+            break;
+        }
+    }
+
+    return hit;
+}
+
+bool intersectPrimitive(DrawableType type, const Vector3 &o, const Vector3 &d, float tMin, float &t, Vector3 &n)
+{
+    switch (type) {
+        case DrawableType::Box:
+            return intersectBox(o, d, tMin, t, n);
+        case DrawableType::Sphere:
+            return intersectSphere(o, d, {}, tMin, t, n);
+        case DrawableType::Capsule: {
+            // same as Primitives::capsule3DSolid() with halfLength 1
+            bool hit = intersectCylinderSide(o, d, 1, tMin, t, n);
+            Vector3 sphereNormal;
+            for (float y : {-1.0f, 1.0f}) {
+                auto tSphere = t;
+                if (intersectSphere(o, d, {0, y, 0}, tMin, tSphere, sphereNormal) && (o.y() + d.y() * tSphere - y) * y >= 0)
+                    t = tSphere, n = sphereNormal, hit = true;
+            }
+            return hit;
+        }
+        case DrawableType::Cylinder: {
+            bool hit = intersectCylinderSide(o, d, 0.5f, tMin, t, n);
+            hit |= intersectCap(o, d, 0.5f, 1, tMin, t, n);
+            hit |= intersectCap(o, d, -0.5f, -1, tMin, t, n);
+            return hit;
+        }
+        case DrawableType::Cone:
+            return intersectCone(o, d, tMin, t, n);
+        default:
+            return false;
+    }
+}
+
+/// Local-space radius of the bounding spheres of the unit primitives.
+float primitiveRadius(DrawableType type)
+{
+    switch (type) {
+        case DrawableType::Box: return 1.7321f;
+        case DrawableType::Capsule: return 2.0f;
+        case DrawableType::Sphere: return 1.0f;
+        default: return 1.1181f;
+    }
+}
+
+/**
+ * Amanatides & Woo traversal of the dense voxels along o + t * d for t in (tMin, hit.t).
+ */
+void traceVoxels(const DenseVoxels &voxels, const std::vector<Color3> &materials, const Vector3 &o, const Vector3 &d, float tMin, Hit &hit)
+{
+    if (voxels.ids.empty())
+        return;
+
+    // grid space: one unit per voxel, the occupied box starts at zero, t is still the world-space parameter
+    const auto g = (o - voxels.origin) / voxels.voxelSize - Vector3{voxels.min};
+    const auto gd = d / voxels.voxelSize;
+    const auto dims = Vector3{voxels.dims};
+
+    float tEnter = tMin, tExit = hit.t;
+    int enterAxis = -1;
+    for (int i = 0; i < 3; ++i) {
+        if (std::abs(gd[i]) < 1e-8f) {
+            if (g[i] < 0 || g[i] >= dims[i])
+                return;
+            continue;
+        }
+
+        auto t1 = -g[i] / gd[i], t2 = (dims[i] - g[i]) / gd[i];
+        if (t1 > t2)
+            std::swap(t1, t2);
+
+        if (t1 > tEnter)
+            tEnter = t1, enterAxis = i;
+        tExit = std::min(tExit, t2);
+    }
+
+    if (tEnter >= tExit)
+        return;
+
+    const auto start = g + gd * tEnter;
+    VoxelCoords cell, step;
+    Vector3 tNext, tDelta;
+    for (int i = 0; i < 3; ++i) {
+        cell[i] = std::clamp(int(std::floor(start[i])), 0, voxels.dims[i] - 1);
+        step[i] = gd[i] > 0 ? 1 : -1;
+
+        if (std::abs(gd[i]) < 1e-8f) {
+            tNext[i] = tDelta[i] = noHit;
+            continue;
+        }
+
+        const auto boundary = float(cell[i] + (gd[i] > 0 ? 1 : 0));
+        tNext[i] = (boundary - g[i]) / gd[i];
+        tDelta[i] = std::abs(1.0f / gd[i]);
+    }
+
+    auto t = tEnter;
+    auto axis = enterAxis;
+
+    while (t < tExit) {
+        if (const auto id = voxels.at(cell.x(), cell.y(), cell.z()); id && axis >= 0) {
+            hit.t = t;
+            hit.normal = {};
+            hit.normal[axis] = -float(step[axis]);
+            hit.materialId = id;
+            hit.color = materials[id - 1];
+            return;
+        }
+
+        axis = tNext.x() < tNext.y() ? (tNext.x() < tNext.z() ? 0 : 2) : (tNext.y() < tNext.z() ? 1 : 2);
+        t = tNext[axis];
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= voxels.dims[axis])
+            return;
+
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+}
+
+
+struct RaycastEnvRenderer::Impl
+{
+public:
+    struct EnvData
+    {
+        std::vector<Primitive> primitives;
+
+        // primitives in front of the current camera
+        std::vector<const Primitive *> visible;
+
+        DenseVoxels voxels;
+        std::vector<std::pair<VoxelCoords, uint8_t>> scratchVoxels;
+
+        std::vector<HudQuad> hudQuads;
+    };
+
+    // resolution and output buffers of one traced frame, depth and segmentation are optional
+    struct FrameTarget
+    {
+        int w, h;
+        float tanHalfFovX, tanHalfFovY;
+        uint8_t *rgba;
+        uint16_t *depth, *segmentation;
+    };
+
+public:
+    Impl(Envs &envs, int w, int h, const ObservationOptions &obsOptions);
+
+    void preDraw(Env &env, int envIdx);
+
+    void collectVoxels(const LayoutVoxelQuery &query, EnvData &data) const;
+
+    void collectPrimitives(const Env &env, bool skipLayout, EnvData &data) const;
+
+    void traceAgent(Env &env, int agentIdx, EnvData &data, const FrameTarget &target);
+
+    void drawHires(Envs &envs, const std::vector<int> &envIndices);
+
+    const uint8_t * getObservation(int envIdx, int agentIdx) const
+    {
+        const auto frameIdx = size_t(agentOffsets[envIdx] + agentIdx);
+        if (obsOptions.convertsColor())
+            return convertedFrames.data() + frameIdx * obsOptions.bytesPerFrame(w, h);
+
+        return frames.data() + frameIdx * pixelsPerFrame * 4;
+    }
+
+    const uint8_t * getObservation(int envIdx, int agentIdx, ObservationChannel channel) const
+    {
+        if (channel == ObservationChannel::Color)
+            return getObservation(envIdx, agentIdx);
+
+        const auto &aux = channel == ObservationChannel::Depth ? depthFrames : segmentationFrames;
+        if (aux.empty())
+            return nullptr;
+
+        return reinterpret_cast<const uint8_t *>(aux.data() + size_t(agentOffsets[envIdx] + agentIdx) * pixelsPerFrame);
+    }
+
+public:
+    int w, h;
+    size_t pixelsPerFrame;
+    ObservationOptions obsOptions;
+
+    float near, far, tanHalfFovX, tanHalfFovY;
+    Vector3 lightDirection{Vector3{0.4f, 1.0f, 0.25f}.normalized()};
+
+    // material ID - 1 is the color ID, see colorId()
+    std::vector<Color3> materials;
+
+    std::vector<int> agentOffsets;
+    std::vector<EnvData> envData;
+
+    std::vector<uint8_t> frames, convertedFrames;
+    std::vector<uint16_t> depthFrames, segmentationFrames;
+
+    // second output resolution, see setHiresOutput()
+    int hiresW = 0, hiresH = 0;
+    ObservationOptions hiresObsOptions;
+    std::vector<uint8_t> hiresRgba;
+
+    // per env and agent, empty until the env is drawn for the first time
+    std::vector<std::vector<std::vector<uint8_t>>> hiresFrames;
+};
+
+RaycastEnvRenderer::Impl::Impl(Envs &envs, int w, int h, const ObservationOptions &obsOptions)
+: w{w}
+, h{h}
+, pixelsPerFrame{size_t(w) * size_t(h)}
+, obsOptions{obsOptions}
+, envData(envs.size())
+{
+    for (auto c : allColors)
+        materials.push_back(rgb(c));
+
+    float fov, aspectRatio;
+    std::tie(fov, near, far, aspectRatio) = agentCameraParameters();
+
+    // horizontal FOV as in Matrix4::perspectiveProjection(), the frame defines the aspect ratio
+    tanHalfFovX = std::tan(float(Rad{Deg{fov}}) / 2);
+    tanHalfFovY = tanHalfFovX * float(h) / float(w);
+
+    int numAgentsTotal = 0;
+    for (const auto &env : envs) {
+        agentOffsets.push_back(numAgentsTotal);
+        numAgentsTotal += env->getNumAgents();
+    }
+
+    const auto numFrames = size_t(numAgentsTotal);
+    frames.resize(numFrames * pixelsPerFrame * 4);
+    if (obsOptions.convertsColor())
+        convertedFrames.resize(numFrames * obsOptions.bytesPerFrame(w, h));
+    if (obsOptions.depth)
+        depthFrames.resize(numFrames * pixelsPerFrame);
+    if (obsOptions.segmentation)
+        segmentationFrames.resize(numFrames * pixelsPerFrame);
+}
+
+void RaycastEnvRenderer::Impl::collectVoxels(const LayoutVoxelQuery &query, EnvData &data) const
+{
+    auto &voxels = data.voxels;
+    auto &scratch = data.scratchVoxels;
+    scratch.clear();
+
+    VoxelCoords minCoords{std::numeric_limits<int>::max()}, maxCoords{std::numeric_limits<int>::min()};
+    query.forEachVoxel([&](const VoxelCoords &coords, const SymbolicVoxel &v) {
+        if (!(v.voxelType & VOXEL_OPAQUE) || v.object)
+            return;
+
+        // colors outside of allColors still have to be drawn, with the first material
+        scratch.emplace_back(coords, std::max(materialId(v.color), uint8_t(1)));
+        minCoords = Math::min(minCoords, coords);
+        maxCoords = Math::max(maxCoords, coords);
+    });
+
+    voxels.ids.clear();
+    if (scratch.empty() || materials.empty())
+        return;
+
+    voxels.origin = query.gridOrigin();
+    voxels.voxelSize = query.voxelSize();
+    voxels.min = minCoords;
+    voxels.dims = maxCoords - minCoords + VoxelCoords{1};
+    voxels.ids.assign(size_t(voxels.dims.x()) * size_t(voxels.dims.y()) * size_t(voxels.dims.z()), 0);
+
+    for (const auto &[coords, id] : scratch) {
+        const auto c = coords - minCoords;
+        voxels.ids[(size_t(c.x()) * size_t(voxels.dims.y()) + size_t(c.y())) * size_t(voxels.dims.z()) + size_t(c.z())] = id;
+    }
+}
+
+void RaycastEnvRenderer::Impl::collectPrimitives(const Env &env, bool skipLayout, EnvData &data) const
+{
+    data.primitives.clear();
+
+    const auto &drawables = env.getDrawables();
+    for (auto type = int(DrawableType::First); type < int(DrawableType::NumTypes); ++type)
+        for (const auto &d : drawables[DrawableType(type)]) {
+            if (skipLayout && d.layout)
+                continue;
+
+            const auto transform = d.objectPtr->absoluteTransformationMatrix();
+            const auto &basis = transform.rotationScaling();
+            const auto maxScale = std::max({basis[0].length(), basis[1].length(), basis[2].length()});
+
+            Primitive p{};
+            p.type = DrawableType(type);
+            p.worldToLocal = transform.inverted();
+            p.normalMatrix = transform.normalMatrix();
+            p.center = transform.translation();
+            p.radius = primitiveRadius(p.type) * maxScale;
+            p.color = colorById(d.colorId);
+            p.materialId = materialId(d.colorId);
+            data.primitives.push_back(p);
+        }
+}
+
+void RaycastEnvRenderer::Impl::preDraw(Env &env, int envIdx)
+{
+    PROFILE_ZONE("RaycastEnvRenderer::trace");
+
+    auto &data = envData[envIdx];
+
+    const auto *query = env.getScenario().layoutVoxelQuery();
+    if (query)
+        collectVoxels(*query, data);
+    else
+        data.voxels.ids.clear();
+
+    collectPrimitives(env, query != nullptr, data);
+
+    for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+        const auto frameIdx = size_t(agentOffsets[envIdx] + agentIdx);
+
+        FrameTarget target{w, h, tanHalfFovX, tanHalfFovY, frames.data() + frameIdx * pixelsPerFrame * 4, nullptr, nullptr};
+        if (!depthFrames.empty())
+            target.depth = depthFrames.data() + frameIdx * pixelsPerFrame;
+        if (!segmentationFrames.empty())
+            target.segmentation = segmentationFrames.data() + frameIdx * pixelsPerFrame;
+
+        traceAgent(env, agentIdx, data, target);
+
+        data.hudQuads.clear();
+        env.hud(agentIdx, data.hudQuads);
+        drawHud(data.hudQuads, frames.data() + frameIdx * pixelsPerFrame * 4, w, h);
+    }
+
+    if (obsOptions.convertsColor()) {
+        const auto firstFrame = size_t(agentOffsets[envIdx]);
+        convertObservations(
+            frames.data() + firstFrame * pixelsPerFrame * 4, w, h, size_t(env.getNumAgents()), obsOptions,
+            convertedFrames.data() + firstFrame * obsOptions.bytesPerFrame(w, h)
+        );
+    }
+}
+
+void RaycastEnvRenderer::Impl::traceAgent(Env &env, int agentIdx, EnvData &data, const FrameTarget &target)
+{
+    const auto camera = env.getAgents()[agentIdx]->getCameraObject()->absoluteTransformationMatrix();
+    const auto origin = camera.translation();
+    const auto &rotation = camera.rotationScaling();
+    const auto viewDirection = -rotation[2];
+
+    // primitives behind the camera or beyond the far plane are skipped for the whole frame
+    data.visible.clear();
+    for (const auto &p : data.primitives) {
+        const auto depth = Math::dot(p.center - origin, viewDirection);
+        if (depth + p.radius > near && depth - p.radius < far)
+            data.visible.push_back(&p);
+    }
+
+    const auto w = target.w, h = target.h;
+    auto rgba = target.rgba;
+    auto depth = target.depth, segmentation = target.segmentation;
+
+    for (int y = 0; y < h; ++y) {
+        // rows are top-down
+        const auto dirY = (1.0f - 2.0f * (float(y) + 0.5f) / float(h)) * target.tanHalfFovY;
+
+        for (int x = 0; x < w; ++x) {
+            const auto dirX = (2.0f * (float(x) + 0.5f) / float(w) - 1.0f) * target.tanHalfFovX;
+
+            // camera-space z of the direction is -1, so t is the view depth
+            const auto d = rotation * Vector3{dirX, dirY, -1.0f};
+
+            Hit hit;
+            hit.t = far;
+
+            for (const auto *p : data.visible) {
+                // distance from the center of the bounding sphere to the ray
+                const auto oc = p->center - origin;
+                const auto tc = Math::dot(oc, d) / d.dot();
+                if ((oc - d * tc).dot() > p->radius * p->radius)
+                    continue;
+
+                Vector3 localNormal;
+                const auto localOrigin = p->worldToLocal.transformPoint(origin), localDir = p->worldToLocal.transformVector(d);
+                if (intersectPrimitive(p->type, localOrigin, localDir, near, hit.t, localNormal)) {
+                    hit.normal = p->normalMatrix * localNormal;
+                    hit.color = p->color;
+                    hit.materialId = p->materialId;
+                }
+            }
+
+            traceVoxels(data.voxels, materials, origin, d, near, hit);
+
+            const auto pixel = size_t(y) * size_t(w) + size_t(x);
+            auto out = rgba + pixel * 4;
+
+            if (hit.t >= far) {
+                out[0] = backgroundColor.r(), out[1] = backgroundColor.g(), out[2] = backgroundColor.b(), out[3] = 255;
+                if (depth)
+                    depth[pixel] = 65535;
+                if (segmentation)
+                    segmentation[pixel] = 0;
+                continue;
+            }
+
+            const auto lambert = std::max(0.0f, Math::dot(hit.normal.normalized(), lightDirection));
+            const auto c = Math::pack<Color3ub>(Math::clamp(hit.color * (ambient + diffuse * lambert), 0.0f, 1.0f));
+            out[0] = c.r(), out[1] = c.g(), out[2] = c.b(), out[3] = 255;
+
+            if (depth)
+                depth[pixel] = uint16_t(std::min(hit.t / far, 1.0f) * 65535.0f + 0.5f);
+            if (segmentation)
+                segmentation[pixel] = hit.materialId;
+        }
+    }
+}
+
+void RaycastEnvRenderer::Impl::drawHires(Envs &envs, const std::vector<int> &envIndices)
+{
+    PROFILE_ZONE("RaycastEnvRenderer::traceHires");
+
+    // same aspect ratio handling as the observations
+    const auto hiresTanHalfFovY = tanHalfFovX * float(hiresH) / float(hiresW);
+    const auto bytesPerFrame = hiresObsOptions.bytesPerFrame(hiresW, hiresH);
+
+    for (auto envIdx : envIndices) {
+        auto &env = *envs[envIdx];
+        auto &data = envData[envIdx];
+
+        auto &envFrames = hiresFrames[envIdx];
+        envFrames.resize(size_t(env.getNumAgents()));
+
+        // voxels and primitives are the ones collected by the last preDraw()
+        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+            traceAgent(env, agentIdx, data, {hiresW, hiresH, tanHalfFovX, hiresTanHalfFovY, hiresRgba.data(), nullptr, nullptr});
+
+            data.hudQuads.clear();
+            env.hud(agentIdx, data.hudQuads);
+            drawHud(data.hudQuads, hiresRgba.data(), hiresW, hiresH);
+
+            auto &frame = envFrames[agentIdx];
+            frame.resize(bytesPerFrame);
+            if (hiresObsOptions.convertsColor())
+                convertObservations(hiresRgba.data(), hiresW, hiresH, 1, hiresObsOptions, frame.data());
+            else
+                std::copy(hiresRgba.begin(), hiresRgba.end(), frame.begin());
+        }
+    }
+}
+
+
+RaycastEnvRenderer::RaycastEnvRenderer(Envs &envs, int w, int h, const ObservationOptions &obsOptions)
+{
+    pimpl = std::make_unique<Impl>(envs, w, h, obsOptions);
+}
+
+RaycastEnvRenderer::~RaycastEnvRenderer() = default;
+
+void RaycastEnvRenderer::reset(Env &, int envIdx)
+{
+    // everything is collected again before every frame, only the scratch memory is kept
+    auto &data = pimpl->envData[envIdx];
+    data.primitives.clear();
+    data.visible.clear();
+}
+
+void RaycastEnvRenderer::preDraw(Env &env, int envIdx)
+{
+    pimpl->preDraw(env, envIdx);
+}
+
+const uint8_t * RaycastEnvRenderer::getObservation(int envIdx, int agentIdx) const
+{
+    return pimpl->getObservation(envIdx, agentIdx);
+}
+
+const uint8_t * RaycastEnvRenderer::getObservation(int envIdx, int agentIdx, ObservationChannel channel) const
+{
+    return pimpl->getObservation(envIdx, agentIdx, channel);
+}
+
+const uint8_t * RaycastEnvRenderer::getObservationsBatch() const
+{
+    return pimpl->getObservation(0, 0);
+}
+
+const uint8_t * RaycastEnvRenderer::getObservationsBatch(ObservationChannel channel) const
+{
+    return pimpl->getObservation(0, 0, channel);
+}
+
+bool RaycastEnvRenderer::setHiresOutput(int w, int h, const ObservationOptions &options)
+{
+    TCHECK(options.downsample >= 1 && w % options.downsample == 0 && h % options.downsample == 0);
+
+    pimpl->hiresW = w, pimpl->hiresH = h;
+    pimpl->hiresObsOptions = options;
+    pimpl->hiresObsOptions.depth = pimpl->hiresObsOptions.segmentation = false;
+
+    pimpl->hiresRgba.resize(size_t(w) * size_t(h) * 4);
+    pimpl->hiresFrames.assign(pimpl->envData.size(), {});
+    return true;
+}
+
+void RaycastEnvRenderer::drawHires(Envs &envs, const std::vector<int> &envIndices)
+{
+    TCHECK(pimpl->hiresW > 0);
+    pimpl->drawHires(envs, envIndices);
+}
+
+const uint8_t * RaycastEnvRenderer::getHiresObservation(int envIdx, int agentIdx) const
+{
+    const auto &frames = pimpl->hiresFrames;
+    if (envIdx >= int(frames.size()) || agentIdx >= int(frames[envIdx].size()))
+        return nullptr;
+
+    return frames[envIdx][agentIdx].data();
+}
+
+void RaycastEnvRenderer::memoryReport(MemoryReport &report) const
+{
+    const auto &impl = *pimpl;
+
+    report.add("render.observations", vectorBytes(impl.frames) + vectorBytes(impl.convertedFrames));
+    report.add("render.auxiliary", vectorBytes(impl.depthFrames) + vectorBytes(impl.segmentationFrames));
+
+    size_t sceneBytes = 0;
+    for (const auto &data : impl.envData)
+        sceneBytes += vectorBytes(data.primitives) + vectorBytes(data.visible) + vectorBytes(data.voxels.ids)
+                      + vectorBytes(data.scratchVoxels) + vectorBytes(data.hudQuads);
+
+    report.add("render.scene", sceneBytes);
+
+    if (impl.hiresW > 0) {
+        size_t hiresBytes = vectorBytes(impl.hiresRgba) + vectorBytes(impl.hiresFrames);
+        for (const auto &envFrames : impl.hiresFrames) {
+            hiresBytes += vectorBytes(envFrames);
+            for (const auto &frame : envFrames)
+                hiresBytes += vectorBytes(frame);
+        }
+
+        report.add("render.hires_frames", hiresBytes);
+    }
+}
@@ -0,0 +1,43 @@
+#include <rendering/render_snapshot.hpp>
+
+
+using namespace Magnum;
+using namespace Megaverse;
+
+
+void SnapshotCapture::capture(Env &env, RenderSnapshot &snapshot)
+{
+    const auto &drawables = env.getDrawables();
+    const auto &agents = env.getAgents();
+
+    if (!built || env.episodeId() != episodeId) {
+        // drawables first, then the cameras of the agents
+        std::vector<Object3D *> objects;
+        for (const auto &sceneObjects : drawables)
+            for (const auto &sceneObjectInfo : sceneObjects)
+                objects.emplace_back(sceneObjectInfo.objectPtr);
+        for (auto *agent : agents)
+            objects.emplace_back(agent->getCameraObject());
+
+        cache.build(objects);
+        episodeId = env.episodeId();
+        built = true;
+    } else
+        cache.update();
+
+    int objectIdx = 0;
+    for (int drawableType = int(DrawableType::First); drawableType < int(DrawableType::NumTypes); ++drawableType) {
+        const auto &sceneObjects = drawables[DrawableType(drawableType)];
+
+        auto &instances = snapshot.instances[DrawableType(drawableType)];
+        instances.resize(sceneObjects.size());
+        for (size_t i = 0; i < sceneObjects.size(); ++i)
+            instances[i] = {cache.transformation(objectIdx++), sceneObjects[i].colorId};
+    }
+
+    snapshot.agentCameras.resize(agents.size());
+    for (auto &camera : snapshot.agentCameras)
+        camera = cache.transformation(objectIdx++);
+
+    snapshot.episodeId = episodeId;
+}
@@ -1,3 +1,7 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
 #include <Magnum/Primitives/Cube.h>
 #include <Magnum/Primitives/Cone.h>
 #include <Magnum/Primitives/Capsule.h>
@@ -30,6 +34,84 @@ void Megaverse::initPrimitives(std::map<DrawableType, Magnum::Trade::MeshData> &
     m.emplace(DrawableType::Cylinder, Primitives::cylinderSolid(1, 6, 0.5f, Magnum::Primitives::CylinderFlag::CapEnds));
 }
 
+void Megaverse::initPrimitiveLods(DrawableTypeArray<std::vector<Magnum::Trade::MeshData>> &lods)
+{
+    std::map<DrawableType, Trade::MeshData> base;
+    initPrimitives(base);
+    for (auto &[type, mesh] : base)
+        lods[type].emplace_back(std::move(mesh));
+
+    auto &capsule = lods[DrawableType::Capsule];
+    capsule.emplace_back(Primitives::capsule3DSolid(2, 1, 6, 1.0));
+    capsule.emplace_back(Primitives::capsule3DSolid(1, 1, 4, 1.0));
+
+    lods[DrawableType::Sphere].emplace_back(Primitives::icosphereSolid(0));
+
+    lods[DrawableType::Cone].emplace_back(Primitives::coneSolid(1, 4, 0.5f));
+
+    lods[DrawableType::Cylinder].emplace_back(Primitives::cylinderSolid(1, 4, 0.5f, Magnum::Primitives::CylinderFlag::CapEnds));
+}
+
+
+void Megaverse::convertObservations(const uint8_t *rgba, int w, int h, size_t numFrames, const ObservationOptions &options, uint8_t *dst)
+{
+    const auto ds = options.downsample, outW = options.width(w), outH = options.height(h), channels = options.channels();
+    const auto blockSize = ds * ds;
+
+    for (size_t frame = 0; frame < numFrames; ++frame) {
+        const auto src = rgba + frame * size_t(w * h * 4);
+
+        for (int y = 0; y < outH; ++y) {
+            for (int x = 0; x < outW; ++x) {
+                int sum[3] = {0, 0, 0};
+                for (int by = 0; by < ds; ++by) {
+                    const auto row = src + (size_t(y * ds + by) * w + size_t(x * ds)) * 4;
+                    for (int bx = 0; bx < ds; ++bx)
+                        for (int c = 0; c < 3; ++c)
+                            sum[c] += row[bx * 4 + c];
+                }
+
+                if (options.format == ObservationFormat::Gray8) {
+                    *dst++ = uint8_t((299 * sum[0] + 587 * sum[1] + 114 * sum[2] + 500 * blockSize) / (1000 * blockSize));
+                } else {
+                    if (options.swapsRedBlue())
+                        std::swap(sum[0], sum[2]);
+
+                    for (int c = 0; c < 3; ++c)
+                        *dst++ = uint8_t((sum[c] + blockSize / 2) / blockSize);
+
+                    if (channels == 4)
+                        *dst++ = 255;
+                }
+            }
+        }
+    }
+}
+
+Range2Di Megaverse::hudPixelRect(const Range2D &ndc, int w, int h)
+{
+    const auto toPixel = [](float v, int size) { return std::clamp(int(std::lround((v + 1.0f) * 0.5f * float(size))), 0, size); };
+
+    // NDC y is up, rows go down
+    const Vector2i min{toPixel(ndc.min().x(), w), h - toPixel(ndc.max().y(), h)};
+    const Vector2i max{toPixel(ndc.max().x(), w), h - toPixel(ndc.min().y(), h)};
+    return {min, Math::max(min, max)};
+}
+
+void Megaverse::drawHud(const std::vector<HudQuad> &quads, uint8_t *rgba, int w, int h)
+{
+    for (const auto &quad : quads) {
+        const auto rect = hudPixelRect(quad.rect, w, h);
+        const auto c = Math::pack<Color3ub>(quad.color);
+        const uint8_t pixel[4] = {c.r(), c.g(), c.b(), 255};
+
+        for (int y = rect.min().y(); y < rect.max().y(); ++y) {
+            auto row = rgba + (size_t(y) * size_t(w) + size_t(rect.min().x())) * 4;
+            for (int x = rect.min().x(); x < rect.max().x(); ++x, row += 4)
+                memcpy(row, pixel, sizeof(pixel));
+        }
+    }
+}
 
 void Overview::reset(Object3D *parent)
 {
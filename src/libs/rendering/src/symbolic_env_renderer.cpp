@@ -0,0 +1,191 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <util/scoped_profiler.hpp>
+
+#include <env/scenario.hpp>
+#include <env/voxel_state.hpp>
+
+#include <rendering/symbolic_env_renderer.hpp>
+
+
+using namespace Magnum;
+using namespace Megaverse;
+
+
+namespace
+{
+
+enum SymbolicChannel
+{
+    CHANNEL_TYPE = 0,
+    CHANNEL_COLOR = 1,
+    CHANNEL_OBJECT = 2,
+    CHANNEL_AGENT = 3,
+};
+
+/**
+ * Egocentric frame of one agent: cell (row, col) of the view is at origin + forward * (radius - row) + right * (col - radius).
+ */
+struct AgentFrame
+{
+    Vector3 origin, forward, right;
+    float voxelSize;
+    int radius, minLevel, numLevels;
+
+    Vector3 cellCenter(int row, int col) const
+    {
+        return origin + (forward * float(radius - row) + right * float(col - radius)) * voxelSize;
+    }
+
+    /// @return false if the point is outside of the view
+    bool cell(const Vector3 &p, int level, int &row, int &col) const
+    {
+        const auto d = p - origin;
+        row = radius - int(std::lround(Math::dot(d, forward) / voxelSize));
+        col = radius + int(std::lround(Math::dot(d, right) / voxelSize));
+
+        const auto width = 2 * radius + 1;
+        return row >= 0 && row < width && col >= 0 && col < width && level >= minLevel && level < minLevel + numLevels;
+    }
+};
+
+}
+
+
+SymbolicEnvRenderer::SymbolicEnvRenderer(Envs &envs, const SymbolicObservationOptions &options)
+: options{options}
+, objectPoints(envs.size())
+{
+    int numAgentsTotal = 0;
+    for (const auto &env : envs) {
+        agentOffsets.push_back(numAgentsTotal);
+        numAgentsTotal += env->getNumAgents();
+    }
+
+    observations.resize(size_t(numAgentsTotal) * options.bytesPerFrame());
+}
+
+void SymbolicEnvRenderer::preDraw(Env &env, int envIdx)
+{
+    PROFILE_ZONE("SymbolicEnvRenderer::observe");
+
+    // layout boxes come from the voxel grid, everything else drawn is an object
+    auto &objects = objectPoints[envIdx];
+    objects.clear();
+
+    const auto &drawables = env.getDrawables();
+    for (auto type = int(DrawableType::First); type < int(DrawableType::NumTypes); ++type) {
+        if (DrawableType(type) == DrawableType::Box)
+            continue;
+
+        for (const auto &d : drawables[DrawableType(type)])
+            objects.push_back({d.objectPtr->absoluteTransformation().translation(), uint8_t(type + 1)});
+    }
+
+    for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+        auto obs = observations.data() + size_t(agentOffsets[envIdx] + agentIdx) * options.bytesPerFrame();
+        memset(obs, 0, options.bytesPerFrame());
+
+        observeAgent(env, agentIdx, objects, obs);
+    }
+}
+
+void SymbolicEnvRenderer::observeAgent(Env &env, int agentIdx, const std::vector<ObjectPoint> &objects, uint8_t *obs) const
+{
+    const auto &agents = env.getAgents();
+    const auto &scenario = env.getScenario();
+    const auto *query = scenario.layoutVoxelQuery();
+
+    const auto *self = agents[agentIdx];
+    const auto position = self->transformation().translation();
+
+    Vector3 forward{self->forwardDirection()};
+    forward.y() = 0;
+    forward = forward.dot() > 1e-6f ? forward.normalized() : Vector3{0, 0, -1};
+
+    AgentFrame frame{};
+    frame.origin = position;
+    frame.forward = forward;
+    frame.right = Vector3{-forward.z(), 0, forward.x()};
+    frame.voxelSize = query ? query->voxelSize() : 1.0f;
+    frame.radius = options.radius;
+
+    const auto levelOf = [&](const Vector3 &p) {
+        return query ? query->voxelCoords(p).y() : int(std::floor(p.y() / frame.voxelSize));
+    };
+
+    const auto agentLevel = levelOf(position);
+    frame.minLevel = agentLevel - options.below;
+    frame.numLevels = options.below + options.above;
+
+    const auto width = options.width();
+    const auto cropMode = options.mode == SymbolicObservationMode::Crop;
+
+    const auto cellPtr = [&](int level, int row, int col) {
+        const auto layer = cropMode ? level - frame.minLevel : 0;
+        return obs + ((size_t(layer) * size_t(width) + size_t(row)) * size_t(width) + size_t(col)) * SymbolicObservationOptions::channels;
+    };
+
+    if (query) {
+        SymbolicVoxel v;
+
+        for (int row = 0; row < width; ++row)
+            for (int col = 0; col < width; ++col) {
+                auto coords = query->voxelCoords(frame.cellCenter(row, col));
+
+                // top to bottom, so the top-down mode stops at the first solid voxel
+                bool foundTop = false;
+                for (int level = frame.minLevel + frame.numLevels - 1; level >= frame.minLevel; --level) {
+                    coords.y() = level;
+                    if (!query->voxel(coords, v))
+                        continue;
+
+                    auto cell = cellPtr(level, row, col);
+                    if (v.object)
+                        cell[CHANNEL_OBJECT] = uint8_t(int(DrawableType::Box) + 1);
+
+                    if (cropMode) {
+                        cell[CHANNEL_TYPE] = uint8_t(v.voxelType | (v.terrain << 2));
+                        if (v.voxelType & VOXEL_OPAQUE)
+                            cell[CHANNEL_COLOR] = materialId(v.color);
+                    } else if (!foundTop && (v.voxelType & VOXEL_SOLID)) {
+                        foundTop = true;
+                        cell[CHANNEL_TYPE] = uint8_t(std::clamp(level - agentLevel + 128, 1, 255));
+                        if (v.voxelType & VOXEL_OPAQUE)
+                            cell[CHANNEL_COLOR] = materialId(v.color);
+                    }
+                }
+            }
+    }
+
+    int row, col;
+    for (const auto &object : objects) {
+        const auto level = levelOf(object.position);
+        if (frame.cell(object.position, level, row, col))
+            cellPtr(level, row, col)[CHANNEL_OBJECT] = object.type;
+    }
+
+    const auto team = scenario.teamAffinity(agentIdx);
+    for (int i = 0; i < int(agents.size()); ++i) {
+        const auto p = agents[i]->transformation().translation();
+        const auto level = levelOf(p);
+        if (!frame.cell(p, level, row, col))
+            continue;
+
+        const auto id = i == agentIdx ? 1 : scenario.teamAffinity(i) == team ? 2 : 3;
+        cellPtr(level, row, col)[CHANNEL_AGENT] = uint8_t(id);
+    }
+}
+
+const uint8_t * SymbolicEnvRenderer::getObservation(int envIdx, int agentIdx) const
+{
+    return observations.data() + size_t(agentOffsets[envIdx] + agentIdx) * options.bytesPerFrame();
+}
+
+void SymbolicEnvRenderer::memoryReport(MemoryReport &report) const
+{
+    report.add("render.observations", vectorBytes(observations));
+    report.add("render.symbolic_objects", vectorBytes(objectPoints));
+}
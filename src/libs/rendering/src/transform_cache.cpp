@@ -0,0 +1,146 @@
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+#include <util/macro.hpp>
+
+#include <rendering/transform_cache.hpp>
+
+
+using namespace Magnum;
+using namespace Megaverse;
+
+
+namespace
+{
+
+// exact comparison, the fuzzy Matrix4::operator==() is much slower and a tiny move still has to be picked up
+bool sameMatrix(const Matrix4 &a, const Matrix4 &b)
+{
+    return memcmp(a.data(), b.data(), sizeof(Matrix4)) == 0;
+}
+
+/**
+ * parent * local, one column of the result per iteration with 4-wide vectors. Products are summed in the same order
+ * and without FMA, so the result matches Matrix4::operator*() exactly (up to the sign of zeros).
+ */
+void multiply(const Matrix4 &parent, const Matrix4 &local, Matrix4 &out)
+{
+    const float *a = parent.data(), *b = local.data();
+    float *o = out.data();
+
+#if defined(__x86_64__) || defined(__i386__)
+    const __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+    for (int col = 0; col < 4; ++col) {
+        const float *bc = b + col * 4;
+        auto sum = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+        _mm_storeu_ps(o + col * 4, sum);
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t a0 = vld1q_f32(a), a1 = vld1q_f32(a + 4), a2 = vld1q_f32(a + 8), a3 = vld1q_f32(a + 12);
+    for (int col = 0; col < 4; ++col) {
+        const float *bc = b + col * 4;
+        auto sum = vmulq_n_f32(a0, bc[0]);
+        sum = vaddq_f32(sum, vmulq_n_f32(a1, bc[1]));
+        sum = vaddq_f32(sum, vmulq_n_f32(a2, bc[2]));
+        sum = vaddq_f32(sum, vmulq_n_f32(a3, bc[3]));
+        vst1q_f32(o + col * 4, sum);
+    }
+#else
+    UNUSED(a), UNUSED(b), UNUSED(o);
+    out = parent * local;
+#endif
+}
+
+}
+
+
+void TransformCache::build(const std::vector<Object3D *> &objects)
+{
+    drawableObjects = objects;
+
+    nodes.clear(), parents.clear(), nodeObjects.clear(), local.clear(), world.clear();
+    objectNodes.clear();
+    changed.clear();
+
+    std::unordered_map<Object3D *, int> nodeIndices;
+
+    std::vector<Object3D *> chain;
+    for (int objectIdx = 0; objectIdx < int(objects.size()); ++objectIdx) {
+        // ancestors that are not in the cache yet, closest first
+        chain.clear();
+        auto node = objects[objectIdx];
+        while (node && !nodeIndices.count(node)) {
+            chain.push_back(node);
+            node = node->parent();
+        }
+
+        // chain ends either at the root or at a node that is already cached
+        auto parentIdx = node ? nodeIndices[node] : -1;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+            nodeIndices[*it] = parentIdx = addNode(*it, parentIdx);
+
+        const auto nodeIdx = nodeIndices[objects[objectIdx]];
+        objectNodes.push_back(nodeIdx);
+        nodeObjects[nodeIdx] = objectIdx;
+    }
+
+    moved.assign(nodes.size(), false);
+}
+
+int TransformCache::addNode(Object3D *object, int parentIdx)
+{
+    const auto nodeIdx = int(nodes.size());
+
+    nodes.push_back(object);
+    parents.push_back(parentIdx);
+    nodeObjects.push_back(-1);
+    local.push_back(object->transformationMatrix());
+    world.push_back(local.back());
+    if (parentIdx >= 0)
+        multiply(world[parentIdx], local.back(), world.back());
+
+    return nodeIdx;
+}
+
+const std::vector<int> & TransformCache::update()
+{
+    changed.clear();
+
+    for (int i = 0; i < int(nodes.size()); ++i) {
+        const auto object = nodes[i];
+        const auto parentIdx = parents[i];
+
+        if (object->parent() != (parentIdx >= 0 ? nodes[parentIdx] : nullptr)) {
+            build(drawableObjects);
+            changed.resize(drawableObjects.size());
+            std::iota(changed.begin(), changed.end(), 0);
+            return changed;
+        }
+
+        const auto &t = object->transformationMatrix();
+        const bool nodeMoved = !sameMatrix(t, local[i]) || (parentIdx >= 0 && moved[parentIdx]);
+        moved[i] = nodeMoved;
+
+        if (nodeMoved) {
+            local[i] = t;
+            if (parentIdx >= 0)
+                multiply(world[parentIdx], t, world[i]);
+            else
+                world[i] = t;
+            if (nodeObjects[i] >= 0)
+                changed.push_back(nodeObjects[i]);
+        }
+    }
+
+    return changed;
+}
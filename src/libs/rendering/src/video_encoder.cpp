@@ -0,0 +1,137 @@
+#include <cstring>
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <util/tiny_logger.hpp>
+#include <util/shared_memory.hpp>
+
+#include <rendering/video_encoder.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+// hardware acceleration properties of VideoWriter appeared in OpenCV 4.5.2
+#define HAS_VIDEOWRITER_HW_ACCELERATION (CV_VERSION_MAJOR * 10000 + CV_VERSION_MINOR * 100 + CV_VERSION_REVISION >= 40502)
+
+uint32_t nextPowerOfTwo(int v)
+{
+    uint32_t p = 1;
+    while (p < uint32_t(v))
+        p <<= 1;
+    return p;
+}
+
+std::unique_ptr<cv::VideoWriter> openWriter(const std::string &filename, float fps, int w, int h)
+{
+    auto writer = std::make_unique<cv::VideoWriter>();
+
+#if HAS_VIDEOWRITER_HW_ACCELERATION
+    // H.264 on a hardware encoder (NVENC, VAAPI, ...) if there is one, the backend falls back to software
+    const std::vector<int> params{cv::VIDEOWRITER_PROP_HW_ACCELERATION, cv::VIDEO_ACCELERATION_ANY};
+    writer->open(filename, cv::CAP_FFMPEG, cv::VideoWriter::fourcc('a', 'v', 'c', '1'), fps, {w, h}, params);
+#endif
+
+    // MPEG-4 part 2 is available in every OpenCV build with video support
+    if (!writer->isOpened())
+        writer->open(filename, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps, {w, h});
+
+    if (!writer->isOpened()) {
+        TLOG(ERROR) << "Could not open video file " << filename;
+        return nullptr;
+    }
+
+    return writer;
+}
+
+}
+
+
+VideoEncoder::VideoEncoder(std::string filenamePrefix, float fps, int capacity)
+: filenamePrefix{std::move(filenamePrefix)}
+, fps{fps}
+, slots(nextPowerOfTwo(capacity))
+{
+    encoderThread = std::thread{[this] { encoderLoop(); }};
+}
+
+VideoEncoder::~VideoEncoder()
+{
+    stop.store(true, std::memory_order_release);
+    futexWakeAll(head);
+    encoderThread.join();
+
+    if (numDroppedFrames() > 0)
+        TLOG(WARNING) << "Video encoder fell behind, dropped " << numDroppedFrames() << " frames";
+}
+
+bool VideoEncoder::pushFrame(int stream, const uint8_t *const *tiles, int numTiles, int tileW, int tileH)
+{
+    const auto h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= slots.size()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    auto &slot = slots[h % slots.size()];
+    slot.stream = stream, slot.w = tileW * numTiles, slot.h = tileH;
+    slot.bgr.resize(size_t(slot.w) * size_t(slot.h) * 3);
+
+    // rows of the tiles side by side, one memcpy per row of every tile
+    const auto tileRowBytes = size_t(tileW) * 3;
+    for (int row = 0; row < tileH; ++row)
+        for (int tile = 0; tile < numTiles; ++tile)
+            memcpy(slot.bgr.data() + (size_t(row) * numTiles + tile) * tileRowBytes, tiles[tile] + row * tileRowBytes, tileRowBytes);
+
+    head.store(h + 1, std::memory_order_release);
+    futexWakeAll(head);
+    return true;
+}
+
+void VideoEncoder::encoderLoop()
+{
+    while (true) {
+        const auto t = tail.load(std::memory_order_relaxed);
+        const auto h = head.load(std::memory_order_acquire);
+
+        if (t == h) {
+            // the producer publishes everything before it sets stop, so an empty ring is final
+            if (stop.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == t)
+                break;
+
+            futexWait(head, h);
+            continue;
+        }
+
+        const auto &slot = slots[t % slots.size()];
+        encode(slot.stream, slot.bgr.data(), slot.w, slot.h);
+
+        tail.store(t + 1, std::memory_order_release);
+    }
+
+    writers.clear();
+}
+
+void VideoEncoder::encode(int stream, const uint8_t *bgr, int w, int h)
+{
+    if (stream >= int(writers.size()))
+        writers.resize(size_t(stream) + 1), failedStreams.resize(size_t(stream) + 1);
+
+    auto &writer = writers[stream];
+    if (!writer) {
+        if (failedStreams[stream])
+            return;
+
+        writer = openWriter(filenamePrefix + std::to_string(stream) + ".mp4", fps, w, h);
+        if (!writer) {
+            failedStreams[stream] = true;
+            return;
+        }
+    }
+
+    writer->write(cv::Mat{h, w, CV_8UC3, const_cast<uint8_t *>(bgr)});
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <env/scenario_component.hpp>
+#include <env/batched_components.hpp>
 
 
 namespace Megaverse
@@ -14,10 +15,10 @@ public:
 };
 
 template<typename VoxelT>
-class FallDetectionComponent : public ScenarioComponent
+class FallDetectionComponent : public ScenarioComponent, public BatchedFallDetection
 {
 public:
-    explicit FallDetectionComponent(Scenario &scenario, VoxelGrid<VoxelT> &grid, FallDetectionCallbacks &callbacks, int fallThreshold = -20)
+    explicit FallDetectionComponent(Scenario &scenario, ChunkedVoxelGrid<VoxelT> &grid, FallDetectionCallbacks &callbacks, int fallThreshold = -20)
     : ScenarioComponent{scenario}
     , grid{grid}
     , callbacks{callbacks}
@@ -32,22 +33,33 @@ public:
 
     void step(Env &env, Env::EnvState &envState) override
     {
-        for (int i = 0; i < env.getNumAgents(); ++i) {
-            auto &a = envState.agents[i];
-            if (a->absoluteTransformation().translation().y() < fallThreshold) {
-                resetAgent(i, a);
-                callbacks.agentFell(i);
-            }
-        }
+        // checked for the whole shard by BatchedComponentsPass instead
+        if (envState.batchedComponents)
+            return;
+
+        for (int i = 0; i < env.getNumAgents(); ++i)
+            if (envState.agents[i]->absoluteTransformation().translation().y() < float(fallThreshold))
+                respawnFallenAgent(env, i);
+    }
+
+    float fallHeight() const override { return float(fallThreshold); }
+
+    void respawnFallenAgent(Env &env, int agentIdx) override
+    {
+        resetAgent(agentIdx, env.getAgents()[agentIdx]);
+        callbacks.agentFell(agentIdx);
     }
 
     void resetAgent(int agentIdx, AbstractAgent *a)
     {
         auto p = agentInitialPositions[agentIdx];
-        auto v = grid.getWithVector(p);
-        while (v && !v->empty() && p.y() < 1000) {
-            ++p.y();
-            v = grid.getWithVector(p);
+
+        // ascend until we find a non-solid voxel above the spawn point
+        const auto coords = grid.getCoords(p);
+        const auto maxY = grid.getCoords({p.x(), 1000.0f, p.z()}).y() - 1;
+        if (coords.y() <= maxY) {
+            const auto y = grid.findInColumn(coords.x(), coords.z(), coords.y(), maxY, VOXEL_SOLID, false);
+            p.y() += float(y - coords.y()) * grid.getVoxelSize();
         }
 
         const float halfVoxel = grid.getVoxelSize() / 2;
@@ -55,7 +67,7 @@ public:
     }
 
 public:
-    VoxelGrid<VoxelT> &grid;
+    ChunkedVoxelGrid<VoxelT> &grid;
     std::vector<Magnum::Vector3> agentInitialPositions;
     FallDetectionCallbacks &callbacks;
     int fallThreshold = -20;
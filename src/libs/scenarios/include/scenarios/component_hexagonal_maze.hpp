@@ -4,7 +4,7 @@
 #include <env/scenario_component.hpp>
 
 
-class HoneyCombMaze;
+struct CompactMaze;
 
 namespace Megaverse
 {
@@ -20,7 +20,8 @@ public:
 
     void addDrawablesAndCollisions(DrawablesMap &drawables, Env::EnvState &envState) const;
 
-    HoneyCombMaze & getMaze() const { return *maze; }
+    /// Shared with other envs, see HoneyCombMazePool.
+    const CompactMaze & getMaze() const { return *maze; }
 
     [[nodiscard]] float getScale() const { return mazeScale; }
     [[nodiscard]] int getSize() const { return mazeSize; }
@@ -37,7 +38,7 @@ private:
     ColorRgb bottomEdgingColor, topEdgingColor;
     float wallLandmarkProbability = 0.0f;
 
-    std::unique_ptr<HoneyCombMaze> maze;
+    const CompactMaze *maze = nullptr;
     double xMin = 0, xMax = 0, yMin = 0, yMax = 0;
 };
 
@@ -29,7 +29,7 @@ template<typename VoxelT>
 class ObjectStackingComponent : public ScenarioComponent
 {
 public:
-    explicit ObjectStackingComponent(Scenario &scenario, int numAgents, VoxelGrid<VoxelT> &grid, ObjectStackingCallbacks &callbacks)
+    explicit ObjectStackingComponent(Scenario &scenario, int numAgents, ChunkedVoxelGrid<VoxelT> &grid, ObjectStackingCallbacks &callbacks)
     : ScenarioComponent{scenario}
     , grid{grid}
     , carryingObject(size_t(numAgents), nullptr)
@@ -121,7 +121,7 @@ public:
                 obj->translate({float(voxel.x()) + 0.5f, float(voxel.y()) + 0.5f, float(voxel.z()) + 0.5f});
                 obj->syncPose();
 
-                obj->toggleCollision();
+                obj->setColliding(true);
 
                 carryingObject[agentIdx] = nullptr;
 
@@ -141,7 +141,7 @@ public:
 
                 if (voxelPtr && voxelPtr->physicsObject && !hasObjectAbove) {
                     auto obj = voxelPtr->physicsObject;
-                    obj->toggleCollision();
+                    obj->setColliding(false);
 
                     obj->setParent(agent);
                     auto scaling = obj->transformation().scaling();
@@ -176,17 +176,16 @@ public:
             const auto pos = movableObject;
             auto translation = Magnum::Vector3{float(pos.x()) + 0.5f, float(pos.y()) + 0.5f, float(pos.z()) + 0.5f};
 
-            auto bBoxShape = std::make_unique<btBoxShape>(btVector3{1, 1, 1});
-
-            auto &object = envState.scene->addChild<RigidBody>(envState.scene.get(), 0.0f, bBoxShape.get(), envState.physics->bWorld);
+            auto &object = envState.scene->addChild<RigidBody>(
+                envState.scene.get(), 0.0f, CollisionShapeCache::unitBox(), envState.physics->bWorld,
+                movableCollisionGroup, movableCollisionMask
+            );
             object.scale(objScale).translate(translation);
             object.setCollisionScale({1.15f, 1.15f, 1.15f});
             object.setCollisionOffset({0, -0.05f, 0});
             object.syncPose();
 
-            drawables[DrawableType::Box].emplace_back(&object, rgb(ColorRgb::MOVABLE_BOX));
-
-            envState.physics->collisionShapes.emplace_back(std::move(bBoxShape));
+            drawables[DrawableType::Box].emplace_back(&object, ColorRgb::MOVABLE_BOX);
 
             if (!grid.hasVoxel(pos)) {
                 VoxelT voxelState;
@@ -198,7 +197,7 @@ public:
     }
 
 private:
-    VoxelGrid<VoxelT> &grid;
+    ChunkedVoxelGrid<VoxelT> &grid;
 
     std::vector<RigidBody *> carryingObject;
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <unordered_map>
+
 #include <env/scenario_component.hpp>
 
 #include <scenarios/platforms.hpp>
@@ -19,9 +21,7 @@ public:
 
     void reset(Env &, Env::EnvState &) override
     {
-        platforms.clear();
-        levelRoot.reset();
-        levelRoot = std::make_unique<Object3D>(nullptr);
+        clearPlatforms();
     }
 
     void addPlatform(std::unique_ptr<Platform> platform)
@@ -29,9 +29,68 @@ public:
         platforms.emplace_back(std::move(platform));
     }
 
+    void clearPlatforms()
+    {
+        platforms.clear();
+        indexedBoxes.clear(), cells.clear();
+    }
+
+    /**
+     * Checks platform #platformIdx, which must be in its final position, against all platforms before its two
+     * predecessors (neighbours in the chain touch or overlap by design). Platforms before that are kept in a uniform
+     * grid over the XZ plane, so a check only visits the platforms nearby and a colliding layout can be rejected as
+     * soon as the offending platform is placed.
+     */
+    bool collidesWithEarlierPlatforms(int platformIdx)
+    {
+        // everything placed later is relative to these, so their boxes don't change anymore
+        while (int(indexedBoxes.size()) < platformIdx - 2) {
+            const auto idx = int(indexedBoxes.size());
+            indexedBoxes.emplace_back(platforms[idx]->platformBoundingBox());
+            forEachCell(indexedBoxes.back(), [this, idx](int64_t cell) { cells[cell].push_back(idx); });
+        }
+
+        const auto bb = platforms[platformIdx]->platformBoundingBox();
+
+        bool collides = false;
+        forEachCell(bb, [&](int64_t cell) {
+            const auto it = cells.find(cell);
+            if (collides || it == cells.end())
+                return;
+
+            for (auto idx : it->second)
+                if (indexedBoxes[idx].collidesWith(bb)) {
+                    TLOG(INFO) << "Platform " << platformIdx << " collides with " << idx;
+                    collides = true;
+                    break;
+                }
+        });
+
+        return collides;
+    }
+
+private:
+    template<typename F>
+    static void forEachCell(const BoundingBox &bb, F &&f)
+    {
+        // max is exclusive, boxes that only touch don't collide
+        const auto cellX = [](int x) { return x >= 0 ? x / cellSize : (x - cellSize + 1) / cellSize; };
+        for (int x = cellX(bb.min.x()); x <= cellX(bb.max.x() - 1); ++x)
+            for (int z = cellX(bb.min.z()); z <= cellX(bb.max.z() - 1); ++z)
+                f((int64_t(x) << 32) | int64_t(uint32_t(z)));
+    }
+
 public:
     std::vector<std::unique_ptr<Platform>> platforms;
-    std::unique_ptr<Object3D> levelRoot;
+    // the first platform starts at the origin of the grid
+    GridTransform levelRoot;
+
+private:
+    // a platform is a few voxels to a few dozen voxels long
+    static constexpr int cellSize = 8;
+
+    std::vector<BoundingBox> indexedBoxes;
+    std::unordered_map<int64_t, std::vector<int>> cells;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include <env/scenario_component.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Pickup and contact checks between agents and objects. Objects are registered with a contact radius and bucketed
+ * into a uniform hash grid in the XZ plane, so a query only looks at the nearby cells, and the distance tests are
+ * on squared lengths.
+ * Static objects keep the position they were added with. Dynamic objects are re-bucketed in step() if they moved.
+ */
+class ProximityComponent : public ScenarioComponent
+{
+public:
+    explicit ProximityComponent(Scenario &scenario, float cellSize = 2.0f)
+    : ScenarioComponent{scenario}
+    , cellSize{cellSize}
+    {
+    }
+
+    void reset(Env &, Env::EnvState &) override
+    {
+        objects.clear(), cells.clear(), dynamicObjects.clear();
+        maxRadius = 0;
+    }
+
+    /**
+     * Refresh positions of the dynamic objects, call this before the queries in the scenario step().
+     */
+    void step(Env &, Env::EnvState &) override
+    {
+        for (auto id : dynamicObjects) {
+            auto &o = objects[id];
+            if (!o.active)
+                continue;
+
+            o.position = o.object->absoluteTransformation().translation();
+            const auto cell = cellKey(o.position);
+            if (cell != o.cell) {
+                removeFromCell(id);
+                o.cell = cell;
+                cells[cell].push_back(id);
+            }
+        }
+    }
+
+    /**
+     * @return id of the object, ids are indices in the order of registration and are valid until reset().
+     */
+    int addStatic(const Magnum::Vector3 &position, float radius, int tag = 0, Object3D *object = nullptr)
+    {
+        const int id = int(objects.size());
+        objects.push_back({object, position, sqr(radius), tag, cellKey(position), true});
+        cells[objects.back().cell].push_back(id);
+        maxRadius = std::max(maxRadius, radius);
+        return id;
+    }
+
+    int addDynamic(Object3D *object, float radius, int tag = 0)
+    {
+        const int id = addStatic(object->absoluteTransformation().translation(), radius, tag, object);
+        dynamicObjects.push_back(id);
+        return id;
+    }
+
+    /**
+     * Object won't be reported by the queries anymore.
+     */
+    void remove(int id)
+    {
+        if (!objects[id].active)
+            return;
+
+        removeFromCell(id);
+        objects[id].active = false;
+    }
+
+    bool active(int id) const { return objects[id].active; }
+
+    int tag(int id) const { return objects[id].tag; }
+
+    Object3D * object(int id) const { return objects[id].object; }
+
+    const Magnum::Vector3 & position(int id) const { return objects[id].position; }
+
+    /**
+     * Call func(id) for every active object whose contact radius contains the point.
+     */
+    template<typename Func>
+    void forEachNear(const Magnum::Vector3 &point, Func &&func)
+    {
+        const int r = int(std::ceil(maxRadius / cellSize));
+        const int cx = cellCoord(point.x()), cz = cellCoord(point.z());
+
+        found.clear();
+        for (int x = cx - r; x <= cx + r; ++x)
+            for (int z = cz - r; z <= cz + r; ++z) {
+                auto it = cells.find(cellKey(x, z));
+                if (it == cells.end())
+                    continue;
+
+                for (auto id : it->second)
+                    if ((objects[id].position - point).dot() < objects[id].radiusSq)
+                        found.push_back(id);
+            }
+
+        // callbacks are called after the lookup, so they are free to remove objects
+        for (auto id : found)
+            if (objects[id].active)
+                func(id);
+    }
+
+    /**
+     * Contacts of all agents in the env, evaluated in one pass. Calls func(agentIdx, id) in the agent order, an object
+     * removed in the callback is not reported for the following agents.
+     */
+    template<typename Func>
+    void forEachAgentContact(Env &env, Env::EnvState &envState, Func &&func)
+    {
+        contacts.clear();
+        for (int i = 0; i < env.getNumAgents(); ++i) {
+            const auto t = envState.agents[i]->absoluteTransformation().translation();
+            forEachNear(t, [&](int id) { contacts.emplace_back(i, id); });
+        }
+
+        for (const auto &[agentIdx, id] : contacts)
+            if (objects[id].active)
+                func(agentIdx, id);
+    }
+
+private:
+    int cellCoord(float v) const { return int(std::floor(v / cellSize)); }
+
+    static int64_t cellKey(int x, int z) { return (int64_t(x) << 32) | uint32_t(z); }
+
+    int64_t cellKey(const Magnum::Vector3 &p) const { return cellKey(cellCoord(p.x()), cellCoord(p.z())); }
+
+    void removeFromCell(int id)
+    {
+        auto &cell = cells[objects[id].cell];
+        cell.erase(std::find(cell.begin(), cell.end(), id));
+    }
+
+private:
+    struct Object
+    {
+        Object3D *object;
+        Magnum::Vector3 position;
+        float radiusSq;
+        int tag;
+        int64_t cell;
+        bool active;
+    };
+
+    float cellSize, maxRadius = 0;
+
+    std::vector<Object> objects;
+    std::unordered_map<int64_t, std::vector<int>> cells;
+    std::vector<int> dynamicObjects;
+
+    // scratch buffers reused between the queries
+    std::vector<int> found;
+    std::vector<std::pair<int, int>> contacts;
+};
+
+}
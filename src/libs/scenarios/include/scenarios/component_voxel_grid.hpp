@@ -1,7 +1,12 @@
 #pragma once
 
+#include <limits>
+#include <vector>
+#include <utility>
 #include <unordered_set>
 
+#include <Magnum/Math/Functions.h>
+
 #include <util/voxel_grid.hpp>
 
 #include <env/scenario_component.hpp>
@@ -50,6 +55,10 @@ public:
 };
 
 
+template<typename T, typename = void> struct HasPhysicsObject : std::false_type {};
+template<typename T> struct HasPhysicsObject<T, std::void_t<decltype(std::declval<T>().physicsObject)>> : std::true_type {};
+
+
 // comment this to disable voxel layout optimization, i.e. for ablation study
 #define OPTIMIZE_VOXEL_LAYOUT
 
@@ -59,8 +68,11 @@ public:
  * @tparam VoxelT data stored in each non-empty voxel cell.
  */
 template<typename VoxelT>
-class VoxelGridComponent : public ScenarioComponent
+class VoxelGridComponent : public ScenarioComponent, public LayoutCollisionQuery, public LayoutVoxelQuery
 {
+public:
+    using VoxelSnapshot = typename ChunkedVoxelStorage<VoxelT>::SharedChunks;
+
 public:
     explicit VoxelGridComponent(Scenario &scenario, int maxVoxelsXYZ = 100, float minX = 0, float minY = 0, float minZ = 0, float voxelSize = 1)
     : ScenarioComponent{scenario}
@@ -70,6 +82,60 @@ public:
 
     void reset(Env &, Env::EnvState &) override { grid.clear(); }
 
+    /**
+     * Layout bodies are generated from the solid voxels (see addLayoutBoxes()), so we can tell whether the volume is
+     * free just by scanning the voxel columns.
+     */
+    bool layoutInAabb(const btVector3 &aabbMin, const btVector3 &aabbMax) const override
+    {
+        if constexpr (!HasVoxelType<VoxelT>::value) {
+            // no type information, cannot rule out any collisions
+            return true;
+        } else {
+            const auto minCoords = grid.getCoords(Magnum::Vector3{aabbMin}), maxCoords = grid.getCoords(Magnum::Vector3{aabbMax});
+
+            for (int x = minCoords.x(); x <= maxCoords.x(); ++x)
+                for (int z = minCoords.z(); z <= maxCoords.z(); ++z)
+                    if (grid.anyInColumn(x, z, minCoords.y(), maxCoords.y(), VOXEL_SOLID))
+                        return true;
+
+            return false;
+        }
+    }
+
+    VoxelCoords voxelCoords(const Magnum::Vector3 &position) const override { return grid.getCoords(position); }
+
+    Magnum::Vector3 gridOrigin() const override { return grid.getOrigin(); }
+
+    float voxelSize() const override { return grid.getVoxelSize(); }
+
+    bool voxel(const VoxelCoords &coords, SymbolicVoxel &v) const override
+    {
+        const auto *stored = grid.get(coords);
+        if (!stored)
+            return false;
+
+        v = symbolicVoxel(*stored);
+        return true;
+    }
+
+    void forEachVoxel(const VoxelFunc &func) const override
+    {
+        grid.forEach([&](const VoxelCoords &coords, const VoxelT &stored) { func(coords, symbolicVoxel(stored)); });
+    }
+
+    /**
+     * Immutable copy of the current voxels, i.e. to cache the generated layout and restore it later without
+     * regenerating. Should be taken before any scene objects are referenced by the voxels.
+     */
+    VoxelSnapshot snapshot() const { return grid.share(); }
+
+    /**
+     * The grid references the snapshot chunks and copies only the ones it writes to (objects, rewards), so envs
+     * that replay the same layout share its voxels.
+     */
+    void restore(const VoxelSnapshot &voxels) { grid.restore(voxels); }
+
     void addPlatform(const Platform &p, ColorRgb layoutColor, ColorRgb wallColor, bool drawWalls = true)
     {
         for (auto &bb : p.layoutBoxes)
@@ -105,31 +171,58 @@ public:
                 }
     }
 
+    /**
+     * Greedily merge voxels of the same type and color into parallelepipeds.
+     * Voxels are copied into a dense scratch volume first, so all the neighbourhood checks during the expansion are
+     * just array lookups. Scratch buffers are kept between episodes.
+     */
     std::map<BBoxInfo, Boxes> toBoundingBoxes()
     {
         const static Magnum::Vector3i directions[] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
 
-        std::unordered_set<VoxelCoords> visited;
+        std::map<BBoxInfo, Boxes> boxesByVoxelType;
 
-        const auto gridHashMap = grid.getHashMap();
+        // voxels in the grid iteration order, this defines the order in which the boxes are grown
+        scratchVoxels.clear();
+        VoxelCoords minCoords{std::numeric_limits<int>::max()}, maxCoords{std::numeric_limits<int>::min()};
 
-        std::map<BBoxInfo, Boxes> boxesByVoxelType;
+        grid.forEach([&](const VoxelCoords &coord, const VoxelT &) {
+            scratchVoxels.emplace_back(coord);
+            minCoords = Magnum::Math::min(minCoords, coord);
+            maxCoords = Magnum::Math::max(maxCoords, coord);
+        });
+
+        if (scratchVoxels.empty())
+            return boxesByVoxelType;
+
+        const auto dims = maxCoords - minCoords + VoxelCoords{1};
+        const auto volume = size_t(dims.x()) * size_t(dims.y()) * size_t(dims.z());
+
+        const auto denseIdx = [&](int x, int y, int z) {
+            return (size_t(x - minCoords.x()) * size_t(dims.y()) + size_t(y - minCoords.y())) * size_t(dims.z()) + size_t(z - minCoords.z());
+        };
+
+        // (voxelType, color) packed into one key, empty voxels are marked with emptyKey
+        constexpr uint32_t emptyKey = std::numeric_limits<uint32_t>::max();
+        const auto voxelKey = [](const VoxelT &v) { return (uint32_t(v.color) << 8) | uint32_t(v.voxelType); };
 
-        for (auto it : gridHashMap) {
-            const auto &coord = it.first;
-            const auto &voxel = it.second;
-            const auto voxelType = voxel.voxelType;
-            const auto color = voxel.color;
+        scratchKeys.assign(volume, emptyKey);
+        scratchVisited.assign(volume, false);
 
-            if (visited.count(coord)) {
+        for (const auto &coord : scratchVoxels)
+            scratchKeys[denseIdx(coord.x(), coord.y(), coord.z())] = voxelKey(*std::as_const(grid).get(coord));
+
+        for (const auto &coord : scratchVoxels) {
+            const auto startIdx = denseIdx(coord.x(), coord.y(), coord.z());
+            if (scratchVisited[startIdx]) {
                 // already processed this voxel
                 continue;
             }
 
-            visited.emplace(coord);
+            scratchVisited[startIdx] = true;
 
+            const auto key = scratchKeys[startIdx];
             BoundingBox bbox{coord, coord};
-            std::vector<VoxelCoords> expansion;
 
 #ifdef OPTIMIZE_VOXEL_LAYOUT
             // try to expand the parallelepiped in every direction as far as we can
@@ -137,39 +230,42 @@ public:
                 for (int sign = -1; sign <= 1; sign += 2) {
                     auto d = direction * sign;
 
-                    bool canExpand = true;
-
                     // expanding in a specific direction as far as we can
                     while (true) {
                         const auto xlim = startEndCoord(bbox.min.x(), bbox.max.x(), d.x());
                         const auto ylim = startEndCoord(bbox.min.y(), bbox.max.y(), d.y());
                         const auto zlim = startEndCoord(bbox.min.z(), bbox.max.z(), d.z());
 
-                        expansion.clear();
+                        // the slab is outside of the occupied volume
+                        if (xlim.min < minCoords.x() || xlim.max > maxCoords.x() ||
+                            ylim.min < minCoords.y() || ylim.max > maxCoords.y() ||
+                            zlim.min < minCoords.z() || zlim.max > maxCoords.z())
+                            break;
 
-                        for (auto x = xlim.min; x <= xlim.max; ++x)
-                            for (auto y = ylim.min; y <= ylim.max; ++y)
-                                for (auto z = zlim.min; z <= zlim.max; ++z) {
-                                    const VoxelCoords coords{x, y, z};
-                                    const auto v = grid.get(coords);
-                                    if (!v || v->voxelType != voxelType || v->color != color || visited.count(coords)) {
+                        bool canExpand = true;
+                        for (auto x = xlim.min; x <= xlim.max && canExpand; ++x)
+                            for (auto y = ylim.min; y <= ylim.max && canExpand; ++y) {
+                                const auto rowIdx = denseIdx(x, y, zlim.min);
+                                for (auto i = rowIdx; i <= rowIdx + size_t(zlim.max - zlim.min); ++i)
+                                    if (scratchKeys[i] != key || scratchVisited[i]) {
                                         // we could not expand in this direction
                                         canExpand = false;
-                                        goto afterLoop;
+                                        break;
                                     }
-
-                                    expansion.emplace_back(coords);
-                                }
-
-                        afterLoop:
+                            }
 
                         if (!canExpand)
                             break;
 
-                        for (auto newVoxelCoord : expansion) {
-                            visited.emplace(newVoxelCoord);
-                            bbox.addPoint(newVoxelCoord);
-                        }
+                        for (auto x = xlim.min; x <= xlim.max; ++x)
+                            for (auto y = ylim.min; y <= ylim.max; ++y) {
+                                const auto rowIdx = denseIdx(x, y, zlim.min);
+                                for (auto i = rowIdx; i <= rowIdx + size_t(zlim.max - zlim.min); ++i)
+                                    scratchVisited[i] = true;
+                            }
+
+                        bbox.addPoint({xlim.min, ylim.min, zlim.min});
+                        bbox.addPoint({xlim.max, ylim.max, zlim.max});
                     }
                 }
             }
@@ -180,14 +276,38 @@ public:
             // finished expanding in all possible directions
             // the bounding box defines the parallepiped completely filled by solid voxels
             // we can draw only this parallelepiped (8 vertices) instead of drawing individual voxels, saving a ton of time
-            boxesByVoxelType[{voxelType, color}].emplace_back(bbox);
+            const auto &voxel = *std::as_const(grid).get(coord);
+            boxesByVoxelType[{voxel.voxelType, voxel.color}].emplace_back(bbox);
         }
 
         return boxesByVoxelType;
     }
 
+    /// Voxels and the scratch buffers, for Scenario::memoryReport().
+    size_t memoryBytes() const
+    {
+        return grid.memoryBytes() + vectorBytes(scratchVoxels) + vectorBytes(scratchKeys) + vectorBytes(scratchVisited);
+    }
+
+private:
+    static SymbolicVoxel symbolicVoxel(const VoxelT &stored)
+    {
+        SymbolicVoxel v;
+        v.voxelType = stored.voxelType, v.terrain = stored.terrain, v.color = stored.color;
+        if constexpr (HasPhysicsObject<VoxelT>::value)
+            v.object = stored.physicsObject != nullptr;
+
+        return v;
+    }
+
+private:
+    // scratch buffers for toBoundingBoxes(), to avoid allocations on every reset
+    std::vector<VoxelCoords> scratchVoxels;
+    std::vector<uint32_t> scratchKeys;
+    std::vector<bool> scratchVisited;
+
 public:
-    VoxelGrid<VoxelT> grid;
+    ChunkedVoxelGrid<VoxelT> grid;
 };
 
 }
\ No newline at end of file
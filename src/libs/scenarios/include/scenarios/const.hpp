@@ -19,6 +19,8 @@ namespace Megaverse::Str
              obstaclesNumAllowedMaxDifficulty = "obstaclesNumAllowedMaxDifficulty",
              obstaclesAgentCarriedObjectToExit = "obstaclesAgentCarriedObjectToExit";
 
+    ConstStr layoutCacheSize = "layoutCacheSize";
+
     ConstStr towerPickedUpObject = "towerPickedUpObject",
              towerVisitedBuildingZoneWithObject = "towerVisitedBuildingZoneWithObject",
              towerBuildingReward = "towerBuildingReward";
@@ -26,7 +28,9 @@ namespace Megaverse::Str
     ConstStr collectSingleGood = "collectSingleGood",
              collectSingleBad = "collectSingleBad",
              collectAll = "collectAll",
-             collectAbyss = "collectAbyss";
+             collectAbyss = "collectAbyss",
+             collectHeightmapPoolSize = "collectHeightmapPoolSize",
+             collectHeightmapPoolSeed = "collectHeightmapPoolSeed";
 
     ConstStr sokobanBoxOnTarget = "sokobanBoxOnTarget",
              sokobanBoxLeavesTarget = "sokobanBoxLeavesTarget",
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+
+namespace Megaverse
+{
+
+/**
+ * Precomputed Perlin noise fields for the CollectScenario terrain, shared by all envs in the process.
+ * Field #i depends only on (size, poolSize, poolSeed, i), so the layouts are reproducible no matter which thread
+ * computed the field or when. A background thread generates the whole pool when it is first requested, and a reset
+ * that needs a field before it is ready just computes that field itself.
+ */
+class HeightmapPool
+{
+public:
+    struct Heightmap
+    {
+        /// noise in [0, 1] on a size x size grid, index x * size + z
+        std::vector<double> noise;
+    };
+
+public:
+    /// One pool per parameter set, created lazily. Thread-safe.
+    static HeightmapPool & get(int size, int poolSize, uint32_t poolSeed);
+
+    HeightmapPool(int size, int poolSize, uint32_t poolSeed);
+
+    ~HeightmapPool();
+
+    int size() const { return mapSize; }
+
+    int poolSize() const { return int(entries.size()); }
+
+    /// Thread-safe, blocks only if this field is being generated on another thread right now.
+    const Heightmap & heightmap(int idx);
+
+    /**
+     * Noise at (x, z) of a field viewed through one of the 8 symmetries of the square (transform in [0, 8):
+     * bit 0 swaps the axes, bits 1 and 2 mirror x and z), which multiplies the number of distinct terrains.
+     */
+    double noise(const Heightmap &h, int transform, int x, int z) const
+    {
+        if (transform & 1)
+            std::swap(x, z);
+        if (transform & 2)
+            x = mapSize - 1 - x;
+        if (transform & 4)
+            z = mapSize - 1 - z;
+
+        return h.noise[x * mapSize + z];
+    }
+
+private:
+    void generate(int idx);
+
+    void backgroundLoop();
+
+private:
+    struct Entry
+    {
+        std::once_flag generated;
+        Heightmap heightmap;
+    };
+
+    int mapSize;
+    uint32_t poolSeed;
+
+    std::vector<Entry> entries;
+
+    std::atomic<bool> stop{false};
+    std::thread background;
+};
+
+}
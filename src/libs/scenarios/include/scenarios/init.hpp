@@ -1,6 +1,7 @@
 #pragma once
 
 #include <env/scenario.hpp>
+#include <env/env_step.hpp>
 
 #include <scenarios/scenario_empty.hpp>
 #include <scenarios/scenario_sokoban.hpp>
@@ -20,7 +21,7 @@ namespace Megaverse
 template <typename ScenarioType>
 void registerScenario(const std::string &name)
 {
-    Scenario::registerScenario(name, Scenario::scenarioFactory<ScenarioType>);
+    Scenario::registerScenario(name, Scenario::scenarioFactory<ScenarioType>, stepScenario<ScenarioType>);
 }
 
 void scenariosGlobalInit()
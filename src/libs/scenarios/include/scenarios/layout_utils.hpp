@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 #include <util/voxel_grid.hpp>
 
 #include <env/env.hpp>
@@ -9,15 +11,26 @@
 
 namespace Megaverse
 {
+    /**
+     * Adds drawables and static collisions for the merged layout boxes.
+     * If EnvState::compoundStaticLayout is set, all solid boxes go into a single btCompoundShape with one rigid body,
+     * otherwise every box gets its own rigid body.
+     */
+    void addLayoutBoxes(DrawablesMap &drawables, Env::EnvState &envState, const std::map<BBoxInfo, Boxes> &boxesByType, float voxelSize);
+
     template<typename VoxelT>
     void addDrawablesAndCollisionObjectsFromVoxelGrid(VoxelGridComponent<VoxelT> &vg, DrawablesMap &drawables, Env::EnvState &envState, float voxelSize)
     {
-        auto boundingBoxesByType = vg.toBoundingBoxes();
-        for (auto &[bbInfo, bb] : boundingBoxesByType)
-            addBoundingBoxes(drawables, envState, bb, bbInfo.type, bbInfo.color, voxelSize);
+        addLayoutBoxes(drawables, envState, vg.toBoundingBoxes(), voxelSize);
     }
 
-    void addBoundingBoxes(DrawablesMap &drawables, Env::EnvState &envState, const Boxes &boxes, int voxelType, ColorRgb color, float voxelSize);
+    /**
+     * Key for the layout cache. Layout is fully determined by the scenario, its parameters, number of agents and the
+     * seed that Env::reset() uses to generate the episode.
+     */
+    std::string layoutCacheKey(const std::string &scenarioName, const FloatParams &params, int numAgents, int layoutSeed);
+
+    void addBoundingBoxes(DrawablesMap &drawables, Env::EnvState &envState, const Boxes &boxes, int voxelType, ColorRgb color, float voxelSize, bool addCollisions = true);
     void addTerrain(DrawablesMap &drawables, Env::EnvState &envState, TerrainType type, const BoundingBox &bb, float voxelSize = 1.0f);
 
     void addStaticCollidingBox(
@@ -110,40 +110,86 @@ public:
 };
 
 
-struct MagnumAABB
+/**
+ * Placement of a platform in the voxel grid: rotation about the Y axis by a multiple of 90 degrees, followed by
+ * a translation. Integer math only, same conventions as Object3D::rotateY() and translate().
+ */
+struct GridTransform
 {
-    MagnumAABB(Object3D &parent, const BoundingBox &bb)
-    : min(&parent.addChild<Object3D>())
-    , max(&parent.addChild<Object3D>())
+    static GridTransform translation(const VoxelCoords &t) { return GridTransform{0, t}; }
+
+    static GridTransform rotationY(int quarterTurns) { return GridTransform{quarterTurns & 3, {0, 0, 0}}; }
+
+    /// Applies local first, i.e. like the *Local() methods of Object3D.
+    [[nodiscard]] GridTransform operator*(const GridTransform &local) const
+    {
+        return GridTransform{(quarterTurns + local.quarterTurns) & 3, rotate(local.translation) + translation};
+    }
+
+    [[nodiscard]] VoxelCoords transformPoint(const VoxelCoords &p) const { return rotate(p) + translation; }
+
+    [[nodiscard]] Magnum::Vector3 transformPoint(const Magnum::Vector3 &p) const
+    {
+        return rotate(p) + Magnum::Vector3{translation};
+    }
+
+    template<typename V>
+    [[nodiscard]] V rotate(const V &v) const
+    {
+        // counter-clockwise when looking down the Y axis: (x, z) -> (z, -x)
+        switch (quarterTurns) {
+            case 1: return {v.z(), v.y(), -v.x()};
+            case 2: return {-v.x(), v.y(), -v.z()};
+            case 3: return {-v.z(), v.y(), v.x()};
+            default: return v;
+        }
+    }
+
+public:
+    int quarterTurns = 0;
+    VoxelCoords translation{0, 0, 0};
+};
+
+
+/**
+ * Box in the local coordinates of a platform. It follows the platform when it is moved or rotated, the box in the
+ * grid is computed on demand.
+ */
+struct PlatformAABB
+{
+    PlatformAABB(const GridTransform &frame, const BoundingBox &bb)
+    : frame{&frame}
+    , local{bb}
     {
-        min->translateLocal(Magnum::Vector3(bb.min));
-        max->translateLocal(Magnum::Vector3(bb.max));
     }
 
     [[nodiscard]] BoundingBox boundingBox() const
     {
-        BoundingBox bb;
-        bb.min = Magnum::Math::lround(min->absoluteTransformation().translation());
-        bb.max = Magnum::Math::lround(max->absoluteTransformation().translation());
+        BoundingBox bb{frame->transformPoint(local.min), frame->transformPoint(local.max)};
         bb.sort();
         return bb;
     }
 
 public:
-    Object3D *min, *max;
+    const GridTransform *frame;
+    BoundingBox local;
 };
 
 
 class Platform
 {
 public:
-    explicit Platform(Object3D *parent, Rng &rng, int walls, const FloatParams &params)
+    explicit Platform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params)
     : rng{rng}
     , walls{walls}
-    , root{&parent->addChild<Object3D>()}
+    , root{parent}
     , params{params}
     {
     }
+
+    // boxes refer to the root of the platform
+    Platform(const Platform &) = delete;
+    Platform & operator=(const Platform &) = delete;
     virtual ~Platform() = default;
 
     virtual void init() = 0;
@@ -152,25 +198,23 @@ public:
 
     virtual void rotateCCW(int /*previousPlatformWidth*/)
     {
-        root->rotateYLocal(degrees(90.0));
-        root->translateLocal({-1, 0, -1});
+        root = root * GridTransform::rotationY(1) * GridTransform::translation({-1, 0, -1});
     }
 
     virtual void rotateCW(int previousPlatformWidth)
     {
-        root->rotateYLocal(degrees(-90.0));
-        root->translateLocal({float(previousPlatformWidth) - 1, 0, -float(width) + 1});
+        root = root * GridTransform::rotationY(-1) * GridTransform::translation({previousPlatformWidth - 1, 0, -width + 1});
     }
 
-    virtual Object3D * anchorPoint() { return nextPlatformAnchor; }
+    /// Where the next platform starts, follows the rotation of this one.
+    GridTransform anchorPoint() const { return root * GridTransform::translation(nextPlatformAnchor); }
 
     virtual void addFloor()
     {
-        MagnumAABB floor{*root, {0, 0, 0, length, 1, width}};
+        PlatformAABB floor{root, {0, 0, 0, length, 1, width}};
         layoutBoxes.emplace_back(floor);
 
-        nextPlatformAnchor = &root->addChild<Object3D>();
-        nextPlatformAnchor->translateLocal({float(length), 0, 0});
+        nextPlatformAnchor = {length, 0, 0};
 
         boundingBoxDirty = true;
     }
@@ -178,13 +222,13 @@ public:
     virtual void addWalls()
     {
         if (walls & WALLS_SOUTH)
-            wallBoxes.emplace_back(MagnumAABB{*root, {0, 0, 0, 1, height, width}});
+            wallBoxes.emplace_back(PlatformAABB{root, {0, 0, 0, 1, height, width}});
         if (walls & WALLS_NORTH)
-            wallBoxes.emplace_back(MagnumAABB{*root, {length - 1, 0, 0, length, height, width}});
+            wallBoxes.emplace_back(PlatformAABB{root, {length - 1, 0, 0, length, height, width}});
         if (walls & WALLS_EAST)
-            wallBoxes.emplace_back(MagnumAABB{*root, {0, 0, 0, length, height, 1}});
+            wallBoxes.emplace_back(PlatformAABB{root, {0, 0, 0, length, height, 1}});
         if (walls & WALLS_WEST)
-            wallBoxes.emplace_back(MagnumAABB{*root, {0, 0, width - 1, length, height, width}});
+            wallBoxes.emplace_back(PlatformAABB{root, {0, 0, width - 1, length, height, width}});
 
         boundingBoxDirty = true;
     }
@@ -269,7 +313,7 @@ public:
     {
         for (auto &c : coords) {
             Magnum::Vector3 v{c.x() + 0.5f, c.y() + 0.5f, c.z() + 0.5f};
-            c = toVoxel(root->absoluteTransformation().transformPoint(v));
+            c = toVoxel(root.transformPoint(v));
         }
 
         return coords;
@@ -290,10 +334,13 @@ public:
     // length = x, height = y, width = z
     int length{}, height{}, width{};
 
-    std::vector<MagnumAABB> layoutBoxes, wallBoxes;
-    std::map<TerrainType, std::vector<MagnumAABB>> terrainBoxes;
+    std::vector<PlatformAABB> layoutBoxes, wallBoxes;
+    std::map<TerrainType, std::vector<PlatformAABB>> terrainBoxes;
+
+    GridTransform root;
 
-    Object3D *nextPlatformAnchor{}, *root{};
+    // in the local coordinates of the platform, see anchorPoint()
+    VoxelCoords nextPlatformAnchor{0, 0, 0};
 
     bool boundingBoxDirty = true;
     BoundingBox outerBoundingBox;
@@ -306,7 +353,7 @@ public:
 class EmptyPlatform : public Platform
 {
 public:
-    explicit EmptyPlatform(Object3D *parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
+    explicit EmptyPlatform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
         : Platform{parent, rng, walls, params}
     {
         width = w;
@@ -332,7 +379,7 @@ public:
 class WallPlatform : public EmptyPlatform
 {
 public:
-    explicit WallPlatform(Object3D *parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
+    explicit WallPlatform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
         : EmptyPlatform{parent, rng, walls, params, w}
     {
     }
@@ -352,7 +399,7 @@ public:
         const auto wallX = randRange(1, length, rng);
         const auto wallThickness = randRange(1, length - wallX + 1, rng);
 
-        MagnumAABB wall{*root, {wallX, 1, 1, wallX + wallThickness, 1 + wallHeight, width - 1}};
+        PlatformAABB wall{root, {wallX, 1, 1, wallX + wallThickness, 1 + wallHeight, width - 1}};
         layoutBoxes.emplace_back(wall);
 
         // this way we won't generate boxes on top of the wall (for the most part)
@@ -375,7 +422,7 @@ private:
 class LavaPlatform : public EmptyPlatform
 {
 public:
-    explicit LavaPlatform(Object3D *parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
+    explicit LavaPlatform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
         : EmptyPlatform{parent, rng, walls, params, w}
     {
     }
@@ -395,7 +442,7 @@ public:
 
         const auto lavaX = randRange(1, length - lavaLength, rng);
 
-        MagnumAABB lava{*root, {lavaX, 1, 1, lavaX + lavaLength, 2, width - 1}};
+        PlatformAABB lava{root, {lavaX, 1, 1, lavaX + lavaLength, 2, width - 1}};
         terrainBoxes[TERRAIN_LAVA].emplace_back(lava);
     }
 
@@ -410,7 +457,7 @@ private:
 class StepPlatform : public EmptyPlatform
 {
 public:
-    explicit StepPlatform(Object3D *parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
+    explicit StepPlatform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
         : EmptyPlatform{parent, rng, walls, params, w}
     {
     }
@@ -426,16 +473,15 @@ public:
     void generate() override
     {
         const auto stepX = randRange(1, length, rng);
-        MagnumAABB floorLow{*root, {0, 0, 0, stepX + 1, 1, width}};
-        MagnumAABB floorHigh{*root, {stepX, stepHeight, 0, length, stepHeight + 1, width}};
-        MagnumAABB wall{*root, {stepX, 0, 0, stepX + 1, stepHeight + 1, width}};
+        PlatformAABB floorLow{root, {0, 0, 0, stepX + 1, 1, width}};
+        PlatformAABB floorHigh{root, {stepX, stepHeight, 0, length, stepHeight + 1, width}};
+        PlatformAABB wall{root, {stepX, 0, 0, stepX + 1, stepHeight + 1, width}};
 
         layoutBoxes.emplace_back(floorLow);
         layoutBoxes.emplace_back(floorHigh);
         layoutBoxes.emplace_back(wall);
 
-        nextPlatformAnchor = &root->addChild<Object3D>();
-        nextPlatformAnchor->translateLocal({float(length), float(stepHeight), 0});
+        nextPlatformAnchor = {length, stepHeight, 0};
 
         addWalls();
 
@@ -460,7 +506,7 @@ private:
 class GapPlatform : public EmptyPlatform
 {
 public:
-    explicit GapPlatform(Object3D *parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
+    explicit GapPlatform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params, int w = -1)
         : EmptyPlatform{parent, rng, walls, params, w}
     {
     }
@@ -475,14 +521,13 @@ public:
 
     void generate() override
     {
-        MagnumAABB floorStart{*root, {0, 0, 0, gapX, 1, width}};
-        MagnumAABB floorEnd{*root, {gapX + gap, 0, 0, length, 1, width}};
+        PlatformAABB floorStart{root, {0, 0, 0, gapX, 1, width}};
+        PlatformAABB floorEnd{root, {gapX + gap, 0, 0, length, 1, width}};
 
         layoutBoxes.emplace_back(floorStart);
         layoutBoxes.emplace_back(floorEnd);
 
-        nextPlatformAnchor = &root->addChild<Object3D>();
-        nextPlatformAnchor->translateLocal({float(length), 0, 0});
+        nextPlatformAnchor = {length, 0, 0};
 
         addWalls();
     }
@@ -516,7 +561,7 @@ private:
 class StartPlatform : public EmptyPlatform
 {
 public:
-    explicit StartPlatform(Object3D *parent, Rng &rng, const FloatParams &params, int w = -1)
+    explicit StartPlatform(const GridTransform &parent, Rng &rng, const FloatParams &params, int w = -1)
         : EmptyPlatform{parent, rng, WALLS_SOUTH | WALLS_EAST | WALLS_WEST, params, w}
     {
     }
@@ -530,7 +575,7 @@ public:
 class ExitPlatform : public EmptyPlatform
 {
 public:
-    explicit ExitPlatform(Object3D *parent, Rng &rng, const FloatParams &params, int w = -1)
+    explicit ExitPlatform(const GridTransform &parent, Rng &rng, const FloatParams &params, int w = -1)
         : EmptyPlatform{parent, rng, WALLS_NORTH | WALLS_EAST | WALLS_WEST, params, w}
     {
     }
@@ -539,7 +584,7 @@ public:
     {
         EmptyPlatform::generate();
 
-        MagnumAABB exit{*root, {length - 3, 1, 1, length - 1, 3, width - 1}};
+        PlatformAABB exit{root, {length - 3, 1, 1, length - 1, 3, width - 1}};
         terrainBoxes[TERRAIN_EXIT].emplace_back(exit);
     }
 };
@@ -547,7 +592,7 @@ public:
 class TransitionPlatform : public EmptyPlatform
 {
 public:
-    explicit TransitionPlatform(Object3D *parent, Rng &rng, int walls, const FloatParams &params, int l, int w)
+    explicit TransitionPlatform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params, int l, int w)
         : EmptyPlatform{parent, rng, walls, params, -1}
     {
         length = l, width = w;
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <deque>
+#include <array>
 
 #include <scenarios/scenario_default.hpp>
 #include <scenarios/layout_utils.hpp>
@@ -15,6 +15,9 @@ namespace Megaverse
 struct VoxelBoxAGone : public VoxelState
 {
     RigidBody *disappearingPlatform = nullptr;
+
+    // index in platformStates once an agent stepped on this platform
+    int platformState = -1;
 } __attribute__((aligned(8)));
 
 class BoxAGoneScenario : public DefaultScenario, public FallDetectionCallbacks
@@ -25,16 +28,20 @@ private:
     struct AgentState
     {
         RigidBody *lastPlatform = nullptr;
+        int lastPlatformState = -1;
         float secondsBeforeTouchedFloor = 0.0f;
     };
 
     struct PlatformState
     {
-        int remainingTicks = 0;
+        // the platform disappears during this tick
+        int expireTick = 0;
         VoxelCoords coords;
         RigidBody *temporaryPlatform = nullptr;
     } __attribute__((aligned(32)));
 
+    constexpr static int platformTicks = 15, leftPlatformTicks = 3, growingTicks = 5;
+
 public:
     explicit BoxAGoneScenario(const std::string &name, Env &env, Env::EnvState &envState);
 
@@ -49,8 +56,17 @@ public:
 
     void addEpisodeDrawables(DrawablesMap &drawables) override;
 
+    void memoryReport(MemoryReport &report) const override { report.add("voxel_grid", vg.memoryBytes()); }
+
+    const LayoutVoxelQuery * layoutVoxelQuery() const override { return &vg; }
+
     void addDisappearingPlatforms(DrawablesMap &drawables);
 
+    /**
+     * Platform disappears at the given tick, unless it is already scheduled to disappear earlier.
+     */
+    void scheduleExpiration(int stateIdx, int tick);
+
     /**
      * Different trueObjective depending on whether this is a single-agent or competitive setting.
      */
@@ -108,8 +124,17 @@ private:
     std::vector<VoxelCoords> spawnPositions;
 
     std::vector<AgentState> agentStates;
-    std::map<RigidBody *, PlatformState> platformStates;
-    std::deque<RigidBody *> extraPlatforms;
+
+    /**
+     * States of the visited platforms, never erased during the episode. The timer wheel buckets the states by
+     * expiration tick, an entry is stale if the timer of the platform was shortened in the meantime.
+     */
+    std::vector<PlatformState> platformStates;
+    std::array<std::vector<int>, platformTicks + 1> timerWheel;
+    int currTick = 0;
+
+    std::vector<RigidBody *> extraPlatforms;
+    int nextExtraPlatform = 0;
 };
 
 }
\ No newline at end of file
@@ -37,6 +37,14 @@ public:
 
     void addEpisodeDrawables(DrawablesMap &drawables) override;
 
+    const LayoutCollisionQuery * layoutCollisionQuery() const override { return &vg; }
+
+    void memoryReport(MemoryReport &report) const override { report.add("voxel_grid", vg.memoryBytes()); }
+
+    const LayoutVoxelQuery * layoutVoxelQuery() const override { return &vg; }
+
+    BatchedComponents batchedComponents() override { return {&fallDetection}; }
+
     float trueObjective(int /*agentIdx*/) const override { return solved; }
 
     RewardShaping defaultRewardShaping() const override
@@ -49,6 +57,17 @@ public:
         };
     }
 
+    void initializeDefaultParameters() override
+    {
+        DefaultScenario::initializeDefaultParameters();
+        auto &fp = floatParams;
+
+        // number of precomputed noise fields shared by the envs in the process (see HeightmapPool),
+        // 0 generates a fresh field every episode
+        fp[Str::collectHeightmapPoolSize] = 0;
+        fp[Str::collectHeightmapPoolSeed] = 0;
+    }
+
     float episodeLengthSec() const override
     {
         // add a little bit of time for every extra reward object
@@ -17,60 +17,20 @@ namespace Megaverse
 class DefaultScenario : public Scenario
 {
 public:
-    struct UIElement
-    {
-    public:
-        UIElement() = default;
-
-        UIElement(Object3D *anchor, Object3D *uiElement)
-        : anchor{anchor}
-        , uiElement{uiElement}
-        {
-        }
-
-        void rescale(const Magnum::Vector3 &requiredScale) const
-        {
-            const auto scale = uiElement->transformation().scaling();
-            uiElement->scaleLocal(requiredScale / scale);
-        }
-
-        void show()
-        {
-            if (visible)
-                return;
-
-            anchor->translate({-1000, 0, 0});
-            visible = true;
-        }
-
-        void hide()
-        {
-            if (!visible)
-                return;
-
-            anchor->translate({1000, 0, 0});
-            visible = false;
-        }
-
-    public:
-        bool visible = true;
-        Object3D *anchor = nullptr;
-        Object3D *uiElement = nullptr;
-    };
-
+    /**
+     * Layout of the default HUD in normalized device coordinates: remaining time bar along the bottom edge,
+     * reward indicators on the left (positive) and right (negative) edge, their height is proportional to the reward.
+     */
     struct DefaultUI
     {
-        std::vector<UIElement> remainingTimeBars, positiveRewardIndicator, negativeRewardIndicator;
-        float initialRemainingTimeBarScale = 0.24f;
+        float remainingTimeBarY = -0.977f, remainingTimeBarHalfHeight = 0.011f;
+        float rewardIndicatorX = 0.965f, rewardIndicatorHalfWidth = 0.25f, rewardIndicatorHalfHeightPerReward = 0.3f;
     };
 
 public:
     explicit DefaultScenario(const std::string &scenarioName, Env &env, Env::EnvState &envState)
     : Scenario{scenarioName, env, envState}
     {
-        const auto numAgents = env.getNumAgents();
-        defaultUI.remainingTimeBars.resize(numAgents);
-        defaultUI.positiveRewardIndicator.resize(numAgents), defaultUI.negativeRewardIndicator.resize(numAgents);
     }
 
     /**
@@ -85,17 +45,25 @@ public:
 
         for (int i = 0; i < numAgents; ++i) {
             auto randomRotation = frand(envState.rng) * Magnum::Constants::pi() * 2;
-            auto &agent = envState.scene->addChild<DefaultKinematicAgent>(
-                envState.scene.get(), envState.physics->bWorld,
-                Magnum::Vector3{agentPositions[i]} + Magnum::Vector3{0.5, 0.0, 0.5},
-                randomRotation, verticalLookLimitRad
-            );
+            auto &agent = addAgent(Magnum::Vector3{agentPositions[i]} + Magnum::Vector3{0.5, 0.0, 0.5}, randomRotation, verticalLookLimitRad);
             agent.updateTransform();
 
             agents.emplace_back(&agent);
         }
     }
 
+    /**
+     * Agent with the controller selected by the voxelAgentController parameter.
+     */
+    AbstractAgent & addAgent(const Magnum::Vector3 &position, float rotation, float verticalLookLimitRad)
+    {
+        auto param = floatParams.find(Str::voxelAgentController);
+        if (param != floatParams.end() && param->second > 0)
+            return envState.scene->addChild<VoxelKinematicAgent>(envState.scene.get(), envState.physics->bWorld, position, rotation, verticalLookLimitRad);
+
+        return envState.scene->addChild<DefaultKinematicAgent>(envState.scene.get(), envState.physics->bWorld, position, rotation, verticalLookLimitRad);
+    }
+
     void addEpisodeAgentsDrawables(DrawablesMap &drawables) override
     {
         const auto numAgents = env.getNumAgents();
@@ -114,12 +82,12 @@ public:
             auto &agentBody = agent->addChild<Object3D>();
             agentBody.scale({0.35f, 0.36f, 0.35f}).translate({0, 0.09f, 0});
 
-            drawables[DrawableType::Capsule].emplace_back(&agentBody, rgb(agentColors[i % numAgentColors]));
+            drawables[DrawableType::Capsule].emplace_back(&agentBody, agentColors[i % numAgentColors]);
 
             auto &eyesObject = agent->getCameraObject()->addChild<Object3D>();
             eyesObject.scale({0.25f, 0.12f, 0.2f}).translate({0.0f, 0.0f, -0.19f});
 
-            drawables[DrawableType::Box].emplace_back(&eyesObject, rgb(ColorRgb::AGENT_EYES));
+            drawables[DrawableType::Box].emplace_back(&eyesObject, ColorRgb::AGENT_EYES);
 
             // visualize location where agent interacts with objects
             // auto &pickupSpot = agent.pickupSpot->addChild<Object3D>();
@@ -128,61 +96,21 @@ public:
         }
     }
 
-    void addUIDrawables(DrawablesMap &drawables) override
+    void hud(int agentIdx, std::vector<HudQuad> &quads) const override
     {
-        const auto numAgents = env.getNumAgents();
-        for (int i = 0; i < numAgents; ++i) {
-            auto agent = envState.agents[i];
+        const auto &ui = defaultUI;
 
-            auto &uiObject = agent->getCameraObject()->addChild<Object3D>();
-            uiObject.translate({0, 0, -0.2f});
-
-            auto &remainingTimeBarAnchor = uiObject.addChild<Object3D>();
-            remainingTimeBarAnchor.translate({0, -0.131f, 0});
-            auto &remainingTimeBar = remainingTimeBarAnchor.addChild<Object3D>();
-            remainingTimeBar.scaleLocal({defaultUI.initialRemainingTimeBarScale, 0.0015, 0.001});
-            drawables[DrawableType::Box].emplace_back(&remainingTimeBar, rgb(ColorRgb::BLUE));
-            defaultUI.remainingTimeBars[i] = UIElement{&remainingTimeBarAnchor, &remainingTimeBar};
-
-            if (floatParams[Str::useUIRewardIndicators] > 0) {
-                auto addRewardIndicator = [&](float xOffset, ColorRgb color, std::vector<UIElement> &container) {
-                    auto &indicatorAnchor = uiObject.addChild<Object3D>();
-                    indicatorAnchor.translate({xOffset, 0, 0});
-                    auto &indicator = indicatorAnchor.addChild<Object3D>();
-                    indicator.scaleLocal({0.01, 0.03, 0.0001});
-                    drawables[DrawableType::Box].emplace_back(&indicator, rgb(color));
-                    container[i] = UIElement{&indicatorAnchor, &indicator};
-                    container[i].hide();
-                };
-
-                addRewardIndicator(-0.23f, ColorRgb::GREEN, defaultUI.positiveRewardIndicator);
-                addRewardIndicator(0.23f, ColorRgb::RED, defaultUI.negativeRewardIndicator);
-            }
-        }
-    }
+        const auto barHalfWidth = env.remainingTimeFraction();
+        quads.push_back({{{-barHalfWidth, ui.remainingTimeBarY - ui.remainingTimeBarHalfHeight}, {barHalfWidth, ui.remainingTimeBarY + ui.remainingTimeBarHalfHeight}}, rgb(ColorRgb::BLUE)});
 
-    void updateUI() override
-    {
-        const auto numAgents = env.getNumAgents();
-        for (int i = 0; i < numAgents; ++i) {
-            auto &bar = defaultUI.remainingTimeBars[i];
-            bar.rescale({env.remainingTimeFraction() * defaultUI.initialRemainingTimeBarScale, 0.0015, 0.001});
-
-            if (floatParams[Str::useUIRewardIndicators] > 0) {
-                if (envState.lastReward[i] > FLT_EPSILON) {
-                    defaultUI.positiveRewardIndicator[i].show();
-                    defaultUI.positiveRewardIndicator[i].rescale({0.06, 0.04f * envState.lastReward[i], 0.0001});
-                    defaultUI.negativeRewardIndicator[i].hide();
-                } else if (envState.lastReward[i] < -FLT_EPSILON) {
-                    defaultUI.negativeRewardIndicator[i].show();
-                    defaultUI.negativeRewardIndicator[i].rescale({0.06, -0.04f * envState.lastReward[i], 0.0001});
-                    defaultUI.positiveRewardIndicator[i].hide();
-                } else {
-                    defaultUI.positiveRewardIndicator[i].hide();
-                    defaultUI.negativeRewardIndicator[i].hide();
-                }
-            }
-        }
+        const auto reward = envState.lastReward[agentIdx];
+        if (!resolvedParams.useUIRewardIndicators || std::fabs(reward) <= FLT_EPSILON)
+            return;
+
+        const auto x = reward > 0 ? -ui.rewardIndicatorX : ui.rewardIndicatorX;
+        const auto halfHeight = ui.rewardIndicatorHalfHeightPerReward * std::fabs(reward);
+        const auto color = rgb(reward > 0 ? ColorRgb::GREEN : ColorRgb::RED);
+        quads.push_back({{{x - ui.rewardIndicatorHalfWidth, -halfHeight}, {x + ui.rewardIndicatorHalfWidth, halfHeight}}, color});
     }
 
     std::vector<Magnum::Color3> getPalette() const override
@@ -25,6 +25,8 @@ public:
     float trueObjective(int) const override { return 0; }
 
     RewardShaping defaultRewardShaping() const override { return {}; }
+
+    bool saveState(StateBuffer &) const override { return true; }
 };
 
 }
\ No newline at end of file
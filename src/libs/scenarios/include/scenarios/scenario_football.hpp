@@ -2,6 +2,7 @@
 
 #include <scenarios/scenario_default.hpp>
 #include <scenarios/component_platforms.hpp>
+#include <scenarios/component_proximity.hpp>
 #include <scenarios/component_voxel_grid.hpp>
 #include <scenarios/layout_utils.hpp>
 
@@ -28,6 +29,12 @@ public:
 
     void addEpisodeDrawables(DrawablesMap &drawables) override;
 
+    const LayoutCollisionQuery * layoutCollisionQuery() const override { return &vg; }
+
+    void memoryReport(MemoryReport &report) const override { report.add("voxel_grid", vg.memoryBytes()); }
+
+    const LayoutVoxelQuery * layoutVoxelQuery() const override { return &vg; }
+
     float trueObjective(int) const override { return 0; }//TODO
 
     RewardShaping defaultRewardShaping() const override { return {}; }
@@ -35,6 +42,7 @@ public:
 private:
     VoxelGridComponent<VoxelState> vg;
     PlatformsComponent platformsComponent;
+    ProximityComponent proximity;
 
     std::unique_ptr<btSphereShape> collisionShape;
     Object3D *footballObject = nullptr;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <scenarios/scenario_default.hpp>
+#include <scenarios/component_proximity.hpp>
 #include <scenarios/component_hexagonal_maze.hpp>
 
 namespace Megaverse
@@ -33,6 +34,7 @@ private:
     bool solved = false;
 
     HexagonalMazeComponent maze;
+    ProximityComponent proximity;
 
     Magnum::Vector3 rewardObjectCoords;
     Object3D *rewardObject = nullptr;
@@ -1,25 +1,12 @@
 #pragma once
 
-#include <list>
-
 #include <scenarios/scenario_default.hpp>
+#include <scenarios/component_proximity.hpp>
 #include <scenarios/component_hexagonal_maze.hpp>
 
 namespace Megaverse
 {
 
-struct CollectableObject
-{
-    Object3D *object = nullptr;
-    bool good = false;
-};
-
-struct VoxelHexMemory
-{
-    std::list<CollectableObject> objects;
-};
-
-
 class HexMemoryScenario : public DefaultScenario
 {
 public:
@@ -59,7 +46,8 @@ private:
 
     HexagonalMazeComponent maze;
 
-    VoxelGridComponent<VoxelHexMemory> vg;
+    // collectable objects, tagged with whether they are good
+    ProximityComponent proximity;
 
     Magnum::Vector3 landmarkLocation;
     std::vector<Magnum::Vector3> goodObjects, badObjects;
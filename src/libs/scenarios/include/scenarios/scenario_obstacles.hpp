@@ -1,5 +1,7 @@
 #pragma once
 
+#include <util/lru_cache.hpp>
+
 #include <scenarios/platforms.hpp>
 #include <scenarios/scenario_default.hpp>
 #include <scenarios/layout_utils.hpp>
@@ -19,6 +21,23 @@ struct VoxelObstacles : public VoxelWithPhysicsObjects
     Object3D *rewardObject = nullptr;
 };
 
+/**
+ * Everything we need to recreate the episode layout without generating it from scratch.
+ */
+struct ObstaclesLayout
+{
+    VoxelGridComponent<VoxelObstacles>::VoxelSnapshot voxels;
+    std::map<BBoxInfo, Boxes> boxes;
+    std::vector<std::pair<TerrainType, BoundingBox>> terrainBoxes;
+
+    std::vector<VoxelCoords> objectSpawnPositions, rewardSpawnPositions;
+    std::vector<Magnum::Vector3> agentSpawnPositions;
+    int numPlatforms{};
+
+    // rng state right after the layout generation
+    Rng rng;
+};
+
 class ObstaclesScenario : public DefaultScenario, public ObjectStackingCallbacks, public FallDetectionCallbacks
 {
 public:
@@ -33,6 +52,21 @@ public:
 
     void addEpisodeDrawables(DrawablesMap &drawables) override;
 
+    const LayoutCollisionQuery * layoutCollisionQuery() const override { return &vg; }
+
+    void memoryReport(MemoryReport &report) const override { report.add("voxel_grid", vg.memoryBytes()); }
+
+    const LayoutVoxelQuery * layoutVoxelQuery() const override { return &vg; }
+
+    BatchedComponents batchedComponents() override { return {&fallDetection}; }
+
+    bool reserveLayoutCache(size_t numLayouts) override;
+
+    bool isLayoutCached(int layoutSeed) const override;
+
+    /// Baked from the layout cache, episode datasets need reserveLayoutCache().
+    bool bakeLayout(StateBuffer &buffer) const override;
+
     float trueObjective(int) const override { return solved; }
 
     RewardShaping defaultRewardShaping() const override
@@ -65,6 +99,9 @@ public:
         fp[Str::obstaclesMaxHeight] = 3;
 
         fp[Str::obstaclesNumAllowedMaxDifficulty] = 1;
+
+        // number of layouts (keyed by scenario, params and seed) cached in the process, 0 disables the cache
+        fp[Str::layoutCacheSize] = 0;
     }
 
     float episodeLengthSec() const override;
@@ -76,6 +113,19 @@ public:
 protected:
     std::vector<PlatformType> platformTypes;
 
+private:
+    void generateLayout();
+
+    void restoreLayout(const ObstaclesLayout &layout);
+
+    /// Layout from EnvState::bakedLayout, see bakeLayout().
+    std::shared_ptr<ObstaclesLayout> instantiateBakedLayout();
+
+    static LruCache<std::string, ObstaclesLayout> & layoutCache();
+
+    /// Str::layoutCacheSize or the capacity reserved by reserveLayoutCache(), whichever is larger
+    size_t layoutCacheCapacity() const;
+
 private:
     VoxelGridComponent<VoxelObstacles> vg;
     PlatformsComponent platformsComponent;
@@ -89,6 +139,13 @@ private:
     bool solved = false;
 
     int numPlatforms{};
+
+    std::string layoutKey;
+    std::shared_ptr<const ObstaclesLayout> cachedLayout;
+    std::shared_ptr<ObstaclesLayout> newLayout;
+
+    // layout of the current episode if it was restored or recorded for the cache, see bakeLayout()
+    std::shared_ptr<const ObstaclesLayout> episodeLayout;
 };
 
 class TestScenario : public ObstaclesScenario
@@ -56,7 +56,9 @@ public:
 
 public:
     ArrangementItem arrangementItem;
-    bool pickedUp = false;
+
+    /// object stands where the arrangement wants it, maintained in the object stacking callbacks
+    bool matching = false;
 };
 
 struct Arrangement
@@ -92,6 +94,12 @@ public:
 
     void addEpisodeDrawables(DrawablesMap &drawables) override;
 
+    const LayoutCollisionQuery * layoutCollisionQuery() const override { return &vg; }
+
+    void memoryReport(MemoryReport &report) const override { report.add("voxel_grid", vg.memoryBytes()); }
+
+    const LayoutVoxelQuery * layoutVoxelQuery() const override { return &vg; }
+
     float trueObjective(int /*agentIdx*/) const override { return solved; }
 
     RewardShaping defaultRewardShaping() const override
@@ -106,7 +114,7 @@ public:
 
     void arrangementDrawables(DrawablesMap &drawables, const Arrangement &arr, VoxelCoords center, bool interactive);
 
-    int countMatchingObjects() const;
+    bool matchesArrangement(const ArrangementObject &obj, const VoxelCoords &coords) const;
 
     bool canPlaceObject(int /*agentIdx*/, const VoxelCoords &coords, Object3D *obj) override;
 
@@ -125,7 +133,7 @@ private:
     Arrangement arrangement;
     std::vector<ArrangementObject *> arrangementObjects;
 
-    int maxMatchingObjects = 0;
+    int numMatchingObjects = 0, maxMatchingObjects = 0;
 
     const VoxelCoords leftCenter = {5, 2, 5};
     const VoxelCoords rightCenter = {13, 2, 5};
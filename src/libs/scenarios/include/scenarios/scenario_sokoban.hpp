@@ -1,6 +1,7 @@
 #pragma once
 
 #include <scenarios/scenario_default.hpp>
+#include <scenarios/sokoban_levels.hpp>
 #include <scenarios/layout_utils.hpp>
 #include <scenarios/component_voxel_grid.hpp>
 #include <scenarios/component_fall_detection.hpp>
@@ -10,12 +11,6 @@
 namespace Megaverse
 {
 
-struct SokobanLevel
-{
-    std::vector<std::string> rows;
-};
-
-
 class SokobanScenario : public DefaultScenario
 {
 public:
@@ -28,14 +23,22 @@ public:
 
     void step() override;
 
-    void reloadLevels();
-
     void createLayout();
 
     std::vector<Magnum::Vector3> agentStartingPositions() override;
 
     void addEpisodeDrawables(DrawablesMap &drawables) override;
 
+    const LayoutCollisionQuery * layoutCollisionQuery() const override { return &vg; }
+
+    void memoryReport(MemoryReport &report) const override { report.add("voxel_grid", vg.memoryBytes()); }
+
+    const LayoutVoxelQuery * layoutVoxelQuery() const override { return &vg; }
+
+    bool saveState(StateBuffer &buffer) const override;
+
+    void restoreState(StateReader &reader) override;
+
     float trueObjective(int) const override { return float(solved); }
 
     RewardShaping defaultRewardShaping() const override
@@ -55,11 +58,10 @@ public:
 
 private:
     std::string boxobanLevelsDir{};
-    std::vector<std::string> allSokobanLevelFiles{};
     constexpr static ConstStr levelSet = "unfiltered", levelSplit = "train";
 
-    std::vector<SokobanLevel> levels;
-    SokobanLevel currLevel;
+    const SokobanLevelDatabase *levels = nullptr;
+    size_t currLevelIdx = 0;
     int length = 0, width = 0;
 
     VoxelGridComponent<VoxelWithPhysicsObjects> vg;
@@ -67,6 +69,11 @@ private:
 
     std::vector<Magnum::Vector3> agentPositions;
     std::vector<VoxelCoords> boxesCoords;
+
+    // current voxel of each box body, the pointers are also stored in the voxels
+    std::vector<RigidBody *> boxBodies;
+    std::vector<VoxelCoords> boxVoxels;
+    std::map<BBoxInfo, Boxes> layoutBoxes;
     int numBoxes = 0, numBoxesOnGoal = 0;
 
     bool solved = false;
@@ -39,6 +39,14 @@ public:
 
     void addEpisodeDrawables(DrawablesMap &drawables) override;
 
+    const LayoutCollisionQuery * layoutCollisionQuery() const override { return &vg; }
+
+    void memoryReport(MemoryReport &report) const override { report.add("voxel_grid", vg.memoryBytes()); }
+
+    const LayoutVoxelQuery * layoutVoxelQuery() const override { return &vg; }
+
+    BatchedComponents batchedComponents() override { return {&fallDetection}; }
+
     float trueObjective(int) const override { return float(highestTower); }
 
     RewardShaping defaultRewardShaping() const override
@@ -60,7 +68,9 @@ public:
 
 private:
     bool isInBuildingZone(const VoxelCoords &c) const;
-    float calculateTowerReward() const;
+
+    void addToBuildingZone(const VoxelCoords &c);
+    void removeFromBuildingZone(const VoxelCoords &c);
 
     static float buildingRewardCoeffForHeight(float height);
     void addCollectiveReward(int agentIdx);
@@ -74,6 +84,10 @@ private:
     int highestTower = 0;
     BoundingBox buildingZone;
     std::unordered_set<VoxelCoords> objectsInBuildingZone;
+
+    // reward of the objects currently in the building zone, maintained in the stacking callbacks,
+    // and the part of it the team was already rewarded for
+    float buildingZoneReward = 0.0f;
     float currBuildingZoneReward = 0.0f;
 
     std::vector<AgentState> agentState;
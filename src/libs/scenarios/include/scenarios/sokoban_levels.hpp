@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <util/filesystem_utils.hpp>
+
+
+namespace Megaverse
+{
+
+struct SokobanLevel
+{
+    std::vector<std::string> rows;
+};
+
+/**
+ * Bitplanes of a level, each bit is one cell (row x, column z).
+ */
+enum class SokobanPlane
+{
+    Floor,
+    Wall,
+    Goal,
+    Box,
+    Player,
+
+    NumPlanes,
+};
+
+/**
+ * Axis-aligned block of floor or wall cells in the (x, z) plane, bounds are inclusive.
+ * Blocks are merged greedily when the database is built, so a reset can add the layout geometry directly
+ * instead of merging voxels.
+ */
+struct SokobanRect
+{
+    uint8_t x0, z0, x1, z1;
+    uint8_t plane;  // SokobanPlane::Floor or SokobanPlane::Wall
+};
+
+
+/**
+ * All levels of a Boxoban split (e.g. unfiltered/train), shared read-only by every SokobanScenario in the process.
+ * On first use the text files are parsed once and converted into a compact binary file next to them
+ * (bitplanes plus pre-merged floor and wall blocks per level), later runs and other processes just memory-map it.
+ * Delete the .bin file to rebuild it. If the cache can't be written, the converted levels stay in memory.
+ */
+class SokobanLevelDatabase
+{
+public:
+    /// Built lazily, once per directory. Thread-safe.
+    static const SokobanLevelDatabase & get(const std::string &dirWithLevels);
+
+    /// Parse and convert the given text files. Does not use or touch the cache.
+    explicit SokobanLevelDatabase(const std::vector<std::string> &levelFiles);
+
+    /// Load a binary file written by save().
+    static std::unique_ptr<SokobanLevelDatabase> load(const std::string &filename);
+
+    bool save(const std::string &filename) const;
+
+    size_t size() const { return header().numLevels; }
+
+    /// Maximum level size over the database.
+    int rows() const { return int(header().rows); }
+
+    int cols() const { return int(header().cols); }
+
+    bool cell(size_t levelIdx, SokobanPlane plane, int x, int z) const
+    {
+        const auto bit = size_t(x) * header().cols + size_t(z);
+        const auto *p = planes(levelIdx) + size_t(plane) * header().planeBytes;
+        return (p[bit / 8] >> (bit % 8)) & 1;
+    }
+
+    std::pair<const SokobanRect *, const SokobanRect *> rects(size_t levelIdx) const;
+
+    /// Level in the text notation, mostly for debugging and tests.
+    SokobanLevel level(size_t idx) const;
+
+    static std::string cacheFilename(const std::string &dirWithLevels);
+
+    static std::vector<std::string> levelFiles(const std::string &dirWithLevels);
+
+private:
+    SokobanLevelDatabase() = default;
+
+    /**
+     * File layout: header, bitplanes of all levels, (numLevels + 1) uint32 offsets into the rect array, rects.
+     */
+    struct Header
+    {
+        char magic[8];
+        uint32_t rows, cols, planeBytes, numRects;
+        uint64_t numLevels;
+    };
+
+    static constexpr char magic[8] = {'M', 'V', 'S', 'O', 'K', 'O', 'B', '2'};
+
+    const Header & header() const { return *reinterpret_cast<const Header *>(image); }
+
+    size_t levelBytes() const { return size_t(SokobanPlane::NumPlanes) * header().planeBytes; }
+
+    const uint8_t * planes(size_t levelIdx) const
+    {
+        return reinterpret_cast<const uint8_t *>(image + sizeof(Header)) + levelIdx * levelBytes();
+    }
+
+    const uint32_t * rectOffsets() const
+    {
+        return reinterpret_cast<const uint32_t *>(planes(size()));
+    }
+
+    static size_t imageSize(const Header &h)
+    {
+        return sizeof(Header) + h.numLevels * size_t(SokobanPlane::NumPlanes) * h.planeBytes
+               + (h.numLevels + 1) * sizeof(uint32_t) + h.numRects * sizeof(SokobanRect);
+    }
+
+private:
+    // points either into the mapped file or into the owned buffer
+    const char *image = nullptr;
+    std::vector<char> buffer;
+    std::unique_ptr<MappedFile> mapped;
+};
+
+}
@@ -0,0 +1,80 @@
+#include <map>
+#include <tuple>
+
+#include <util/util.hpp>
+#include <util/tiny_logger.hpp>
+#include <util/perlin_noise.hpp>
+
+#include <scenarios/heightmap_pool.hpp>
+
+
+using namespace Megaverse;
+
+
+HeightmapPool & HeightmapPool::get(int size, int poolSize, uint32_t poolSeed)
+{
+    static std::mutex mutex;
+    static std::map<std::tuple<int, int, uint32_t>, std::unique_ptr<HeightmapPool>> pools;
+
+    std::lock_guard<std::mutex> lock{mutex};
+
+    auto &pool = pools[{size, poolSize, poolSeed}];
+    if (!pool) {
+        pool = std::make_unique<HeightmapPool>(size, poolSize, poolSeed);
+        TLOG(INFO) << "Generating " << poolSize << " heightmaps " << size << "x" << size << " in the background";
+    }
+
+    return *pool;
+}
+
+HeightmapPool::HeightmapPool(int size, int poolSize, uint32_t poolSeed)
+: mapSize{size}
+, poolSeed{poolSeed}
+, entries(size_t(poolSize))
+{
+    // a single thread, so the pool takes at most one core away from the simulation
+    background = std::thread{[this] { backgroundLoop(); }};
+}
+
+HeightmapPool::~HeightmapPool()
+{
+    stop = true;
+    background.join();
+}
+
+const HeightmapPool::Heightmap & HeightmapPool::heightmap(int idx)
+{
+    auto &entry = entries[idx];
+    std::call_once(entry.generated, [this, idx] { generate(idx); });
+    return entry.heightmap;
+}
+
+void HeightmapPool::backgroundLoop()
+{
+    for (int idx = 0; idx < poolSize() && !stop; ++idx)
+        heightmap(idx);
+}
+
+void HeightmapPool::generate(int idx)
+{
+    std::seed_seq seedSeq{poolSeed, uint32_t(idx)};
+    Rng rng{seedSeq};
+
+    // same distribution of noise parameters as CollectScenario uses for the fresh terrain
+    const double frequency = double(randRange(1, 100, rng)) / 10.0;
+    const std::int32_t octaves = randRange(1, 10, rng);
+    const std::uint32_t seed = randRange(0, 1000000000, rng);
+
+    const siv::PerlinNoise perlin(seed);
+    const double f = mapSize / frequency;
+
+    std::vector<double> zCoords(mapSize);
+    for (int z = 0; z < mapSize; ++z)
+        zCoords[z] = z / f;
+
+    auto &noise = entries[idx].heightmap.noise;
+    noise.resize(size_t(mapSize) * mapSize);
+
+    for (int x = 0; x < mapSize; ++x)
+        perlin.accumulatedOctaveNoise2DRow_0_1(x / f, zCoords.data(), zCoords.size(), octaves, noise.data() + x * mapSize);
+}
@@ -1,4 +1,5 @@
 #include <queue>
+#include <sstream>
 
 #include <util/magnum.hpp>
 #include <util/tiny_logger.hpp>
@@ -13,39 +14,104 @@ using namespace Magnum::Math::Literals;
 using namespace Megaverse;
 
 
+std::string Megaverse::layoutCacheKey(const std::string &scenarioName, const FloatParams &params, int numAgents, int layoutSeed)
+{
+    std::ostringstream key;
+    key << scenarioName << ':' << numAgents << ':' << layoutSeed;
+
+    // FloatParams is an ordered map, so the key does not depend on the order in which params were set
+    for (const auto &[k, v] : params)
+        key << ':' << k << '=' << v;
+
+    return key.str();
+}
+
+namespace
+{
+
+struct BoxPose
+{
+    Magnum::Vector3 scale, translation;
+};
+
+BoxPose layoutBoxPose(const BoundingBox &box, float voxelSize)
+{
+    const auto bboxMin = box.min, bboxMax = box.max;
+    auto scale = Magnum::Vector3{
+        float(bboxMax.x() - bboxMin.x() + 1) / 2,
+        float(bboxMax.y() - bboxMin.y() + 1) / 2,
+        float(bboxMax.z() - bboxMin.z() + 1) / 2,
+    } * voxelSize;
+
+    auto translation = Magnum::Vector3{
+        float((bboxMin.x() + bboxMax.x())) / 2 + 0.5f,
+        float((bboxMin.y() + bboxMax.y())) / 2 + 0.5f,
+        float((bboxMin.z() + bboxMax.z())) / 2 + 0.5f
+    } * voxelSize;
+
+    return {scale, translation};
+}
+
+}
+
+void Megaverse::addLayoutBoxes(DrawablesMap &drawables, Env::EnvState &envState, const std::map<BBoxInfo, Boxes> &boxesByType, float voxelSize)
+{
+    const bool compound = envState.compoundStaticLayout;
+
+    for (auto &[bbInfo, bb] : boxesByType)
+        addBoundingBoxes(drawables, envState, bb, bbInfo.type, bbInfo.color, voxelSize, !compound);
+
+    if (!compound)
+        return;
+
+    int numSolidBoxes = 0;
+    for (auto &[bbInfo, bb] : boxesByType)
+        if (bbInfo.type & VOXEL_SOLID)
+            numSolidBoxes += int(bb.size());
+
+    if (!numSolidBoxes)
+        return;
+
+    // one broadphase proxy for the whole layout, the compound shape has its own internal AABB tree for the children
+    auto compoundShape = envState.episodeArena.create<btCompoundShape>(true, numSolidBoxes);
+
+    for (auto &[bbInfo, bb] : boxesByType) {
+        if (!(bbInfo.type & VOXEL_SOLID))
+            continue;
+
+        for (const auto &box : bb) {
+            const auto pose = layoutBoxPose(box, voxelSize);
+            btTransform t{btMatrix3x3::getIdentity(), btVector3{pose.translation}};
+            compoundShape->addChildShape(t, CollisionShapeCache::box(btVector3{pose.scale}));
+        }
+    }
+
+    // the body is at the origin with unit scale, so we never call syncPose() on it (this would rescale the shared children)
+    envState.scene->addChild<RigidBody>(envState.scene.get(), 0.0f, compoundShape, envState.physics->bWorld, layoutCollisionGroup, layoutCollisionMask);
+}
+
 // TODO: add different types of layouts
-void Megaverse::addBoundingBoxes(DrawablesMap &drawables, Env::EnvState &envState, const Boxes &boxes, int voxelType, ColorRgb color, float voxelSize)
+void Megaverse::addBoundingBoxes(DrawablesMap &drawables, Env::EnvState &envState, const Boxes &boxes, int voxelType, ColorRgb color, float voxelSize, bool addCollisions)
 {
     if (voxelType == VOXEL_EMPTY)
         return;
 
     for (auto box : boxes) {
-        const auto bboxMin = box.min, bboxMax = box.max;
-        auto scale = Magnum::Vector3{
-            float(bboxMax.x() - bboxMin.x() + 1) / 2,
-            float(bboxMax.y() - bboxMin.y() + 1) / 2,
-            float(bboxMax.z() - bboxMin.z() + 1) / 2,
-        } * voxelSize;
-
-        auto translation = Magnum::Vector3{
-            float((bboxMin.x() + bboxMax.x())) / 2 + 0.5f,
-            float((bboxMin.y() + bboxMax.y())) / 2 + 0.5f,
-            float((bboxMin.z() + bboxMax.z())) / 2 + 0.5f
-        } * voxelSize;
-
-        auto &layoutBox = envState.scene->addChild<Object3D>();
+        const auto [scale, translation] = layoutBoxPose(box, voxelSize);
+
+        auto &layoutBox = envState.scene->addChild<SceneNode>();
         layoutBox.scale(scale).translate(translation);
 
         if (voxelType & VOXEL_OPAQUE)
-            drawables[DrawableType::Box].emplace_back(&layoutBox, rgb(color));
+            drawables[DrawableType::Box].emplace_back(&layoutBox, color, true);
 
-        if (voxelType & VOXEL_SOLID) {
-            auto bBoxShape = std::make_unique<btBoxShape>(btVector3{1,1,1});
-            auto &collisionBox = layoutBox.addChild<RigidBody>(envState.scene.get(), 0.0f, bBoxShape.get(), envState.physics->bWorld);
+        if (addCollisions && (voxelType & VOXEL_SOLID)) {
+            auto &collisionBox = layoutBox.addChild<RigidBody>(
+                envState.scene.get(), 0.0f, CollisionShapeCache::unitBox(), envState.physics->bWorld,
+                layoutCollisionGroup, layoutCollisionMask
+            );
 
             collisionBox.syncPose();
-
-            envState.physics->collisionShapes.emplace_back(std::move(bBoxShape));
         }
     }
 }
@@ -58,12 +124,12 @@ void Megaverse::addTerrain(DrawablesMap &drawables, Env::EnvState &envState, Ter
         // otherwise we don't draw anything
         const auto pos = Magnum::Vector3(bb.min.x() * voxelSize + scale.x() / 2, bb.min.y() * voxelSize, bb.min.z() * voxelSize + scale.z() / 2);
 
-        auto &terrainObject = envState.scene->addChild<Object3D>(envState.scene.get());
+        auto &terrainObject = envState.scene->addChild<SceneNode>(envState.scene.get());
         terrainObject.scale({0.5, 0.025, 0.5}).scale(scale);
         terrainObject.translate({0.0, 0.025, 0.0});
         terrainObject.translate(pos);
 
-        drawables[DrawableType::Box].emplace_back(&terrainObject, rgb(terrainColor(type)));
+        drawables[DrawableType::Box].emplace_back(&terrainObject, terrainColor(type));
     }
 }
 
@@ -72,29 +138,27 @@ void Megaverse::addStaticCollidingBox(
     Vector3 scale, Vector3 translation, ColorRgb color
 )
 {
-    auto &layoutBox = envState.scene->addChild<Object3D>();
+    auto &layoutBox = envState.scene->addChild<SceneNode>();
     layoutBox.scale(scale).translate(translation);
-    drawables[DrawableType::Box].emplace_back(&layoutBox, rgb(color));
+    drawables[DrawableType::Box].emplace_back(&layoutBox, color);
 
-    auto bBoxShape = std::make_unique<btBoxShape>(btVector3{1, 1, 1});
-    auto &collisionBox = layoutBox.addChild<RigidBody>(envState.scene.get(), 0.0f, bBoxShape.get(), envState.physics->bWorld);
+    auto &collisionBox = layoutBox.addChild<RigidBody>(envState.scene.get(), 0.0f, CollisionShapeCache::unitBox(), envState.physics->bWorld);
     collisionBox.syncPose();
-    envState.physics->collisionShapes.emplace_back(std::move(bBoxShape));
 }
 
 Object3D * Megaverse::addCylinder(DrawablesMap &drawables, Object3D &parent, Magnum::Vector3 translation, Magnum::Vector3 scale, ColorRgb color)
 {
-    auto &rootObject = parent.addChild<Object3D>();
+    auto &rootObject = parent.addChild<SceneNode>();
     rootObject.scale(scale).translate(translation);
-    drawables[DrawableType::Cylinder].emplace_back(&rootObject, rgb(color));
+    drawables[DrawableType::Cylinder].emplace_back(&rootObject, color);
     return &rootObject;
 }
 
 Object3D * Megaverse::addSphere(DrawablesMap &drawables, Object3D &parent, Magnum::Vector3 translation, Magnum::Vector3 scale, ColorRgb color)
 {
-    auto &rootObject = parent.addChild<Object3D>();
+    auto &rootObject = parent.addChild<SceneNode>();
     rootObject.scale(scale).translate(translation);
-    drawables[DrawableType::Sphere].emplace_back(&rootObject, rgb(color));
+    drawables[DrawableType::Sphere].emplace_back(&rootObject, color);
     return &rootObject;
 }
 
@@ -113,14 +177,14 @@ Object3D * Megaverse::addPillar(DrawablesMap &drawables, Object3D &parent, Magnu
 
 Object3D * Megaverse::addDiamond(DrawablesMap &drawables, Object3D &parent, Magnum::Vector3 translation, Magnum::Vector3 scale, ColorRgb color)
 {
-    auto &rootObject = parent.addChild<Object3D>();
-    auto &bottomHalf = rootObject.addChild<Object3D>();
+    auto &rootObject = parent.addChild<SceneNode>();
+    auto &bottomHalf = rootObject.addChild<SceneNode>();
     bottomHalf.rotateXLocal(180.0_degf).translate({0.0f, -1.0f, 0.0f});
     rootObject.scale(scale);
     rootObject.translate(translation);
 
-    drawables[DrawableType::Cone].emplace_back(&rootObject, rgb(color));
-    drawables[DrawableType::Cone].emplace_back(&bottomHalf, rgb(color));
+    drawables[DrawableType::Cone].emplace_back(&rootObject, color);
+    drawables[DrawableType::Cone].emplace_back(&bottomHalf, color);
 
     return &rootObject;
 }
@@ -7,7 +7,7 @@ using namespace Megaverse;
 class BoxAGoneScenario::BoxAGonePlatform : public EmptyPlatform
 {
 public:
-    explicit BoxAGonePlatform(Object3D *parent, Rng &rng, int walls, const FloatParams &params, int)
+    explicit BoxAGonePlatform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params, int)
     : EmptyPlatform(parent, rng, walls, params)
     {
     }
@@ -49,9 +49,12 @@ void BoxAGoneScenario::reset()
 
     agentStates = std::vector<AgentState>(env.getNumAgents());
     platformStates.clear();
+    for (auto &bucket : timerWheel)
+        bucket.clear();
+    currTick = 0;
     extraPlatforms.clear();
 
-    platform = std::make_unique<BoxAGonePlatform>(platformsComponent.levelRoot.get(), envState.rng, WALLS_ALL, floatParams, env.getNumAgents());
+    platform = std::make_unique<BoxAGonePlatform>(platformsComponent.levelRoot, envState.rng, WALLS_ALL, floatParams, env.getNumAgents());
     platform->init(), platform->generate();
     vg.addPlatform(*platform, ColorRgb::LAYOUT_DEFAULT, ColorRgb::LAYOUT_DEFAULT, true);
 
@@ -119,18 +122,18 @@ void BoxAGoneScenario::step()
             if (voxel->disappearingPlatform != agentStates[i].lastPlatform) {
                 // visited new platform
                 // set the timer for the previous visited platform to disappear
-                if (platformStates.count(agentStates[i].lastPlatform)) {
-                    auto &p = platformStates[agentStates[i].lastPlatform];
-                    p.remainingTicks = std::min(p.remainingTicks, 3);
-                }
+                const int lastState = agentStates[i].lastPlatformState;
+                if (lastState != -1 && platformStates[lastState].expireTick >= currTick)
+                    scheduleExpiration(lastState, currTick + leftPlatformTicks - 1);
 
                 // add new platform state
-                if (!platformStates.count(voxel->disappearingPlatform)) {
-                    const static auto ticks = 15;
-                    const auto temporaryPlatform = extraPlatforms.back();
-                    platformStates[voxel->disappearingPlatform] = PlatformState{ticks, coords, temporaryPlatform};
-                    extraPlatforms.pop_back();
-                    extraPlatforms.push_front(temporaryPlatform);
+                if (voxel->platformState == -1) {
+                    const auto temporaryPlatform = extraPlatforms[nextExtraPlatform];
+                    nextExtraPlatform = (nextExtraPlatform + int(extraPlatforms.size()) - 1) % int(extraPlatforms.size());
+
+                    voxel->platformState = int(platformStates.size());
+                    platformStates.push_back(PlatformState{currTick + platformTicks, coords, temporaryPlatform});
+                    scheduleExpiration(voxel->platformState, currTick + platformTicks - 1);
 
                     const auto platformSc = voxel->disappearingPlatform->absoluteTransformation().scaling();
                     const auto platformTr = voxel->disappearingPlatform->absoluteTransformation().translation();
@@ -144,31 +147,39 @@ void BoxAGoneScenario::step()
                 }
 
                 agentStates[i].lastPlatform = voxel->disappearingPlatform;
+                agentStates[i].lastPlatformState = voxel->platformState;
             }
         }
     }
 
-    for (auto iter = platformStates.begin(); iter != platformStates.end();) {
-        auto &state = iter->second;
-        auto &tempPlatform = state.temporaryPlatform;
-
-        --state.remainingTicks;
-        if (state.remainingTicks <= 0) {
-            tempPlatform->translate(Magnum::Vector3{300, 300, 300} * voxelSize);  // basically remove from the scene
+    // platforms that are about to disappear grow a little every tick
+    for (int t = currTick + 1; t <= currTick + growingTicks; ++t)
+        for (auto stateIdx : timerWheel[t % timerWheel.size()]) {
+            const auto &state = platformStates[stateIdx];
+            if (state.expireTick != t)
+                continue;
+
+            auto tempPlatform = state.temporaryPlatform;
+            const auto platformSc = tempPlatform->absoluteTransformation().scaling();
+            const auto platformTr = tempPlatform->absoluteTransformation().translation();
+            tempPlatform->resetTransformation().scale(platformSc * 1.03f).translate(platformTr);
             tempPlatform->syncPose();
-            platformStates.erase(iter++);
-            vg.grid.remove(state.coords);
-        } else {
-            if (state.remainingTicks <= 5) {
-                const auto platformSc = tempPlatform->absoluteTransformation().scaling();
-                const auto platformTr = tempPlatform->absoluteTransformation().translation();
-                tempPlatform->resetTransformation().scale(platformSc * 1.03f).translate(platformTr);
-                tempPlatform->syncPose();
-            }
-
-            ++iter;
         }
+
+    // the bodies are only moved out of the way, the temporary platforms are reused
+    auto &expiring = timerWheel[currTick % timerWheel.size()];
+    for (auto stateIdx : expiring) {
+        const auto &state = platformStates[stateIdx];
+        if (state.expireTick != currTick)
+            continue;
+
+        state.temporaryPlatform->translate(Magnum::Vector3{300, 300, 300} * voxelSize);  // basically remove from the scene
+        state.temporaryPlatform->syncPose();
+        vg.grid.remove(state.coords);
     }
+    expiring.clear();
+
+    ++currTick;
 
     if (agentsTouchingFloor >= env.getNumAgents() && !finished) {
         finished = true;
@@ -202,15 +213,11 @@ void BoxAGoneScenario::addDisappearingPlatforms(DrawablesMap &drawables)
     for (const auto &[pos, color] : disappearingPlatforms) {
         auto translation = Magnum::Vector3{float(pos.x()) + 0.5f, float(pos.y()) + 0.5f, float(pos.z()) + 0.5f} * voxelSize;
 
-        auto bBoxShape = std::make_unique<btBoxShape>(btVector3{1, 1, 1});
-
-        auto &object = envState.scene->addChild<RigidBody>(envState.scene.get(), 0.0f, bBoxShape.get(), envState.physics->bWorld);
+        auto &object = envState.scene->addChild<RigidBody>(envState.scene.get(), 0.0f, CollisionShapeCache::unitBox(), envState.physics->bWorld);
         object.scale(objScale).translate(translation);
         object.syncPose();
 
-        drawables[DrawableType::Box].emplace_back(&object, rgb(color));
-
-        envState.physics->collisionShapes.emplace_back(std::move(bBoxShape));
+        drawables[DrawableType::Box].emplace_back(&object, color);
 
         VoxelBoxAGone voxelState;
         voxelState.disappearingPlatform = &object;
@@ -219,15 +226,25 @@ void BoxAGoneScenario::addDisappearingPlatforms(DrawablesMap &drawables)
 
     for (int i = 0; i < env.getNumAgents() * 3; ++i) {
         auto translation = Magnum::Vector3{300, 300, 300} * voxelSize;
-        auto bBoxShape = std::make_unique<btBoxShape>(btVector3{1, 1, 1});
-
-        auto &object = envState.scene->addChild<RigidBody>(envState.scene.get(), 0.0f, bBoxShape.get(), envState.physics->bWorld);
+        auto &object = envState.scene->addChild<RigidBody>(envState.scene.get(), 0.0f, CollisionShapeCache::unitBox(), envState.physics->bWorld);
         object.scale(objScale).translate(translation);
         object.syncPose();
 
-        drawables[DrawableType::Box].emplace_back(&object, rgb(ColorRgb::GREEN));
-        envState.physics->collisionShapes.emplace_back(std::move(bBoxShape));
+        drawables[DrawableType::Box].emplace_back(&object, ColorRgb::GREEN);
 
         extraPlatforms.emplace_back(&object);
     }
+
+    // temporary platforms are handed out starting from the back
+    nextExtraPlatform = int(extraPlatforms.size()) - 1;
+}
+
+void BoxAGoneScenario::scheduleExpiration(int stateIdx, int tick)
+{
+    auto &state = platformStates[stateIdx];
+    if (tick >= state.expireTick)
+        return;
+
+    state.expireTick = tick;
+    timerWheel[tick % timerWheel.size()].push_back(stateIdx);
 }
@@ -1,5 +1,6 @@
 #include <util/perlin_noise.hpp>
 
+#include <scenarios/heightmap_pool.hpp>
 #include <scenarios/scenario_collect.hpp>
 
 
@@ -61,36 +62,58 @@ void CollectScenario::createLandscape()
 
     std::vector<int> spawnHeight(length * width, 1);
 
-    double frequency = double (randRange(1, 100, rng)) / 10.0;
-    // frequency = std::clamp(frequency, 0.1, 64.0);
+    // noise in [0, 1] for the inner cells, either from a fresh Perlin field or from a precomputed one
+    double noise[maxLength][maxWidth];
 
-    const std::int32_t octaves = randRange(1, 10, rng);
-    // octaves = std::clamp(octaves, 1, 16);
+    const auto heightmapPoolSize = int(lround(floatParams[Str::collectHeightmapPoolSize]));
+    if (heightmapPoolSize > 0) {
+        const auto poolSeed = uint32_t(lround(floatParams[Str::collectHeightmapPoolSeed]));
+        auto &pool = HeightmapPool::get(maxWidth, heightmapPoolSize, poolSeed);
 
-    const std::uint32_t seed = randRange(0, 1000000000, rng);
+        const auto &heightmap = pool.heightmap(randRange(0, heightmapPoolSize, rng));
+        const int transform = randRange(0, 8, rng);
 
-    const siv::PerlinNoise perlin(seed);
-    const double fx = maxLength / frequency;
-    const double fz = maxWidth / frequency;
+        for (int x = 1; x < length - 1; ++x)
+            for (int z = 1; z < width - 1; ++z)
+                noise[x][z] = pool.noise(heightmap, transform, x, z);
+    } else {
+        double frequency = double (randRange(1, 100, rng)) / 10.0;
+        // frequency = std::clamp(frequency, 0.1, 64.0);
+
+        const std::int32_t octaves = randRange(1, 10, rng);
+        // octaves = std::clamp(octaves, 1, 16);
+
+        const std::uint32_t seed = randRange(0, 1000000000, rng);
+
+        const siv::PerlinNoise perlin(seed);
+        const double fx = maxLength / frequency;
+        const double fz = maxWidth / frequency;
+
+        // noise is evaluated a row at a time, z coords are the same for every row
+        double zCoords[maxWidth];
+        for (int z = 1; z < width - 1; ++z)
+            zCoords[z - 1] = z / fz;
+
+        for (int x = 1; x < length - 1; ++x)
+            perlin.accumulatedOctaveNoise2DRow_0_1(x / fx, zCoords, size_t(width - 2), octaves, noise[x] + 1);
+    }
 
     const int intensity = randRange(5, 18, rng);
     const float groundLevel = Megaverse::frand(rng) * 0.5f + 0.2f;
 
-    for (int x = 1; x < length - 1; ++x)
+    const auto landscapeVoxel = makeVoxel<VoxelCollect>(VOXEL_SOLID | VOXEL_OPAQUE, TERRAIN_NONE, landscapeColor);
+
+    for (int x = 1; x < length - 1; ++x) {
         for (int z = 1; z < width - 1; ++z) {
-            const double noise = perlin.accumulatedOctaveNoise2D_0_1(x / fx, z / fz, octaves);
-            const double yCoord = intensity * (noise - groundLevel);
+            const double yCoord = intensity * (noise[x][z] - groundLevel);
 
             if (yCoord >= 1) {
                 const int yCoordRound = int(lround(yCoord));
-                for (int y = yCoordRound; y >= 1; --y) {
-                    VoxelCoords v{x, y, z};
-                    vg.grid.set(v, makeVoxel<VoxelCollect>(VOXEL_SOLID | VOXEL_OPAQUE, TERRAIN_NONE, landscapeColor));
-                }
-
+                vg.grid.setColumn(x, z, 1, yCoordRound, landscapeVoxel);
                 spawnHeight[x * width + z] = yCoordRound + 1;
             }
         }
+    }
 
     // floor
     for (int x = 0; x < length; ++x)
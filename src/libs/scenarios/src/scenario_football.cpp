@@ -4,10 +4,18 @@
 using namespace Megaverse;
 
 
+namespace
+{
+
+constexpr float kickDistance = 1.8f;
+
+}
+
+
 class FootballScenario::FootballLayout : public EmptyPlatform
 {
 public:
-    FootballLayout(Object3D *parent, Rng &rng, int walls, const FloatParams &params)
+    FootballLayout(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params)
     : EmptyPlatform{parent, rng, walls, params}
     {
     }
@@ -104,6 +112,7 @@ FootballScenario::FootballScenario(const std::string &name, Env &env, Env::EnvSt
 : DefaultScenario(name, env, envState)
 , vg{*this}
 , platformsComponent{*this}
+, proximity{*this}
 {
 }
 
@@ -113,6 +122,7 @@ void FootballScenario::reset()
 {
     vg.reset(env, envState);
     platformsComponent.reset(env, envState);
+    proximity.reset(env, envState);
 
     collisionShape = std::make_unique<btSphereShape>(2.0);
 
@@ -122,8 +132,9 @@ void FootballScenario::reset()
     object.syncPose();
 
     footballObject = &object;
+    proximity.addDynamic(footballObject, kickDistance);
 
-    layout = std::make_unique<FootballLayout>(platformsComponent.levelRoot.get(), envState.rng, WALLS_ALL, floatParams);
+    layout = std::make_unique<FootballLayout>(platformsComponent.levelRoot, envState.rng, WALLS_ALL, floatParams);
     layout->init(), layout->generate();
     vg.addPlatform(*layout, ColorRgb::LAYOUT_DEFAULT, ColorRgb::LAYOUT_DEFAULT, true);
 }
@@ -137,28 +148,27 @@ void FootballScenario::addEpisodeDrawables(DrawablesMap &drawables)
 {
     addDrawablesAndCollisionObjectsFromVoxelGrid(vg, drawables, envState, 1);
 
-    drawables[DrawableType::Sphere].emplace_back(footballObject, rgb(ColorRgb::ORANGE));
+    drawables[DrawableType::Sphere].emplace_back(footballObject, ColorRgb::ORANGE);
 }
 
 void FootballScenario::step()
 {
+    proximity.step(env, envState);
+
     for (int i = 0; i < env.getNumAgents(); ++i) {
         const auto a = envState.currAction[i];
         if (!!(a & Action::Interact)) {
             const auto &agent = envState.agents[i];
             const auto t = agent->transformation().translation();
 
-            const auto ft = footballObject->transformation().translation();
-
-            auto dt = ft - t;
-            if (dt.length() < 1.8) {
-                auto dtNorm = dt.normalized();
+            proximity.forEachNear(t, [&](int id) {
+                auto dtNorm = (proximity.position(id) - t).normalized();
                 dtNorm.y() = 0.5;
                 auto force = 70 * btVector3{dtNorm.x(), dtNorm.y(), dtNorm.z()};
 
-                auto football = dynamic_cast<DynamicRigidBody *>(footballObject);
+                auto football = dynamic_cast<DynamicRigidBody *>(proximity.object(id));
                 football->bRigidBody->applyForce(force, {0, 0, 0});
-            }
+            });
         }
     }
 }
@@ -1,4 +1,4 @@
-#include <mazes/honeycombmaze.h>
+#include <mazes/honeycombmazepool.h>
 
 #include <scenarios/const.hpp>
 #include <scenarios/layout_utils.hpp>
@@ -13,6 +13,7 @@ using namespace Magnum::Math::Literals;
 HexExploreScenario::HexExploreScenario(const std::string &name, Env &env, Env::EnvState &envState)
 : DefaultScenario(name, env, envState)
 , maze{*this}
+, proximity{*this}
 {
 }
 
@@ -25,14 +26,15 @@ void HexExploreScenario::reset()
     maze.minSize = 2, maze.maxSize = 8;
     maze.omitWallsProbabilityMin = 0.1f, maze.omitWallsProbabilityMax = 0.4f;
     maze.reset(env, envState);
+    proximity.reset(env, envState);
 
     auto &hexMaze = maze.getMaze();
-    auto &adjList = hexMaze.getAdjacencyList();
+    const int numCells = int(hexMaze.cellCenters.size());
 
     auto mazeScale = maze.getScale();
 
-    auto randomCellIdx = randRange(0, adjList.size(), envState.rng);
-    auto cellCenter = hexMaze.getCellCenters()[randomCellIdx];
+    auto randomCellIdx = randRange(0, numCells, envState.rng);
+    auto cellCenter = hexMaze.cellCenters[randomCellIdx];
 
     rewardObjectCoords = Magnum::Vector3{float(cellCenter.first) * mazeScale, 0, float(cellCenter.second) * mazeScale};
 
@@ -41,20 +43,13 @@ void HexExploreScenario::reset()
 
 void HexExploreScenario::step()
 {
-    for (int i = 0; i < env.getNumAgents(); ++i) {
-        auto &agent = env.getAgents()[i];
-        const auto t = agent->absoluteTransformation().translation();
-
-        const auto threshold = 1.2;
-        const auto distance = (t - rewardObjectCoords).length();
-        if (distance < threshold && !solved) {
-            solved = true;
-            doneWithTimer();
-            rewardTeam(Str::exploreSolved, i, 1);
-            rewardObject->translate({1e3, 1e3, 1e3});
-            break;
-        }
-    }
+    proximity.forEachAgentContact(env, envState, [&](int agentIdx, int id) {
+        solved = true;
+        doneWithTimer();
+        rewardTeam(Str::exploreSolved, agentIdx, 1);
+        rewardObject->translate({1e3, 1e3, 1e3});
+        proximity.remove(id);
+    });
 }
 
 std::vector<Magnum::Vector3> HexExploreScenario::agentStartingPositions()
@@ -63,14 +58,14 @@ std::vector<Magnum::Vector3> HexExploreScenario::agentStartingPositions()
 
     auto &hexMaze = maze.getMaze();
     auto mazeScale = maze.getScale();
-    std::vector<int> cellIndices(hexMaze.getAdjacencyList().size(), 0);
+    std::vector<int> cellIndices(hexMaze.cellCenters.size(), 0);
     std::iota(cellIndices.begin(), cellIndices.end(), 0);
     std::shuffle(cellIndices.begin(), cellIndices.end(), envState.rng);
 
     float furtherstDistance = 0;
 
     for (auto cellIdx : cellIndices) {
-        auto cellCenter = hexMaze.getCellCenters()[cellIdx];
+        auto cellCenter = hexMaze.cellCenters[cellIdx];
 
         auto spawnPos = Vector3{float(cellCenter.first) * mazeScale, 0.1, float(cellCenter.second) * mazeScale};
         auto distance = (rewardObjectCoords - spawnPos).length();
@@ -105,4 +100,8 @@ void HexExploreScenario::addEpisodeDrawables(DrawablesMap &drawables)
     // adding reward object
     const auto scale = 1.9f;
     rewardObject = addDiamond(drawables, *envState.scene, rewardObjectCoords + Vector3{0, 1.2, 0}, {0.17f * scale, 0.35f * scale, 0.17f * scale}, ColorRgb::VIOLET);
+
+    // distance is measured to the floor below the diamond
+    constexpr auto threshold = 1.2f;
+    proximity.addStatic(rewardObjectCoords, threshold, 0, rewardObject);
 }
@@ -1,4 +1,4 @@
-#include <mazes/honeycombmaze.h>
+#include <mazes/honeycombmazepool.h>
 
 #include <scenarios/layout_utils.hpp>
 #include <scenarios/scenario_hex_memory.hpp>
@@ -11,7 +11,7 @@ using namespace Megaverse;
 HexMemoryScenario::HexMemoryScenario(const std::string &name, Env &env, Env::EnvState &envState)
 : DefaultScenario(name, env, envState)
 , maze{*this}
-, vg{*this, 100, 0, 0, 0, 1.0}
+, proximity{*this}
 {
 }
 
@@ -21,7 +21,7 @@ void HexMemoryScenario::reset()
 {
     solved = false;
 
-    vg.reset(env, envState);
+    proximity.reset(env, envState);
 
     goodObjects.clear(), badObjects.clear();
     goodObjectsCollected = 0;
@@ -31,7 +31,7 @@ void HexMemoryScenario::reset()
     maze.reset(env, envState);
 
     auto &hexMaze = maze.getMaze();
-    auto &adjList = hexMaze.getAdjacencyList();
+    const int numCells = int(hexMaze.cellCenters.size());
 
     auto mazeScale = maze.getScale();
 
@@ -39,8 +39,8 @@ void HexMemoryScenario::reset()
     int centerCellIdx = 0;
 
     // hacky way to find the cell closest to center
-    for (int cellIdx = 0; cellIdx < int(adjList.size()); ++cellIdx) {
-        auto cellCenter = hexMaze.getCellCenters()[cellIdx];
+    for (int cellIdx = 0; cellIdx < numCells; ++cellIdx) {
+        auto cellCenter = hexMaze.cellCenters[cellIdx];
         auto distanceToCenter = sqrt(sqr(cellCenter.first) + sqr(cellCenter.second));
 
         if (distanceToCenter < minDistanceToCenter) {
@@ -49,16 +49,16 @@ void HexMemoryScenario::reset()
         }
     }
 
-    auto mazeCenter = hexMaze.getCellCenters()[centerCellIdx];
+    auto mazeCenter = hexMaze.cellCenters[centerCellIdx];
     landmarkLocation = Magnum::Vector3(mazeCenter.first * mazeScale, 1.0f, mazeCenter.second * mazeScale);
 
     std::vector<Magnum::Vector3> objectCoordinates;
 
-    for (int cellIdx = 0; cellIdx < int(adjList.size()); ++cellIdx) {
+    for (int cellIdx = 0; cellIdx < numCells; ++cellIdx) {
         if (cellIdx == centerCellIdx)
             continue;
 
-        auto cellCenter = hexMaze.getCellCenters()[cellIdx];
+        auto cellCenter = hexMaze.cellCenters[cellIdx];
         auto coord = Magnum::Vector3(cellCenter.first, 0.5f, cellCenter.second);
         auto offset = Magnum::Vector3(frand(envState.rng) - 0.5f, 0, frand(envState.rng) - 0.5f);
         coord += offset;
@@ -78,44 +78,20 @@ void HexMemoryScenario::reset()
 
 void HexMemoryScenario::step()
 {
-    constexpr auto collectRadius = 1.0f;
-
     if (goodObjectsCollected >= int(goodObjects.size()) && !solved) {
         solved = true;
         doneWithTimer();
     }
 
-    for (int i = 0; i < env.getNumAgents(); ++i) {
-        auto agent = envState.agents[i];
-        const auto t = agent->absoluteTransformation().translation();
-        const auto agentCoords = vg.grid.getCoords(t);
-
-        // checking the surrounding voxels for objects we can collect
-        // (that's a lot of code, isn't it easier to just check all the objects globally lol)
-
-        for (int dx = -1; dx <= 1; ++dx)
-            for (int dz = -1; dz <= 1; ++dz) {
-                const VoxelCoords coords{agentCoords.x() + dx, agentCoords.y(), agentCoords.z() + dz};
-
-                if (!vg.grid.hasVoxel(coords))
-                    continue;
-
-                const auto voxel = vg.grid.get(coords);
-                for (auto it = voxel->objects.begin(); it != voxel->objects.end();) {
-                    const auto pillarPos = it->object->absoluteTransformation().translation();
-                    const auto distance = (pillarPos - t).length();
-                    if (distance < collectRadius) {
-                        // collecting the object
-                        rewardTeam(it->good ? Str::memoryCollectGood : Str::memoryCollectBad, i, 1);
-
-                        goodObjectsCollected += it->good;
-                        it->object->translate({100, 100, 100});
-                        it = voxel->objects.erase(it);
-                    } else
-                        ++it;
-                }
-            }
-    }
+    proximity.forEachAgentContact(env, envState, [&](int agentIdx, int id) {
+        // collecting the object
+        const bool good = proximity.tag(id);
+        rewardTeam(good ? Str::memoryCollectGood : Str::memoryCollectBad, agentIdx, 1);
+
+        goodObjectsCollected += good;
+        proximity.object(id)->translate({100, 100, 100});
+        proximity.remove(id);
+    });
 }
 
 std::vector<Magnum::Vector3> HexMemoryScenario::agentStartingPositions()
@@ -139,11 +115,7 @@ void HexMemoryScenario::spawnAgents(std::vector<AbstractAgent *> &agents)
 
     for (int i = 0; i < numAgents; ++i) {
         auto randomRotation = rotationBetweenAgents * i;
-        auto &agent = envState.scene->addChild<DefaultKinematicAgent>(
-            envState.scene.get(), envState.physics->bWorld,
-            Magnum::Vector3{agentPositions[i]} + Magnum::Vector3{0.5, 0.0, 0.5},
-            randomRotation, verticalLookLimitRad
-        );
+        auto &agent = addAgent(Magnum::Vector3{agentPositions[i]} + Magnum::Vector3{0.5, 0.0, 0.5}, randomRotation, verticalLookLimitRad);
         agent.updateTransform();
 
         agents.emplace_back(&agent);
@@ -196,6 +168,7 @@ void HexMemoryScenario::addEpisodeDrawables(DrawablesMap &drawables)
     // adding landmark object
     addObject(goodShape, goodObjectColor, landmarkLocation + shift[goodShape], scale[goodShape]);
     float objScale = 0.6;
+    constexpr auto collectRadius = 1.0f;
 
     bool isGood = true;
     for (const auto &objects : {goodObjects, badObjects}) {
@@ -204,12 +177,7 @@ void HexMemoryScenario::addEpisodeDrawables(DrawablesMap &drawables)
             auto color = isGood ? goodObjectColor : badObjectColor;
 
             const auto object = addObject(shape, color, coord + shift[shape] * objScale, scale[shape] * objScale);
-
-            const auto voxelCoord = vg.grid.getCoords(coord);
-            if (!vg.grid.hasVoxel(voxelCoord))
-                vg.grid.set(voxelCoord, VoxelHexMemory{});
-
-            vg.grid.get(voxelCoord)->objects.emplace_back(CollectableObject{object, isGood});
+            proximity.addStatic(object->absoluteTransformation().translation(), collectRadius, isGood, object);
         }
 
         isGood = !isGood;
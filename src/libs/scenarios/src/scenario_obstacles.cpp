@@ -1,4 +1,6 @@
 #include <set>
+#include <atomic>
+#include <utility>
 
 #include <Magnum/Math/Angle.h>
 
@@ -14,8 +16,39 @@ using namespace Megaverse;
 namespace
 {
 
+// minimum capacity of the layout cache, see ObstaclesScenario::reserveLayoutCache()
+std::atomic<size_t> reservedLayoutCacheSize{0};
+
+template<typename T>
+void writeVector(StateBuffer &buffer, const std::vector<T> &v)
+{
+    buffer.write(uint32_t(v.size()));
+    buffer.write(v.data(), v.size() * sizeof(T));
+}
+
+template<typename T>
+bool readVector(StateReader &reader, std::vector<T> &v)
+{
+    const auto n = reader.read<uint32_t>();
+    if (!reader.ok() || n * sizeof(T) > reader.remaining())
+        return false;
+
+    v.resize(n);
+    return reader.read(v.data(), n * sizeof(T));
+}
+
+/**
+ * One voxel of a baked layout, scene objects are not part of the layout.
+ */
+struct BakedVoxel
+{
+    VoxelCoords coords;
+    uint8_t voxelType, terrain;
+    ColorRgb color;
+};
+
 std::unique_ptr<Platform> makePlatform(
-    const std::vector<PlatformType> &platformTypes, Object3D *parent, Rng &rng,
+    const std::vector<PlatformType> &platformTypes, const GridTransform &parent, Rng &rng,
     int walls, const FloatParams &params, int width
 )
 {
@@ -48,6 +81,35 @@ ObstaclesScenario::ObstaclesScenario(const std::string &name, Env &env, Env::Env
 {
 }
 
+LruCache<std::string, ObstaclesLayout> & ObstaclesScenario::layoutCache()
+{
+    // shared between all envs in the process
+    static LruCache<std::string, ObstaclesLayout> cache;
+    return cache;
+}
+
+size_t ObstaclesScenario::layoutCacheCapacity() const
+{
+    const auto cacheSize = size_t(std::max(0L, lround(floatParams.at(Str::layoutCacheSize))));
+    return std::max(cacheSize, reservedLayoutCacheSize.load(std::memory_order_relaxed));
+}
+
+bool ObstaclesScenario::reserveLayoutCache(size_t numLayouts)
+{
+    auto reserved = reservedLayoutCacheSize.load();
+    while (reserved < numLayouts && !reservedLayoutCacheSize.compare_exchange_weak(reserved, numLayouts)) {}
+
+    return true;
+}
+
+bool ObstaclesScenario::isLayoutCached(int layoutSeed) const
+{
+    if (!layoutCacheCapacity())
+        return false;
+
+    return layoutCache().contains(layoutCacheKey(scenarioName, floatParams, env.getNumAgents(), layoutSeed));
+}
+
 void ObstaclesScenario::reset()
 {
     vg.reset(env, envState);
@@ -59,15 +121,143 @@ void ObstaclesScenario::reset()
     agentReachedExit = std::vector<bool>(env.getNumAgents(), false);
     solved = false;
 
+    cachedLayout.reset(), newLayout.reset(), episodeLayout.reset();
+
+    const auto cacheSize = layoutCacheCapacity();
+    if (cacheSize > 0) {
+        layoutCache().setCapacity(cacheSize);
+        layoutKey = layoutCacheKey(scenarioName, floatParams, env.getNumAgents(), envState.layoutSeed);
+
+        cachedLayout = layoutCache().get(layoutKey);
+        if (cachedLayout) {
+            restoreLayout(*cachedLayout);
+            episodeLayout = cachedLayout;
+            return;
+        }
+    }
+
+    if (envState.bakedLayout) {
+        if (auto baked = instantiateBakedLayout()) {
+            restoreLayout(*baked);
+            cachedLayout = episodeLayout = baked;
+            if (cacheSize > 0)
+                layoutCache().put(layoutKey, std::move(baked));
+            return;
+        }
+
+        TLOG(WARNING) << "Could not read the baked layout with seed " << envState.layoutSeed << ", generating it";
+        vg.reset(env, envState);
+    }
+
+    generateLayout();
+
+    if (cacheSize > 0) {
+        // boxes are added in addEpisodeDrawables(), after that the layout goes into the cache
+        newLayout = std::make_shared<ObstaclesLayout>();
+        newLayout->voxels = vg.snapshot();
+
+        for (auto &platform : platformsComponent.platforms)
+            for (auto &[terrainType, boxes] : platform->terrainBoxes)
+                for (auto &bb : boxes)
+                    newLayout->terrainBoxes.emplace_back(terrainType, bb.boundingBox());
+
+        newLayout->agentSpawnPositions = agentSpawnPositions;
+        newLayout->objectSpawnPositions = objectSpawnPositions;
+        newLayout->rewardSpawnPositions = rewardSpawnPositions;
+        newLayout->numPlatforms = numPlatforms;
+        newLayout->rng = envState.rng;
+    }
+}
+
+void ObstaclesScenario::restoreLayout(const ObstaclesLayout &layout)
+{
+    vg.restore(layout.voxels);
+
+    agentSpawnPositions = layout.agentSpawnPositions;
+    objectSpawnPositions = layout.objectSpawnPositions;
+    rewardSpawnPositions = layout.rewardSpawnPositions;
+    numPlatforms = layout.numPlatforms;
+    fallDetection.agentInitialPositions = agentSpawnPositions;
+
+    // continue with the same random sequence as if the layout was just generated
+    envState.rng = layout.rng;
+}
+
+bool ObstaclesScenario::bakeLayout(StateBuffer &buffer) const
+{
+    if (!episodeLayout)
+        return false;
+
+    const auto &layout = *episodeLayout;
+
+    // voxels of the snapshot only, the live grid also references the objects of the episode
+    std::vector<BakedVoxel> voxels;
+    ChunkedVoxelGrid<VoxelObstacles> grid{100, vg.grid.getOrigin(), vg.grid.getVoxelSize()};
+    grid.restore(layout.voxels);
+    grid.forEach([&](const VoxelCoords &coords, const VoxelObstacles &v) { voxels.push_back({coords, v.voxelType, v.terrain, v.color}); });
+    writeVector(buffer, voxels);
+
+    buffer.write(uint32_t(layout.boxes.size()));
+    for (const auto &[info, boxes] : layout.boxes) {
+        buffer.write(info);
+        writeVector(buffer, boxes);
+    }
+
+    writeVector(buffer, layout.terrainBoxes);
+    writeVector(buffer, layout.objectSpawnPositions);
+    writeVector(buffer, layout.rewardSpawnPositions);
+    writeVector(buffer, layout.agentSpawnPositions);
+    buffer.write(layout.numPlatforms);
+    buffer.write(layout.rng);
+    return true;
+}
+
+std::shared_ptr<ObstaclesLayout> ObstaclesScenario::instantiateBakedLayout()
+{
+    StateReader reader{envState.bakedLayout, envState.bakedLayoutBytes};
+    auto layout = std::make_shared<ObstaclesLayout>();
+
+    std::vector<BakedVoxel> voxels;
+    if (!readVector(reader, voxels))
+        return nullptr;
+
+    for (const auto &v : voxels)
+        vg.grid.set(v.coords, makeVoxel<VoxelObstacles>(v.voxelType, v.terrain, v.color));
+    layout->voxels = vg.snapshot();
+
+    const auto numBoxTypes = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < numBoxTypes && reader.ok(); ++i) {
+        const auto info = reader.read<BBoxInfo>();
+        readVector(reader, layout->boxes[info]);
+    }
+
+    readVector(reader, layout->terrainBoxes);
+    readVector(reader, layout->objectSpawnPositions);
+    readVector(reader, layout->rewardSpawnPositions);
+    readVector(reader, layout->agentSpawnPositions);
+    reader.read(layout->numPlatforms);
+    reader.read(layout->rng);
+
+    return reader.finished() ? layout : nullptr;
+}
+
+void ObstaclesScenario::generateLayout()
+{
     auto &platforms = platformsComponent.platforms;
 
     const bool drawWalls = randRange(0, 2, envState.rng);
 
     StartPlatform *startPlatform = nullptr;
 
-    // generating the level layout
-    for (int attempt = 0; attempt < 20; ++attempt) {
-        platforms.clear();
+    // generating the level layout, an attempt is abandoned as soon as a platform collides with an earlier one
+    constexpr int maxAttempts = 20;
+    for (int attempt = 0; attempt < maxAttempts; ++attempt) {
+        platformsComponent.clearPlatforms();
+
+        // the last attempt is used no matter what, so it has to produce a complete layout
+        const bool canReject = attempt + 1 < maxAttempts;
+        const auto collides = [&] { return platformsComponent.collidesWithEarlierPlatforms(int(platforms.size()) - 1); };
+        bool selfCollision = false;
 
         numPlatforms = randRange(
             int(lround(floatParams[Str::obstaclesMinNumPlatforms])),
@@ -77,7 +267,7 @@ void ObstaclesScenario::reset()
 
         static const std::vector<int> orientations = {ORIENTATION_STRAIGHT, ORIENTATION_TURN_LEFT, ORIENTATION_TURN_RIGHT};
 
-        auto startPlatformPtr = std::make_unique<StartPlatform>(platformsComponent.levelRoot.get(), envState.rng, floatParams);
+        auto startPlatformPtr = std::make_unique<StartPlatform>(platformsComponent.levelRoot, envState.rng, floatParams);
         startPlatformPtr->init(), startPlatformPtr->generate();
         int requiredWidth = startPlatformPtr->width;
 
@@ -89,13 +279,13 @@ void ObstaclesScenario::reset()
         int numMaxDifficultyObstacles = 0;
         int numAllowedMaxDifficultyObstacles = int(floatParams.at(Str::obstaclesNumAllowedMaxDifficulty));
 
-        for (int i = 0; i < numPlatforms; ++i) {
+        for (int i = 0; i < numPlatforms && !(selfCollision && canReject); ++i) {
             auto orientation = randomSample(orientations, envState.rng);
             requiredWidth = orientation == ORIENTATION_STRAIGHT ? requiredWidth : -1;
 
             std::unique_ptr<Platform> newPlatform;
             while (!newPlatform || (newPlatform->isMaxDifficulty() && numMaxDifficultyObstacles >= numAllowedMaxDifficultyObstacles)) {
-                newPlatform = makePlatform(platformTypes, previousPlatform->nextPlatformAnchor, envState.rng, WALLS_WEST | WALLS_EAST, floatParams, requiredWidth);
+                newPlatform = makePlatform(platformTypes, previousPlatform->anchorPoint(), envState.rng, WALLS_WEST | WALLS_EAST, floatParams, requiredWidth);
                 newPlatform->init();
             }
 
@@ -122,39 +312,38 @@ void ObstaclesScenario::reset()
                     break;
             }
 
+            selfCollision = collides() || selfCollision;
+
             if (orientation != ORIENTATION_STRAIGHT) {
                 int walls = WALLS_NORTH;
                 walls |= orientation == ORIENTATION_TURN_LEFT ? WALLS_WEST : WALLS_EAST;
                 const int w = previousPlatform->width, l = platform->width - 1;
 
-                platformsComponent.addPlatform(std::make_unique<TransitionPlatform>(previousPlatform->nextPlatformAnchor, envState.rng, walls, floatParams, l, w));
+                platformsComponent.addPlatform(std::make_unique<TransitionPlatform>(previousPlatform->anchorPoint(), envState.rng, walls, floatParams, l, w));
                 auto transitionPlatform = platforms.back().get();
 
                 transitionPlatform->init();
                 transitionPlatform->generate();
+
+                selfCollision = collides() || selfCollision;
             }
 
             previousPlatform = platform;
             requiredWidth = platform->width;
         }
 
-        auto exitPlatformPtr = std::make_unique<ExitPlatform>(previousPlatform->nextPlatformAnchor, envState.rng, floatParams, requiredWidth);
+        if (selfCollision && canReject) {
+            TLOG(INFO) << "Self collision! Attempt " << attempt << " re-generate!";
+            continue;
+        }
+
+        auto exitPlatformPtr = std::make_unique<ExitPlatform>(previousPlatform->anchorPoint(), envState.rng, floatParams, requiredWidth);
         exitPlatformPtr->init(), exitPlatformPtr->generate();
         platformsComponent.addPlatform(std::move(exitPlatformPtr));
 
-        // don't check collisions with self and with the previous platforms (there might be overlap)
-        bool selfCollision = false;
-        for (int j = 0; j < int(platforms.size()) && !selfCollision; ++j) {
-            for (int k = 0; k < j - 2; ++k) {
-                if (platforms[j]->collidesWith(*platforms[k])) {
-                    TLOG(INFO) << "Platform " << j << " collides with " << k;
-                    selfCollision = true;
-                    break;
-                }
-            }
-        }
+        selfCollision = collides() || selfCollision;
 
-        if (selfCollision)
+        if (selfCollision && canReject)
             TLOG(INFO) << "Self collision! Attempt " << attempt << " re-generate!";
         else
             break;
@@ -205,12 +394,14 @@ void ObstaclesScenario::step()
         const auto t = agent->absoluteTransformation().translation();
         const auto voxel = vg.grid.getCoords(t);
 
-        if (vg.grid.hasVoxel(voxel)) {
-            const auto terrainType = vg.grid.get(voxel)->terrain;
+        // const lookups, so the shared layout chunks are not copied
+        if (const auto *voxelData = std::as_const(vg.grid).get(voxel)) {
+            const auto terrainType = voxelData->terrain;
             if (terrainType & TERRAIN_EXIT) {
                 ++numAgentsAtExit;
                 if (!agentReachedExit[i]) {
                     agentReachedExit[i] = true;
+                    setAgentDone(i);
                     rewardTeam(Str::obstaclesAgentAtExit, i, 1);
 
                     if (objectStackingComponent.agentCarryingObject(i)) {
@@ -222,10 +413,10 @@ void ObstaclesScenario::step()
                 agentTouchedLava(i);
 
             // additional reward objects promote exploration
-            auto voxelData = vg.grid.get(voxel);
             if (voxelData->rewardObject) {
-                voxelData->rewardObject->translate({1000, 1000, 1000});
-                voxelData->rewardObject = nullptr;  // remove the reference, but the object will be later cleaned when we destroy the scene graph
+                auto rewardVoxel = vg.grid.get(voxel);
+                rewardVoxel->rewardObject->translate({1000, 1000, 1000});
+                rewardVoxel->rewardObject = nullptr;  // remove the reference, but the object will be later cleaned when we destroy the scene graph
                 rewardTeam(Str::obstaclesExtraReward, i, 1);
             }
         }
@@ -240,13 +431,27 @@ void ObstaclesScenario::step()
 
 void ObstaclesScenario::addEpisodeDrawables(DrawablesMap &drawables)
 {
-    addDrawablesAndCollisionObjectsFromVoxelGrid(vg, drawables, envState, 1);
-
-    // add terrains
-    for (auto &platform : platformsComponent.platforms)
-        for (auto &[terrainType, boxes] : platform->terrainBoxes)
-            for (auto &bb : boxes)
-                addTerrain(drawables, envState, terrainType, bb.boundingBox());
+    if (cachedLayout) {
+        addLayoutBoxes(drawables, envState, cachedLayout->boxes, 1);
+
+        for (auto &[terrainType, bb] : cachedLayout->terrainBoxes)
+            addTerrain(drawables, envState, terrainType, bb);
+    } else {
+        auto boundingBoxesByType = vg.toBoundingBoxes();
+        addLayoutBoxes(drawables, envState, boundingBoxesByType, 1);
+
+        // add terrains
+        for (auto &platform : platformsComponent.platforms)
+            for (auto &[terrainType, boxes] : platform->terrainBoxes)
+                for (auto &bb : boxes)
+                    addTerrain(drawables, envState, terrainType, bb.boundingBox());
+
+        if (newLayout) {
+            newLayout->boxes = std::move(boundingBoxesByType);
+            episodeLayout = newLayout;
+            layoutCache().put(layoutKey, std::move(newLayout));
+        }
+    }
 
     objectStackingComponent.addDrawablesAndCollisions(drawables, envState, objectSpawnPositions);
 
@@ -1,5 +1,5 @@
-#include <set>
 #include <queue>
+#include <bitset>
 
 #include <scenarios/scenario_rearrange.hpp>
 
@@ -8,10 +8,28 @@ using namespace Magnum;
 using namespace Megaverse;
 
 
+namespace
+{
+
+/**
+ * Arrangement offsets stay within x, z in [-2, 2] and y in [0, 1], so the occupancy fits into a small bitset.
+ */
+constexpr int arrangementRange = 2, arrangementSide = 2 * arrangementRange + 1;
+
+using ArrangementCells = std::bitset<arrangementSide * arrangementSide * 2>;
+
+int arrangementCell(const VoxelCoords &offset)
+{
+    return (offset.y() * arrangementSide + offset.x() + arrangementRange) * arrangementSide + offset.z() + arrangementRange;
+}
+
+}
+
+
 class RearrangeScenario::RearrangePlatform : public EmptyPlatform
 {
 public:
-    explicit RearrangePlatform(Object3D *parent, Rng &rng, int walls, const FloatParams &params, int)
+    explicit RearrangePlatform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params, int)
     : EmptyPlatform(parent, rng, walls, params)
     {
     }
@@ -51,12 +69,13 @@ void RearrangeScenario::reset()
     objectStackingComponent.reset(env, envState);
     platformsComponent.reset(env, envState);
 
-    platform = std::make_unique<RearrangePlatform>(platformsComponent.levelRoot.get(), envState.rng, WALLS_ALL, floatParams, env.getNumAgents());
+    platform = std::make_unique<RearrangePlatform>(platformsComponent.levelRoot, envState.rng, WALLS_ALL, floatParams, env.getNumAgents());
     platform->init(), platform->generate();
     vg.addPlatform(*platform, ColorRgb::DARK_GREY, ColorRgb::DARK_GREY, randomBool(envState.rng));
 
     arrangement = Arrangement{};
     arrangementObjects.clear();
+    numMatchingObjects = maxMatchingObjects = 0;
 
     generateArrangement();
 }
@@ -67,12 +86,12 @@ void RearrangeScenario::generateArrangement()
 
     // bfs
     std::queue<ArrangementItem> q;
-    std::unordered_set<VoxelCoords> used;
+    ArrangementCells used;
 
     const auto firstItem = ArrangementItem::random(envState.rng, {0, 0, 0});
     q.push(firstItem);
     arrangement.items.emplace_back(firstItem);
-    used.insert({0, 0, 0});
+    used.set(arrangementCell({0, 0, 0}));
 
     std::vector<VoxelCoords> directions{
         {-1, 0, 0},
@@ -99,17 +118,17 @@ void RearrangeScenario::generateArrangement()
             if (newOffset.y() >= 2 || abs(newOffset.x()) >= 2 || abs(newOffset.z()) >= 2)
                 continue;
 
-            if (used.count(newOffset))
+            if (used.test(arrangementCell(newOffset)))
                 continue;
 
             // item has to be on the floor or on top of another item
-            if (!(newOffset.y() == 0 || used.count(below)))
+            if (!(newOffset.y() == 0 || used.test(arrangementCell(below))))
                 continue;
 
             const auto newItem = ArrangementItem::random(envState.rng, newOffset);
             q.push(newItem);
             arrangement.items.emplace_back(newItem);
-            used.insert(newOffset);
+            used.set(arrangementCell(newOffset));
             ++numBranches;
             if (numBranches >= maxBranches)
                 break;
@@ -134,44 +153,36 @@ bool RearrangeScenario::canPlaceObject(int, const VoxelCoords &coord, Object3D *
     return abs(delta.x()) <= 2 && abs(delta.z()) <= 2;
 }
 
-int RearrangeScenario::countMatchingObjects() const
+bool RearrangeScenario::matchesArrangement(const ArrangementObject &obj, const VoxelCoords &coords) const
 {
-    int matching = 0;
-    for (const auto *obj : arrangementObjects) {
-        if (obj->pickedUp)
-            continue;
-
-        const auto voxelCoords = vg.grid.getCoords(obj->absoluteTransformation().translation());
-        const auto offset = voxelCoords - rightCenter;
-        if (arrangement.contains(obj->arrangementItem.shape, obj->arrangementItem.color, offset))
-            ++matching;
-    }
-
-    return matching;
+    return arrangement.contains(obj.arrangementItem.shape, obj.arrangementItem.color, coords - rightCenter);
 }
 
-void RearrangeScenario::placedObject(int agentIdx, const VoxelCoords &, Object3D *obj)
+void RearrangeScenario::placedObject(int agentIdx, const VoxelCoords &coords, Object3D *obj)
 {
-    dynamic_cast<ArrangementObject *>(obj)->pickedUp = false;
+    auto arrangementObject = dynamic_cast<ArrangementObject *>(obj);
+    arrangementObject->matching = matchesArrangement(*arrangementObject, coords);
+    numMatchingObjects += arrangementObject->matching;
+
     checkDone(agentIdx);
 }
 
-void RearrangeScenario::pickedObject(int agentIdx, const VoxelCoords &, Object3D *obj)
+void RearrangeScenario::pickedObject(int, const VoxelCoords &, Object3D *obj)
 {
-    dynamic_cast<ArrangementObject *>(obj)->pickedUp = true;
-    checkDone(agentIdx);
+    // the number of matches can only go down here, nothing to reward or finish
+    auto arrangementObject = dynamic_cast<ArrangementObject *>(obj);
+    numMatchingObjects -= arrangementObject->matching;
+    arrangementObject->matching = false;
 }
 
 void RearrangeScenario::checkDone(int agentIdx)
 {
-    const auto matches = countMatchingObjects();
-
-    if (matches > maxMatchingObjects) {
+    if (numMatchingObjects > maxMatchingObjects) {
         rewardTeam(Str::rearrangeOneMoreObjectCorrectPosition, agentIdx, 1);
-        maxMatchingObjects = matches;
+        maxMatchingObjects = numMatchingObjects;
     }
 
-    if (matches >= int(arrangement.items.size()) && !solved) {
+    if (numMatchingObjects >= int(arrangement.items.size()) && !solved) {
         solved = true;
         rewardTeam(Str::rearrangeAllObjectsCorrectPosition, agentIdx, 1);
         doneWithTimer();
@@ -210,9 +221,9 @@ void RearrangeScenario::arrangementDrawables(DrawablesMap &drawables, const Arra
 
     const auto objSize = 0.45f;
 
-    std::unordered_set<VoxelCoords> occupied;
+    ArrangementCells occupied;
     for (const auto &item : arr.items)
-        occupied.insert(item.offset);
+        occupied.set(arrangementCell(item.offset));
 
     int numUnmovedItems = arr.items.size();
     if (interactive)
@@ -226,18 +237,16 @@ void RearrangeScenario::arrangementDrawables(DrawablesMap &drawables, const Arra
         if (interactive && placedItems >= numUnmovedItems) {
             // random offset
             VoxelCoords newOffset = item.offset;
-            while (occupied.count(newOffset))
+            while (occupied.test(arrangementCell(newOffset)))
                 newOffset = VoxelCoords{randRange(-2, 3, envState.rng), 0, randRange(-2, 3, envState.rng)};
 
             pos = newOffset + center;
-            occupied.insert(newOffset);
+            occupied.set(arrangementCell(newOffset));
         }
 
         auto translation = Magnum::Vector3{float(pos.x()) + 0.5f, float(pos.y()) + 0.5f, float(pos.z()) + 0.5f};
 
-        auto bBoxShape = std::make_unique<btBoxShape>(btVector3{1, 1, 1});
-
-        auto &object = envState.scene->addChild<ArrangementObject>(envState.scene.get(), 0.0f, bBoxShape.get(), envState.physics->bWorld);
+        auto &object = envState.scene->addChild<ArrangementObject>(envState.scene.get(), 0.0f, CollisionShapeCache::unitBox(), envState.physics->bWorld);
         object.arrangementItem = item;
 
         object.scale(scales.at(item.shape) * objSize).translate(translation);
@@ -248,9 +257,7 @@ void RearrangeScenario::arrangementDrawables(DrawablesMap &drawables, const Arra
 
         object.syncPose();
 
-        drawables[item.shape].emplace_back(&object, rgb(item.color));
-
-        envState.physics->collisionShapes.emplace_back(std::move(bBoxShape));
+        drawables[item.shape].emplace_back(&object, item.color);
 
         if (interactive) {
             VoxelRearrange voxelState;
@@ -258,6 +265,9 @@ void RearrangeScenario::arrangementDrawables(DrawablesMap &drawables, const Arra
             vg.grid.set(pos, voxelState);
 
             arrangementObjects.emplace_back(&object);
+
+            object.matching = matchesArrangement(object, pos);
+            numMatchingObjects += object.matching;
         }
 
         ++placedItems;
@@ -279,7 +289,7 @@ void RearrangeScenario::addEpisodeDrawables(DrawablesMap &drawables)
     arrangementDrawables(drawables, arrangement, leftCenter, false);
     arrangementDrawables(drawables, arrangement, rightCenter, true);
 
-    maxMatchingObjects = countMatchingObjects();
+    maxMatchingObjects = numMatchingObjects;
     TLOG(DEBUG) << "Initial num matching objects: " << maxMatchingObjects;
 
     Vector3 platformCenter = {9.5, 0, 7};
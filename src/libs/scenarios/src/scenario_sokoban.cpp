@@ -1,5 +1,4 @@
 #include <regex>
-#include <iomanip>
 
 #include <util/string_utils.hpp>
 #include <util/filesystem_utils.hpp>
@@ -14,17 +13,6 @@ using namespace Magnum::Math::Literals;
 namespace
 {
 
-enum SokobanNotation
-{
-    EMPTY_CELL = ' ',
-    GOAL_CELL = '.',
-    PLAYER_CELL = '@',
-    PLAYER_ON_GOAL = '+',
-    BOX_CELL = '$',
-    BOX_ON_GOAL = '*',
-    WALL_CELL = '#',
-};
-
 enum SokobanTerrain
 {
     SOKO_EMPTY = 0,
@@ -58,61 +46,22 @@ SokobanScenario::SokobanScenario(const std::string &name, Env &env, Env::EnvStat
         boxobanLevelsDir = std::regex_replace(boxobanLevelsDir, std::regex("~"), envvarHome);
     }
 
-    auto dirWithLevels = pathJoin(boxobanLevelsDir, levelSet, levelSplit);
-
-    for (int levelFileIdx = 0; levelFileIdx <= 999; ++levelFileIdx) {
-        std::ostringstream ss;
-        ss << std::setw(3) << std::setfill('0') << levelFileIdx << ".txt";
-        auto levelFilePath = pathJoin(dirWithLevels, ss.str());
-        if (fileExists(levelFilePath))
-            allSokobanLevelFiles.emplace_back(levelFilePath);
-    }
-
-    if (allSokobanLevelFiles.empty())
-        TLOG(FATAL) << "Could not find any Boxoban levels. Set envvar BOXOBAN_LEVELS or put unzipped Boxoban folder "
-                       "(named boxoban) containing unfiltered/medium/hard level splits into ~/datasets";
-
-    TLOG(INFO) << allSokobanLevelFiles.size() << " boxoban level files found";
+    levels = &SokobanLevelDatabase::get(pathJoin(boxobanLevelsDir, levelSet, levelSplit));
 }
 
 SokobanScenario::~SokobanScenario() = default;
 
-void SokobanScenario::reloadLevels()
-{
-    const auto levelFilePath = randomSample(allSokobanLevelFiles, envState.rng);
-
-    std::vector<char> buffer;
-    const auto bytesRead = readAllBytes(levelFilePath, buffer);
-    if (!bytesRead)
-        TLOG(FATAL) << "Could not read the level file " << levelFilePath;
-
-    std::string content{buffer.begin(), buffer.end()};
-    auto lines = splitString(content, "\n");
-    SokobanLevel level;
-    for (int i = 0; i < int(lines.size()); ++i) {
-        if (startsWith(lines[i], ";")) {
-            if (i > 0) levels.emplace_back(std::move(level));
-            level = SokobanLevel{};
-        } else
-            level.rows.emplace_back(lines[i]);
-    }
-
-    std::shuffle(levels.begin(), levels.end(), envState.rng);
-}
-
 void SokobanScenario::reset()
 {
     vg.reset(env, envState);
     solved = false;
     agentPositions.clear(), boxesCoords.clear();
+    boxBodies.clear(), boxVoxels.clear();
     length = width = 0;
+    layoutBoxes.clear();
     numBoxes = numBoxesOnGoal = 0;
 
-    if (levels.empty())
-        reloadLevels();
-
-    currLevel = levels.back();
-    levels.pop_back();
+    currLevelIdx = size_t(randRange(0, int(levels->size()), envState.rng));
 
     createLayout();
 }
@@ -131,22 +80,25 @@ void SokobanScenario::createLayout()
     };
     auto floorColor = randomSample(floorColors, envState.rng);
 
-    length = int(currLevel.rows.size());
-    for (int x = 0; x < length; ++x) {
-        const auto &row = currLevel.rows[x];
-        width = std::max(width, int(row.size()));
+    // the voxel grid is still needed for the interactions and collision queries, the geometry comes from the
+    // blocks merged when the level database was built
+    for (int x = 0; x < levels->rows(); ++x) {
+        for (int z = 0; z < levels->cols(); ++z) {
+            const auto cell = [&](SokobanPlane plane) { return levels->cell(currLevelIdx, plane, x, z); };
+            if (!cell(SokobanPlane::Floor))
+                continue;
 
-        for (int z = 0; z < int(row.size()); ++z) {
+            length = std::max(length, x + 1), width = std::max(width, z + 1);
             g.set({x, 0, z}, makeVoxel<VoxelWithPhysicsObjects>(VOXEL_SOLID | VOXEL_OPAQUE, TERRAIN_NONE, floorColor));
 
-            if (row[z] == WALL_CELL) {
+            if (cell(SokobanPlane::Wall)) {
                 for (int y = 1; y <= wallHeight; ++y)
                     g.set({x, y, z}, makeVoxel<VoxelWithPhysicsObjects>(VOXEL_SOLID));
 
                 g.get(VoxelCoords{x, 1, z})->terrain = SOKO_WALL;
             }
 
-            if (row[z] == PLAYER_CELL || row[z] == PLAYER_ON_GOAL) {
+            if (cell(SokobanPlane::Player)) {
                 for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
                     const float agentX = float(x) + float(agentIdx % 2) * 0.5f;
                     const float agentZ = float(z) + float(agentIdx % 4 > 1) * 0.5f;
@@ -154,15 +106,23 @@ void SokobanScenario::createLayout()
                 }
             }
 
-            if (row[z] == GOAL_CELL || row[z] == PLAYER_ON_GOAL)
+            if (cell(SokobanPlane::Goal))
                 g.set({x, 1, z}, makeVoxel<VoxelWithPhysicsObjects>(VOXEL_EMPTY, SOKO_GOAL));
 
-            if (row[z] == BOX_CELL || row[z] == BOX_ON_GOAL) {
+            if (cell(SokobanPlane::Box)) {
                 boxesCoords.emplace_back(x, 1, z);
                 ++numBoxes;
             }
         }
     }
+
+    const auto rects = levels->rects(currLevelIdx);
+    for (auto r = rects.first; r != rects.second; ++r) {
+        if (SokobanPlane(r->plane) == SokobanPlane::Floor)
+            layoutBoxes[BBoxInfo(VOXEL_SOLID | VOXEL_OPAQUE, floorColor)].emplace_back(r->x0, 0, r->z0, r->x1, 0, r->z1);
+        else
+            layoutBoxes[BBoxInfo(VOXEL_SOLID, ColorRgb::LAYOUT_DEFAULT)].emplace_back(r->x0, 1, r->z0, r->x1, wallHeight, r->z1);
+    }
 }
 
 void SokobanScenario::step()
@@ -206,6 +166,9 @@ void SokobanScenario::step()
                             desiredPosVoxel->physicsObject->syncPose();
                             voxel->physicsObject = nullptr;
 
+                            const auto boxIdx = std::find(boxBodies.begin(), boxBodies.end(), desiredPosVoxel->physicsObject) - boxBodies.begin();
+                            boxVoxels[boxIdx] = desiredPos;
+
                             // moved the box
                             if (voxel->terrain != SOKO_GOAL && desiredPosVoxel->terrain == SOKO_GOAL) {
                                 // moved the box to the goal position
@@ -239,7 +202,7 @@ std::vector<Magnum::Vector3> SokobanScenario::agentStartingPositions()
 
 void SokobanScenario::addEpisodeDrawables(DrawablesMap &drawables)
 {
-    addDrawablesAndCollisionObjectsFromVoxelGrid(vg, drawables, envState, vg.grid.getVoxelSize());
+    addLayoutBoxes(drawables, envState, layoutBoxes, vg.grid.getVoxelSize());
 
     const static std::map<SokobanTerrain, ColorRgb> colors = {
         {SOKO_WALL, ColorRgb::LIGHT_ORANGE},
@@ -268,7 +231,7 @@ void SokobanScenario::addEpisodeDrawables(DrawablesMap &drawables)
             terrainObject.translate({0.0, h, 0.0});
             terrainObject.translate(pos);
 
-            drawables[DrawableType::Box].emplace_back(&terrainObject, rgb(colors.at(SokobanTerrain(v->terrain))));
+            drawables[DrawableType::Box].emplace_back(&terrainObject, colors.at(SokobanTerrain(v->terrain)));
         }
     }
 
@@ -278,18 +241,45 @@ void SokobanScenario::addEpisodeDrawables(DrawablesMap &drawables)
 
         auto &layoutBox = envState.scene->addChild<Object3D>();
         layoutBox.scale(scale).translate(translation);
-        drawables[DrawableType::Box].emplace_back(&layoutBox, rgb(ColorRgb::DARK_BLUE));
+        drawables[DrawableType::Box].emplace_back(&layoutBox, ColorRgb::DARK_BLUE);
 
-        auto bBoxShape = std::make_unique<btBoxShape>(btVector3{1, 1, 1});
-        auto &collisionBox = layoutBox.addChild<RigidBody>(envState.scene.get(), 0.0f, bBoxShape.get(), envState.physics->bWorld);
+        auto &collisionBox = layoutBox.addChild<RigidBody>(envState.scene.get(), 0.0f, CollisionShapeCache::unitBox(), envState.physics->bWorld);
         collisionBox.setCollisionScale({1.15, 3, 1.15});
         collisionBox.setCollisionOffset({0, 0.6, 0});
         collisionBox.syncPose();
-        envState.physics->collisionShapes.emplace_back(std::move(bBoxShape));
 
         if (!g.hasVoxel({box}))
             g.set(box, makeVoxel<VoxelWithPhysicsObjects>(VOXEL_EMPTY));
 
         g.get(box)->physicsObject = &collisionBox;
+        boxBodies.emplace_back(&collisionBox);
+        boxVoxels.emplace_back(box);
+    }
+}
+
+bool SokobanScenario::saveState(StateBuffer &buffer) const
+{
+    buffer.write(numBoxesOnGoal);
+    buffer.write(solved);
+    buffer.write(boxVoxels.data(), boxVoxels.size() * sizeof(VoxelCoords));
+    return true;
+}
+
+void SokobanScenario::restoreState(StateReader &reader)
+{
+    reader.read(numBoxesOnGoal);
+    reader.read(solved);
+
+    // box bodies were moved back by the env, the voxels have to point to them again
+    for (const auto &coords : boxVoxels)
+        vg.grid.get(coords)->physicsObject = nullptr;
+
+    reader.read(boxVoxels.data(), boxVoxels.size() * sizeof(VoxelCoords));
+
+    for (size_t i = 0; i < boxVoxels.size(); ++i) {
+        if (!vg.grid.hasVoxel(boxVoxels[i]))
+            vg.grid.set(boxVoxels[i], makeVoxel<VoxelWithPhysicsObjects>(VOXEL_EMPTY));
+
+        vg.grid.get(boxVoxels[i])->physicsObject = boxBodies[i];
     }
 }
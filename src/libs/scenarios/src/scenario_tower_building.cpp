@@ -8,7 +8,7 @@ using namespace Megaverse;
 class TowerBuildingScenario::TowerBuildingPlatform : public EmptyPlatform
 {
 public:
-    explicit TowerBuildingPlatform(Object3D *parent, Rng &rng, int walls, const FloatParams &params, int numAgents)
+    explicit TowerBuildingPlatform(const GridTransform &parent, Rng &rng, int walls, const FloatParams &params, int numAgents)
     : EmptyPlatform(parent, rng, walls, params)
     , numAgents{numAgents}
     {
@@ -84,7 +84,7 @@ public:
         const VoxelCoords minCoord{buildZoneXOffset, 1, buildZoneZOffset},
                           maxCoord{buildZoneXOffset + buildZoneLength, 1, buildZoneZOffset + buildZoneWidth};
 
-        MagnumAABB buildingZoneBB{*root, {minCoord, maxCoord}};
+        PlatformAABB buildingZoneBB{root, {minCoord, maxCoord}};
         terrainBoxes[TERRAIN_BUILDING_ZONE].emplace_back(buildingZoneBB);
     }
 
@@ -140,13 +140,13 @@ void TowerBuildingScenario::reset()
     while (layoutColor == ColorRgb::BUILDING_ZONE)
         layoutColor = randomLayoutColor(envState.rng);
 
-    platform = std::make_unique<TowerBuildingPlatform>(platformsComponent.levelRoot.get(), envState.rng, WALLS_ALL, floatParams, env.getNumAgents());
+    platform = std::make_unique<TowerBuildingPlatform>(platformsComponent.levelRoot, envState.rng, WALLS_ALL, floatParams, env.getNumAgents());
     platform->init(), platform->generate();
     vg.addPlatform(*platform, layoutColor, randomLayoutColor(envState.rng), randomBool(envState.rng));
 
     buildingZone = platform->terrainBoxes[TERRAIN_BUILDING_ZONE].front().boundingBox();
 
-    currBuildingZoneReward = 0.0f;
+    buildingZoneReward = currBuildingZoneReward = 0.0f;
     objectsInBuildingZone.clear();
     highestTower = 0;
 
@@ -168,9 +168,8 @@ void TowerBuildingScenario::addEpisodeDrawables(DrawablesMap &drawables)
 
     const auto objectPositions = platform->generateObjectPositions(-1);
     for (const auto &pos : objectPositions)
-        if (isInBuildingZone(pos))
-            objectsInBuildingZone.insert(pos);
-    currBuildingZoneReward = calculateTowerReward();
+        addToBuildingZone(pos);
+    currBuildingZoneReward = buildingZoneReward;
     TLOG(INFO) << "Initial tower reward: " << currBuildingZoneReward;
 
     objectStackingComponent.addDrawablesAndCollisions(drawables, envState, objectPositions);
@@ -183,16 +182,14 @@ void TowerBuildingScenario::step()
 
     for (int i = 0; i < env.getNumAgents(); ++i) {
         // reward shaping: give agents reward for visiting bulding zone while carrying the object
-        if (objectStackingComponent.agentCarryingObject(i)) {
+        if (!agentState[i].visitedBuildingZoneWithObject && objectStackingComponent.agentCarryingObject(i)) {
             const auto &agent = envState.agents[i];
             const auto t = agent->transformation().translation();
 
             VoxelCoords voxel = vg.grid.getCoords(t);
             if (isInBuildingZone(voxel)) {
-                if (!agentState[i].visitedBuildingZoneWithObject) {
-                    rewardTeam(Str::towerVisitedBuildingZoneWithObject, i, 1);
-                    agentState[i].visitedBuildingZoneWithObject = true;
-                }
+                rewardTeam(Str::towerVisitedBuildingZoneWithObject, i, 1);
+                agentState[i].visitedBuildingZoneWithObject = true;
             }
         }
     }
@@ -205,9 +202,7 @@ bool TowerBuildingScenario::canPlaceObject(int, const VoxelCoords &c, Object3D *
 
 void TowerBuildingScenario::placedObject(int agentIdx, const VoxelCoords &voxel, Object3D *)
 {
-    if (isInBuildingZone(voxel))
-        objectsInBuildingZone.insert(voxel);
-
+    addToBuildingZone(voxel);
     addCollectiveReward(agentIdx);
 
     highestTower = std::max(highestTower, voxel.y() - buildingZone.min.y() + 1);
@@ -215,8 +210,7 @@ void TowerBuildingScenario::placedObject(int agentIdx, const VoxelCoords &voxel,
 
 void TowerBuildingScenario::pickedObject(int agentIdx, const VoxelCoords &voxel, Object3D *)
 {
-    if (isInBuildingZone(voxel))
-        objectsInBuildingZone.erase(voxel);
+    removeFromBuildingZone(voxel);
 
     if (!agentState[agentIdx].pickedUpObject) {
         rewardAgent(Str::towerPickedUpObject, agentIdx, 1);
@@ -229,15 +223,16 @@ bool TowerBuildingScenario::isInBuildingZone(const VoxelCoords &c) const
     return c.x() >= buildingZone.min.x() && c.x() < buildingZone.max.x() && c.z() >= buildingZone.min.z() && c.z() < buildingZone.max.z();
 }
 
-float TowerBuildingScenario::calculateTowerReward() const
+void TowerBuildingScenario::addToBuildingZone(const VoxelCoords &c)
 {
-    float reward = 0.0f;
-    for (auto &pos : objectsInBuildingZone) {
-        auto height = pos.y();
-        reward += buildingRewardCoeffForHeight(height);
-    }
+    if (isInBuildingZone(c) && objectsInBuildingZone.insert(c).second)
+        buildingZoneReward += buildingRewardCoeffForHeight(c.y());
+}
 
-    return reward;
+void TowerBuildingScenario::removeFromBuildingZone(const VoxelCoords &c)
+{
+    if (isInBuildingZone(c) && objectsInBuildingZone.erase(c))
+        buildingZoneReward -= buildingRewardCoeffForHeight(c.y());
 }
 
 /**
@@ -252,11 +247,10 @@ float TowerBuildingScenario::buildingRewardCoeffForHeight(float height)
 
 void TowerBuildingScenario::addCollectiveReward(int agentIdx)
 {
-    auto newReward = calculateTowerReward();
-    auto rewardDelta = newReward - currBuildingZoneReward;
-    // TLOG(INFO) << "Curr reward: " << rewardDelta << " new reward: " << newReward;
+    // picking up an object is not penalized right away, the difference is accounted for on the next placement
+    auto rewardDelta = buildingZoneReward - currBuildingZoneReward;
 
-    currBuildingZoneReward = newReward;
+    currBuildingZoneReward = buildingZoneReward;
     rewardTeam(Str::towerBuildingReward, agentIdx, rewardDelta);
 }
 
@@ -0,0 +1,269 @@
+#include <map>
+#include <mutex>
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+
+#include <util/tiny_logger.hpp>
+#include <util/string_utils.hpp>
+
+#include <scenarios/sokoban_levels.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+enum SokobanNotation
+{
+    EMPTY_CELL = ' ',
+    GOAL_CELL = '.',
+    PLAYER_CELL = '@',
+    PLAYER_ON_GOAL = '+',
+    BOX_CELL = '$',
+    BOX_ON_GOAL = '*',
+    WALL_CELL = '#',
+};
+
+}
+
+
+const SokobanLevelDatabase & SokobanLevelDatabase::get(const std::string &dirWithLevels)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::unique_ptr<SokobanLevelDatabase>> databases;
+
+    std::lock_guard<std::mutex> lock{mutex};
+
+    auto &db = databases[dirWithLevels];
+    if (db)
+        return *db;
+
+    const auto cachePath = cacheFilename(dirWithLevels);
+    db = load(cachePath);
+    if (db) {
+        TLOG(INFO) << db->size() << " boxoban levels mapped from " << cachePath;
+        return *db;
+    }
+
+    const auto files = levelFiles(dirWithLevels);
+    if (files.empty())
+        TLOG(FATAL) << "Could not find any Boxoban levels. Set envvar BOXOBAN_LEVELS or put unzipped Boxoban folder "
+                       "(named boxoban) containing unfiltered/medium/hard level splits into ~/datasets";
+
+    db.reset(new SokobanLevelDatabase{files});
+    TLOG(INFO) << db->size() << " boxoban levels parsed from " << files.size() << " files";
+
+    if (db->save(cachePath)) {
+        // map the cache right away, so the pages are shared with other processes instead of a private copy
+        if (auto mappedDb = load(cachePath))
+            db = std::move(mappedDb);
+    } else {
+        TLOG(WARNING) << "Could not write the level cache " << cachePath << ", keeping the levels in memory";
+    }
+
+    return *db;
+}
+
+SokobanLevelDatabase::SokobanLevelDatabase(const std::vector<std::string> &levelFiles)
+{
+    std::vector<SokobanLevel> levels;
+
+    for (const auto &levelFilePath : levelFiles) {
+        std::vector<char> fileBytes;
+        if (!readAllBytes(levelFilePath, fileBytes))
+            TLOG(FATAL) << "Could not read the level file " << levelFilePath;
+
+        // every level starts with a "; <idx>" line
+        std::string content{fileBytes.begin(), fileBytes.end()};
+        auto lines = splitString(content, "\n");
+        SokobanLevel level;
+        for (int i = 0; i < int(lines.size()); ++i) {
+            if (startsWith(lines[i], ";")) {
+                if (!level.rows.empty()) levels.emplace_back(std::move(level));
+                level = SokobanLevel{};
+            } else
+                level.rows.emplace_back(lines[i]);
+        }
+        if (!level.rows.empty())
+            levels.emplace_back(std::move(level));
+    }
+
+    Header h{};
+    memcpy(h.magic, magic, sizeof(magic));
+    for (const auto &level : levels) {
+        h.rows = std::max(h.rows, uint32_t(level.rows.size()));
+        for (const auto &row : level.rows)
+            h.cols = std::max(h.cols, uint32_t(row.size()));
+    }
+
+    // rects store uint8 coordinates
+    if (h.rows > 256 || h.cols > 256)
+        TLOG(FATAL) << "Sokoban levels larger than 256x256 are not supported, got " << h.rows << "x" << h.cols;
+
+    h.numLevels = levels.size();
+    // multiple of 4 bytes, so the uint32 offsets after the planes are aligned
+    h.planeBytes = (h.rows * h.cols + 31) / 32 * 4;
+
+    std::vector<uint8_t> planeBits(h.numLevels * size_t(SokobanPlane::NumPlanes) * h.planeBytes, 0);
+    std::vector<uint32_t> offsets{0};
+    std::vector<SokobanRect> allRects;
+
+    std::vector<uint8_t> mask(h.rows * h.cols);
+
+    for (size_t i = 0; i < levels.size(); ++i) {
+        auto *levelPlanes = planeBits.data() + i * size_t(SokobanPlane::NumPlanes) * h.planeBytes;
+        const auto setBit = [&](SokobanPlane plane, size_t x, size_t z) {
+            const auto bit = x * h.cols + z;
+            levelPlanes[size_t(plane) * h.planeBytes + bit / 8] |= uint8_t(1 << (bit % 8));
+        };
+
+        for (size_t x = 0; x < levels[i].rows.size(); ++x) {
+            const auto &row = levels[i].rows[x];
+            for (size_t z = 0; z < row.size(); ++z) {
+                setBit(SokobanPlane::Floor, x, z);
+
+                switch (row[z]) {
+                    case WALL_CELL: setBit(SokobanPlane::Wall, x, z); break;
+                    case GOAL_CELL: setBit(SokobanPlane::Goal, x, z); break;
+                    case BOX_CELL: setBit(SokobanPlane::Box, x, z); break;
+                    case BOX_ON_GOAL: setBit(SokobanPlane::Box, x, z); setBit(SokobanPlane::Goal, x, z); break;
+                    case PLAYER_CELL: setBit(SokobanPlane::Player, x, z); break;
+                    case PLAYER_ON_GOAL: setBit(SokobanPlane::Player, x, z); setBit(SokobanPlane::Goal, x, z); break;
+                    default: break;
+                }
+            }
+        }
+
+        // greedy 2D merge, same result for every episode with this level, so it's done here once
+        for (auto plane : {SokobanPlane::Floor, SokobanPlane::Wall}) {
+            const auto *bits = levelPlanes + size_t(plane) * h.planeBytes;
+            for (size_t bit = 0; bit < mask.size(); ++bit)
+                mask[bit] = (bits[bit / 8] >> (bit % 8)) & 1;
+
+            const auto unmerged = [&](uint32_t x, uint32_t z) { return mask[x * h.cols + z] != 0; };
+
+            for (uint32_t x0 = 0; x0 < h.rows; ++x0)
+                for (uint32_t z0 = 0; z0 < h.cols; ++z0) {
+                    if (!unmerged(x0, z0))
+                        continue;
+
+                    auto z1 = z0;
+                    while (z1 + 1 < h.cols && unmerged(x0, z1 + 1))
+                        ++z1;
+
+                    auto x1 = x0;
+                    while (x1 + 1 < h.rows) {
+                        bool fullRow = true;
+                        for (auto z = z0; z <= z1 && fullRow; ++z)
+                            fullRow = unmerged(x1 + 1, z);
+                        if (!fullRow)
+                            break;
+                        ++x1;
+                    }
+
+                    for (auto x = x0; x <= x1; ++x)
+                        for (auto z = z0; z <= z1; ++z)
+                            mask[x * h.cols + z] = 0;
+
+                    allRects.push_back({uint8_t(x0), uint8_t(z0), uint8_t(x1), uint8_t(z1), uint8_t(plane)});
+                }
+        }
+
+        offsets.emplace_back(uint32_t(allRects.size()));
+    }
+
+    h.numRects = uint32_t(allRects.size());
+
+    buffer.resize(imageSize(h));
+    auto *dst = buffer.data();
+    memcpy(dst, &h, sizeof(h)), dst += sizeof(h);
+    memcpy(dst, planeBits.data(), planeBits.size()), dst += planeBits.size();
+    memcpy(dst, offsets.data(), offsets.size() * sizeof(uint32_t)), dst += offsets.size() * sizeof(uint32_t);
+    memcpy(dst, allRects.data(), allRects.size() * sizeof(SokobanRect));
+
+    image = buffer.data();
+}
+
+std::unique_ptr<SokobanLevelDatabase> SokobanLevelDatabase::load(const std::string &filename)
+{
+    auto file = std::make_unique<MappedFile>(filename);
+    if (!file->isOpen() || file->size() < sizeof(Header))
+        return nullptr;
+
+    Header header{};
+    memcpy(&header, file->data(), sizeof(Header));
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0)
+        return nullptr;
+
+    if (file->size() != imageSize(header)) {
+        TLOG(WARNING) << "Level cache " << filename << " is truncated, ignoring it";
+        return nullptr;
+    }
+
+    std::unique_ptr<SokobanLevelDatabase> db{new SokobanLevelDatabase};
+    db->image = file->data();
+    db->mapped = std::move(file);
+    return db;
+}
+
+bool SokobanLevelDatabase::save(const std::string &filename) const
+{
+    return writeFileAtomic(filename, image, imageSize(header()));
+}
+
+std::pair<const SokobanRect *, const SokobanRect *> SokobanLevelDatabase::rects(size_t levelIdx) const
+{
+    const auto *offsets = rectOffsets();
+    const auto *allRects = reinterpret_cast<const SokobanRect *>(offsets + size() + 1);
+    return {allRects + offsets[levelIdx], allRects + offsets[levelIdx + 1]};
+}
+
+SokobanLevel SokobanLevelDatabase::level(size_t idx) const
+{
+    SokobanLevel level;
+
+    for (int x = 0; x < rows(); ++x) {
+        std::string row;
+        for (int z = 0; z < cols() && cell(idx, SokobanPlane::Floor, x, z); ++z) {
+            const bool goal = cell(idx, SokobanPlane::Goal, x, z);
+            if (cell(idx, SokobanPlane::Wall, x, z))
+                row += char(WALL_CELL);
+            else if (cell(idx, SokobanPlane::Box, x, z))
+                row += char(goal ? BOX_ON_GOAL : BOX_CELL);
+            else if (cell(idx, SokobanPlane::Player, x, z))
+                row += char(goal ? PLAYER_ON_GOAL : PLAYER_CELL);
+            else
+                row += char(goal ? GOAL_CELL : EMPTY_CELL);
+        }
+
+        if (row.empty())
+            break;
+
+        level.rows.emplace_back(std::move(row));
+    }
+
+    return level;
+}
+
+std::string SokobanLevelDatabase::cacheFilename(const std::string &dirWithLevels)
+{
+    return dirWithLevels + ".megaverse.bin";
+}
+
+std::vector<std::string> SokobanLevelDatabase::levelFiles(const std::string &dirWithLevels)
+{
+    std::vector<std::string> files;
+
+    for (int levelFileIdx = 0; levelFileIdx <= 999; ++levelFileIdx) {
+        std::ostringstream ss;
+        ss << std::setw(3) << std::setfill('0') << levelFileIdx << ".txt";
+        auto levelFilePath = pathJoin(dirWithLevels, ss.str());
+        if (fileExists(levelFilePath))
+            files.emplace_back(levelFilePath);
+    }
+
+    return files;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+
+
+namespace Megaverse
+{
+
+/**
+ * Reusable barrier for a fixed number of threads.
+ * Waiting threads first spin for a bounded number of iterations (cheap if the other threads arrive soon), and then
+ * park on a condition variable, so we don't burn a whole core when the wait is long.
+ */
+class Barrier
+{
+public:
+    static constexpr int defaultSpinBudget = 4096;
+
+public:
+    explicit Barrier(int numThreads, int spinBudget = defaultSpinBudget);
+
+    /**
+     * Blocks until all numThreads threads have called this function. Can be called repeatedly.
+     * @param spinIterations overrides the spin budget for this wait, i.e. 0 for a thread that expects a long wait.
+     * @return time in nanoseconds this thread spent waiting.
+     */
+    uint64_t arriveAndWait(int spinIterations = -1);
+
+    void setSpinBudget(int numIterations) { spinBudget = numIterations; }
+
+    int getSpinBudget() const { return spinBudget; }
+
+    /// Total time spent waiting on this barrier by all threads since the last resetStats().
+    uint64_t totalWaitNs() const { return waitNs; }
+
+    /// How many times a thread exhausted the spin budget and had to park.
+    uint64_t numParked() const { return parked; }
+
+    void resetStats() { waitNs = 0, parked = 0; }
+
+private:
+    const int numThreads;
+    std::atomic<int> spinBudget;
+
+    std::atomic<int> numArrived{0};
+    std::atomic<uint64_t> generation{0};
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    int numSleeping = 0;  // guarded by mutex
+
+    std::atomic<uint64_t> waitNs{0}, parked{0};
+};
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <initializer_list>
+
+#include <util/tiny_logger.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Instruction set of a kernel variant. Scalar is the portable reference every kernel has, the others are only
+ * selected on CPUs (and operating systems) that support them, so one build runs on the whole fleet.
+ */
+enum class SimdLevel
+{
+    Scalar,
+    Neon,
+    Avx2,
+    Avx512,
+};
+
+const char * simdLevelName(SimdLevel level);
+
+/// Detected once via CPUID (x86) or HWCAP (aarch64).
+bool simdLevelSupported(SimdLevel level);
+
+/**
+ * Highest level kernels may use: the best one the CPU supports, or lower if the MEGAVERSE_SIMD environment
+ * variable (scalar, neon, avx2, avx512) asks for it, i.e. to rule out a variant when chasing a bug.
+ */
+SimdLevel maxSimdLevel();
+
+/**
+ * Function pointer to the best variant of a kernel for this CPU, selected when the dispatcher is constructed
+ * (usually a function-local static, so on the first call).
+ */
+template<typename Fn>
+class SimdDispatch
+{
+public:
+    struct Variant
+    {
+        SimdLevel level;
+        Fn *fn;
+    };
+
+public:
+    SimdDispatch(std::initializer_list<Variant> variants)
+    : variants{variants}
+    {
+        for (const auto &v : variants)
+            if (v.level == SimdLevel::Scalar || (simdLevelSupported(v.level) && v.level <= maxSimdLevel()))
+                if (!selected.fn || v.level > selected.level)
+                    selected = v;
+
+        TCHECK(selected.fn) << "Every kernel needs a scalar variant";
+    }
+
+    template<typename... Args>
+    decltype(auto) operator()(Args &&...args) const { return selected.fn(std::forward<Args>(args)...); }
+
+    SimdLevel level() const { return selected.level; }
+
+    /// Variants that can run on this CPU, regardless of MEGAVERSE_SIMD, i.e. to check that they agree.
+    std::vector<Variant> available() const
+    {
+        std::vector<Variant> result;
+        for (const auto &v : variants)
+            if (v.level == SimdLevel::Scalar || simdLevelSupported(v.level))
+                result.push_back(v);
+
+        return result;
+    }
+
+private:
+    std::vector<Variant> variants;
+    Variant selected{SimdLevel::Scalar, nullptr};
+};
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <new>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+
+
+namespace Megaverse
+{
+
+/**
+ * Monotonic allocator for objects that live exactly one episode. Allocation is a pointer bump, and release() runs
+ * the destructors and rewinds all blocks in one go. The blocks are kept, so after the first few episodes resets
+ * don't have to go through malloc for anything allocated here.
+ */
+class EpisodeArena
+{
+public:
+    static constexpr size_t defaultBlockSize = 64 * 1024;
+
+public:
+    explicit EpisodeArena(size_t blockSize = defaultBlockSize);
+
+    ~EpisodeArena();
+
+    EpisodeArena(const EpisodeArena &) = delete;
+
+    void operator=(const EpisodeArena &) = delete;
+
+    void * allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    /**
+     * Construct an object in the arena. It is destroyed by release(), never delete it yourself.
+     */
+    template<typename T, typename... Args>
+    T * create(Args &&...args)
+    {
+        auto obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            destructors.push_back({obj, [](void *p) { static_cast<T *>(p)->~T(); }});
+
+        return obj;
+    }
+
+    /**
+     * Destroy all objects in the reverse order of creation and make the memory available again.
+     */
+    void release();
+
+    size_t bytesAllocated() const { return allocated; }
+
+    size_t bytesReserved() const;
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    struct Destructor
+    {
+        void *obj;
+        void (*destroy)(void *);
+    };
+
+    size_t blockSize;
+
+    std::vector<Block> blocks;
+    size_t currBlock = 0, offset = 0, allocated = 0;
+
+    std::vector<Destructor> destructors;
+};
+
+}
@@ -49,4 +49,37 @@ bool fileExists(const std::string &filename);
 
 std::vector<std::string> listFilesInDirectory(const std::string &dir);
 
+/// mkdir -p, true if the directory exists afterwards.
+bool createDirectories(const std::string &dir);
+
+/// Write to a temporary file next to the target and rename it, so concurrent readers never see a partial file.
+bool writeFileAtomic(const std::string &filename, const char *data, size_t size);
+
+/**
+ * Read-only memory mapping of a whole file. Pages are shared between all processes that map the same file.
+ */
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string &filename);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+
+    void operator=(const MappedFile &) = delete;
+
+    bool isOpen() const { return data_ != nullptr; }
+
+    const char * data() const { return data_; }
+
+    size_t size() const { return size_; }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
 }
\ No newline at end of file
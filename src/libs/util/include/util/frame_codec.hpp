@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+
+namespace Megaverse
+{
+
+/**
+ * Compact byte stream of consecutive frames of one camera, i.e. the observations of one agent sent to a remote actor.
+ * Delta frames store the bytewise difference to the previous frame (static parts of the view, the constant alpha
+ * channel and small motions become runs of zeros) compressed with lzCompress(). Key frames are compressed as they are,
+ * the decoder can start or resynchronize on them.
+ * Encoded frame: one byte of flags followed by an LZ4 block that decompresses to exactly frameBytes.
+ */
+class FrameEncoder
+{
+public:
+    enum Flags : uint8_t
+    {
+        KEYFRAME = 1,
+    };
+
+public:
+    /**
+     * @param keyframeInterval a key frame every n frames bounds how long a decoder that starts mid-stream (or lost
+     * a frame) has to wait. 0 disables the periodic key frames.
+     */
+    explicit FrameEncoder(size_t frameBytes, int keyframeInterval = 64);
+
+    /// Upper bound of the size of one encoded frame.
+    static size_t maxEncodedBytes(size_t frameBytes);
+
+    /**
+     * Appends the encoded frame to out.
+     * @param keyframe i.e. the first frame of a new episode, which has nothing in common with the previous one.
+     */
+    void encode(const uint8_t *frame, bool keyframe, std::vector<uint8_t> &out);
+
+    /// The next frame is encoded as a key frame.
+    void requestKeyframe() { framesSinceKeyframe = -1; }
+
+private:
+    size_t frameBytes;
+    int keyframeInterval;
+    int framesSinceKeyframe = -1;
+
+    std::vector<uint8_t> prevFrame, residual;
+};
+
+class FrameDecoder
+{
+public:
+    explicit FrameDecoder(size_t frameBytes);
+
+    /**
+     * @param frame receives frameBytes of the decoded frame.
+     * @return false if the data is corrupted or if it is a delta frame and the decoder has no reference yet.
+     * Delta frames are rejected until the next key frame after a failure.
+     */
+    bool decode(const uint8_t *data, size_t size, uint8_t *frame);
+
+private:
+    size_t frameBytes;
+    bool hasReference = false;
+
+    std::vector<uint8_t> prevFrame, block;
+};
+
+}
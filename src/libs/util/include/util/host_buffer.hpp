@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace Megaverse
+{
+
+/**
+ * How large host buffers (i.e. observations) are allocated.
+ * HugePages: 2MB pages, explicit ones if the system reserved any (vm.nr_hugepages), transparent huge pages otherwise,
+ * fewer TLB misses when the whole batch is read or written. Small buffers get normal pages.
+ * Pinned: huge pages that are also page-locked for the GPU (cudaHostRegister), so host-to-device copies
+ * (torch .cuda(non_blocking=True)) are asynchronous DMA transfers. Needs setHostMemoryPinning(), falls back to
+ * HugePages without it.
+ */
+enum class HostMemoryPolicy
+{
+    Pageable,
+    HugePages,
+    Pinned,
+};
+
+/**
+ * Page-locking of host memory for the GPU, installed by a library that links CUDA, see HostMemoryPolicy::Pinned.
+ */
+struct HostMemoryPinning
+{
+    bool (*pin)(void *data, size_t size) = nullptr;
+    void (*unpin)(void *data) = nullptr;
+};
+
+void setHostMemoryPinning(const HostMemoryPinning &pinning);
+
+bool hostMemoryPinningAvailable();
+
+/**
+ * Zero-initialized, page-aligned host memory allocated according to a HostMemoryPolicy.
+ */
+class HostBuffer
+{
+public:
+    HostBuffer() = default;
+
+    HostBuffer(size_t size, HostMemoryPolicy policy);
+
+    ~HostBuffer();
+
+    HostBuffer(HostBuffer &&other) noexcept;
+
+    HostBuffer & operator=(HostBuffer &&other) noexcept;
+
+    HostBuffer(const HostBuffer &) = delete;
+
+    void operator=(const HostBuffer &) = delete;
+
+    /// New zeroed allocation with the same policy if the size changes, the contents are not kept.
+    void resize(size_t size);
+
+    uint8_t * data() { return data_; }
+
+    const uint8_t * data() const { return data_; }
+
+    size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    HostMemoryPolicy policy() const { return policy_; }
+
+    /// What the allocation actually got, the policy is a request.
+    bool hasHugePages() const { return hugePages; }
+
+    bool isPinned() const { return pinned; }
+
+private:
+    void release();
+
+private:
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0, mappedSize = 0;
+    HostMemoryPolicy policy_ = HostMemoryPolicy::Pageable;
+    bool hugePages = false, pinned = false;
+};
+
+}
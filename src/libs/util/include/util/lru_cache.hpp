@@ -0,0 +1,132 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+
+
+namespace Megaverse
+{
+
+/**
+ * Thread-safe LRU cache of immutable values, can be shared between envs that live in the same process.
+ * Values are stored as shared_ptr<const Value>, so an entry that is evicted while someone is still using it
+ * stays alive until the last user is done.
+ */
+template<typename Key, typename Value>
+class LruCache
+{
+public:
+    using ValuePtr = std::shared_ptr<const Value>;
+
+public:
+    explicit LruCache(size_t capacity = 0)
+    : capacity{capacity}
+    {
+    }
+
+    /**
+     * @return cached value or nullptr if the key is not in the cache. Marks the entry as most recently used.
+     */
+    ValuePtr get(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+
+        auto it = index.find(key);
+        if (it == index.end()) {
+            ++numMisses;
+            return nullptr;
+        }
+
+        ++numHits;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    /// Unlike get() this does not count as a use of the entry.
+    bool contains(const Key &key) const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return index.count(key) > 0;
+    }
+
+    void put(const Key &key, ValuePtr value)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!capacity)
+            return;
+
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = std::move(value);
+            entries.splice(entries.begin(), entries, it->second);
+            return;
+        }
+
+        entries.emplace_front(key, std::move(value));
+        index[key] = entries.begin();
+        evict();
+    }
+
+    /**
+     * Capacity of zero disables the cache.
+     */
+    void setCapacity(size_t newCapacity)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        capacity = newCapacity;
+        evict();
+    }
+
+    size_t getCapacity() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return capacity;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return entries.size();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        entries.clear(), index.clear();
+    }
+
+    size_t hits() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return numHits;
+    }
+
+    size_t misses() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return numMisses;
+    }
+
+private:
+    void evict()
+    {
+        while (entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+private:
+    mutable std::mutex mutex;
+    size_t capacity;
+
+    // most recently used entries are in front
+    std::list<std::pair<Key, ValuePtr>> entries;
+    std::unordered_map<Key, typename decltype(entries)::iterator> index;
+
+    size_t numHits = 0, numMisses = 0;
+};
+
+}
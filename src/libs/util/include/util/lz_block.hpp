@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+
+namespace Megaverse
+{
+
+/**
+ * Fast byte-oriented LZ77 compression in the LZ4 block format (greedy matching with a single hash table, no framing),
+ * so the blocks can also be decoded by the reference LZ4 library. Meant for data that is written much more often
+ * than it is read, i.e. recordings: compression is a single pass, decompression is mostly memcpys.
+ */
+void lzCompress(const uint8_t *src, size_t size, std::vector<uint8_t> &out);
+
+/**
+ * @param rawSize exact size of the decompressed data, stored next to the block by the caller.
+ * @return false if the block is corrupted or does not decompress to rawSize bytes.
+ */
+bool lzDecompress(const uint8_t *src, size_t size, size_t rawSize, std::vector<uint8_t> &out);
+
+}
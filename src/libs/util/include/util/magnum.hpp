@@ -5,6 +5,8 @@
 #include <Magnum/SceneGraph/SceneGraph.h>
 #include <Magnum/SceneGraph/MatrixTransformation3D.h>
 
+#include <util/pooled_allocation.hpp>
+
 
 namespace Megaverse
 {
@@ -12,6 +14,15 @@ namespace Megaverse
 using Object3D = Magnum::SceneGraph::Object<Magnum::SceneGraph::MatrixTransformation3D>;
 using Scene3D = Magnum::SceneGraph::Scene<Magnum::SceneGraph::MatrixTransformation3D>;
 
+/**
+ * Plain scene graph node with pooled memory, use it instead of Object3D for the per-episode geometry.
+ */
+class SceneNode : public Object3D, public PooledAllocation<SceneNode>
+{
+public:
+    using Object3D::Object3D;
+};
+
 using Radians = Magnum::Math::Rad<Magnum::Float>;
 
 
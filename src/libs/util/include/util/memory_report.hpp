@@ -0,0 +1,96 @@
+#pragma once
+
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+
+namespace Megaverse
+{
+
+/**
+ * Live bytes of a subsystem, updated by its allocation hooks (i.e. the allocator of Bullet or the operator new of
+ * the scene graph nodes). Thread-safe, one relaxed atomic per update.
+ */
+class MemoryCounter
+{
+public:
+    void allocated(size_t bytes)
+    {
+        const auto curr = live.fetch_add(int64_t(bytes), std::memory_order_relaxed) + int64_t(bytes);
+        numAllocations.fetch_add(1, std::memory_order_relaxed);
+
+        // racy, but only the peak can be slightly off
+        if (curr > peak.load(std::memory_order_relaxed))
+            peak.store(curr, std::memory_order_relaxed);
+    }
+
+    void freed(size_t bytes) { live.fetch_sub(int64_t(bytes), std::memory_order_relaxed); }
+
+    /// Allocations made before the hooks were installed can be freed through them, so this never goes below 0.
+    size_t liveBytes() const { return size_t(std::max(live.load(std::memory_order_relaxed), int64_t(0))); }
+
+    size_t peakBytes() const { return size_t(std::max(peak.load(std::memory_order_relaxed), int64_t(0))); }
+
+    uint64_t getNumAllocations() const { return numAllocations.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> live{0}, peak{0};
+    std::atomic<uint64_t> numAllocations{0};
+};
+
+/**
+ * Bytes used per subsystem, keys are dot-separated, i.e. "env.voxel_grid" or "render.instances".
+ * Most entries are estimates from the sizes and capacities of the containers. Entries under "process." come from
+ * MemoryCounter hooks and from the OS and cover the whole process rather than one env, entries under "gpu." are
+ * video memory. Neither is included in total() unless asked for explicitly.
+ */
+struct MemoryReport
+{
+    void add(const std::string &subsystem, size_t bytes) { subsystems[subsystem] += bytes; }
+
+    /// Adds all entries of the other report, optionally under a prefix.
+    void merge(const MemoryReport &other, const std::string &prefix = {});
+
+    size_t get(const std::string &subsystem) const;
+
+    /// Sum of the entries with this key prefix (all host entries by default), see above.
+    size_t total(const std::string &prefix = {}) const;
+
+    const std::map<std::string, size_t> & entries() const { return subsystems; }
+
+    /// One line per subsystem, largest first.
+    std::string toString() const;
+
+private:
+    std::map<std::string, size_t> subsystems;
+};
+
+template<typename T>
+size_t vectorBytes(const std::vector<T> &v) { return v.capacity() * sizeof(T); }
+
+inline size_t vectorBytes(const std::vector<bool> &v) { return v.capacity() / 8; }
+
+/// Outer and inner vectors, i.e. per-env lists.
+template<typename T>
+size_t vectorBytes(const std::vector<std::vector<T>> &v)
+{
+    auto bytes = v.capacity() * sizeof(std::vector<T>);
+    for (const auto &inner : v)
+        bytes += vectorBytes(inner);
+
+    return bytes;
+}
+
+/// Nodes, buckets and the values themselves (not what the values point to).
+template<typename K, typename V, typename H>
+size_t hashMapBytes(const std::unordered_map<K, V, H> &m)
+{
+    return m.size() * (sizeof(std::pair<const K, V>) + 2 * sizeof(void *)) + m.bucket_count() * sizeof(void *);
+}
+
+}
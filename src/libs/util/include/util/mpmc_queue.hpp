@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace Megaverse
+{
+
+/**
+ * Bounded lock-free multi-producer multi-consumer queue (D. Vyukov's array queue): every cell carries a sequence
+ * number that tells producers and consumers whether it is free or filled for their lap, so push() and pop() only
+ * contend on one atomic counter each and never block. For small trivially copyable values, i.e. env indices
+ * handed between the simulation threads.
+ * Capacity is rounded up to a power of two.
+ */
+template<typename T>
+class MpmcQueue
+{
+public:
+    explicit MpmcQueue(size_t minCapacity)
+    {
+        size_t capacity = 2;
+        while (capacity < minCapacity)
+            capacity *= 2;
+
+        mask = capacity - 1;
+        cells = std::make_unique<Cell[]>(capacity);
+        for (size_t i = 0; i < capacity; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /// @return false if the queue is full.
+    bool push(const T &value)
+    {
+        auto pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            auto &cell = cells[pos & mask];
+            const auto seq = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = intptr_t(seq) - intptr_t(pos);
+
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0)
+                return false;
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    /// @return false if the queue is empty.
+    bool pop(T &value)
+    {
+        auto pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            auto &cell = cells[pos & mask];
+            const auto seq = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = intptr_t(seq) - intptr_t(pos + 1);
+
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0)
+                return false;
+            else
+                pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    // producers and consumers on separate cache lines
+    alignas(64) std::atomic<size_t> enqueuePos{0};
+    alignas(64) std::atomic<size_t> dequeuePos{0};
+};
+
+}
@@ -2,6 +2,11 @@
 #include <fstream>
 #include <unistd.h>
 
+#if defined(__linux__)
+    #include <sched.h>
+    #include <pthread.h>
+#endif
+
 
 /**
  * https://gist.github.com/thirdwing/da4621eb163a886a03c5
@@ -28,3 +33,38 @@ inline void unixProcessMemUsage(double& vm_usage, double& resident_set)
     vm_usage = double(vsize);
     resident_set = double(rss) * double(page_size_bytes);
 }
+
+/**
+ * Pin a thread (e.g. std::thread::native_handle() or pthread_self()) to a single logical CPU.
+ * Only supported on Linux, returns false if the affinity could not be set.
+ */
+template<typename NativeHandle>
+inline bool setThreadAffinity(NativeHandle thread, int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+    return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuSet) == 0;
+#else
+    (void)thread, (void)cpu;
+    return false;
+#endif
+}
+
+/**
+ * Background threads that should only use CPU time nobody else wants (SCHED_IDLE).
+ * Only supported on Linux, returns false if the policy could not be set.
+ */
+template<typename NativeHandle>
+inline bool setThreadIdlePriority(NativeHandle thread)
+{
+#if defined(__linux__)
+    sched_param param{};
+    param.sched_priority = 0;
+    return pthread_setschedparam(thread, SCHED_IDLE, &param) == 0;
+#else
+    (void)thread;
+    return false;
+#endif
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+
+namespace Megaverse
+{
+
+/**
+ * Hardware counters of a piece of work, user space only.
+ */
+struct PerfCounterValues
+{
+    uint64_t cycles = 0, instructions = 0, llcMisses = 0, branchMisses = 0;
+
+    double ipc() const { return cycles ? double(instructions) / double(cycles) : 0.0; }
+
+    PerfCounterValues & operator+=(const PerfCounterValues &o)
+    {
+        cycles += o.cycles, instructions += o.instructions, llcMisses += o.llcMisses, branchMisses += o.branchMisses;
+        return *this;
+    }
+
+    PerfCounterValues operator-(const PerfCounterValues &o) const
+    {
+        return {cycles - o.cycles, instructions - o.instructions, llcMisses - o.llcMisses, branchMisses - o.branchMisses};
+    }
+};
+
+/**
+ * Linux perf_event group (cycles, instructions, LLC misses, branch misses) counting the calling thread, read with
+ * one syscall. Needs perf_event_paranoid <= 2 (the default), otherwise, or on other platforms, the group is not
+ * valid() and read() fails. Multiplexed counters (more groups than the PMU has slots) are scaled by the fraction of
+ * time they were running.
+ */
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters &) = delete;
+    void operator=(const PerfCounters &) = delete;
+
+    bool valid() const { return groupFd >= 0; }
+
+    /// Current totals since the group was opened, call from the thread that created it.
+    bool read(PerfCounterValues &values) const;
+
+private:
+    static constexpr int numCounters = 4;
+
+    int groupFd = -1;
+    int fds[numCounters] = {-1, -1, -1, -1};
+};
+
+}
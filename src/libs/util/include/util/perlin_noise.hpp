@@ -77,6 +77,16 @@ namespace siv
 			return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
 		}
 
+		/// Grad(hash, x, y, 0) without the branches
+		[[nodiscard]]
+		static constexpr value_type Grad2(std::uint8_t hash, value_type x, value_type y) noexcept
+		{
+			const std::uint8_t h = hash & 15;
+			const value_type u = h < 8 ? x : y;
+			const value_type v = h < 4 ? y : (h == 12) | (h == 14) ? x : value_type(0);
+			return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+		}
+
 		[[nodiscard]]
 		static constexpr value_type Weight(std::int32_t octaves) noexcept
 		{
@@ -325,6 +335,52 @@ namespace siv
 				* value_type(0.5) + value_type(0.5), 0, 1);
 		}
 
+		///////////////////////////////////////
+		//
+		//	Batched accumulated octave noise clamped within the range [0, 1]
+		//	* out[i] == accumulatedOctaveNoise2D_0_1(x, ys[i], octaves), for a row of points with the same x
+		//	* z = 0 is folded in (only 4 of the 8 gradients), the x part is computed once per octave
+		//	  and the inner loop has no branches, so it can be vectorized
+		//
+		void accumulatedOctaveNoise2DRow_0_1(value_type x, const value_type* ys, std::size_t n, std::int32_t octaves, value_type* out) const noexcept
+		{
+			std::fill(out, out + n, value_type(0));
+
+			value_type amp = 1, yScale = 1;
+
+			for (std::int32_t o = 0; o < octaves; ++o)
+			{
+				const std::int32_t X = static_cast<std::int32_t>(std::floor(x)) & 255;
+				const value_type xf = x - std::floor(x);
+				const value_type u = Fade(xf);
+				const std::int32_t pX = p[X], pX1 = p[X + 1];
+
+				for (std::size_t i = 0; i < n; ++i)
+				{
+					value_type y = ys[i] * yScale;
+					const std::int32_t Y = static_cast<std::int32_t>(std::floor(y)) & 255;
+					y -= std::floor(y);
+					const value_type v = Fade(y);
+
+					const std::int32_t A = pX + Y, B = pX1 + Y;
+
+					const value_type noise = Lerp(v, Lerp(u, Grad2(p[p[A]], xf, y), Grad2(p[p[B]], xf - 1, y)),
+						Lerp(u, Grad2(p[p[A + 1]], xf, y - 1), Grad2(p[p[B + 1]], xf - 1, y - 1)));
+
+					out[i] += noise * amp;
+				}
+
+				x *= 2;
+				yScale *= 2;
+				amp /= 2;
+			}
+
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				out[i] = std::clamp<value_type>(out[i] * value_type(0.5) + value_type(0.5), 0, 1);
+			}
+		}
+
 		///////////////////////////////////////
 		//
 		//	Normalized octave noise [0, 1]
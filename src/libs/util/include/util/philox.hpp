@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <limits>
+#include <cstdint>
+#include <type_traits>
+
+
+namespace Megaverse
+{
+
+/**
+ * Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+ * Every block of four outputs is a pure function of the 64-bit key and the 128-bit counter, so a stream can be
+ * positioned anywhere in O(1), i.e. forStream() starts the stream of an (env, episode) pair without replaying
+ * the episodes before it. The state is 40 bytes instead of mt19937's 5KB, which also makes env snapshots cheaper.
+ * Satisfies UniformRandomBitGenerator, so it works with the <random> distributions.
+ */
+class Philox4x32
+{
+public:
+    using result_type = uint32_t;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+public:
+    Philox4x32() { seed(defaultSeed); }
+
+    explicit Philox4x32(uint64_t seedValue) { seed(seedValue); }
+
+    template<typename SeedSeq, typename = std::enable_if_t<!std::is_arithmetic_v<SeedSeq>>>
+    explicit Philox4x32(SeedSeq &seedSeq) { seed(seedSeq); }
+
+    /**
+     * Stream #stream of the episode #episode. Different streams and episodes never overlap (up to 2^34 numbers
+     * per episode).
+     */
+    static Philox4x32 forStream(uint64_t seedValue, uint32_t stream, uint64_t episode)
+    {
+        Philox4x32 rng{seedValue};
+        rng.counter = {0, stream, uint32_t(episode), uint32_t(episode >> 32)};
+        return rng;
+    }
+
+    void seed(uint64_t seedValue = defaultSeed)
+    {
+        key = {uint32_t(seedValue), uint32_t(seedValue >> 32)};
+        counter = {0, 0, 0, 0};
+        outputIdx = blockSize;
+    }
+
+    template<typename SeedSeq, typename = std::enable_if_t<!std::is_arithmetic_v<SeedSeq>>>
+    void seed(SeedSeq &seedSeq)
+    {
+        std::array<uint32_t, 2> words{};
+        seedSeq.generate(words.begin(), words.end());
+        seed(uint64_t(words[0]) | (uint64_t(words[1]) << 32));
+    }
+
+    result_type operator()()
+    {
+        if (outputIdx == blockSize) {
+            block = generateBlock(counter, key);
+            outputIdx = 0;
+
+            // only the first word counts blocks, the rest of the counter identifies the stream
+            ++counter[0];
+        }
+
+        return block[outputIdx++];
+    }
+
+    void discard(unsigned long long n)
+    {
+        for (; n > 0; --n)
+            (*this)();
+    }
+
+    /**
+     * One block of the Philox4x32-10 function.
+     */
+    static std::array<uint32_t, 4> generateBlock(std::array<uint32_t, 4> ctr, std::array<uint32_t, 2> k)
+    {
+        constexpr uint32_t m0 = 0xD2511F53, m1 = 0xCD9E8D57;
+        constexpr uint32_t w0 = 0x9E3779B9, w1 = 0xBB67AE85;
+
+        for (int round = 0; round < 10; ++round) {
+            const auto p0 = uint64_t(m0) * ctr[0], p1 = uint64_t(m1) * ctr[2];
+            ctr = {uint32_t(p1 >> 32) ^ ctr[1] ^ k[0], uint32_t(p1), uint32_t(p0 >> 32) ^ ctr[3] ^ k[1], uint32_t(p0)};
+            k[0] += w0, k[1] += w1;
+        }
+
+        return ctr;
+    }
+
+    friend bool operator==(const Philox4x32 &a, const Philox4x32 &b)
+    {
+        return a.key == b.key && a.counter == b.counter && a.outputIdx == b.outputIdx
+               && (a.outputIdx == blockSize || a.block == b.block);
+    }
+
+    friend bool operator!=(const Philox4x32 &a, const Philox4x32 &b) { return !(a == b); }
+
+private:
+    static constexpr uint64_t defaultSeed = 5489u;  // same default as mt19937
+    static constexpr int blockSize = 4;
+
+    std::array<uint32_t, 2> key{};
+    std::array<uint32_t, 4> counter{}, block{};
+    int outputIdx = blockSize;
+};
+
+}
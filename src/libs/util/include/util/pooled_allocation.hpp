@@ -0,0 +1,72 @@
+#pragma once
+
+#include <new>
+#include <vector>
+#include <cstddef>
+
+#include <util/memory_report.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Class-level operator new/delete that recycle the memory of objects of type T through a thread-local free list.
+ * Meant for the scene graph nodes that every reset creates by the thousands and destroys with the scene.
+ * Derived classes that are bigger than T fall back to the global allocator.
+ * Live objects of the hierarchy are counted in memoryCounter(), process-wide.
+ */
+template<typename T, size_t maxPoolSize = 1 << 14>
+class PooledAllocation
+{
+public:
+    static void * operator new(size_t size)
+    {
+        memoryCounter().allocated(size);
+
+        auto &blocks = freeList().blocks;
+        if (size != sizeof(T) || blocks.empty())
+            return ::operator new(size);
+
+        auto mem = blocks.back();
+        blocks.pop_back();
+        return mem;
+    }
+
+    static void operator delete(void *mem, size_t size)
+    {
+        memoryCounter().freed(size);
+
+        auto &blocks = freeList().blocks;
+        if (size == sizeof(T) && blocks.size() < maxPoolSize)
+            blocks.emplace_back(mem);
+        else
+            ::operator delete(mem);
+    }
+
+    static MemoryCounter & memoryCounter()
+    {
+        static MemoryCounter counter;
+        return counter;
+    }
+
+private:
+    struct FreeList
+    {
+        ~FreeList()
+        {
+            for (auto mem : blocks)
+                ::operator delete(mem);
+        }
+
+        std::vector<void *> blocks;
+    };
+
+    static FreeList & freeList()
+    {
+        thread_local FreeList list;
+        return list;
+    }
+};
+
+}
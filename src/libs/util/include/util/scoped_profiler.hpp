@@ -0,0 +1,220 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <util/perf_counters.hpp>
+
+
+namespace Megaverse
+{
+
+using ProfilerZoneId = uint16_t;
+
+/**
+ * Completed zone, as recorded by the thread that executed it. Timestamps are steady_clock nanoseconds.
+ */
+struct ProfilerEvent
+{
+    // set in threadIdx for GPU work recorded by the thread, see ScopedProfiler::recordGpu()
+    static constexpr uint32_t gpuTrack = 1u << 31;
+
+    uint64_t startNs = 0, endNs = 0;
+    ProfilerZoneId zone = 0;
+    uint16_t depth = 0;
+    uint32_t threadIdx = 0;
+};
+
+/**
+ * Durations of one zone in logarithmic buckets (four per octave of nanoseconds), so percentiles are accurate
+ * to ~19% regardless of the range.
+ */
+struct ProfilerHistogram
+{
+    static constexpr int bucketsPerOctave = 4, numBuckets = 64 * bucketsPerOctave;
+
+    void add(uint64_t durationNs);
+
+    /// Approximate duration (ns) below which fraction q of the samples are, q in [0, 1].
+    double percentile(double q) const;
+
+    double meanNs() const { return count ? double(totalNs) / double(count) : 0.0; }
+
+    static int bucket(uint64_t durationNs);
+
+    /// Geometric middle of the bucket.
+    static double bucketValue(int bucket);
+
+    std::array<uint64_t, numBuckets> buckets{};
+    uint64_t count = 0, totalNs = 0, maxNs = 0;
+};
+
+/**
+ * Thread-safe replacement for TinyProfiler in the hot paths (Env::step, VectorEnv workers, renderers).
+ * Zones are RAII scopes created with PROFILE_ZONE("name"), the name is resolved to an id once per call site.
+ * Every thread records completed zones into its own fixed-size ring buffer without locks, collect()
+ * periodically drains all buffers into per-zone histograms and (if tracing is on) into a list of events
+ * that can be saved in Chrome trace format (chrome://tracing, Perfetto).
+ * If a buffer overflows between two collect() calls the oldest events are lost and counted in droppedEvents().
+ *
+ * Disabled by default, then a zone is a single relaxed atomic load.
+ *
+ * Optionally zones also count hardware events (setCountersEnabled()), accumulated per zone and thread. Like the
+ * durations they are inclusive of the nested zones.
+ */
+class ScopedProfiler
+{
+    struct ThreadBuffer;
+
+public:
+    static ScopedProfiler &instance();
+
+    static bool enabled() { return enabledFlag.load(std::memory_order_relaxed); }
+
+    void setEnabled(bool enable) { enabledFlag.store(enable, std::memory_order_relaxed); }
+
+    /**
+     * Count cycles, instructions, LLC and branch misses in the zones (see PerfCounters), two extra syscalls per
+     * zone, so for benchmarks rather than production runs. Only the first maxCounterZones zone ids are counted.
+     * @return false if the counters are not available on this thread, zones are then timed as usual.
+     */
+    bool setCountersEnabled(bool enable);
+
+    static bool countersEnabled() { return countersFlag.load(std::memory_order_relaxed); }
+
+    static constexpr size_t maxCounterZones = 256;
+
+    /// Keep individual events for writeChromeTrace(), at most maxTraceEvents of them.
+    void setTraceEnabled(bool enable, size_t maxTraceEvents = 1 << 20);
+
+    /// Idempotent, returns the same id for the same name.
+    ProfilerZoneId registerZone(const char *name);
+
+    const std::string & zoneName(ProfilerZoneId zone) const;
+
+    static uint64_t nowNs()
+    {
+        using namespace std::chrono;
+        return uint64_t(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+    }
+
+    /// Called by ProfilerZone on the recording thread. Lock-free except for the first call on a new thread.
+    void record(ProfilerZoneId zone, uint64_t startNs, uint64_t endNs, uint16_t depth);
+
+    /**
+     * GPU work submitted by the calling thread, measured by the renderer (timer queries, or submit-to-completion on
+     * the host). Goes into the histogram of the zone like any other event, traces show it on a separate GPU track.
+     * @param startNs steady_clock time the work is attributed to, i.e. its submission.
+     */
+    void recordGpu(ProfilerZoneId zone, uint64_t startNs, uint64_t durationNs);
+
+    /// Called by ProfilerZone: counter totals of the calling thread, false if it has no counters.
+    bool readCounters(PerfCounterValues &values);
+
+    /// Called by ProfilerZone on the recording thread.
+    void addCounters(ProfilerZoneId zone, const PerfCounterValues &delta);
+
+    /// Sum over all threads since the last clear(), zeros if the zone was never counted.
+    PerfCounterValues counters(const std::string &zoneName) const;
+
+    /// Drains the per-thread ring buffers. Safe to call from any thread while others keep recording.
+    void collect();
+
+    /// Histograms per zone (indexed by zone id), call collect() first.
+    std::vector<ProfilerHistogram> histograms() const;
+
+    ProfilerHistogram histogram(const std::string &zoneName) const;
+
+    /// Human-readable table: count, mean, p50, p95, p99, max per zone.
+    std::string summary() const;
+
+    /// Write the collected events as Chrome trace JSON. Returns false if the file could not be written.
+    bool writeChromeTrace(const std::string &path) const;
+
+    /// Clear the histograms and the collected trace events (zone registrations are kept).
+    void clear();
+
+    uint64_t droppedEvents() const;
+
+    ~ScopedProfiler();
+
+    ScopedProfiler(const ScopedProfiler &) = delete;
+
+    void operator=(const ScopedProfiler &) = delete;
+
+private:
+    ScopedProfiler();
+
+    ThreadBuffer & threadBuffer();
+
+private:
+    static std::atomic<bool> enabledFlag, countersFlag;
+
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+inline ScopedProfiler &sprof() { return ScopedProfiler::instance(); }
+
+/**
+ * RAII zone, records [construction, destruction) on the current thread. Nested zones get increasing depth.
+ */
+class ProfilerZone
+{
+public:
+    explicit ProfilerZone(ProfilerZoneId zone)
+    : zone{zone}
+    , active{ScopedProfiler::enabled()}
+    {
+        if (active) {
+            depth = currentDepth++;
+            counted = ScopedProfiler::countersEnabled() && ScopedProfiler::instance().readCounters(startCounters);
+            startNs = ScopedProfiler::nowNs();
+        }
+    }
+
+    ~ProfilerZone()
+    {
+        if (active) {
+            const auto endNs = ScopedProfiler::nowNs();
+            --currentDepth;
+
+            auto &profiler = ScopedProfiler::instance();
+            PerfCounterValues endCounters;
+            if (counted && profiler.readCounters(endCounters))
+                profiler.addCounters(zone, endCounters - startCounters);
+
+            profiler.record(zone, startNs, endNs, depth);
+        }
+    }
+
+    ProfilerZone(const ProfilerZone &) = delete;
+
+    void operator=(const ProfilerZone &) = delete;
+
+private:
+    static thread_local uint16_t currentDepth;
+
+    ProfilerZoneId zone;
+    bool active, counted = false;
+    uint16_t depth = 0;
+    uint64_t startNs = 0;
+    PerfCounterValues startCounters;
+};
+
+}
+
+
+#define PROFILE_ZONE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_ZONE_CONCAT(a, b) PROFILE_ZONE_CONCAT_IMPL(a, b)
+
+/// Profile the rest of the enclosing scope. The name must be a string literal.
+#define PROFILE_ZONE(name) \
+    static const ::Megaverse::ProfilerZoneId PROFILE_ZONE_CONCAT(profilerZoneId_, __LINE__) = \
+        ::Megaverse::ScopedProfiler::instance().registerZone(name); \
+    ::Megaverse::ProfilerZone PROFILE_ZONE_CONCAT(profilerZone_, __LINE__){PROFILE_ZONE_CONCAT(profilerZoneId_, __LINE__)}
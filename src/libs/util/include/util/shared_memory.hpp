@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+
+namespace Megaverse
+{
+
+/**
+ * Named POSIX shared memory segment mapped into the address space of the process.
+ * The process that created the segment owns the name and unlinks it on destruction, processes that attached to it
+ * keep their mapping until they are destroyed too.
+ */
+class SharedMemory
+{
+public:
+    SharedMemory() = default;
+
+    /// Create a zero-filled segment, an existing segment with the same name is replaced.
+    static SharedMemory create(const std::string &name, size_t size);
+
+    /// Attach to a segment created by another process, the size is taken from the segment.
+    static SharedMemory attach(const std::string &name);
+
+    ~SharedMemory();
+
+    SharedMemory(SharedMemory &&other) noexcept { *this = std::move(other); }
+
+    SharedMemory & operator=(SharedMemory &&other) noexcept;
+
+    SharedMemory(const SharedMemory &) = delete;
+
+    void operator=(const SharedMemory &) = delete;
+
+    bool isOpen() const { return data_ != nullptr; }
+
+    uint8_t * data() const { return data_; }
+
+    size_t size() const { return size_; }
+
+    const std::string & name() const { return name_; }
+
+private:
+    void release();
+
+private:
+    std::string name_;
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    bool owner = false;
+};
+
+/**
+ * Sleep while word == expected, or until woken up by futexWakeAll(). Can return spuriously, so callers re-check
+ * their condition in a loop. Works across processes when the word lives in shared memory.
+ * Off Linux this yields instead of sleeping.
+ */
+void futexWait(std::atomic<uint32_t> &word, uint32_t expected);
+
+void futexWakeAll(std::atomic<uint32_t> &word);
+
+}
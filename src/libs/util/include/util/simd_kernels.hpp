@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <util/cpu_dispatch.hpp>
+
+
+namespace Megaverse
+{
+
+/// out[i] = a[i] op b[i] modulo 256, out may alias a or b.
+using ByteKernel = void(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n);
+
+/// Frame residuals, see FrameEncoder.
+void subtractBytes(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n);
+
+void addBytes(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n);
+
+/// The dispatchers behind the kernels above, for tests and benchmarks.
+const SimdDispatch<ByteKernel> & subtractBytesDispatch();
+
+const SimdDispatch<ByteKernel> & addBytesDispatch();
+
+}
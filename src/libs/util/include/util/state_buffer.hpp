@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+
+namespace Megaverse
+{
+
+/**
+ * Flat byte buffer for state snapshots (see Env::saveState()). Only plain values can be written (no pointers
+ * or owned memory), so saving and restoring is a sequence of memcpys. Bullet math types are not formally trivially
+ * copyable with SIMD enabled, hence the weaker check. The storage only grows: once the buffer is large enough for
+ * a state, saving into it again does not allocate.
+ */
+class StateBuffer
+{
+public:
+    void clear() { numBytes = 0; }
+
+    size_t size() const { return numBytes; }
+
+    const uint8_t * data() const { return bytes.data(); }
+
+    void write(const void *src, size_t size)
+    {
+        if (numBytes + size > bytes.size())
+            bytes.resize(std::max(numBytes + size, 2 * bytes.size()));
+
+        memcpy(bytes.data() + numBytes, src, size);
+        numBytes += size;
+    }
+
+    template<typename T>
+    void write(const T &value)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Only plain values can be saved");
+        write(&value, sizeof(T));
+    }
+
+private:
+    std::vector<uint8_t> bytes;
+    size_t numBytes = 0;
+};
+
+/**
+ * Reads values back in the order they were written. Reading past the end fails (and keeps failing) instead of
+ * crashing, so a mismatching snapshot is detected with a single check at the end.
+ */
+class StateReader
+{
+public:
+    explicit StateReader(const StateBuffer &buffer)
+    : StateReader{buffer.data(), buffer.size()}
+    {
+    }
+
+    StateReader(const uint8_t *data, size_t size)
+    : bytes{data}
+    , numBytes{size}
+    {
+    }
+
+    bool read(void *dst, size_t size)
+    {
+        if (failed || pos + size > numBytes) {
+            failed = true;
+            return false;
+        }
+
+        memcpy(dst, bytes + pos, size);
+        pos += size;
+        return true;
+    }
+
+    template<typename T>
+    bool read(T &value)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Only plain values can be restored");
+        return read(&value, sizeof(T));
+    }
+
+    template<typename T>
+    T read()
+    {
+        T value{};
+        read(value);
+        return value;
+    }
+
+    bool ok() const { return !failed; }
+
+    bool finished() const { return !failed && pos == numBytes; }
+
+    size_t remaining() const { return failed ? 0 : numBytes - pos; }
+
+private:
+    const uint8_t *bytes;
+    size_t numBytes;
+    size_t pos = 0;
+    bool failed = false;
+};
+
+}
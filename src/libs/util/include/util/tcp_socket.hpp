@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+
+namespace Megaverse
+{
+
+/**
+ * Blocking TCP socket with Nagle's algorithm disabled (small action messages go out immediately).
+ * Closed on destruction.
+ */
+class TcpSocket
+{
+public:
+    TcpSocket() = default;
+
+    /// Listening socket on all interfaces, port 0 picks a free port (see localPort()).
+    static TcpSocket listen(int port, int backlog = 16);
+
+    static TcpSocket connect(const std::string &host, int port);
+
+    /**
+     * Wait for a connection on a listening socket.
+     * @param timeoutMs -1 blocks; an invalid socket is returned if nobody connected in time.
+     */
+    TcpSocket accept(int timeoutMs = -1) const;
+
+    ~TcpSocket();
+
+    TcpSocket(TcpSocket &&other) noexcept { *this = std::move(other); }
+
+    TcpSocket & operator=(TcpSocket &&other) noexcept;
+
+    TcpSocket(const TcpSocket &) = delete;
+
+    void operator=(const TcpSocket &) = delete;
+
+    bool isOpen() const { return fd >= 0; }
+
+    int descriptor() const { return fd; }
+
+    int localPort() const;
+
+    /// @return false if the connection is closed or broken, the socket is closed then.
+    bool sendAll(const void *data, size_t size);
+
+    bool recvAll(void *data, size_t size);
+
+    template<typename T>
+    bool sendValue(const T &value) { return sendAll(&value, sizeof(value)); }
+
+    template<typename T>
+    bool recvValue(T &value) { return recvAll(&value, sizeof(value)); }
+
+    /// Wait until there is data to read (or the peer closed the connection), -1 blocks.
+    bool waitReadable(int timeoutMs) const;
+
+    void close();
+
+private:
+    explicit TcpSocket(int fd) : fd{fd} {}
+
+private:
+    int fd = -1;
+};
+
+/**
+ * Splits "host:port" (the host is optional), returns false if there is no valid port.
+ */
+bool parseHostPort(const std::string &address, std::string &host, int &port);
+
+}
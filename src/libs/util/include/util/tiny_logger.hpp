@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <vector>
+#include <cstdint>
 #include <ostream>
 #include <sstream>
 #include <iostream>
@@ -23,7 +24,25 @@ enum LogLevel
 
 void setLogLevel(LogLevel level);
 
+/// Runtime level check, TLOG statements above the level are not evaluated at all.
+bool logLevelEnabled(LogLevel level);
 
+/**
+ * Block until all messages logged so far by any thread are written to their streams.
+ */
+void flushLogs();
+
+/// Messages dropped because a thread's queue was full (only INFO and above are ever dropped).
+uint64_t numDroppedLogMessages();
+
+
+/**
+ * Messages are formatted into a thread-local buffer and handed over to a background thread through
+ * a per-thread lock-free queue, so logging threads never contend on a mutex or on the output stream.
+ * The background thread adds the timestamp and the header and writes the message.
+ * When a queue is full, INFO/VERBOSE/DEBUG messages are dropped (see numDroppedLogMessages()), more severe
+ * messages wait for space. FATAL messages flush everything and exit.
+ */
 class LogMessage
 {
 public:
@@ -31,38 +50,39 @@ public:
 
     ~LogMessage();
 
-    std::ostringstream &operator()();
+    std::ostringstream &operator()() { return stream; }
 
 private:
-    std::shared_ptr<std::ostringstream> stream;
+    std::ostringstream stream;
     std::ostream *outStream;
     LogLevel level;
+    const char *file, *func;
+    int line;
+    int64_t timestampUs;
+    bool enabled;
 };
 
-class NullStream : public std::ostringstream
+/**
+ * Turns the whole "TLOG(...) << a << b" expression into void, so it can be an operand of the ternary in TLOG.
+ */
+struct LogVoidify
 {
-public:
-    NullStream()
-        : std::ostringstream() {}
-
-    NullStream &operator()()
-    {
-        return *this;
-    }
+    void operator&(std::ostream &) {}
 };
 
-template<typename T>
-inline NullStream &operator<<(NullStream &stream, T &&)
-{
-    return stream;
-}
-
 
 // helper macros
 
-#define TLOG(level) LogMessage(level, __FILE__, __LINE__, __FUNCTION__)()
+/// Statements more verbose than this are compiled out, e.g. -DTLOG_MAX_LEVEL=::Megaverse::INFO for release builds.
+#ifndef TLOG_MAX_LEVEL
+    #define TLOG_MAX_LEVEL ::Megaverse::DEBUG
+#endif
+
+#define TLOG(level) \
+    ((level) > TLOG_MAX_LEVEL || !::Megaverse::logLevelEnabled(level)) ? (void)0 : \
+    ::Megaverse::LogVoidify{} & ::Megaverse::LogMessage(level, __FILE__, __LINE__, __FUNCTION__)()
 
-#define TLOG_IF(level, cond) !(cond) ? NullStream()() : TLOG(level)
+#define TLOG_IF(level, cond) !(cond) ? (void)0 : TLOG(level)
 
 // die if condition is not true
 #define TCHECK(cond) TLOG_IF(FATAL, !(cond))
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+
+namespace Megaverse
+{
+
+/**
+ * Lock-free handoff of the latest value from one producer thread to one consumer thread, i.e. scene snapshots from
+ * the simulation to a viewer that runs at its own frame rate. The producer fills writeSlot() and publish()es it,
+ * the consumer picks up the most recent published slot with update(); values published in between are skipped.
+ * Neither side ever waits for the other, and slots are reused, so values that keep their capacity (vectors) stop
+ * allocating after the first few frames.
+ */
+template<typename T>
+class TripleBuffer
+{
+public:
+    /// Producer: slot to fill, invisible to the consumer until publish().
+    T & writeSlot() { return slots[writeIdx]; }
+
+    /// Producer: make the write slot the latest value and continue with a free slot.
+    void publish()
+    {
+        writeIdx = middle.exchange(uint8_t(writeIdx | freshBit), std::memory_order_acq_rel) & indexMask;
+    }
+
+    /**
+     * Consumer: switch readSlot() to the latest published value.
+     * @return false if nothing was published since the last update, readSlot() stays the same.
+     */
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_acquire) & freshBit))
+            return false;
+
+        readIdx = middle.exchange(uint8_t(readIdx), std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    /// Consumer: value of the last update(), default constructed before the first one.
+    const T & readSlot() const { return slots[readIdx]; }
+
+private:
+    static constexpr uint8_t indexMask = 0b11, freshBit = 0b100;
+
+    std::array<T, 3> slots{};
+
+    // each side owns one index, the third slot is exchanged through the atomic
+    alignas(64) int writeIdx = 0;
+    alignas(64) int readIdx = 1;
+    alignas(64) std::atomic<uint8_t> middle{2};
+};
+
+}
@@ -5,6 +5,7 @@
 #include <algorithm>
 
 #include <util/macro.hpp>
+#include <util/philox.hpp>
 
 
 namespace Megaverse
@@ -22,7 +23,7 @@ FORCE_INLINE T sqr(T x)
     return x * x;
 }
 
-using Rng = std::mt19937;
+using Rng = Philox4x32;
 
 /**
  * @return random integer from [low, high).
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <climits>
+#include <functional>
+#include <unordered_set>
+#include <condition_variable>
+
+#include <util/voxel_grid.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Keeps the chunks of a procedurally generated world of any size loaded around a set of points (i.e. the agents).
+ * Missing chunks near the points are generated on background threads, nearest first, and installed by update() on
+ * the thread that owns the grid; chunks that are far from all points are evicted. The grid therefore holds at most
+ * (2 * evictRadius + 1)^2 columns of chunks per point, regardless of the size of the world.
+ * Distances are Chebyshev distances in the horizontal plane, measured in chunks.
+ */
+template<typename VoxelState, int logChunkSize = 4>
+class VoxelChunkStreamer
+{
+public:
+    using Storage = ChunkedVoxelStorage<VoxelState, logChunkSize>;
+    using Grid = VoxelGrid<VoxelState, Storage>;
+    using Chunk = typename Storage::Chunk;
+
+    /**
+     * Fills an empty chunk with Storage::setInChunk(), runs on the background threads. Must only depend on the chunk
+     * coords and immutable data (i.e. the world seed), chunks can be evicted and generated again later.
+     */
+    using Generator = std::function<void(const VoxelCoords &chunkCoords, Chunk &chunk)>;
+
+    struct Options
+    {
+        int loadRadius = 4;
+
+        // larger than loadRadius, so agents moving along a chunk boundary don't generate the same chunks over and over
+        int evictRadius = 6;
+
+        // vertical extent of the world in chunks (inclusive)
+        int minChunkY = 0, maxChunkY = 0;
+
+        int numThreads = 1;
+    };
+
+public:
+    VoxelChunkStreamer(Generator generator, const Options &options)
+    : generator{std::move(generator)}
+    , options{options}
+    {
+        for (int i = 0; i < std::max(options.numThreads, 1); ++i)
+            threads.emplace_back([this] { generatorLoop(); });
+    }
+
+    ~VoxelChunkStreamer()
+    {
+        {
+            std::lock_guard lock{mutex};
+            stop = true;
+        }
+
+        cv.notify_all();
+        for (auto &t : threads)
+            t.join();
+    }
+
+    /**
+     * Install the chunks generated since the last call, evict the chunks far from all centers (voxel coords) and
+     * request the missing chunks around them. Only update() and reset() touch the grid.
+     * @return number of chunks installed.
+     */
+    int update(Grid &grid, const std::vector<VoxelCoords> &centers)
+    {
+        std::vector<VoxelCoords> centerChunks;
+        for (const auto &center : centers)
+            centerChunks.push_back(Storage::chunkCoords(center));
+
+        const auto distance = [&](const VoxelCoords &c) {
+            int d = INT_MAX;
+            for (const auto &cc : centerChunks)
+                d = std::min(d, std::max(std::abs(c.x() - cc.x()), std::abs(c.z() - cc.z())));
+            return d;
+        };
+
+        std::vector<std::pair<VoxelCoords, std::shared_ptr<Chunk>>> ready;
+        {
+            std::lock_guard lock{mutex};
+            ready.swap(finished);
+        }
+
+        int numInstalled = 0;
+        for (auto &[coords, chunk] : ready) {
+            inFlight.erase(coords);
+            if (distance(coords) <= options.evictRadius) {
+                grid.insertChunk(coords, std::move(chunk));
+                ++numInstalled;
+            }
+        }
+
+        grid.evictChunks([&](const VoxelCoords &c) { return distance(c) > options.evictRadius; });
+
+        std::vector<VoxelCoords> missing;
+        for (const auto &cc : centerChunks)
+            for (int x = cc.x() - options.loadRadius; x <= cc.x() + options.loadRadius; ++x)
+                for (int z = cc.z() - options.loadRadius; z <= cc.z() + options.loadRadius; ++z)
+                    for (int y = options.minChunkY; y <= options.maxChunkY; ++y) {
+                        const VoxelCoords c{x, y, z};
+                        if (!grid.hasChunk(c) && inFlight.insert(c).second)
+                            missing.push_back(c);
+                    }
+
+        if (!missing.empty()) {
+            std::stable_sort(missing.begin(), missing.end(), [&](const auto &a, const auto &b) { return distance(a) < distance(b); });
+
+            {
+                std::lock_guard lock{mutex};
+                for (const auto &c : missing)
+                    requests.push_back({c, generation});
+            }
+
+            cv.notify_all();
+        }
+
+        return numInstalled;
+    }
+
+    /**
+     * The world changed (i.e. a new episode with a different seed): drop the pending chunks and empty the grid.
+     */
+    void reset(Grid &grid)
+    {
+        {
+            std::lock_guard lock{mutex};
+            ++generation;
+            requests.clear();
+            finished.clear();
+        }
+
+        inFlight.clear();
+        grid.evictChunks([](const VoxelCoords &) { return true; });
+    }
+
+    /// Block until all requested chunks are generated, i.e. before the first step of an episode.
+    void wait()
+    {
+        std::unique_lock lock{mutex};
+        idleCv.wait(lock, [this] { return requests.empty() && numGenerating == 0; });
+    }
+
+    /// Chunks requested and not installed yet.
+    size_t numPending() const { return inFlight.size(); }
+
+private:
+    struct Request
+    {
+        VoxelCoords coords;
+        uint64_t generation;
+    };
+
+    void generatorLoop()
+    {
+        std::unique_lock lock{mutex};
+
+        while (true) {
+            cv.wait(lock, [this] { return stop || !requests.empty(); });
+            if (stop)
+                break;
+
+            const auto request = requests.front();
+            requests.pop_front();
+            ++numGenerating;
+
+            lock.unlock();
+            auto chunk = std::make_shared<Chunk>();
+            generator(request.coords, *chunk);
+            lock.lock();
+
+            // results of a previous world are dropped
+            if (request.generation == generation)
+                finished.emplace_back(request.coords, std::move(chunk));
+
+            if (--numGenerating == 0 && requests.empty())
+                idleCv.notify_all();
+        }
+    }
+
+private:
+    Generator generator;
+    Options options;
+
+    std::mutex mutex;
+    std::condition_variable cv, idleCv;
+    std::deque<Request> requests;
+    std::vector<std::pair<VoxelCoords, std::shared_ptr<Chunk>>> finished;
+    int numGenerating = 0;
+    uint64_t generation = 0;
+    bool stop = false;
+
+    // owner side: requested and not installed yet
+    std::unordered_set<VoxelCoords> inFlight;
+
+    std::vector<std::thread> threads;
+};
+
+}
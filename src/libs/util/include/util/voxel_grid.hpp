@@ -1,11 +1,17 @@
 #pragma once
 
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#include <cstdint>
 #include <unordered_map>
 
 #include <Magnum/Magnum.h>
 #include <Magnum/Math/Vector3.h>
 
 #include <util/magnum.hpp>
+#include <util/memory_report.hpp>
 
 
 namespace Megaverse
@@ -13,7 +19,22 @@ namespace Megaverse
 
 using VoxelCoords = Magnum::Vector3i;
 
-constexpr int maxGridResolution = 1'024, logMaxGridResolution = 10, maxAbsVoxelCoord = maxGridResolution / 2;
+/**
+ * Coords within +-maxAbsVoxelCoord along each axis have distinct 64-bit keys (21 bits per axis), so streamed open
+ * worlds (see VoxelChunkStreamer) can span about two million voxels along each axis without aliasing.
+ */
+constexpr int logMaxGridResolution = 21, maxGridResolution = 1 << logMaxGridResolution, maxAbsVoxelCoord = maxGridResolution / 2;
+
+inline uint64_t voxelKey(const VoxelCoords &voxel)
+{
+    constexpr auto shift = logMaxGridResolution;
+    constexpr auto mask = uint64_t(maxGridResolution - 1);
+    const auto x = uint64_t(voxel.x() + maxAbsVoxelCoord) & mask;
+    const auto y = uint64_t(voxel.y() + maxAbsVoxelCoord) & mask;
+    const auto z = uint64_t(voxel.z() + maxAbsVoxelCoord) & mask;
+
+    return (x << (2 * shift)) | (y << shift) | z;
+}
 
 inline VoxelCoords toVoxel(const Magnum::Vector3 &v)
 {
@@ -40,11 +61,7 @@ template <> struct hash<Megaverse::VoxelCoords>
 {
     std::size_t operator()(const Megaverse::VoxelCoords &voxel) const noexcept
     {
-        constexpr auto shift = Megaverse::logMaxGridResolution;
-        constexpr auto offset = Megaverse::maxAbsVoxelCoord;
-        const int x = voxel.x() + offset, y = voxel.y() + offset, z = voxel.z() + offset;
-
-        return size_t((x << (2 * shift)) + (y << shift) + z);
+        return std::size_t(Megaverse::voxelKey(voxel));
     }
 };
 
@@ -54,11 +71,494 @@ template <> struct hash<Megaverse::VoxelCoords>
 namespace Megaverse
 {
 
-template<typename VoxelState> class VoxelGrid
+/**
+ * Default storage policy for VoxelGrid: one hash map node per voxel.
+ * Cheap for very sparse grids, but every lookup is a pointer chase.
+ */
+template<typename VoxelState> class HashMapVoxelStorage
 {
 public:
     using HashMap = std::unordered_map<VoxelCoords, VoxelState>;
 
+public:
+    explicit HashMapVoxelStorage(size_t voxelCount)
+    : grid{voxelCount}
+    {
+    }
+
+    /**
+     * std::unordered_map::clear() keeps the bucket array, so refilling the grid does not rehash.
+     */
+    void clear() { grid.clear(); }
+
+    bool hasVoxel(const VoxelCoords &coords) const { return bool(grid.count(coords)); }
+
+    const VoxelState * get(const VoxelCoords &coords) const
+    {
+        auto voxelIt = grid.find(coords);
+        if (voxelIt == grid.end())
+            return nullptr;
+
+        return &(voxelIt->second);
+    }
+
+    VoxelState * get(const VoxelCoords &coords)
+    {
+        auto voxelIt = grid.find(coords);
+        if (voxelIt == grid.end())
+            return nullptr;
+
+        return &(voxelIt->second);
+    }
+
+    void set(const VoxelCoords &coords, const VoxelState &state) { grid[coords] = state; }
+
+    void remove(const VoxelCoords &coords) { grid.erase(coords); }
+
+    void setColumn(int x, int z, int yMin, int yMax, const VoxelState &state)
+    {
+        for (int y = yMin; y <= yMax; ++y)
+            grid[{x, y, z}] = state;
+    }
+
+    template<typename Func>
+    void forEach(Func &&func) const
+    {
+        for (const auto &[coords, voxel] : grid)
+            func(coords, voxel);
+    }
+
+    const HashMap & getHashMap() const { return grid; }
+
+    size_t memoryBytes() const { return hashMapBytes(grid); }
+
+private:
+    HashMap grid;
+};
+
+
+/**
+ * Storage policy for VoxelGrid that keeps voxels in dense chunks (bricks) of (2^logChunkSize)^3 voxels.
+ * Chunks are allocated on demand and looked up in a hash map, so neighbouring queries hit the same memory and
+ * filling a layout requires only a handful of allocations.
+ */
+/// Detect whether the voxel data has the voxelType field (most voxel types are derived from VoxelState)
+template<typename T, typename = void> struct HasVoxelType : std::false_type {};
+template<typename T> struct HasVoxelType<T, std::void_t<decltype(std::declval<T>().voxelType)>> : std::true_type {};
+
+template<typename VoxelState, int logChunkSize = 4> class ChunkedVoxelStorage
+{
+public:
+    static constexpr int chunkSize = 1 << logChunkSize, chunkMask = chunkSize - 1;
+    static constexpr int voxelsPerChunk = chunkSize * chunkSize * chunkSize;
+
+    /**
+     * Voxels are stored y-major, so a vertical column within a chunk is contiguous in memory.
+     * In addition to the voxel data we keep a separate plane of voxel types (SoA), so that column queries like
+     * "is there anything solid below" scan a few bytes instead of the whole voxel structs.
+     * This plane is updated in set() and remove(), i.e. voxelType of a voxel must be changed by calling set().
+     */
+    struct Chunk
+    {
+        VoxelState voxels[voxelsPerChunk];
+        uint8_t voxelTypes[voxelsPerChunk] = {};
+        uint64_t occupied[voxelsPerChunk / 64] = {};
+        int numOccupied = 0;
+        bool dirty = false;
+
+        // immutable chunk referenced by a SharedChunks snapshot, copied on the first write (see share())
+        bool frozen = false;
+
+        bool isOccupied(int idx) const { return occupied[idx >> 6] & (uint64_t(1) << (idx & 63)); }
+        void setOccupied(int idx) { occupied[idx >> 6] |= uint64_t(1) << (idx & 63); }
+        void clearOccupied(int idx) { occupied[idx >> 6] &= ~(uint64_t(1) << (idx & 63)); }
+    };
+
+    /**
+     * Reference-counted immutable voxels of a whole grid, see share() and restore().
+     */
+    using SharedChunks = std::vector<std::pair<VoxelCoords, std::shared_ptr<const Chunk>>>;
+
+public:
+    explicit ChunkedVoxelStorage(size_t voxelCount)
+    {
+        // voxelCount is the expected resolution of the grid along each axis
+        const auto chunksPerAxis = voxelCount / chunkSize + 1;
+        chunks.reserve(chunksPerAxis * chunksPerAxis);
+    }
+
+    /**
+     * Chunks are kept allocated between episodes, we only reset the voxels in chunks that were touched since the
+     * last clear(). Layouts usually occupy the same region of space, so after the first episode there are no allocations.
+     */
+    void clear()
+    {
+        // shared chunks are just dropped, the owned chunks they displaced are in spareChunks
+        for (const auto &coords : sharedChunkCoords) {
+            auto it = chunks.find(coords);
+            if (it != chunks.end() && it->second->frozen)
+                chunks.erase(it);
+        }
+        sharedChunkCoords.clear();
+
+        for (auto chunkPtr : dirtyChunks) {
+            auto &chunk = *chunkPtr;
+
+            for (int i = 0; i < voxelsPerChunk / 64; ++i) {
+                auto bits = chunk.occupied[i];
+                while (bits) {
+                    const int idx = i * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    chunk.voxels[idx] = VoxelState{};
+                    chunk.voxelTypes[idx] = 0;
+                }
+
+                chunk.occupied[i] = 0;
+            }
+
+            chunk.numOccupied = 0;
+            chunk.dirty = false;
+        }
+
+        dirtyChunks.clear();
+    }
+
+    bool hasVoxel(const VoxelCoords &coords) const { return get(coords) != nullptr; }
+
+    const VoxelState * get(const VoxelCoords &coords) const
+    {
+        auto it = chunks.find(chunkCoords(coords));
+        if (it == chunks.end())
+            return nullptr;
+
+        const auto idx = voxelIdx(coords);
+        const auto &chunk = *it->second;
+        return chunk.isOccupied(idx) ? &chunk.voxels[idx] : nullptr;
+    }
+
+    /**
+     * Mutable access copies a shared chunk, so read-only lookups should go through the const overload.
+     */
+    VoxelState * get(const VoxelCoords &coords)
+    {
+        auto it = chunks.find(chunkCoords(coords));
+        if (it == chunks.end())
+            return nullptr;
+
+        const auto idx = voxelIdx(coords);
+        if (!it->second->isOccupied(idx))
+            return nullptr;
+
+        return &writableChunk(it->second).voxels[idx];
+    }
+
+    void set(const VoxelCoords &coords, const VoxelState &state)
+    {
+        setInChunk(writableChunk(chunks[chunkCoords(coords)]), coords, state);
+    }
+
+    /**
+     * Set a voxel of a standalone chunk (coords are the global voxel coords), i.e. one that is generated on another
+     * thread and handed to insertChunk() later.
+     */
+    static void setInChunk(Chunk &chunk, const VoxelCoords &coords, const VoxelState &state)
+    {
+        const auto idx = voxelIdx(coords);
+        if (!chunk.isOccupied(idx)) {
+            chunk.setOccupied(idx);
+            ++chunk.numOccupied;
+        }
+
+        chunk.voxels[idx] = state;
+
+        if constexpr (HasVoxelType<VoxelState>::value)
+            chunk.voxelTypes[idx] = uint8_t(state.voxelType);
+    }
+
+    static VoxelCoords chunkCoords(const VoxelCoords &coords)
+    {
+        // arithmetic shift rounds towards negative infinity, which is what we need for negative coords
+        return {coords.x() >> logChunkSize, coords.y() >> logChunkSize, coords.z() >> logChunkSize};
+    }
+
+    /// A chunk is allocated at these chunk coords (it can be empty, i.e. after clear() or for air).
+    bool hasChunk(const VoxelCoords &chunkCoords) const { return chunks.count(chunkCoords) > 0; }
+
+    size_t numChunks() const { return chunks.size(); }
+
+    /**
+     * Replace the chunk at chunkCoords with a filled one without copying the voxels, see setInChunk().
+     */
+    void insertChunk(const VoxelCoords &chunkCoords, std::shared_ptr<Chunk> chunk)
+    {
+        auto &entry = chunks[chunkCoords];
+        if (entry && entry->dirty)
+            dirtyChunks.erase(std::find(dirtyChunks.begin(), dirtyChunks.end(), entry.get()));
+
+        entry = std::move(chunk);
+        entry->frozen = false, entry->dirty = true;
+        dirtyChunks.push_back(entry.get());
+    }
+
+    /**
+     * Free the chunks for which evict(chunkCoords) is true, together with their voxels. Unlike clear() this releases
+     * the memory, so a grid that follows the agents through a large world stays bounded.
+     * @return number of chunks evicted.
+     */
+    template<typename Pred>
+    size_t evictChunks(Pred &&evict)
+    {
+        // owned chunks are kept alive until they are gone from dirtyChunks, shared ones are never dirty
+        std::vector<std::shared_ptr<Chunk>> evicted;
+        size_t numEvicted = 0;
+
+        for (auto it = chunks.begin(); it != chunks.end();) {
+            if (!evict(it->first)) {
+                ++it;
+                continue;
+            }
+
+            if (it->second->dirty) {
+                it->second->dirty = false;
+                evicted.push_back(std::move(it->second));
+            }
+
+            it = chunks.erase(it);
+            ++numEvicted;
+        }
+
+        if (!evicted.empty())
+            dirtyChunks.erase(std::remove_if(dirtyChunks.begin(), dirtyChunks.end(), [](const Chunk *c) { return !c->dirty; }), dirtyChunks.end());
+
+        return numEvicted;
+    }
+
+    /**
+     * Same as set() for every voxel of the column (x, z) between yMin and yMax (inclusive). Column is contiguous
+     * within a chunk, so this is one chunk lookup and a linear fill per chunk instead of a lookup per voxel.
+     */
+    void setColumn(int x, int z, int yMin, int yMax, const VoxelState &state)
+    {
+        for (int chunkY = yMin >> logChunkSize; chunkY <= (yMax >> logChunkSize); ++chunkY) {
+            auto &chunk = writableChunk(chunks[{x >> logChunkSize, chunkY, z >> logChunkSize}]);
+
+            const int columnIdx = voxelIdx({x, 0, z});
+            const int from = columnIdx + (std::max(yMin, chunkY << logChunkSize) & chunkMask);
+            const int to = columnIdx + (std::min(yMax, (chunkY << logChunkSize) + chunkMask) & chunkMask);
+
+            for (int idx = from; idx <= to; ++idx) {
+                if (!chunk.isOccupied(idx)) {
+                    chunk.setOccupied(idx);
+                    ++chunk.numOccupied;
+                }
+
+                chunk.voxels[idx] = state;
+            }
+
+            if constexpr (HasVoxelType<VoxelState>::value)
+                std::fill(chunk.voxelTypes + from, chunk.voxelTypes + to + 1, uint8_t(state.voxelType));
+        }
+    }
+
+    void remove(const VoxelCoords &coords)
+    {
+        auto it = chunks.find(chunkCoords(coords));
+        if (it == chunks.end())
+            return;
+
+        const auto idx = voxelIdx(coords);
+        if (it->second->isOccupied(idx)) {
+            auto &chunk = writableChunk(it->second);
+            chunk.clearOccupied(idx);
+            chunk.voxels[idx] = VoxelState{};
+            chunk.voxelTypes[idx] = 0;
+            --chunk.numOccupied;
+        }
+    }
+
+    template<typename Func>
+    void forEach(Func &&func) const
+    {
+        for (const auto &[chunkCoord, chunkPtr] : chunks) {
+            const auto &chunk = *chunkPtr;
+            if (!chunk.numOccupied)
+                continue;
+
+            const auto chunkOrigin = chunkCoord * chunkSize;
+
+            for (int i = 0; i < voxelsPerChunk / 64; ++i) {
+                auto bits = chunk.occupied[i];
+                while (bits) {
+                    const int idx = i * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+
+                    const VoxelCoords local{(idx >> logChunkSize) & chunkMask, idx & chunkMask, idx >> (2 * logChunkSize)};
+                    func(chunkOrigin + local, chunk.voxels[idx]);
+                }
+            }
+        }
+    }
+
+    /**
+     * Find the first voxel in the vertical column (x, z) between yFrom and yTo (inclusive, in either direction)
+     * for which ((voxelType & typeMask) != 0) == match. Missing voxels have type 0.
+     * @return y coordinate of the voxel, or yTo + step if there is no such voxel.
+     */
+    int findInColumn(int x, int z, int yFrom, int yTo, uint8_t typeMask, bool match) const
+    {
+        const int step = yTo >= yFrom ? 1 : -1;
+
+        int y = yFrom;
+        while (y != yTo + step) {
+            const auto chunkY = y >> logChunkSize;
+            // last y in the current chunk that we need to check
+            const int chunkEndY = step > 0 ? std::min(yTo, (chunkY << logChunkSize) + chunkMask) : std::max(yTo, chunkY << logChunkSize);
+
+            auto it = chunks.find({x >> logChunkSize, chunkY, z >> logChunkSize});
+            if (it == chunks.end() || !it->second->numOccupied) {
+                // the whole chunk is empty, we only have a match if we're looking for a non-matching voxel
+                if (!match)
+                    return y;
+            } else {
+                // column is contiguous, this is a tight loop over bytes that the compiler can vectorize
+                const uint8_t *types = it->second->voxelTypes + voxelIdx({x, 0, z});
+                for (int cy = y; cy != chunkEndY + step; cy += step)
+                    if (bool(types[cy & chunkMask] & typeMask) == match)
+                        return cy;
+            }
+
+            y = chunkEndY + step;
+        }
+
+        return y;
+    }
+
+    /**
+     * @return whether any voxel in the vertical column (x, z) between yMin and yMax (inclusive) has any of the
+     * typeMask bits set.
+     */
+    bool anyInColumn(int x, int z, int yMin, int yMax, uint8_t typeMask) const
+    {
+        for (int chunkY = yMin >> logChunkSize; chunkY <= (yMax >> logChunkSize); ++chunkY) {
+            auto it = chunks.find({x >> logChunkSize, chunkY, z >> logChunkSize});
+            if (it == chunks.end() || !it->second->numOccupied)
+                continue;
+
+            const int from = std::max(yMin, chunkY << logChunkSize) & chunkMask;
+            const int to = std::min(yMax, (chunkY << logChunkSize) + chunkMask) & chunkMask;
+
+            const uint8_t *types = it->second->voxelTypes + voxelIdx({x, 0, z});
+            uint8_t acc = 0;
+            for (int i = from; i <= to; ++i)
+                acc |= types[i];
+
+            if (acc & typeMask)
+                return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Immutable copy of the occupied chunks. Grids restored from it reference the same chunks and copy a chunk only
+     * when they first write to it, so many envs replaying the same layout keep one copy of the voxels.
+     */
+    SharedChunks share() const
+    {
+        SharedChunks shared;
+        for (const auto &[coords, chunkPtr] : chunks) {
+            if (!chunkPtr->numOccupied)
+                continue;
+
+            if (chunkPtr->frozen)
+                shared.emplace_back(coords, chunkPtr);
+            else {
+                auto copy = std::make_shared<Chunk>(*chunkPtr);
+                copy->dirty = false, copy->frozen = true;
+                shared.emplace_back(coords, std::move(copy));
+            }
+        }
+
+        return shared;
+    }
+
+    /**
+     * Replaces the contents of the grid with the shared chunks, without copying any voxels.
+     */
+    void restore(const SharedChunks &shared)
+    {
+        clear();
+
+        for (const auto &[coords, chunkPtr] : shared) {
+            auto &entry = chunks[coords];
+            if (entry)
+                spareChunks.push_back(std::move(entry));
+
+            // frozen chunks are never written to, writableChunk() replaces them with a copy first
+            entry = std::const_pointer_cast<Chunk>(chunkPtr);
+            sharedChunkCoords.push_back(coords);
+        }
+    }
+
+    /// Chunks shared with a snapshot are not counted, they belong to whoever holds the snapshot.
+    size_t memoryBytes() const
+    {
+        const auto numShared = size_t(std::count_if(chunks.begin(), chunks.end(), [](const auto &c) { return c.second->frozen; }));
+        return (chunks.size() - numShared + spareChunks.size()) * sizeof(Chunk) + hashMapBytes(chunks) + vectorBytes(dirtyChunks);
+    }
+
+private:
+    static int voxelIdx(const VoxelCoords &coords)
+    {
+        return (coords.y() & chunkMask) + ((coords.x() & chunkMask) << logChunkSize) + ((coords.z() & chunkMask) << (2 * logChunkSize));
+    }
+
+    /**
+     * Chunk that we can write to, a new one for an empty slot or a private copy of a shared chunk.
+     */
+    Chunk & writableChunk(std::shared_ptr<Chunk> &chunkPtr)
+    {
+        if (!chunkPtr || chunkPtr->frozen) {
+            std::shared_ptr<Chunk> chunk;
+            if (!spareChunks.empty()) {
+                chunk = std::move(spareChunks.back());
+                spareChunks.pop_back();
+            } else
+                chunk = std::make_shared<Chunk>();
+
+            if (chunkPtr) {
+                *chunk = *chunkPtr;
+                chunk->dirty = chunk->frozen = false;
+            }
+
+            chunkPtr = std::move(chunk);
+        }
+
+        if (!chunkPtr->dirty) {
+            chunkPtr->dirty = true;
+            dirtyChunks.push_back(chunkPtr.get());
+        }
+
+        return *chunkPtr;
+    }
+
+private:
+    std::unordered_map<VoxelCoords, std::shared_ptr<Chunk>> chunks;
+
+    // chunks that may contain voxels, i.e. need to be reset in clear()
+    std::vector<Chunk *> dirtyChunks;
+
+    // where restore() put shared chunks, and the empty owned chunks they displaced (reused by writableChunk())
+    std::vector<VoxelCoords> sharedChunkCoords;
+    std::vector<std::shared_ptr<Chunk>> spareChunks;
+};
+
+
+template<typename VoxelState, typename Storage = HashMapVoxelStorage<VoxelState>> class VoxelGrid
+{
+public:
+    using StorageType = Storage;
+
 public:
     /**
      * Ctor.
@@ -67,8 +567,7 @@ public:
      * @param voxelSize scale of one voxel
      */
     explicit VoxelGrid(size_t voxelCount, const Magnum::Vector3 &origin, float voxelSize)
-    : voxelCount{voxelCount}
-    , grid{voxelCount}
+    : grid{voxelCount}
     , origin{origin}
     , voxelSize{voxelSize} {}
 
@@ -77,7 +576,7 @@ public:
      */
     void clear()
     {
-        grid = HashMap{voxelCount};
+        grid.clear();
     }
 
     /**
@@ -86,7 +585,7 @@ public:
      */
     bool hasVoxel(const VoxelCoords &coords) const
     {
-        return bool(grid.count(coords));
+        return grid.hasVoxel(coords);
     }
 
     /**
@@ -95,20 +594,12 @@ public:
      */
     const VoxelState * get(const VoxelCoords &coords) const
     {
-        auto voxelIt = grid.find(coords);
-        if (voxelIt == grid.end())
-            return nullptr;
-
-        return &(voxelIt->second);
+        return grid.get(coords);
     }
 
     VoxelState * get(const VoxelCoords &coords)
     {
-        auto voxelIt = grid.find(coords);
-        if (voxelIt == grid.end())
-            return nullptr;
-
-        return &(voxelIt->second);
+        return grid.get(coords);
     }
 
     const VoxelState * getWithVector(const Magnum::Vector3 &v) const
@@ -128,12 +619,29 @@ public:
      */
     void set(const VoxelCoords &coords, const VoxelState &state)
     {
-        grid[coords] = state;
+        grid.set(coords, state);
     }
 
     void remove(const VoxelCoords &coords)
     {
-        grid.erase(coords);
+        grid.remove(coords);
+    }
+
+    /**
+     * Set all voxels of the vertical column (x, z) between yMin and yMax (inclusive) to the same state.
+     */
+    void setColumn(int x, int z, int yMin, int yMax, const VoxelState &state)
+    {
+        grid.setColumn(x, z, yMin, yMax, state);
+    }
+
+    /**
+     * Call func(coords, voxelState) for every voxel in the grid, order is not specified.
+     */
+    template<typename Func>
+    void forEach(Func &&func) const
+    {
+        grid.forEach(std::forward<Func>(func));
     }
 
     /**
@@ -148,20 +656,76 @@ public:
         return coords;
     }
 
-    const HashMap & getHashMap() const
+    /**
+     * Only available with the hash map storage.
+     */
+    const auto & getHashMap() const
+    {
+        return grid.getHashMap();
+    }
+
+    /**
+     * Column queries, see ChunkedVoxelStorage.
+     */
+    int findInColumn(int x, int z, int yFrom, int yTo, uint8_t typeMask, bool match) const
+    {
+        return grid.findInColumn(x, z, yFrom, yTo, typeMask, match);
+    }
+
+    bool anyInColumn(int x, int z, int yMin, int yMax, uint8_t typeMask) const
     {
-        return grid;
+        return grid.anyInColumn(x, z, yMin, yMax, typeMask);
+    }
+
+    /**
+     * Copy-on-write snapshots, only available with the chunked storage.
+     */
+    auto share() const
+    {
+        return grid.share();
+    }
+
+    template<typename SharedChunks>
+    void restore(const SharedChunks &shared)
+    {
+        grid.restore(shared);
+    }
+
+    /**
+     * Chunk-granular population and eviction, only available with the chunked storage, see VoxelChunkStreamer.
+     */
+    bool hasChunk(const VoxelCoords &chunkCoords) const { return grid.hasChunk(chunkCoords); }
+
+    size_t numChunks() const { return grid.numChunks(); }
+
+    template<typename ChunkPtr>
+    void insertChunk(const VoxelCoords &chunkCoords, ChunkPtr chunk)
+    {
+        grid.insertChunk(chunkCoords, std::move(chunk));
+    }
+
+    template<typename Pred>
+    size_t evictChunks(Pred &&evict)
+    {
+        return grid.evictChunks(std::forward<Pred>(evict));
     }
 
     float getVoxelSize() const { return voxelSize; }
 
-private:
-    size_t voxelCount;
+    const Magnum::Vector3 & getOrigin() const { return origin; }
 
-    HashMap grid;
+    size_t memoryBytes() const { return grid.memoryBytes(); }
+
+private:
+    Storage grid;
 
     Magnum::Vector3 origin;
     float voxelSize;
 };
 
+/**
+ * Voxel grid with dense chunked storage, this is what the scenarios use.
+ */
+template<typename VoxelState> using ChunkedVoxelGrid = VoxelGrid<VoxelState, ChunkedVoxelStorage<VoxelState>>;
+
 }
\ No newline at end of file
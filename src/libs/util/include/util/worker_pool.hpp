@@ -0,0 +1,66 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+
+namespace Megaverse
+{
+
+/**
+ * Small fixed pool of helper threads for data parallelism within one job, i.e. the agents of a single large env
+ * (see Env::setPhysicsWorkers()). The calling thread always takes part in the work.
+ * One job at a time: a thread that calls parallelFor() while another job is running does its own job inline instead
+ * of waiting, so several envs can share one pool without blocking each other.
+ */
+class WorkerPool
+{
+public:
+    explicit WorkerPool(int numThreads);
+
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+
+    void operator=(const WorkerPool &) = delete;
+
+    int numThreads() const { return int(threads.size()); }
+
+    /// Calls func(begin, end) for chunks of grainSize indices covering [0, n), returns when all chunks are done.
+    void parallelFor(int n, int grainSize, const std::function<void(int begin, int end)> &func);
+
+    /// Jobs that ran on the pool, and those that ran inline because the pool was busy.
+    uint64_t numParallelJobs() const { return parallelJobs.load(std::memory_order_relaxed); }
+
+    uint64_t numInlineJobs() const { return inlineJobs.load(std::memory_order_relaxed); }
+
+private:
+    void workerLoop();
+
+    void runChunks();
+
+private:
+    std::mutex submitMutex;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable, workDone;
+    uint64_t generation = 0;
+    int numFinished = 0;
+    bool stop = false;
+
+    // current job, written by the submitting thread before the generation changes
+    const std::function<void(int, int)> *job = nullptr;
+    int jobSize = 0, grain = 1, numChunks = 0;
+    std::atomic<int> nextChunk{0};
+
+    std::atomic<uint64_t> parallelJobs{0}, inlineJobs{0};
+
+    std::vector<std::thread> threads;
+};
+
+}
@@ -0,0 +1,81 @@
+#include <chrono>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#endif
+
+#include <util/barrier.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+}
+
+
+Barrier::Barrier(int numThreads, int spinBudget)
+: numThreads{numThreads}
+, spinBudget{spinBudget}
+{
+}
+
+uint64_t Barrier::arriveAndWait(int spinIterations)
+{
+    const auto gen = generation.load(std::memory_order_acquire);
+
+    if (numArrived.fetch_add(1, std::memory_order_acq_rel) == numThreads - 1) {
+        // last thread to arrive, release everyone else
+        // counter is reset before bumping the generation, so no one can re-enter the barrier before this
+        numArrived.store(0, std::memory_order_relaxed);
+
+        bool haveSleepingThreads;
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            generation.fetch_add(1, std::memory_order_release);
+            haveSleepingThreads = numSleeping > 0;
+        }
+
+        if (haveSleepingThreads)
+            cv.notify_all();
+
+        return 0;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    bool released = false;
+    const int budget = spinIterations >= 0 ? spinIterations : spinBudget.load(std::memory_order_relaxed);
+    for (int i = 0; i < budget; ++i) {
+        if (generation.load(std::memory_order_acquire) != gen) {
+            released = true;
+            break;
+        }
+
+        cpuRelax();
+    }
+
+    if (!released) {
+        std::unique_lock<std::mutex> lock{mutex};
+        ++numSleeping;
+        cv.wait(lock, [&] { return generation.load(std::memory_order_acquire) != gen; });
+        --numSleeping;
+        ++parked;
+    }
+
+    const auto waited = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    waitNs += waited;
+    return waited;
+}
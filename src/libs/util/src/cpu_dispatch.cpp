@@ -0,0 +1,89 @@
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__aarch64__) && defined(__linux__)
+    #include <sys/auxv.h>
+    #include <asm/hwcap.h>
+#endif
+
+#include <util/cpu_dispatch.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+bool detect(SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::Scalar:
+            return true;
+#if defined(__x86_64__) || defined(__i386__)
+        // also checks that the OS saves the wider registers (XCR0)
+        case SimdLevel::Avx2:
+            return __builtin_cpu_supports("avx2");
+        case SimdLevel::Avx512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#elif defined(__aarch64__) && defined(__linux__)
+        case SimdLevel::Neon:
+            return getauxval(AT_HWCAP) & HWCAP_ASIMD;
+#elif defined(__ARM_NEON)
+        case SimdLevel::Neon:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+SimdLevel detectMaxLevel()
+{
+    auto best = SimdLevel::Scalar;
+    for (auto level : {SimdLevel::Neon, SimdLevel::Avx2, SimdLevel::Avx512})
+        if (simdLevelSupported(level))
+            best = level;
+
+    const auto override = std::getenv("MEGAVERSE_SIMD");
+    if (!override)
+        return best;
+
+    for (auto level : {SimdLevel::Scalar, SimdLevel::Neon, SimdLevel::Avx2, SimdLevel::Avx512})
+        if (strcmp(override, simdLevelName(level)) == 0) {
+            if (!simdLevelSupported(level))
+                TLOG(WARNING) << "MEGAVERSE_SIMD=" << override << " is not supported by this CPU, using " << simdLevelName(best);
+            return level < best ? level : best;
+        }
+
+    TLOG(WARNING) << "Unknown MEGAVERSE_SIMD=" << override << ", expected scalar, neon, avx2 or avx512";
+    return best;
+}
+
+}
+
+
+const char * Megaverse::simdLevelName(SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::Neon: return "neon";
+        case SimdLevel::Avx2: return "avx2";
+        case SimdLevel::Avx512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+bool Megaverse::simdLevelSupported(SimdLevel level)
+{
+    static const bool supported[] = {
+        detect(SimdLevel::Scalar), detect(SimdLevel::Neon), detect(SimdLevel::Avx2), detect(SimdLevel::Avx512),
+    };
+
+    return supported[int(level)];
+}
+
+SimdLevel Megaverse::maxSimdLevel()
+{
+    static const auto level = detectMaxLevel();
+    return level;
+}
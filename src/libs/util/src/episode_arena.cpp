@@ -0,0 +1,58 @@
+#include <memory>
+#include <algorithm>
+
+#include <util/episode_arena.hpp>
+
+
+using namespace Megaverse;
+
+
+EpisodeArena::EpisodeArena(size_t blockSize)
+: blockSize{blockSize}
+{
+}
+
+EpisodeArena::~EpisodeArena()
+{
+    release();
+}
+
+void * EpisodeArena::allocate(size_t size, size_t alignment)
+{
+    for (; currBlock < blocks.size(); ++currBlock, offset = 0) {
+        auto &block = blocks[currBlock];
+
+        void *ptr = block.data.get() + offset;
+        auto space = block.size - offset;
+        if (std::align(alignment, size, ptr, space)) {
+            offset = block.size - space + size;
+            allocated += size;
+            return ptr;
+        }
+    }
+
+    // no room in the retained blocks, oversized allocations get a block of their own
+    const auto newBlockSize = std::max(blockSize, size + alignment);
+    blocks.push_back({std::unique_ptr<char[]>(new char[newBlockSize]), newBlockSize});
+    currBlock = blocks.size() - 1, offset = 0;
+
+    return allocate(size, alignment);
+}
+
+void EpisodeArena::release()
+{
+    for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+        it->destroy(it->obj);
+
+    destructors.clear();
+    currBlock = offset = allocated = 0;
+}
+
+size_t EpisodeArena::bytesReserved() const
+{
+    size_t reserved = 0;
+    for (const auto &block : blocks)
+        reserved += block.size;
+
+    return reserved;
+}
@@ -1,5 +1,14 @@
+#include <cstdio>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <util/filesystem_utils.hpp>
 
+
 namespace Megaverse
 {
 
@@ -27,6 +36,64 @@ bool fileExists(const std::string& filename)
     return f.good();
 }
 
+bool createDirectories(const std::string &dir)
+{
+    for (size_t pos = dir.find(pathDelim(), 1); ; pos = dir.find(pathDelim(), pos + 1)) {
+        const auto prefix = dir.substr(0, pos);
+        if (!prefix.empty() && mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+
+        if (pos == std::string::npos)
+            break;
+    }
+
+    struct stat st{};
+    return stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool writeFileAtomic(const std::string &filename, const char *data, size_t size)
+{
+    const auto tmpFilename = filename + ".tmp" + std::to_string(getpid());
+
+    {
+        std::ofstream f{tmpFilename, std::ios::out | std::ios::binary};
+        if (!f.write(data, std::streamsize(size)))
+            return false;
+    }
+
+    if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+MappedFile::MappedFile(const std::string &filename)
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr != MAP_FAILED) {
+            data_ = static_cast<const char *>(ptr);
+            size_ = size_t(st.st_size);
+        }
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+        munmap(const_cast<char *>(data_), size_);
+}
+
 // This crashes on GCC 8.4 due to some obscure linking error (let's just wait for a new compiler I guess lol)
 //std::vector<std::string> listFilesInDirectory(const std::string &dir)
 //{
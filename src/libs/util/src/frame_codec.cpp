@@ -0,0 +1,78 @@
+#include <cstring>
+
+#include <util/lz_block.hpp>
+#include <util/frame_codec.hpp>
+#include <util/simd_kernels.hpp>
+
+
+using namespace Megaverse;
+
+
+FrameEncoder::FrameEncoder(size_t frameBytes, int keyframeInterval)
+: frameBytes{frameBytes}
+, keyframeInterval{keyframeInterval}
+, prevFrame(frameBytes)
+, residual(frameBytes)
+{
+}
+
+size_t FrameEncoder::maxEncodedBytes(size_t frameBytes)
+{
+    // flags, then the worst case of the LZ4 block format: incompressible data stored as a single run of literals
+    return 1 + frameBytes + frameBytes / 255 + 16;
+}
+
+void FrameEncoder::encode(const uint8_t *frame, bool keyframe, std::vector<uint8_t> &out)
+{
+    keyframe = keyframe || framesSinceKeyframe < 0 || (keyframeInterval > 0 && framesSinceKeyframe + 1 >= keyframeInterval);
+
+    const uint8_t *block = frame;
+    if (keyframe)
+        framesSinceKeyframe = 0;
+    else {
+        // wraps around, the decoder adds the residual back modulo 256 as well
+        subtractBytes(frame, prevFrame.data(), residual.data(), frameBytes);
+
+        block = residual.data();
+        ++framesSinceKeyframe;
+    }
+
+    out.push_back(keyframe ? KEYFRAME : 0);
+    lzCompress(block, frameBytes, out);
+
+    memcpy(prevFrame.data(), frame, frameBytes);
+}
+
+
+FrameDecoder::FrameDecoder(size_t frameBytes)
+: frameBytes{frameBytes}
+, prevFrame(frameBytes)
+{
+}
+
+bool FrameDecoder::decode(const uint8_t *data, size_t size, uint8_t *frame)
+{
+    if (size < 1) {
+        hasReference = false;
+        return false;
+    }
+
+    const bool keyframe = data[0] & FrameEncoder::KEYFRAME;
+    if (!keyframe && !hasReference)
+        return false;
+
+    block.clear();
+    if (!lzDecompress(data + 1, size - 1, frameBytes, block)) {
+        hasReference = false;
+        return false;
+    }
+
+    if (keyframe)
+        memcpy(prevFrame.data(), block.data(), frameBytes);
+    else
+        addBytes(prevFrame.data(), block.data(), prevFrame.data(), frameBytes);
+
+    memcpy(frame, prevFrame.data(), frameBytes);
+    hasReference = true;
+    return true;
+}
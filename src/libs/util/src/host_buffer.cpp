@@ -0,0 +1,154 @@
+#include <mutex>
+#include <utility>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <util/tiny_logger.hpp>
+#include <util/host_buffer.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+constexpr size_t hugePageSize = size_t(2) << 20;
+
+HostMemoryPinning & pinningHooks()
+{
+    static HostMemoryPinning pinning;
+    return pinning;
+}
+
+std::mutex pinningMutex;
+
+size_t roundUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+void * mapAnonymous(size_t size, int extraFlags = 0)
+{
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extraFlags, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+/**
+ * Normal pages at a 2MB boundary, so the kernel can back the whole range with transparent huge pages.
+ */
+uint8_t * mapHugeAligned(size_t size)
+{
+    auto *ptr = static_cast<uint8_t *>(mapAnonymous(size + hugePageSize));
+    if (!ptr)
+        return nullptr;
+
+    const auto head = roundUp(uintptr_t(ptr), hugePageSize) - uintptr_t(ptr);
+    if (head)
+        munmap(ptr, head);
+    munmap(ptr + head + size, hugePageSize - head);
+
+    return ptr + head;
+}
+
+}
+
+
+void Megaverse::setHostMemoryPinning(const HostMemoryPinning &pinning)
+{
+    std::lock_guard lock{pinningMutex};
+    pinningHooks() = pinning;
+}
+
+bool Megaverse::hostMemoryPinningAvailable()
+{
+    std::lock_guard lock{pinningMutex};
+    return pinningHooks().pin != nullptr;
+}
+
+HostBuffer::HostBuffer(size_t size, HostMemoryPolicy policy)
+: size_{size}
+, policy_{policy}
+{
+    if (!size)
+        return;
+
+    const bool huge = policy != HostMemoryPolicy::Pageable && size >= hugePageSize;
+    mappedSize = huge ? roundUp(size, hugePageSize) : roundUp(size, size_t(sysconf(_SC_PAGESIZE)));
+
+    if (huge) {
+#if defined(__linux__)
+        data_ = static_cast<uint8_t *>(mapAnonymous(mappedSize, MAP_HUGETLB));
+        hugePages = data_ != nullptr;
+
+        if (!data_) {
+            // no reserved huge pages, ask for transparent ones (effective with THP set to madvise or always)
+            data_ = mapHugeAligned(mappedSize);
+            hugePages = data_ && madvise(data_, mappedSize, MADV_HUGEPAGE) == 0;
+        }
+#else
+        data_ = mapHugeAligned(mappedSize);
+#endif
+    } else
+        data_ = static_cast<uint8_t *>(mapAnonymous(mappedSize));
+
+    TCHECK(data_);
+
+    if (policy == HostMemoryPolicy::Pinned) {
+        std::lock_guard lock{pinningMutex};
+        const auto &hooks = pinningHooks();
+        pinned = hooks.pin && hooks.pin(data_, mappedSize);
+        if (!pinned)
+            TLOG(WARNING) << "Could not pin " << mappedSize << " bytes of host memory, the buffer stays unpinned";
+    }
+}
+
+HostBuffer::~HostBuffer()
+{
+    release();
+}
+
+HostBuffer::HostBuffer(HostBuffer &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+HostBuffer & HostBuffer::operator=(HostBuffer &&other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    release();
+
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    mappedSize = std::exchange(other.mappedSize, 0);
+    policy_ = other.policy_;
+    hugePages = std::exchange(other.hugePages, false);
+    pinned = std::exchange(other.pinned, false);
+    return *this;
+}
+
+void HostBuffer::resize(size_t size)
+{
+    if (size != size_)
+        *this = HostBuffer{size, policy_};
+}
+
+void HostBuffer::release()
+{
+    if (!data_)
+        return;
+
+    if (pinned) {
+        std::lock_guard lock{pinningMutex};
+        if (pinningHooks().unpin)
+            pinningHooks().unpin(data_);
+    }
+
+    munmap(data_, mappedSize);
+    data_ = nullptr;
+    size_ = mappedSize = 0;
+    hugePages = pinned = false;
+}
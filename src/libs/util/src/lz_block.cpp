@@ -0,0 +1,161 @@
+#include <cstring>
+#include <algorithm>
+
+#include <util/lz_block.hpp>
+
+
+namespace Megaverse
+{
+
+namespace
+{
+
+constexpr int minMatch = 4, hashLog = 14;
+constexpr size_t maxOffset = 65535;
+
+// format constraints: the last 5 bytes are always literals, and the last match starts at least 12 bytes before the end
+constexpr size_t lastLiterals = 5, matchStartLimit = 12;
+
+uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - hashLog); }
+
+void writeLength(size_t length, std::vector<uint8_t> &out)
+{
+    for (; length >= 255; length -= 255)
+        out.push_back(255);
+    out.push_back(uint8_t(length));
+}
+
+void writeSequence(const uint8_t *literals, size_t numLiterals, size_t offset, size_t matchLength, std::vector<uint8_t> &out)
+{
+    const auto matchCode = matchLength - minMatch;
+
+    out.push_back(uint8_t((std::min<size_t>(numLiterals, 15) << 4) | std::min<size_t>(matchCode, 15)));
+    if (numLiterals >= 15)
+        writeLength(numLiterals - 15, out);
+
+    if (numLiterals)
+        out.insert(out.end(), literals, literals + numLiterals);
+
+    out.push_back(uint8_t(offset)), out.push_back(uint8_t(offset >> 8));
+    if (matchCode >= 15)
+        writeLength(matchCode - 15, out);
+}
+
+void writeLastLiterals(const uint8_t *literals, size_t numLiterals, std::vector<uint8_t> &out)
+{
+    out.push_back(uint8_t(std::min<size_t>(numLiterals, 15) << 4));
+    if (numLiterals >= 15)
+        writeLength(numLiterals - 15, out);
+
+    // empty inputs may come with a null pointer
+    if (numLiterals)
+        out.insert(out.end(), literals, literals + numLiterals);
+}
+
+bool readLength(const uint8_t *&ip, const uint8_t *end, size_t &length)
+{
+    uint8_t b;
+    do {
+        if (ip == end)
+            return false;
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+
+    return true;
+}
+
+}
+
+void lzCompress(const uint8_t *src, size_t size, std::vector<uint8_t> &out)
+{
+    size_t anchor = 0;
+
+    if (size > matchStartLimit) {
+        std::vector<int32_t> table(size_t(1) << hashLog, -1);
+
+        const auto startLimit = size - matchStartLimit, matchLimit = size - lastLiterals;
+        for (size_t pos = 0; pos < startLimit;) {
+            const auto sequence = read32(src + pos);
+            auto &entry = table[hash(sequence)];
+            const auto candidate = entry;
+            entry = int32_t(pos);
+
+            if (candidate < 0 || pos - size_t(candidate) > maxOffset || read32(src + candidate) != sequence) {
+                ++pos;
+                continue;
+            }
+
+            size_t length = minMatch;
+            while (pos + length < matchLimit && src[candidate + length] == src[pos + length])
+                ++length;
+
+            writeSequence(src + anchor, pos - anchor, pos - size_t(candidate), length, out);
+            pos += length;
+            anchor = pos;
+        }
+    }
+
+    writeLastLiterals(src + anchor, size - anchor, out);
+}
+
+bool lzDecompress(const uint8_t *src, size_t size, size_t rawSize, std::vector<uint8_t> &out)
+{
+    const auto base = out.size();
+    out.resize(base + rawSize);
+
+    const uint8_t *ip = src, *end = src + size;
+    size_t op = 0;
+
+    while (ip < end) {
+        const auto token = *ip++;
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !readLength(ip, end, numLiterals))
+            return false;
+        if (numLiterals > size_t(end - ip) || op + numLiterals > rawSize)
+            return false;
+
+        // out.data() is null for an empty output, memcpy must not see it even with a zero length
+        if (numLiterals)
+            memcpy(out.data() + base + op, ip, numLiterals);
+        ip += numLiterals, op += numLiterals;
+
+        // the last sequence has no match
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        const auto offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+        ip += 2;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(ip, end, matchLength))
+            return false;
+        matchLength += minMatch;
+
+        if (offset == 0 || offset > op || op + matchLength > rawSize)
+            return false;
+
+        // byte by byte, the match can overlap the output it copies
+        if (matchLength) {
+            uint8_t *dst = out.data() + base + op;
+            const uint8_t *match = dst - offset;
+            for (size_t i = 0; i < matchLength; ++i)
+                dst[i] = match[i];
+        }
+        op += matchLength;
+    }
+
+    return op == rawSize;
+}
+
+}
@@ -0,0 +1,62 @@
+#include <vector>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+#include <util/memory_report.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+bool startsWith(const std::string &s, const std::string &prefix) { return s.compare(0, prefix.size(), prefix) == 0; }
+
+}
+
+
+void MemoryReport::merge(const MemoryReport &other, const std::string &prefix)
+{
+    for (const auto &[subsystem, bytes] : other.subsystems)
+        add(prefix + subsystem, bytes);
+}
+
+size_t MemoryReport::get(const std::string &subsystem) const
+{
+    const auto it = subsystems.find(subsystem);
+    return it == subsystems.end() ? 0 : it->second;
+}
+
+size_t MemoryReport::total(const std::string &prefix) const
+{
+    // process-wide and GPU memory is only summed up when explicitly asked for
+    const auto separate = [&prefix](const std::string &subsystem) {
+        for (const auto &p : {"process.", "gpu."})
+            if (startsWith(subsystem, p) && !startsWith(prefix, p))
+                return true;
+        return false;
+    };
+
+    size_t sum = 0;
+    for (const auto &[subsystem, bytes] : subsystems)
+        if (startsWith(subsystem, prefix) && !separate(subsystem))
+            sum += bytes;
+
+    return sum;
+}
+
+std::string MemoryReport::toString() const
+{
+    std::vector<std::pair<std::string, size_t>> sorted{subsystems.begin(), subsystems.end()};
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(2);
+    for (const auto &[subsystem, bytes] : sorted)
+        s << std::left << std::setw(40) << subsystem << std::right << std::setw(12) << double(bytes) / (1 << 20) << " MB\n";
+
+    s << std::left << std::setw(40) << "total" << std::right << std::setw(12) << double(total()) / (1 << 20) << " MB\n";
+    return s.str();
+}
@@ -0,0 +1,100 @@
+#include <util/perf_counters.hpp>
+
+#if defined(__linux__)
+    #include <cstring>
+    #include <utility>
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
+#endif
+
+
+using namespace Megaverse;
+
+
+#if defined(__linux__)
+
+namespace
+{
+
+int openCounter(uint32_t type, uint64_t config, int groupFd)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = groupFd < 0;  // the leader starts the whole group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // this thread, any CPU
+    return int(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+
+}
+
+PerfCounters::PerfCounters()
+{
+    const std::pair<uint32_t, uint64_t> events[numCounters]{
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    for (int i = 0; i < numCounters; ++i) {
+        fds[i] = openCounter(events[i].first, events[i].second, i == 0 ? -1 : fds[0]);
+        if (fds[i] < 0) {
+            // all or nothing, i.e. no PMU in a VM or perf_event_paranoid too strict
+            for (int j = 0; j < i; ++j)
+                close(fds[j]), fds[j] = -1;
+            return;
+        }
+    }
+
+    groupFd = fds[0];
+    ioctl(groupFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(groupFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (auto &fd : fds)
+        if (fd >= 0)
+            close(fd), fd = -1;
+}
+
+bool PerfCounters::read(PerfCounterValues &values) const
+{
+    if (groupFd < 0)
+        return false;
+
+    // PERF_FORMAT_GROUP layout: nr, time_enabled, time_running, values[nr]
+    uint64_t data[3 + numCounters];
+    if (::read(groupFd, data, sizeof(data)) != ssize_t(sizeof(data)) || data[0] != numCounters)
+        return false;
+
+    const auto enabled = data[1], running = data[2];
+    const auto scaled = [&](uint64_t v) {
+        return running && running < enabled ? uint64_t(double(v) * double(enabled) / double(running)) : v;
+    };
+
+    values = {scaled(data[3]), scaled(data[4]), scaled(data[5]), scaled(data[6])};
+    return true;
+}
+
+#else
+
+PerfCounters::PerfCounters() = default;
+
+PerfCounters::~PerfCounters() = default;
+
+bool PerfCounters::read(PerfCounterValues &) const
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,388 @@
+#include <map>
+#include <algorithm>
+#include <deque>
+#include <cmath>
+#include <mutex>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+
+#include <util/tiny_logger.hpp>
+#include <util/scoped_profiler.hpp>
+
+
+using namespace Megaverse;
+
+
+std::atomic<bool> ScopedProfiler::enabledFlag{false}, ScopedProfiler::countersFlag{false};
+
+thread_local uint16_t ProfilerZone::currentDepth = 0;
+
+
+int ProfilerHistogram::bucket(uint64_t durationNs)
+{
+    if (durationNs <= 1)
+        return 0;
+
+    const auto b = int(std::log2(double(durationNs)) * bucketsPerOctave);
+    return std::min(b, numBuckets - 1);
+}
+
+double ProfilerHistogram::bucketValue(int bucket)
+{
+    return std::exp2((double(bucket) + 0.5) / bucketsPerOctave);
+}
+
+void ProfilerHistogram::add(uint64_t durationNs)
+{
+    ++buckets[size_t(bucket(durationNs))];
+    ++count;
+    totalNs += durationNs;
+    maxNs = std::max(maxNs, durationNs);
+}
+
+double ProfilerHistogram::percentile(double q) const
+{
+    if (!count)
+        return 0.0;
+
+    const auto target = std::max(uint64_t(1), uint64_t(std::ceil(q * double(count))));
+
+    uint64_t seen = 0;
+    for (int b = 0; b < numBuckets; ++b) {
+        seen += buckets[size_t(b)];
+        if (seen >= target)
+            return std::min(bucketValue(b), double(maxNs));
+    }
+
+    return double(maxNs);
+}
+
+
+/**
+ * Single-producer ring. The owning thread writes the slot and then publishes it by advancing "written",
+ * the collector reads up to "written" and discards the slots that might have been overwritten while it was copying.
+ */
+struct ScopedProfiler::ThreadBuffer
+{
+    static constexpr uint64_t capacity = 1 << 14;
+
+    explicit ThreadBuffer(uint32_t threadIdx) : threadIdx{threadIdx}, events(capacity) {}
+
+    uint32_t threadIdx;
+    std::vector<ProfilerEvent> events;
+    std::atomic<uint64_t> written{0};
+
+    // per zone: cycles, instructions, LLC misses, branch misses; added by the owner, read and cleared by others
+    using ZoneCounters = std::array<std::array<std::atomic<uint64_t>, 4>, ScopedProfiler::maxCounterZones>;
+    std::atomic<ZoneCounters *> zoneCounters{nullptr};
+
+    ~ThreadBuffer() { delete zoneCounters.load(); }
+
+    // only accessed by the collector, under collectMutex
+    uint64_t read = 0;
+};
+
+struct ScopedProfiler::Impl
+{
+    std::mutex zonesMutex;
+    std::deque<std::string> zoneNames;
+    std::map<std::string, ProfilerZoneId> zoneIds;
+
+    std::mutex buffersMutex;
+    std::deque<std::unique_ptr<ThreadBuffer>> buffers;
+
+    mutable std::mutex collectMutex;
+    std::vector<ProfilerHistogram> histograms;
+    std::vector<ProfilerEvent> traceEvents;
+    bool traceEnabled = false;
+    size_t maxTraceEvents = 0;
+    uint64_t dropped = 0;
+};
+
+
+ScopedProfiler::ScopedProfiler()
+: impl{std::make_unique<Impl>()}
+{
+}
+
+ScopedProfiler::~ScopedProfiler() = default;
+
+ScopedProfiler & ScopedProfiler::instance()
+{
+    static ScopedProfiler profiler;
+    return profiler;
+}
+
+void ScopedProfiler::setTraceEnabled(bool enable, size_t maxTraceEvents)
+{
+    std::lock_guard<std::mutex> lock{impl->collectMutex};
+    impl->traceEnabled = enable;
+    impl->maxTraceEvents = maxTraceEvents;
+}
+
+ProfilerZoneId ScopedProfiler::registerZone(const char *name)
+{
+    std::lock_guard<std::mutex> lock{impl->zonesMutex};
+
+    const auto it = impl->zoneIds.find(name);
+    if (it != impl->zoneIds.end())
+        return it->second;
+
+    const auto id = ProfilerZoneId(impl->zoneNames.size());
+    impl->zoneNames.emplace_back(name);
+    impl->zoneIds.emplace(name, id);
+    return id;
+}
+
+const std::string & ScopedProfiler::zoneName(ProfilerZoneId zone) const
+{
+    std::lock_guard<std::mutex> lock{impl->zonesMutex};
+    return impl->zoneNames[zone];
+}
+
+ScopedProfiler::ThreadBuffer & ScopedProfiler::threadBuffer()
+{
+    // buffers are never freed, so events of threads that already exited can still be collected
+    thread_local ThreadBuffer *buffer = nullptr;
+
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock{impl->buffersMutex};
+        impl->buffers.emplace_back(std::make_unique<ThreadBuffer>(uint32_t(impl->buffers.size())));
+        buffer = impl->buffers.back().get();
+    }
+
+    return *buffer;
+}
+
+void ScopedProfiler::record(ProfilerZoneId zone, uint64_t startNs, uint64_t endNs, uint16_t depth)
+{
+    auto &buffer = threadBuffer();
+
+    const auto pos = buffer.written.load(std::memory_order_relaxed);
+    buffer.events[pos % ThreadBuffer::capacity] = ProfilerEvent{startNs, endNs, zone, depth, buffer.threadIdx};
+    buffer.written.store(pos + 1, std::memory_order_release);
+}
+
+bool ScopedProfiler::setCountersEnabled(bool enable)
+{
+    countersFlag.store(enable, std::memory_order_relaxed);
+
+    PerfCounterValues values;
+    return !enable || readCounters(values);
+}
+
+bool ScopedProfiler::readCounters(PerfCounterValues &values)
+{
+    // opened on the first counted zone of the thread and closed when it exits, unlike the buffers
+    thread_local std::unique_ptr<PerfCounters> perf;
+
+    if (!perf) {
+        perf = std::make_unique<PerfCounters>();
+        if (!perf->valid())
+            TLOG(WARNING) << "Hardware performance counters are not available on thread " << threadBuffer().threadIdx;
+    }
+
+    return perf->read(values);
+}
+
+void ScopedProfiler::addCounters(ProfilerZoneId zone, const PerfCounterValues &delta)
+{
+    if (zone >= maxCounterZones)
+        return;
+
+    auto &buffer = threadBuffer();
+    auto counters = buffer.zoneCounters.load(std::memory_order_acquire);
+    if (!counters) {
+        counters = new ThreadBuffer::ZoneCounters{};
+        buffer.zoneCounters.store(counters, std::memory_order_release);
+    }
+
+    auto &c = (*counters)[zone];
+    c[0].fetch_add(delta.cycles, std::memory_order_relaxed);
+    c[1].fetch_add(delta.instructions, std::memory_order_relaxed);
+    c[2].fetch_add(delta.llcMisses, std::memory_order_relaxed);
+    c[3].fetch_add(delta.branchMisses, std::memory_order_relaxed);
+}
+
+PerfCounterValues ScopedProfiler::counters(const std::string &name) const
+{
+    ProfilerZoneId id;
+    {
+        std::lock_guard<std::mutex> lock{impl->zonesMutex};
+        const auto it = impl->zoneIds.find(name);
+        if (it == impl->zoneIds.end() || it->second >= maxCounterZones)
+            return {};
+        id = it->second;
+    }
+
+    PerfCounterValues total;
+    std::lock_guard<std::mutex> lock{impl->buffersMutex};
+    for (const auto &buffer : impl->buffers) {
+        const auto counters = buffer->zoneCounters.load(std::memory_order_acquire);
+        if (!counters)
+            continue;
+
+        const auto &c = (*counters)[id];
+        total += PerfCounterValues{c[0].load(std::memory_order_relaxed), c[1].load(std::memory_order_relaxed),
+                                   c[2].load(std::memory_order_relaxed), c[3].load(std::memory_order_relaxed)};
+    }
+
+    return total;
+}
+
+void ScopedProfiler::recordGpu(ProfilerZoneId zone, uint64_t startNs, uint64_t durationNs)
+{
+    auto &buffer = threadBuffer();
+
+    const auto pos = buffer.written.load(std::memory_order_relaxed);
+    buffer.events[pos % ThreadBuffer::capacity] = ProfilerEvent{startNs, startNs + durationNs, zone, 0, buffer.threadIdx | ProfilerEvent::gpuTrack};
+    buffer.written.store(pos + 1, std::memory_order_release);
+}
+
+void ScopedProfiler::collect()
+{
+    std::vector<ThreadBuffer *> buffers;
+    {
+        std::lock_guard<std::mutex> lock{impl->buffersMutex};
+        for (auto &b : impl->buffers)
+            buffers.emplace_back(b.get());
+    }
+
+    size_t numZones;
+    {
+        std::lock_guard<std::mutex> lock{impl->zonesMutex};
+        numZones = impl->zoneNames.size();
+    }
+
+    std::lock_guard<std::mutex> lock{impl->collectMutex};
+    impl->histograms.resize(numZones);
+
+    for (auto buffer : buffers) {
+        const auto written = buffer->written.load(std::memory_order_acquire);
+
+        auto from = buffer->read;
+        if (written - from > ThreadBuffer::capacity) {
+            impl->dropped += written - from - ThreadBuffer::capacity;
+            from = written - ThreadBuffer::capacity;
+        }
+
+        for (auto pos = from; pos < written; ++pos) {
+            const auto event = buffer->events[pos % ThreadBuffer::capacity];
+
+            // the writer might have lapped us while we were copying
+            if (buffer->written.load(std::memory_order_acquire) >= pos + ThreadBuffer::capacity) {
+                ++impl->dropped;
+                continue;
+            }
+
+            if (event.zone >= impl->histograms.size())
+                impl->histograms.resize(event.zone + 1);
+            impl->histograms[event.zone].add(event.endNs - event.startNs);
+
+            if (impl->traceEnabled && impl->traceEvents.size() < impl->maxTraceEvents)
+                impl->traceEvents.emplace_back(event);
+        }
+
+        buffer->read = written;
+    }
+}
+
+std::vector<ProfilerHistogram> ScopedProfiler::histograms() const
+{
+    std::lock_guard<std::mutex> lock{impl->collectMutex};
+    return impl->histograms;
+}
+
+ProfilerHistogram ScopedProfiler::histogram(const std::string &name) const
+{
+    ProfilerZoneId id;
+    {
+        std::lock_guard<std::mutex> lock{impl->zonesMutex};
+        const auto it = impl->zoneIds.find(name);
+        if (it == impl->zoneIds.end())
+            return {};
+        id = it->second;
+    }
+
+    std::lock_guard<std::mutex> lock{impl->collectMutex};
+    return id < impl->histograms.size() ? impl->histograms[id] : ProfilerHistogram{};
+}
+
+std::string ScopedProfiler::summary() const
+{
+    const auto hists = histograms();
+
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(3);
+    s << std::left << std::setw(32) << "zone" << std::right << std::setw(10) << "count"
+      << std::setw(12) << "mean_ms" << std::setw(12) << "p50_ms" << std::setw(12) << "p95_ms"
+      << std::setw(12) << "p99_ms" << std::setw(12) << "max_ms" << "\n";
+
+    constexpr double nsToMs = 1e-6;
+    for (size_t zone = 0; zone < hists.size(); ++zone) {
+        const auto &h = hists[zone];
+        if (!h.count)
+            continue;
+
+        s << std::left << std::setw(32) << zoneName(ProfilerZoneId(zone)) << std::right << std::setw(10) << h.count
+          << std::setw(12) << h.meanNs() * nsToMs << std::setw(12) << h.percentile(0.5) * nsToMs
+          << std::setw(12) << h.percentile(0.95) * nsToMs << std::setw(12) << h.percentile(0.99) * nsToMs
+          << std::setw(12) << double(h.maxNs) * nsToMs << "\n";
+    }
+
+    return s.str();
+}
+
+bool ScopedProfiler::writeChromeTrace(const std::string &path) const
+{
+    std::ofstream f{path};
+    if (!f) {
+        TLOG(ERROR) << "Could not open " << path << " for writing";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock{impl->collectMutex};
+
+    const auto t0 = impl->traceEvents.empty() ? 0 : std::min_element(
+        impl->traceEvents.begin(), impl->traceEvents.end(),
+        [](const auto &a, const auto &b) { return a.startNs < b.startNs; }
+    )->startNs;
+
+    // complete events ("X"), timestamps in microseconds, GPU work of every thread under a separate process
+    f << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    for (size_t i = 0; i < impl->traceEvents.size(); ++i) {
+        const auto &e = impl->traceEvents[i];
+        const auto pid = e.threadIdx & ProfilerEvent::gpuTrack ? 1 : 0;
+        f << (i ? ",\n" : "") << "{\"name\":\"" << zoneName(e.zone) << "\",\"ph\":\"X\",\"pid\":" << pid
+          << ",\"tid\":" << (e.threadIdx & ~ProfilerEvent::gpuTrack)
+          << ",\"ts\":" << double(e.startNs - t0) * 1e-3 << ",\"dur\":" << double(e.endNs - e.startNs) * 1e-3
+          << ",\"args\":{\"depth\":" << e.depth << "}}";
+    }
+    f << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    return bool(f);
+}
+
+void ScopedProfiler::clear()
+{
+    {
+        std::lock_guard<std::mutex> lock{impl->buffersMutex};
+        for (auto &buffer : impl->buffers)
+            if (const auto counters = buffer->zoneCounters.load(std::memory_order_acquire))
+                for (auto &zone : *counters)
+                    for (auto &c : zone)
+                        c.store(0, std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock{impl->collectMutex};
+    impl->histograms.clear();
+    impl->traceEvents.clear();
+    impl->dropped = 0;
+}
+
+uint64_t ScopedProfiler::droppedEvents() const
+{
+    std::lock_guard<std::mutex> lock{impl->collectMutex};
+    return impl->dropped;
+}
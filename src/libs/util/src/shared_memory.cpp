@@ -0,0 +1,130 @@
+#include <thread>
+#include <climits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+#endif
+
+#include <util/tiny_logger.hpp>
+#include <util/shared_memory.hpp>
+
+
+namespace Megaverse
+{
+
+SharedMemory SharedMemory::create(const std::string &name, size_t size)
+{
+    SharedMemory shm;
+
+    shm_unlink(name.c_str());
+    const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        TLOG(ERROR) << "Could not create shared memory segment " << name;
+        return shm;
+    }
+
+    // newly created segment is zero-filled
+    if (ftruncate(fd, off_t(size)) == 0) {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr != MAP_FAILED) {
+            shm.data_ = static_cast<uint8_t *>(ptr);
+            shm.size_ = size;
+        }
+    }
+
+    close(fd);
+
+    if (!shm.data_) {
+        TLOG(ERROR) << "Could not map " << size << " bytes of shared memory " << name;
+        shm_unlink(name.c_str());
+        return shm;
+    }
+
+    shm.name_ = name;
+    shm.owner = true;
+    return shm;
+}
+
+SharedMemory SharedMemory::attach(const std::string &name)
+{
+    SharedMemory shm;
+
+    const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) {
+        TLOG(ERROR) << "Could not open shared memory segment " << name;
+        return shm;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *ptr = mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr != MAP_FAILED) {
+            shm.data_ = static_cast<uint8_t *>(ptr);
+            shm.size_ = size_t(st.st_size);
+        }
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+
+    shm.name_ = name;
+    return shm;
+}
+
+SharedMemory::~SharedMemory()
+{
+    release();
+}
+
+SharedMemory & SharedMemory::operator=(SharedMemory &&other) noexcept
+{
+    if (this != &other) {
+        release();
+
+        name_ = std::move(other.name_);
+        data_ = other.data_, size_ = other.size_, owner = other.owner;
+        other.data_ = nullptr, other.size_ = 0, other.owner = false;
+    }
+
+    return *this;
+}
+
+void SharedMemory::release()
+{
+    if (data_)
+        munmap(data_, size_);
+    if (owner)
+        shm_unlink(name_.c_str());
+
+    data_ = nullptr, size_ = 0, owner = false;
+}
+
+void futexWait(std::atomic<uint32_t> &word, uint32_t expected)
+{
+#if defined(__linux__)
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32-bit word");
+
+    // not FUTEX_PRIVATE, the word can be shared with other processes
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+#else
+    if (word.load() == expected)
+        std::this_thread::yield();
+#endif
+}
+
+void futexWakeAll(std::atomic<uint32_t> &word)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+}
@@ -0,0 +1,133 @@
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+#include <util/simd_kernels.hpp>
+
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+// scalar variants are the reference the others are tested against
+void subtractBytesScalar(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = uint8_t(a[i] - b[i]);
+}
+
+void addBytesScalar(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = uint8_t(a[i] + b[i]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// compiled for the target regardless of the build flags, only ever called after the CPU check
+__attribute__((target("avx2"))) void subtractBytesAvx2(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto va = _mm256_loadu_si256((const __m256i *)(a + i)), vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_sub_epi8(va, vb));
+    }
+    subtractBytesScalar(a + i, b + i, out + i, n - i);
+}
+
+__attribute__((target("avx2"))) void addBytesAvx2(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto va = _mm256_loadu_si256((const __m256i *)(a + i)), vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_add_epi8(va, vb));
+    }
+    addBytesScalar(a + i, b + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void subtractBytesAvx512(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const auto va = _mm512_loadu_si512(a + i), vb = _mm512_loadu_si512(b + i);
+        _mm512_storeu_si512(out + i, _mm512_sub_epi8(va, vb));
+    }
+    subtractBytesScalar(a + i, b + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void addBytesAvx512(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const auto va = _mm512_loadu_si512(a + i), vb = _mm512_loadu_si512(b + i);
+        _mm512_storeu_si512(out + i, _mm512_add_epi8(va, vb));
+    }
+    addBytesScalar(a + i, b + i, out + i, n - i);
+}
+
+#elif defined(__ARM_NEON)
+
+void subtractBytesNeon(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        vst1q_u8(out + i, vsubq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    subtractBytesScalar(a + i, b + i, out + i, n - i);
+}
+
+void addBytesNeon(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        vst1q_u8(out + i, vaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    addBytesScalar(a + i, b + i, out + i, n - i);
+}
+
+#endif
+
+}
+
+
+const SimdDispatch<ByteKernel> & Megaverse::subtractBytesDispatch()
+{
+    static const SimdDispatch<ByteKernel> dispatch{
+        {SimdLevel::Scalar, subtractBytesScalar},
+#if defined(__x86_64__) || defined(__i386__)
+        {SimdLevel::Avx2, subtractBytesAvx2},
+        {SimdLevel::Avx512, subtractBytesAvx512},
+#elif defined(__ARM_NEON)
+        {SimdLevel::Neon, subtractBytesNeon},
+#endif
+    };
+
+    return dispatch;
+}
+
+const SimdDispatch<ByteKernel> & Megaverse::addBytesDispatch()
+{
+    static const SimdDispatch<ByteKernel> dispatch{
+        {SimdLevel::Scalar, addBytesScalar},
+#if defined(__x86_64__) || defined(__i386__)
+        {SimdLevel::Avx2, addBytesAvx2},
+        {SimdLevel::Avx512, addBytesAvx512},
+#elif defined(__ARM_NEON)
+        {SimdLevel::Neon, addBytesNeon},
+#endif
+    };
+
+    return dispatch;
+}
+
+void Megaverse::subtractBytes(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    subtractBytesDispatch()(a, b, out, n);
+}
+
+void Megaverse::addBytes(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n)
+{
+    addBytesDispatch()(a, b, out, n);
+}
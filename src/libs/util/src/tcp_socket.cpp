@@ -0,0 +1,195 @@
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <util/tiny_logger.hpp>
+#include <util/tcp_socket.hpp>
+
+
+namespace Megaverse
+{
+
+namespace
+{
+
+void setNoDelay(int fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+}
+
+TcpSocket TcpSocket::listen(int port, int backlog)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        TLOG(ERROR) << "Could not create a socket: " << strerror(errno);
+        return TcpSocket{};
+    }
+
+    // a restarted server can take the port over right away
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(uint16_t(port));
+
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(fd, backlog) != 0) {
+        TLOG(ERROR) << "Could not listen on port " << port << ": " << strerror(errno);
+        ::close(fd);
+        return TcpSocket{};
+    }
+
+    return TcpSocket{fd};
+}
+
+TcpSocket TcpSocket::connect(const std::string &host, int port)
+{
+    addrinfo hints{}, *addresses = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    const auto service = std::to_string(port);
+    if (const auto err = getaddrinfo(host.empty() ? "localhost" : host.c_str(), service.c_str(), &hints, &addresses)) {
+        TLOG(ERROR) << "Could not resolve " << host << ": " << gai_strerror(err);
+        return TcpSocket{};
+    }
+
+    int fd = -1;
+    for (auto *a = addresses; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(addresses);
+
+    if (fd < 0) {
+        TLOG(ERROR) << "Could not connect to " << host << ":" << port;
+        return TcpSocket{};
+    }
+
+    setNoDelay(fd);
+    return TcpSocket{fd};
+}
+
+TcpSocket TcpSocket::accept(int timeoutMs) const
+{
+    if (!waitReadable(timeoutMs))
+        return TcpSocket{};
+
+    const int client = ::accept(fd, nullptr, nullptr);
+    if (client < 0)
+        return TcpSocket{};
+
+    setNoDelay(client);
+    return TcpSocket{client};
+}
+
+TcpSocket::~TcpSocket()
+{
+    close();
+}
+
+TcpSocket & TcpSocket::operator=(TcpSocket &&other) noexcept
+{
+    if (this != &other) {
+        close();
+        fd = std::exchange(other.fd, -1);
+    }
+
+    return *this;
+}
+
+int TcpSocket::localPort() const
+{
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+        return -1;
+
+    return ntohs(addr.sin_port);
+}
+
+bool TcpSocket::sendAll(const void *data, size_t size)
+{
+    auto ptr = static_cast<const uint8_t *>(data);
+    while (size > 0 && fd >= 0) {
+        // MSG_NOSIGNAL: a closed peer is an error here, not a SIGPIPE that kills the process
+        const auto n = ::send(fd, ptr, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            close();
+            return false;
+        }
+
+        ptr += n, size -= size_t(n);
+    }
+
+    return fd >= 0;
+}
+
+bool TcpSocket::recvAll(void *data, size_t size)
+{
+    auto ptr = static_cast<uint8_t *>(data);
+    while (size > 0 && fd >= 0) {
+        const auto n = ::recv(fd, ptr, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            close();
+            return false;
+        }
+
+        ptr += n, size -= size_t(n);
+    }
+
+    return fd >= 0;
+}
+
+bool TcpSocket::waitReadable(int timeoutMs) const
+{
+    pollfd p{fd, POLLIN, 0};
+    int res;
+    while ((res = poll(&p, 1, timeoutMs)) < 0 && errno == EINTR) {}
+
+    return res > 0;
+}
+
+void TcpSocket::close()
+{
+    if (fd >= 0)
+        ::close(std::exchange(fd, -1));
+}
+
+bool parseHostPort(const std::string &address, std::string &host, int &port)
+{
+    const auto colon = address.rfind(':');
+    const auto portStr = colon == std::string::npos ? address : address.substr(colon + 1);
+
+    char *end = nullptr;
+    const auto value = strtol(portStr.c_str(), &end, 10);
+    if (portStr.empty() || *end != '\0' || value < 0 || value > 65535)
+        return false;
+
+    host = colon == std::string::npos ? std::string{} : address.substr(0, colon);
+    port = int(value);
+    return true;
+}
+
+}
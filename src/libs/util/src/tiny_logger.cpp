@@ -1,7 +1,15 @@
 #include <mutex>
+#include <atomic>
+#include <algorithm>
 #include <thread>
+#include <vector>
 #include <cstring>
 #include <iomanip>
+#include <condition_variable>
+
+#if defined(__linux__) || defined(__APPLE__)
+    #include <pthread.h>
+#endif
 
 #include <util/tiny_logger.hpp>
 #include <util/filesystem_utils.hpp>
@@ -17,7 +25,7 @@ namespace
 {
 
 /// Everything with level higher than logLevel will be discarded.
-LogLevel logLevel = DEBUG;
+std::atomic<int> logLevel{DEBUG};
 
 
 const char *levelToStr(LogLevel level)
@@ -46,20 +54,255 @@ const char *constBasename(const char *filepath)
     return basename ? basename + 1 : filepath;
 }
 
-void printTime(std::ostream &stream)
+void printTime(std::ostream &stream, int64_t timestampUs)
 {
-    char timeStr[1 << 6];
-    const system_clock::time_point now = system_clock::now();
-    const time_t timestamp = system_clock::to_time_t(now);
-    strftime(timeStr, sizeof(timeStr), "%m-%d %T", std::localtime(&timestamp));
+    const auto timePoint = system_clock::time_point{duration_cast<system_clock::duration>(microseconds{timestampUs})};
+    const time_t timestamp = system_clock::to_time_t(timePoint);
+
+    std::tm localTime{};
+    localtime_r(&timestamp, &localTime);
 
-    const auto sinceEpoch = now.time_since_epoch();
-    const system_clock::duration fraction = sinceEpoch - duration_cast<seconds>(sinceEpoch);
-    const long long ms = duration_cast<milliseconds>(fraction).count();
+    char timeStr[1 << 6];
+    strftime(timeStr, sizeof(timeStr), "%m-%d %T", &localTime);
 
+    const long long ms = (timestampUs / 1000) % 1000;
     stream << timeStr << '.' << std::setw(3) << std::setfill('0') << ms << ' ';
 }
 
+
+struct LogRecord
+{
+    std::string text;
+    std::ostream *outStream = nullptr;
+    LogLevel level = INFO;
+    const char *file = nullptr, *func = nullptr;
+    int line = 0;
+    int64_t timestampUs = 0;
+};
+
+void writeRecord(const LogRecord &r)
+{
+    std::ostringstream header;
+    header << "[";
+    printTime(header, r.timestampUs);
+
+    header << levelToStr(r.level) << ' ' << constBasename(r.file) << ':' << r.line;
+    if (r.func) {
+        header << ' ' << r.func;
+        if (!strchr(r.func, '('))
+            header << "()";
+    }
+    header << "] ";
+
+    *r.outStream << header.str() << r.text << '\n';
+}
+
+/**
+ * Single-producer single-consumer ring, the producer is the owning thread, the consumer is whoever holds
+ * the drain mutex (the flusher thread or flushLogs()).
+ */
+struct LogQueue
+{
+    static constexpr uint64_t capacity = 1 << 12;
+
+    std::vector<LogRecord> records = std::vector<LogRecord>(capacity);
+    std::atomic<uint64_t> head{0}, tail{0};
+
+    bool tryPush(LogRecord &&r)
+    {
+        const auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) >= capacity)
+            return false;
+
+        records[t % capacity] = std::move(r);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<typename F>
+    void drain(F &&consume)
+    {
+        const auto t = tail.load(std::memory_order_acquire);
+        auto h = head.load(std::memory_order_relaxed);
+
+        for (; h < t; ++h) {
+            auto &r = records[h % capacity];
+            consume(r);
+            r.text = std::string{};  // release the memory now, the slot can stay unused for a long time
+        }
+
+        head.store(h, std::memory_order_release);
+    }
+};
+
+class LogBackend
+{
+public:
+    static LogBackend & instance()
+    {
+        // never destroyed: messages can be logged from static destructors and from threads that outlive main()
+        static auto *backend = new LogBackend;
+        return *backend;
+    }
+
+    void push(LogRecord &&r)
+    {
+        if (!running.load(std::memory_order_acquire)) {
+            // before the start, after the shutdown and in forked children until the flusher is restarted
+            start();
+
+            if (!running.load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lock{drainMutex};
+                drainAll();
+                writeRecord(r);
+                return;
+            }
+        }
+
+        auto &queue = threadQueue();
+        if (queue.tryPush(std::move(r)))
+            return;
+
+        if (r.level >= INFO) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        // warnings and errors are never dropped: make room by draining on this thread
+        while (!queue.tryPush(std::move(r))) {
+            std::lock_guard<std::mutex> lock{drainMutex};
+            drainAll();
+        }
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock{drainMutex};
+        drainAll();
+    }
+
+    uint64_t numDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    LogBackend()
+    {
+        std::atexit([] { LogBackend::instance().stop(); });
+
+#if defined(__linux__) || defined(__APPLE__)
+        // Python workers are often forked: the child has no flusher thread and may inherit a locked mutex
+        pthread_atfork(
+            [] { LogBackend::instance().drainMutex.lock(); },
+            [] { LogBackend::instance().drainMutex.unlock(); },
+            [] {
+                auto &b = LogBackend::instance();
+                b.drainMutex.unlock();
+                b.flusher = nullptr;  // the thread does not exist in the child, the object is leaked on purpose
+                b.running = false;
+                b.stopped = false;
+            }
+        );
+#endif
+    }
+
+    void start()
+    {
+        std::lock_guard<std::mutex> lock{startMutex};
+        if (running || stopped)
+            return;
+
+        stopRequested = false;
+        flusher = new std::thread{[this] { flusherLoop(); }};
+        running.store(true, std::memory_order_release);
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock{startMutex};
+            stopped = true;
+
+            if (!running)
+                return;
+
+            running.store(false, std::memory_order_release);
+            stopRequested = true;
+        }
+
+        wakeup.notify_one();
+        flusher->join();
+        delete flusher;
+        flusher = nullptr;
+
+        flush();
+    }
+
+    void flusherLoop()
+    {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock{wakeupMutex};
+                wakeup.wait_for(lock, 5ms, [this] { return stopRequested.load(); });
+            }
+
+            flush();
+
+            if (stopRequested)
+                break;
+        }
+    }
+
+    LogQueue & threadQueue()
+    {
+        // queues are never freed, a thread may exit before its messages are written
+        thread_local LogQueue *queue = nullptr;
+
+        if (!queue) {
+            std::lock_guard<std::mutex> lock{queuesMutex};
+            queues.emplace_back(new LogQueue);
+            queue = queues.back();
+        }
+
+        return *queue;
+    }
+
+    /// Call with drainMutex held.
+    void drainAll()
+    {
+        std::vector<LogQueue *> currQueues;
+        {
+            std::lock_guard<std::mutex> lock{queuesMutex};
+            currQueues = queues;
+        }
+
+        std::vector<std::ostream *> streams;
+        for (auto q : currQueues) {
+            q->drain([&streams](const LogRecord &r) {
+                writeRecord(r);
+                if (std::find(streams.begin(), streams.end(), r.outStream) == streams.end())
+                    streams.emplace_back(r.outStream);
+            });
+        }
+
+        for (auto s : streams)
+            s->flush();
+    }
+
+private:
+    std::mutex queuesMutex;
+    std::vector<LogQueue *> queues;
+
+    std::mutex drainMutex;
+    std::atomic<uint64_t> dropped{0};
+
+    std::mutex startMutex;
+    std::thread *flusher = nullptr;
+    std::atomic<bool> running{false}, stopRequested{false};
+    bool stopped = false;
+
+    std::mutex wakeupMutex;
+    std::condition_variable wakeup;
+};
+
 }
 
 
@@ -68,54 +311,46 @@ namespace Megaverse
 
 void setLogLevel(LogLevel level)
 {
-    logLevel = level;
+    logLevel.store(level, std::memory_order_relaxed);
+}
+
+bool logLevelEnabled(LogLevel level)
+{
+    return level <= logLevel.load(std::memory_order_relaxed);
+}
+
+void flushLogs()
+{
+    LogBackend::instance().flush();
+}
+
+uint64_t numDroppedLogMessages()
+{
+    return LogBackend::instance().numDropped();
 }
 
 LogMessage::LogMessage(LogLevel lvl, const char *file, int line, const char *func, std::ostream *outStream)
-    : stream{nullptr}
-    , outStream{outStream}
+    : outStream{outStream}
     , level{lvl}
+    , file{file}
+    , func{func}
+    , line{line}
+    , timestampUs{duration_cast<microseconds>(system_clock::now().time_since_epoch()).count()}
+    , enabled{logLevelEnabled(lvl)}
 {
-    if (level > logLevel) {
-        static std::shared_ptr<std::ostringstream> nullStream = std::make_shared<NullStream>();
-        stream = nullStream;
-    } else {
-        stream = std::make_shared<std::ostringstream>();
-
-        *stream << "[";
-        printTime(*stream);
-
-        *stream << levelToStr(level) << ' ' << constBasename(file) << ':' << line;
-        if (func) {
-            *stream << ' ' << func;
-            if (!strchr(func, '('))
-                *stream << "()";
-        }
-        *stream << "] ";
-    }
 }
 
 LogMessage::~LogMessage()
 {
-    if (stream)
-        *stream << '\n';
-
-    if (level <= logLevel) {
-        static std::mutex mutex;
-        std::lock_guard<std::mutex> lock(mutex);
-        *outStream << stream->str();
-    }
+    if (enabled)
+        LogBackend::instance().push(LogRecord{stream.str(), outStream, level, file, func, line, timestampUs});
 
     if (level == FATAL) {
+        flushLogs();
         *outStream << "\nExiting due to FATAL error, see the logs for details...\n\n\n";
         std::this_thread::sleep_for(2s);
         exit(-1);
     }
 }
 
-std::ostringstream &LogMessage::operator()()
-{
-    return *stream;
 }
-
-}
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include <algorithm>
+
+#include <util/worker_pool.hpp>
+
+
+using namespace Megaverse;
+
+
+WorkerPool::WorkerPool(int numThreads)
+{
+    for (int i = 0; i < numThreads; ++i)
+        threads.emplace_back([this] { workerLoop(); });
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard lock{mutex};
+        stop = true;
+    }
+    workAvailable.notify_all();
+
+    for (auto &t : threads)
+        t.join();
+}
+
+void WorkerPool::parallelFor(int n, int grainSize, const std::function<void(int, int)> &func)
+{
+    grainSize = std::max(grainSize, 1);
+    if (n <= 0)
+        return;
+
+    std::unique_lock submit{submitMutex, std::try_to_lock};
+    if (threads.empty() || n <= grainSize || !submit.owns_lock()) {
+        inlineJobs.fetch_add(1, std::memory_order_relaxed);
+        func(0, n);
+        return;
+    }
+
+    {
+        std::lock_guard lock{mutex};
+        job = &func;
+        jobSize = n, grain = grainSize, numChunks = (n + grainSize - 1) / grainSize;
+        nextChunk.store(0, std::memory_order_relaxed);
+        numFinished = 0;
+        ++generation;
+    }
+    workAvailable.notify_all();
+
+    runChunks();
+
+    // every worker takes part in every job, so none of them can still be looking at this one afterwards
+    std::unique_lock lock{mutex};
+    workDone.wait(lock, [this] { return numFinished == numThreads(); });
+    job = nullptr;
+
+    parallelJobs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WorkerPool::runChunks()
+{
+    for (int chunk = nextChunk.fetch_add(1); chunk < numChunks; chunk = nextChunk.fetch_add(1)) {
+        const auto begin = chunk * grain;
+        (*job)(begin, std::min(begin + grain, jobSize));
+    }
+}
+
+void WorkerPool::workerLoop()
+{
+    uint64_t seen = 0;
+
+    std::unique_lock lock{mutex};
+    while (true) {
+        workAvailable.wait(lock, [&] { return stop || generation != seen; });
+        if (stop)
+            return;
+
+        seen = generation;
+        lock.unlock();
+        runChunks();
+        lock.lock();
+
+        if (++numFinished == numThreads())
+            workDone.notify_one();
+    }
+}
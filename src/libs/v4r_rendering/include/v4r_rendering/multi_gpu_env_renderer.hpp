@@ -0,0 +1,81 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <util/host_buffer.hpp>
+
+#include <env/env_renderer.hpp>
+
+#include <v4r_rendering/v4r_env_renderer.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Shards envs between several GPUs, one V4REnvRenderer (and one v4r::BatchRenderer) per device.
+ * Env i is rendered on gpuIds[i % numGpus]. All devices render concurrently, the observations are then gathered
+ * into a single host buffer with the usual layout (env-major, then agent), so this is a drop-in replacement for
+ * a single V4REnvRenderer.
+ */
+class MultiGpuEnvRenderer : public EnvRenderer
+{
+public:
+    explicit MultiGpuEnvRenderer(Envs &envs, int w, int h, const std::vector<int> &gpuIds, const ObservationOptions &obsOptions = {});
+
+    ~MultiGpuEnvRenderer() override;
+
+    void reset(Env &env, int envIdx) override;
+
+    void prepareReset(Env &env, int envIdx) override;
+
+    void finishReset(Env &env, int envIdx) override;
+
+    void preDraw(Env &env, int envIdx) override;
+
+    void draw(Envs &envs) override;
+
+    void drawAsync(Envs &envs) override;
+
+    void waitForFrame() override;
+
+    const uint8_t * getObservation(int envIdx, int agentIdx) const override;
+
+    const uint8_t * getObservation(int envIdx, int agentIdx, ObservationChannel channel) const override;
+
+    const uint8_t * getObservationsBatch() const override { return frames.data(); }
+
+    const uint8_t * getObservationsBatch(ObservationChannel channel) const override;
+
+    Overview * getOverview() override;
+
+    /// Sum over the device renderers plus the gathered buffers.
+    void memoryReport(MemoryReport &report) const override;
+
+private:
+    V4REnvRenderer & shard(int envIdx) { return *renderers[size_t(envIdx) % renderers.size()]; }
+
+    int localIdx(int envIdx) const { return envIdx / int(renderers.size()); }
+
+    /**
+     * Copy the observations (and depth) of every env from its device renderer into the gathered buffers.
+     */
+    void gather();
+
+private:
+    std::vector<std::unique_ptr<V4REnvRenderer>> renderers;
+
+    int numEnvs;
+
+    // index of the first agent of each env in the gathered buffers, plus the total number of agents at the end
+    std::vector<int> agentOffsets;
+    size_t bytesPerFrame, depthBytesPerFrame;
+    bool withDepth;
+
+    HostBuffer frames;
+    std::vector<uint8_t> depthFrames;
+    bool frameInFlight = false;
+};
+
+}
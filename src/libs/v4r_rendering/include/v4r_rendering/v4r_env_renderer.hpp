@@ -14,29 +14,90 @@ class V4REnvRenderer : public EnvRenderer
 {
 public:
     /**
-     * @param previousRenderer if renderers are chained (i.e. multiple renderers render the same scene) we need the
-     * pointer to the previous renderer in the chain to provide the list of "dirty" drawables whose absolute
-     * transformations we need to query from the scene graph and update.
+     * @param previousRenderer if renderers are chained (i.e. multiple renderers render the same scene). Every
+     * renderer in the chain picks up the moved objects from a TransformCache of its own.
+     * @param numCommandStreams split the envs into this many shards with a v4r::CommandStream each, so the shards
+     * can be submitted by the simulation threads (see submitShard()). Outputs of the streams are gathered into one
+     * batch on the host, so with more than one stream observations are not exported in device memory.
      */
-    explicit V4REnvRenderer(Envs &envs, int w, int h, V4REnvRenderer *previousRenderer, bool withOverview);
+    explicit V4REnvRenderer(
+        Envs &envs, int w, int h, V4REnvRenderer *previousRenderer, bool withOverview, int gpuId = 0,
+        const ObservationOptions &obsOptions = {}, int numCommandStreams = 1
+    );
+
+    /**
+     * Render only a subset of envs (e.g. a shard of a MultiGpuEnvRenderer) on the given GPU.
+     * Env indices passed to the other methods are indices in this subset.
+     */
+    explicit V4REnvRenderer(
+        const std::vector<Env *> &envs, int w, int h, bool withOverview, int gpuId, const ObservationOptions &obsOptions = {},
+        int numCommandStreams = 1
+    );
 
     ~V4REnvRenderer() override;
 
     void reset(Env &env, int envIdx) override;
 
+    void prepareReset(Env &env, int envIdx) override;
+
+    void finishReset(Env &env, int envIdx) override;
+
     void preDraw(Env &env, int envIndex) override;
 
     void draw(Envs &envs) override;
 
+    void drawAsync(Envs &envs) override;
+
+    void waitForFrame() override;
+
+    int numShards() const override;
+
+    int shardOf(int envIdx) const override;
+
+    void submitShard(int shardIdx) override;
+
+    /**
+     * V4R renders the whole batch into fixed output slots, so masked out agents are still rendered on the GPU, only
+     * the host side of their frames (HUD, conversion, depth, pipelined copies) is skipped.
+     */
+    void setRenderMask(const std::vector<uint8_t> &agentMask) override;
+
+    /**
+     * Experimental: column-major view matrices of all agents, 16 floats each in the order of the per-agent buffers,
+     * used by preDraw() instead of the agent cameras (see BatchedKinematics::getCameraViews()). The buffer must stay
+     * valid while it is set, nullptr goes back to the cameras.
+     */
+    void setCameraViews(const float *views);
+
     const uint8_t * getObservation(int envIdx, int agentIdx) const override;
 
+    const uint8_t * getObservation(int envIdx, int agentIdx, ObservationChannel channel) const override;
+
+    const uint8_t * getObservationsBatch() const override;
+
+    const uint8_t * getObservationsBatch(ObservationChannel channel) const override;
+
+    const uint8_t * getObservationsBatchDevice() const override;
+
+    bool setDeviceFrameStack(int numFrames) override;
+
+    const uint8_t * getFrameStackDevice() const override;
+
     std::vector<int> getDirtyDrawables(int envIdx) const;
 
     Overview * getOverview() override;
 
+    void memoryReport(MemoryReport &report) const override;
+
 private:
     struct Impl;
     std::unique_ptr<Impl> pimpl;
 };
 
+/**
+ * Page-lock HostMemoryPolicy::Pinned buffers with cudaHostRegister(), see setHostMemoryPinning().
+ * Done by the Vulkan renderers, call it before creating other renderers with pinned observations.
+ */
+void installCudaHostPinning();
+
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include <cstring>
+
+#include <util/tiny_logger.hpp>
+
+#include <v4r_rendering/multi_gpu_env_renderer.hpp>
+
+
+using namespace Megaverse;
+
+
+MultiGpuEnvRenderer::MultiGpuEnvRenderer(
+    Envs &envs, int w, int h, const std::vector<int> &gpuIds, const ObservationOptions &obsOptions
+)
+: numEnvs{int(envs.size())}
+, bytesPerFrame{obsOptions.bytesPerFrame(w, h)}
+, depthBytesPerFrame{obsOptions.bytesPerFrame(ObservationChannel::Depth, w, h)}
+, withDepth{obsOptions.depth}
+{
+    TCHECK(!gpuIds.empty());
+
+    agentOffsets.push_back(0);
+    for (const auto &e : envs)
+        agentOffsets.push_back(agentOffsets.back() + e->getNumAgents());
+
+    // no point in creating renderers for devices that don't get any envs
+    const auto numShards = std::min(gpuIds.size(), envs.size());
+
+    // frames of the devices are only gathered, the batch the learner copies from is the one to pin
+    auto shardOptions = obsOptions;
+    if (shardOptions.hostMemory == HostMemoryPolicy::Pinned)
+        shardOptions.hostMemory = HostMemoryPolicy::HugePages;
+
+    for (size_t shardIdx = 0; shardIdx < numShards; ++shardIdx) {
+        std::vector<Env *> shardEnvs;
+        for (size_t envIdx = shardIdx; envIdx < envs.size(); envIdx += numShards)
+            shardEnvs.emplace_back(envs[envIdx].get());
+
+        TLOG(INFO) << "Rendering " << shardEnvs.size() << " envs on GPU " << gpuIds[shardIdx];
+        renderers.emplace_back(std::make_unique<V4REnvRenderer>(shardEnvs, w, h, false, gpuIds[shardIdx], shardOptions));
+    }
+
+    const auto numAgentsTotal = size_t(agentOffsets.back());
+    frames = HostBuffer{numAgentsTotal * bytesPerFrame, obsOptions.hostMemory};
+    if (withDepth)
+        depthFrames.resize(numAgentsTotal * depthBytesPerFrame);
+}
+
+MultiGpuEnvRenderer::~MultiGpuEnvRenderer() = default;
+
+void MultiGpuEnvRenderer::reset(Env &env, int envIdx)
+{
+    shard(envIdx).reset(env, localIdx(envIdx));
+}
+
+void MultiGpuEnvRenderer::prepareReset(Env &env, int envIdx)
+{
+    shard(envIdx).prepareReset(env, localIdx(envIdx));
+}
+
+void MultiGpuEnvRenderer::finishReset(Env &env, int envIdx)
+{
+    shard(envIdx).finishReset(env, localIdx(envIdx));
+}
+
+void MultiGpuEnvRenderer::preDraw(Env &env, int envIdx)
+{
+    shard(envIdx).preDraw(env, localIdx(envIdx));
+}
+
+void MultiGpuEnvRenderer::draw(Envs &envs)
+{
+    // submit to all devices first so they render concurrently
+    drawAsync(envs);
+    waitForFrame();
+}
+
+void MultiGpuEnvRenderer::drawAsync(Envs &envs)
+{
+    waitForFrame();
+
+    for (auto &r : renderers)
+        r->drawAsync(envs);
+
+    frameInFlight = true;
+}
+
+void MultiGpuEnvRenderer::waitForFrame()
+{
+    if (!frameInFlight)
+        return;
+
+    for (auto &r : renderers)
+        r->waitForFrame();
+
+    frameInFlight = false;
+    gather();
+}
+
+void MultiGpuEnvRenderer::gather()
+{
+    // agents of one env are contiguous in the output of its device renderer
+    for (int envIdx = 0; envIdx < numEnvs; ++envIdx) {
+        const auto numAgents = size_t(agentOffsets[envIdx + 1] - agentOffsets[envIdx]);
+        memcpy(frames.data() + size_t(agentOffsets[envIdx]) * bytesPerFrame, shard(envIdx).getObservation(localIdx(envIdx), 0), numAgents * bytesPerFrame);
+    }
+
+    if (!withDepth)
+        return;
+
+    for (int envIdx = 0; envIdx < numEnvs; ++envIdx) {
+        const auto numAgents = size_t(agentOffsets[envIdx + 1] - agentOffsets[envIdx]);
+        const auto src = shard(envIdx).getObservation(localIdx(envIdx), 0, ObservationChannel::Depth);
+        memcpy(depthFrames.data() + size_t(agentOffsets[envIdx]) * depthBytesPerFrame, src, numAgents * depthBytesPerFrame);
+    }
+}
+
+const uint8_t * MultiGpuEnvRenderer::getObservation(int envIdx, int agentIdx) const
+{
+    return frames.data() + size_t(agentOffsets[envIdx] + agentIdx) * bytesPerFrame;
+}
+
+const uint8_t * MultiGpuEnvRenderer::getObservation(int envIdx, int agentIdx, ObservationChannel channel) const
+{
+    if (channel == ObservationChannel::Color)
+        return getObservation(envIdx, agentIdx);
+
+    const auto batch = getObservationsBatch(channel);
+    if (!batch)
+        return nullptr;
+
+    return batch + size_t(agentOffsets[envIdx] + agentIdx) * depthBytesPerFrame;
+}
+
+const uint8_t * MultiGpuEnvRenderer::getObservationsBatch(ObservationChannel channel) const
+{
+    switch (channel) {
+        case ObservationChannel::Depth: return withDepth ? depthFrames.data() : nullptr;
+        case ObservationChannel::Segmentation: return nullptr;
+        default: return getObservationsBatch();
+    }
+}
+
+Overview * MultiGpuEnvRenderer::getOverview()
+{
+    return renderers.front()->getOverview();
+}
+
+void MultiGpuEnvRenderer::memoryReport(MemoryReport &report) const
+{
+    for (const auto &r : renderers)
+        r->memoryReport(report);
+
+    report.add("render.observations", frames.size() + vectorBytes(depthFrames));
+}
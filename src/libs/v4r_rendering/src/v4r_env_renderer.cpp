@@ -1,9 +1,14 @@
 #include <memory>
 #include <vector>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
 
 #include <glm/ext.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <Corrade/Containers/ArrayView.h>
+
 #include <Magnum/Trade/MeshData.h>
 #include <Magnum/SceneGraph/Camera.h>
 #include <Magnum/SceneGraph/Drawable.h>
@@ -16,8 +21,12 @@
 #include <v4r/debug.hpp>
 
 #include <util/tiny_logger.hpp>
+#include <util/host_buffer.hpp>
+#include <util/scoped_profiler.hpp>
 
+#include <rendering/culling.hpp>
 #include <rendering/render_utils.hpp>
+#include <rendering/transform_cache.hpp>
 
 #include <v4r_rendering/v4r_env_renderer.hpp>
 
@@ -29,50 +38,86 @@ using namespace Magnum::Math::Literals;
 using namespace Megaverse;
 
 
+/**
+ * Per-env instance transformations, read from the transform cache of the env. Dirty drawables are the ones the
+ * cache reported as moved in preDraw() (or all of them after a reset).
+ */
+struct InstanceTransforms
+{
+    TransformCache cache;
+    std::vector<int> dirty;
+};
+
+
+/**
+ * One drawable per scene object per env. v4r has no multi-view rendering, so each agent of the env has its own
+ * v4r::Environment with a copy of the instance, but the transformation is computed only once for all of them.
+ */
 class Megaverse::V4RDrawable : public SceneGraph::Drawable3D
 {
 public:
     explicit V4RDrawable(
             SceneGraph::AbstractObject3D &parentObject,
-            v4r::Environment &renderEnv,
-            uint32_t instanceID,
+            v4r::Environment *renderEnvs,
+            std::vector<uint32_t> instanceIDs,
+            InstanceTransforms &staging,
+            int drawableIdx,
             SceneGraph::DrawableGroup3D &drawables)
         : SceneGraph::Drawable3D{parentObject, &drawables},
-          _renderEnv(renderEnv),
-          _instanceID(instanceID)
-    {}
+          _renderEnvs(renderEnvs),
+          _instanceIDs(std::move(instanceIDs)),
+          _staging(staging),
+          _drawableIdx(drawableIdx)
+    {
+    }
 
 private:
     void draw(const Matrix4 &transformation, SceneGraph::Camera3D &) override
     {
-        _renderEnv.updateInstanceTransform(_instanceID, glm::make_mat4(transformation.data()));
+        const auto t = glm::make_mat4(transformation.data());
+        for (int view = 0; view < int(_instanceIDs.size()); ++view)
+            setTransformation(view, t);
     }
 
 public:
-    void updateAbsoluteTransformation()
+    glm::mat4 absoluteTransformation() const
     {
-        _renderEnv.updateInstanceTransform(_instanceID, glm::make_mat4(object().absoluteTransformationMatrix().data()));
+        return glm::make_mat4(_staging.cache.transformation(_drawableIdx).data());
     }
 
-private:
-    v4r::Environment &_renderEnv;
-    uint32_t _instanceID;
-};
+    void setTransformation(int view, const glm::mat4 &t)
+    {
+        _renderEnvs[view].updateInstanceTransform(_instanceIDs[view], t);
+    }
 
+    /**
+     * v4r instances can't change their mesh, so switching the level of detail replaces the instance.
+     */
+    void setInstanceID(int view, uint32_t instanceID) { _instanceIDs[view] = instanceID; }
 
-struct ColorCompare
-{
-    bool operator()(const Magnum::Color3 &c1, const Magnum::Color3 &c2) const
+    /**
+     * Culled instances are collapsed to a point, so they produce no fragments.
+     */
+    void hide(int view)
     {
-        return c1.r() == c2.r() ? c1.g() == c2.g() ? c1.b() < c2.b() : c1.g() < c2.g() : c1.r() < c2.r();
+        setTransformation(view, glm::mat4(0.f));
     }
+
+private:
+    v4r::Environment *_renderEnvs;
+    std::vector<uint32_t> _instanceIDs;
+
+    InstanceTransforms &_staging;
+    int _drawableIdx;
 };
 
 
 struct V4REnvRenderer::Impl
 {
 public:
-    explicit Impl(Envs &envs, int w, int h, V4REnvRenderer *previousRenderer, bool withOverview);
+    explicit Impl(const std::vector<Env *> &envs, int w, int h, V4REnvRenderer *previousRenderer, bool withOverview, int gpuId,
+        const ObservationOptions &obsOptions, int numCommandStreams
+    );
 
     ~Impl();
 
@@ -82,25 +127,160 @@ public:
      */
     void reset(Env &env, int envIdx);
 
+    /**
+     * Collects the instances that need to be added to the render envs. Only touches per-env data, so it is safe
+     * to call this concurrently for different envs.
+     */
+    void prepareReset(Env &env, int envIdx);
+
+    /**
+     * Recreates the render environments (requires the command stream, so has to be called on the main thread).
+     */
+    void finishReset(Env &env, int envIdx);
+
     void preDraw(Env &env, int envIdx);
     void draw(Envs &envs);
 
+    void drawAsync(Envs &envs);
+    void waitForFrame();
+
+    void setRenderMask(const std::vector<uint8_t> &agentMask) { renderMask = agentMask; }
+
+    void setCameraViews(const float *views) { cameraViews = views; }
+
+    int numShards() const { return int(shards.size()); }
+
+    int shardOf(int envIdx) const { return envShards[envIdx]; }
+
+    /**
+     * Called from the worker threads, concurrently for different shards. Each command stream is only used by one
+     * thread at a time: the worker that submits the shard, or the main thread in draw().
+     */
+    void submitShard(int shardIdx);
+
+    /// Submit the shards that were not submitted by the workers.
+    void submitRemainingShards();
+
+    /// Submit the render envs of the shard, with the CPU time of the call and the submission time for finishShards().
+    static void renderShard(Shard &shard);
+
+    /// Wait for the streams and gather their outputs into one batch.
+    void finishShards();
+
+    /// Color output of the finished frame, one batch for all render envs.
+    const uint8_t * frameRGB() const
+    {
+        return shards.size() == 1 ? shards.front().stream.getRGB() : gatheredFrames.data();
+    }
+
+    const float * frameDepth()
+    {
+        return shards.size() == 1 ? shards.front().stream.getDepth() : gatheredDepth.data();
+    }
+
+    /**
+     * Calls f(first, count) for every run of consecutive render envs of the frame that are not masked out.
+     */
+    template<typename F>
+    void forEachRenderedRun(F &&f) const
+    {
+        const auto numRenderEnvs = renderEnvs.size();
+        if (frameRenderMask.empty()) {
+            f(size_t(0), numRenderEnvs);
+            return;
+        }
+
+        for (size_t first = 0; first < numRenderEnvs;) {
+            auto end = first;
+            while (end < numRenderEnvs && frameRenderMask[end])
+                ++end;
+
+            if (end > first)
+                f(first, end - first);
+
+            first = end + 1;
+        }
+    }
+
+    /**
+     * V4R pipelines only output RGBA8 at the framebuffer resolution, so other observation formats are converted
+     * on the host right after the frame is finished. Linear depth is scaled into the uint16 depth channel.
+     */
+    void processFrame();
+
     const uint8_t * getObservation(int envIdx, int agentIdx) const;
 
+    /**
+     * Depth comes from the same pass (pipeline with RenderOutputs::Depth), segmentation is not supported by V4R.
+     */
+    const uint8_t * getObservation(int envIdx, int agentIdx, ObservationChannel channel) const;
+
+    const uint8_t * getObservationsBatch(ObservationChannel channel) const;
+
+    const uint8_t * getObservationsBatch() const { return getObservation(0, 0); }
+
+    /**
+     * Frames rendered by V4R are already in CUDA memory. Pipelined mode only keeps a host copy of the previous frame,
+     * so device memory is only exported for the synchronous rendering. Device frames have no HUD, it is drawn on the host.
+     */
+    const uint8_t * getObservationsBatchDevice() const
+    {
+        if (frameInFlight || usePipelineFrames || obsOptions.convertsColor() || shards.size() > 1)
+            return nullptr;
+
+        return shards.front().stream.getColorDevPtr();
+    }
+
+    /**
+     * Works in both rendering modes: finished frames are copied on the device right after waitForFrame(). Converted
+     * observations (format, downsample) are uploaded from the host, since conversion happens there anyway.
+     */
+    bool setDeviceFrameStack(int numFrames);
+
+    const uint8_t * getFrameStackDevice() const
+    {
+        return stackDevice ? stackDevice + size_t(stackSlot + 1) * stackBatchBytes() : nullptr;
+    }
+
+    /**
+     * Copy the observations of the finished frame into the device frame stack.
+     */
+    void pushFrameStack();
+
+    size_t stackBatchBytes() const { return stackFrameBytes * renderEnvs.size(); }
+
     /**
      * Assuming preDraw() and draw() were already called for this renderer before the next renderer in the chain
      * requests dirty drawables.
      */
-    std::vector<int> getDirtyDrawables(int envIdx) const { return dirtyDrawables[envIdx]; }
+    std::vector<int> getDirtyDrawables(int envIdx) const { return instanceTransforms[envIdx].dirty; }
 
     Overview * getOverview() { return &overview; }
 
+    void memoryReport(MemoryReport &report) const;
+
 private:
-    int batchSize(const Envs &envs) const
+    static int numShardsFor(const std::vector<Env *> &envs, int numCommandStreams)
+    {
+        return std::clamp(numCommandStreams, 1, std::max(int(envs.size()), 1));
+    }
+
+    /// Shard s covers envs [envs * s / numShards, envs * (s + 1) / numShards).
+    static int shardFirstEnv(int numEnvs, int numShards, int shardIdx) { return numEnvs * shardIdx / numShards; }
+
+    /// v4r streams all have the same batch size, the number of agents in the largest shard.
+    static int maxShardBatchSize(const std::vector<Env *> &envs, int numShards)
     {
+        const auto numEnvs = int(envs.size());
+
         int res = 0;
-        for (const auto &e : envs)
-            res += e->getNumAgents();
+        for (int s = 0; s < numShards; ++s) {
+            int batch = 0;
+            for (auto envIdx = shardFirstEnv(numEnvs, numShards, s); envIdx < shardFirstEnv(numEnvs, numShards, s + 1); ++envIdx)
+                batch += envs[envIdx]->getNumAgents();
+
+            res = std::max(res, batch);
+        }
 
         return res;
     }
@@ -108,28 +288,137 @@ private:
 public:
     v4r::BatchRenderer renderer;
     v4r::AssetLoader loader;
-    v4r::CommandStream cmdStream;
     shared_ptr<v4r::Scene> scene;
-    vector<v4r::Environment> renderEnvs;
+
+    /**
+     * One command stream per shard of consecutive envs, so the shards can be submitted from different threads.
+     * Each stream renders into output buffers of its own, with more than one stream the finished frames are
+     * gathered into gatheredFrames (and gatheredDepth), so the batch layout is the same.
+     */
+    struct Shard
+    {
+        v4r::CommandStream stream;
+        vector<v4r::Environment> renderEnvs;
+        size_t firstRenderEnv = 0;
+        bool submitted = false;
+
+        // host time of the submission while profiling, for the submit-to-completion time of the shard
+        uint64_t submitNs = 0;
+    };
+
+    std::vector<Shard> shards;
+    std::vector<int> envShards;
+    HostBuffer gatheredFrames;
+    std::vector<float> gatheredDepth;
+
+    // every agent's render env in the vector of its shard, agents of an env are consecutive
+    vector<v4r::Environment *> renderEnvs;
 
     glm::u32vec2 framebufferSize;
 
-    int pixelsPerFrame{}, pixelsPerEnv{};
+    int pixelsPerFrame{};
+
+    // index of the first render env (i.e. agent) of each env, envs can have different numbers of agents
+    std::vector<int> agentOffsets;
+
+    // pipelined rendering: last finished frame is copied here, so the next frame can be rendered into
+    // the command stream output buffer while the observations are being consumed
+    bool frameInFlight = false, usePipelineFrames = false;
+    HostBuffer pipelineFrames;
+
+    ObservationOptions obsOptions;
+    size_t obsBytesPerFrame{};
+    HostBuffer convertedFrames;
+    std::vector<uint16_t> depthFrames;
+
+    // device frame stack of 2 * stackFrames batches: every frame is written to slot s and s + stackFrames, so the
+    // last stackFrames frames are always consecutive, from slot stackSlot + 1 on
+    int stackFrames = 0, stackSlot = 0;
+    size_t stackFrameBytes = 0;
+    uint8_t *stackDevice = nullptr;
+
+    // envs reset since the last frame, their agents get the whole history filled with the next frame
+    std::vector<bool> stackResetEnvs;
 
 //    vector<uint8_t> cpuFrames;
 
     std::vector<SceneGraph::DrawableGroup3D> envDrawables;
     std::vector<std::vector<V4RDrawable *>> v4rDrawables;  // to avoid dynamic cast on every step()
-    std::vector<std::vector<std::reference_wrapper<SceneGraph::AbstractObject3D>>> drawablesObjects;
 
-    std::vector<std::vector<int>> dirtyDrawables;
+    std::vector<InstanceTransforms> instanceTransforms;
+
+    struct PendingInstance
+    {
+        uint32_t meshIdx, materialIdx;
+        Object3D *object;
+    };
 
-    std::map<Color3, int, ColorCompare> materialIndices;
+    std::vector<std::vector<PendingInstance>> pendingInstances;
+
+    /**
+     * Assign render instances of the previous episode to the new instances with the same mesh and material,
+     * add the missing ones and delete the rest, instead of recreating the whole v4r::Environment.
+     * @param instanceIDs output, [instance][agentIdx]
+     */
+    void reuseInstances(
+        int renderEnvIdx, const std::vector<PendingInstance> &instances, std::vector<std::vector<uint32_t>> &instanceIDs, int agentIdx
+    );
+
+    struct AllocatedInstance
+    {
+        uint32_t meshIdx, materialIdx, instanceID;
+    };
+
+    // instances currently present in each render env
+    std::vector<std::vector<AllocatedInstance>> allocatedInstances;
+
+    // [renderEnvIdx][instance of the env] -> index in allocatedInstances, to replace the instance on a LOD switch
+    std::vector<std::vector<uint32_t>> instanceSlots;
+    std::vector<bool> renderEnvsInitialized;
+
+    /**
+     * Hide instances of the culling grid cells outside of the agent camera frustum, and show ones that came into view.
+     * Only instances of the cells that changed visibility are updated.
+     * Visible cells also select the level of detail of their instances by distance.
+     */
+    void cullInstances(Env &env, int envIdx);
+
+    /**
+     * Replace the instances of the cell in the render env with the mesh of the new level of detail.
+     */
+    void switchLod(int envIdx, int renderEnvIdx, int agentIdx, const CullingGrid::Cell &cell, int lod);
+
+    // grid over pendingInstances of each env, position in the grid order -> instance index and back
+    std::vector<CullingGrid> cullingGrids;
+    std::vector<std::vector<uint32_t>> cullingOrder, instanceCullingPos;
+
+    // [renderEnvIdx][cell]
+    std::vector<std::vector<bool>> visibleCells;
+    std::vector<std::vector<bool>> visibleCellsScratch;  // [envIdx], preDraw() runs concurrently for different envs
+
+    std::vector<Range3D> meshBounds;
+    bool frustumCulling = true;
+
+    // [base mesh index][lod] -> mesh index in the scene, lower levels of detail are loaded after the base meshes
+    std::vector<std::vector<uint32_t>> meshLods;
+    int maxLodLevels = 1;
+
+    // [renderEnvIdx][cell], level of detail the instances of the cell are currently using
+    std::vector<std::vector<uint8_t>> cellLods;
+
+    // [renderEnvIdx], HUD collected in preDraw() and the HUD of the frame being rendered, drawn over it on the host
+    std::vector<std::vector<HudQuad>> hudQuads, frameHudQuads;
+
+    // [renderEnvIdx], see EnvRenderer::setRenderMask(), and the mask of the frame being rendered
+    std::vector<uint8_t> renderMask, frameRenderMask;
+
+    // [renderEnvIdx * 16], see setCameraViews()
+    const float *cameraViews = nullptr;
 
 //    v4r::RenderDoc rdoc;
 
     std::map<DrawableType, Trade::MeshData> meshData;
-    std::map<DrawableType, int> meshIndices;
+    DrawableTypeArray<int> meshIndices;
 
     V4REnvRenderer *previousRenderer = nullptr;
 
@@ -142,20 +431,43 @@ using Pipeline = v4r::BlinnPhong<v4r::RenderOutputs::Color,
                                  v4r::DataSource::Uniform,
                                  v4r::DataSource::Uniform>;
 
-V4REnvRenderer::Impl::Impl(Envs &envs, int w, int h, V4REnvRenderer *previousRenderer, bool withOverview)
-    : renderer{{ 0, 1, 1, uint32_t(batchSize(envs)), uint32_t(w), uint32_t(h), glm::mat4(1.f) },
-               v4r::RenderFeatures<Pipeline> {v4r::RenderOptions::CpuSynchronization}}
+using PipelineWithDepth = v4r::BlinnPhong<v4r::RenderOutputs::Color | v4r::RenderOutputs::Depth,
+                                          v4r::DataSource::Uniform,
+                                          v4r::DataSource::Uniform,
+                                          v4r::DataSource::Uniform>;
+
+static v4r::BatchRenderer makeBatchRenderer(const v4r::RenderConfig &config, bool withDepth)
+{
+    // both pipelines share the vertex and material layout, so the rest of the renderer does not depend on the choice
+    if (withDepth)
+        return v4r::BatchRenderer{config, v4r::RenderFeatures<PipelineWithDepth>{v4r::RenderOptions::CpuSynchronization}};
+
+    return v4r::BatchRenderer{config, v4r::RenderFeatures<Pipeline>{v4r::RenderOptions::CpuSynchronization}};
+}
+
+V4REnvRenderer::Impl::Impl(
+    const std::vector<Env *> &envs, int w, int h, V4REnvRenderer *previousRenderer, bool withOverview, int gpuId,
+    const ObservationOptions &obsOptions, int numCommandStreams
+)
+    : renderer{makeBatchRenderer({
+        gpuId, 1, uint32_t(numShardsFor(envs, numCommandStreams)),
+        uint32_t(maxShardBatchSize(envs, numShardsFor(envs, numCommandStreams))), uint32_t(w), uint32_t(h), glm::mat4(1.f)
+    }, obsOptions.depth)}
     , loader{renderer.makeLoader()}
-    , cmdStream{renderer.makeCommandStream()}
-    , renderEnvs{}
     , framebufferSize{w, h}
     , previousRenderer{previousRenderer}
     , withOverviewCamera{withOverview}
+    , obsOptions{obsOptions}
     // cpuFrames(),
     // rdoc()
 {
+    installCudaHostPinning();
+
     auto numEnvs = envs.size();
-    envDrawables.resize(numEnvs), drawablesObjects.resize(numEnvs), v4rDrawables.resize(numEnvs), dirtyDrawables.resize(numEnvs);
+    envDrawables.resize(numEnvs), v4rDrawables.resize(numEnvs);
+    instanceTransforms.resize(numEnvs), visibleCellsScratch.resize(numEnvs);
+    pendingInstances.resize(numEnvs);
+    cullingGrids.resize(numEnvs), cullingOrder.resize(numEnvs), instanceCullingPos.resize(numEnvs);
 
 //    cpuFrames = vector<uint8_t>(size_t(framebufferSize.x * framebufferSize.y * 4 * env.getNumAgents()));
 
@@ -167,12 +479,11 @@ V4REnvRenderer::Impl::Impl(Envs &envs, int w, int h, V4REnvRenderer *previousRen
 
     // Inefficient conversion
     auto convertMesh = [&](const Magnum::Trade::MeshData &magnum_mesh) {
-        vector<Vertex> vertices;
-        vector<uint32_t> indices;
-        const auto magnum_indices = magnum_mesh.indicesAsArray();
         const auto magnum_positions = magnum_mesh.positions3DAsArray();
         const auto magnum_normals = magnum_mesh.normalsAsArray();
 
+        vector<Vertex> vertices;
+        vertices.reserve(magnum_positions.size());
         for (size_t i = 0; i < magnum_positions.size(); i++) {
             const auto &position = magnum_positions[i];
             const auto &normal = magnum_normals[i];
@@ -183,8 +494,9 @@ V4REnvRenderer::Impl::Impl(Envs &envs, int w, int h, V4REnvRenderer *previousRen
             });
         }
 
-        for (uint32_t idx : magnum_indices)
-            indices.push_back(idx);
+        // straight into the vector, without the temporary array
+        vector<uint32_t> indices(magnum_mesh.indexCount());
+        magnum_mesh.indicesInto(Corrade::Containers::arrayView(indices.data(), indices.size()));
 
         return loader.loadMesh(move(vertices), move(indices));
     };
@@ -195,20 +507,42 @@ V4REnvRenderer::Impl::Impl(Envs &envs, int w, int h, V4REnvRenderer *previousRen
         for (const auto &[drawable, data] : meshData) {
             meshIndices[drawable] = int(meshes.size());
             meshes.emplace_back(convertMesh(data));
+            meshBounds.emplace_back(Megaverse::meshBounds(data));
+        }
+
+        meshLods.resize(meshes.size());
+        DrawableTypeArray<std::vector<Trade::MeshData>> lodMeshData;
+        initPrimitiveLods(lodMeshData);
+
+        for (const auto &[drawable, data] : meshData) {
+            const auto &lods = lodMeshData[drawable];
+            const auto baseIdx = meshIndices[drawable];
+            meshLods[baseIdx].push_back(uint32_t(baseIdx));
+
+            for (size_t lod = 1; lod < lods.size(); ++lod) {
+                meshLods[baseIdx].push_back(uint32_t(meshes.size()));
+                meshes.emplace_back(convertMesh(lods[lod]));
+                meshBounds.emplace_back(Megaverse::meshBounds(lods[lod]));
+            }
+
+            maxLodLevels = std::max(maxLodLevels, int(lods.size()));
         }
     }
 
-    // Materials
+    // Materials: one per entry of allColors, so the color ID of a drawable is its material index
     {
-        const auto palette = envs.front()->getPalette();
         constexpr float shininess = 300.0f;
 
-        for (auto c : palette) {
-            materialIndices[c] = int(materials.size());
+        // the pipeline is fixed at compile time, a black specular color gives the Lambert look, not its speed
+        if (obsOptions.shading == ShadingModel::Flat)
+            TLOG(WARNING) << "Flat shading is not supported by the Vulkan renderer, using Lambert";
+        const auto specular = obsOptions.shading == ShadingModel::BlinnPhong ? glm::vec3(1.f) : glm::vec3(0.f);
 
+        for (auto colorRgb : allColors) {
+            const auto c = rgb(colorRgb);
             materials.emplace_back(loader.makeMaterial(MaterialParams {
                 glm::vec3(c.r(), c.g(), c.b()),
-                glm::vec3(1.f),
+                specular,
                 shininess
             }));
         }
@@ -222,27 +556,124 @@ V4REnvRenderer::Impl::Impl(Envs &envs, int w, int h, V4REnvRenderer *previousRen
         scene = loader.makeScene(scene_desc);
     }
 
-    // vector of render envs
+    // shards and their render envs, the vectors are not resized afterwards, so renderEnvs can point into them
     {
         auto [fov, near, far, aspectRatio] = agentCameraParameters();
         UNUSED(aspectRatio);
 
-        for (auto &env : envs)
-            for (int agentIdx = 0; agentIdx < env->getNumAgents(); ++agentIdx)
-                renderEnvs.emplace_back(cmdStream.makeEnvironment(scene, fov, near, far));
+        const auto numShards = numShardsFor(envs, numCommandStreams);
+        shards.reserve(size_t(numShards));
+        for (int s = 0; s < numShards; ++s)
+            shards.push_back(Shard{renderer.makeCommandStream(), {}, 0, false});
+
+        envShards.resize(numEnvs);
+        int numRenderEnvs = 0;
+        for (int s = 0; s < numShards; ++s) {
+            auto &shard = shards[s];
+            shard.firstRenderEnv = size_t(numRenderEnvs);
+
+            for (auto envIdx = shardFirstEnv(int(numEnvs), numShards, s); envIdx < shardFirstEnv(int(numEnvs), numShards, s + 1); ++envIdx) {
+                envShards[envIdx] = s;
+                agentOffsets.push_back(numRenderEnvs);
+                numRenderEnvs += envs[envIdx]->getNumAgents();
+
+                for (int agentIdx = 0; agentIdx < envs[envIdx]->getNumAgents(); ++agentIdx)
+                    shard.renderEnvs.emplace_back(shard.stream.makeEnvironment(scene, fov, near, far));
+            }
+        }
+
+        for (auto &shard : shards)
+            for (auto &renderEnv : shard.renderEnvs)
+                renderEnvs.push_back(&renderEnv);
     }
 
+    visibleCells.resize(renderEnvs.size()), cellLods.resize(renderEnvs.size());
+    hudQuads.resize(renderEnvs.size()), frameHudQuads.resize(renderEnvs.size());
+    allocatedInstances.resize(renderEnvs.size()), instanceSlots.resize(renderEnvs.size());
+    renderEnvsInitialized.resize(renderEnvs.size(), false);
+
     pixelsPerFrame = framebufferSize.x * framebufferSize.y * 4;
-    pixelsPerEnv = envs.front()->getNumAgents() * pixelsPerFrame;
+
+    if (obsOptions.convertsColor()) {
+        TCHECK(obsOptions.downsample >= 1 && w % obsOptions.downsample == 0 && h % obsOptions.downsample == 0);
+        obsBytesPerFrame = obsOptions.bytesPerFrame(w, h);
+        convertedFrames = HostBuffer{obsBytesPerFrame * renderEnvs.size(), obsOptions.hostMemory};
+    }
+
+    if (obsOptions.depth)
+        depthFrames.resize(size_t(w * h) * renderEnvs.size());
+
+    // allocated with the first pipelined frame
+    pipelineFrames = HostBuffer{0, obsOptions.hostMemory};
+
+    if (shards.size() > 1) {
+        gatheredFrames = HostBuffer{size_t(pixelsPerFrame) * renderEnvs.size(), obsOptions.hostMemory};
+        if (obsOptions.depth)
+            gatheredDepth.resize(size_t(w * h) * renderEnvs.size());
+    }
+
+    if (obsOptions.segmentation)
+        TLOG(WARNING) << "Segmentation observations are not supported by the V4R renderer";
 }
 
 V4REnvRenderer::Impl::~Impl()
 {
     TLOG(INFO) << __PRETTY_FUNCTION__;
+
+    if (stackDevice)
+        cudaFree(stackDevice);
 }
 
 void V4REnvRenderer::Impl::reset(Env &env, int envIdx)
 {
+    prepareReset(env, envIdx);
+    finishReset(env, envIdx);
+}
+
+void V4REnvRenderer::Impl::prepareReset(Env &env, int envIdx)
+{
+    // reset renderer data structures
+    {
+        envDrawables[envIdx] = SceneGraph::DrawableGroup3D{};
+        pendingInstances[envIdx].clear();
+    }
+
+    const auto &drawables = env.getDrawables();
+
+    for (int drawableType = int(DrawableType::First); drawableType < int(DrawableType::NumTypes); ++drawableType) {
+        const auto meshIndex = meshIndices[DrawableType(drawableType)];
+        for (const auto &sceneObjectInfo : drawables[DrawableType(drawableType)]) {
+            TCHECK(sceneObjectInfo.colorId < numColors);  // colors outside of allColors have no material
+            pendingInstances[envIdx].push_back({uint32_t(meshIndex), uint32_t(sceneObjectInfo.colorId), sceneObjectInfo.objectPtr});
+        }
+    }
+
+    std::vector<Object3D *> objects;
+    for (const auto &instance : pendingInstances[envIdx])
+        objects.emplace_back(instance.object);
+
+    auto &cache = instanceTransforms[envIdx].cache;
+    cache.build(objects);
+
+    std::vector<Range3D> bounds;
+    for (size_t i = 0; i < pendingInstances[envIdx].size(); ++i)
+        bounds.emplace_back(transformedBounds(cache.transformation(int(i)), meshBounds[pendingInstances[envIdx][i].meshIdx]));
+
+    cullingOrder[envIdx] = cullingGrids[envIdx].build(bounds);
+
+    auto &instancePos = instanceCullingPos[envIdx];
+    instancePos.resize(bounds.size());
+    for (uint32_t pos = 0; pos < cullingOrder[envIdx].size(); ++pos)
+        instancePos[cullingOrder[envIdx][pos]] = pos;
+}
+
+void V4REnvRenderer::Impl::finishReset(Env &env, int envIdx)
+{
+    waitForFrame();  // can't replace render envs while the previous frame is being rendered
+
+    if (stackDevice)
+        stackResetEnvs[envIdx] = true;
+
     auto [fov, near, far, aspectRatio] = agentCameraParameters();
     if (withOverviewCamera && envIdx == 0) {
         auto [oFov, oNear, oFar, oAspectRatio] = overviewCameraParameters();
@@ -250,45 +681,49 @@ void V4REnvRenderer::Impl::reset(Env &env, int envIdx)
     }
     UNUSED(aspectRatio);
 
+    // render envs are created once (camera parameters never change) and reused between episodes
     for (int i = 0; i < env.getNumAgents(); ++i) {
-        const auto idx = envIdx * env.getNumAgents() + i;  // assuming all envs have the same numAgents
-        renderEnvs[idx] = cmdStream.makeEnvironment(scene, fov, near, far);
-    }
-
-    // reset renderer data structures
-    {
-        envDrawables[envIdx] = SceneGraph::DrawableGroup3D{};
+        const auto idx = agentOffsets[envIdx] + i;
+        if (!renderEnvsInitialized[idx]) {
+            *renderEnvs[idx] = shards[envShards[envIdx]].stream.makeEnvironment(scene, fov, near, far);
+            renderEnvsInitialized[idx] = true;
+            allocatedInstances[idx].clear();
+        }
     }
 
     // drawables
     {
-        const auto &drawables = env.getDrawables();
+        const auto numAgents = env.getNumAgents();
+        auto envRenderEnvs = renderEnvs[agentOffsets[envIdx]];
 
-        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
-            const auto renderEnvIdx = envIdx * env.getNumAgents() + agentIdx;
-            auto &renderEnv = renderEnvs[renderEnvIdx];
-
-            for (const auto &[drawableType, meshIndex] : meshIndices) {
-                for (const auto &sceneObjectInfo : drawables.at(drawableType)) {
-                    const auto &color = sceneObjectInfo.color;
-                    const auto materialIdx = materialIndices[color];  // if we forgot to add the color to the palette, we should crash here
-                    const auto renderID = renderEnv.addInstance(uint32_t(meshIndex), uint32_t(materialIdx), glm::mat4(1.f));
-                    sceneObjectInfo.objectPtr->addFeature<V4RDrawable>(renderEnv, renderID, envDrawables[envIdx]);
-                }
-            }
-        }
+        v4rDrawables[envIdx].clear();
+
+        // the transform cache was built in prepareReset(), all instances get their transformations in the first preDraw()
+        const auto numInstances = pendingInstances[envIdx].size();
+        auto &staging = instanceTransforms[envIdx];
+        staging.dirty.resize(numInstances);
+        std::iota(staging.dirty.begin(), staging.dirty.end(), 0);
 
-        drawablesObjects[envIdx].clear(), v4rDrawables[envIdx].clear();
+        v4rDrawables[envIdx].reserve(numInstances);
 
-        for (size_t i = 0; i < envDrawables[envIdx].size(); ++i) {
-            auto &object = envDrawables[envIdx][i].object();
-            drawablesObjects[envIdx].emplace_back(object);
+        std::vector<std::vector<uint32_t>> envInstanceIDs(pendingInstances[envIdx].size(), std::vector<uint32_t>(size_t(numAgents)));
+        for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx)
+            reuseInstances(agentOffsets[envIdx] + agentIdx, pendingInstances[envIdx], envInstanceIDs, agentIdx);
 
-            auto v4rDrawable = dynamic_cast<V4RDrawable *>(&envDrawables[envIdx][i]);
-            v4rDrawables[envIdx].emplace_back(v4rDrawable);
+        for (size_t i = 0; i < pendingInstances[envIdx].size(); ++i) {
+            const auto &instance = pendingInstances[envIdx][i];
+            auto instanceIDs = std::move(envInstanceIDs[i]);
+
+            auto &drawable = instance.object->addFeature<V4RDrawable>(envRenderEnvs, std::move(instanceIDs), staging, int(i), envDrawables[envIdx]);
+            v4rDrawables[envIdx].emplace_back(&drawable);
         }
 
-        dirtyDrawables[envIdx].clear();
+        // everything is visible until the first culling pass
+        const auto numCells = cullingGrids[envIdx].getCells().size();
+        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx) {
+            visibleCells[agentOffsets[envIdx] + agentIdx].assign(numCells, true);
+            cellLods[agentOffsets[envIdx] + agentIdx].assign(numCells, 0);
+        }
     }
 
     // controllable overview camera
@@ -296,54 +731,206 @@ void V4REnvRenderer::Impl::reset(Env &env, int envIdx)
         overview.reset(&env.getScene());
 }
 
-void V4REnvRenderer::Impl::preDraw(Env &env, int envIdx)
+void V4REnvRenderer::Impl::reuseInstances(
+    int renderEnvIdx, const std::vector<PendingInstance> &instances, std::vector<std::vector<uint32_t>> &instanceIDs, int agentIdx
+)
 {
-    dirtyDrawables[envIdx].clear();
+    auto &renderEnv = *renderEnvs[renderEnvIdx];
+    auto &allocated = allocatedInstances[renderEnvIdx];
+
+    const auto key = [](uint32_t meshIdx, uint32_t materialIdx) { return (uint64_t(meshIdx) << 32) | materialIdx; };
+
+    // walk the previous and the new instances sorted by mesh and material, reusing matching render instances
+    const auto allocatedKey = [&](const AllocatedInstance &a) { return key(a.meshIdx, a.materialIdx); };
+    std::sort(allocated.begin(), allocated.end(), [&](const auto &a, const auto &b) { return allocatedKey(a) < allocatedKey(b); });
+
+    std::vector<size_t> order(instances.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+        return key(instances[a].meshIdx, instances[a].materialIdx) < key(instances[b].meshIdx, instances[b].materialIdx);
+    });
+
+    std::vector<AllocatedInstance> newAllocated;
+    newAllocated.reserve(instances.size());
+
+    auto &slots = instanceSlots[renderEnvIdx];
+    slots.resize(instances.size());
 
+    size_t prev = 0;
+    for (auto i : order) {
+        const auto &instance = instances[i];
+        const auto k = key(instance.meshIdx, instance.materialIdx);
+
+        while (prev < allocated.size() && allocatedKey(allocated[prev]) < k)
+            renderEnv.deleteInstance(allocated[prev++].instanceID);
+
+        uint32_t instanceID;
+        if (prev < allocated.size() && allocatedKey(allocated[prev]) == k)
+            instanceID = allocated[prev++].instanceID;
+        else
+            instanceID = renderEnv.addInstance(instance.meshIdx, instance.materialIdx, glm::mat4(1.f));
+
+        instanceIDs[i][agentIdx] = instanceID;
+        slots[i] = uint32_t(newAllocated.size());
+        newAllocated.push_back({instance.meshIdx, instance.materialIdx, instanceID});
+    }
+
+    for (; prev < allocated.size(); ++prev)
+        renderEnv.deleteInstance(allocated[prev].instanceID);
+
+    allocated = std::move(newAllocated);
+}
+
+void V4REnvRenderer::Impl::preDraw(Env &env, int envIdx)
+{
     const auto numAgents = env.getNumAgents();
     for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx) {
-        const auto renderEnvIdx = envIdx * numAgents + agentIdx;
-        v4r::Environment &renderEnv = renderEnvs[renderEnvIdx];
+        const auto renderEnvIdx = agentOffsets[envIdx] + agentIdx;
+        v4r::Environment &renderEnv = *renderEnvs[renderEnvIdx];
 
         auto activeCameraPtr = env.getAgents()[agentIdx]->getCamera();
         if (withOverviewCamera && overview.enabled && envIdx == 0)
             activeCameraPtr = overview.camera;
 
         auto view = glm::make_mat4(activeCameraPtr->cameraMatrix().data());
+        if (cameraViews && activeCameraPtr == env.getAgents()[agentIdx]->getCamera())
+            view = glm::make_mat4(cameraViews + size_t(renderEnvIdx) * 16);
 
         renderEnv.setCameraView(view);
+
+        // the overview camera shows the scene only
+        hudQuads[renderEnvIdx].clear();
+        if (!(withOverviewCamera && overview.enabled && envIdx == 0))
+            env.hud(agentIdx, hudQuads[renderEnvIdx]);
     }
 
-    if (previousRenderer) {
-        dirtyDrawables[envIdx] = previousRenderer->getDirtyDrawables(envIdx);
-    } else {
-        std::vector<std::reference_wrapper<SceneGraph::AbstractObject3D>> dirtyObjects;
+    auto &staging = instanceTransforms[envIdx];
 
-        for (size_t i = 0; i < drawablesObjects[envIdx].size(); ++i) {
-            auto &obj = drawablesObjects[envIdx][i].get();
-            if (obj.isDirty()) {
-                dirtyObjects.emplace_back(drawablesObjects[envIdx][i]);
-                dirtyDrawables[envIdx].emplace_back(i);
+    // chained renderers have caches of their own, nobody cleans the scene graph
+    for (auto drawableIdx : staging.cache.update())
+        staging.dirty.push_back(drawableIdx);
+
+    if (frustumCulling)
+        cullInstances(env, envIdx);
+
+    const auto &grid = cullingGrids[envIdx];
+    const auto &instancePos = instanceCullingPos[envIdx];
+
+    // transformation is computed once and copied to the views of all agents, except the ones that don't see it
+    for (auto &drawableIdx : staging.dirty) {
+        auto drawable = v4rDrawables[envIdx][drawableIdx];
+        const auto t = drawable->absoluteTransformation();
+        const auto cell = frustumCulling ? grid.cellOf(instancePos[drawableIdx]) : 0;
+
+        for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx)
+            if (!frustumCulling || visibleCells[agentOffsets[envIdx] + agentIdx][cell])
+                drawable->setTransformation(agentIdx, t);
+    }
+
+    staging.dirty.clear();
+}
+
+void V4REnvRenderer::Impl::cullInstances(Env &env, int envIdx)
+{
+    auto &grid = cullingGrids[envIdx];
+    const auto &instances = pendingInstances[envIdx];
+    const auto &order = cullingOrder[envIdx];
+    const auto &instancePos = instanceCullingPos[envIdx];
+    const auto numAgents = env.getNumAgents();
+
+    const auto &staging = instanceTransforms[envIdx];
+    for (auto drawableIdx : staging.dirty) {
+        const auto &instance = instances[drawableIdx];
+        grid.update(instancePos[drawableIdx], transformedBounds(staging.cache.transformation(drawableIdx), meshBounds[instance.meshIdx]));
+    }
+
+    const auto &cells = grid.getCells();
+
+    for (int agentIdx = 0; agentIdx < numAgents; ++agentIdx) {
+        const auto renderEnvIdx = agentOffsets[envIdx] + agentIdx;
+
+        auto cameraPtr = env.getAgents()[agentIdx]->getCamera();
+        if (withOverviewCamera && overview.enabled && envIdx == 0)
+            cameraPtr = overview.camera;
+
+        grid.cellVisibility(cameraPtr->projectionMatrix() * cameraPtr->cameraMatrix(), visibleCellsScratch[envIdx]);
+
+        auto &visible = visibleCells[renderEnvIdx];
+        for (size_t cell = 0; cell < cells.size(); ++cell) {
+            if (visible[cell] == visibleCellsScratch[envIdx][cell])
+                continue;
+
+            visible[cell] = visibleCellsScratch[envIdx][cell];
+            for (auto pos = cells[cell].first; pos < cells[cell].first + cells[cell].count; ++pos) {
+                auto drawable = v4rDrawables[envIdx][order[pos]];
+                if (visible[cell])
+                    drawable->setTransformation(agentIdx, drawable->absoluteTransformation());
+                else
+                    drawable->hide(agentIdx);
             }
         }
 
-        // Collapsing the scene graph transformations "manually", somehow this is barely faster, if at all
-        SceneGraph::AbstractObject3D::setClean(dirtyObjects);
+        if (maxLodLevels <= 1)
+            continue;
+
+        // hidden cells keep their level of detail until they come into view
+        const auto cameraPosition = cameraPtr->cameraMatrix().invertedRigid().translation();
+        auto &lods = cellLods[renderEnvIdx];
+        for (size_t cell = 0; cell < cells.size(); ++cell) {
+            if (!visible[cell])
+                continue;
+
+            const auto lod = lodForDistance(distanceToBounds(cameraPosition, cells[cell].bounds), maxLodLevels);
+            if (lod != lods[cell]) {
+                switchLod(envIdx, renderEnvIdx, agentIdx, cells[cell], lod);
+                lods[cell] = uint8_t(lod);
+            }
+        }
     }
+}
 
-    for (auto &drawableIdx : dirtyDrawables[envIdx])
-        v4rDrawables[envIdx][drawableIdx]->updateAbsoluteTransformation();
+void V4REnvRenderer::Impl::switchLod(int envIdx, int renderEnvIdx, int agentIdx, const CullingGrid::Cell &cell, int lod)
+{
+    auto &renderEnv = *renderEnvs[renderEnvIdx];
+    auto &allocated = allocatedInstances[renderEnvIdx];
+    const auto &slots = instanceSlots[renderEnvIdx];
+    const auto &order = cullingOrder[envIdx];
+
+    for (auto pos = cell.first; pos < cell.first + cell.count; ++pos) {
+        const auto instanceIdx = order[pos];
+        const auto &levels = meshLods[pendingInstances[envIdx][instanceIdx].meshIdx];
+        const auto meshIdx = levels[std::min(size_t(lod), levels.size() - 1)];
+
+        auto &slot = allocated[slots[instanceIdx]];
+        if (slot.meshIdx == meshIdx)
+            continue;
+
+        auto drawable = v4rDrawables[envIdx][instanceIdx];
+        renderEnv.deleteInstance(slot.instanceID);
+        slot.meshIdx = meshIdx;
+        slot.instanceID = renderEnv.addInstance(meshIdx, slot.materialIdx, drawable->absoluteTransformation());
+        drawable->setInstanceID(agentIdx, slot.instanceID);
+    }
 }
 
 void V4REnvRenderer::Impl::draw(Envs &)
 {
+    waitForFrame();
+    usePipelineFrames = false;
+
 //    rdoc.startFrame();
-    cmdStream.render(renderEnvs);
-    cmdStream.waitForFrame();
+    submitRemainingShards();
+    hudQuads.swap(frameHudQuads);
+    frameRenderMask = renderMask;
+
+    PROFILE_ZONE("Renderer::readback");
+    finishShards();
+    processFrame();
+    pushFrameStack();
 
 //    memcpy(
 //        cpuFrames.data(),
-//        cmdStream.getRGB(),
+//        frameRGB(),
 //        env.getNumAgents() * framebufferSize.x * framebufferSize.y * 4
 //    );
 
@@ -354,16 +941,230 @@ void V4REnvRenderer::Impl::draw(Envs &)
 //        abort();
 }
 
+void V4REnvRenderer::Impl::drawAsync(Envs &)
+{
+    waitForFrame();
+
+    // instance transforms and camera views are copied by the command stream at submission, so after this
+    // we can keep updating the render envs from the simulation threads
+    submitRemainingShards();
+    hudQuads.swap(frameHudQuads);
+    frameRenderMask = renderMask;
+    frameInFlight = true;
+}
+
+void V4REnvRenderer::Impl::waitForFrame()
+{
+    if (!frameInFlight)
+        return;
+
+    PROFILE_ZONE("Renderer::readback");
+
+    finishShards();
+    frameInFlight = false;
+
+    usePipelineFrames = true;
+
+    // conversion output doubles as the copy of the finished frame
+    processFrame();
+    pushFrameStack();
+    if (obsOptions.convertsColor())
+        return;
+
+    const auto frameBytes = size_t(pixelsPerFrame);
+    pipelineFrames.resize(frameBytes * renderEnvs.size());
+    forEachRenderedRun([&](size_t first, size_t count) {
+        memcpy(pipelineFrames.data() + first * frameBytes, frameRGB() + first * frameBytes, count * frameBytes);
+    });
+}
+
+void V4REnvRenderer::Impl::submitShard(int shardIdx)
+{
+    // a pipelined frame still owns the outputs, draw() submits after waiting for it
+    auto &shard = shards[shardIdx];
+    if (frameInFlight || shard.submitted)
+        return;
+
+    renderShard(shard);
+    shard.submitted = true;
+}
+
+void V4REnvRenderer::Impl::renderShard(Shard &shard)
+{
+    PROFILE_ZONE("Renderer::submit");
+
+    shard.submitNs = ScopedProfiler::enabled() ? ScopedProfiler::nowNs() : 0;
+    shard.stream.render(shard.renderEnvs);
+}
+
+void V4REnvRenderer::Impl::submitRemainingShards()
+{
+    for (auto &shard : shards) {
+        if (!shard.submitted)
+            renderShard(shard);
+
+        shard.submitted = true;
+    }
+}
+
+void V4REnvRenderer::Impl::finishShards()
+{
+    // v4r does not expose its command buffers for timestamp queries, so the GPU time of a shard is measured on the
+    // host from submission to completion, an upper bound that includes queueing behind the other shards
+    static const auto gpuFrameZone = sprof().registerZone("Renderer::gpu.frame");
+
+    for (auto &shard : shards) {
+        shard.stream.waitForFrame();
+        shard.submitted = false;
+
+        if (shard.submitNs && ScopedProfiler::enabled())
+            sprof().recordGpu(gpuFrameZone, shard.submitNs, ScopedProfiler::nowNs() - shard.submitNs);
+        shard.submitNs = 0;
+    }
+
+    if (shards.size() == 1)
+        return;
+
+    const auto pixels = size_t(framebufferSize.x) * size_t(framebufferSize.y);
+    for (const auto &shard : shards) {
+        const auto first = shard.firstRenderEnv, count = shard.renderEnvs.size();
+        memcpy(gatheredFrames.data() + first * size_t(pixelsPerFrame), shard.stream.getRGB(), count * size_t(pixelsPerFrame));
+
+        if (obsOptions.depth)
+            memcpy(gatheredDepth.data() + first * pixels, shard.stream.getDepth(), count * pixels * sizeof(float));
+    }
+}
+
+void V4REnvRenderer::Impl::processFrame()
+{
+    const auto w = int(framebufferSize.x), h = int(framebufferSize.y);
+
+    // v4r has no overlay pass, the few HUD pixels are written into the finished frames before anyone reads them
+    auto rgba = const_cast<uint8_t *>(frameRGB());
+    const auto far = std::get<2>(agentCameraParameters());
+    const float *depth = obsOptions.depth ? frameDepth() : nullptr;
+    const auto pixels = size_t(w) * size_t(h);
+
+    forEachRenderedRun([&](size_t first, size_t count) {
+        for (auto i = first; i < first + count; ++i)
+            drawHud(frameHudQuads[i], rgba + i * size_t(pixelsPerFrame), w, h);
+
+        if (obsOptions.convertsColor())
+            convertObservations(rgba + first * size_t(pixelsPerFrame), w, h, count, obsOptions, convertedFrames.data() + first * obsBytesPerFrame);
+
+        if (obsOptions.depth) {
+            for (auto i = first * pixels; i < (first + count) * pixels; ++i)
+                depthFrames[i] = uint16_t(std::min(depth[i] / far, 1.0f) * 65535.0f + 0.5f);
+        }
+    });
+}
+
+bool V4REnvRenderer::Impl::setDeviceFrameStack(int numFrames)
+{
+    if (numFrames < 1 || stackDevice) {
+        TLOG(ERROR) << "Frame stack can only be set once, with at least one frame";
+        return false;
+    }
+
+    stackFrames = numFrames;
+    stackFrameBytes = obsOptions.bytesPerFrame(int(framebufferSize.x), int(framebufferSize.y));
+
+    if (cudaMalloc(reinterpret_cast<void **>(&stackDevice), 2 * size_t(stackFrames) * stackBatchBytes()) != cudaSuccess) {
+        TLOG(ERROR) << "Could not allocate a device frame stack of " << numFrames << " frames";
+        stackDevice = nullptr;
+        return false;
+    }
+
+    // all envs are reset before the first frame, which fills the whole stack
+    stackResetEnvs.assign(agentOffsets.size(), true);
+    return true;
+}
+
+void V4REnvRenderer::Impl::pushFrameStack()
+{
+    if (!stackDevice)
+        return;
+
+    PROFILE_ZONE("Renderer::frameStack");
+
+    // device to device, or host to device for the converted observations
+    const auto batchBytes = stackBatchBytes();
+    const uint8_t *frame = obsOptions.convertsColor() ? convertedFrames.data()
+        : shards.size() > 1 ? gatheredFrames.data() : shards.front().stream.getColorDevPtr();
+
+    stackSlot = (stackSlot + 1) % stackFrames;
+    for (auto slot : {stackSlot, stackSlot + stackFrames})
+        TCHECK(cudaMemcpy(stackDevice + size_t(slot) * batchBytes, frame, batchBytes, cudaMemcpyDefault) == cudaSuccess);
+
+    for (size_t envIdx = 0; envIdx < stackResetEnvs.size(); ++envIdx) {
+        if (!stackResetEnvs[envIdx])
+            continue;
+
+        stackResetEnvs[envIdx] = false;
+
+        const auto firstAgent = size_t(agentOffsets[envIdx]);
+        const auto lastAgent = envIdx + 1 < agentOffsets.size() ? size_t(agentOffsets[envIdx + 1]) : renderEnvs.size();
+        const auto offset = firstAgent * stackFrameBytes, bytes = (lastAgent - firstAgent) * stackFrameBytes;
+
+        for (int slot = 0; slot < 2 * stackFrames; ++slot)
+            TCHECK(cudaMemcpy(stackDevice + size_t(slot) * batchBytes + offset, frame + offset, bytes, cudaMemcpyDefault) == cudaSuccess);
+    }
+}
+
 const uint8_t * V4REnvRenderer::Impl::getObservation(int envIdx, int agentIdx) const
 {
-    const auto startIdx = envIdx * pixelsPerEnv;
-    return cmdStream.getRGB() + startIdx + agentIdx * pixelsPerFrame;
+    const auto renderEnvIdx = size_t(agentOffsets[envIdx] + agentIdx);
+    if (obsOptions.convertsColor())
+        return convertedFrames.data() + renderEnvIdx * obsBytesPerFrame;
+
+    const auto startIdx = renderEnvIdx * size_t(pixelsPerFrame);
+    if (usePipelineFrames)
+        return pipelineFrames.data() + startIdx;
+
+    return frameRGB() + startIdx;
 //    return cpuFrames.data() + agentIdx * framebufferSize.x * framebufferSize.y * 4;
 }
 
-V4REnvRenderer::V4REnvRenderer(Envs &envs, int w, int h, V4REnvRenderer *previousRenderer, bool withOverview)
+const uint8_t * V4REnvRenderer::Impl::getObservation(int envIdx, int agentIdx, ObservationChannel channel) const
 {
-    pimpl = std::make_unique<Impl>(envs, w, h, previousRenderer, withOverview);
+    if (channel == ObservationChannel::Color)
+        return getObservation(envIdx, agentIdx);
+
+    const auto batch = getObservationsBatch(channel);
+    if (!batch)
+        return nullptr;
+
+    const auto w = int(framebufferSize.x), h = int(framebufferSize.y);
+    return batch + size_t(agentOffsets[envIdx] + agentIdx) * obsOptions.bytesPerFrame(channel, w, h);
+}
+
+const uint8_t * V4REnvRenderer::Impl::getObservationsBatch(ObservationChannel channel) const
+{
+    switch (channel) {
+        case ObservationChannel::Depth: return obsOptions.depth ? reinterpret_cast<const uint8_t *>(depthFrames.data()) : nullptr;
+        case ObservationChannel::Segmentation: return nullptr;
+        default: return getObservationsBatch();
+    }
+}
+
+V4REnvRenderer::V4REnvRenderer(
+    Envs &envs, int w, int h, V4REnvRenderer *previousRenderer, bool withOverview, int gpuId,
+    const ObservationOptions &obsOptions, int numCommandStreams
+)
+{
+    std::vector<Env *> envPtrs;
+    for (auto &e : envs)
+        envPtrs.emplace_back(e.get());
+
+    pimpl = std::make_unique<Impl>(envPtrs, w, h, previousRenderer, withOverview, gpuId, obsOptions, numCommandStreams);
+}
+
+V4REnvRenderer::V4REnvRenderer(
+    const std::vector<Env *> &envs, int w, int h, bool withOverview, int gpuId, const ObservationOptions &obsOptions,
+    int numCommandStreams
+)
+{
+    pimpl = std::make_unique<Impl>(envs, w, h, nullptr, withOverview, gpuId, obsOptions, numCommandStreams);
 }
 
 V4REnvRenderer::~V4REnvRenderer() = default;
@@ -374,6 +1175,16 @@ void V4REnvRenderer::reset(Env &env, int envIdx)
     pimpl->reset(env, envIdx);
 }
 
+void V4REnvRenderer::prepareReset(Env &env, int envIdx)
+{
+    pimpl->prepareReset(env, envIdx);
+}
+
+void V4REnvRenderer::finishReset(Env &env, int envIdx)
+{
+    pimpl->finishReset(env, envIdx);
+}
+
 void V4REnvRenderer::preDraw(Env &env, int envIndex)
 {
     pimpl->preDraw(env, envIndex);
@@ -384,11 +1195,113 @@ void V4REnvRenderer::draw(Envs &envs)
     pimpl->draw(envs);
 }
 
+void V4REnvRenderer::drawAsync(Envs &envs)
+{
+    pimpl->drawAsync(envs);
+}
+
+void V4REnvRenderer::waitForFrame()
+{
+    pimpl->waitForFrame();
+}
+
+int V4REnvRenderer::numShards() const
+{
+    return pimpl->numShards();
+}
+
+int V4REnvRenderer::shardOf(int envIdx) const
+{
+    return pimpl->shardOf(envIdx);
+}
+
+void V4REnvRenderer::submitShard(int shardIdx)
+{
+    pimpl->submitShard(shardIdx);
+}
+
+void V4REnvRenderer::setRenderMask(const std::vector<uint8_t> &agentMask)
+{
+    pimpl->setRenderMask(agentMask);
+}
+
+void V4REnvRenderer::setCameraViews(const float *views)
+{
+    pimpl->setCameraViews(views);
+}
+
 const uint8_t * V4REnvRenderer::getObservation(int envIdx, int agentIdx) const
 {
     return pimpl->getObservation(envIdx, agentIdx);
 }
 
+const uint8_t * V4REnvRenderer::getObservation(int envIdx, int agentIdx, ObservationChannel channel) const
+{
+    return pimpl->getObservation(envIdx, agentIdx, channel);
+}
+
+const uint8_t * V4REnvRenderer::getObservationsBatch() const
+{
+    return pimpl->getObservationsBatch();
+}
+
+const uint8_t * V4REnvRenderer::getObservationsBatch(ObservationChannel channel) const
+{
+    return pimpl->getObservationsBatch(channel);
+}
+
+const uint8_t * V4REnvRenderer::getObservationsBatchDevice() const
+{
+    return pimpl->getObservationsBatchDevice();
+}
+
+bool V4REnvRenderer::setDeviceFrameStack(int numFrames)
+{
+    return pimpl->setDeviceFrameStack(numFrames);
+}
+
+const uint8_t * V4REnvRenderer::getFrameStackDevice() const
+{
+    return pimpl->getFrameStackDevice();
+}
+
+void V4REnvRenderer::Impl::memoryReport(MemoryReport &report) const
+{
+    report.add("render.observations", pipelineFrames.size() + convertedFrames.size() + vectorBytes(depthFrames));
+
+    size_t drawablesBytes = vectorBytes(v4rDrawables);
+    for (const auto &drawables : v4rDrawables)
+        drawablesBytes += drawables.size() * sizeof(V4RDrawable);
+    report.add("render.drawables", drawablesBytes);
+
+    size_t instancesBytes = vectorBytes(pendingInstances) + vectorBytes(allocatedInstances) + vectorBytes(instanceSlots);
+    for (const auto &transforms : instanceTransforms)
+        instancesBytes += transforms.cache.memoryBytes() + vectorBytes(transforms.dirty);
+    report.add("render.instances", instancesBytes);
+
+    size_t cullingBytes = vectorBytes(cullingOrder) + vectorBytes(instanceCullingPos) + vectorBytes(visibleCells)
+        + vectorBytes(visibleCellsScratch) + vectorBytes(cellLods);
+    for (const auto &grid : cullingGrids)
+        cullingBytes += grid.memoryBytes();
+    report.add("render.culling", cullingBytes);
+
+    size_t meshBytes = 0;
+    for (const auto &[type, mesh] : meshData)
+        meshBytes += mesh.vertexData().size() + mesh.indexData().size();
+    report.add("render.meshes", meshBytes);
+    report.add("gpu.meshes", meshBytes);
+
+    // one color (and optionally float depth) output per render env, i.e. per agent
+    const size_t depthBytes = obsOptions.depth ? size_t(framebufferSize.x * framebufferSize.y) * sizeof(float) : 0;
+    report.add("gpu.framebuffers", renderEnvs.size() * (size_t(pixelsPerFrame) + depthBytes));
+    report.add("gpu.frame_stack", stackDevice ? 2 * size_t(stackFrames) * stackBatchBytes() : 0);
+}
+
+void V4REnvRenderer::memoryReport(MemoryReport &report) const
+{
+    pimpl->memoryReport(report);
+}
+
 std::vector<int> V4REnvRenderer::getDirtyDrawables(int envIdx) const
 {
     return pimpl->getDirtyDrawables(envIdx);
@@ -398,3 +1311,18 @@ Overview * V4REnvRenderer::getOverview()
 {
     return pimpl->getOverview();
 }
+
+void Megaverse::installCudaHostPinning()
+{
+    // portable: pinned for every device, i.e. with MultiGpuEnvRenderer
+    setHostMemoryPinning({
+        [](void *data, size_t size) {
+            if (cudaHostRegister(data, size, cudaHostRegisterPortable) == cudaSuccess)
+                return true;
+
+            cudaGetLastError();  // don't leave the error for the next CUDA call
+            return false;
+        },
+        [](void *data) { cudaHostUnregister(data); },
+    });
+}
@@ -38,8 +38,14 @@ public:
     virtual ~Viewer() { viewerExists = false; }
 
 public:
+    /// @param dones indexed like envs, only the active env is checked
     void step(const std::vector<bool> &dones);
 
+    /**
+     * Show env #envIdx. The renderer is recreated for this env only, other envs never allocate rendering resources.
+     */
+    void setActiveEnv(int envIdx);
+
 protected:
     void drawEvent() override;
 
@@ -50,6 +56,8 @@ protected:
     void mouseMoveEvent(MouseMoveEvent &event) override;
 
 private:
+    void createRenderer();
+
     void controlOverview(const KeyEvent::Key &key, bool addAction);
 
     void moveOverviewCamera();
@@ -61,10 +69,10 @@ protected:
     Envs &envs;
 
     /**
-     * Overview is only supported for the 1st env in case we have a vector of envs.
-     * On-the-fly switching between multiple envs is also possible, but requires additional logic.
+     * The only env that is rendered, switched with PageUp/PageDown or setActiveEnv().
+     * Renderer indices are indices in the subset {envs[activeEnv]}, so the active env is always env 0 to the renderer.
      */
-    constexpr static int activeEnv = 0;
+    int activeEnv = 0;
     int activeAgent = 0;
 
     std::unique_ptr<EnvRenderer> renderer;
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <util/triple_buffer.hpp>
+
+#include <env/env.hpp>
+
+#include <rendering/render_snapshot.hpp>
+
+
+namespace Megaverse
+{
+
+/**
+ * Viewer window that runs on its own thread at its own frame rate, so visualization doesn't slow down sampling.
+ * The simulation side only publishes snapshots of one env (see RenderSnapshot) through a lock-free triple buffer,
+ * the window, the events and the rendering are on the viewer thread, which never touches the envs.
+ * Controls: 1-6 switch between agents, O toggles a free camera (UHJK, left and right shift, mouse to look around),
+ * ESC or closing the window stops the viewer.
+ */
+class ViewerThread
+{
+public:
+    explicit ViewerThread(int envIdx = 0, float fps = 30.0f);
+
+    ~ViewerThread();
+
+    /**
+     * Call from the thread that steps the envs after every step and reset, while the env is not being stepped.
+     * Snapshots are captured at most at the frame rate of the viewer, the other calls return right away.
+     */
+    void publish(Envs &envs);
+
+    /// false once the window is closed
+    bool isRunning() const { return running; }
+
+private:
+    void loop();
+
+private:
+    int envIdx;
+    float fps;
+
+    SnapshotCapture capture;
+    TripleBuffer<RenderSnapshot> snapshots;
+    std::chrono::steady_clock::time_point lastPublish;
+
+    std::atomic<bool> running{true}, terminate{false};
+    std::thread thread;
+};
+
+}
@@ -1,6 +1,3 @@
-#include <opencv2/core/mat.hpp>
-#include <opencv2/imgproc.hpp>
-
 #include <util/tiny_logger.hpp>
 
 #include <env/env.hpp>
@@ -18,6 +15,24 @@ using namespace Magnum;
 using namespace Megaverse;
 
 
+namespace
+{
+
+/**
+ * Renderers produce top-down frames, the window framebuffer is bottom-up, so the destination rectangle of the blit is
+ * upside down.
+ */
+void blitTopDown(GL::AbstractFramebuffer &source)
+{
+    const auto size = source.viewport().size();
+
+    GL::defaultFramebuffer.bind();
+    GL::AbstractFramebuffer::blit(source, GL::defaultFramebuffer, {{}, size}, {{0, size.y()}, {size.x(), 0}}, GL::FramebufferBlit::Color, GL::FramebufferBlitFilter::Nearest);
+}
+
+}
+
+
 bool Viewer::viewerExists = false;
 
 
@@ -48,33 +63,28 @@ Viewer::Viewer(Envs &envs, bool useVulkan, EnvRenderer *parentRenderer, const Ar
 
     ctx = std::make_unique<WindowRenderingContext>();
 
-    const Magnum::Vector2i fbSize = framebufferSize();
+    // the viewer renders only its active env, so it does not share resources with the renderer of the other envs
+    UNUSED(parentRenderer);
+
     if (useVulkan) {
 #if defined (CORRADE_TARGET_APPLE)
         TLOG(ERROR) << "Vulkan not supported on MacOS";
-        UNUSED(parentRenderer);
 #else
-        framebuffer = GL::Framebuffer{Range2Di{{}, fbSize}};
+        framebuffer = GL::Framebuffer{Range2Di{{}, framebufferSize()}};
         framebuffer.attachRenderbuffer(GL::Framebuffer::ColorAttachment{0}, colorBuffer);
         framebuffer.mapForDraw({{0, GL::Framebuffer::ColorAttachment{0}}});
         framebuffer.clearColor(0, Color3{0.125f}).clearDepth(1.0).bind();
-
-        auto v4rParentRenderer = dynamic_cast<V4REnvRenderer *>(parentRenderer);
-        renderer = std::make_unique<V4REnvRenderer>(envs, fbSize[0], fbSize[1], v4rParentRenderer, true);
 #endif
-    } else {
-        renderer = std::make_unique<MagnumEnvRenderer>(envs, fbSize[0], fbSize[1], withDebugDraw, true, ctx.get());
-        dynamic_cast<MagnumEnvRenderer &>(*renderer).toggleDebugMode();
     }
 
-    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx)
-        renderer->reset(*envs[envIdx], envIdx);
+    createRenderer();
 
     setSwapInterval(0);
 
     TLOG(WARNING) << "\nControls:\n"
                   << "WASD and arrow keys to control the agent\n"
                   << "1,2,3,4,etc. to switch between agents (if several are present in the environment)\n"
+                  << "PageUp/PageDown to switch between envs (if there are several)\n"
                   << "Press O to toggle the overview camera, use mouse to control view angle\n"
                   << "Use UHJK keys to control the position of the camera\n"
                   << "Press R to reset the episode\n"
@@ -82,16 +92,53 @@ Viewer::Viewer(Envs &envs, bool useVulkan, EnvRenderer *parentRenderer, const Ar
                   << "ESC to exit the app\n";
 }
 
-void Viewer::step(const std::vector<bool> &dones)
+void Viewer::createRenderer()
 {
-    for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
-        if (forceReset)
-            envs[envIdx]->terminateEpisodeOnNextFrame();
+    // only the active env is rendered, it is env 0 to the renderer
+    const std::vector<Env *> activeEnvs{envs[activeEnv].get()};
+    const Magnum::Vector2i fbSize = framebufferSize();
+
+    // release the GPU resources of the previous env before allocating new ones
+    renderer.reset();
+
+    if (useVulkan) {
+#if !defined(CORRADE_TARGET_APPLE)
+        renderer = std::make_unique<V4REnvRenderer>(activeEnvs, fbSize[0], fbSize[1], true, 0);
+#endif
+    } else {
+        renderer = std::make_unique<MagnumEnvRenderer>(activeEnvs, fbSize[0], fbSize[1], withDebugDraw, true, ctx.get());
+        dynamic_cast<MagnumEnvRenderer &>(*renderer).toggleDebugMode();
+    }
+
+    renderer->reset(*envs[activeEnv], 0);
+}
 
-        if (dones[envIdx])
-            renderer->reset(*envs[envIdx], envIdx);
+void Viewer::setActiveEnv(int envIdx)
+{
+    if (envIdx < 0 || envIdx >= int(envs.size())) {
+        TLOG(WARNING) << "Could not switch to env " << envIdx << " (numEnvs is " << envs.size() << ")";
+        return;
     }
 
+    if (envIdx == activeEnv)
+        return;
+
+    activeEnv = envIdx;
+    activeAgent = std::min(activeAgent, envs[activeEnv]->getNumAgents() - 1);
+    createRenderer();
+
+    TLOG(INFO) << "Viewing env " << activeEnv;
+    redraw();
+}
+
+void Viewer::step(const std::vector<bool> &dones)
+{
+    if (forceReset)
+        envs[activeEnv]->terminateEpisodeOnNextFrame();
+
+    if (dones[activeEnv])
+        renderer->reset(*envs[activeEnv], 0);
+
     forceReset = false;
 
     moveOverviewCamera();
@@ -102,16 +149,10 @@ void Viewer::drawEvent()
 {
     if (useVulkan) {
 #if !defined(CORRADE_TARGET_APPLE)
-        for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx)
-            renderer->preDraw(*envs[envIdx], envIdx);
+        renderer->preDraw(*envs[activeEnv], 0);
 
         renderer->draw(envs);
-        auto dataPtr = renderer->getObservation(activeEnv, activeAgent);
-
-        // probably would've been easier to actually draw a quad upside down instead of flipping the texture
-        // but hey, this is not a performance-critical code and it works!
-        cv::Mat mat(height, width, CV_8UC4, (char *) dataPtr);
-        cv::flip(mat, mat, 0);
+        auto dataPtr = renderer->getObservation(0, activeAgent);
 
         Containers::ArrayView<const uint8_t> data(dataPtr, width * height * 4);
         ImageView2D image(PixelFormat::RGBA8Unorm, {width, height}, data);
@@ -125,26 +166,17 @@ void Viewer::drawEvent()
         framebuffer.mapForRead(GL::Framebuffer::ColorAttachment(0));
         framebuffer.attachTexture(GL::Framebuffer::ColorAttachment(0), texture, 0);
 
-        // blit color to window framebuffer
-        GL::defaultFramebuffer.bind();
-        GL::AbstractFramebuffer::blit(framebuffer, GL::defaultFramebuffer, {{}, framebuffer.viewport().size()}, GL::FramebufferBlit::Color);
+        blitTopDown(framebuffer);
 #endif
     } else {
         auto &magnumRenderer = dynamic_cast<MagnumEnvRenderer &>(*renderer);
 
-        for (int envIdx = 0; envIdx < int(envs.size()); ++envIdx) {
-            magnumRenderer.preDraw(*envs[envIdx], envIdx);
-            magnumRenderer.drawAgent(*envs[envIdx], envIdx, activeAgent, false);
-        }
+        magnumRenderer.preDraw(*envs[activeEnv], 0);
+        magnumRenderer.drawAgent(*envs[activeEnv], 0, activeAgent, false);
 
         auto rendererFramebuffer = magnumRenderer.getFramebuffer();
-
-        GL::defaultFramebuffer.bind();
-
         rendererFramebuffer->mapForRead(GL::Framebuffer::ColorAttachment{0});
-
-        // blit color to window framebuffer
-        GL::AbstractFramebuffer::blit(*rendererFramebuffer, GL::defaultFramebuffer, {{}, rendererFramebuffer->viewport().size()}, GL::FramebufferBlit::Color);
+        blitTopDown(*rendererFramebuffer);
     }
 
     swapBuffers();
@@ -157,7 +189,7 @@ void Viewer::keyPressEvent(Platform::Sdl2Application::KeyEvent &event)
     controlOverview(event.key(), true);
 
     auto chgAgent = [this](int idx) {
-        if (idx >= envs[0]->getNumAgents())
+        if (idx >= envs[activeEnv]->getNumAgents())
             TLOG(WARNING) << "Could not switch to agent " << idx << " (greater than numAgents)";
         else
             activeAgent = idx;
@@ -182,6 +214,12 @@ void Viewer::keyPressEvent(Platform::Sdl2Application::KeyEvent &event)
         case KeyEvent::Key::Six:
             chgAgent(5);
             break;
+        case KeyEvent::Key::PageUp:
+            setActiveEnv(activeEnv + 1);
+            break;
+        case KeyEvent::Key::PageDown:
+            setActiveEnv(activeEnv - 1);
+            break;
         case KeyEvent::Key::R:
             forceReset = true;
             break;
@@ -0,0 +1,325 @@
+#include <map>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#include <Corrade/Containers/GrowableArray.h>
+
+#include <Magnum/Timeline.h>
+#include <Magnum/GL/Buffer.h>
+#include <Magnum/GL/Mesh.h>
+#include <Magnum/GL/Renderer.h>
+#include <Magnum/GL/DefaultFramebuffer.h>
+#include <Magnum/Math/Matrix4.h>
+#include <Magnum/MeshTools/Compile.h>
+#include <Magnum/Shaders/Phong.h>
+#include <Magnum/Trade/MeshData.h>
+#include <Magnum/Platform/Sdl2Application.h>
+
+#include <util/tiny_logger.hpp>
+
+#include <env/env_renderer.hpp>
+
+#include <rendering/render_utils.hpp>
+
+#include <viewer/viewer.hpp>
+#include <viewer/viewer_thread.hpp>
+
+
+using namespace Magnum;
+using namespace Magnum::Math::Literals;
+
+using namespace Megaverse;
+
+
+namespace
+{
+
+struct InstanceData
+{
+    Matrix4 transformationMatrix;
+    Matrix3x3 normalMatrix;
+    Color3 color;
+};
+
+/**
+ * Window of ViewerThread, created and destroyed on the viewer thread. Draws the latest snapshot with one instanced
+ * draw call per drawable type.
+ */
+class SnapshotViewer : public Platform::Sdl2Application
+{
+public:
+    SnapshotViewer(const Arguments &arguments, TripleBuffer<RenderSnapshot> &snapshots);
+
+private:
+    void drawEvent() override;
+
+    void keyPressEvent(KeyEvent &event) override;
+
+    void keyReleaseEvent(KeyEvent &event) override;
+
+    void mouseMoveEvent(MouseMoveEvent &event) override;
+
+    void controlCamera(KeyEvent::Key key, bool pressed);
+
+    // world transformation of the camera for this frame
+    Matrix4 cameraTransformation(const RenderSnapshot &snapshot, float dt);
+
+private:
+    TripleBuffer<RenderSnapshot> &snapshots;
+
+    Shaders::Phong shader{NoCreate};
+
+    // created with the GL context, buffers are referenced by the meshes so they are declared first
+    std::map<DrawableType, GL::Buffer> instanceBuffers;
+    std::map<DrawableType, GL::Mesh> meshes;
+    Containers::Array<InstanceData> instances;
+
+    Timeline timeline;
+
+    int activeAgent = 0;
+
+    bool freeCamera = false;
+    Vector3 cameraPosition;
+    float yaw = 0.0f, pitch = -30.0f;
+    Action cameraActions = Action::Idle;
+};
+
+SnapshotViewer::SnapshotViewer(const Arguments &arguments, TripleBuffer<RenderSnapshot> &snapshots)
+: Platform::Sdl2Application{arguments, NoCreate}
+, snapshots{snapshots}
+{
+    Configuration conf;
+    conf.setTitle("MegaverseViewer").setSize({1280, 720});
+    GLConfiguration glConf;
+    glConf.setSampleCount(4);
+
+    if (!tryCreate(conf, glConf)) {
+        TLOG(WARNING) << "Fall back to default MSAA";
+        create(conf, glConf.setSampleCount(0));
+    }
+
+    // frames are paced by ViewerThread
+    setSwapInterval(0);
+
+    GL::Renderer::enable(GL::Renderer::Feature::DepthTest);
+    GL::Renderer::enable(GL::Renderer::Feature::FaceCulling);
+    GL::Renderer::setClearColor(Color3{0.125f});
+
+    shader = Shaders::Phong{Shaders::Phong::Flag::VertexColor | Shaders::Phong::Flag::InstancedTransformation};
+    shader.setShininess(300).setLightPosition({0, 4, 2}).setLightColor(0xaaaaaa_rgbf);
+    shader.setDiffuseColor(0xbbbbbb_rgbf);
+    shader.setAmbientColor(0x555555_rgbf);
+
+    std::map<DrawableType, Trade::MeshData> meshData;
+    initPrimitives(meshData);
+    for (const auto &[drawableType, data] : meshData) {
+        auto &buffer = instanceBuffers.emplace(drawableType, GL::Buffer{}).first->second;
+
+        auto mesh = MeshTools::compile(data);
+        mesh.addVertexBufferInstanced(
+            buffer, 1, 0, Shaders::Phong::TransformationMatrix{}, Shaders::Phong::NormalMatrix{}, Shaders::Phong::Color3{}
+        );
+        meshes.emplace(drawableType, std::move(mesh));
+    }
+
+    timeline.start();
+}
+
+void SnapshotViewer::drawEvent()
+{
+    snapshots.update();
+    const auto &snapshot = snapshots.readSlot();
+
+    GL::defaultFramebuffer.clear(GL::FramebufferClear::Color | GL::FramebufferClear::Depth);
+
+    if (!snapshot.agentCameras.empty()) {
+        auto [fov, near, far, aspectRatio] = freeCamera ? overviewCameraParameters() : agentCameraParameters();
+        aspectRatio = Vector2{windowSize()}.aspectRatio();
+
+        const auto projection = Matrix4::perspectiveProjection(Deg{fov}, aspectRatio, near, far);
+        const auto cameraMatrix = cameraTransformation(snapshot, timeline.previousFrameDuration()).inverted();
+        shader.setProjectionMatrix(projection).setTransformationMatrix(cameraMatrix).setNormalMatrix(cameraMatrix.normalMatrix());
+
+        for (auto &[drawableType, mesh] : meshes) {
+            const auto &snapshotInstances = snapshot.instances[drawableType];
+            if (snapshotInstances.empty())
+                continue;
+
+            arrayResize(instances, Containers::NoInit, snapshotInstances.size());
+            for (size_t i = 0; i < snapshotInstances.size(); ++i) {
+                const auto &t = snapshotInstances[i].transformation;
+                instances[i] = {t, t.normalMatrix(), colorById(snapshotInstances[i].colorId)};
+            }
+
+            instanceBuffers.at(drawableType).setData(instances, GL::BufferUsage::StreamDraw);
+
+            mesh.setInstanceCount(Int(instances.size()));
+            shader.draw(mesh);
+        }
+    }
+
+    swapBuffers();
+    timeline.nextFrame();
+    redraw();
+}
+
+Matrix4 SnapshotViewer::cameraTransformation(const RenderSnapshot &snapshot, float dt)
+{
+    activeAgent = std::min(activeAgent, int(snapshot.agentCameras.size()) - 1);
+    if (!freeCamera)
+        return snapshot.agentCameras[activeAgent];
+
+    const auto rotation = Matrix4::rotationY(Deg{yaw}) * Matrix4::rotationX(Deg{pitch});
+
+    Vector3 moveDirection{};
+    if (!!(cameraActions & Action::Forward))
+        moveDirection -= rotation.backward();
+    else if (!!(cameraActions & Action::Backward))
+        moveDirection += rotation.backward();
+
+    if (!!(cameraActions & Action::Left))
+        moveDirection -= rotation.right();
+    else if (!!(cameraActions & Action::Right))
+        moveDirection += rotation.right();
+
+    if (!!(cameraActions & Action::LookUp))
+        moveDirection += Vector3::yAxis();
+    else if (!!(cameraActions & Action::LookDown))
+        moveDirection -= Vector3::yAxis();
+
+    constexpr float speed = 20.0f;
+    if (moveDirection.length() > FLT_EPSILON)
+        cameraPosition += moveDirection.normalized() * speed * dt;
+
+    return Matrix4::translation(cameraPosition) * rotation;
+}
+
+void SnapshotViewer::keyPressEvent(KeyEvent &event)
+{
+    controlCamera(event.key(), true);
+
+    switch (event.key()) {
+        case KeyEvent::Key::One: activeAgent = 0; break;
+        case KeyEvent::Key::Two: activeAgent = 1; break;
+        case KeyEvent::Key::Three: activeAgent = 2; break;
+        case KeyEvent::Key::Four: activeAgent = 3; break;
+        case KeyEvent::Key::Five: activeAgent = 4; break;
+        case KeyEvent::Key::Six: activeAgent = 5; break;
+        case KeyEvent::Key::O: {
+            freeCamera = !freeCamera;
+            setCursor(freeCamera ? Cursor::HiddenLocked : Cursor::Arrow);
+
+            // free camera starts above and behind the current agent
+            const auto &cameras = snapshots.readSlot().agentCameras;
+            if (freeCamera && !cameras.empty()) {
+                const auto &agentCamera = cameras[std::min(activeAgent, int(cameras.size()) - 1)];
+                cameraPosition = agentCamera.translation() + agentCamera.backward() * 6.0f + Vector3{0, 6, 0};
+                yaw = float(Deg{Rad{std::atan2(agentCamera.backward().x(), agentCamera.backward().z())}});
+                pitch = -30.0f;
+            }
+            break;
+        }
+        case KeyEvent::Key::Esc:
+            setCursor(Cursor::Arrow);
+            exit(0);
+            break;
+        default:
+            break;
+    }
+
+    event.setAccepted();
+}
+
+void SnapshotViewer::keyReleaseEvent(KeyEvent &event)
+{
+    controlCamera(event.key(), false);
+    event.setAccepted();
+}
+
+void SnapshotViewer::mouseMoveEvent(MouseMoveEvent &event)
+{
+    if (!freeCamera)
+        return;
+
+    constexpr float sensitivity = 0.075f;
+    yaw -= sensitivity * float(event.relativePosition().x());
+    pitch = std::clamp(pitch - sensitivity * float(event.relativePosition().y()), -89.0f, 89.0f);
+
+    event.setAccepted();
+}
+
+void SnapshotViewer::controlCamera(KeyEvent::Key key, bool pressed)
+{
+    auto a = Action::Idle;
+
+    switch (key) {
+        case KeyEvent::Key::U: a = Action::Forward; break;
+        case KeyEvent::Key::J: a = Action::Backward; break;
+        case KeyEvent::Key::H: a = Action::Left; break;
+        case KeyEvent::Key::K: a = Action::Right; break;
+        case KeyEvent::Key::LeftShift: a = Action::LookUp; break;
+        case KeyEvent::Key::RightShift: a = Action::LookDown; break;
+        default: break;
+    }
+
+    if (pressed)
+        cameraActions |= a;
+    else
+        cameraActions &= ~a;
+}
+
+}
+
+
+ViewerThread::ViewerThread(int envIdx, float fps)
+: envIdx{envIdx}
+, fps{fps}
+{
+    // SDL supports one application per process, same as Viewer
+    TCHECK(!Viewer::viewerExists);
+    Viewer::viewerExists = true;
+
+    thread = std::thread{[this] { loop(); }};
+}
+
+ViewerThread::~ViewerThread()
+{
+    terminate = true;
+    thread.join();
+
+    Viewer::viewerExists = false;
+}
+
+void ViewerThread::publish(Envs &envs)
+{
+    if (!running)
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now - lastPublish < std::chrono::duration<float>(1.0f / fps))
+        return;
+
+    lastPublish = now;
+    capture.capture(*envs[envIdx], snapshots.writeSlot());
+    snapshots.publish();
+}
+
+void ViewerThread::loop()
+{
+    {
+        static int argc = 1;
+        static const char *argv[] = {"Viewer"};
+        SnapshotViewer app{Platform::Sdl2Application::Arguments{argc, (char **) argv}, snapshots};
+
+        const auto frameDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(1.0f / fps));
+        auto nextFrame = std::chrono::steady_clock::now();
+
+        while (!terminate && app.mainLoopIteration()) {
+            nextFrame += frameDuration;
+            std::this_thread::sleep_until(nextFrame);
+        }
+    }
+
+    running = false;
+}
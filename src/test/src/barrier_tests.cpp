@@ -0,0 +1,45 @@
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <util/barrier.hpp>
+
+
+using namespace Megaverse;
+
+
+TEST(barrier, phases)
+{
+    constexpr int numThreads = 4, numPhases = 1000;
+
+    for (int spinBudget : {0, Barrier::defaultSpinBudget}) {
+        Barrier barrier{numThreads, spinBudget};
+        std::atomic<int> counter{0};
+        std::atomic<bool> ok{true};
+
+        auto func = [&] {
+            for (int phase = 0; phase < numPhases; ++phase) {
+                ++counter;
+                barrier.arriveAndWait();
+
+                // everyone incremented the counter before anyone passed the barrier
+                if (counter.load() < (phase + 1) * numThreads)
+                    ok = false;
+
+                barrier.arriveAndWait();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < numThreads; ++i)
+            threads.emplace_back(func);
+
+        func();
+        for (auto &t : threads)
+            t.join();
+
+        EXPECT_TRUE(ok);
+        EXPECT_EQ(counter, numThreads * numPhases);
+    }
+}
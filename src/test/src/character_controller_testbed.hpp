@@ -0,0 +1,181 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <Magnum/Math/Constants.h>
+
+#include <env/env.hpp>
+#include <env/agent.hpp>
+
+#include <scenarios/const.hpp>
+#include <scenarios/platforms.hpp>
+#include <scenarios/layout_utils.hpp>
+
+
+namespace Megaverse
+{
+
+/// Canned layouts for the character controller tests and benchmarks, a row of platforms along the X axis.
+enum class ControllerLayout
+{
+    Floor,
+    Stairs,
+    Walls,
+    Gaps,
+};
+
+inline const char * controllerLayoutName(ControllerLayout layout)
+{
+    switch (layout) {
+        case ControllerLayout::Stairs: return "stairs";
+        case ControllerLayout::Walls: return "walls";
+        case ControllerLayout::Gaps: return "gaps";
+        default: return "floor";
+    }
+}
+
+/// Positions of all agents after every tick.
+using Trajectories = std::vector<std::vector<Magnum::Vector3>>;
+
+/**
+ * Agents with kinematic controllers in a canned layout, stepped the way Env::step() does it but without a scenario,
+ * rewards or renderers. Every agent walks forward along its own lane with a scripted sequence of jumps, so any two
+ * controllers (i.e. a faster replacement of KinematicCharacterController) can be compared tick by tick.
+ * Layout is made from the obstacle platforms with a fixed seed and unit obstacles (1-voxel steps, walls and gaps).
+ */
+template<typename AgentT = DefaultKinematicAgent>
+class ControllerTestbed
+{
+public:
+    static constexpr int numPlatforms = 8;
+
+public:
+    explicit ControllerTestbed(ControllerLayout layout, int numAgents, uint64_t seed = 42)
+    : layout{layout}
+    , envState{numAgents}
+    {
+        envState.reset();
+
+        const FloatParams params{
+            {Str::obstaclesMinHeight, 1}, {Str::obstaclesMaxHeight, 1},
+            {Str::obstaclesMinGap, 1}, {Str::obstaclesMaxGap, 1},
+        };
+
+        Rng rng{seed};
+        const auto width = std::max(5, 2 * numAgents + 1);
+
+        Boxes boxes;
+        GridTransform anchor;
+        for (int i = 0; i < numPlatforms; ++i) {
+            auto platform = makePlatform(i == 0 ? ControllerLayout::Floor : layout, anchor, rng, params, width);
+            platform->init();
+            platform->generate();
+
+            // platform boxes are half-open, layout boxes include the max voxel
+            for (const auto *v : {&platform->layoutBoxes, &platform->wallBoxes})
+                for (const auto &aabb : *v) {
+                    const auto bb = aabb.boundingBox();
+                    boxes.emplace_back(bb.min, bb.max - VoxelCoords{1, 1, 1});
+                }
+
+            anchor = platform->anchorPoint();
+        }
+
+        addBoundingBoxes(drawables, envState, boxes, VoxelState::generateType(true, true), ColorRgb::LAYOUT_DEFAULT, 1.0f);
+
+        // lanes two voxels apart, facing +X
+        for (int i = 0; i < numAgents; ++i) {
+            const Magnum::Vector3 position{1.5f, 1.0f, 1.5f + 2.0f * float(i)};
+            auto &agent = envState.scene->addChild<AgentT>(envState.scene.get(), envState.physics->bWorld, position, -Magnum::Constants::piHalf(), 0.0f);
+            envState.agents.emplace_back(&agent);
+        }
+    }
+
+    ~ControllerTestbed()
+    {
+        for (auto &d : drawables)
+            d.clear();
+    }
+
+    /// Controls of agent #agentIdx at tick #tickIdx: always forward, jumps in every layout except the flat floor.
+    AgentControls controls(int agentIdx, int tickIdx) const
+    {
+        AgentControls c;
+        c.forward = 1.0f;
+        c.jump = layout != ControllerLayout::Floor && (tickIdx + 3 * agentIdx) % 12 == 0;
+        return c;
+    }
+
+    void tick()
+    {
+        const auto dt = envState.simulationStepSeconds;
+
+        for (int i = 0; i < int(envState.agents.size()); ++i)
+            envState.agents[i]->applyControls(controls(i, numTicks), dt);
+
+        envState.physics->bWorld.stepKinematicOnly(dt, 1, dt);
+
+        for (auto agent : envState.agents)
+            agent->updateTransform();
+
+        ++numTicks;
+    }
+
+    std::vector<Magnum::Vector3> positions() const
+    {
+        std::vector<Magnum::Vector3> p;
+        for (auto agent : envState.agents)
+            p.emplace_back(agent->transformation().translation());
+
+        return p;
+    }
+
+    int getNumTicks() const { return numTicks; }
+
+private:
+    static std::unique_ptr<Platform> makePlatform(ControllerLayout layout, const GridTransform &parent, Rng &rng, const FloatParams &params, int width)
+    {
+        const auto walls = WALLS_EAST | WALLS_WEST;
+
+        switch (layout) {
+            case ControllerLayout::Stairs: return std::make_unique<StepPlatform>(parent, rng, walls, params, width);
+            case ControllerLayout::Walls: return std::make_unique<WallPlatform>(parent, rng, walls, params, width);
+            case ControllerLayout::Gaps: return std::make_unique<GapPlatform>(parent, rng, walls, params, width);
+            default: return std::make_unique<EmptyPlatform>(parent, rng, walls, params, width);
+        }
+    }
+
+private:
+    ControllerLayout layout;
+    Env::EnvState envState;
+    DrawablesMap drawables;
+    int numTicks = 0;
+};
+
+template<typename AgentT = DefaultKinematicAgent>
+Trajectories recordTrajectories(ControllerLayout layout, int numAgents, int numTicks, uint64_t seed = 42)
+{
+    ControllerTestbed<AgentT> testbed{layout, numAgents, seed};
+
+    Trajectories trajectories;
+    for (int i = 0; i < numTicks; ++i) {
+        testbed.tick();
+        trajectories.emplace_back(testbed.positions());
+    }
+
+    return trajectories;
+}
+
+/// Largest distance between the positions of the same agent at the same tick, to check a controller against another one.
+inline float maxDeviation(const Trajectories &a, const Trajectories &b)
+{
+    float deviation = 0;
+    for (size_t t = 0; t < std::min(a.size(), b.size()); ++t)
+        for (size_t i = 0; i < std::min(a[t].size(), b[t].size()); ++i)
+            deviation = std::max(deviation, (a[t][i] - b[t][i]).length());
+
+    return deviation;
+}
+
+}
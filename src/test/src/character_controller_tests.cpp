@@ -0,0 +1,29 @@
+#include <gtest/gtest.h>
+
+#include "character_controller_testbed.hpp"
+
+
+using namespace Megaverse;
+
+
+TEST(characterController, deterministic)
+{
+    for (auto layout : {ControllerLayout::Floor, ControllerLayout::Stairs, ControllerLayout::Walls, ControllerLayout::Gaps}) {
+        const auto a = recordTrajectories(layout, 4, 60), b = recordTrajectories(layout, 4, 60);
+        ASSERT_EQ(a.size(), 60u);
+        EXPECT_EQ(maxDeviation(a, b), 0.0f) << controllerLayoutName(layout);
+    }
+}
+
+TEST(characterController, floor)
+{
+    const auto trajectories = recordTrajectories(ControllerLayout::Floor, 2, 30);
+
+    const auto &start = trajectories.front(), &end = trajectories.back();
+    for (size_t i = 0; i < start.size(); ++i) {
+        // walks along its lane and stays on the floor
+        EXPECT_GT(end[i].x(), start[i].x() + 1.0f);
+        EXPECT_NEAR(end[i].z(), start[i].z(), 0.01f);
+        EXPECT_NEAR(end[i].y(), start[i].y(), 0.1f);
+    }
+}
@@ -1,10 +1,28 @@
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <thread>
+#include <algorithm>
+
+#include <unistd.h>
+
 #include <gtest/gtest.h>
 
 #include <Magnum/GL/Context.h>
 
 #include <env/env.hpp>
+#include <env/episode_dataset.hpp>
+#include <env/batched_kinematics.hpp>
+#include <env/vector_env_server.hpp>
+#include <env/trajectory_recorder.hpp>
 #include <scenarios/init.hpp>
 
+#include <batched_env/batched_env.hpp>
+
 #include <magnum_rendering/magnum_env_renderer.hpp>
 
 
@@ -22,6 +40,35 @@ TEST_F(EnvTest, env)
     Env env{"TowerBuilding"};
 }
 
+TEST_F(EnvTest, sharedCollisionShapes)
+{
+    auto a = CollisionShapeCache::box({1, 2, 3}), b = CollisionShapeCache::box({1, 2, 3});
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, CollisionShapeCache::unitBox());
+    EXPECT_TRUE(CollisionShapeCache::isShared(a));
+
+    // resets reuse the shapes from the previous episodes
+    Env env{"ObstaclesHard"};
+    env.seed(42), env.reset();
+    const auto numShapes = CollisionShapeCache::numShapes();
+    env.seed(42), env.reset();
+    EXPECT_EQ(CollisionShapeCache::numShapes(), numShapes);
+    EXPECT_TRUE(env.getPhysics().collisionShapes.empty());
+}
+
+TEST_F(EnvTest, memoryReport)
+{
+    Env env{"ObstaclesEasy"};
+    env.seed(42), env.reset();
+
+    MemoryReport report;
+    env.memoryReport(report);
+    EXPECT_GT(report.get("voxel_grid"), 0u);
+    EXPECT_GT(report.get("physics.objects"), 0u);
+    EXPECT_GT(report.get("scene_graph"), 0u);
+    EXPECT_GT(BulletMemory::counter().liveBytes(), 0u);
+}
+
 TEST_F(EnvTest, multipleEnvs)
 {
     Envs envs;
@@ -39,3 +86,604 @@ TEST_F(EnvTest, multipleEnvs)
     for (int i = 0; i < 3; ++i)
         renderer.draw(envs);
 }
+
+TEST_F(EnvTest, snapshotRestore)
+{
+    const auto rollout = [](Env &env, int numSteps) {
+        std::vector<Magnum::Vector3> positions;
+        for (int i = 0; i < numSteps; ++i) {
+            for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+                env.setAction(agentIdx, (i / 5 + agentIdx) % 2 ? Action::Forward | Action::LookLeft : Action::Right | Action::Jump);
+            env.step();
+
+            for (auto agent : env.getAgents())
+                positions.emplace_back(agent->absoluteTransformation().translation());
+        }
+        return positions;
+    };
+
+    // contact pairs may be processed in a different order after the resync, so allow for rounding differences
+    const auto expectSame = [](const std::vector<Magnum::Vector3> &a, const std::vector<Magnum::Vector3> &b) {
+        ASSERT_EQ(a.size(), b.size());
+        for (size_t i = 0; i < a.size(); ++i)
+            EXPECT_LT((a[i] - b[i]).length(), 1e-3f);
+    };
+
+    Env env{"Empty", 2};
+    env.seed(42), env.reset();
+    rollout(env, 7);
+
+    StateBuffer snapshot;
+    ASSERT_TRUE(env.saveState(snapshot));
+    const auto episodeId = env.episodeId();
+
+    const auto expected = rollout(env, 30);
+
+    ASSERT_TRUE(env.restoreState(snapshot));
+    EXPECT_EQ(env.episodeId(), episodeId);
+    expectSame(rollout(env, 30), expected);
+
+    // snapshots of other episodes are restored on a regenerated layout
+    env.reset();
+    ASSERT_TRUE(env.restoreState(snapshot));
+    EXPECT_NE(env.episodeId(), episodeId);
+    expectSame(rollout(env, 30), expected);
+
+    Env other{"TowerBuilding", 2};
+    other.reset();
+    EXPECT_FALSE(other.restoreState(snapshot));
+
+    StateBuffer unsupported;
+    EXPECT_FALSE(other.saveState(unsupported));
+}
+
+TEST_F(EnvTest, clone)
+{
+    const auto step = [](Env &env, int i) {
+        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+            env.setAction(agentIdx, (i / 5 + agentIdx) % 2 ? Action::Forward | Action::LookLeft : Action::Right);
+        env.step();
+    };
+
+    Env source{"Empty", 2}, target{"Empty", 2};
+    source.reset(), target.reset();
+
+    for (int fork = 0; fork < 2; ++fork) {
+        for (int i = 0; i < 10; ++i)
+            step(source, i), step(target, 20 - i);
+
+        const auto targetEpisode = target.episodeId();
+        ASSERT_TRUE(source.clone(target));
+
+        // the layout is regenerated only once per source episode
+        EXPECT_EQ(target.layoutEpisodeId(), source.episodeId());
+        if (fork > 0)
+            EXPECT_EQ(target.episodeId(), targetEpisode);
+
+        for (int i = 0; i < 15; ++i) {
+            step(source, i), step(target, i);
+            for (int agentIdx = 0; agentIdx < source.getNumAgents(); ++agentIdx) {
+                const auto a = source.getAgents()[agentIdx]->absoluteTransformation().translation();
+                const auto b = target.getAgents()[agentIdx]->absoluteTransformation().translation();
+                EXPECT_LT((a - b).length(), 1e-3f);
+            }
+        }
+    }
+
+    Env other{"TowerBuilding", 2};
+    other.reset();
+    EXPECT_FALSE(source.clone(other));
+}
+
+TEST_F(EnvTest, sharedPhysicsResources)
+{
+    const auto resources = std::make_shared<PhysicsResources>(true);
+
+    std::vector<std::unique_ptr<Env>> shared, separate;
+    for (int i = 0; i < 3; ++i) {
+        shared.emplace_back(std::make_unique<Env>("ObstaclesEasy", 2));
+        separate.emplace_back(std::make_unique<Env>("ObstaclesEasy", 2));
+        ASSERT_TRUE(shared.back()->setPhysicsResources(resources));
+
+        shared.back()->seed(42, i), separate.back()->seed(42, i);
+        shared.back()->reset(), separate.back()->reset();
+    }
+
+    // worlds stay independent, envs on shared resources behave exactly like the ones with their own
+    for (int step = 0; step < 100; ++step) {
+        for (int i = 0; i < 3; ++i) {
+            for (auto env : {shared[i].get(), separate[i].get()}) {
+                for (int agentIdx = 0; agentIdx < env->getNumAgents(); ++agentIdx)
+                    env->setAction(agentIdx, (step / 7 + agentIdx + i) % 2 ? Action::Forward | Action::Jump : Action::Left);
+                env->step();
+                if (env->isDone())
+                    env->reset();
+            }
+
+            for (int agentIdx = 0; agentIdx < shared[i]->getNumAgents(); ++agentIdx) {
+                const auto a = shared[i]->getAgents()[agentIdx]->absoluteTransformation().translation();
+                const auto b = separate[i]->getAgents()[agentIdx]->absoluteTransformation().translation();
+                EXPECT_LT((a - b).length(), 1e-4f);
+            }
+        }
+    }
+
+    EXPECT_FALSE(shared.front()->setPhysicsResources(std::make_shared<PhysicsResources>()));
+
+    // envs can go away in any order, the resources live as long as one of them
+    shared.erase(shared.begin());
+    shared.back()->step();
+}
+
+TEST_F(EnvTest, axisSweepBroadphase)
+{
+    Env env{"ObstaclesEasy", 2, {{Str::axisSweepBroadphase, 1.0f}}};
+    env.reset();
+    EXPECT_EQ(env.getPhysics().broadphaseOptions.type, BroadphaseType::AxisSweep);
+
+    for (int i = 0; i < 200; ++i) {
+        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+            env.setAction(agentIdx, i % 3 ? Action::Forward : Action::LookLeft | Action::Jump);
+        env.step();
+        if (env.isDone())
+            env.reset();
+    }
+
+    // the world is reused between episodes with the same broadphase
+    env.reset();
+    EXPECT_EQ(env.getPhysics().broadphaseOptions.type, BroadphaseType::AxisSweep);
+    EXPECT_GT(env.getPhysics().bWorld.getNumCollisionObjects(), 0);
+}
+
+TEST_F(EnvTest, trajectoryRecorder)
+{
+    const std::string filename = "trajectory_test.mgtr";
+
+    Envs envs;
+    envs.emplace_back(std::make_unique<Env>("Empty", 2));
+    auto &env = *envs.front();
+    env.seed(42), env.reset();
+
+    const std::vector<Action> actions{Action::Forward | Action::LookLeft, Action::Right | Action::Jump};
+    constexpr int numSteps = 20;
+    {
+        TrajectoryRecorder recorder{filename, envs, 256};
+        ASSERT_TRUE(recorder.isOpen());
+
+        recorder.recordEpisodeStart(0, env);
+        recorder.endFrame();
+
+        for (int i = 0; i < numSteps; ++i) {
+            for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+                env.setAction(agentIdx, actions[agentIdx]);
+            env.step();
+
+            const std::vector<float> rewards{env.getLastReward(0), env.getLastReward(1)};
+            recorder.recordStep(0, env, actions.data(), rewards.data(), env.isDone());
+            recorder.endFrame();
+        }
+    }
+
+    TrajectoryReader reader{filename};
+    ASSERT_TRUE(reader.isOpen());
+    EXPECT_EQ(reader.getMetadata().scenario, env.getScenarioName());
+    EXPECT_EQ(reader.getMetadata().numAgents, std::vector<int>{2});
+
+    // a regenerated episode with the recorded poses applied matches the final state of the env
+    Env replay{"Empty", 2};
+    std::vector<Object3D *> objects;
+
+    int numStepRecords = 0;
+    TrajectoryReader::Record record;
+    while (reader.next(record)) {
+        if (record.type == TrajectoryRecorder::EPISODE) {
+            EXPECT_EQ(record.layoutSeed, env.getLayoutSeed());
+            replay.resetWithLayoutSeed(record.layoutSeed);
+            sceneObjectsInOrder(replay.getScene(), objects);
+        } else if (record.type == TrajectoryRecorder::STEP) {
+            ++numStepRecords;
+            EXPECT_EQ(record.actions, actions);
+        }
+
+        for (const auto &[idx, transform] : record.transforms)
+            objects[idx]->setTransformation(transform);
+    }
+
+    EXPECT_EQ(numStepRecords, numSteps);
+
+    std::vector<Object3D *> expected;
+    sceneObjectsInOrder(env.getScene(), expected);
+    ASSERT_EQ(objects.size(), expected.size());
+    for (size_t i = 0; i < objects.size(); ++i)
+        EXPECT_EQ(objects[i]->transformationMatrix(), expected[i]->transformationMatrix());
+
+    std::remove(filename.c_str());
+}
+
+TEST_F(EnvTest, physicsWorkers)
+{
+    WorkerPool workers{3};
+
+    Env env{"Empty", 8, FloatParams{{Str::voxelAgentController, 1.0f}}};
+    env.setPhysicsWorkers(&workers);
+    env.seed(42), env.reset();
+
+    std::vector<Magnum::Vector3> start;
+    for (auto agent : env.getAgents())
+        start.emplace_back(agent->absoluteTransformation().translation());
+
+    for (int i = 0; i < 20; ++i) {
+        for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+            env.setAction(agentIdx, Action::Forward);
+        env.step();
+    }
+
+    EXPECT_GT(workers.numParallelJobs() + workers.numInlineJobs(), 0u);
+    for (int agentIdx = 0; agentIdx < env.getNumAgents(); ++agentIdx)
+        EXPECT_GT((env.getAgents()[agentIdx]->absoluteTransformation().translation() - start[agentIdx]).length(), 0.5f);
+
+    env.setPhysicsWorkers(nullptr);
+}
+
+TEST_F(EnvTest, batchedKinematics)
+{
+    Envs envs;
+    envs.emplace_back(std::make_unique<Env>("Collect", 2, FloatParams{{Str::voxelAgentController, 1.0f}}));
+    envs.emplace_back(std::make_unique<Env>("Collect", 2));
+    for (auto &env : envs)
+        env->seed(42), env->reset();
+
+    BatchedKinematics kinematics{envs};
+    ASSERT_EQ(kinematics.numAgentsTotal(), 4);
+    ASSERT_TRUE(kinematics.syncEnv(0, *envs[0]));
+    EXPECT_FALSE(kinematics.syncEnv(1, *envs[1]));
+
+    // same view as the camera of the agent
+    for (int agentIdx = 0; agentIdx < 2; ++agentIdx) {
+        const auto expected = envs[0]->getAgents()[agentIdx]->getCamera()->cameraMatrix();
+        const auto *view = kinematics.getCameraViews() + agentIdx * BatchedKinematics::viewFloats;
+        for (int i = 0; i < BatchedKinematics::viewFloats; ++i)
+            EXPECT_NEAR(view[i], expected.data()[i], 1e-4f);
+    }
+
+    // agents spawn above the floor and land
+    std::vector<KinematicControls> controls(4);
+    uint8_t events = 0;
+    for (int i = 0; i < 30; ++i) {
+        kinematics.step(controls.data(), 1.0f / 15, 2);
+        events |= kinematics.getEvents()[0];
+    }
+
+    EXPECT_TRUE(events & KINEMATIC_LANDED);
+    const auto landed = kinematics.getAgentStates()[0];
+    ASSERT_TRUE(landed.grounded);
+
+    kinematics.step(controls.data(), 1.0f / 15, 2);
+    EXPECT_EQ(kinematics.getEvents()[0], 0);
+    EXPECT_FLOAT_EQ(kinematics.getAgentStates()[0].position[1], landed.position[1]);
+
+    // walking along the heading on the floor
+    controls[0].forward = 1;
+    events = 0;
+    for (int i = 0; i < 5; ++i) {
+        kinematics.step(controls.data(), 1.0f / 15, 2);
+        events |= kinematics.getEvents()[0];
+    }
+
+    const auto walked = kinematics.getAgentStates()[0];
+    EXPECT_FLOAT_EQ(walked.position[1], landed.position[1]);
+    if (!(events & KINEMATIC_HIT_WALL)) {
+        const float dx = walked.position[0] - landed.position[0], dz = walked.position[2] - landed.position[2];
+        EXPECT_GT(-dx * std::sin(landed.yaw) - dz * std::cos(landed.yaw), 0.5f);
+    }
+
+    float view[BatchedKinematics::viewFloats];
+    kinematicCameraView(KinematicParams{}, walked, view);
+    for (int i = 0; i < BatchedKinematics::viewFloats; ++i)
+        EXPECT_FLOAT_EQ(kinematics.getCameraViews()[i], view[i]);
+
+    // agents of envs that were not synced don't collide with anything and fall
+    EXPECT_LT(kinematics.getAgentStates()[2].position[1], -10.0f);
+}
+
+TEST_F(EnvTest, episodeDataset)
+{
+    const std::string filename = "episode_dataset_test.bin";
+
+    Env baker{"ObstaclesEasy", 2};
+    baker.seed(42);
+    ASSERT_TRUE(EpisodeDataset::bake(baker, 4, filename));
+
+    const auto dataset = EpisodeDataset::load(filename);
+    ASSERT_TRUE(dataset);
+    ASSERT_GT(dataset->size(), 0u);
+    EXPECT_LE(dataset->size(), 4u);
+    EXPECT_EQ(dataset->find(dataset->layoutSeed(0)), 0);
+
+    Env mismatch{"ObstaclesEasy", 1};
+    EXPECT_FALSE(mismatch.setEpisodeDataset(dataset));
+
+    // instantiated episodes are the generated ones, including the random sequence that follows the layout
+    Env env{"ObstaclesEasy", 2}, generated{"ObstaclesEasy", 2};
+    ASSERT_TRUE(env.setEpisodeDataset(dataset));
+
+    std::vector<Object3D *> objects, expected;
+    for (uint64_t episode = 0; episode < dataset->size(); ++episode) {
+        env.resetToEpisode(episode);
+        EXPECT_EQ(env.getLayoutSeed(), dataset->layoutSeed(episode));
+
+        generated.resetWithLayoutSeed(env.getLayoutSeed());
+        EXPECT_EQ(env.getRng(), generated.getRng());
+
+        sceneObjectsInOrder(env.getScene(), objects);
+        sceneObjectsInOrder(generated.getScene(), expected);
+        ASSERT_EQ(objects.size(), expected.size());
+        for (size_t i = 0; i < objects.size(); ++i)
+            EXPECT_EQ(objects[i]->transformationMatrix(), expected[i]->transformationMatrix());
+    }
+
+    // offset of the first entry (after the 24-byte header and the padded key), wraps around when its size is added
+    {
+        const auto entryOffset = 24 + (EpisodeDataset::datasetKey(baker).size() + 7) / 8 * 8 + 8;
+        std::fstream file{filename, std::ios::in | std::ios::out | std::ios::binary};
+        const uint64_t corruptOffset = ~uint64_t(0) - 8;
+        file.seekp(std::streamoff(entryOffset));
+        file.write(reinterpret_cast<const char *>(&corruptOffset), sizeof(corruptOffset));
+    }
+    EXPECT_FALSE(EpisodeDataset::load(filename));
+
+    std::remove(filename.c_str());
+}
+
+TEST_F(EnvTest, incrementalReset)
+{
+    Env env{"ObstaclesEasy", 2}, expected{"ObstaclesEasy", 2};
+    env.seed(42), expected.seed(42);
+    env.reset(), expected.reset();
+
+    std::vector<Object3D *> objects, expectedObjects;
+    for (int episode = 0; episode < 3; ++episode) {
+        // a zero budget runs one stage per call
+        env.beginReset();
+        int numCalls = 1;
+        while (!env.continueReset(0))
+            ++numCalls;
+        EXPECT_EQ(numCalls, Env::numResetStages);
+        EXPECT_FALSE(env.resetInProgress());
+
+        expected.reset();
+        EXPECT_EQ(env.getLayoutSeed(), expected.getLayoutSeed());
+        EXPECT_EQ(env.getRng(), expected.getRng());
+
+        sceneObjectsInOrder(env.getScene(), objects);
+        sceneObjectsInOrder(expected.getScene(), expectedObjects);
+        ASSERT_EQ(objects.size(), expectedObjects.size());
+        for (size_t i = 0; i < objects.size(); ++i)
+            EXPECT_EQ(objects[i]->transformationMatrix(), expectedObjects[i]->transformationMatrix());
+
+        for (int i = 0; i < 10; ++i)
+            env.step(), expected.step();
+    }
+
+    // a regular reset abandons the one in progress
+    env.beginReset();
+    env.continueReset(0);
+    env.reset();
+    EXPECT_FALSE(env.resetInProgress());
+}
+
+TEST_F(EnvTest, batchedEnv)
+{
+    constexpr int numEnvs = 2, numAgents = 2;
+    BatchedEnv env{"Empty", 64, 36, numEnvs, numAgents, 1, false, {}};
+
+    // symbolic observations need no GPU
+    SymbolicObservationOptions options;
+    options.radius = 3;
+    ASSERT_TRUE(env.setSymbolicObservations(options));
+    EXPECT_EQ(env.observationShape(), (std::vector<int>{options.layers(), 7, 7, SymbolicObservationOptions::channels}));
+
+    env.seed(42), env.reset();
+
+    const auto numActionSpaces = int(Env::actionSpaceSizes.size());
+    std::vector<int32_t> actions(numEnvs * numAgents * numActionSpaces, 0);
+    EXPECT_FALSE(env.setActionsBatched(actions.data(), numEnvs * numAgents - 1, numActionSpaces));
+
+    // out of range actions are rejected before any is set
+    actions.back() = Env::actionSpaceSizes.back();
+    EXPECT_FALSE(env.setActionsBatched(actions.data(), numEnvs * numAgents, numActionSpaces));
+    actions.back() = -1;
+    EXPECT_FALSE(env.setActionsBatched(actions.data(), numEnvs * numAgents, numActionSpaces));
+    actions.back() = 0;
+
+    EXPECT_FALSE(env.setActions(0, 0, {1}));
+    EXPECT_FALSE(env.setActions(0, numAgents, std::vector<int>(numActionSpaces, 0)));
+    EXPECT_FALSE(env.setActions(0, 0, std::vector<int>(numActionSpaces, 100)));
+    EXPECT_TRUE(env.setActions(0, 0, std::vector<int>(numActionSpaces, 1)));
+
+    for (int i = 0; i < 10; ++i) {
+        actions[0] = i % Env::actionSpaceSizes[0];
+        ASSERT_TRUE(env.setActionsBatched(actions.data(), numEnvs * numAgents, numActionSpaces));
+        env.stepAsync();
+        env.stepWait();
+
+        ASSERT_NE(env.getObservationsBatch(), nullptr);
+        ASSERT_NE(env.getRewards(), nullptr);
+        for (int envIdx = 0; envIdx < numEnvs; ++envIdx)
+            EXPECT_EQ(bool(env.getDones()[envIdx]), env.isDone(envIdx));
+    }
+
+    // batched reward shaping is picked up by the next step, NaN keeps the current value, unknown rewards are ignored
+    const std::vector<std::string> rewardNames{Str::teamSpirit, "noSuchReward"};
+    const auto nan = std::numeric_limits<float>::quiet_NaN();
+    const std::vector<float> values{0.1f, 1, 0.2f, 1, 0.3f, 1, nan, 1};
+    EXPECT_FALSE(env.setRewardShapingBatched(rewardNames, values.data(), numEnvs * numAgents - 1));
+    ASSERT_TRUE(env.setRewardShapingBatched(rewardNames, values.data(), numEnvs * numAgents));
+    EXPECT_EQ(env.getRewardShaping(0, 1).at(Str::teamSpirit), 0.0f);
+
+    env.step();
+    EXPECT_FLOAT_EQ(env.getRewardShaping(0, 1).at(Str::teamSpirit), 0.2f);
+    EXPECT_FLOAT_EQ(env.getRewardShaping(1, 0).at(Str::teamSpirit), 0.3f);
+    EXPECT_EQ(env.getRewardShaping(1, 1).at(Str::teamSpirit), 0.0f);
+    EXPECT_EQ(env.getRewardShaping(1, 1).count("noSuchReward"), 0u);
+
+    env.close();
+}
+
+TEST_F(EnvTest, envPool)
+{
+    constexpr int numEnvs = 3, numAgents = 2;
+    BatchedEnv env{"Empty", 64, 36, numEnvs, numAgents, 2, false, {}};
+
+    SymbolicObservationOptions options;
+    options.radius = 3;
+    ASSERT_TRUE(env.setSymbolicObservations(options));
+    env.seed(42), env.reset();
+
+    const auto numActionSpaces = int(Env::actionSpaceSizes.size());
+    const std::vector<int32_t> actions(numEnvs * numAgents * numActionSpaces, 0);
+
+    const int first[] = {0}, duplicate[] = {1, 1}, inFlight[] = {2, 0}, rest[] = {1, 2};
+    ASSERT_TRUE(env.send(first, 1, actions.data(), numActionSpaces));
+
+    // rejected as a whole, nothing of it is queued
+    EXPECT_FALSE(env.send(first, 1, actions.data(), numActionSpaces));
+    EXPECT_FALSE(env.send(duplicate, 2, actions.data(), numActionSpaces));
+    EXPECT_FALSE(env.send(inFlight, 2, actions.data(), numActionSpaces));
+
+    const auto received = env.recv(1);
+    ASSERT_EQ(received, std::vector<int>{0});
+
+    ASSERT_TRUE(env.send(rest, 2, actions.data(), numActionSpaces));
+    ASSERT_TRUE(env.send(first, 1, actions.data(), numActionSpaces));
+    EXPECT_EQ(env.recv(3).size(), 3u);
+
+    env.close();
+}
+
+TEST_F(EnvTest, tcpServer)
+{
+    constexpr int numEnvs = 4, numAgents = 2;
+    BatchedEnv env{"Empty", 64, 36, numEnvs, numAgents, 2, false, {}};
+
+    SymbolicObservationOptions options;
+    options.radius = 3;
+    ASSERT_TRUE(env.setSymbolicObservations(options));
+    env.seed(42), env.reset();
+
+    const auto port = 40000 + int(getpid() % 20000);
+    std::thread server{[&] { env.serve("tcp://:" + std::to_string(port), 2); }};
+
+    // one raw and one compressed slice, the server only starts once both are connected
+    std::vector<std::unique_ptr<VectorEnvTcpClient>> clients;
+    for (int slice = 0; slice < 2; ++slice) {
+        for (int attempt = 0; attempt < 100; ++attempt) {
+            auto client = std::make_unique<VectorEnvTcpClient>("127.0.0.1", port, slice, slice == 1);
+            if (client->isOpen()) {
+                clients.push_back(std::move(client));
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+
+        ASSERT_EQ(int(clients.size()), slice + 1);
+    }
+
+    for (auto &client : clients) {
+        ASSERT_TRUE(client->waitForReset());
+        EXPECT_EQ(client->numEnvs(), numEnvs / 2);
+        EXPECT_EQ(client->numAgents(), numEnvs / 2 * numAgents);
+    }
+
+    // both slices in flight at once
+    for (int i = 0; i < 20; ++i) {
+        for (auto &client : clients) {
+            std::fill_n(client->actions(), client->numAgents(), int32_t(i % 2 ? Action::Forward : Action::Left));
+            ASSERT_TRUE(client->stepAsync());
+        }
+
+        for (auto &client : clients) {
+            ASSERT_TRUE(client->stepWait());
+
+            // the compressed slice decodes to the same kind of frames
+            const auto sliceBytes = client->getHeader().obsBytesPerAgent * size_t(client->numAgents());
+            EXPECT_TRUE(std::any_of(client->observations(), client->observations() + sliceBytes, [](uint8_t v) { return v != 0; }));
+        }
+    }
+
+    clients[0]->terminate();
+    server.join();
+    EXPECT_FALSE(clients[1]->stepAsync() && clients[1]->stepWait());
+
+    env.close();
+}
+
+TEST_F(EnvTest, tcpServerInvalidAction)
+{
+    BatchedEnv env{"Empty", 64, 36, 2, 1, 1, false, {}};
+
+    SymbolicObservationOptions options;
+    options.radius = 3;
+    ASSERT_TRUE(env.setSymbolicObservations(options));
+    env.seed(42), env.reset();
+
+    const auto port = 40000 + int((getpid() + 1) % 20000);
+    std::thread server{[&] { env.serve("tcp://:" + std::to_string(port), 1); }};
+
+    std::unique_ptr<VectorEnvTcpClient> client;
+    for (int attempt = 0; attempt < 100 && !(client && client->isOpen()); ++attempt) {
+        client = std::make_unique<VectorEnvTcpClient>("127.0.0.1", port, 0, false);
+        if (!client->isOpen())
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ASSERT_TRUE(client->isOpen());
+    ASSERT_TRUE(client->waitForReset());
+
+    // a bit outside of the action space closes the connection and stops the server
+    std::fill_n(client->actions(), client->numAgents(), int32_t(1) << 20);
+    client->stepAsync();
+    EXPECT_FALSE(client->stepWait());
+    server.join();
+
+    env.close();
+}
+
+TEST_F(EnvTest, vectorEnvClientChecksSegment)
+{
+    const std::string name = "/megaverse_layout_test_" + std::to_string(getpid());
+
+    // a segment as published by a VectorEnvServer with 2 envs of one agent each, at most size bytes of it
+    const auto publish = [&](size_t size) {
+        VectorEnvShmHeader layout{};
+        layout.numEnvs = 2, layout.numAgents = 2, layout.obsBytesPerAgent = 4 * 4 * 3;
+        const auto fullSize = layout.computeLayout();
+
+        auto shm = SharedMemory::create(name, std::min(size, fullSize));
+        auto h = new (shm.data()) VectorEnvShmHeader{};
+        h->numEnvs = 2, h->numAgents = 2, h->numSlices = 1;
+        h->obsW = 4, h->obsH = 4, h->obsChannels = 3;
+        h->obsBytesPerAgent = layout.obsBytesPerAgent;
+        h->computeLayout();
+        if (size >= fullSize) {
+            const int32_t agentOffsets[] = {0, 1, 2};
+            memcpy(shm.data() + h->agentOffsetsOffset, agentOffsets, sizeof(agentOffsets));
+        }
+        h->magic = VectorEnvShmHeader::magicValue;
+        return shm;
+    };
+
+    {
+        auto shm = publish(std::numeric_limits<size_t>::max());
+        VectorEnvClient client{name, 0};
+        ASSERT_TRUE(client.isOpen());
+        EXPECT_EQ(client.numAgents(), 2);
+    }
+
+    {
+        // the header claims buffers past the end of the segment
+        auto shm = publish(sizeof(VectorEnvShmHeader) + 64);
+        VectorEnvClient client{name, 0};
+        EXPECT_FALSE(client.isOpen());
+    }
+}
@@ -1,7 +1,12 @@
 #include <gtest/gtest.h>
 
+#include <rendering/culling.hpp>
+#include <rendering/render_utils.hpp>
+#include <rendering/transform_cache.hpp>
+
 #include <magnum_rendering/rendering_context.hpp>
 
+using namespace Magnum;
 using namespace Megaverse;
 
 
@@ -11,3 +16,115 @@ TEST(gfx, context)
     constexpr int device = 0;
     WindowlessContext context{device};
 }
+
+TEST(gfx, convertObservations)
+{
+    // 2x2 RGBA frame, downsampled into a single pixel
+    const std::vector<uint8_t> rgba{
+        10, 20, 30, 255,   30, 40, 50, 255,
+        50, 60, 70, 255,   70, 80, 90, 255,
+    };
+
+    ObservationOptions options;
+    options.format = ObservationFormat::RGB8;
+    options.downsample = 2;
+    EXPECT_EQ(options.bytesPerFrame(2, 2), 3u);
+
+    std::vector<uint8_t> rgb(options.bytesPerFrame(2, 2));
+    convertObservations(rgba.data(), 2, 2, 1, options, rgb.data());
+    EXPECT_EQ(rgb, (std::vector<uint8_t>{40, 50, 60}));
+
+    options.format = ObservationFormat::Gray8;
+    options.downsample = 1;
+    std::vector<uint8_t> gray(options.bytesPerFrame(2, 2));
+    convertObservations(rgba.data(), 2, 2, 1, options, gray.data());
+    EXPECT_EQ(gray[0], 18);  // 0.299 * 10 + 0.587 * 20 + 0.114 * 30
+    EXPECT_EQ(gray[3], 78);
+
+    options.format = ObservationFormat::BGR8;
+    std::vector<uint8_t> bgr(options.bytesPerFrame(2, 2));
+    convertObservations(rgba.data(), 2, 2, 1, options, bgr.data());
+    EXPECT_EQ(bgr, (std::vector<uint8_t>{30, 20, 10,  50, 40, 30,  70, 60, 50,  90, 80, 70}));
+}
+
+TEST(gfx, drawHud)
+{
+    // left half of the bottom row of a 4x2 frame
+    EXPECT_EQ(hudPixelRect({{-1, -1}, {0, 0}}, 4, 2), (Range2Di{{0, 1}, {2, 2}}));
+    EXPECT_TRUE(hudPixelRect({{2, 2}, {3, 3}}, 4, 2).size().isZero());
+
+    std::vector<uint8_t> rgba(4 * 2 * 4, 0);
+    drawHud({{{{-1, -1}, {0, 0}}, Color3{1, 0, 0}}}, rgba.data(), 4, 2);
+    EXPECT_EQ(rgba[0], 0);
+    EXPECT_EQ(rgba[16], 255);
+    EXPECT_EQ(rgba[16 + 4 * 2], 0);
+    EXPECT_EQ(rgba[16 + 4 + 3], 255);
+}
+
+TEST(gfx, depthToUint16)
+{
+    const auto [fov, near, far, aspectRatio] = agentCameraParameters();
+    EXPECT_EQ(depthToUint16(0.0f, near, far), uint16_t(near / far * 65535.0f + 0.5f));
+    EXPECT_EQ(depthToUint16(1.0f, near, far), 65535);
+
+    // window depth is very non-linear, halfway through the depth range is still right in front of the camera
+    EXPECT_LT(depthToUint16(0.5f, near, far), 20);
+}
+
+TEST(gfx, lodForDistance)
+{
+    EXPECT_EQ(lodForDistance(0.0f, 3), 0);
+    EXPECT_EQ(lodForDistance(lodDistances[0] + 1, 3), 1);
+    EXPECT_EQ(lodForDistance(lodDistances[1] + 1, 3), 2);
+
+    // meshes with fewer levels stay at their coarsest one
+    EXPECT_EQ(lodForDistance(lodDistances[1] + 1, 2), 1);
+    EXPECT_EQ(lodForDistance(1000.0f, 1), 0);
+}
+
+TEST(gfx, transformCache)
+{
+    Scene3D scene;
+    Object3D agent{&scene}, other{&scene}, camera{&agent}, held{&agent}, box{&scene};
+    agent.translate({1, 0, 0});
+    camera.translate({0, 2, 0});
+    held.translate({0, 1, 0});
+    box.translate({5, 0, 0});
+
+    TransformCache cache;
+    cache.build({&camera, &held, &box});
+    EXPECT_EQ(cache.transformation(0), camera.absoluteTransformationMatrix());
+    EXPECT_TRUE(cache.update().empty());
+
+    // moving the agent moves both children, the box stays where it is
+    agent.translate({0, 0, 3});
+    EXPECT_EQ(cache.update(), (std::vector<int>{0, 1}));
+    EXPECT_EQ(cache.transformation(1), held.absoluteTransformationMatrix());
+    EXPECT_TRUE(cache.update().empty());
+
+    // reparented objects rebuild the cache
+    held.setParent(&other);
+    EXPECT_EQ(cache.update().size(), 3u);
+    EXPECT_EQ(cache.transformation(1), held.absoluteTransformationMatrix());
+}
+
+TEST(gfx, occlusionBuffer)
+{
+    // camera at the origin looking down -Z, a wall in front of it
+    OcclusionBuffer occlusion;
+    occlusion.clear(Matrix4::perspectiveProjection(Deg{90.0f}, 2.0f, 0.1f, 100.0f));
+
+    const Range3D unitBox{{-1, -1, -1}, {1, 1, 1}};
+    const auto wall = Matrix4::translation({0, 0, -5}) * Matrix4::scaling({2, 2, 0.1f});
+    occlusion.addOccluder(wall, unitBox);
+
+    EXPECT_FALSE(occlusion.visible({{-1, -1, -10}, {1, 1, -9}}));
+    EXPECT_TRUE(occlusion.visible({{-1, -1, -3}, {1, 1, -2}}));
+    EXPECT_TRUE(occlusion.visible({{6, -1, -10}, {8, 1, -9}}));
+
+    // the occluder doesn't hide itself
+    EXPECT_TRUE(occlusion.visible(transformedBounds(wall, unitBox)));
+
+    // bounds around the camera are always visible
+    EXPECT_TRUE(occlusion.visible({{-1, -1, -1}, {1, 1, 1}}));
+}
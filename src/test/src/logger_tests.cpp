@@ -43,6 +43,9 @@ TEST(logger, concurrency)
     for (int i = 0; i < numThreads; ++i)
         threads[i].join();
 
+    // messages are written by the background thread
+    flushLogs();
+
     std::vector<std::string> lines = Megaverse::splitString(testStream.str(), "\n");
     int threadIdx = 0;
     for (auto &line : lines)
@@ -56,3 +59,22 @@ TEST(logger, concurrency)
         EXPECT_LE(threadIdx, numThreads);
     }
 }
+
+TEST(logger, disabledLevelsAreNotEvaluated)
+{
+    int evaluated = 0;
+    const auto sideEffect = [&evaluated] { return ++evaluated; };
+
+    setLogLevel(WARNING);
+    TLOG(DEBUG) << sideEffect();
+    TLOG_IF(INFO, true) << sideEffect();
+    EXPECT_EQ(evaluated, 0);
+
+    setLogLevel(DEBUG);
+    TLOG_IF(INFO, false) << sideEffect();
+    EXPECT_EQ(evaluated, 0);
+
+    TLOG(DEBUG) << sideEffect();
+    EXPECT_EQ(evaluated, 1);
+    flushLogs();
+}
@@ -1,9 +1,12 @@
+#include <fstream>
+
 #include <gtest/gtest.h>
 
 #include <util/tiny_logger.hpp>
 
 #include <mazes/kruskal.h>
 #include <mazes/honeycombmaze.h>
+#include <mazes/honeycombmazepool.h>
 
 
 using namespace Megaverse;
@@ -24,9 +27,84 @@ TEST(maze, honeycomb)
     TLOG(DEBUG) << "Rendering maze to '" << outputprefix << ".svg'...";
     maze->PrintMazeSVG(outputprefix);
 
-    auto adjList = maze->getAdjacencyList();
+    EXPECT_EQ(maze->getGraph().Vertices(), 3 * size * (size - 1) + 1);
     const auto [xmin, ymin, xmax, ymax] = maze->GetCoordinateBounds();
     TLOG(DEBUG) << xmin << " " << ymin << " " << xmax << " " << ymax;
 
     TLOG(DEBUG) << system("eog /tmp/maze.svg");
 }
+
+TEST(maze, honeycombPool)
+{
+    for (int size = 2; size < 10; ++size) {
+        HoneyCombMaze maze{size};
+        maze.InitialiseGraph();
+
+        const int numBorders = maze.getGraph().Edges();
+
+        const auto compact = HoneyCombMazePool::Generate(size, 42);
+        const int numCells = 3 * size * (size - 1) + 1;
+        EXPECT_EQ(int(compact.cellCenters.size()), numCells);
+
+        // each interior border is listed twice, spanning tree removes numCells - 1 of them
+        int numInterior = 0;
+        for (const auto &wall : compact.walls) {
+            EXPECT_NEAR(wall.halfLength, 0.5f, 1e-5f);
+            numInterior += wall.cell2 != -1;
+        }
+        const int numOuter = int(compact.walls.size()) - numInterior;
+        EXPECT_EQ((numBorders - numOuter) / 2 - (numCells - 1), numInterior);
+
+        // same seed, same maze
+        const auto other = HoneyCombMazePool::Generate(size, 42);
+        ASSERT_EQ(other.walls.size(), compact.walls.size());
+        for (size_t i = 0; i < compact.walls.size(); ++i)
+            EXPECT_EQ(other.walls[i].cell2, compact.walls[i].cell2);
+    }
+
+    EXPECT_EQ(&HoneyCombMazePool::Get(5, 3), &HoneyCombMazePool::Get(5, 3));
+}
+
+TEST(maze, mazePack)
+{
+    std::vector<CompactMaze> mazes;
+    for (int size = 3; size < 6; ++size)
+        mazes.push_back(HoneyCombMazePool::Generate(size, unsigned(size)));
+
+    const std::string filename = "/tmp/megaverse_test.mzpack";
+    ASSERT_TRUE(WriteMazePack(filename, kHoneyCombMaze, mazes));
+
+    MazeType type;
+    std::vector<CompactMaze> loaded;
+    ASSERT_TRUE(ReadMazePack(filename, &type, &loaded));
+    EXPECT_EQ(type, kHoneyCombMaze);
+    ASSERT_EQ(loaded.size(), mazes.size());
+
+    for (size_t i = 0; i < mazes.size(); ++i) {
+        EXPECT_EQ(loaded[i].size, mazes[i].size);
+        EXPECT_EQ(loaded[i].xmax, mazes[i].xmax);
+        EXPECT_EQ(loaded[i].cellCenters, mazes[i].cellCenters);
+        ASSERT_EQ(loaded[i].walls.size(), mazes[i].walls.size());
+        for (size_t w = 0; w < mazes[i].walls.size(); ++w) {
+            EXPECT_EQ(loaded[i].walls[w].cx, mazes[i].walls[w].cx);
+            EXPECT_EQ(loaded[i].walls[w].cell2, mazes[i].walls[w].cell2);
+        }
+    }
+
+    ASSERT_TRUE(HoneyCombMazePool::LoadPack(filename));
+    EXPECT_EQ(HoneyCombMazePool::NumMazes(4), 1);
+    EXPECT_EQ(HoneyCombMazePool::NumMazes(7), HoneyCombMazePool::kMazesPerSize);
+    EXPECT_EQ(HoneyCombMazePool::Get(4, 0).walls.size(), mazes[1].walls.size());
+
+    // cells offset of the first record (after the 16-byte header and 48 bytes of the record), wraps around when the
+    // size of the cells is added
+    {
+        std::fstream file{filename, std::ios::in | std::ios::out | std::ios::binary};
+        const uint64_t corruptOffset = ~uint64_t(0) - 8;
+        file.seekp(64);
+        file.write(reinterpret_cast<const char *>(&corruptOffset), sizeof(corruptOffset));
+    }
+    EXPECT_FALSE(ReadMazePack(filename, &type, &loaded));
+
+    remove(filename.c_str());
+}
@@ -0,0 +1,132 @@
+#include <thread>
+#include <vector>
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include <megaverse_c/megaverse_c.h>
+
+
+TEST(MegaverseC, invalidArguments)
+{
+    EXPECT_EQ(megaverse_create(nullptr, 64, 36, 1, 1, 1, 0, nullptr, nullptr, 0), nullptr);
+    EXPECT_EQ(megaverse_create("Empty", 0, 36, 1, 1, 1, 0, nullptr, nullptr, 0), nullptr);
+    EXPECT_EQ(megaverse_create("Empty", 64, 36, 1, 1, 1, 0, nullptr, nullptr, 1), nullptr);
+
+    // would abort in Scenario::create()
+    EXPECT_EQ(megaverse_create("NoSuchScenario", 64, 36, 1, 1, 1, 0, nullptr, nullptr, 0), nullptr);
+
+    const char *names[] = {nullptr};
+    const float values[] = {1.0f};
+    EXPECT_EQ(megaverse_create("Empty", 64, 36, 1, 1, 1, 0, names, values, 1), nullptr);
+
+    EXPECT_EQ(megaverse_reset(nullptr), -1);
+    EXPECT_EQ(megaverse_step(nullptr), -1);
+    EXPECT_EQ(megaverse_num_envs(nullptr), -1);
+    EXPECT_EQ(megaverse_set_num_active_envs(nullptr, 1), -1);
+    EXPECT_EQ(megaverse_get_observations(nullptr), nullptr);
+    EXPECT_EQ(megaverse_get_dones(nullptr), nullptr);
+    megaverse_seed(nullptr, 0);
+    megaverse_destroy(nullptr);
+}
+
+TEST(MegaverseC, step)
+{
+    constexpr int numEnvs = 2, numAgents = 2;
+    const char *names[] = {"episodeLengthSec"};
+    const float values[] = {5.0f};
+
+    auto env = megaverse_create("empty", 64, 36, numEnvs, numAgents, 1, 0, names, values, 1);
+    ASSERT_NE(env, nullptr);
+    EXPECT_EQ(megaverse_num_envs(env), numEnvs);
+    EXPECT_EQ(megaverse_num_agents_per_env(env), numAgents);
+
+    // ray traced frames need no GPU
+    megaverse_set_cpu_rendering(env, 1);
+    EXPECT_EQ(megaverse_set_observation_format(env, MegaverseObservationFormat(42), 1), -1);
+    megaverse_seed(env, 42);
+    ASSERT_EQ(megaverse_reset(env), 0);
+
+    int shape[8];
+    ASSERT_EQ(megaverse_observation_shape(env, shape, 8), 3);
+    EXPECT_EQ(shape[0], 36);
+    EXPECT_EQ(shape[1], 64);
+
+    EXPECT_EQ(megaverse_set_num_active_envs(env, 0), -1);
+    EXPECT_EQ(megaverse_set_num_active_envs(env, numEnvs + 1), -1);
+
+    const auto numActionSpaces = megaverse_action_space_sizes(nullptr, 0);
+    ASSERT_GT(numActionSpaces, 0);
+    std::vector<int32_t> actions(numEnvs * numAgents * numActionSpaces, 0);
+
+    EXPECT_EQ(megaverse_set_actions(env, nullptr, numEnvs * numAgents, numActionSpaces), -1);
+    EXPECT_EQ(megaverse_set_actions(env, actions.data(), numEnvs * numAgents - 1, numActionSpaces), -1);
+    EXPECT_EQ(megaverse_set_actions(env, actions.data(), numEnvs * numAgents, numActionSpaces + 1), -1);
+    actions[1] = -1;
+    EXPECT_EQ(megaverse_set_actions(env, actions.data(), numEnvs * numAgents, numActionSpaces), -1);
+    actions[1] = 0;
+
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_EQ(megaverse_set_actions(env, actions.data(), numEnvs * numAgents, numActionSpaces), 0);
+        ASSERT_EQ(megaverse_step(env), 0);
+
+        EXPECT_NE(megaverse_get_observations(env), nullptr);
+        EXPECT_NE(megaverse_get_rewards(env), nullptr);
+        EXPECT_NE(megaverse_get_dones(env), nullptr);
+    }
+
+    ASSERT_EQ(megaverse_step_async(env), 0);
+    ASSERT_EQ(megaverse_step_wait(env), 0);
+
+    megaverse_destroy(env);
+}
+
+TEST(MegaverseC, xlaStepCpu)
+{
+    constexpr int numEnvs = 2, numAgents = 1;
+    auto env = megaverse_create("Empty", 64, 36, numEnvs, numAgents, 1, 0, nullptr, nullptr, 0);
+    ASSERT_NE(env, nullptr);
+    megaverse_set_cpu_rendering(env, 1);
+    ASSERT_EQ(megaverse_reset(env), 0);
+
+    int shape[3];
+    ASSERT_EQ(megaverse_observation_shape(env, shape, 3), 3);
+    const auto numActionSpaces = megaverse_action_space_sizes(nullptr, 0);
+
+    std::vector<int32_t> actions(numEnvs * numAgents * numActionSpaces, 0);
+    const auto handle = uint64_t(uintptr_t(env));
+    std::vector<uint8_t> obs(size_t(numEnvs * numAgents) * shape[0] * shape[1] * shape[2], 0xff);
+    std::vector<float> rewards(numEnvs * numAgents, -1);
+    std::vector<uint8_t> dones(numEnvs, 0xff);
+
+    const void *in[] = {actions.data(), &handle};
+    void *out[] = {obs.data(), rewards.data(), dones.data()};
+
+    // XLA calls the target on its own threads
+    std::thread{[&] { megaverse_xla_step_cpu(out, in); }}.join();
+
+    EXPECT_EQ(memcmp(obs.data(), megaverse_get_observations(env), obs.size()), 0);
+    EXPECT_EQ(memcmp(rewards.data(), megaverse_get_rewards(env), rewards.size() * sizeof(float)), 0);
+    EXPECT_EQ(memcmp(dones.data(), megaverse_get_dones(env), dones.size()), 0);
+
+    // the legacy API has no status, out of range actions abort
+    actions[0] = 1000;
+    EXPECT_EXIT(megaverse_xla_step_cpu(out, in), ::testing::ExitedWithCode(255), "");
+
+    megaverse_destroy(env);
+}
+
+TEST(MegaverseC, xlaRejectsOpenGL)
+{
+    auto env = megaverse_create("Empty", 64, 36, 1, 1, 1, 0, nullptr, nullptr, 0);
+    ASSERT_NE(env, nullptr);
+
+    std::vector<int32_t> actions(megaverse_action_space_sizes(nullptr, 0), 0);
+    const auto handle = uint64_t(uintptr_t(env));
+    const void *in[] = {actions.data(), &handle};
+
+    // the legacy API has no status, steps that can't be done abort
+    EXPECT_EXIT(megaverse_xla_step_cpu(nullptr, in), ::testing::ExitedWithCode(255), "");
+
+    megaverse_destroy(env);
+}
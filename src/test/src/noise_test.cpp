@@ -8,6 +8,8 @@
 #include <util/util.hpp>
 #include <util/perlin_noise.hpp>
 
+#include <scenarios/heightmap_pool.hpp>
+
 
 using namespace Megaverse;
 
@@ -222,3 +224,47 @@ TEST(util, perlinNoise)
         }
     }
 }
+
+TEST(util, perlinNoiseRow)
+{
+    Megaverse::Rng rng{42};
+
+    for (int i = 0; i < 20; ++i) {
+        const siv::PerlinNoise perlin(uint32_t(randRange(0, 1000000000, rng)));
+        const std::int32_t octaves = randRange(1, 10, rng);
+        const double fx = 42 / (double(randRange(1, 100, rng)) / 10.0), fz = fx * 0.7;
+
+        std::vector<double> zs(40), row(zs.size());
+        for (size_t z = 0; z < zs.size(); ++z)
+            zs[z] = double(z) / fz;
+
+        for (int x = 0; x < 40; ++x) {
+            perlin.accumulatedOctaveNoise2DRow_0_1(x / fx, zs.data(), zs.size(), octaves, row.data());
+
+            // bit-exact, so layouts don't change
+            for (size_t z = 0; z < zs.size(); ++z)
+                EXPECT_EQ(row[z], perlin.accumulatedOctaveNoise2D_0_1(x / fx, zs[z], octaves));
+        }
+    }
+}
+
+TEST(util, heightmapPool)
+{
+    // fields don't depend on which thread generated them
+    HeightmapPool pool1{42, 16, 7}, pool2{42, 16, 7};
+
+    for (int i = 15; i >= 0; --i) {
+        const auto &h1 = pool1.heightmap(i), &h2 = pool2.heightmap(i);
+        EXPECT_EQ(h1.noise, h2.noise);
+
+        for (double v : h1.noise)
+            EXPECT_TRUE(v >= 0 && v <= 1);
+
+        // mirrored x and z is the same as swapping the axes twice and mirroring
+        EXPECT_EQ(pool1.noise(h1, 6, 3, 5), pool1.noise(h1, 7, 5, 3));
+        EXPECT_EQ(pool1.noise(h1, 0, 0, 0), pool1.noise(h1, 6, 41, 41));
+    }
+
+    EXPECT_EQ(&HeightmapPool::get(42, 16, 7), &HeightmapPool::get(42, 16, 7));
+    EXPECT_NE(&HeightmapPool::get(42, 16, 7), &HeightmapPool::get(42, 16, 8));
+}
@@ -0,0 +1,60 @@
+#include <thread>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <util/shared_memory.hpp>
+
+
+using namespace Megaverse;
+
+
+TEST(sharedMemory, attach)
+{
+    const std::string name = "/megaverse_test_" + std::to_string(getpid());
+
+    auto shm = SharedMemory::create(name, 4096);
+    ASSERT_TRUE(shm.isOpen());
+    EXPECT_EQ(shm.data()[100], 0);
+    shm.data()[100] = 42;
+
+    {
+        auto other = SharedMemory::attach(name);
+        ASSERT_TRUE(other.isOpen());
+        EXPECT_EQ(other.size(), 4096u);
+        EXPECT_EQ(other.data()[100], 42);
+
+        other.data()[200] = 7;
+    }
+
+    EXPECT_EQ(shm.data()[200], 7);
+
+    // the owner unlinks the name
+    shm = SharedMemory{};
+    EXPECT_FALSE(SharedMemory::attach(name).isOpen());
+}
+
+TEST(sharedMemory, futexPingPong)
+{
+    constexpr uint32_t numRounds = 1000;
+    std::atomic<uint32_t> word{0};
+
+    // each side waits for the other one to advance the counter
+    auto player = [&word](uint32_t parity) {
+        for (uint32_t v = parity; v < 2 * numRounds; v += 2) {
+            uint32_t curr;
+            while ((curr = word.load()) != v)
+                futexWait(word, curr);
+
+            word.store(v + 1);
+            futexWakeAll(word);
+        }
+    };
+
+    std::thread t{player, 1};
+    player(0);
+    t.join();
+
+    EXPECT_EQ(word.load(), 2 * numRounds);
+}
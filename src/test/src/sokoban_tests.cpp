@@ -0,0 +1,70 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <gtest/gtest.h>
+
+#include <util/filesystem_utils.hpp>
+
+#include <scenarios/sokoban_levels.hpp>
+
+
+using namespace Megaverse;
+
+
+TEST(sokoban, levelDatabase)
+{
+    char dirTemplate[] = "/tmp/megaverse_sokoban_XXXXXX";
+    const std::string dir = mkdtemp(dirTemplate);
+
+    const std::string level0 = "; 0\n#####\n#@$.#\n#####\n\n", level1 = "; 1\n####\n#@*#\n#  #\n####\n";
+    const std::string file0 = level0 + level1, file1 = "; 0\n###\n#@#\n###\n";
+
+    writeFileAtomic(pathJoin(dir, "000.txt"), file0.data(), file0.size());
+    writeFileAtomic(pathJoin(dir, "001.txt"), file1.data(), file1.size());
+
+    const auto files = SokobanLevelDatabase::levelFiles(dir);
+    ASSERT_EQ(files.size(), 2u);
+
+    // levels of different sizes within one database are restored exactly
+    const auto &db = SokobanLevelDatabase::get(dir);
+    ASSERT_EQ(db.size(), 3u);
+    EXPECT_EQ(db.level(0).rows, (std::vector<std::string>{"#####", "#@$.#", "#####"}));
+    EXPECT_EQ(db.level(1).rows, (std::vector<std::string>{"####", "#@*#", "#  #", "####"}));
+    EXPECT_EQ(db.level(2).rows, (std::vector<std::string>{"###", "#@#", "###"}));
+
+    EXPECT_TRUE(db.cell(0, SokobanPlane::Wall, 0, 4));
+    EXPECT_TRUE(db.cell(1, SokobanPlane::Box, 1, 2) && db.cell(1, SokobanPlane::Goal, 1, 2));
+    EXPECT_FALSE(db.cell(2, SokobanPlane::Floor, 0, 3));
+
+    // pre-merged blocks cover every floor and wall cell exactly once
+    for (size_t levelIdx = 0; levelIdx < db.size(); ++levelIdx) {
+        std::vector<int> covered(size_t(db.rows() * db.cols()) * 2, 0);
+        const auto rects = db.rects(levelIdx);
+        for (auto r = rects.first; r != rects.second; ++r)
+            for (int x = r->x0; x <= r->x1; ++x)
+                for (int z = r->z0; z <= r->z1; ++z)
+                    ++covered[size_t((x * db.cols() + z) * 2 + (SokobanPlane(r->plane) == SokobanPlane::Wall))];
+
+        for (int x = 0; x < db.rows(); ++x)
+            for (int z = 0; z < db.cols(); ++z) {
+                const auto idx = size_t((x * db.cols() + z) * 2);
+                EXPECT_EQ(covered[idx], int(db.cell(levelIdx, SokobanPlane::Floor, x, z)));
+                EXPECT_EQ(covered[idx + 1], int(db.cell(levelIdx, SokobanPlane::Wall, x, z)));
+            }
+    }
+
+    // level 0: one floor block and four wall blocks
+    EXPECT_EQ(db.rects(0).second - db.rects(0).first, 1 + 4);
+
+    const auto cache = SokobanLevelDatabase::cacheFilename(dir);
+    const auto mapped = SokobanLevelDatabase::load(cache);
+    ASSERT_NE(mapped, nullptr);
+    ASSERT_EQ(mapped->size(), 3u);
+    EXPECT_EQ(mapped->level(1).rows, db.level(1).rows);
+    EXPECT_EQ(mapped->rects(1).second - mapped->rects(1).first, db.rects(1).second - db.rects(1).first);
+
+    std::remove(cache.c_str());
+    for (const auto &f : files)
+        std::remove(f.c_str());
+    std::remove(dir.c_str());
+}
@@ -0,0 +1,69 @@
+#include <thread>
+#include <vector>
+#include <numeric>
+
+#include <gtest/gtest.h>
+
+#include <util/tcp_socket.hpp>
+
+
+using namespace Megaverse;
+
+
+TEST(tcpSocket, loopback)
+{
+    auto listener = TcpSocket::listen(0);
+    ASSERT_TRUE(listener.isOpen());
+    const auto port = listener.localPort();
+    ASSERT_GT(port, 0);
+
+    // larger than the socket buffers, so both sides have to loop
+    std::vector<uint8_t> payload(4 << 20);
+    std::iota(payload.begin(), payload.end(), uint8_t(0));
+
+    std::thread client{[&] {
+        auto socket = TcpSocket::connect("127.0.0.1", port);
+        ASSERT_TRUE(socket.isOpen());
+        EXPECT_TRUE(socket.sendValue(uint32_t(42)));
+        EXPECT_TRUE(socket.sendAll(payload.data(), payload.size()));
+
+        uint32_t reply = 0;
+        EXPECT_TRUE(socket.recvValue(reply));
+        EXPECT_EQ(reply, 43u);
+    }};
+
+    auto connection = listener.accept(5000);
+    ASSERT_TRUE(connection.isOpen());
+
+    uint32_t value = 0;
+    std::vector<uint8_t> received(payload.size());
+    EXPECT_TRUE(connection.recvValue(value));
+    EXPECT_TRUE(connection.recvAll(received.data(), received.size()));
+    EXPECT_EQ(value, 42u);
+    EXPECT_EQ(received, payload);
+    EXPECT_TRUE(connection.sendValue(value + 1));
+
+    client.join();
+
+    // the client is gone
+    EXPECT_FALSE(connection.recvValue(value));
+    EXPECT_FALSE(connection.isOpen());
+    EXPECT_FALSE(listener.accept(10).isOpen());
+}
+
+TEST(tcpSocket, parseHostPort)
+{
+    std::string host;
+    int port = 0;
+
+    EXPECT_TRUE(parseHostPort("gpu-node-3:5555", host, port));
+    EXPECT_EQ(host, "gpu-node-3");
+    EXPECT_EQ(port, 5555);
+
+    EXPECT_TRUE(parseHostPort("7000", host, port));
+    EXPECT_EQ(host, "");
+    EXPECT_EQ(port, 7000);
+
+    EXPECT_FALSE(parseHostPort("localhost:", host, port));
+    EXPECT_FALSE(parseHostPort("localhost:http", host, port));
+}
@@ -1,8 +1,23 @@
+#include <thread>
+#include <cstring>
 #include <algorithm>
 
 #include <gtest/gtest.h>
 
 #include <util/util.hpp>
+#include <util/lz_block.hpp>
+#include <util/frame_codec.hpp>
+#include <util/lru_cache.hpp>
+#include <util/host_buffer.hpp>
+#include <util/simd_kernels.hpp>
+#include <util/mpmc_queue.hpp>
+#include <util/triple_buffer.hpp>
+#include <util/worker_pool.hpp>
+#include <util/episode_arena.hpp>
+#include <util/memory_report.hpp>
+#include <util/pooled_allocation.hpp>
+#include <util/perf_counters.hpp>
+#include <util/scoped_profiler.hpp>
 
 
 using namespace Megaverse;
@@ -21,3 +36,478 @@ TEST(util, memcpyStride)
     range = std::equal_range(std::begin(ones), std::end(ones), 1);
     EXPECT_TRUE(range.first == std::begin(ones) && range.second == std::end(ones));
 }
+
+TEST(util, lruCache)
+{
+    LruCache<int, int> cache{2};
+
+    cache.put(1, std::make_shared<int>(10));
+    cache.put(2, std::make_shared<int>(20));
+    EXPECT_EQ(*cache.get(1), 10);
+    EXPECT_TRUE(cache.contains(2));
+
+    // 2 is the least recently used entry
+    cache.put(3, std::make_shared<int>(30));
+    EXPECT_FALSE(cache.contains(2));
+    EXPECT_EQ(cache.get(2), nullptr);
+    EXPECT_EQ(*cache.get(1), 10);
+    EXPECT_EQ(*cache.get(3), 30);
+    EXPECT_EQ(cache.hits(), 3u);
+    EXPECT_EQ(cache.misses(), 1u);
+
+    cache.setCapacity(0);
+    EXPECT_EQ(cache.size(), 0u);
+    cache.put(4, std::make_shared<int>(40));
+    EXPECT_EQ(cache.get(4), nullptr);
+}
+
+TEST(util, profilerHistogram)
+{
+    ProfilerHistogram h;
+    for (uint64_t i = 1; i <= 1000; ++i)
+        h.add(i * 1000);
+
+    EXPECT_EQ(h.count, 1000u);
+    EXPECT_EQ(h.maxNs, 1000000u);
+
+    // one bucket is a quarter of an octave wide
+    EXPECT_NEAR(h.percentile(0.5), 500000.0, 500000.0 * 0.2);
+    EXPECT_NEAR(h.percentile(0.99), 990000.0, 990000.0 * 0.2);
+    EXPECT_LE(h.percentile(1.0), 1000000.0);
+}
+
+TEST(util, scopedProfiler)
+{
+    auto &p = sprof();
+    p.setEnabled(true);
+    p.clear();
+
+    for (int i = 0; i < 10; ++i) {
+        PROFILE_ZONE("test_outer");
+        PROFILE_ZONE("test_inner");
+    }
+
+    p.setEnabled(false);
+    {
+        PROFILE_ZONE("test_outer");
+    }
+
+    p.collect();
+    EXPECT_EQ(p.histogram("test_outer").count, 10u);
+    EXPECT_EQ(p.histogram("test_inner").count, 10u);
+    EXPECT_EQ(p.histogram("no_such_zone").count, 0u);
+    EXPECT_EQ(p.droppedEvents(), 0u);
+
+    // GPU durations are recorded as they are, not measured on the host
+    p.recordGpu(p.registerZone("test_gpu"), ScopedProfiler::nowNs(), 1'000'000);
+    p.collect();
+    EXPECT_EQ(p.histogram("test_gpu").count, 1u);
+    EXPECT_EQ(p.histogram("test_gpu").maxNs, 1'000'000u);
+}
+
+TEST(util, perfCounters)
+{
+    PerfCounters perf;
+    if (!perf.valid())
+        GTEST_SKIP() << "perf_event not available";
+
+    auto &p = sprof();
+    p.setEnabled(true);
+    p.clear();
+    ASSERT_TRUE(p.setCountersEnabled(true));
+
+    volatile uint64_t sum = 0;
+    {
+        PROFILE_ZONE("test_counted");
+        for (int i = 0; i < 100000; ++i)
+            sum = sum + uint64_t(i);
+    }
+
+    p.setCountersEnabled(false);
+    p.setEnabled(false);
+
+    const auto c = p.counters("test_counted");
+    EXPECT_GT(c.instructions, 100000u);
+    EXPECT_GT(c.cycles, 0u);
+    EXPECT_EQ(p.counters("no_such_zone").instructions, 0u);
+
+    p.clear();
+    EXPECT_EQ(p.counters("test_counted").instructions, 0u);
+}
+
+namespace
+{
+
+struct PooledBase
+{
+    virtual ~PooledBase() = default;
+    int value = 0;
+};
+
+struct PooledNode : public PooledBase, public PooledAllocation<PooledNode> {};
+
+struct BiggerNode : public PooledNode
+{
+    double extra[4]{};
+};
+
+}
+
+TEST(util, hostBuffer)
+{
+    static int numPinned = 0;
+    setHostMemoryPinning({[](void *, size_t) { ++numPinned; return true; }, [](void *) { --numPinned; }});
+
+    for (auto policy : {HostMemoryPolicy::Pageable, HostMemoryPolicy::HugePages, HostMemoryPolicy::Pinned}) {
+        HostBuffer buffer{(size_t(5) << 20) + 3, policy};
+        ASSERT_NE(buffer.data(), nullptr);
+        EXPECT_EQ(uintptr_t(buffer.data()) % 4096, 0u);
+        EXPECT_TRUE(std::all_of(buffer.data(), buffer.data() + buffer.size(), [](uint8_t b) { return b == 0; }));
+        memset(buffer.data(), 0xab, buffer.size());
+
+        EXPECT_EQ(buffer.isPinned(), policy == HostMemoryPolicy::Pinned);
+        EXPECT_EQ(numPinned, int(buffer.isPinned()));
+        EXPECT_TRUE(policy != HostMemoryPolicy::Pageable || !buffer.hasHugePages());
+
+        // moves keep a single owner of the pinned range
+        HostBuffer moved{std::move(buffer)};
+        EXPECT_EQ(buffer.data(), nullptr);
+        EXPECT_EQ(moved.data()[0], 0xab);
+
+        moved.resize(1000);
+        EXPECT_EQ(moved.size(), 1000u);
+        EXPECT_EQ(moved.data()[0], 0);
+        EXPECT_EQ(moved.policy(), policy);
+    }
+
+    EXPECT_EQ(numPinned, 0);
+    setHostMemoryPinning({});
+}
+
+TEST(util, pooledAllocation)
+{
+    PooledBase *node = new PooledNode;
+    const void *mem = node;
+    delete node;
+
+    // freed block is reused, derived classes of a different size don't touch the pool
+    PooledBase *bigger = new BiggerNode;
+    node = new PooledNode;
+    EXPECT_EQ(mem, node);
+
+    delete bigger;
+    delete node;
+}
+
+TEST(util, memoryReport)
+{
+    const auto live = PooledNode::memoryCounter().liveBytes();
+    auto node = new PooledNode;
+    EXPECT_EQ(PooledNode::memoryCounter().liveBytes(), live + sizeof(PooledNode));
+    delete node;
+    EXPECT_EQ(PooledNode::memoryCounter().liveBytes(), live);
+
+    MemoryCounter counter;
+    counter.allocated(100), counter.allocated(50), counter.freed(100);
+    EXPECT_EQ(counter.liveBytes(), 50u);
+    EXPECT_EQ(counter.peakBytes(), 150u);
+    counter.freed(1000);
+    EXPECT_EQ(counter.liveBytes(), 0u);
+
+    MemoryReport env, report;
+    env.add("voxel_grid", 10), env.add("physics", 20), env.add("voxel_grid", 5);
+    report.merge(env, "env."), report.merge(env, "env.");
+    report.add("process.rss", 1000), report.add("gpu.framebuffers", 300);
+
+    EXPECT_EQ(report.get("env.voxel_grid"), 30u);
+    EXPECT_EQ(report.total("env."), 70u);
+    EXPECT_EQ(report.total(), 70u);
+    EXPECT_EQ(report.total("process."), 1000u);
+    EXPECT_EQ(report.total("gpu."), 300u);
+    EXPECT_NE(report.toString().find("env.physics"), std::string::npos);
+}
+
+TEST(util, episodeArena)
+{
+    static int numDestroyed = 0;
+
+    struct Tracked
+    {
+        explicit Tracked(int v) : v{v} {}
+        ~Tracked() { ++numDestroyed; }
+        int v;
+    };
+
+    EpisodeArena arena{256};
+
+    auto a = arena.create<Tracked>(1);
+    auto aligned = arena.allocate(8, 64);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 64, 0u);
+
+    // bigger than a block
+    auto big = arena.allocate(1000);
+    ASSERT_NE(big, nullptr);
+    EXPECT_EQ(a->v, 1);
+
+    const auto reserved = arena.bytesReserved();
+    arena.release();
+    EXPECT_EQ(numDestroyed, 1);
+    EXPECT_EQ(arena.bytesAllocated(), 0u);
+
+    // same pattern again fits into the retained blocks
+    arena.create<Tracked>(2);
+    arena.allocate(8, 64);
+    arena.allocate(1000);
+    EXPECT_EQ(arena.bytesReserved(), reserved);
+}
+
+TEST(util, tripleBuffer)
+{
+    TripleBuffer<std::array<int, 64>> buffer;
+    EXPECT_FALSE(buffer.update());
+
+    buffer.writeSlot().fill(1);
+    buffer.publish();
+    buffer.writeSlot().fill(2);
+    buffer.publish();
+
+    // only the latest value is seen
+    EXPECT_TRUE(buffer.update());
+    EXPECT_EQ(buffer.readSlot()[0], 2);
+    EXPECT_FALSE(buffer.update());
+
+    // consumer never sees a slot that is being written
+    constexpr int numValues = 100000;
+    std::thread producer{[&buffer] {
+        for (int v = 3; v <= numValues; ++v) {
+            buffer.writeSlot().fill(v);
+            buffer.publish();
+        }
+    }};
+
+    int last = 2;
+    while (last < numValues) {
+        if (!buffer.update())
+            continue;
+
+        const auto &slot = buffer.readSlot();
+        EXPECT_GT(slot[0], last);
+        EXPECT_TRUE(std::all_of(slot.begin(), slot.end(), [&slot](int v) { return v == slot[0]; }));
+        last = slot[0];
+    }
+
+    producer.join();
+}
+
+TEST(util, mpmcQueue)
+{
+    MpmcQueue<int> queue{5};
+    EXPECT_EQ(queue.capacity(), 8u);
+
+    int v;
+    EXPECT_FALSE(queue.pop(v));
+    for (int i = 0; i < 8; ++i)
+        EXPECT_TRUE(queue.push(i));
+    EXPECT_FALSE(queue.push(8));
+
+    EXPECT_TRUE(queue.pop(v));
+    EXPECT_EQ(v, 0);
+
+    // every value pushed by the producers is popped exactly once
+    while (queue.pop(v)) {}
+
+    constexpr int numProducers = 3, numConsumers = 3, valuesPerProducer = 5000;
+    std::vector<std::atomic<int>> seen(numProducers * valuesPerProducer);
+    std::atomic<int> numPopped{0};
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < numProducers; ++p)
+        threads.emplace_back([&, p] {
+            for (int i = 0; i < valuesPerProducer; ++i)
+                while (!queue.push(p * valuesPerProducer + i))
+                    std::this_thread::yield();
+        });
+
+    for (int c = 0; c < numConsumers; ++c)
+        threads.emplace_back([&] {
+            int value;
+            while (numPopped.load() < numProducers * valuesPerProducer)
+                if (queue.pop(value))
+                    seen[value].fetch_add(1), numPopped.fetch_add(1);
+                else
+                    std::this_thread::yield();
+        });
+
+    for (auto &t : threads)
+        t.join();
+
+    EXPECT_TRUE(std::all_of(seen.begin(), seen.end(), [](const std::atomic<int> &n) { return n.load() == 1; }));
+}
+
+TEST(util, philox)
+{
+    // known answers from the Random123 test vectors
+    const auto zero = Philox4x32::generateBlock({0, 0, 0, 0}, {0, 0});
+    EXPECT_EQ(zero, (std::array<uint32_t, 4>{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+
+    const auto pi = Philox4x32::generateBlock({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0});
+    EXPECT_EQ(pi, (std::array<uint32_t, 4>{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}));
+
+    // a stream can be started directly and matches what it produces when iterated
+    auto a = Philox4x32::forStream(42, 3, 7), b = Philox4x32::forStream(42, 3, 7);
+    b.discard(5);
+    for (int i = 0; i < 5; ++i)
+        a();
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(a(), b());
+
+    auto otherEpisode = Philox4x32::forStream(42, 3, 8), otherStream = Philox4x32::forStream(42, 4, 7);
+    auto c = Philox4x32::forStream(42, 3, 7);
+    const auto first = c();
+    EXPECT_NE(first, otherEpisode());
+    EXPECT_NE(first, otherStream());
+}
+
+TEST(util, lzBlock)
+{
+    std::vector<uint8_t> data;
+    for (int i = 0; i < 100000; ++i)
+        data.push_back(uint8_t(i % 251 < 200 ? i % 7 : i * 31));
+
+    for (size_t size : {size_t(0), size_t(5), size_t(13), data.size()}) {
+        std::vector<uint8_t> compressed, decompressed;
+        lzCompress(data.data(), size, compressed);
+        ASSERT_TRUE(lzDecompress(compressed.data(), compressed.size(), size, decompressed));
+        EXPECT_TRUE(std::equal(decompressed.begin(), decompressed.end(), data.begin(), data.begin() + size));
+
+        if (size == data.size()) {
+            EXPECT_LT(compressed.size(), size / 4);
+
+            // wrong size or truncated blocks are rejected
+            EXPECT_FALSE(lzDecompress(compressed.data(), compressed.size(), size + 1, decompressed));
+            EXPECT_FALSE(lzDecompress(compressed.data(), compressed.size() / 2, size, decompressed));
+        }
+    }
+
+    // empty block into an empty output, and a sequence without literals
+    std::vector<uint8_t> empty;
+    EXPECT_TRUE(lzDecompress(nullptr, 0, 0, empty));
+    EXPECT_TRUE(empty.empty());
+
+    const std::vector<uint8_t> block{0x10, 'a', 1, 0, 0x00, 1, 0, 0x10, 'b'};
+    std::vector<uint8_t> decompressed;
+    ASSERT_TRUE(lzDecompress(block.data(), block.size(), 10, decompressed));
+    EXPECT_EQ(std::string(decompressed.begin(), decompressed.end()), "aaaaaaaaab");
+}
+
+TEST(util, frameCodec)
+{
+    // RGBA frames of a scene that moves by one pixel per frame
+    constexpr int w = 64, h = 32;
+    constexpr size_t frameBytes = w * h * 4;
+
+    auto makeFrame = [&](int t) {
+        std::vector<uint8_t> frame(frameBytes);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x) {
+                auto p = frame.data() + (y * w + x) * 4;
+                p[0] = uint8_t(x * 3 + t), p[1] = uint8_t(y * 5), p[2] = uint8_t((x + t) / 8 * 40), p[3] = 255;
+            }
+        return frame;
+    };
+
+    FrameEncoder encoder{frameBytes, 4};
+    FrameDecoder decoder{frameBytes};
+    std::vector<uint8_t> decoded(frameBytes);
+
+    std::vector<std::vector<uint8_t>> stream;
+    for (int t = 0; t < 10; ++t) {
+        const auto frame = makeFrame(t);
+        stream.emplace_back();
+        encoder.encode(frame.data(), t == 6, stream.back());
+        EXPECT_LE(stream.back().size(), FrameEncoder::maxEncodedBytes(frameBytes));
+
+        ASSERT_TRUE(decoder.decode(stream.back().data(), stream.back().size(), decoded.data()));
+        EXPECT_EQ(decoded, frame);
+    }
+
+    const auto isKeyframe = [&](int t) { return (stream[t][0] & FrameEncoder::KEYFRAME) != 0; };
+    EXPECT_TRUE(isKeyframe(0) && isKeyframe(4) && isKeyframe(6));
+    EXPECT_FALSE(isKeyframe(1) || isKeyframe(5) || isKeyframe(7));
+    EXPECT_LT(stream[1].size(), stream[0].size());
+
+    // a decoder that joins mid-stream waits for the next key frame
+    FrameDecoder lateDecoder{frameBytes};
+    EXPECT_FALSE(lateDecoder.decode(stream[5].data(), stream[5].size(), decoded.data()));
+    EXPECT_TRUE(lateDecoder.decode(stream[6].data(), stream[6].size(), decoded.data()));
+    EXPECT_TRUE(lateDecoder.decode(stream[7].data(), stream[7].size(), decoded.data()));
+    EXPECT_EQ(decoded, makeFrame(7));
+}
+
+TEST(util, simdKernels)
+{
+    EXPECT_TRUE(simdLevelSupported(SimdLevel::Scalar));
+    EXPECT_TRUE(simdLevelSupported(maxSimdLevel()));
+    EXPECT_LE(subtractBytesDispatch().level(), maxSimdLevel());
+
+    // odd sizes exercise the scalar tails, the offset the unaligned loads
+    Philox4x32 rng{7};
+    for (const size_t n : {size_t(0), size_t(1), size_t(31), size_t(64), size_t(1000)}) {
+        std::vector<uint8_t> a(n + 1), b(n + 1);
+        for (size_t i = 0; i < a.size(); ++i)
+            a[i] = uint8_t(rng()), b[i] = uint8_t(rng());
+
+        for (const auto *dispatch : {&subtractBytesDispatch(), &addBytesDispatch()}) {
+            const auto variants = dispatch->available();
+            ASSERT_EQ(variants.front().level, SimdLevel::Scalar);
+
+            std::vector<uint8_t> expected(n);
+            variants.front().fn(a.data() + 1, b.data() + 1, expected.data(), n);
+
+            for (const auto &v : variants) {
+                std::vector<uint8_t> out(n);
+                v.fn(a.data() + 1, b.data() + 1, out.data(), n);
+                EXPECT_EQ(out, expected) << simdLevelName(v.level) << " n=" << n;
+
+                // in place, as FrameDecoder uses it
+                auto inPlace = std::vector<uint8_t>(a.begin() + 1, a.end());
+                v.fn(inPlace.data(), b.data() + 1, inPlace.data(), n);
+                EXPECT_EQ(inPlace, expected) << simdLevelName(v.level) << " n=" << n;
+            }
+        }
+    }
+}
+
+TEST(util, workerPool)
+{
+    WorkerPool pool{3};
+
+    for (const int n : {0, 1, 7, 1000}) {
+        std::vector<std::atomic<int>> visits(static_cast<size_t>(n));
+        pool.parallelFor(n, 4, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i)
+                ++visits[size_t(i)];
+        });
+
+        EXPECT_TRUE(std::all_of(visits.begin(), visits.end(), [](const auto &v) { return v == 1; })) << n;
+    }
+
+    // concurrent callers either get the pool or run inline, every job is complete either way
+    std::vector<std::thread> callers;
+    std::atomic<int> total{0};
+    for (int t = 0; t < 4; ++t)
+        callers.emplace_back([&] {
+            for (int job = 0; job < 50; ++job)
+                pool.parallelFor(64, 8, [&](int begin, int end) { total += end - begin; });
+        });
+    for (auto &t : callers)
+        t.join();
+
+    EXPECT_EQ(total, 4 * 50 * 64);
+    EXPECT_EQ(pool.numParallelJobs() + pool.numInlineJobs(), 4 * 50 + 2 + 1u);
+
+    WorkerPool empty{0};
+    int sum = 0;
+    empty.parallelFor(10, 1, [&](int begin, int end) { sum += end - begin; });
+    EXPECT_EQ(sum, 10);
+}
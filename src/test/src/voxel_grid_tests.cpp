@@ -1,6 +1,10 @@
+#include <utility>
+
 #include <gtest/gtest.h>
 
+#include <util/util.hpp>
 #include <util/voxel_grid.hpp>
+#include <util/voxel_chunk_streamer.hpp>
 
 #include <env/voxel_state.hpp>
 
@@ -53,6 +57,202 @@ TEST(voxelGrid, perf)
                 vg.set({x, y, z}, {x + y + z, "42"});
 }
 
+TEST(voxelGrid, chunked)
+{
+    VoxelGrid<TestVoxelState> vg{100, {0, 0, 0}, 1};
+    ChunkedVoxelGrid<TestVoxelState> chunked{100, {0, 0, 0}, 1};
+
+    Rng rng{42};
+    for (int i = 0; i < 10000; ++i) {
+        const VoxelCoords coords{randRange(-40, 40, rng), randRange(-20, 20, rng), randRange(-40, 40, rng)};
+
+        if (randomBool(rng)) {
+            vg.set(coords, {i, ""});
+            chunked.set(coords, {i, ""});
+        } else {
+            vg.remove(coords);
+            chunked.remove(coords);
+        }
+    }
+
+    int numVoxels = 0;
+    chunked.forEach([&](const VoxelCoords &coords, const TestVoxelState &state) {
+        ++numVoxels;
+        EXPECT_TRUE(vg.hasVoxel(coords));
+        EXPECT_EQ(vg.get(coords)->someInt, state.someInt);
+    });
+
+    EXPECT_EQ(numVoxels, int(vg.getHashMap().size()));
+    EXPECT_EQ(chunked.get({-100, 0, 0}), nullptr);
+}
+
+TEST(voxelGrid, chunkedClear)
+{
+    ChunkedVoxelGrid<TestVoxelState> vg{100, {0, 0, 0}, 1};
+
+    for (int episode = 0; episode < 3; ++episode) {
+        vg.clear();
+        EXPECT_FALSE(vg.hasVoxel({0, 0, episode}));
+
+        for (int x = -5; x < 30; ++x)
+            vg.set({x, 0, episode}, {x, "42"});
+
+        int numVoxels = 0;
+        vg.forEach([&](const VoxelCoords &, const TestVoxelState &) { ++numVoxels; });
+        EXPECT_EQ(numVoxels, 35);  // voxels from previous episodes are gone
+    }
+}
+
+TEST(voxelGrid, copyOnWrite)
+{
+    ChunkedVoxelGrid<TestVoxelState> source{100, {0, 0, 0}, 1};
+    for (int x = -5; x < 30; ++x)
+        source.set({x, 0, 0}, {x, "42"});
+
+    const auto shared = source.share();
+    source.clear();
+
+    ChunkedVoxelGrid<TestVoxelState> a{100, {0, 0, 0}, 1}, b{100, {0, 0, 0}, 1};
+    for (int episode = 0; episode < 2; ++episode) {
+        a.restore(shared), b.restore(shared);
+        EXPECT_EQ(a.memoryBytes(), b.memoryBytes());
+
+        // the first write copies the chunk, the other grid and the snapshot still see the original voxels
+        a.get({3, 0, 0})->someInt = -1;
+        a.remove({4, 0, 0});
+        b.set({5, 0, 0}, {-2, "43"});
+
+        EXPECT_EQ(a.get({3, 0, 0})->someInt, -1);
+        EXPECT_FALSE(a.hasVoxel({4, 0, 0}));
+        EXPECT_EQ(std::as_const(b).get({3, 0, 0})->someInt, 3);
+        EXPECT_TRUE(b.hasVoxel({4, 0, 0}));
+        EXPECT_EQ(std::as_const(a).get({5, 0, 0})->someInt, 5);
+        EXPECT_EQ(b.get({5, 0, 0})->someInt, -2);
+
+        int numVoxels = 0;
+        b.forEach([&](const VoxelCoords &, const TestVoxelState &) { ++numVoxels; });
+        EXPECT_EQ(numVoxels, 35);
+    }
+
+    a.clear();
+    EXPECT_FALSE(a.hasVoxel({10, 0, 0}));
+
+    ChunkedVoxelGrid<TestVoxelState> c{100, {0, 0, 0}, 1};
+    c.restore(shared);
+    EXPECT_EQ(std::as_const(c).get({3, 0, 0})->someInt, 3);
+    EXPECT_EQ(std::as_const(c).get({5, 0, 0})->someString, "42");
+}
+
+TEST(voxelGrid, columnQueries)
+{
+    ChunkedVoxelGrid<VoxelState> vg{100, {0, 0, 0}, 1};
+
+    // solid column from y=-3 to y=20 (spans several chunks), with a gap at y=7
+    for (int y = -3; y <= 20; ++y)
+        if (y != 7)
+            vg.set({2, y, -5}, makeVoxel<VoxelState>(VOXEL_SOLID | VOXEL_OPAQUE));
+
+    EXPECT_EQ(vg.findInColumn(2, -5, -3, 100, VOXEL_SOLID, false), 7);
+    EXPECT_EQ(vg.findInColumn(2, -5, 8, 100, VOXEL_SOLID, false), 21);
+    EXPECT_EQ(vg.findInColumn(2, -5, 30, -30, VOXEL_SOLID, true), 20);
+    EXPECT_EQ(vg.findInColumn(3, -5, 30, -30, VOXEL_SOLID, true), -31);  // nothing found
+
+    EXPECT_TRUE(vg.anyInColumn(2, -5, 5, 7, VOXEL_SOLID));
+    EXPECT_FALSE(vg.anyInColumn(2, -5, 7, 7, VOXEL_SOLID));
+    EXPECT_FALSE(vg.anyInColumn(2, -5, 21, 100, VOXEL_SOLID));
+
+    vg.remove({2, 10, -5});
+    EXPECT_EQ(vg.findInColumn(2, -5, 8, 100, VOXEL_SOLID, false), 10);
+
+    vg.clear();
+    EXPECT_FALSE(vg.anyInColumn(2, -5, -100, 100, VOXEL_SOLID | VOXEL_OPAQUE));
+}
+
+TEST(voxelGrid, setColumn)
+{
+    ChunkedVoxelGrid<VoxelState> chunked{100, {0, 0, 0}, 1};
+    VoxelGrid<VoxelState> vg{100, {0, 0, 0}, 1};
+
+    // across chunk boundaries, and overwriting some existing voxels
+    chunked.set({4, 3, -7}, makeVoxel<VoxelState>(VOXEL_EMPTY));
+    chunked.setColumn(4, -7, -2, 35, makeVoxel<VoxelState>(VOXEL_SOLID, 0, ColorRgb::GREEN));
+    vg.setColumn(4, -7, -2, 35, makeVoxel<VoxelState>(VOXEL_SOLID, 0, ColorRgb::GREEN));
+
+    int numVoxels = 0;
+    chunked.forEach([&](const VoxelCoords &coords, const VoxelState &state) {
+        ++numVoxels;
+        EXPECT_TRUE(vg.hasVoxel(coords));
+        EXPECT_EQ(state.color, ColorRgb::GREEN);
+    });
+    EXPECT_EQ(numVoxels, 38);
+    EXPECT_EQ(numVoxels, int(vg.getHashMap().size()));
+
+    EXPECT_EQ(chunked.findInColumn(4, -7, -10, 100, VOXEL_SOLID, true), -2);
+    EXPECT_EQ(chunked.findInColumn(4, -7, -2, 100, VOXEL_SOLID, false), 36);
+
+    chunked.clear();
+    EXPECT_FALSE(chunked.anyInColumn(4, -7, -100, 100, VOXEL_SOLID));
+}
+
+TEST(voxelGrid, largeCoords)
+{
+    // 1024 apart, these used to share a hash and a packed key
+    VoxelGrid<TestVoxelState> vg{100, {0, 0, 0}, 1};
+    vg.set({100'000, 0, -300'000}, {1, "a"});
+    vg.set({100'000 + 1'024, 0, -300'000}, {2, "b"});
+
+    EXPECT_NE(voxelKey({100'000, 0, -300'000}), voxelKey({100'000 + 1'024, 0, -300'000}));
+    EXPECT_EQ(vg.get({100'000, 0, -300'000})->someInt, 1);
+    EXPECT_EQ(vg.get({101'024, 0, -300'000})->someInt, 2);
+    EXPECT_FALSE(vg.hasVoxel({100'000, 1, -300'000}));
+}
+
+TEST(voxelGrid, chunkStreaming)
+{
+    using Streamer = VoxelChunkStreamer<TestVoxelState>;
+    using Storage = Streamer::Storage;
+
+    // floor at y = 0 everywhere, with the chunk x coord in the voxels so we can tell the chunks apart
+    const auto generate = [](const VoxelCoords &chunkCoords, Streamer::Chunk &chunk) {
+        const auto origin = chunkCoords * Storage::chunkSize;
+        for (int x = 0; x < Storage::chunkSize; ++x)
+            for (int z = 0; z < Storage::chunkSize; ++z)
+                Storage::setInChunk(chunk, origin + VoxelCoords{x, 0, z}, {chunkCoords.x(), ""});
+    };
+
+    Streamer::Options options;
+    options.loadRadius = 1, options.evictRadius = 2, options.numThreads = 2;
+    Streamer streamer{generate, options};
+
+    ChunkedVoxelGrid<TestVoxelState> grid{100, {0, 0, 0}, 1};
+
+    std::vector<VoxelCoords> centers{{0, 5, 0}};
+    streamer.update(grid, centers);
+    streamer.wait();
+    EXPECT_EQ(streamer.update(grid, centers), 9);
+    EXPECT_EQ(streamer.numPending(), 0u);
+    EXPECT_EQ(std::as_const(grid).get({-16, 0, 31})->someInt, -1);
+
+    // walk far away, memory stays bounded by the eviction radius
+    for (int x = 0; x < 100'000; x += 5'000) {
+        centers[0] = {x, 5, 0};
+        streamer.update(grid, centers);
+        streamer.wait();
+        streamer.update(grid, centers);
+
+        EXPECT_LE(grid.numChunks(), 25u);
+        EXPECT_EQ(std::as_const(grid).get({x, 0, 0})->someInt, x >> 4);
+    }
+
+    EXPECT_FALSE(grid.hasVoxel({0, 0, 0}));
+
+    // the new world starts empty, written voxels are cleared with the rest
+    grid.set({centers[0].x(), 1, 0}, {7, ""});
+    streamer.reset(grid);
+    EXPECT_EQ(grid.numChunks(), 0u);
+    EXPECT_FALSE(grid.hasVoxel({centers[0].x(), 1, 0}));
+}
+
 TEST(voxelGrid, voxelState)
 {
     VoxelGrid<VoxelState> vg{0, {0, 0, 0}, 1};